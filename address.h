@@ -21,7 +21,7 @@
 #define HAVE_ADDRESS_H
 
 #include <netinet/in.h>
-#include <netpacket/packet.h>
+#include <linux/if_packet.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -0,0 +1,284 @@
+/**
+ * @file autoservo.c
+ * @brief Implements a servo selecting the best of several other servos.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <math.h>
+#include <stdlib.h>
+
+#include "autoservo.h"
+#include "print.h"
+#include "servo_private.h"
+
+/*
+ * All candidates are fed with each sample, but only the adjustments of
+ * the active one are applied to the clock. Each of the others steers a
+ * virtual clock, whose offset from the real clock is the integral of
+ * the difference between the adjustment applied to the real clock and
+ * the one the candidate asked for, plus the steps the candidate asked
+ * for. A candidate is fed with the offset of its virtual clock, and is
+ * scored by the mean square of that offset while it is locked.
+ *
+ * When a candidate keeps its virtual clock closer to the master than the
+ * active one keeps the real clock, it takes over. Its state is kept, and
+ * its virtual clock is merged into the real clock, which is only a small
+ * change of the offset it sees, so the clock is not stepped.
+ */
+
+/* Smoothing factor of the mean square offsets */
+#define SCORE_SMOOTH 0.05
+/* Number of locked samples before a candidate is scored */
+#define SCORE_MIN_SAMPLES 32
+/* Ratio of the scores required to switch to another candidate */
+#define SWITCH_RATIO 0.5
+/* Number of samples after a switch without another switch */
+#define SWITCH_HOLDOFF 128
+
+struct candidate {
+	struct servo *servo;
+	const char *name;
+	/* Offset of the virtual clock from the real clock in ns */
+	double acc;
+	/* Adjustment returned by the last sample, and the one in effect */
+	double adj;
+	double applied;
+	enum servo_state state;
+	/* Mean square offset of the virtual clock and the number of
+	   locked samples it includes */
+	double score;
+	int samples;
+};
+
+static const struct {
+	enum servo_type type;
+	const char *name;
+} candidate_types[] = {
+	{ CLOCK_SERVO_PI, "pi" },
+	{ CLOCK_SERVO_LINREG, "linreg" },
+	{ CLOCK_SERVO_KALMAN, "kalman" },
+};
+
+#define N_CANDIDATES (sizeof(candidate_types) / sizeof(candidate_types[0]))
+
+struct auto_servo {
+	struct servo servo;
+	struct candidate c[N_CANDIDATES];
+	unsigned int active;
+	/* Adjustment in effect on the real clock */
+	double applied;
+	uint64_t last_ts;
+	int holdoff;
+};
+
+static void auto_destroy(struct servo *servo)
+{
+	struct auto_servo *s = container_of(servo, struct auto_servo, servo);
+	unsigned int i;
+
+	for (i = 0; i < N_CANDIDATES; i++) {
+		if (s->c[i].servo)
+			servo_destroy(s->c[i].servo);
+	}
+	free(s);
+}
+
+static void candidate_sample(struct candidate *c, int64_t offset,
+			     uint64_t local_ts, double weight)
+{
+	double voffset = offset + c->acc;
+
+	c->adj = servo_sample(c->servo, (int64_t) voffset, local_ts, weight,
+			      &c->state);
+
+	if (c->state == SERVO_LOCKED) {
+		if (!c->samples)
+			c->score = voffset * voffset;
+		else
+			c->score += SCORE_SMOOTH *
+				(voffset * voffset - c->score);
+		c->samples++;
+	} else {
+		c->samples = 0;
+	}
+	if (c->state == SERVO_JUMP)
+		c->acc -= voffset;
+	if (c->state != SERVO_UNLOCKED)
+		c->applied = c->adj;
+}
+
+static void auto_select(struct auto_servo *s)
+{
+	struct candidate *a = &s->c[s->active], *c;
+	unsigned int i, best = s->active;
+
+	if (s->holdoff) {
+		s->holdoff--;
+		return;
+	}
+	if (a->samples < SCORE_MIN_SAMPLES)
+		return;
+
+	for (i = 0; i < N_CANDIDATES; i++) {
+		c = &s->c[i];
+		if (c->samples < SCORE_MIN_SAMPLES ||
+		    c->score >= SWITCH_RATIO * a->score ||
+		    c->score >= s->c[best].score)
+			continue;
+		best = i;
+	}
+	if (best == s->active)
+		return;
+
+	pr_info("auto servo: switching from %s to %s (rms %.0f ns, %.0f ns)",
+		a->name, s->c[best].name, sqrt(a->score),
+		sqrt(s->c[best].score));
+	s->active = best;
+	s->c[best].acc = 0.0;
+	s->holdoff = SWITCH_HOLDOFF;
+}
+
+static double auto_sample(struct servo *servo, int64_t offset,
+			  uint64_t local_ts, double weight,
+			  enum servo_state *state)
+{
+	struct auto_servo *s = container_of(servo, struct auto_servo, servo);
+	struct candidate *a, *c;
+	double dt = 0.0;
+	unsigned int i;
+
+	if (s->last_ts && local_ts > s->last_ts)
+		dt = (local_ts - s->last_ts) / 1e9;
+	s->last_ts = local_ts;
+
+	a = &s->c[s->active];
+	for (i = 0; i < N_CANDIDATES; i++) {
+		c = &s->c[i];
+		if (c != a)
+			c->acc += (s->applied - c->applied) * dt;
+		candidate_sample(c, offset, local_ts, weight);
+	}
+	/* The real clock is stepped, which the virtual clocks are not. */
+	if (a->state == SERVO_JUMP) {
+		for (i = 0; i < N_CANDIDATES; i++) {
+			if (&s->c[i] != a)
+				s->c[i].acc += offset;
+		}
+	}
+	if (a->state == SERVO_LOCKED)
+		auto_select(s);
+
+	a = &s->c[s->active];
+	*state = a->state;
+	if (a->state != SERVO_UNLOCKED)
+		s->applied = a->adj;
+	return a->adj;
+}
+
+static void auto_sync_interval(struct servo *servo, double interval)
+{
+	struct auto_servo *s = container_of(servo, struct auto_servo, servo);
+	unsigned int i;
+
+	for (i = 0; i < N_CANDIDATES; i++)
+		servo_sync_interval(s->c[i].servo, interval);
+}
+
+static void auto_reset(struct servo *servo)
+{
+	struct auto_servo *s = container_of(servo, struct auto_servo, servo);
+	unsigned int i;
+
+	for (i = 0; i < N_CANDIDATES; i++) {
+		servo_reset(s->c[i].servo);
+		s->c[i].acc = 0.0;
+		s->c[i].applied = s->applied;
+		s->c[i].samples = 0;
+	}
+	s->last_ts = 0;
+}
+
+static double auto_rate_ratio(struct servo *servo)
+{
+	struct auto_servo *s = container_of(servo, struct auto_servo, servo);
+
+	return servo_rate_ratio(s->c[s->active].servo);
+}
+
+static void auto_leap(struct servo *servo, int leap)
+{
+	struct auto_servo *s = container_of(servo, struct auto_servo, servo);
+	unsigned int i;
+
+	for (i = 0; i < N_CANDIDATES; i++)
+		servo_leap(s->c[i].servo, leap);
+}
+
+static void auto_warm_start(struct servo *servo, double fadj)
+{
+	struct auto_servo *s = container_of(servo, struct auto_servo, servo);
+	unsigned int i;
+
+	for (i = 0; i < N_CANDIDATES; i++) {
+		servo_warm_start(s->c[i].servo, fadj);
+		s->c[i].acc = 0.0;
+		s->c[i].applied = fadj;
+	}
+	s->applied = fadj;
+}
+
+static void auto_reconfigure(struct servo *servo, struct config *cfg)
+{
+	struct auto_servo *s = container_of(servo, struct auto_servo, servo);
+	unsigned int i;
+
+	for (i = 0; i < N_CANDIDATES; i++)
+		servo_reconfigure(s->c[i].servo, cfg);
+}
+
+struct servo *auto_servo_create(struct config *cfg, int fadj, int max_ppb,
+				int sw_ts)
+{
+	struct auto_servo *s;
+	unsigned int i;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->servo.destroy = auto_destroy;
+	s->servo.sample = auto_sample;
+	s->servo.sync_interval = auto_sync_interval;
+	s->servo.reset = auto_reset;
+	s->servo.rate_ratio = auto_rate_ratio;
+	s->servo.leap = auto_leap;
+	s->servo.warm_start = auto_warm_start;
+	s->servo.reconfigure = auto_reconfigure;
+
+	for (i = 0; i < N_CANDIDATES; i++) {
+		s->c[i].servo = servo_create(cfg, candidate_types[i].type,
+					     fadj, max_ppb, sw_ts);
+		if (!s->c[i].servo) {
+			auto_destroy(&s->servo);
+			return NULL;
+		}
+		s->c[i].name = candidate_types[i].name;
+		s->c[i].applied = fadj;
+	}
+	s->applied = fadj;
+
+	return &s->servo;
+}
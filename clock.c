@@ -18,33 +18,63 @@
  */
 #include <errno.h>
 #include <linux/net_tstamp.h>
-#include <poll.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/queue.h>
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
 
 #include "address.h"
 #include "bmc.h"
 #include "clock.h"
 #include "clockadj.h"
 #include "clockcheck.h"
+#include "cpustat.h"
+#include "contain.h"
 #include "foreign.h"
+#include "freqfile.h"
+#include "hash.h"
+#include "holdover.h"
 #include "filter.h"
+#include "mcache.h"
+#include "metrics.h"
 #include "missing.h"
 #include "msg.h"
 #include "phc.h"
+#include "phcalign.h"
 #include "port.h"
 #include "servo.h"
+#include "servolog.h"
+#include "sk.h"
+#include "stateshm.h"
 #include "stats.h"
 #include "print.h"
+#include "ratelimit.h"
 #include "tlv.h"
+#include "trace.h"
 #include "tsproc.h"
+#include "unicast.h"
 #include "uds.h"
 #include "util.h"
+#include "wheel.h"
+#include "worker.h"
 
 #define N_CLOCK_PFD (N_POLLFD + 1) /* one extra per port, for the fault timer */
 #define POW2_41 ((double)(1ULL << 41))
+#define HOLDOVER_UPDATE 1000000000ULL /* nanoseconds */
+/* The clock, and its cold part, start on a cache line. */
+#define CLOCK_ALIGN 64
+/* Marks a ready slot whose descriptor reported only an error or a hang up. */
+#define READY_ERROR (1 << 30)
 
 struct port {
 	LIST_ENTRY(port) list;
@@ -57,15 +87,45 @@ struct freq_estimator {
 	unsigned int count;
 };
 
+struct fast_lock {
+	int samples; /* length of the burst, zero once the servo has taken over */
+	int count;
+	int64_t step; /* threshold of the initial step, zero for none */
+	tmv_t t0;
+	double st, so, stt, sto;
+};
+
 struct clock_stats {
 	struct stats *offset;
 	struct stats *freq;
 	struct stats *delay;
 	unsigned int max_count;
+	/* Results of the last completed interval */
+	struct stats_result last_offset;
+	struct stats_result last_delay;
+	unsigned int last_offset_num;
+	unsigned int last_delay_num;
+};
+
+/* Indices of the timers owned by the clock itself */
+enum clock_timer {
+	CLOCK_TIMER_HOLDOVER,
+	CLOCK_TIMER_SUBSCRIBER,
+	CLOCK_TIMER_METRICS,
+	CLOCK_TIMER_ALIGN,
 };
 
+/* Interval of publishing the state of the ports to the exporter */
+#define METRICS_INTERVAL NS_PER_SEC
+
+/* Number of sources of management messages with their own rate limit */
+#define MGMT_SOURCES_MAX 256
+
 struct clock_subscriber {
 	LIST_ENTRY(clock_subscriber) list;
+	/* Entries in the lists of the subscribers of each event */
+	LIST_ENTRY(clock_subscriber) event_list[NOTIFY_EVENT_CNT];
+	struct wheel_timer timer;
 	uint8_t events[EVENT_BITMASK_CNT];
 	struct PortIdentity targetPortIdentity;
 	struct address addr;
@@ -73,54 +133,117 @@ struct clock_subscriber {
 	time_t expiration;
 };
 
+/*
+ * The fields used by clock_poll() and clock_synchronize() come first, so
+ * that the handling of a sync message touches as few cache lines as
+ * possible. The data sets, descriptions and subscriber lists, which are
+ * used by the state decisions and the management messages, follow on
+ * cache lines of their own.
+ */
 struct clock {
-	enum clock_type type;
-	struct config *config;
+	/* hot: the main loop */
+	struct wheel *wheel; /* its slot follows those of the workers */
+	int *ready; /* indices of the ready slots, in ascending order */
+	struct port **pollport; /* owner of each block of N_CLOCK_PFD slots */
+#ifdef HAVE_EPOLL
+	int epoll_fd;
+	struct epoll_event *epoll_events;
+#else
+	struct pollfd *pollfd;
+#endif
+	int pollfd_valid;
+	uint64_t wakeups; /* of clock_poll() with ready slots */
+	uint64_t events; /* ready slots handled by clock_poll() */
+	int nports; /* does not include the UDS port */
+	int64_t poll_spin; /* nanoseconds to poll for before blocking */
+	int sync_batch;
+	struct port *uds_port;
+	/* hot: the servo */
 	clockid_t clkid;
+	int free_running;
 	struct servo *servo;
+	enum servo_state servo_state;
+	struct fast_lock fast_lock;
+	struct tsproc *tsproc;
+	tmv_t master_offset;
+	tmv_t path_delay;
+	tmv_t ingress_ts;
+	double nrr;
+	int utc_timescale;
+	int utc_offset_set;
+	int leap_set;
+	int kernel_leap;
+	struct clockcheck *sanity_check;
+	struct freqfile *freqfile;
+	struct stateshm *stateshm;
+	struct servolog *servolog;
+	struct holdover *holdover;
+	struct sync_sample_np last_sample;
+	int sample_decimation;
+	struct freq_estimator fest;
+	int freq_est_interval;
+	struct clock_stats stats;
+	int stats_interval;
+	uint64_t cpu_ns[CPU_N_STAGES]; /* at the last report */
+	uint64_t cpu_last;
+	/* cold: data sets, configuration and management */
+	enum clock_type type __attribute__((aligned(CLOCK_ALIGN)));
+	struct config *config;
 	enum servo_type servo_type;
 	struct defaultDS dds;
 	struct dataset default_dataset;
 	struct currentDS cur;
 	struct parent_ds dad;
 	struct timePropertiesDS tds;
-	struct ClockIdentity ptl[PATH_TRACE_MAX];
 	struct foreign_clock *best;
+	struct dataset best_ds; /* of the best at the last state decision */
 	struct ClockIdentity best_id;
 	LIST_HEAD(ports_head, port) ports;
-	struct port *uds_port;
-	struct pollfd *pollfd;
-	int pollfd_valid;
-	int nports; /* does not include the UDS port */
+	struct worker **workers; /* their slots follow the port blocks */
+	int nworkers;
 	int last_port_number;
-	int free_running;
-	int freq_est_interval;
+	int fast_lock_samples;
+	int phc_index;
+	char *freq_file; /* for the PHC in use, empty if not saved */
+	int sanity_freq_limit;
+	enum timestamp_type timestamping;
+	int log_sync_interval;
 	int grand_master_capable; /* for 802.1AS only */
-	int utc_timescale;
-	int utc_offset_set;
-	int leap_set;
-	int kernel_leap;
 	int utc_offset;  /* grand master role */
 	int time_flags;  /* grand master role */
 	int time_source; /* grand master role */
-	enum servo_state servo_state;
-	tmv_t master_offset;
-	tmv_t path_delay;
-	tmv_t ingress_ts;
-	struct tsproc *tsproc;
-	struct freq_estimator fest;
 	struct time_status_np status;
-	double nrr;
-	struct clock_description desc;
-	struct clock_stats stats;
-	int stats_interval;
-	struct clockcheck *sanity_check;
+	struct metrics *metrics;
+	struct metrics_port *metrics_ports;
+	int metrics_nports; /* the entries of metrics_ports */
+	struct wheel_timer metrics_timer;
+	struct wheel_timer holdover_timer;
+	struct phcalign *phcalign; /* with the PHCs of the ports aligned */
+	struct wheel_timer align_timer;
+	uint64_t align_interval;
+	int ref_phc_index; /* of the PHC in use, the aligned ones follow it */
 	struct interface uds_interface;
+	struct clock_description desc;
 	LIST_HEAD(clock_subscribers_head, clock_subscriber) subscribers;
+	struct clock_subscribers_head event_subscribers[NOTIFY_EVENT_CNT];
+	struct hash *subscriber_index; /* by port identity */
+	struct ratelimit *mgmt_limit;
+	struct mcache *mgmt_cache;
+	unsigned int mgmt_gen; /* of the data of the cached responses */
+	struct ClockIdentity ptl[PATH_TRACE_MAX];
+	struct clock **domains; /* hosted on our ports, see clock_domain() */
+	int ndomains;
+	struct clock *primary; /* the host of this clock, if not NULL */
+	int sde; /* see clock_pending_decision() */
+	int domain_selection;
+	struct clock *source; /* the domain steering the servo */
+	uint64_t sample_time; /* CLOCK_MONOTONIC nanoseconds */
 };
 
-struct clock the_clock;
+struct clock the_clock __attribute__((aligned(CLOCK_ALIGN)));
+
 
+static void clock_fast_lock_reset(struct clock *c, int warm);
 static void handle_state_decision_event(struct clock *c);
 static int clock_resize_pollfd(struct clock *c, int new_nports);
 static void clock_remove_port(struct clock *c, struct port *p);
@@ -137,8 +260,44 @@ static int cid_eq(struct ClockIdentity *a, struct ClockIdentity *b)
 	    (var) = (tvar))
 #endif
 
-static void remove_subscriber(struct clock_subscriber *s)
+static int event_bit(uint8_t *bitmask, int event)
+{
+	return bitmask[event / 8] & (1 << (event % 8));
+}
+
+static void subscriber_set_events(struct clock *c, struct clock_subscriber *s,
+				  uint8_t *bitmask)
+{
+	int i;
+
+	for (i = 0; i < NOTIFY_EVENT_CNT; i++) {
+		if (event_bit(s->events, i) && !event_bit(bitmask, i))
+			LIST_REMOVE(s, event_list[i]);
+		else if (!event_bit(s->events, i) && event_bit(bitmask, i))
+			LIST_INSERT_HEAD(&c->event_subscribers[i], s,
+					 event_list[i]);
+	}
+	memcpy(s->events, bitmask, EVENT_BITMASK_CNT);
+}
+
+static void subscriber_renew(struct clock *c, struct clock_subscriber *s,
+			     uint16_t duration)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	s->expiration = now.tv_sec + duration;
+	/* A zero duration expires right away, but a zero timeout disarms. */
+	wheel_set(c->wheel, &s->timer, duration ? duration * NS_PER_SEC : 1);
+}
+
+static void remove_subscriber(struct clock *c, struct clock_subscriber *s)
 {
+	uint8_t none[EVENT_BITMASK_CNT] = {0};
+
+	subscriber_set_events(c, s, none);
+	wheel_clear(c->wheel, &s->timer);
+	hash_remove(c->subscriber_index, pid2str(&s->targetPortIdentity));
 	LIST_REMOVE(s, list);
 	free(s);
 }
@@ -148,7 +307,6 @@ static void clock_update_subscription(struct clock *c, struct ptp_message *req,
 {
 	struct clock_subscriber *s;
 	int i, remove = 1;
-	struct timespec now;
 
 	for (i = 0; i < EVENT_BITMASK_CNT; i++) {
 		if (bitmask[i]) {
@@ -157,37 +315,40 @@ static void clock_update_subscription(struct clock *c, struct ptp_message *req,
 		}
 	}
 
-	LIST_FOREACH(s, &c->subscribers, list) {
-		if (!memcmp(&s->targetPortIdentity, &req->header.sourcePortIdentity,
-		            sizeof(struct PortIdentity))) {
-			/* Found, update the transport address and event
-			 * mask. */
-			if (!remove) {
-				s->addr = req->address;
-				memcpy(s->events, bitmask, EVENT_BITMASK_CNT);
-				clock_gettime(CLOCK_MONOTONIC, &now);
-				s->expiration = now.tv_sec + duration;
-			} else {
-				remove_subscriber(s);
-			}
-			return;
+	s = hash_lookup(c->subscriber_index,
+			pid2str(&req->header.sourcePortIdentity));
+	if (s) {
+		/* Found, update the transport address and event mask. */
+		if (!remove) {
+			s->addr = req->address;
+			subscriber_set_events(c, s, bitmask);
+			subscriber_renew(c, s, duration);
+		} else {
+			remove_subscriber(c, s);
 		}
+		return;
 	}
 	if (remove)
 		return;
 	/* Not present yet, add the subscriber. */
-	s = malloc(sizeof(*s));
+	s = calloc(1, sizeof(*s));
 	if (!s) {
 		pr_err("failed to allocate memory for a subscriber");
 		return;
 	}
 	s->targetPortIdentity = req->header.sourcePortIdentity;
+	if (hash_insert(c->subscriber_index,
+			pid2str(&s->targetPortIdentity), s)) {
+		pr_err("failed to index a subscriber");
+		free(s);
+		return;
+	}
 	s->addr = req->address;
-	memcpy(s->events, bitmask, EVENT_BITMASK_CNT);
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	s->expiration = now.tv_sec + duration;
 	s->sequenceId = 0;
+	wheel_timer_init(&s->timer, c, CLOCK_TIMER_SUBSCRIBER);
 	LIST_INSERT_HEAD(&c->subscribers, s, list);
+	subscriber_set_events(c, s, bitmask);
+	subscriber_renew(c, s, duration);
 }
 
 static void clock_get_subscription(struct clock *c, struct ptp_message *req,
@@ -196,17 +357,16 @@ static void clock_get_subscription(struct clock *c, struct ptp_message *req,
 	struct clock_subscriber *s;
 	struct timespec now;
 
-	LIST_FOREACH(s, &c->subscribers, list) {
-		if (!memcmp(&s->targetPortIdentity, &req->header.sourcePortIdentity,
-			    sizeof(struct PortIdentity))) {
-			memcpy(bitmask, s->events, EVENT_BITMASK_CNT);
-			clock_gettime(CLOCK_MONOTONIC, &now);
-			if (s->expiration < now.tv_sec)
-				*duration = 0;
-			else
-				*duration = s->expiration - now.tv_sec;
-			return;
-		}
+	s = hash_lookup(c->subscriber_index,
+			pid2str(&req->header.sourcePortIdentity));
+	if (s) {
+		memcpy(bitmask, s->events, EVENT_BITMASK_CNT);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (s->expiration < now.tv_sec)
+			*duration = 0;
+		else
+			*duration = s->expiration - now.tv_sec;
+		return;
 	}
 	/* A client without entry means the client has no subscriptions. */
 	memset(bitmask, 0, EVENT_BITMASK_CNT);
@@ -218,36 +378,34 @@ static void clock_flush_subscriptions(struct clock *c)
 	struct clock_subscriber *s, *tmp;
 
 	LIST_FOREACH_SAFE(s, &c->subscribers, list, tmp) {
-		remove_subscriber(s);
+		remove_subscriber(c, s);
 	}
 }
 
-static void clock_prune_subscriptions(struct clock *c)
+static void clock_expire_subscription(struct clock *c, struct wheel_timer *t)
 {
-	struct clock_subscriber *s, *tmp;
-	struct timespec now;
+	struct clock_subscriber *s;
 
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	LIST_FOREACH_SAFE(s, &c->subscribers, list, tmp) {
-		if (s->expiration <= now.tv_sec) {
-			pr_info("subscriber %s timed out",
-				pid2str(&s->targetPortIdentity));
-			remove_subscriber(s);
-		}
-	}
+	s = container_of(t, struct clock_subscriber, timer);
+	pr_info("subscriber %s timed out", pid2str(&s->targetPortIdentity));
+	remove_subscriber(c, s);
+}
+
+static int clock_event_subscribed(struct clock *c, enum notification event)
+{
+	return event < NOTIFY_EVENT_CNT &&
+		!LIST_EMPTY(&c->event_subscribers[event]);
 }
 
 void clock_send_notification(struct clock *c, struct ptp_message *msg,
 			     int msglen, enum notification event)
 {
-	unsigned int event_pos = event / 8;
-	uint8_t mask = 1 << (event % 8);
 	struct port *uds = c->uds_port;
 	struct clock_subscriber *s;
 
-	LIST_FOREACH(s, &c->subscribers, list) {
-		if (!(s->events[event_pos] & mask))
-			continue;
+	if (event >= NOTIFY_EVENT_CNT)
+		return;
+	LIST_FOREACH(s, &c->event_subscribers[event], event_list[event]) {
 		/* send event */
 		msg->header.sequenceId = htons(s->sequenceId);
 		s->sequenceId++;
@@ -260,17 +418,67 @@ void clock_send_notification(struct clock *c, struct ptp_message *msg,
 	}
 }
 
+/* Frees the parts that a hosted clock owns, see clock_create_domain(). */
+static void clock_destroy_domain(struct clock *d)
+{
+	struct port *p, *tmp;
+
+	if (d->subscriber_index) {
+		clock_flush_subscriptions(d);
+		hash_destroy(d->subscriber_index, NULL);
+	}
+	LIST_FOREACH_SAFE(p, &d->ports, list, tmp) {
+		LIST_REMOVE(p, list);
+		port_close(p);
+	}
+	if (d->servo)
+		servo_destroy(d->servo);
+	if (d->tsproc)
+		tsproc_destroy(d->tsproc);
+	stats_destroy(d->stats.offset);
+	stats_destroy(d->stats.freq);
+	stats_destroy(d->stats.delay);
+	if (d->mgmt_limit)
+		ratelimit_destroy(d->mgmt_limit);
+	if (d->mgmt_cache)
+		mcache_destroy(d->mgmt_cache);
+	free(d);
+}
+
 void clock_destroy(struct clock *c)
 {
 	struct port *p, *tmp;
+	int i;
 
-	clock_flush_subscriptions(c);
+	/* The hosted clocks go first, as they share our ports. */
+	for (i = 0; i < c->ndomains; i++) {
+		clock_destroy_domain(c->domains[i]);
+	}
+	free(c->domains);
+	if (c->subscriber_index) {
+		clock_flush_subscriptions(c);
+		hash_destroy(c->subscriber_index, NULL);
+	}
 	LIST_FOREACH_SAFE(p, &c->ports, list, tmp) {
 		clock_remove_port(c, p);
 	}
 	port_close(c->uds_port);
+	for (i = 0; i < c->nworkers; i++) {
+		worker_destroy(c->workers[i]);
+	}
+	free(c->workers);
+	if (c->wheel)
+		wheel_destroy(c->wheel);
+#ifdef HAVE_EPOLL
+	if (c->epoll_fd >= 0)
+		close(c->epoll_fd);
+	free(c->epoll_events);
+#else
 	free(c->pollfd);
-	if (c->clkid != CLOCK_REALTIME) {
+#endif
+	free(c->pollport);
+	free(c->ready);
+	if (c->clkid != CLOCK_REALTIME && c->clkid != CLOCK_REPLAY) {
 		phc_close(c->clkid);
 	}
 	servo_destroy(c->servo);
@@ -280,6 +488,24 @@ void clock_destroy(struct clock *c)
 	stats_destroy(c->stats.delay);
 	if (c->sanity_check)
 		clockcheck_destroy(c->sanity_check);
+	if (c->freqfile)
+		freqfile_destroy(c->freqfile);
+	if (c->holdover)
+		holdover_destroy(c->holdover);
+	if (c->phcalign)
+		phcalign_destroy(c->phcalign);
+	if (c->servolog)
+		servolog_close(c->servolog);
+	if (c->metrics)
+		metrics_destroy(c->metrics);
+	free(c->metrics_ports);
+	free(c->freq_file);
+	if (c->stateshm)
+		stateshm_destroy(c->stateshm);
+	if (c->mgmt_limit)
+		ratelimit_destroy(c->mgmt_limit);
+	if (c->mgmt_cache)
+		mcache_destroy(c->mgmt_cache);
 	memset(c, 0, sizeof(*c));
 	msg_cleanup();
 }
@@ -288,6 +514,10 @@ static int clock_fault_timeout(struct port *port, int set)
 {
 	struct fault_interval i;
 
+	/* The ports of the hosted domains recover right away. */
+	if (port_fault_fd(port) < 0)
+		return 0;
+
 	if (!set) {
 		pr_debug("clearing fault on port %d", port_number(port));
 		return port_set_fault_timer_lin(port, 0);
@@ -323,6 +553,79 @@ static void clock_management_send_error(struct port *p,
 		pr_err("failed to send management error status");
 }
 
+static void clock_stats_get(struct clock_stats *s, struct clock_stats_np *csn)
+{
+	memset(csn, 0, sizeof(*csn));
+	csn->offset_samples = s->last_offset_num;
+	csn->offset_rms = llround(s->last_offset.rms);
+	csn->offset_max = llround(s->last_offset.max_abs);
+	csn->offset_p50 = llround(s->last_offset.p50_abs);
+	csn->offset_p99 = llround(s->last_offset.p99_abs);
+	csn->offset_p999 = llround(s->last_offset.p999_abs);
+	csn->delay_samples = s->last_delay_num;
+	if (!s->last_delay_num)
+		return;
+	csn->delay_mean = llround(s->last_delay.mean);
+	csn->delay_p50 = llround(s->last_delay.p50_abs);
+	csn->delay_p99 = llround(s->last_delay.p99_abs);
+	csn->delay_p999 = llround(s->last_delay.p999_abs);
+}
+
+static void clock_time_status(struct clock *c, struct time_status_np *tsn)
+{
+	tsn->master_offset = tmv_to_nanoseconds(c->master_offset);
+	tsn->ingress_time = tmv_to_nanoseconds(c->ingress_ts);
+	tsn->cumulativeScaledRateOffset =
+		(Integer32) (c->status.cumulativeScaledRateOffset +
+			      c->nrr * POW2_41 - POW2_41);
+	tsn->scaledLastGmPhaseChange = c->status.scaledLastGmPhaseChange;
+	tsn->gmTimeBaseIndicator = c->status.gmTimeBaseIndicator;
+	tsn->lastGmPhaseChange = c->status.lastGmPhaseChange;
+	if (cid_eq(&c->dad.pds.grandmasterIdentity, &c->dds.clockIdentity))
+		tsn->gmPresent = 0;
+	else
+		tsn->gmPresent = 1;
+	tsn->gmIdentity = c->dad.pds.grandmasterIdentity;
+}
+
+static void clock_perf_stats(struct clock *c, struct perf_stats_np *psn)
+{
+	uint64_t cpu_ns[CPU_N_STAGES], cpu_count[CPU_N_STAGES];
+	unsigned long issued, avoided;
+	struct tx_timestamp_stats_np tsn;
+	struct msg_pool_stats pool;
+	struct port *p;
+
+	memset(psn, 0, sizeof(*psn));
+	psn->wakeups = c->wakeups;
+	psn->events = c->events;
+
+	msg_pool_stats(&pool);
+	psn->pool_hits = pool.hits;
+	psn->pool_misses = pool.misses;
+	psn->pool_failures = pool.failures;
+	psn->pool_total = pool.total;
+	psn->pool_high_water = pool.high_water;
+
+	LIST_FOREACH(p, &c->ports, list) {
+		port_get_txts_stats(p, &tsn);
+		psn->txts_count += tsn.count;
+		psn->txts_timeouts += tsn.timeouts;
+		if (tsn.p99 > psn->txts_p99)
+			psn->txts_p99 = tsn.p99;
+		if (tsn.max > psn->txts_max)
+			psn->txts_max = tsn.max;
+	}
+
+	cpustat_get(cpu_ns, cpu_count);
+	psn->servo_ns = cpu_ns[CPU_SERVO];
+	psn->servo_count = cpu_count[CPU_SERVO];
+
+	clockadj_get_stats(&issued, &avoided);
+	psn->adj_issued = issued;
+	psn->adj_avoided = avoided;
+}
+
 /* The 'p' and 'req' paremeters are needed for the GET actions that operate
  * on per-client datasets. If such actions do not apply to the caller, it is
  * allowed to pass both of them as NULL.
@@ -331,12 +634,23 @@ static int clock_management_fill_response(struct clock *c, struct port *p,
 					  struct ptp_message *req,
 					  struct ptp_message *rsp, int id)
 {
-	int datalen = 0, respond = 0;
+	int datalen = 0, i, respond = 0;
 	struct management_tlv *tlv;
 	struct management_tlv_datum *mtd;
 	struct time_status_np *tsn;
 	struct grandmaster_settings_np *gsn;
 	struct subscribe_events_np *sen;
+	struct msg_pool_stats_np *mps;
+	struct msg_pool_stats pool;
+	struct management_stats_np *msn;
+	struct ratelimit_stats rls;
+	struct clock_stats_np *csn;
+	uint64_t cpu_ns[CPU_N_STAGES], cpu_count[CPU_N_STAGES];
+	struct cpu_stats_np *cpu;
+	struct holdover_status hs;
+	struct holdover_np *hon;
+	struct snapshot_np *snp;
+	struct port *piter;
 	struct PTPText *text;
 
 	tlv = (struct management_tlv *) rsp->management.suffix;
@@ -415,19 +729,7 @@ static int clock_management_fill_response(struct clock *c, struct port *p,
 		break;
 	case TLV_TIME_STATUS_NP:
 		tsn = (struct time_status_np *) tlv->data;
-		tsn->master_offset = c->master_offset;
-		tsn->ingress_time = tmv_to_nanoseconds(c->ingress_ts);
-		tsn->cumulativeScaledRateOffset =
-			(Integer32) (c->status.cumulativeScaledRateOffset +
-				      c->nrr * POW2_41 - POW2_41);
-		tsn->scaledLastGmPhaseChange = c->status.scaledLastGmPhaseChange;
-		tsn->gmTimeBaseIndicator = c->status.gmTimeBaseIndicator;
-		tsn->lastGmPhaseChange = c->status.lastGmPhaseChange;
-		if (cid_eq(&c->dad.pds.grandmasterIdentity, &c->dds.clockIdentity))
-			tsn->gmPresent = 0;
-		else
-			tsn->gmPresent = 1;
-		tsn->gmIdentity = c->dad.pds.grandmasterIdentity;
+		clock_time_status(c, tsn);
 		datalen = sizeof(*tsn);
 		respond = 1;
 		break;
@@ -440,6 +742,91 @@ static int clock_management_fill_response(struct clock *c, struct port *p,
 		datalen = sizeof(*gsn);
 		respond = 1;
 		break;
+	case TLV_MSG_POOL_STATS_NP:
+		msg_pool_stats(&pool);
+		mps = (struct msg_pool_stats_np *) tlv->data;
+		mps->total = pool.total;
+		mps->free = pool.free;
+		mps->limit = pool.limit;
+		mps->high_water = pool.high_water;
+		mps->hits = pool.hits;
+		mps->misses = pool.misses;
+		mps->failures = pool.failures;
+		datalen = sizeof(*mps);
+		respond = 1;
+		break;
+	case TLV_CLOCK_STATS_NP:
+		csn = (struct clock_stats_np *) tlv->data;
+		clock_stats_get(&c->stats, csn);
+		datalen = sizeof(*csn);
+		respond = 1;
+		break;
+	case TLV_HOLDOVER_NP:
+		hon = (struct holdover_np *) tlv->data;
+		memset(hon, 0, sizeof(*hon));
+		if (c->holdover) {
+			holdover_get_status(c->holdover, &hs);
+			hon->active = hs.active;
+			hon->duration = hs.duration;
+			hon->points = hs.points;
+			hon->frequency = llround(hs.freq * 65536.0);
+			hon->drift = llround(hs.drift * 3600.0 * 65536.0);
+			hon->temp_coeff = llround(hs.temp_coeff * 65536.0);
+			hon->error = llround(hs.error);
+		}
+		datalen = sizeof(*hon);
+		respond = 1;
+		break;
+	case TLV_SYNC_SAMPLE_NP:
+		memcpy(tlv->data, &c->last_sample, sizeof(c->last_sample));
+		datalen = sizeof(c->last_sample);
+		respond = 1;
+		break;
+	case TLV_MANAGEMENT_STATS_NP:
+		ratelimit_stats(c->mgmt_limit, &rls);
+		msn = (struct management_stats_np *) tlv->data;
+		msn->admitted = rls.admitted;
+		msn->dropped = rls.dropped;
+		msn->overflows = rls.overflows;
+		msn->sources = rls.sources;
+		msn->limited = rls.limited;
+		datalen = sizeof(*msn);
+		respond = 1;
+		break;
+	case TLV_CPU_STATS_NP:
+		cpu = (struct cpu_stats_np *) tlv->data;
+		memset(cpu, 0, sizeof(*cpu));
+		cpu->enabled = cpustat_enabled;
+		cpustat_get(cpu_ns, cpu_count);
+		for (i = 0; i < CPU_N_STAGES && i < CPU_STATS_STAGES; i++) {
+			cpu->stage[i].ns = cpu_ns[i];
+			cpu->stage[i].count = cpu_count[i];
+		}
+		datalen = sizeof(*cpu);
+		respond = 1;
+		break;
+	case TLV_PERF_STATS_NP:
+		clock_perf_stats(c, (struct perf_stats_np *) tlv->data);
+		datalen = sizeof(struct perf_stats_np);
+		respond = 1;
+		break;
+	case TLV_SNAPSHOT_NP:
+		snp = (struct snapshot_np *) tlv->data;
+		snp->dds = c->dds;
+		snp->cds = c->cur;
+		snp->pds = c->dad.pds;
+		snp->tds = c->tds;
+		clock_time_status(c, &snp->tsn);
+		snp->portCount = 0;
+		snp->reserved = 0;
+		LIST_FOREACH(piter, &c->ports, list) {
+			if (snp->portCount == SNAPSHOT_NP_MAX_PORTS)
+				break;
+			port_data_set(piter, &snp->ports[snp->portCount++]);
+		}
+		datalen = sizeof(*snp) + snp->portCount * sizeof(snp->ports[0]);
+		respond = 1;
+		break;
 	case TLV_SUBSCRIBE_EVENTS_NP:
 		if (p != c->uds_port) {
 			/* Only the UDS port allowed. */
@@ -462,10 +849,36 @@ static int clock_management_fill_response(struct clock *c, struct port *p,
 	return respond;
 }
 
+/*
+ * The responses which only depend on the data sets changed by the state
+ * decisions, the time properties updates and the SET requests are kept
+ * in network byte order, see clock_mgmt_changed().
+ */
+static int clock_management_cacheable(int id)
+{
+	switch (id) {
+	case TLV_USER_DESCRIPTION:
+	case TLV_DEFAULT_DATA_SET:
+	case TLV_PARENT_DATA_SET:
+	case TLV_TIME_PROPERTIES_DATA_SET:
+	case TLV_PRIORITY1:
+	case TLV_PRIORITY2:
+	case TLV_DOMAIN:
+	case TLV_SLAVE_ONLY:
+	case TLV_CLOCK_ACCURACY:
+	case TLV_TRACEABILITY_PROPERTIES:
+	case TLV_TIMESCALE_PROPERTIES:
+	case TLV_GRANDMASTER_SETTINGS_NP:
+		return 1;
+	}
+	return 0;
+}
+
 static int clock_management_get_response(struct clock *c, struct port *p,
 					 int id, struct ptp_message *req)
 {
 	struct PortIdentity pid = port_identity(p);
+	int cacheable = clock_management_cacheable(id);
 	struct ptp_message *rsp;
 	int respond;
 
@@ -473,7 +886,13 @@ static int clock_management_get_response(struct clock *c, struct port *p,
 	if (!rsp) {
 		return 0;
 	}
-	respond = clock_management_fill_response(c, p, req, rsp, id);
+	if (cacheable && mcache_get(c->mgmt_cache, id, c->mgmt_gen, rsp)) {
+		respond = 1;
+	} else {
+		respond = clock_management_fill_response(c, p, req, rsp, id);
+		if (respond && cacheable)
+			mcache_put(c->mgmt_cache, id, c->mgmt_gen, rsp);
+	}
 	if (respond)
 		port_prepare_and_send(p, rsp, 0);
 	msg_put(rsp);
@@ -542,23 +961,54 @@ static void clock_stats_update(struct clock_stats *s,
 	/* Path delay stats are updated separately, they may be empty. */
 	if (!stats_get_result(s->delay, &delay_stats)) {
 		pr_info("rms %4.0f max %4.0f "
+			"p50 %4.0f p99 %4.0f p99.9 %4.0f "
 			"freq %+6.0f +/- %3.0f "
-			"delay %5.0f +/- %3.0f",
+			"delay %5.0f +/- %3.0f "
+			"p50 %5.0f p99 %5.0f p99.9 %5.0f",
 			offset_stats.rms, offset_stats.max_abs,
+			offset_stats.p50_abs, offset_stats.p99_abs,
+			offset_stats.p999_abs,
 			freq_stats.mean, freq_stats.stddev,
-			delay_stats.mean, delay_stats.stddev);
+			delay_stats.mean, delay_stats.stddev,
+			delay_stats.p50_abs, delay_stats.p99_abs,
+			delay_stats.p999_abs);
 	} else {
 		pr_info("rms %4.0f max %4.0f "
+			"p50 %4.0f p99 %4.0f p99.9 %4.0f "
 			"freq %+6.0f +/- %3.0f",
 			offset_stats.rms, offset_stats.max_abs,
+			offset_stats.p50_abs, offset_stats.p99_abs,
+			offset_stats.p999_abs,
 			freq_stats.mean, freq_stats.stddev);
 	}
 
+	s->last_offset = offset_stats;
+	s->last_offset_num = stats_get_num_values(s->offset);
+	s->last_delay_num = stats_get_num_values(s->delay);
+	if (s->last_delay_num)
+		s->last_delay = delay_stats;
+
 	stats_reset(s->offset);
 	stats_reset(s->freq);
 	stats_reset(s->delay);
 }
 
+/* Record the last sample and push it to the subscribers. */
+static void clock_sample_notify(struct clock *c, double freq,
+				enum servo_state state)
+{
+	struct sync_sample_np *s = &c->last_sample;
+
+	s->master_offset = tmv_to_nanoseconds(c->master_offset);
+	s->path_delay = tmv_to_nanoseconds(c->path_delay);
+	s->ingress_time = tmv_to_nanoseconds(c->ingress_ts);
+	s->frequency = llround(freq * 65536.0);
+	s->servo_state = state;
+	s->sequence++;
+	if (!(s->sequence % c->sample_decimation))
+		clock_notify_event(c, NOTIFY_SYNC_SAMPLE);
+}
+
 static enum servo_state clock_no_adjust(struct clock *c, tmv_t ingress,
 					tmv_t origin)
 {
@@ -577,7 +1027,7 @@ static enum servo_state clock_no_adjust(struct clock *c, tmv_t ingress,
 	 * By leaving out the path delay altogther, we can avoid the
 	 * error caused by our imperfect path delay measurement.
 	 */
-	if (!f->ingress1) {
+	if (tmv_is_zero(f->ingress1)) {
 		f->ingress1 = ingress;
 		f->origin1 = origin;
 		return state;
@@ -598,12 +1048,19 @@ static enum servo_state clock_no_adjust(struct clock *c, tmv_t ingress,
 	if (c->stats.max_count > 1) {
 		clock_stats_update(&c->stats,
 				   tmv_to_nanoseconds(c->master_offset), freq);
+	} else if (c->primary) {
+		pr_info("domain %hhu: master offset %10" PRId64 " s%d "
+			"freq %+7.0f path delay %9" PRId64,
+			c->dds.domainNumber,
+			tmv_to_nanoseconds(c->master_offset), state, freq,
+			tmv_to_nanoseconds(c->path_delay));
 	} else {
 		pr_info("master offset %10" PRId64 " s%d freq %+7.0f "
 			"path delay %9" PRId64,
 			tmv_to_nanoseconds(c->master_offset), state, freq,
 			tmv_to_nanoseconds(c->path_delay));
 	}
+	clock_sample_notify(c, -freq, state);
 
 	fui = 1.0 + (c->status.cumulativeScaledRateOffset + 0.0) / POW2_41;
 
@@ -633,6 +1090,7 @@ static void clock_update_grandmaster(struct clock *c)
 	pds->grandmasterPriority1               = c->dds.priority1;
 	pds->grandmasterPriority2               = c->dds.priority2;
 	c->dad.path_length                      = 0;
+	c->dad.path_gen++;
 	c->tds.currentUtcOffset                 = c->utc_offset;
 	c->tds.flags                            = c->time_flags;
 	c->tds.timeSource                       = c->time_source;
@@ -641,16 +1099,16 @@ static void clock_update_grandmaster(struct clock *c)
 static void clock_update_slave(struct clock *c)
 {
 	struct parentDS *pds = &c->dad.pds;
-	struct ptp_message *msg        = TAILQ_FIRST(&c->best->messages);
+	struct announce_msg *a         = &c->best->announce;
 	c->cur.stepsRemoved            = 1 + c->best->dataset.stepsRemoved;
 	pds->parentPortIdentity        = c->best->dataset.sender;
-	pds->grandmasterIdentity       = msg->announce.grandmasterIdentity;
-	pds->grandmasterClockQuality   = msg->announce.grandmasterClockQuality;
-	pds->grandmasterPriority1      = msg->announce.grandmasterPriority1;
-	pds->grandmasterPriority2      = msg->announce.grandmasterPriority2;
-	c->tds.currentUtcOffset        = msg->announce.currentUtcOffset;
-	c->tds.flags                   = msg->header.flagField[1];
-	c->tds.timeSource              = msg->announce.timeSource;
+	pds->grandmasterIdentity       = a->grandmasterIdentity;
+	pds->grandmasterClockQuality   = a->grandmasterClockQuality;
+	pds->grandmasterPriority1      = a->grandmasterPriority1;
+	pds->grandmasterPriority2      = a->grandmasterPriority2;
+	c->tds.currentUtcOffset        = a->currentUtcOffset;
+	c->tds.flags                   = a->hdr.flagField[1];
+	c->tds.timeSource              = a->timeSource;
 	if (!(c->tds.flags & PTP_TIMESCALE)) {
 		pr_warning("foreign master not using PTP timescale");
 	}
@@ -762,84 +1220,471 @@ struct config *clock_config(struct clock *c)
 	return c->config;
 }
 
-static int clock_add_port(struct clock *c, int phc_index,
-			  enum timestamp_type timestamping,
-			  struct interface *iface)
+struct wheel *clock_wheel(struct clock *c)
 {
-	struct port *p, *piter, *lastp = NULL;
-
-	if (clock_resize_pollfd(c, c->nports + 1))
-		return -1;
-	p = port_open(phc_index, timestamping, ++c->last_port_number,
-		      iface, c);
-	if (!p) {
-		/* No need to shrink pollfd */
-		return -1;
-	}
-	LIST_FOREACH(piter, &c->ports, list)
-		lastp = piter;
-	if (lastp)
-		LIST_INSERT_AFTER(lastp, p, list);
-	else
-		LIST_INSERT_HEAD(&c->ports, p, list);
-	c->nports++;
-	clock_fda_changed(c);
-	return 0;
+	return c->wheel;
 }
 
-static void clock_remove_port(struct clock *c, struct port *p)
+struct worker *clock_worker(struct clock *c, int number)
 {
-	/* Do not call clock_resize_pollfd, it's pointless to shrink
-	 * the allocated memory at this point, clock_destroy will free
-	 * it all anyway. This function is usable from other parts of
-	 * the code, but even then we don't mind if pollfd is larger
-	 * than necessary. */
-	LIST_REMOVE(p, list);
-	c->nports--;
-	clock_fda_changed(c);
-	port_close(p);
+	if (!c->nworkers || number < 1)
+		return NULL;
+	return c->workers[(number - 1) % c->nworkers];
 }
 
-struct clock *clock_create(enum clock_type type, struct config *config,
-			   const char *phc_device)
+struct clock_probe {
+	pthread_mutex_t lock;
+	struct interface *next;
+	struct config *config;
+	enum timestamp_type timestamping;
+};
+
+static void clock_probe_interface(struct clock_probe *cp,
+				  struct interface *iface)
 {
-	enum timestamp_type timestamping =
-		config_get_int(config, NULL, "time_stamping");
-	int fadj = 0, max_adj = 0, sw_ts = timestamping == TS_SOFTWARE ? 1 : 0;
-	enum servo_type servo = config_get_int(config, NULL, "clock_servo");
-	int phc_index, required_modes = 0;
-	struct clock *c = &the_clock;
-	struct port *p;
-	unsigned char oui[OUI_LEN];
-	char phc[32], *tmp;
-	struct interface *iface, *udsif = &c->uds_interface;
-	struct timespec ts;
-	int sfl;
+	enum transport_type transport;
 
-	clock_gettime(CLOCK_REALTIME, &ts);
-	srandom(ts.tv_sec ^ ts.tv_nsec);
+	sk_get_ts_info(iface->name, &iface->ts_info);
 
-	if (c->nports)
-		clock_destroy(c);
+	if (!cp->config || cp->timestamping == TS_SOFTWARE) {
+		return;
+	}
+	transport = config_get_int(cp->config, iface->name, "network_transport");
+	if (transport == TRANS_UDS) {
+		return;
+	}
+	/* Failures are reported again when the port opens its sockets. */
+	sk_hwts_prepare(iface->name, cp->timestamping, transport);
+}
 
-	switch (type) {
-	case CLOCK_TYPE_ORDINARY:
-	case CLOCK_TYPE_BOUNDARY:
-		c->type = type;
-		break;
-	case CLOCK_TYPE_P2P:
-	case CLOCK_TYPE_E2E:
-	case CLOCK_TYPE_MANAGEMENT:
-		return NULL;
+static void *clock_probe_run(void *arg)
+{
+	struct clock_probe *cp = arg;
+	struct interface *iface;
+
+	while (1) {
+		pthread_mutex_lock(&cp->lock);
+		iface = cp->next;
+		if (iface)
+			cp->next = STAILQ_NEXT(iface, list);
+		pthread_mutex_unlock(&cp->lock);
+		if (!iface)
+			break;
+		clock_probe_interface(cp, iface);
 	}
+	return NULL;
+}
 
-	/* Initialize the defaultDS. */
-	c->dds.clockQuality.clockClass =
-		config_get_int(config, NULL, "clockClass");
-	c->dds.clockQuality.clockAccuracy =
-		config_get_int(config, NULL, "clockAccuracy");
-	c->dds.clockQuality.offsetScaledLogVariance =
-		config_get_int(config, NULL, "offsetScaledLogVariance");
+/*
+ * Query the time stamping capabilities of every interface and, when
+ * init_threads is set, configure their time stamping units from a pool
+ * of threads. Some drivers take hundreds of milliseconds to reconfigure,
+ * and doing this one port after the other makes the start up time of a
+ * large boundary clock the sum of all of them. The ports themselves are
+ * still opened one by one, and hwts_init() leaves an interface alone
+ * when it is already set up correctly.
+ */
+static void clock_probe_interfaces(struct config *config,
+				   enum timestamp_type timestamping)
+{
+	int err, i, n = config_get_int(config, NULL, "init_threads");
+	struct clock_probe cp = {
+		.next = STAILQ_FIRST(&config->interfaces),
+		.timestamping = timestamping,
+	};
+	sigset_t all, old;
+	pthread_t *tid;
+
+	if (n > config->n_interfaces)
+		n = config->n_interfaces;
+	tid = n > 1 ? calloc(n, sizeof(*tid)) : NULL;
+	if (!tid) {
+		/* Just the capabilities, the ports configure the rest. */
+		for (; cp.next; cp.next = STAILQ_NEXT(cp.next, list))
+			clock_probe_interface(&cp, cp.next);
+		return;
+	}
+	cp.config = config;
+	pthread_mutex_init(&cp.lock, NULL);
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	for (i = 0; i < n; i++) {
+		err = pthread_create(&tid[i], NULL, clock_probe_run, &cp);
+		if (err) {
+			pr_warning("init thread: pthread_create failed: %s",
+				   strerror(err));
+			break;
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	/* Lend a hand, this also covers a failure to start any threads. */
+	clock_probe_run(&cp);
+
+	while (i--)
+		pthread_join(tid[i], NULL);
+	pthread_mutex_destroy(&cp.lock);
+	free(tid);
+}
+
+static int clock_create_workers(struct clock *c, int n, const char *cpus)
+{
+	char *buf, *tok, *end;
+	int *cpu, i, ncpus = 0;
+	long val;
+
+	cpu = calloc(n, sizeof(*cpu));
+	buf = strdup(cpus);
+	c->workers = calloc(n, sizeof(*c->workers));
+	if (!cpu || !buf || !c->workers)
+		goto err;
+
+	for (tok = strtok(buf, ", "); tok; tok = strtok(NULL, ", ")) {
+		val = strtol(tok, &end, 10);
+		if (*end || val < 0 || val >= CPU_SETSIZE) {
+			pr_err("bad cpu '%s' in port_thread_cpus", tok);
+			goto err;
+		}
+		if (ncpus < n)
+			cpu[ncpus++] = val;
+	}
+	for (i = 0; i < n; i++) {
+		c->workers[i] = worker_create(i < ncpus ? cpu[i] : -1);
+		if (!c->workers[i])
+			goto err;
+		c->nworkers++;
+	}
+	free(buf);
+	free(cpu);
+	return 0;
+err:
+	free(buf);
+	free(cpu);
+	return -1;
+}
+
+/*
+ * Creates the clock of another domain on the ports of the clock. It
+ * measures its offset without adjusting any clock, and it shares the
+ * timer wheel, the UDS port and the transport of each port.
+ */
+static struct clock *clock_create_domain(struct clock *c, int domain)
+{
+	struct clock **domains, *d;
+	struct port *p, *q, *lastq = NULL;
+	int i;
+
+	domains = realloc(c->domains, (c->ndomains + 1) * sizeof(*domains));
+	if (!domains) {
+		pr_err("low memory");
+		return NULL;
+	}
+	c->domains = domains;
+	if (posix_memalign((void **) &d, CLOCK_ALIGN, sizeof(*d))) {
+		pr_err("low memory");
+		return NULL;
+	}
+	memset(d, 0, sizeof(*d));
+	c->domains[c->ndomains++] = d;
+
+	d->primary = c;
+	d->type = c->type;
+	d->config = c->config;
+	d->dds = c->dds;
+	d->dds.domainNumber = domain;
+	d->desc = c->desc;
+	d->clkid = CLOCK_INVALID;
+	d->free_running = 1;
+	d->utc_timescale = c->utc_timescale;
+	d->utc_offset = c->utc_offset;
+	d->time_flags = c->time_flags;
+	d->time_source = c->time_source;
+	d->grand_master_capable = c->grand_master_capable;
+	d->freq_est_interval = c->freq_est_interval;
+	d->stats_interval = c->stats_interval;
+	d->sample_decimation = c->sample_decimation;
+	d->phc_index = c->phc_index;
+	d->timestamping = c->timestamping;
+	d->wheel = c->wheel;
+	d->uds_port = c->uds_port;
+	d->nrr = 1.0;
+
+	d->servo_type = CLOCK_SERVO_NULLF;
+	d->servo = servo_create(c->config, d->servo_type, 0, 0, 0);
+	d->tsproc = tsproc_create(config_get_int(c->config, NULL, "tsproc_mode"),
+				  config_get_int(c->config, NULL, "delay_filter"),
+				  config_get_int(c->config, NULL, "delay_filter_length"),
+				  config_get_double(c->config, NULL, "delay_filter_quantile"));
+	if (d->tsproc &&
+	    tsproc_set_filters(d->tsproc,
+		config_get_string(c->config, NULL, "delay_filter_chain"),
+		config_get_string(c->config, NULL, "offset_filter_chain"))) {
+		tsproc_destroy(d->tsproc);
+		d->tsproc = NULL;
+	}
+	d->stats.offset = stats_create();
+	d->stats.freq = stats_create();
+	d->stats.delay = stats_create();
+	d->subscriber_index = hash_create();
+	d->mgmt_limit = ratelimit_create("management",
+			config_get_double(c->config, NULL, "management_rate"),
+			config_get_int(c->config, NULL, "management_burst"),
+			MGMT_SOURCES_MAX);
+	d->mgmt_cache = mcache_create();
+	if (!d->servo || !d->tsproc || !d->stats.offset || !d->stats.freq ||
+	    !d->stats.delay || !d->subscriber_index || !d->mgmt_limit ||
+	    !d->mgmt_cache) {
+		pr_err("domain %d: failed to create the clock", domain);
+		return NULL;
+	}
+
+	clock_update_grandmaster(d);
+	d->dad.pds.parentStats                           = 0;
+	d->dad.pds.observedParentOffsetScaledLogVariance = 0xffff;
+	d->dad.pds.observedParentClockPhaseChangeRate    = 0x7fffffff;
+	d->dad.ptl = d->ptl;
+	clock_sync_interval(d, 0);
+
+	LIST_INIT(&d->subscribers);
+	for (i = 0; i < NOTIFY_EVENT_CNT; i++) {
+		LIST_INIT(&d->event_subscribers[i]);
+	}
+	LIST_INIT(&d->ports);
+	LIST_FOREACH(p, &c->ports, list) {
+		q = port_open_domain(p, d);
+		if (!q) {
+			pr_err("domain %d: failed to open port %s", domain,
+			       port_name(p));
+			return NULL;
+		}
+		if (lastq)
+			LIST_INSERT_AFTER(lastq, q, list);
+		else
+			LIST_INSERT_HEAD(&d->ports, q, list);
+		lastq = q;
+		d->nports++;
+	}
+	d->last_port_number = c->last_port_number;
+	d->dds.numberPorts = d->nports;
+
+	LIST_FOREACH(q, &d->ports, list) {
+		port_dispatch(q, EV_INITIALIZE, 0);
+	}
+	pr_info("domain %d: following on %d ports", domain, d->nports);
+	return d;
+}
+
+/* Creates the clocks of the domains listed in secondary_domains. */
+static int clock_create_domains(struct clock *c, const char *list)
+{
+	char *buf, *tok, *end;
+	int err = -1;
+	long val;
+
+	buf = strdup(list);
+	if (!buf)
+		return -1;
+
+	for (tok = strtok(buf, ", "); tok; tok = strtok(NULL, ", ")) {
+		val = strtol(tok, &end, 10);
+		if (*end || val < 0 || val > 127 ||
+		    val == c->dds.domainNumber || clock_domain(c, val)) {
+			pr_err("bad domain '%s' in secondary_domains", tok);
+			goto out;
+		}
+		if (!clock_create_domain(c, val))
+			goto out;
+	}
+	err = 0;
+out:
+	free(buf);
+	return err;
+}
+
+static int clock_add_port(struct clock *c, int phc_index,
+			  enum timestamp_type timestamping,
+			  struct interface *iface)
+{
+	struct port *p, *piter, *lastp = NULL;
+
+	if (clock_resize_pollfd(c, c->nports + 1))
+		return -1;
+	p = port_open(phc_index, timestamping, ++c->last_port_number,
+		      iface, c);
+	if (!p) {
+		/* No need to shrink pollfd */
+		return -1;
+	}
+	LIST_FOREACH(piter, &c->ports, list)
+		lastp = piter;
+	if (lastp)
+		LIST_INSERT_AFTER(lastp, p, list);
+	else
+		LIST_INSERT_HEAD(&c->ports, p, list);
+	c->nports++;
+	clock_fda_changed(c);
+	return 0;
+}
+
+static void clock_remove_port(struct clock *c, struct port *p)
+{
+	/* Do not call clock_resize_pollfd, it's pointless to shrink
+	 * the allocated memory at this point, clock_destroy will free
+	 * it all anyway. This function is usable from other parts of
+	 * the code, but even then we don't mind if pollfd is larger
+	 * than necessary. */
+	LIST_REMOVE(p, list);
+	c->nports--;
+	clock_fda_changed(c);
+	port_close(p);
+}
+
+/*
+ * Set the clock to the frequency saved by a previous run, if any.
+ * Returns non-zero if the frequency was restored. Without 'fadj' the
+ * file is only opened, to save the frequency of the clock.
+ */
+static int clock_restore_freq(struct clock *c, clockid_t clkid,
+			      const char *name, int max_adj, int *fadj)
+{
+	double freq, limit = max_adj;
+
+	if (c->freqfile) {
+		freqfile_destroy(c->freqfile);
+		c->freqfile = NULL;
+	}
+	if (!c->freq_file[0])
+		return 0;
+
+	c->freqfile = freqfile_create(c->freq_file, name);
+	if (!c->freqfile) {
+		pr_err("failed to create frequency file");
+		return 0;
+	}
+	if (!fadj)
+		return 0;
+
+	if (c->sanity_freq_limit && c->sanity_freq_limit < limit)
+		limit = c->sanity_freq_limit;
+	if (freqfile_load(c->freqfile, limit, &freq))
+		return 0;
+
+	pr_info("restoring frequency %+.0f ppb of %s", freq, name);
+	*fadj = (int) freq;
+	clockadj_set_freq(clkid, *fadj);
+	return 1;
+}
+
+static void clock_metrics_update(struct clock *c)
+{
+	struct metrics_port *mp;
+	struct msg_pool_stats pool;
+	struct port *p;
+	int n = 0;
+
+	LIST_FOREACH(p, &c->ports, list) {
+		if (n >= c->metrics_nports)
+			break;
+		mp = &c->metrics_ports[n++];
+		snprintf(mp->name, sizeof(mp->name), "%s", port_name(p));
+		mp->number = port_number(p);
+		mp->state = port_state(p);
+		port_get_stats(p, &mp->stats);
+	}
+	msg_pool_stats(&pool);
+	metrics_update(c->metrics, c->metrics_ports, n, &pool);
+	wheel_set(c->wheel, &c->metrics_timer, METRICS_INTERVAL);
+}
+
+static void clock_align_update(struct clock *c)
+{
+	phcalign_update(c->phcalign);
+	wheel_set(c->wheel, &c->align_timer, c->align_interval);
+}
+
+/*
+ * Align the PHCs of the ports in the "just a bunch of devices" mode to
+ * the PHC in use, instead of leaving them to an external program.
+ */
+static int clock_create_align(struct clock *c, struct config *config)
+{
+	struct interface *iface;
+	double interval;
+	int log_interval;
+
+	c->ref_phc_index = c->phc_index;
+	if (!config_get_int(config, NULL, "jbod_align") || c->phc_index < 0)
+		return 0;
+
+	log_interval = config_get_int(config, NULL, "jbod_align_interval");
+	interval = pow(2.0, log_interval);
+	c->phcalign = phcalign_create(config, interval);
+	if (!c->phcalign || phcalign_add(c->phcalign, c->phc_index))
+		return -1;
+
+	STAILQ_FOREACH(iface, &config->interfaces, list) {
+		if (!iface->ts_info.valid || iface->ts_info.phc_index < 0 ||
+		    !config_get_int(config, iface->name, "boundary_clock_jbod"))
+			continue;
+		if (phcalign_add(c->phcalign, iface->ts_info.phc_index))
+			return -1;
+	}
+	if (phcalign_count(c->phcalign) < 2) {
+		phcalign_destroy(c->phcalign);
+		c->phcalign = NULL;
+		return 0;
+	}
+
+	c->align_interval = interval * NS_PER_SEC;
+	wheel_timer_init(&c->align_timer, c, CLOCK_TIMER_ALIGN);
+	clock_align_update(c);
+	return 0;
+}
+
+struct clock *clock_create(enum clock_type type, struct config *config,
+			   const char *phc_device)
+{
+	enum timestamp_type timestamping =
+		config_get_int(config, NULL, "time_stamping");
+	int fadj = 0, max_adj = 0, sw_ts = timestamping == TS_SOFTWARE ? 1 : 0;
+	enum servo_type servo = config_get_int(config, NULL, "clock_servo");
+	int replay = config_get_int(config, NULL, "network_transport") ==
+		TRANS_REPLAY;
+	int i, phc_index, required_modes = 0, warm = 0;
+	struct clock *c = &the_clock;
+	struct port *p;
+	unsigned char oui[OUI_LEN];
+	char phc[32], *state_file, *metrics_address, *tmp;
+	struct interface *iface, *udsif = &c->uds_interface;
+	struct timespec ts;
+	int nifaces = 0, nworkers;
+	double mgmt_rate;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	srandom(ts.tv_sec ^ ts.tv_nsec);
+
+	if (c->nports)
+		clock_destroy(c);
+
+	switch (type) {
+	case CLOCK_TYPE_ORDINARY:
+	case CLOCK_TYPE_BOUNDARY:
+	case CLOCK_TYPE_P2P:
+	case CLOCK_TYPE_E2E:
+		c->type = type;
+		break;
+	case CLOCK_TYPE_MANAGEMENT:
+		return NULL;
+	}
+
+	/* Initialize the defaultDS. */
+	c->dds.clockQuality.clockClass =
+		config_get_int(config, NULL, "clockClass");
+	c->dds.clockQuality.clockAccuracy =
+		config_get_int(config, NULL, "clockAccuracy");
+	c->dds.clockQuality.offsetScaledLogVariance =
+		config_get_int(config, NULL, "offsetScaledLogVariance");
 
 	c->desc.productDescription.max_symbols = 64;
 	c->desc.revisionData.max_symbols = 32;
@@ -902,6 +1747,7 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 				return NULL;
 			break;
 		case TS_ONESTEP:
+		case TS_P2P1STEP:
 			break;
 		}
 	}
@@ -920,13 +1766,16 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 		break;
 	case TS_HARDWARE:
 	case TS_ONESTEP:
+	case TS_P2P1STEP:
 		required_modes |= SOF_TIMESTAMPING_TX_HARDWARE |
 			SOF_TIMESTAMPING_RX_HARDWARE |
 			SOF_TIMESTAMPING_RAW_HARDWARE;
 		break;
 	}
+	clock_probe_interfaces(config, timestamping);
+
 	STAILQ_FOREACH(iface, &config->interfaces, list) {
-		if (iface->ts_info.valid &&
+		if (!replay && iface->ts_info.valid &&
 		    ((iface->ts_info.so_timestamping & required_modes) != required_modes)) {
 			pr_err("interface '%s' does not support "
 			       "requested timestamping mode", iface->name);
@@ -937,7 +1786,7 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	iface = STAILQ_FIRST(&config->interfaces);
 
 	/* determine PHC Clock index */
-	if (config_get_int(config, NULL, "free_running")) {
+	if (config_get_int(config, NULL, "free_running") || replay) {
 		phc_index = -1;
 	} else if (config_get_int(config, NULL, "time_stamping") == TS_SOFTWARE ||
 		   config_get_int(config, NULL, "time_stamping") == TS_LEGACY_HW) {
@@ -958,7 +1807,14 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 		pr_info("selected /dev/ptp%d as PTP clock", phc_index);
 	}
 
-	if (generate_clock_identity(&c->dds.clockIdentity, iface->name)) {
+	if (replay) {
+		/* A replay needs no interface, only an identity of its own. */
+		memset(&c->dds.clockIdentity, 0, sizeof(c->dds.clockIdentity));
+		c->dds.clockIdentity.id[0] = 0x02;
+		c->dds.clockIdentity.id[3] = 0xFF;
+		c->dds.clockIdentity.id[4] = 0xFE;
+		c->dds.clockIdentity.id[7] = 0x01;
+	} else if (generate_clock_identity(&c->dds.clockIdentity, iface->name)) {
 		pr_err("failed to generate a clock identity");
 		return NULL;
 	}
@@ -985,18 +1841,39 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	c->config = config;
 	c->free_running = config_get_int(config, NULL, "free_running");
 	c->freq_est_interval = config_get_int(config, NULL, "freq_est_interval");
+	c->freq_file = strdup(config_get_string(config, NULL, "freq_file"));
+	if (!c->freq_file) {
+		pr_err("low memory");
+		return NULL;
+	}
 	c->grand_master_capable = config_get_int(config, NULL, "gmCapable");
 	c->kernel_leap = config_get_int(config, NULL, "kernel_leap");
+	c->poll_spin = config_get_int(config, NULL, "poll_spin") * 1000LL;
+	c->sanity_freq_limit = config_get_int(config, NULL, "sanity_freq_limit");
+	c->sync_batch = config_get_int(config, NULL, "sync_batch");
 	c->utc_offset = CURRENT_UTC_OFFSET;
 	c->time_source = config_get_int(config, NULL, "timeSource");
+	clockadj_set_min_change(config_get_double(config, NULL,
+						  "min_freq_change"));
+
+	if (phc_index >= 0)
+		snprintf(phc, 31, "/dev/ptp%d", phc_index);
+	else if (replay)
+		snprintf(phc, 31, "CLOCK_REPLAY");
+	else
+		snprintf(phc, 31, "CLOCK_REALTIME");
 
 	if (c->free_running) {
 		c->clkid = CLOCK_INVALID;
 		if (timestamping == TS_SOFTWARE || timestamping == TS_LEGACY_HW) {
 			c->utc_timescale = 1;
 		}
+	} else if (replay) {
+		c->clkid = CLOCK_REPLAY;
+		c->utc_timescale = sw_ts;
+		clockadj_init(c->clkid);
+		max_adj = config_get_int(config, NULL, "max_frequency");
 	} else if (phc_index >= 0) {
-		snprintf(phc, 31, "/dev/ptp%d", phc_index);
 		c->clkid = phc_open(phc);
 		if (c->clkid == CLOCK_INVALID) {
 			pr_err("Failed to open %s: %m", phc);
@@ -1025,23 +1902,71 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 		   and return 0. Set the frequency back to make sure fadj is
 		   the actual frequency of the clock. */
 		clockadj_set_freq(c->clkid, fadj);
+		warm = clock_restore_freq(c, c->clkid, phc, max_adj, &fadj);
 	}
 	c->servo = servo_create(c->config, servo, -fadj, max_adj, sw_ts);
 	if (!c->servo) {
 		pr_err("Failed to create clock servo");
 		return NULL;
 	}
+	if (warm)
+		servo_warm_start(c->servo, -fadj);
 	c->servo_state = SERVO_UNLOCKED;
 	c->servo_type = servo;
+	c->fast_lock_samples = config_get_int(config, NULL, "fast_lock");
+	c->fast_lock.step = (int64_t) (1e9 * config_get_double(config, NULL,
+						"first_step_threshold"));
+	clock_fast_lock_reset(c, warm);
+	state_file = config_get_string(config, NULL, "state_file");
+	metrics_address = config_get_string(config, NULL, "metrics_address");
+	if (state_file[0] || metrics_address[0]) {
+		/* The exporter reads the state even without a file. */
+		c->stateshm = stateshm_create(state_file[0] ? state_file : NULL,
+					      1);
+		if (!c->stateshm) {
+			pr_err("failed to create state file");
+			return NULL;
+		}
+		stateshm_set_clock(c->stateshm, 0, phc);
+	}
+	tmp = config_get_string(config, NULL, "servo_log_file");
+	if (tmp[0]) {
+		c->servolog = servolog_open(tmp,
+			config_get_int(config, NULL, "servo_log_size"),
+			config_get_int(config, NULL, "servo_log_files"));
+		if (!c->servolog) {
+			pr_err("failed to create the servo log");
+			return NULL;
+		}
+	}
+	if (config_get_int(config, NULL, "holdover") && !c->free_running) {
+		c->holdover = holdover_create(
+			config_get_int(config, NULL, "holdover_window"),
+			config_get_string(config, NULL, "holdover_temp_file"));
+		if (!c->holdover) {
+			pr_err("failed to create holdover");
+			return NULL;
+		}
+		wheel_timer_init(&c->holdover_timer, c, CLOCK_TIMER_HOLDOVER);
+	}
 	c->tsproc = tsproc_create(config_get_int(config, NULL, "tsproc_mode"),
 				  config_get_int(config, NULL, "delay_filter"),
-				  config_get_int(config, NULL, "delay_filter_length"));
+				  config_get_int(config, NULL, "delay_filter_length"),
+				  config_get_double(config, NULL, "delay_filter_quantile"));
 	if (!c->tsproc) {
 		pr_err("Failed to create time stamp processor");
 		return NULL;
 	}
+	if (tsproc_set_filters(c->tsproc,
+			config_get_string(config, NULL, "delay_filter_chain"),
+			config_get_string(config, NULL, "offset_filter_chain"))) {
+		pr_err("bad delay_filter_chain or offset_filter_chain");
+		return NULL;
+	}
 	c->nrr = 1.0;
 	c->stats_interval = config_get_int(config, NULL, "summary_interval");
+	c->sample_decimation = config_get_int(config, NULL,
+					      "sync_sample_decimation");
 	c->stats.offset = stats_create();
 	c->stats.freq = stats_create();
 	c->stats.delay = stats_create();
@@ -1049,13 +1974,15 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 		pr_err("failed to create stats");
 		return NULL;
 	}
-	sfl = config_get_int(config, NULL, "sanity_freq_limit");
-	if (sfl) {
-		c->sanity_check = clockcheck_create(sfl);
+	/* A replay runs at its own pace, unrelated to the monotonic clock. */
+	if (c->sanity_freq_limit && !replay) {
+		c->sanity_check = clockcheck_create(c->sanity_freq_limit);
 		if (!c->sanity_check) {
 			pr_err("Failed to create clock sanity check");
 			return NULL;
 		}
+		clockcheck_set_period(c->sanity_check,
+			config_get_int(config, NULL, "sanity_check_period"));
 	}
 
 	/* Initialize the parentDS. */
@@ -1068,9 +1995,67 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	clock_sync_interval(c, 0);
 
 	LIST_INIT(&c->subscribers);
+	for (i = 0; i < NOTIFY_EVENT_CNT; i++) {
+		LIST_INIT(&c->event_subscribers[i]);
+	}
 	LIST_INIT(&c->ports);
 	c->last_port_number = 0;
 
+#ifdef HAVE_EPOLL
+	c->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (c->epoll_fd < 0) {
+		pr_err("epoll_create1 failed: %m");
+		return NULL;
+	}
+#endif
+
+	if (msg_pool_init(config_get_int(config, NULL, "msg_pool_size"),
+			  config_get_int(config, NULL, "msg_pool_limit"),
+			  config_get_int(config, NULL, "msg_pool_lock"))) {
+		pr_err("failed to set up the message pool");
+		return NULL;
+	}
+
+	c->wheel = wheel_create();
+	if (!c->wheel) {
+		pr_err("failed to create the timer wheel");
+		return NULL;
+	}
+
+	c->subscriber_index = hash_create();
+	if (!c->subscriber_index) {
+		pr_err("failed to create the subscriber index");
+		return NULL;
+	}
+
+	mgmt_rate = config_get_double(config, NULL, "management_rate");
+	c->mgmt_limit = ratelimit_create("management", mgmt_rate,
+			config_get_int(config, NULL, "management_burst"),
+			MGMT_SOURCES_MAX);
+	if (!c->mgmt_limit) {
+		pr_err("failed to create the management rate limit");
+		return NULL;
+	}
+	c->mgmt_cache = mcache_create();
+	if (!c->mgmt_cache) {
+		pr_err("failed to create the management cache");
+		return NULL;
+	}
+
+	STAILQ_FOREACH(iface, &config->interfaces, list) {
+		nifaces++;
+	}
+	nworkers = config_get_int(config, NULL, "port_threads");
+	if (nworkers > nifaces)
+		nworkers = nifaces;
+	if (nworkers > 0 &&
+	    clock_create_workers(c, nworkers,
+				 config_get_string(config, NULL,
+						   "port_thread_cpus"))) {
+		pr_err("failed to create the port threads");
+		return NULL;
+	}
+
 	/*
 	 * Create the UDS interface.
 	 */
@@ -1094,12 +2079,44 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	}
 
 	c->dds.numberPorts = c->nports;
+	c->phc_index = phc_index;
+	c->timestamping = timestamping;
+
+	if (clock_create_align(c, config)) {
+		pr_err("failed to align the PHCs");
+		return NULL;
+	}
 
 	LIST_FOREACH(p, &c->ports, list) {
 		port_dispatch(p, EV_INITIALIZE, 0);
 	}
 	port_dispatch(c->uds_port, EV_INITIALIZE, 0);
 
+	if (clock_create_domains(c, config_get_string(config, NULL,
+						      "secondary_domains")))
+		return NULL;
+	c->domain_selection = c->ndomains && !c->free_running &&
+		config_get_int(config, NULL, "domain_selection");
+	c->source = c;
+
+	if (metrics_address[0]) {
+		c->metrics_nports = c->nports ? c->nports : 1;
+		c->metrics_ports = calloc(c->metrics_nports,
+					  sizeof(*c->metrics_ports));
+		if (!c->metrics_ports) {
+			pr_err("low memory");
+			return NULL;
+		}
+		c->metrics = metrics_create(metrics_address, c->stateshm,
+					    c->nports);
+		if (!c->metrics) {
+			pr_err("failed to start the metrics exporter");
+			return NULL;
+		}
+		wheel_timer_init(&c->metrics_timer, c, CLOCK_TIMER_METRICS);
+		clock_metrics_update(c);
+	}
+
 	return c;
 }
 
@@ -1131,6 +2148,17 @@ struct dataset *clock_default_ds(struct clock *c)
 	return out;
 }
 
+struct clock *clock_domain(struct clock *c, int domain)
+{
+	int i;
+
+	for (i = 0; i < c->ndomains; i++) {
+		if (c->domains[i]->dds.domainNumber == domain)
+			return c->domains[i];
+	}
+	return NULL;
+}
+
 UInteger8 clock_domain_number(struct clock *c)
 {
 	return c->dds.domainNumber;
@@ -1160,46 +2188,254 @@ struct ClockIdentity clock_identity(struct clock *c)
 	return c->dds.clockIdentity;
 }
 
+/* One block per port and one for uds, then the workers and the wheel. */
+static int clock_nfds(struct clock *c, int nports)
+{
+	return (nports + 1) * N_CLOCK_PFD + c->nworkers + 1;
+}
+
 static int clock_resize_pollfd(struct clock *c, int new_nports)
 {
+	struct port **new_pollport;
+	int *new_ready;
+#ifdef HAVE_EPOLL
+	struct epoll_event *new_events;
+
+	/* Need to allocate one extra block of fds for uds */
+	new_events = realloc(c->epoll_events, clock_nfds(c, new_nports) *
+			     sizeof(struct epoll_event));
+	if (!new_events)
+		return -1;
+	c->epoll_events = new_events;
+#else
 	struct pollfd *new_pollfd;
 
 	/* Need to allocate one extra block of fds for uds */
-	new_pollfd = realloc(c->pollfd,
-			     (new_nports + 1) * N_CLOCK_PFD *
+	new_pollfd = realloc(c->pollfd, clock_nfds(c, new_nports) *
 			     sizeof(struct pollfd));
 	if (!new_pollfd)
 		return -1;
 	c->pollfd = new_pollfd;
+#endif
+	new_ready = realloc(c->ready, clock_nfds(c, new_nports) * sizeof(int));
+	if (!new_ready)
+		return -1;
+	c->ready = new_ready;
+	new_pollport = realloc(c->pollport,
+			       (new_nports + 1) * sizeof(struct port *));
+	if (!new_pollport)
+		return -1;
+	c->pollport = new_pollport;
 	return 0;
 }
 
-static void clock_fill_pollfd(struct pollfd *dest, struct port *p)
+#ifdef HAVE_EPOLL
+
+static void clock_epoll_add(struct clock *c, int fd, int slot, int events)
+{
+	struct epoll_event ev;
+
+	if (fd < 0)
+		return;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.u32 = slot;
+	/*
+	 * Closed descriptors leave the epoll set by themselves, so
+	 * anything still registered only needs its slot updated.
+	 */
+	if (!epoll_ctl(c->epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+		return;
+	if (errno == EEXIST && !epoll_ctl(c->epoll_fd, EPOLL_CTL_MOD, fd, &ev))
+		return;
+	pr_err("epoll_ctl failed for fd %d: %m", fd);
+}
+
+static void clock_fill_pollfd(struct clock *c, int block, struct port *p)
 {
 	struct fdarray *fda;
-	int i;
+	int i, slot = block * N_CLOCK_PFD;
 
 	fda = port_fda(p);
 	for (i = 0; i < N_POLLFD; i++) {
-		dest[i].fd = fda->fd[i];
-		dest[i].events = POLLIN|POLLPRI;
+		if (clock_worker(c, port_number(p))) {
+			/* Only watch for the error queue. */
+			if (i == FD_GENERAL)
+				continue;
+			if (i == FD_EVENT) {
+				clock_epoll_add(c, fda->fd[i], slot + i,
+						EPOLLPRI);
+				continue;
+			}
+		}
+		clock_epoll_add(c, fda->fd[i], slot + i, EPOLLIN|EPOLLPRI);
 	}
-	dest[i].fd = port_fault_fd(p);
-	dest[i].events = POLLIN|POLLPRI;
+	clock_epoll_add(c, port_fault_fd(p), slot + i, EPOLLIN|EPOLLPRI);
+	c->pollport[block] = p;
 }
 
-static void clock_check_pollfd(struct clock *c)
+static void clock_fill_worker_pollfd(struct clock *c, int slot,
+				     struct worker *w)
 {
-	struct port *p;
-	struct pollfd *dest = c->pollfd;
+	clock_epoll_add(c, worker_fd(w), slot, EPOLLIN);
+}
+
+static void clock_fill_wheel_pollfd(struct clock *c, int slot)
+{
+	clock_epoll_add(c, wheel_fd(c->wheel), slot, EPOLLIN);
+}
+
+static int ready_cmp(const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+static int clock_wait(struct clock *c, int timeout)
+{
+	int cnt, i;
+
+	cnt = epoll_wait(c->epoll_fd, c->epoll_events,
+			 clock_nfds(c, c->nports), timeout);
+	if (cnt <= 0)
+		return cnt;
+	for (i = 0; i < cnt; i++) {
+		c->ready[i] = c->epoll_events[i].data.u32;
+		if (!(c->epoll_events[i].events & (EPOLLIN|EPOLLPRI)))
+			c->ready[i] |= READY_ERROR;
+	}
+	/* Keep the dispatch order of the poll() based loop. */
+	if (cnt > 1)
+		qsort(c->ready, cnt, sizeof(c->ready[0]), ready_cmp);
+	return cnt;
+}
+
+#else
+
+static void clock_fill_pollfd(struct clock *c, int block, struct port *p)
+{
+	struct pollfd *dest = c->pollfd + block * N_CLOCK_PFD;
+	struct fdarray *fda;
+	int i;
+
+	fda = port_fda(p);
+	for (i = 0; i < N_POLLFD; i++) {
+		dest[i].fd = fda->fd[i];
+		dest[i].events = POLLIN|POLLPRI;
+	}
+	if (clock_worker(c, port_number(p))) {
+		/* Only watch for the error queue. */
+		dest[FD_EVENT].events = POLLPRI;
+		dest[FD_GENERAL].fd = -1;
+	}
+	dest[i].fd = port_fault_fd(p);
+	dest[i].events = POLLIN|POLLPRI;
+	c->pollport[block] = p;
+}
+
+static void clock_fill_worker_pollfd(struct clock *c, int slot,
+				     struct worker *w)
+{
+	c->pollfd[slot].fd = worker_fd(w);
+	c->pollfd[slot].events = POLLIN;
+}
+
+static void clock_fill_wheel_pollfd(struct clock *c, int slot)
+{
+	c->pollfd[slot].fd = wheel_fd(c->wheel);
+	c->pollfd[slot].events = POLLIN;
+}
+
+static int clock_wait(struct clock *c, int timeout)
+{
+	int cnt, i, n = 0;
+	int nfds = clock_nfds(c, c->nports);
+
+	cnt = poll(c->pollfd, nfds, timeout);
+	if (cnt <= 0)
+		return cnt;
+	for (i = 0; i < nfds && cnt; i++) {
+		if (!c->pollfd[i].revents)
+			continue;
+		cnt--;
+		if (c->pollfd[i].revents & (POLLIN|POLLPRI))
+			c->ready[n++] = i;
+		else if (c->pollfd[i].revents & (POLLERR|POLLHUP|POLLNVAL))
+			c->ready[n++] = i | READY_ERROR;
+	}
+	return n;
+}
+
+#endif
+
+/*
+ * Poll without blocking until an event shows up or the spin budget
+ * runs out, to spare the wakeup latency of the scheduler.
+ */
+static int clock_spin(struct clock *c)
+{
+	struct timespec now, start;
+	int cnt;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		cnt = clock_wait(c, 0);
+		if (cnt)
+			return cnt;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * NS_PER_SEC +
+		 now.tv_nsec - start.tv_nsec < c->poll_spin);
+
+	return clock_wait(c, -1);
+}
+
+/*
+ * Serve the event sockets of the ports first, keeping the order of the
+ * other descriptors, so that a burst of general or management messages
+ * does not delay the time stamps.
+ */
+static void clock_order_ready(struct clock *c, int cnt)
+{
+	int end = c->nports * N_CLOCK_PFD, first = 0, i, r;
+
+	for (i = 0; i < cnt; i++) {
+		r = c->ready[i];
+		if (r & READY_ERROR || r >= end || r % N_CLOCK_PFD != FD_EVENT)
+			continue;
+		memmove(&c->ready[first + 1], &c->ready[first],
+			(i - first) * sizeof(c->ready[0]));
+		c->ready[first++] = r;
+	}
+}
+
+/* Drop the remaining socket events of a port which was reset. */
+static void clock_skip_ready(struct clock *c, int n, int cnt, int block)
+{
+	int r;
+
+	for (; n < cnt; n++) {
+		r = c->ready[n] & ~READY_ERROR;
+		if (c->ready[n] >= 0 && r / N_CLOCK_PFD == block &&
+		    r % N_CLOCK_PFD != N_POLLFD)
+			c->ready[n] = -1;
+	}
+}
+
+static void clock_check_pollfd(struct clock *c)
+{
+	struct port *p;
+	int block = 0, i;
 
 	if (c->pollfd_valid)
 		return;
 	LIST_FOREACH(p, &c->ports, list) {
-		clock_fill_pollfd(dest, p);
-		dest += N_CLOCK_PFD;
+		clock_fill_pollfd(c, block++, p);
+	}
+	clock_fill_pollfd(c, block++, c->uds_port);
+	for (i = 0; i < c->nworkers; i++) {
+		clock_fill_worker_pollfd(c, block * N_CLOCK_PFD + i,
+					 c->workers[i]);
 	}
-	clock_fill_pollfd(dest, c->uds_port);
+	clock_fill_wheel_pollfd(c, block * N_CLOCK_PFD + i);
 	c->pollfd_valid = 1;
 }
 
@@ -1214,6 +2450,8 @@ static int clock_do_forward_mgmt(struct clock *c,
 {
 	if (in == out || !forwarding(c, out))
 		return 0;
+	if (msg->wire)
+		return port_forward(out, msg->wire);
 	if (!*pre_sent) {
 		/* delay calling msg_pre_send until
 		 * actually forwarding */
@@ -1229,6 +2467,13 @@ static void clock_forward_mgmt_msg(struct clock *c, struct port *p, struct ptp_m
 	int pdulen = 0, msg_ready = 0;
 
 	if (forwarding(c, p) && msg->management.boundaryHops) {
+		/*
+		 * The original bytes are sent as they were received, with
+		 * only the boundary hops patched, when they were kept.
+		 */
+		if (msg->wire)
+			msg->wire->management.boundaryHops =
+				msg->management.boundaryHops - 1;
 		pdulen = msg->header.messageLength;
 		msg->management.boundaryHops--;
 		LIST_FOREACH(piter, &c->ports, list) {
@@ -1238,14 +2483,14 @@ static void clock_forward_mgmt_msg(struct clock *c, struct port *p, struct ptp_m
 		}
 		if (clock_do_forward_mgmt(c, p, c->uds_port, msg, &msg_ready))
 			pr_err("uds port: management forward failed");
-		if (msg_ready) {
+		if (msg_ready)
 			msg_post_recv(msg, pdulen);
-			msg->management.boundaryHops++;
-		}
+		msg->management.boundaryHops++;
 	}
 }
 
-int clock_manage(struct clock *c, struct port *p, struct ptp_message *msg)
+static int clock_manage_msg(struct clock *c, struct port *p,
+			    struct ptp_message *msg)
 {
 	int changed = 0, res, answers;
 	struct port *piter;
@@ -1254,6 +2499,12 @@ int clock_manage(struct clock *c, struct port *p, struct ptp_message *msg)
 		{0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}
 	};
 
+	/* Drop the messages of the sources sending too many of them. */
+	if (p != c->uds_port &&
+	    ratelimit_check(c->mgmt_limit,
+			    pid2str(&msg->header.sourcePortIdentity)))
+		return changed;
+
 	/* Forward this message out all eligible ports. */
 	clock_forward_mgmt_msg(c, p, msg);
 
@@ -1279,6 +2530,7 @@ int clock_manage(struct clock *c, struct port *p, struct ptp_message *msg)
 			return changed;
 		break;
 	case SET:
+		clock_mgmt_changed(c);
 		if (mgt->length == 2 && mgt->id != TLV_NULL_MANAGEMENT) {
 			clock_management_send_error(p, msg, TLV_WRONG_LENGTH);
 			return changed;
@@ -1340,6 +2592,14 @@ int clock_manage(struct clock *c, struct port *p, struct ptp_message *msg)
 	case TLV_TIME_STATUS_NP:
 	case TLV_GRANDMASTER_SETTINGS_NP:
 	case TLV_SUBSCRIBE_EVENTS_NP:
+	case TLV_MSG_POOL_STATS_NP:
+	case TLV_CLOCK_STATS_NP:
+	case TLV_HOLDOVER_NP:
+	case TLV_SNAPSHOT_NP:
+	case TLV_SYNC_SAMPLE_NP:
+	case TLV_MANAGEMENT_STATS_NP:
+	case TLV_CPU_STATS_NP:
+	case TLV_PERF_STATS_NP:
 		clock_management_send_error(p, msg, TLV_NOT_SUPPORTED);
 		break;
 	default:
@@ -1361,6 +2621,16 @@ int clock_manage(struct clock *c, struct port *p, struct ptp_message *msg)
 	return changed;
 }
 
+int clock_manage(struct clock *c, struct port *p, struct ptp_message *msg)
+{
+	int changed, stage;
+
+	stage = cpustat_enter(CPU_MANAGEMENT);
+	changed = clock_manage_msg(c, p, msg);
+	cpustat_leave(stage);
+	return changed;
+}
+
 void clock_notify_event(struct clock *c, enum notification event)
 {
 	struct port *uds = c->uds_port;
@@ -1370,10 +2640,17 @@ void clock_notify_event(struct clock *c, enum notification event)
 	int id;
 
 	switch (event) {
-	/* set id */
+	case NOTIFY_TIME_PROPERTIES:
+		id = TLV_TIME_PROPERTIES_DATA_SET;
+		break;
+	case NOTIFY_SYNC_SAMPLE:
+		id = TLV_SYNC_SAMPLE_NP;
+		break;
 	default:
 		return;
 	}
+	if (!clock_event_subscribed(c, event))
+		return;
 	/* targetPortIdentity and sequenceId will be filled by
 	 * clock_send_notification */
 	msg = port_management_notify(pid, uds);
@@ -1399,15 +2676,221 @@ struct PortIdentity clock_parent_identity(struct clock *c)
 	return c->dad.pds.parentPortIdentity;
 }
 
+static int clock_poll_worker(struct clock *c, struct worker *w)
+{
+	struct ptp_message *msg;
+	enum fsm_event event;
+	enum port_state prev;
+	struct port *p;
+	int cnt, sde = 0;
+
+	worker_ack(w);
+	while (worker_pop(w, &p, &msg, &cnt)) {
+		prev = port_state(p);
+		event = port_rx(p, msg, cnt);
+		if (EV_STATE_DECISION_EVENT == event) {
+			port_set_bmc_changed(p);
+			sde = 1;
+		}
+		port_dispatch(p, event, 0);
+		/* Clear any fault after a little while. */
+		if (PS_FAULTY == port_state(p) && PS_FAULTY != prev)
+			clock_fault_timeout(p, 1);
+	}
+	return sde;
+}
+
+static void clock_holdover_update(struct clock *c)
+{
+	double freq = holdover_freq(c->holdover);
+
+	clockadj_set_freq(c->clkid, freq);
+	trace(TRACE_ADJ_FREQ, 0, 0, 0, freq);
+	if (c->sanity_check)
+		clockcheck_set_freq(c->sanity_check, freq);
+	wheel_set(c->wheel, &c->holdover_timer, HOLDOVER_UPDATE);
+}
+
+static void clock_holdover_start(struct clock *c)
+{
+	struct port *p;
+
+	if (!c->holdover || holdover_active(c->holdover) ||
+	    c->servo_state != SERVO_LOCKED)
+		return;
+
+	LIST_FOREACH(p, &c->ports, list) {
+		switch (port_state(p)) {
+		case PS_UNCALIBRATED:
+		case PS_SLAVE:
+			return;
+		default:
+			break;
+		}
+	}
+	if (holdover_start(c->holdover)) {
+		pr_notice("not enough history for holdover");
+		return;
+	}
+	pr_notice("entering holdover");
+	c->servo_state = SERVO_UNLOCKED;
+	clock_holdover_update(c);
+}
+
+static void clock_holdover_stop(struct clock *c)
+{
+	struct holdover_status hs;
+
+	holdover_get_status(c->holdover, &hs);
+	holdover_stop(c->holdover);
+	wheel_clear(c->wheel, &c->holdover_timer);
+	pr_notice("leaving holdover after %.0f seconds, estimated error %.0f ns",
+		  hs.duration, hs.error);
+	/* Continue from the predicted frequency. */
+	servo_reset(c->servo);
+	servo_warm_start(c->servo, -hs.freq);
+}
+
+static void clock_timer(struct clock *c, struct wheel_timer *t)
+{
+	switch (t->index) {
+	case CLOCK_TIMER_HOLDOVER:
+		clock_holdover_update(c);
+		break;
+	case CLOCK_TIMER_SUBSCRIBER:
+		clock_expire_subscription(c, t);
+		break;
+	case CLOCK_TIMER_METRICS:
+		clock_metrics_update(c);
+		break;
+	case CLOCK_TIMER_ALIGN:
+		clock_align_update(c);
+		break;
+	}
+}
+
+/* Tells whether a timer belongs to a clock, or to one of its hosted clocks. */
+static int clock_owns_timer(struct clock *c, struct wheel_timer *t)
+{
+	int i;
+
+	if (t->owner == c)
+		return 1;
+	for (i = 0; i < c->ndomains; i++) {
+		if (t->owner == c->domains[i])
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Schedules a state decision for the clock of a port. Returns non-zero
+ * if the port is one of ours, rather than of a hosted domain.
+ */
+static int clock_port_decision(struct clock *c, struct port *p)
+{
+	if (port_clock(p) == c)
+		return 1;
+	clock_pending_decision(port_clock(p));
+	return 0;
+}
+
+static int clock_poll_wheel(struct clock *c)
+{
+	struct wheel_timer *t;
+	enum fsm_event event;
+	struct port *p;
+	int sde = 0, sync = 0;
+
+	wheel_expire(c->wheel);
+	while ((t = wheel_next(c->wheel))) {
+		if (clock_owns_timer(c, t)) {
+			clock_timer(t->owner, t);
+			continue;
+		}
+		p = t->owner;
+		if (t->index >= UNICAST_TIMER_BASE) {
+			port_unicast_timer(p, t);
+			continue;
+		}
+		if (t->index == FD_SYNC_TX_TIMER)
+			sync = 1;
+		event = port_event(p, t->index);
+		if (EV_STATE_DECISION_EVENT == event) {
+			port_set_bmc_changed(p);
+			sde |= clock_port_decision(c, p);
+		}
+		if (p == c->uds_port)
+			continue;
+		if (EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES == event) {
+			port_set_bmc_changed(p);
+			sde |= clock_port_decision(c, p);
+		}
+		port_dispatch(p, event, 0);
+		/* Clear any fault after a little while. */
+		if (PS_FAULTY == port_state(p))
+			clock_fault_timeout(p, 1);
+	}
+	/*
+	 * The sync messages of the aligned ports went out back to back,
+	 * now collect their time stamps and send the follow up messages.
+	 */
+	if (sync && c->sync_batch) {
+		LIST_FOREACH(p, &c->ports, list) {
+			if (!port_sync_wait(p))
+				continue;
+			port_dispatch(p, EV_FAULT_DETECTED, 0);
+			if (PS_FAULTY == port_state(p))
+				clock_fault_timeout(p, 1);
+		}
+	}
+	return sde;
+}
+
+static void clock_cpustat_report(struct clock *c)
+{
+	uint64_t ns[CPU_N_STAGES], count[CPU_N_STAGES], now, elapsed, total;
+	int i, len = 0, shift;
+	struct timespec ts;
+	char buf[256];
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+	shift = c->stats_interval > 0 ? c->stats_interval : 0;
+	if (!c->cpu_last) {
+		cpustat_get(c->cpu_ns, count);
+		c->cpu_last = now;
+		return;
+	}
+	elapsed = now - c->cpu_last;
+	if (elapsed < NS_PER_SEC << shift)
+		return;
+
+	cpustat_get(ns, count);
+	total = 0;
+	for (i = 0; i < CPU_N_STAGES; i++) {
+		len += snprintf(buf + len, sizeof(buf) - len, " %s %" PRIu64,
+				cpustat_name(i),
+				(ns[i] - c->cpu_ns[i]) * 1000000 / elapsed);
+		total += ns[i] - c->cpu_ns[i];
+		c->cpu_ns[i] = ns[i];
+	}
+	c->cpu_last = now;
+	pr_info("cpu time [us/s]%s total %" PRIu64,
+		buf, total * 1000000 / elapsed);
+}
+
 int clock_poll(struct clock *c)
 {
-	int cnt, err, i, sde = 0;
+	int cnt, i, n, block, error, slot, sde = 0;
+	int wslot = (c->nports + 1) * N_CLOCK_PFD;
 	enum fsm_event event;
-	struct pollfd *cur;
 	struct port *p;
 
 	clock_check_pollfd(c);
-	cnt = poll(c->pollfd, (c->nports + 1) * N_CLOCK_PFD, -1);
+	if (wheel_arm(c->wheel))
+		return -1;
+	cnt = c->poll_spin ? clock_spin(c) : clock_wait(c, -1);
 	if (cnt < 0) {
 		if (EINTR == errno) {
 			return 0;
@@ -1418,51 +2901,116 @@ int clock_poll(struct clock *c)
 	} else if (!cnt) {
 		return 0;
 	}
+	clock_order_ready(c, cnt);
+	c->wakeups++;
+	c->events += cnt;
 
-	cur = c->pollfd;
-	LIST_FOREACH(p, &c->ports, list) {
-		/* Let the ports handle their events. */
-		for (i = err = 0; i < N_POLLFD && !err; i++) {
-			if (cur[i].revents & (POLLIN|POLLPRI)) {
-				event = port_event(p, i);
-				if (EV_STATE_DECISION_EVENT == event)
-					sde = 1;
-				if (EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES == event)
-					sde = 1;
-				err = port_dispatch(p, event, 0);
-				/* Clear any fault after a little while. */
-				if (PS_FAULTY == port_state(p)) {
-					clock_fault_timeout(p, 1);
-					break;
-				}
+	for (n = 0; n < cnt; n++) {
+		if (c->ready[n] < 0)
+			continue;
+		error = c->ready[n] & READY_ERROR;
+		slot = c->ready[n] & ~READY_ERROR;
+		if (error && slot >= wslot) {
+			pr_err("poll error on an internal descriptor");
+			return -1;
+		}
+		/* Check the port timers. */
+		if (slot == wslot + c->nworkers) {
+			if (clock_poll_wheel(c))
+				sde = 1;
+			continue;
+		}
+		/* Check the port threads. */
+		if (slot >= wslot) {
+			if (clock_poll_worker(c, c->workers[slot - wslot]))
+				sde = 1;
+			continue;
+		}
+		block = slot / N_CLOCK_PFD;
+		i = slot % N_CLOCK_PFD;
+		p = c->pollport[block];
+
+		/* Check the UDS port. */
+		if (p == c->uds_port) {
+			if (i == N_POLLFD)
+				continue;
+			/* Reading returns, and clears, the pending error. */
+			if (error)
+				pr_err("uds port: poll error");
+			event = port_event(p, i);
+			if (EV_STATE_DECISION_EVENT == event) {
+				port_set_bmc_changed(p);
+				sde = 1;
 			}
+			continue;
 		}
 
 		/* Check the fault timer. */
-		if (cur[N_POLLFD].revents & (POLLIN|POLLPRI)) {
+		if (i == N_POLLFD) {
+			if (error) {
+				pr_err("port %hu: poll error on the fault timer",
+				       port_number(p));
+				return -1;
+			}
 			clock_fault_timeout(p, 0);
 			port_dispatch(p, EV_FAULT_CLEARED, 0);
+			continue;
 		}
 
-		cur += N_CLOCK_PFD;
-	}
-
-	/* Check the UDS port. */
-	for (i = 0; i < N_POLLFD; i++) {
-		if (cur[i].revents & (POLLIN|POLLPRI)) {
-			event = port_event(c->uds_port, i);
-			if (EV_STATE_DECISION_EVENT == event)
-				sde = 1;
+		/* A socket which failed or hung up has nothing to read. */
+		if (error) {
+			pr_err("port %hu: poll error on socket %d",
+			       port_number(p), i);
+			event = EV_FAULT_DETECTED;
+		} else {
+			event = port_event(p, i);
+		}
+		if (EV_STATE_DECISION_EVENT == event ||
+		    EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES == event) {
+			port_set_bmc_changed(p);
+			sde = 1;
+		}
+		if (port_dispatch(p, event, 0))
+			clock_skip_ready(c, n + 1, cnt, block);
+		/* Clear any fault after a little while. */
+		if (PS_FAULTY == port_state(p)) {
+			clock_fault_timeout(p, 1);
+			clock_skip_ready(c, n + 1, cnt, block);
 		}
 	}
 
-	if (sde)
+	if (sde || c->sde) {
+		c->sde = 0;
 		handle_state_decision_event(c);
+	}
+	for (i = 0; i < c->ndomains; i++) {
+		if (!c->domains[i]->sde)
+			continue;
+		c->domains[i]->sde = 0;
+		handle_state_decision_event(c->domains[i]);
+	}
 
-	clock_prune_subscriptions(c);
+	clock_holdover_start(c);
+	if (cpustat_enabled)
+		clock_cpustat_report(c);
 	return 0;
 }
 
+void clock_pending_decision(struct clock *c)
+{
+	c->sde = 1;
+}
+
+void clock_mgmt_changed(struct clock *c)
+{
+	c->mgmt_gen++;
+}
+
+unsigned int clock_mgmt_gen(struct clock *c)
+{
+	return c->mgmt_gen;
+}
+
 void clock_path_delay(struct clock *c, tmv_t req, tmv_t rx)
 {
 	tsproc_up_ts(c->tsproc, req, rx);
@@ -1495,6 +3043,11 @@ int clock_slave_only(struct clock *c)
 	return c->dds.flags & DDS_SLAVE_ONLY;
 }
 
+int clock_summary_interval(struct clock *c)
+{
+	return c->stats_interval;
+}
+
 UInteger16 clock_steps_removed(struct clock *c)
 {
 	return c->cur.stepsRemoved;
@@ -1503,10 +3056,14 @@ UInteger16 clock_steps_removed(struct clock *c)
 int clock_switch_phc(struct clock *c, int phc_index)
 {
 	struct servo *servo;
-	int fadj, max_adj;
+	int fadj, max_adj, warm;
 	clockid_t clkid;
 	char phc[32];
 
+	/* The aligned PHCs stay in use as long as the slave port does. */
+	if (c->phcalign && phc_index == c->ref_phc_index)
+		return 0;
+
 	snprintf(phc, 31, "/dev/ptp%d", phc_index);
 	clkid = phc_open(phc);
 	if (clkid == CLOCK_INVALID) {
@@ -1521,85 +3078,583 @@ int clock_switch_phc(struct clock *c, int phc_index)
 	}
 	fadj = (int) clockadj_get_freq(clkid);
 	clockadj_set_freq(clkid, fadj);
+	if (c->phcalign && phcalign_locked(c->phcalign, phc_index)) {
+		/* It already runs at the frequency of the previous PHC. */
+		clock_restore_freq(c, clkid, phc, max_adj, NULL);
+		warm = 1;
+	} else {
+		warm = clock_restore_freq(c, clkid, phc, max_adj, &fadj);
+	}
 	servo = servo_create(c->config, c->servo_type, -fadj, max_adj, 0);
 	if (!servo) {
 		pr_err("Switching PHC, failed to create clock servo");
 		phc_close(clkid);
 		return -1;
 	}
+	if (warm)
+		servo_warm_start(servo, -fadj);
+	if (c->holdover && holdover_active(c->holdover)) {
+		holdover_stop(c->holdover);
+		wheel_clear(c->wheel, &c->holdover_timer);
+	}
 	phc_close(c->clkid);
 	servo_destroy(c->servo);
 	c->clkid = clkid;
 	c->servo = servo;
 	c->servo_state = SERVO_UNLOCKED;
+	clock_fast_lock_reset(c, warm);
+	if (c->stateshm)
+		stateshm_set_clock(c->stateshm, 0, phc);
+	if (c->phcalign)
+		phcalign_set_reference(c->phcalign, phc_index);
+	c->ref_phc_index = phc_index;
 	return 0;
 }
 
-enum servo_state clock_synchronize(struct clock *c, tmv_t ingress, tmv_t origin)
+static void clock_step(struct clock *c, int64_t offset)
 {
-	double adj, weight;
-	enum servo_state state = SERVO_UNLOCKED;
+	int i;
 
-	c->ingress_ts = ingress;
+	clockadj_step(c->clkid, -offset);
+	if (c->phcalign)
+		phcalign_step(c->phcalign, offset);
+	trace(TRACE_ADJ_STEP, 0, 0, 0, -offset);
+	c->ingress_ts = tmv_zero();
+	if (c->sanity_check)
+		clockcheck_step(c->sanity_check, -offset);
+	tsproc_reset(c->tsproc, 0);
+	/* The hosted domains time stamp with the same clock. */
+	for (i = 0; i < c->ndomains; i++) {
+		c->domains[i]->ingress_ts = tmv_zero();
+		tsproc_reset(c->domains[i]->tsproc, 0);
+	}
+}
 
-	tsproc_down_ts(c->tsproc, origin, ingress);
+/*
+ * Acquires a clock that has yet to synchronize, ahead of the servo. The
+ * first offset steps the clock right away. The following samples of the
+ * burst, taken while the frequency is left alone, give the frequency
+ * error as the slope of a least squares line, which then warm starts the
+ * servo. Returns non-zero while the sample is consumed by the burst.
+ */
+static int clock_fast_lock(struct clock *c, int64_t offset, tmv_t ingress)
+{
+	struct fast_lock *f = &c->fast_lock;
+	double det, drift, n, slope, t;
 
-	if (tsproc_update_offset(c->tsproc, &c->master_offset, &weight))
-		return state;
+	if (!f->samples)
+		return 0;
 
-	if (clock_utc_correct(c, ingress))
-		return c->servo_state;
+	if (!f->count++) {
+		if (f->step && llabs(offset) > f->step) {
+			pr_info("fast lock: stepping the clock by %" PRId64
+				" ns", -offset);
+			clock_step(c, offset);
+		}
+		return 1;
+	}
+	if (f->count == 2)
+		f->t0 = ingress;
 
-	c->cur.offsetFromMaster = tmv_to_TimeInterval(c->master_offset);
+	t = tmv_dbl(tmv_sub(ingress, f->t0)) / 1e9;
+	f->st += t;
+	f->so += offset;
+	f->stt += t * t;
+	f->sto += t * offset;
+	if (f->count <= f->samples)
+		return 1;
 
-	if (c->free_running)
-		return clock_no_adjust(c, ingress, origin);
+	f->samples = 0;
+	n = f->count - 1;
+	det = n * f->stt - f->st * f->st;
+	if (det <= 0.0)
+		return 0;
 
-	adj = servo_sample(c->servo, tmv_to_nanoseconds(c->master_offset),
-			   tmv_to_nanoseconds(ingress), weight, &state);
+	/* The offset grows by the frequency error, in ns per second. */
+	slope = (n * f->sto - f->st * f->so) / det;
+	drift = -clockadj_get_freq(c->clkid);
+	drift += (1e9 - drift) * slope / 1e9;
+	pr_info("fast lock: frequency %+.0f ppb from %.0f samples", -drift, n);
+	servo_warm_start(c->servo, drift);
+	return 0;
+}
+
+static void clock_fast_lock_reset(struct clock *c, int warm)
+{
+	struct fast_lock *f = &c->fast_lock;
+
+	f->samples = warm ? 0 : c->fast_lock_samples;
+	if (f->samples && f->samples < 2)
+		f->samples = 2;
+	f->count = 0;
+	f->st = f->so = f->stt = f->sto = 0.0;
+}
+
+/*
+ * Steers the clock by the offset of a source, which is either the clock
+ * itself or the selected one of its hosted domains.
+ */
+static enum servo_state clock_steer(struct clock *c, struct clock *src,
+				    tmv_t ingress, double weight)
+{
+	int64_t offset = tmv_to_nanoseconds(src->master_offset);
+	enum servo_state state = SERVO_UNLOCKED;
+	double adj;
+	int stage;
+
+	if (c->holdover && holdover_active(c->holdover))
+		clock_holdover_stop(c);
+
+	if (clock_fast_lock(c, offset, ingress)) {
+		c->servo_state = state;
+		return state;
+	}
+
+	stage = cpustat_enter(CPU_SERVO);
+	adj = servo_sample(c->servo, offset, tmv_to_nanoseconds(ingress),
+			   weight, &state);
+	cpustat_leave(stage);
 	c->servo_state = state;
+	trace(TRACE_SERVO, 0, 0, 0, offset);
+	if (c->servolog) {
+		servolog_put(c->servolog, src->dds.domainNumber,
+			     tmv_to_nanoseconds(ingress), offset,
+			     tmv_to_nanoseconds(src->path_delay), adj, weight,
+			     state);
+	}
 
 	if (c->stats.max_count > 1) {
-		clock_stats_update(&c->stats,
-				   tmv_to_nanoseconds(c->master_offset), adj);
+		clock_stats_update(&c->stats, offset, adj);
+	} else if (src != c) {
+		pr_info("domain %hhu: master offset %10" PRId64 " s%d "
+			"freq %+7.0f path delay %9" PRId64,
+			src->dds.domainNumber, offset, state, adj,
+			tmv_to_nanoseconds(src->path_delay));
 	} else {
 		pr_info("master offset %10" PRId64 " s%d freq %+7.0f "
 			"path delay %9" PRId64,
-			tmv_to_nanoseconds(c->master_offset), state, adj,
+			offset, state, adj,
 			tmv_to_nanoseconds(c->path_delay));
 	}
+	if (c->stateshm) {
+		stateshm_update(c->stateshm, 0,
+				pid2str(&src->dad.pds.parentPortIdentity),
+				offset, tmv_to_nanoseconds(src->path_delay),
+				-adj, state, tmv_to_nanoseconds(ingress));
+	}
+	clock_sample_notify(c, -adj, state);
 
-	tsproc_set_clock_rate_ratio(c->tsproc, clock_rate_ratio(c));
+	tsproc_set_clock_rate_ratio(src->tsproc, clock_rate_ratio(c));
 
 	switch (state) {
 	case SERVO_UNLOCKED:
 		break;
 	case SERVO_JUMP:
 		clockadj_set_freq(c->clkid, -adj);
-		clockadj_step(c->clkid, -tmv_to_nanoseconds(c->master_offset));
-		c->ingress_ts = tmv_zero();
-		if (c->sanity_check) {
+		if (c->sanity_check)
 			clockcheck_set_freq(c->sanity_check, -adj);
-			clockcheck_step(c->sanity_check,
-					-tmv_to_nanoseconds(c->master_offset));
-		}
-		tsproc_reset(c->tsproc, 0);
+		clock_step(c, offset);
 		break;
 	case SERVO_LOCKED:
 		clockadj_set_freq(c->clkid, -adj);
+		trace(TRACE_ADJ_FREQ, 0, 0, 0, -adj);
 		if (c->clkid == CLOCK_REALTIME)
 			sysclk_set_sync();
 		if (c->sanity_check)
 			clockcheck_set_freq(c->sanity_check, -adj);
+		if (c->freqfile)
+			freqfile_sample(c->freqfile, -adj);
+		if (c->holdover)
+			holdover_sample(c->holdover, -adj, offset);
 		break;
 	}
 	return state;
 }
 
+/* Tells whether the samples of a domain still come at its sync rate. */
+static int clock_sample_fresh(struct clock *d, uint64_t now)
+{
+	int n = d->log_sync_interval;
+	uint64_t interval;
+
+	if (!d->sample_time)
+		return 0;
+	if (n < -30)
+		n = -30;
+	else if (n > 30)
+		n = 30;
+	interval = n < 0 ? NS_PER_SEC >> -n : NS_PER_SEC << n;
+	/* Half an interval of slack for the jitter of the messages. */
+	return now - d->sample_time < interval + interval / 2;
+}
+
+/*
+ * Ranks the grand masters of two domains by their quality alone, as the
+ * same grand master may well serve both domains.
+ */
+static int clock_source_cmp(struct dataset *a, struct dataset *b)
+{
+	if (a->priority1 != b->priority1)
+		return b->priority1 - a->priority1;
+	if (a->quality.clockClass != b->quality.clockClass)
+		return b->quality.clockClass - a->quality.clockClass;
+	if (a->quality.clockAccuracy != b->quality.clockAccuracy)
+		return b->quality.clockAccuracy - a->quality.clockAccuracy;
+	if (a->quality.offsetScaledLogVariance !=
+	    b->quality.offsetScaledLogVariance)
+		return b->quality.offsetScaledLogVariance -
+			a->quality.offsetScaledLogVariance;
+	if (a->priority2 != b->priority2)
+		return b->priority2 - a->priority2;
+	return b->stepsRemoved - a->stepsRemoved;
+}
+
+/*
+ * Picks the domain whose offsets steer the clock on a new sample of one
+ * of the domains. Of the domains still receiving their sync messages,
+ * the one with the best grand master wins, and the current one stays on
+ * a tie.
+ * A failed grand master is thus left behind with the first sample of
+ * another domain after one missing sync message, without an announce
+ * timeout, and the servo simply carries on with the new input.
+ */
+static struct clock *clock_select(struct clock *c, struct clock *src)
+{
+	struct clock *best = NULL, *d;
+	struct timespec now;
+	uint64_t t;
+	int i, n;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	t = now.tv_sec * NS_PER_SEC + now.tv_nsec;
+	src->sample_time = t;
+
+	if (c->source->best && clock_sample_fresh(c->source, t))
+		best = c->source;
+	for (i = -1; i < c->ndomains; i++) {
+		d = i < 0 ? c : c->domains[i];
+		if (!d->best || !clock_sample_fresh(d, t))
+			continue;
+		if (!best ||
+		    clock_source_cmp(&d->best->dataset, &best->best->dataset) > 0)
+			best = d;
+	}
+	if (!best)
+		best = src;
+	if (best != c->source) {
+		pr_notice("domain %hhu: selected to steer the clock",
+			  best->dds.domainNumber);
+		c->source = best;
+		n = best->log_sync_interval;
+		servo_sync_interval(c->servo, n < 0 ? 1.0 / (1 << -n) : 1 << n);
+	}
+	return best;
+}
+
+static enum servo_state clock_select_sample(struct clock *c,
+					    struct clock *src,
+					    tmv_t ingress, double weight)
+{
+	if (clock_select(c, src) == src)
+		return clock_steer(c, src, ingress, weight);
+	/* The other domains follow the state of the servo. */
+	return c->servo_state == SERVO_LOCKED ? SERVO_LOCKED : SERVO_UNLOCKED;
+}
+
+enum servo_state clock_synchronize(struct clock *c, tmv_t ingress, tmv_t origin)
+{
+	enum servo_state state = SERVO_UNLOCKED;
+	double weight;
+
+	c->ingress_ts = ingress;
+
+	tsproc_down_ts(c->tsproc, origin, ingress);
+
+	if (tsproc_update_offset(c->tsproc, &c->master_offset, &weight))
+		return state;
+
+	if (clock_utc_correct(c, ingress))
+		return c->servo_state;
+
+	c->cur.offsetFromMaster = tmv_to_TimeInterval(c->master_offset);
+
+	if (c->primary && c->primary->domain_selection)
+		return clock_select_sample(c->primary, c, ingress, weight);
+
+	if (c->free_running)
+		return clock_no_adjust(c, ingress, origin);
+
+	if (c->domain_selection)
+		return clock_select_sample(c, c, ingress, weight);
+
+	return clock_steer(c, c, ingress, weight);
+}
+
+/* Global settings that clock_reload() applies, or leaves to the caller. */
+static const char *clock_live_options[] = {
+	/* the default data set */
+	"clockAccuracy",
+	"clockClass",
+	"offsetScaledLogVariance",
+	"priority1",
+	"priority2",
+	/* the servo */
+	"first_step_threshold",
+	"max_frequency",
+	"pi_integral_const",
+	"pi_integral_exponent",
+	"pi_integral_norm_max",
+	"pi_integral_scale",
+	"pi_proportional_const",
+	"pi_proportional_exponent",
+	"pi_proportional_norm_max",
+	"pi_proportional_scale",
+	"step_threshold",
+	"summary_interval",
+	"sync_sample_decimation",
+	/* applied by the caller */
+	"assume_two_step",
+	"check_fup_sync",
+	"logging_level",
+	"tx_timestamp_timeout",
+	"use_syslog",
+	"verbose",
+	NULL,
+};
+
+static int clock_option_live(const char *option)
+{
+	const char **live;
+
+	for (live = clock_live_options; *live; live++) {
+		if (!strcmp(*live, option))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Updates the parts of the default data set that come from the
+ * configuration.
+ */
+static void clock_reload_dds(struct clock *c)
+{
+	struct config *cfg = c->config;
+	struct defaultDS dds = c->dds;
+
+	dds.priority1 = config_get_int(cfg, NULL, "priority1");
+	dds.priority2 = config_get_int(cfg, NULL, "priority2");
+	dds.clockQuality.clockClass = config_get_int(cfg, NULL, "clockClass");
+	dds.clockQuality.clockAccuracy =
+		config_get_int(cfg, NULL, "clockAccuracy");
+	dds.clockQuality.offsetScaledLogVariance =
+		config_get_int(cfg, NULL, "offsetScaledLogVariance");
+	if (!config_get_int(cfg, NULL, "gmCapable") ||
+	    c->dds.flags & DDS_SLAVE_ONLY) {
+		dds.clockQuality.clockClass = 255;
+	}
+	c->dds = dds;
+}
+
+static struct interface *clock_find_interface(struct config *cfg,
+					      const char *name)
+{
+	struct interface *iface;
+
+	STAILQ_FOREACH(iface, &cfg->interfaces, list) {
+		if (!strcmp(iface->name, name))
+			return iface;
+	}
+	return NULL;
+}
+
+static struct port *clock_find_port(struct clock *c, const char *name)
+{
+	struct port *p;
+
+	LIST_FOREACH(p, &c->ports, list) {
+		if (!strcmp(port_name(p), name))
+			return p;
+	}
+	return NULL;
+}
+
+/*
+ * Opens a port again under the same number, in the same place.
+ */
+static int clock_reopen_port(struct clock *c, struct port *p)
+{
+	struct interface *iface;
+	struct port *np;
+
+	iface = clock_find_interface(c->config, port_name(p));
+	np = port_open(c->phc_index, c->timestamping, port_number(p),
+		       iface, c);
+	if (!np)
+		return -1;
+	LIST_INSERT_AFTER(p, np, list);
+	LIST_REMOVE(p, list);
+	port_close(p);
+	clock_fda_changed(c);
+	return 0;
+}
+
+int clock_reload(struct clock *c, struct config *cfg)
+{
+	int dds = 0, err = 0, i = 0, n = 0, servo = 0;
+	struct metrics_port *mp;
+	enum port_reload *action;
+	struct interface *iface;
+	struct port *p, *tmp;
+	const char *option;
+	struct clock *d;
+
+	/* The hosted domains hold on to the interfaces of our ports. */
+	LIST_FOREACH(p, &c->ports, list) {
+		if (c->ndomains && !clock_find_interface(cfg, port_name(p))) {
+			pr_err("%s is shared with other domains, "
+			       "removing it needs a restart", port_name(p));
+			return -1;
+		}
+	}
+
+	action = calloc(c->nports ? c->nports : 1, sizeof(*action));
+	if (!action) {
+		pr_err("low memory");
+		return -1;
+	}
+
+	while ((option = config_next_change(c->config, cfg, NULL, &i))) {
+		if (!clock_option_live(option)) {
+			pr_warning("%s changed, this needs a restart", option);
+			continue;
+		}
+		pr_info("%s changed", option);
+		if (!strncmp(option, "pri", 3) || !strncmp(option, "clock", 5) ||
+		    !strcmp(option, "offsetScaledLogVariance"))
+			dds = 1;
+		else
+			servo = 1;
+	}
+	if (config_get_int(c->config, NULL, "freq_est_interval") !=
+	    config_get_int(cfg, NULL, "freq_est_interval"))
+		servo = 1;
+
+	/* Compare the ports before their settings are replaced. */
+	LIST_FOREACH(p, &c->ports, list) {
+		if (!clock_find_interface(cfg, port_name(p))) {
+			pr_info("port %d: %s removed", port_number(p),
+				port_name(p));
+			action[n] = PORT_RELOAD_REOPEN;
+		} else {
+			action[n] = port_reload_check(p, c->config, cfg);
+		}
+		/* The hosted domains hold on to the transport. */
+		if (c->ndomains && action[n] == PORT_RELOAD_REOPEN) {
+			pr_warning("port %d: shared with other domains, "
+				   "this needs a restart", port_number(p));
+			action[n] = PORT_RELOAD_NONE;
+		}
+		n++;
+	}
+
+	config_adopt(c->config, cfg);
+
+	n = 0;
+	LIST_FOREACH_SAFE(p, &c->ports, list, tmp) {
+		switch (action[n++]) {
+		case PORT_RELOAD_NONE:
+			break;
+		case PORT_RELOAD_LIVE:
+			port_reload(p);
+			break;
+		case PORT_RELOAD_REOPEN:
+			if (!clock_find_interface(c->config, port_name(p))) {
+				clock_remove_port(c, p);
+			} else if (clock_reopen_port(c, p)) {
+				pr_err("port %d: failed to open %s again",
+				       port_number(p), port_name(p));
+				err = -1;
+			}
+			break;
+		}
+	}
+	free(action);
+
+	STAILQ_FOREACH(iface, &c->config->interfaces, list) {
+		if (clock_find_port(c, iface->name))
+			continue;
+		if (c->ndomains) {
+			pr_warning("%s added, this needs a restart",
+				   iface->name);
+			continue;
+		}
+		sk_get_ts_info(iface->name, &iface->ts_info);
+		if (clock_add_port(c, c->phc_index, c->timestamping, iface)) {
+			pr_err("failed to open port %s", iface->name);
+			err = -1;
+		}
+	}
+	LIST_FOREACH(p, &c->ports, list) {
+		if (port_state(p) == PS_INITIALIZING)
+			port_dispatch(p, EV_INITIALIZE, 0);
+	}
+	c->dds.numberPorts = c->nports;
+
+	/* Without memory, the metrics leave out the ports added last. */
+	if (c->metrics_ports && c->nports > c->metrics_nports) {
+		mp = calloc(c->nports, sizeof(*mp));
+		if (mp) {
+			free(c->metrics_ports);
+			c->metrics_ports = mp;
+			c->metrics_nports = c->nports;
+		} else {
+			pr_err("low memory");
+			err = -1;
+		}
+	}
+
+	if (servo) {
+		servo_reconfigure(c->servo, c->config);
+		c->stats_interval =
+			config_get_int(c->config, NULL, "summary_interval");
+		c->sample_decimation =
+			config_get_int(c->config, NULL, "sync_sample_decimation");
+		c->freq_est_interval =
+			config_get_int(c->config, NULL, "freq_est_interval");
+		clock_sync_interval(c, c->log_sync_interval);
+	}
+
+	if (dds)
+		clock_reload_dds(c);
+
+	/* Decide again, the ports that went away may have held the best. */
+	port_set_bmc_changed(c->uds_port);
+	handle_state_decision_event(c);
+
+	for (i = 0; i < c->ndomains; i++) {
+		d = c->domains[i];
+		if (servo) {
+			d->stats_interval = c->stats_interval;
+			d->sample_decimation = c->sample_decimation;
+			d->freq_est_interval = c->freq_est_interval;
+			clock_sync_interval(d, d->log_sync_interval);
+		}
+		if (dds)
+			clock_reload_dds(d);
+		LIST_FOREACH(p, &d->ports, list) {
+			port_set_bmc_changed(p);
+		}
+		handle_state_decision_event(d);
+	}
+	return err;
+}
+
 void clock_sync_interval(struct clock *c, int n)
 {
 	int shift;
 
+	c->log_sync_interval = n;
 	shift = c->freq_est_interval - n;
 	if (shift < 0)
 		shift = 0;
@@ -1626,26 +3681,63 @@ struct timePropertiesDS *clock_time_properties(struct clock *c)
 	return &c->tds;
 }
 
+static void clock_check_time_properties(struct clock *c,
+					struct timePropertiesDS *old)
+{
+	if (memcmp(old, &c->tds, sizeof(*old)))
+		clock_notify_event(c, NOTIFY_TIME_PROPERTIES);
+}
+
 void clock_update_time_properties(struct clock *c, struct timePropertiesDS tds)
 {
+	struct timePropertiesDS old = c->tds;
+
 	c->tds = tds;
+	clock_mgmt_changed(c);
+	clock_check_time_properties(c, &old);
+}
+
+static int dataset_eq(struct dataset *a, struct dataset *b)
+{
+	return a->priority1 == b->priority1 &&
+		cid_eq(&a->identity, &b->identity) &&
+		!memcmp(&a->quality, &b->quality, sizeof(a->quality)) &&
+		a->priority2 == b->priority2 &&
+		a->stepsRemoved == b->stepsRemoved &&
+		!memcmp(&a->sender, &b->sender, sizeof(a->sender)) &&
+		!memcmp(&a->receiver, &b->receiver, sizeof(a->receiver));
 }
 
+/*
+ * Only the ports whose Erbest or state changed since the last decision
+ * are decided again, unless Ebest or the default data set changed,
+ * which are the inputs shared by all of the ports.
+ */
 static void handle_state_decision_event(struct clock *c)
 {
 	struct foreign_clock *best = NULL, *fc;
+	struct timePropertiesDS old_tds;
 	struct ClockIdentity best_id;
 	struct port *piter;
-	int fresh_best = 0;
+	int all, fresh_best = 0, stage;
+
+	stage = cpustat_enter(CPU_BMC);
+
+	/* A state decision event of the UDS port means a new D0. */
+	all = c->primary ? 0 : port_clear_bmc_changed(c->uds_port);
 
 	LIST_FOREACH(piter, &c->ports, list) {
-		fc = port_compute_best(piter);
+		fc = port_update_best(piter);
 		if (!fc)
 			continue;
 		if (!best || dscmp(&fc->dataset, &best->dataset) > 0)
 			best = fc;
 	}
 
+	if (best != c->best ||
+	    (best && !dataset_eq(&best->dataset, &c->best_ds)))
+		all = 1;
+
 	if (best) {
 		best_id = best->dataset.identity;
 	} else {
@@ -1659,18 +3751,23 @@ static void handle_state_decision_event(struct clock *c)
 		clock_freq_est_reset(c);
 		tsproc_reset(c->tsproc, 1);
 		c->ingress_ts = tmv_zero();
-		c->path_delay = 0;
+		c->path_delay = tmv_zero();
 		c->nrr = 1.0;
 		fresh_best = 1;
 	}
 
 	c->best = best;
 	c->best_id = best_id;
+	if (best)
+		c->best_ds = best->dataset;
 
 	LIST_FOREACH(piter, &c->ports, list) {
 		enum port_state ps;
 		enum fsm_event event;
+		if (!port_clear_bmc_changed(piter) && !all)
+			continue;
 		ps = bmc_state_decision(c, piter);
+		old_tds = c->tds;
 		switch (ps) {
 		case PS_LISTENING:
 			event = EV_NONE;
@@ -1694,8 +3791,12 @@ static void handle_state_decision_event(struct clock *c)
 			event = EV_FAULT_DETECTED;
 			break;
 		}
+		/* Let the subscribers know before the port changes state. */
+		clock_check_time_properties(c, &old_tds);
 		port_dispatch(piter, event, fresh_best);
 	}
+	clock_mgmt_changed(c);
+	cpustat_leave(stage);
 }
 
 struct clock_description *clock_description(struct clock *c)
@@ -1717,6 +3818,11 @@ void clock_check_ts(struct clock *c, struct timespec ts)
 	}
 }
 
+tmv_t clock_master_offset(struct clock *c)
+{
+	return c->master_offset;
+}
+
 double clock_rate_ratio(struct clock *c)
 {
 	return servo_rate_ratio(c->servo);
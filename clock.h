@@ -30,6 +30,8 @@
 #include "transport.h"
 
 struct ptp_message; /*forward declaration*/
+struct wheel;
+struct worker;
 
 /** Opaque type. */
 struct clock;
@@ -72,6 +74,22 @@ UInteger8 clock_class(struct clock *c);
  */
 struct config *clock_config(struct clock *c);
 
+/**
+ * Obtains the worker thread that receives messages for a port.
+ * @param c       The clock instance.
+ * @param number  The number of the port.
+ * @return        A pointer to the worker, or NULL if the port's messages
+ *                are received by the clock's own thread.
+ */
+struct worker *clock_worker(struct clock *c, int number);
+
+/**
+ * Obtains the timer wheel that serves the timers of all ports.
+ * @param c  The clock instance.
+ * @return   A pointer to the timer wheel, without fail.
+ */
+struct wheel *clock_wheel(struct clock *c);
+
 /**
  * Create a clock instance. There can only be one clock in any system,
  * so subsequent calls will destroy the previous clock instance.
@@ -98,6 +116,15 @@ struct dataset *clock_default_ds(struct clock *c);
  */
 void clock_destroy(struct clock *c);
 
+/**
+ * Find the clock of another domain hosted on the ports of a clock, as
+ * configured with the secondary_domains option.
+ * @param c       The clock instance.
+ * @param domain  The domain number.
+ * @return        The clock of that domain, or NULL if there is none.
+ */
+struct clock *clock_domain(struct clock *c, int domain);
+
 /**
  * Obtain the domain number from a clock's default data set.
  * @param c  The clock instance.
@@ -204,6 +231,29 @@ void clock_path_delay(struct clock *c, tmv_t req, tmv_t rx);
 void clock_peer_delay(struct clock *c, tmv_t ppd, tmv_t req, tmv_t rx,
 		      double nrr);
 
+/**
+ * Schedule a state decision event for a clock, to be handled at the end
+ * of the current call to clock_poll(). This is how the events of the
+ * ports of a hosted domain reach their clock.
+ * @param c  The clock instance.
+ */
+void clock_pending_decision(struct clock *c);
+
+/**
+ * Invalidate the cached management responses of a clock and its ports,
+ * after a change of their data sets.
+ * @param c  The clock instance.
+ */
+void clock_mgmt_changed(struct clock *c);
+
+/**
+ * Obtain the generation of the data sets of a clock and its ports, which
+ * tags the cached management responses.
+ * @param c  The clock instance.
+ * @return   A number which changes with every clock_mgmt_changed().
+ */
+unsigned int clock_mgmt_gen(struct clock *c);
+
 /**
  * Poll for events and dispatch them.
  * @param c A pointer to a clock instance obtained with clock_create().
@@ -218,6 +268,14 @@ int clock_poll(struct clock *c);
  */
 int clock_slave_only(struct clock *c);
 
+/**
+ * Obtain the interval of the clock's summary statistics.
+ * @param c  The clock instance.
+ * @return   The value of the summary_interval option, as log base 2 of
+ *           the interval in seconds.
+ */
+int clock_summary_interval(struct clock *c);
+
 /**
  * Obtain the steps removed field from a clock's current data set.
  * @param c  The clock instance.
@@ -225,6 +283,20 @@ int clock_slave_only(struct clock *c);
  */
 UInteger16 clock_steps_removed(struct clock *c);
 
+/**
+ * Apply a new configuration to a running clock. Servo constants, message
+ * intervals and the default data set are updated in place, the ports of
+ * new interfaces are opened, those of removed interfaces are closed, and
+ * a port is only opened again when a setting it cannot change while
+ * running has changed. Settings of the clock that need a restart are
+ * reported and otherwise ignored. Afterwards, @a cfg holds the
+ * interfaces that were removed and is to be destroyed by the caller.
+ * @param c    The clock instance.
+ * @param cfg  The new configuration, see config_reread().
+ * @return     Zero on success, non-zero if some port failed to open.
+ */
+int clock_reload(struct clock *c, struct config *cfg);
+
 /**
  * Switch to a new PTP Hardware Clock, for use with the "jbod" mode.
  * @param c          The clock instance.
@@ -289,6 +361,13 @@ enum clock_type clock_type(struct clock *c);
  */
 void clock_check_ts(struct clock *c, struct timespec ts);
 
+/**
+ * Obtain the latest offset of the clock from its master.
+ * @param c  The clock instance.
+ * @return   The offset from the master.
+ */
+tmv_t clock_master_offset(struct clock *c);
+
 /**
  * Obtain ratio between master's frequency and current clock frequency.
  * @param c  The clock instance.
@@ -18,21 +18,113 @@
  */
 
 #include <math.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "clockadj.h"
+#include "cpustat.h"
 #include "missing.h"
 #include "print.h"
 
 #define NS_PER_SEC 1000000000LL
 
+#define MAX_CACHED_CLOCKS 16
+/*
+ * The status of the system clock is renewed at this interval. Its
+ * maximum error grows by 500 ppm, i.e. only by 5 ms in 10 seconds.
+ */
+#define SYNC_INTERVAL (10 * NS_PER_SEC)
+
+/*
+ * The last frequency written to each clock initialized by clockadj_init().
+ * The entries are added before the clocks are used, so each entry is only
+ * accessed by the thread adjusting its clock.
+ */
+struct freq_cache {
+	clockid_t clkid;
+	int valid;
+	long freq;
+	long tick;
+	double ppb;
+};
+
+static struct freq_cache freq_cache[MAX_CACHED_CLOCKS];
+static int freq_cache_len;
+static double min_freq_change;
+static atomic_ulong adj_issued, adj_avoided;
+static uint64_t realtime_last_sync;
+
+/*
+ * The clock CLOCK_REPLAY runs on the time stamps of the capture, which
+ * the frequency and the steps are applied to.
+ */
+static struct {
+	long freq;
+	int64_t stepped;
+	unsigned int steps;
+	int64_t raw;
+	double phase;
+} replay_clock;
+
 static int realtime_leap_bit;
 static long realtime_hz;
 static long realtime_nominal_tick;
 
+static struct freq_cache *freq_cache_find(clockid_t clkid)
+{
+	int i;
+
+	for (i = 0; i < freq_cache_len; i++) {
+		if (freq_cache[i].clkid == clkid)
+			return &freq_cache[i];
+	}
+	return NULL;
+}
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now))
+		return 0;
+	return now.tv_sec * NS_PER_SEC + now.tv_nsec;
+}
+
+/* Like clock_adjtime(), but CLOCK_REPLAY only keeps the values. */
+static int clockadj_adjtime(clockid_t clkid, struct timex *tx)
+{
+	int err, stage;
+
+	if (clkid != CLOCK_REPLAY) {
+		stage = cpustat_enter(CPU_CLOCKADJ);
+		err = clock_adjtime(clkid, tx);
+		cpustat_leave(stage);
+		return err;
+	}
+
+	if (tx->modes & ADJ_FREQUENCY)
+		replay_clock.freq = tx->freq;
+	if (tx->modes & ADJ_SETOFFSET) {
+		replay_clock.stepped += tx->time.tv_sec * NS_PER_SEC +
+			tx->time.tv_usec;
+		replay_clock.steps++;
+	}
+	tx->freq = replay_clock.freq;
+	return 0;
+}
+
 void clockadj_init(clockid_t clkid)
 {
+	struct freq_cache *entry = freq_cache_find(clkid);
+
+	if (!entry && freq_cache_len < MAX_CACHED_CLOCKS) {
+		entry = &freq_cache[freq_cache_len++];
+		entry->clkid = clkid;
+	}
+	if (entry)
+		entry->valid = 0;
+
 #ifdef _SC_CLK_TCK
 	if (clkid == CLOCK_REALTIME) {
 		/* This is USER_HZ in the kernel. */
@@ -46,11 +138,31 @@ void clockadj_init(clockid_t clkid)
 #endif
 }
 
+void clockadj_set_min_change(double ppb)
+{
+	min_freq_change = ppb;
+}
+
+void clockadj_get_stats(unsigned long *issued, unsigned long *avoided)
+{
+	*issued = atomic_load(&adj_issued);
+	*avoided = atomic_load(&adj_avoided);
+}
+
 void clockadj_set_freq(clockid_t clkid, double freq)
 {
+	struct freq_cache *entry = freq_cache_find(clkid);
+	double ppb = freq;
 	struct timex tx;
 	memset(&tx, 0, sizeof(tx));
 
+	/* Skip the writes which would not change the frequency noticeably. */
+	if (entry && entry->valid && min_freq_change > 0.0 &&
+	    fabs(ppb - entry->ppb) < min_freq_change) {
+		atomic_fetch_add(&adj_avoided, 1);
+		return;
+	}
+
 	/* With system clock set also the tick length. */
 	if (clkid == CLOCK_REALTIME && realtime_nominal_tick) {
 		tx.modes |= ADJ_TICK;
@@ -60,16 +172,41 @@ void clockadj_set_freq(clockid_t clkid, double freq)
 
 	tx.modes |= ADJ_FREQUENCY;
 	tx.freq = (long) (freq * 65.536);
-	if (clock_adjtime(clkid, &tx) < 0)
+
+	/* The value is the same in the resolution of the kernel. */
+	if (entry && entry->valid &&
+	    entry->freq == tx.freq && entry->tick == tx.tick) {
+		atomic_fetch_add(&adj_avoided, 1);
+		return;
+	}
+
+	atomic_fetch_add(&adj_issued, 1);
+	if (clockadj_adjtime(clkid, &tx) < 0) {
 		pr_err("failed to adjust the clock: %m");
+		if (entry)
+			entry->valid = 0;
+	} else if (entry) {
+		entry->valid = 1;
+		entry->freq = tx.freq;
+		entry->tick = tx.tick;
+		entry->ppb = ppb;
+	}
 }
 
 double clockadj_get_freq(clockid_t clkid)
 {
+	struct freq_cache *entry = freq_cache_find(clkid);
 	double f = 0.0;
 	struct timex tx;
 	memset(&tx, 0, sizeof(tx));
-	if (clock_adjtime(clkid, &tx) < 0) {
+
+	/*
+	 * The reading may fail silently on older kernels, so the next
+	 * write must not be skipped, even if the value is the same.
+	 */
+	if (entry)
+		entry->valid = 0;
+	if (clockadj_adjtime(clkid, &tx) < 0) {
 		pr_err("failed to read out the clock frequency adjustment: %m");
 	} else {
 		f = tx.freq / 65.536;
@@ -99,8 +236,33 @@ void clockadj_step(clockid_t clkid, int64_t step)
 		tx.time.tv_sec  -= 1;
 		tx.time.tv_usec += 1000000000;
 	}
-	if (clock_adjtime(clkid, &tx) < 0)
+	if (clockadj_adjtime(clkid, &tx) < 0)
 		pr_err("failed to step clock: %m");
+	if (clkid == CLOCK_REALTIME)
+		realtime_last_sync = 0;
+}
+
+struct timespec clockadj_replay_time(struct timespec raw)
+{
+	int64_t ns = raw.tv_sec * NS_PER_SEC + raw.tv_nsec;
+	struct timespec ts;
+
+	if (replay_clock.raw) {
+		replay_clock.phase += (ns - replay_clock.raw) *
+			(replay_clock.freq / 65.536e9);
+	}
+	replay_clock.raw = ns;
+	ns += replay_clock.stepped + (int64_t) replay_clock.phase;
+	ts.tv_sec = ns / NS_PER_SEC;
+	ts.tv_nsec = ns % NS_PER_SEC;
+	return ts;
+}
+
+int64_t clockadj_get_replay(double *freq, unsigned int *steps)
+{
+	*freq = replay_clock.freq / 65.536;
+	*steps = replay_clock.steps;
+	return replay_clock.stepped;
 }
 
 void sysclk_set_leap(int leap)
@@ -127,6 +289,7 @@ void sysclk_set_leap(int leap)
 	else if (m)
 		pr_notice("%s", m);
 	realtime_leap_bit = tx.status;
+	realtime_last_sync = 0;
 }
 
 void sysclk_set_tai_offset(int offset)
@@ -166,6 +329,16 @@ void sysclk_set_sync(void)
 {
 	clockid_t clkid = CLOCK_REALTIME;
 	struct timex tx;
+	uint64_t now = monotonic_ns();
+
+	/* Renew the status only once in a while, or after a change. */
+	if (realtime_last_sync && now &&
+	    now - realtime_last_sync < SYNC_INTERVAL) {
+		atomic_fetch_add(&adj_avoided, 1);
+		return;
+	}
+	atomic_fetch_add(&adj_issued, 1);
+
 	memset(&tx, 0, sizeof(tx));
 	/* Clear the STA_UNSYNC flag from the status and keep the maxerror
 	   value (which is increased automatically by 500 ppm) below 16 seconds
@@ -174,4 +347,6 @@ void sysclk_set_sync(void)
 	tx.status = realtime_leap_bit;
 	if (clock_adjtime(clkid, &tx) < 0)
 		pr_err("failed to set clock status and maximum error: %m");
+	else
+		realtime_last_sync = now;
 }
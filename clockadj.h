@@ -23,6 +23,13 @@
 #include <inttypes.h>
 #include <time.h>
 
+/*
+ * A clock which exists only in this process, adjusted by the servo when
+ * recorded traffic is replayed. The value is outside of the ranges used
+ * by the kernel, so it is never passed to a system call by mistake.
+ */
+#define CLOCK_REPLAY ((clockid_t) 0x7ffffff3)
+
 /**
  * Initialize state needed when adjusting or reading the clock.
  * @param clkid A clock ID obtained using phc_open() or CLOCK_REALTIME.
@@ -30,7 +37,26 @@
 void clockadj_init(clockid_t clkid);
 
 /**
- * Set clock's frequency offset.
+ * Set the smallest change of the frequency offset written to a clock.
+ * Smaller changes from the last value written by clockadj_set_freq() are
+ * skipped, as are the changes below the resolution of the kernel.
+ * @param ppb  The minimum change in parts per billion, or 0 to write all
+ *             the changes which the kernel can represent.
+ */
+void clockadj_set_min_change(double ppb);
+
+/**
+ * Get the number of frequency and status adjustments issued to the
+ * kernel and of those skipped because they would not change the clock.
+ * @param issued   Receives the number of issued adjustments.
+ * @param avoided  Receives the number of skipped adjustments.
+ */
+void clockadj_get_stats(unsigned long *issued, unsigned long *avoided);
+
+/**
+ * Set clock's frequency offset. A value which is the same as the last one
+ * written to a clock initialized by clockadj_init() is skipped, as is a
+ * change smaller than the value set by clockadj_set_min_change().
  * @param clkid A clock ID obtained using phc_open() or CLOCK_REALTIME.
  * @param freq  The frequency offset in parts per billion (ppb).
  */
@@ -50,6 +76,23 @@ double clockadj_get_freq(clockid_t clkid);
  */
 void clockadj_step(clockid_t clkid, int64_t step);
 
+/**
+ * Read the clock CLOCK_REPLAY. The time stamps of a capture are taken
+ * as those of a free running clock, to which the frequency offset and
+ * the steps written since are applied.
+ * @param raw  A time stamp of the capture.
+ * @return     The time of CLOCK_REPLAY.
+ */
+struct timespec clockadj_replay_time(struct timespec raw);
+
+/**
+ * Read the adjustments made to the clock CLOCK_REPLAY.
+ * @param freq   Receives the frequency offset in parts per billion (ppb).
+ * @param steps  Receives the number of steps.
+ * @return       The sum of the steps in nanoseconds.
+ */
+int64_t clockadj_get_replay(double *freq, unsigned int *steps);
+
 /**
  * Set the system clock to insert/delete leap second at midnight.
  * @param leap  +1 to insert leap second, -1 to delete leap second,
@@ -71,7 +114,8 @@ int sysclk_max_freq(void);
 
 /**
  * Mark the system clock as synchronized to let the kernel synchronize
- * the real-time clock (RTC) to it.
+ * the real-time clock (RTC) to it. The status is only renewed every few
+ * seconds, or after the clock was stepped or its leap status changed.
  */
 void sysclk_set_sync(void);
 #endif
@@ -38,6 +38,9 @@ struct clockcheck {
 	int min_freq;
 	uint64_t last_ts;
 	uint64_t last_mono_ts;
+	/* Time stamps per check, and since the last check */
+	unsigned int period;
+	unsigned int samples;
 };
 
 struct clockcheck *clockcheck_create(int freq_limit)
@@ -49,12 +52,13 @@ struct clockcheck *clockcheck_create(int freq_limit)
 	cc->freq_limit = freq_limit;
 	cc->max_freq = -CHECK_MAX_FREQ;
 	cc->min_freq = CHECK_MAX_FREQ;
+	cc->period = 1;
 	return cc;
 }
 
-int clockcheck_sample(struct clockcheck *cc, uint64_t ts)
+static int clockcheck_check(struct clockcheck *cc, uint64_t ts,
+			    uint64_t mono_ts)
 {
-	uint64_t mono_ts;
 	int64_t interval, mono_interval;
 	double max_foffset, min_foffset;
 	struct timespec now;
@@ -69,12 +73,17 @@ int clockcheck_sample(struct clockcheck *cc, uint64_t ts)
 	if (!cc->freq_known)
 		return ret;
 
+	if (++cc->samples < cc->period)
+		return ret;
+
 	interval = (int64_t)ts - cc->last_ts;
 	if (interval >= 0 && interval < CHECK_MIN_INTERVAL)
 		return ret;
 
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	mono_ts = now.tv_sec * 1000000000LL + now.tv_nsec;
+	if (!mono_ts) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		mono_ts = now.tv_sec * 1000000000LL + now.tv_nsec;
+	}
 	mono_interval = (int64_t)mono_ts - cc->last_mono_ts;
 
 	if (mono_interval < CHECK_MIN_INTERVAL)
@@ -102,10 +111,28 @@ int clockcheck_sample(struct clockcheck *cc, uint64_t ts)
 	cc->last_mono_ts = mono_ts;
 	cc->last_ts = ts;
 	cc->max_freq = cc->min_freq = cc->current_freq;
+	cc->samples = 0;
 
 	return ret;
 }
 
+int clockcheck_sample(struct clockcheck *cc, uint64_t ts)
+{
+	/* The monotonic clock is only read when the check is due. */
+	return clockcheck_check(cc, ts, 0);
+}
+
+int clockcheck_sample_mono(struct clockcheck *cc, uint64_t ts,
+			   uint64_t mono_ts)
+{
+	return clockcheck_check(cc, ts, mono_ts);
+}
+
+void clockcheck_set_period(struct clockcheck *cc, unsigned int period)
+{
+	cc->period = period ? period : 1;
+}
+
 void clockcheck_set_freq(struct clockcheck *cc, int freq)
 {
 	if (cc->max_freq < freq)
@@ -41,6 +41,25 @@ struct clockcheck *clockcheck_create(int freq_limit);
  */
 int clockcheck_sample(struct clockcheck *cc, uint64_t ts);
 
+/**
+ * Perform the sanity check on a time stamp, comparing it with a time
+ * stamp of the system monotonic clock which the caller already took at
+ * about the same time.
+ * @param cc      Pointer to a clock check obtained via @ref clockcheck_create().
+ * @param ts      Time stamp made by the clock in nanoseconds.
+ * @param mono_ts Time stamp made by CLOCK_MONOTONIC in nanoseconds.
+ * @return Zero if ts passed the check, non-zero otherwise.
+ */
+int clockcheck_sample_mono(struct clockcheck *cc, uint64_t ts,
+			   uint64_t mono_ts);
+
+/**
+ * Check only one of a number of consecutive time stamps.
+ * @param cc     Pointer to a clock check obtained via @ref clockcheck_create().
+ * @param period The number of time stamps per check, one by default.
+ */
+void clockcheck_set_period(struct clockcheck *cc, unsigned int period);
+
 /**
  * Inform clock check about changes in current frequency of the clock.
  * @param cc   Pointer to a clock check obtained via @ref clockcheck_create().
@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "clock.h"
 #include "config.h"
 #include "ether.h"
 #include "hash.h"
@@ -128,14 +129,34 @@ struct config_item {
 static struct config_enum clock_servo_enu[] = {
 	{ "pi",     CLOCK_SERVO_PI     },
 	{ "linreg", CLOCK_SERVO_LINREG },
+	{ "kalman", CLOCK_SERVO_KALMAN },
 	{ "ntpshm", CLOCK_SERVO_NTPSHM },
 	{ "nullf",  CLOCK_SERVO_NULLF  },
+	{ "refclock_sock", CLOCK_SERVO_REFCLOCK_SOCK },
+	{ "auto",   CLOCK_SERVO_AUTO   },
+	{ NULL, 0 },
+};
+
+static struct config_enum clock_type_enu[] = {
+	{ "OC",     CLOCK_TYPE_ORDINARY },
+	{ "BC",     CLOCK_TYPE_BOUNDARY },
+	{ "P2P_TC", CLOCK_TYPE_P2P      },
+	{ "E2E_TC", CLOCK_TYPE_E2E      },
 	{ NULL, 0 },
 };
 
 static struct config_enum delay_filter_enu[] = {
 	{ "moving_average", FILTER_MOVING_AVERAGE },
 	{ "moving_median",  FILTER_MOVING_MEDIAN  },
+	{ "moving_quantile", FILTER_MOVING_QUANTILE },
+	{ NULL, 0 },
+};
+
+static struct config_enum hwts_filter_enu[] = {
+	{ "normal",    HWTS_FILTER_NORMAL    },
+	{ "sync",      HWTS_FILTER_SYNC      },
+	{ "delay_req", HWTS_FILTER_DELAY_REQ },
+	{ "auto",      HWTS_FILTER_AUTO      },
 	{ NULL, 0 },
 };
 
@@ -150,6 +171,8 @@ static struct config_enum nw_trans_enu[] = {
 	{ "L2",    TRANS_IEEE_802_3 },
 	{ "UDPv4", TRANS_UDP_IPV4   },
 	{ "UDPv6", TRANS_UDP_IPV6   },
+	{ "XDP",   TRANS_XDP        },
+	{ "replay", TRANS_REPLAY    },
 	{ NULL, 0 },
 };
 
@@ -157,6 +180,7 @@ static struct config_enum timestamping_enu[] = {
 	{ "hardware", TS_HARDWARE  },
 	{ "software", TS_SOFTWARE  },
 	{ "legacy",   TS_LEGACY_HW },
+	{ "p2p1step", TS_P2P1STEP  },
 	{ NULL, 0 },
 };
 
@@ -165,48 +189,87 @@ static struct config_enum tsproc_enu[] = {
 	{ "raw",           TSPROC_RAW           },
 	{ "filter_weight", TSPROC_FILTER_WEIGHT },
 	{ "raw_weight",    TSPROC_RAW_WEIGHT    },
+	{ "min_delay",     TSPROC_MIN_DELAY     },
 	{ NULL, 0 },
 };
 
 struct config_item config_tab[] = {
+	PORT_ITEM_INT("adaptive_interval", 0, 0, 1),
+	PORT_ITEM_INT("adaptive_lock_count", 16, 1, INT_MAX),
+	PORT_ITEM_INT("adaptive_logMinDelayReqInterval", 2, INT8_MIN, INT8_MAX),
+	PORT_ITEM_INT("adaptive_logSyncInterval", 1, INT8_MIN, INT8_MAX),
+	PORT_ITEM_INT("adaptive_offset_threshold", 1000, 0, INT_MAX),
+	PORT_ITEM_INT("allow_interval_requests", 0, 0, 1),
 	PORT_ITEM_INT("announceReceiptTimeout", 3, 2, UINT8_MAX),
 	GLOB_ITEM_INT("assume_two_step", 0, 0, 1),
 	PORT_ITEM_INT("boundary_clock_jbod", 0, 0, 1),
+	PORT_ITEM_INT("busy_poll", 0, 0, INT_MAX),
 	GLOB_ITEM_INT("check_fup_sync", 0, 0, 1),
 	GLOB_ITEM_INT("clockAccuracy", 0xfe, 0, UINT8_MAX),
 	GLOB_ITEM_INT("clockClass", 248, 0, UINT8_MAX),
 	GLOB_ITEM_ENU("clock_servo", CLOCK_SERVO_PI, clock_servo_enu),
+	GLOB_ITEM_INT("clock_thread_cpu", -1, -1, INT_MAX),
+	GLOB_ITEM_ENU("clock_type", CLOCK_TYPE_ORDINARY, clock_type_enu),
+	GLOB_ITEM_INT("cpu_accounting", 0, 0, 1),
 	PORT_ITEM_INT("delayAsymmetry", 0, INT_MIN, INT_MAX),
 	PORT_ITEM_ENU("delay_filter", FILTER_MOVING_MEDIAN, delay_filter_enu),
+	PORT_ITEM_STR("delay_filter_chain", ""),
 	PORT_ITEM_INT("delay_filter_length", 10, 1, INT_MAX),
+	PORT_ITEM_DBL("delay_filter_quantile", 0.5, 0.0, 1.0),
 	PORT_ITEM_ENU("delay_mechanism", DM_E2E, delay_mech_enu),
+	PORT_ITEM_INT("delay_resp_batch", 0, 0, 1000000),
 	GLOB_ITEM_INT("dscp_event", 0, 0, 63),
 	GLOB_ITEM_INT("dscp_general", 0, 0, 63),
 	GLOB_ITEM_INT("domainNumber", 0, 0, 127),
+	GLOB_ITEM_INT("domain_selection", 0, 0, 1),
 	PORT_ITEM_INT("egressLatency", 0, INT_MIN, INT_MAX),
+	GLOB_ITEM_INT("fast_lock", 0, 0, INT_MAX),
 	PORT_ITEM_INT("fault_badpeernet_interval", 16, INT32_MIN, INT32_MAX),
 	PORT_ITEM_INT("fault_reset_interval", 4, INT8_MIN, INT8_MAX),
 	GLOB_ITEM_DBL("first_step_threshold", 0.00002, 0.0, DBL_MAX),
 	PORT_ITEM_INT("follow_up_info", 0, 0, 1),
 	GLOB_ITEM_INT("free_running", 0, 0, 1),
 	PORT_ITEM_INT("freq_est_interval", 1, 0, INT_MAX),
+	GLOB_ITEM_STR("freq_file", ""),
 	GLOB_ITEM_INT("gmCapable", 1, 0, 1),
+	GLOB_ITEM_INT("holdover", 0, 0, 1),
+	GLOB_ITEM_STR("holdover_temp_file", ""),
+	GLOB_ITEM_INT("holdover_window", 1024, 64, INT_MAX),
+	GLOB_ITEM_ENU("hwts_filter", HWTS_FILTER_NORMAL, hwts_filter_enu),
 	PORT_ITEM_INT("hybrid_e2e", 0, 0, 1),
 	PORT_ITEM_INT("ingressLatency", 0, INT_MIN, INT_MAX),
+	GLOB_ITEM_INT("init_threads", 0, 0, INT_MAX),
+	GLOB_ITEM_INT("jbod_align", 0, 0, 1),
+	GLOB_ITEM_INT("jbod_align_interval", -2, -7, 7),
+	PORT_ITEM_INT("kernel_filter", 1, 0, 1),
 	GLOB_ITEM_INT("kernel_leap", 1, 0, 1),
+	GLOB_ITEM_INT("lock_memory", 0, 0, 1),
 	PORT_ITEM_INT("logAnnounceInterval", 1, INT8_MIN, INT8_MAX),
 	PORT_ITEM_INT("logMinDelayReqInterval", 0, INT8_MIN, INT8_MAX),
 	PORT_ITEM_INT("logMinPdelayReqInterval", 0, INT8_MIN, INT8_MAX),
 	PORT_ITEM_INT("logSyncInterval", 0, INT8_MIN, INT8_MAX),
 	GLOB_ITEM_INT("logging_level", LOG_INFO, PRINT_LEVEL_MIN, PRINT_LEVEL_MAX),
+	GLOB_ITEM_INT("logging_queue", 0, 0, 65536),
+	GLOB_ITEM_INT("management_burst", 100, 1, INT_MAX),
+	GLOB_ITEM_DBL("management_rate", 100.0, 0.0, DBL_MAX),
 	GLOB_ITEM_STR("manufacturerIdentity", "00:00:00"),
 	GLOB_ITEM_INT("max_frequency", 900000000, 0, INT_MAX),
+	GLOB_ITEM_STR("metrics_address", ""),
+	GLOB_ITEM_DBL("min_freq_change", 0.0, 0.0, DBL_MAX),
 	PORT_ITEM_INT("min_neighbor_prop_delay", -20000000, INT_MIN, -1),
+	GLOB_ITEM_INT("msg_pool_limit", 0, 0, INT_MAX),
+	GLOB_ITEM_INT("msg_pool_lock", 0, 0, 1),
+	GLOB_ITEM_INT("msg_pool_size", 0, 0, INT_MAX),
 	PORT_ITEM_INT("neighborPropDelayThresh", 20000000, 0, INT_MAX),
 	PORT_ITEM_ENU("network_transport", TRANS_UDP_IPV4, nw_trans_enu),
 	GLOB_ITEM_INT("ntpshm_segment", 0, INT_MIN, INT_MAX),
+	GLOB_ITEM_INT("numa_affinity", 0, 0, 1),
 	GLOB_ITEM_INT("offsetScaledLogVariance", 0xffff, 0, UINT16_MAX),
+	GLOB_ITEM_STR("offset_filter_chain", ""),
 	PORT_ITEM_INT("path_trace_enabled", 0, 0, 1),
+	GLOB_ITEM_INT("poll_spin", 0, 0, INT_MAX),
+	GLOB_ITEM_STR("port_thread_cpus", ""),
+	GLOB_ITEM_INT("port_threads", 0, 0, INT_MAX),
 	GLOB_ITEM_DBL("pi_integral_const", 0.0, 0.0, DBL_MAX),
 	GLOB_ITEM_DBL("pi_integral_exponent", 0.4, -DBL_MAX, DBL_MAX),
 	GLOB_ITEM_DBL("pi_integral_norm_max", 0.3, DBL_MIN, 2.0),
@@ -215,31 +278,59 @@ struct config_item config_tab[] = {
 	GLOB_ITEM_DBL("pi_proportional_exponent", -0.3, -DBL_MAX, DBL_MAX),
 	GLOB_ITEM_DBL("pi_proportional_norm_max", 0.7, DBL_MIN, 1.0),
 	GLOB_ITEM_DBL("pi_proportional_scale", 0.0, 0.0, DBL_MAX),
+	PORT_ITEM_INT("prefer_busy_poll", 0, 0, 1),
 	GLOB_ITEM_INT("priority1", 128, 0, UINT8_MAX),
 	GLOB_ITEM_INT("priority2", 128, 0, UINT8_MAX),
 	GLOB_ITEM_STR("productDescription", ";;"),
 	PORT_ITEM_STR("ptp_dst_mac", "01:1B:19:00:00:00"),
 	PORT_ITEM_STR("p2p_dst_mac", "01:80:C2:00:00:0E"),
+	PORT_ITEM_INT("raw_rx_ring", 0, 0, 1),
+	GLOB_ITEM_STR("refclock_sock_address", "/var/run/chrony.ptp.sock"),
+	PORT_ITEM_STR("replay_file", ""),
+	PORT_ITEM_INT("replay_speed", 1, 0, INT_MAX),
 	GLOB_ITEM_STR("revisionData", ";;"),
+	GLOB_ITEM_INT("sanity_check_period", 1, 1, INT_MAX),
 	GLOB_ITEM_INT("sanity_freq_limit", 200000000, 0, INT_MAX),
+	GLOB_ITEM_INT("sched_priority", 0, 0, 99),
+	GLOB_ITEM_STR("secondary_domains", ""),
+	GLOB_ITEM_STR("servo_log_file", ""),
+	GLOB_ITEM_INT("servo_log_files", 2, 1, 100),
+	GLOB_ITEM_INT("servo_log_size", 1048576, 1, 1 << 26),
 	GLOB_ITEM_INT("slaveOnly", 0, 0, 1),
+	GLOB_ITEM_STR("state_file", ""),
 	GLOB_ITEM_DBL("step_threshold", 0.0, 0.0, DBL_MAX),
 	GLOB_ITEM_INT("summary_interval", 0, INT_MIN, INT_MAX),
 	PORT_ITEM_INT("syncReceiptTimeout", 0, 0, UINT8_MAX),
+	GLOB_ITEM_INT("sync_batch", 0, 0, 1),
+	GLOB_ITEM_INT("sync_sample_decimation", 1, 1, INT_MAX),
 	GLOB_ITEM_INT("timeSource", INTERNAL_OSCILLATOR, 0x10, 0xfe),
 	GLOB_ITEM_ENU("time_stamping", TS_HARDWARE, timestamping_enu),
+	GLOB_ITEM_STR("trace_file", ""),
+	GLOB_ITEM_INT("trace_size", 65536, 1, 1 << 24),
 	PORT_ITEM_INT("transportSpecific", 0, 0, 0x0F),
 	PORT_ITEM_ENU("tsproc_mode", TSPROC_FILTER, tsproc_enu),
 	GLOB_ITEM_INT("twoStepFlag", 1, 0, 1),
+	PORT_ITEM_INT("tx_launch_lead", 0, 0, INT_MAX),
+	PORT_ITEM_INT("tx_timestamp_async", 0, 0, 1),
 	GLOB_ITEM_INT("tx_timestamp_timeout", 1, 1, INT_MAX),
+	PORT_ITEM_INT("tx_timestamp_tuning", 0, 0, 1),
+	PORT_ITEM_INT("udp_reuseport", 0, 0, 1),
 	PORT_ITEM_INT("udp_ttl", 1, 1, 255),
 	PORT_ITEM_INT("udp6_scope", 0x0E, 0x00, 0x0F),
 	GLOB_ITEM_STR("uds_address", "/var/run/ptp4l"),
+	PORT_ITEM_INT("unicast_listen", 0, 0, 1),
+	PORT_ITEM_INT("unicast_max_clients", 4096, 1, INT_MAX),
+	PORT_ITEM_INT("unicast_max_duration", 300, 1, INT_MAX),
 	GLOB_ITEM_INT("use_syslog", 1, 0, 1),
 	GLOB_ITEM_STR("userDescription", ""),
 	GLOB_ITEM_INT("verbose", 0, 0, 1),
+	PORT_ITEM_INT("xdp_queue", 0, 0, INT_MAX),
 };
 
+/* The built in defaults, saved before any file or option changes them. */
+static any_t config_tab_default[N_CONFIG_ITEMS];
+static int config_tab_saved;
+
 static enum parser_result
 parse_fault_interval(struct config *cfg, const char *section,
 		     const char *option, const char *value);
@@ -500,6 +591,12 @@ int config_read(char *name, struct config *cfg)
 	struct interface *current_port = NULL;
 	int line_num;
 
+	/* The interfaces named before the file is read are locked. */
+	STAILQ_FOREACH(current_port, &cfg->interfaces, list) {
+		current_port->locked = 1;
+	}
+	current_port = NULL;
+
 	fp = 0 == strncmp(name, "-", 2) ? stdin : fopen(name, "r");
 
 	if (!fp) {
@@ -607,7 +704,6 @@ struct interface *config_create_interface(char *name, struct config *cfg)
 	}
 
 	strncpy(iface->name, name, MAX_IFNAME_SIZE);
-	sk_get_ts_info(iface->name, &iface->ts_info);
 	STAILQ_INSERT_TAIL(&cfg->interfaces, iface, list);
 	cfg->n_interfaces++;
 
@@ -644,6 +740,12 @@ struct config *config_create(void)
 		}
 	}
 
+	if (!config_tab_saved) {
+		for (i = 0; i < N_CONFIG_ITEMS; i++)
+			config_tab_default[i] = config_tab[i].val;
+		config_tab_saved = 1;
+	}
+
 	/* Perform a Built In Self Test.*/
 	for (i = 0; i < N_CONFIG_ITEMS; i++) {
 		ci = &config_tab[i];
@@ -673,6 +775,156 @@ void config_destroy(struct config *cfg)
 	free(cfg);
 }
 
+struct config *config_reread(char *name, struct config *cfg)
+{
+	char buf[CONFIG_LABEL_SIZE + 8];
+	struct interface *iface, *copy;
+	struct config_item *ci;
+	struct config *new;
+	int i;
+
+	new = calloc(1, sizeof(*new));
+	if (!new) {
+		return NULL;
+	}
+	STAILQ_INIT(&new->interfaces);
+
+	new->htab = hash_create();
+	if (!new->htab) {
+		free(new);
+		return NULL;
+	}
+
+	/*
+	 * Start over from the defaults, keeping what was set on the command
+	 * line. The items are copies, leaving the running settings alone.
+	 */
+	for (i = 0; i < N_CONFIG_ITEMS; i++) {
+		ci = malloc(sizeof(*ci));
+		if (!ci) {
+			goto fail;
+		}
+		*ci = *config_global_item(cfg, config_tab[i].label);
+		ci->flags &= ~(CFG_ITEM_STATIC | CFG_ITEM_DYNSTR);
+		if (!(ci->flags & CFG_ITEM_LOCKED)) {
+			ci->val = config_tab_default[i];
+		} else if (ci->type == CFG_TYPE_STRING) {
+			ci->val.s = strdup(ci->val.s);
+			if (!ci->val.s) {
+				free(ci);
+				goto fail;
+			}
+			ci->flags |= CFG_ITEM_DYNSTR;
+		}
+		snprintf(buf, sizeof(buf), "global.%s", ci->label);
+		if (hash_insert(new->htab, buf, ci)) {
+			config_item_free(ci);
+			goto fail;
+		}
+	}
+
+	STAILQ_FOREACH(iface, &cfg->interfaces, list) {
+		if (!iface->locked) {
+			continue;
+		}
+		copy = config_create_interface(iface->name, new);
+		if (!copy) {
+			goto fail;
+		}
+	}
+
+	if (config_read(name, new)) {
+		goto fail;
+	}
+	return new;
+fail:
+	config_destroy(new);
+	return NULL;
+}
+
+static int config_item_equal(struct config_item *a, struct config_item *b)
+{
+	switch (a->type) {
+	case CFG_TYPE_INT:
+	case CFG_TYPE_ENUM:
+		return a->val.i == b->val.i;
+	case CFG_TYPE_DOUBLE:
+		return a->val.d == b->val.d;
+	case CFG_TYPE_STRING:
+		return !strcmp(a->val.s, b->val.s);
+	}
+	return 0;
+}
+
+const char *config_next_change(struct config *a, struct config *b,
+			       const char *section, int *index)
+{
+	struct config_item *ca, *cb;
+	const char *label;
+	int port;
+
+	for (; *index < N_CONFIG_ITEMS; (*index)++) {
+		port = config_tab[*index].flags & CFG_ITEM_PORT;
+		if (section ? !port : port) {
+			continue;
+		}
+		label = config_tab[*index].label;
+		ca = config_find_item(a, section, label);
+		cb = config_find_item(b, section, label);
+		if (!config_item_equal(ca, cb)) {
+			(*index)++;
+			return label;
+		}
+	}
+	return NULL;
+}
+
+static struct interface *config_find_interface(struct config *cfg,
+					       const char *name)
+{
+	struct interface *iface;
+
+	STAILQ_FOREACH(iface, &cfg->interfaces, list) {
+		if (!strncmp(name, iface->name, MAX_IFNAME_SIZE))
+			return iface;
+	}
+	return NULL;
+}
+
+void config_adopt(struct config *cfg, struct config *src)
+{
+	struct interfaces_head kept = STAILQ_HEAD_INITIALIZER(kept);
+	struct interface *iface, *old;
+	struct hash *htab;
+	int n = 0;
+
+	htab = cfg->htab;
+	cfg->htab = src->htab;
+	src->htab = htab;
+
+	/*
+	 * The ports refer to their interfaces, so those that remain stay
+	 * in place. Those that went away are handed over to src.
+	 */
+	while ((iface = STAILQ_FIRST(&src->interfaces))) {
+		STAILQ_REMOVE_HEAD(&src->interfaces, list);
+		old = config_find_interface(cfg, iface->name);
+		if (old) {
+			STAILQ_REMOVE(&cfg->interfaces, old, interface, list);
+			cfg->n_interfaces--;
+			old->locked = iface->locked;
+			free(iface);
+			iface = old;
+		}
+		STAILQ_INSERT_TAIL(&kept, iface, list);
+		n++;
+	}
+	STAILQ_CONCAT(&src->interfaces, &cfg->interfaces);
+	src->n_interfaces = cfg->n_interfaces;
+	STAILQ_CONCAT(&cfg->interfaces, &kept);
+	cfg->n_interfaces = n;
+}
+
 double config_get_double(struct config *cfg, const char *section,
 			 const char *option)
 {
@@ -707,6 +959,37 @@ int config_get_int(struct config *cfg, const char *section, const char *option)
 	return ci->val.i;
 }
 
+void config_resolve(struct config *cfg, const char *section, void *dst,
+		    const struct config_field *fields, int n)
+{
+	struct config_item *ci;
+	char *ptr;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		ci = config_find_item(cfg, section, fields[i].option);
+		if (!ci) {
+			pr_err("bug: config option %s missing!",
+			       fields[i].option);
+			exit(-1);
+		}
+		ptr = (char *) dst + fields[i].offset;
+		switch (ci->type) {
+		case CFG_TYPE_INT:
+		case CFG_TYPE_ENUM:
+			*(int *) ptr = ci->val.i;
+			break;
+		case CFG_TYPE_DOUBLE:
+			*(double *) ptr = ci->val.d;
+			break;
+		case CFG_TYPE_STRING:
+			pr_err("bug: config option %s type mismatch!",
+			       fields[i].option);
+			exit(-1);
+		}
+	}
+}
+
 char *config_get_string(struct config *cfg, const char *section,
 			const char *option)
 {
@@ -20,6 +20,7 @@
 #ifndef HAVE_CONFIG_H
 #define HAVE_CONFIG_H
 
+#include <stddef.h>
 #include <sys/queue.h>
 
 #include "ds.h"
@@ -36,6 +37,7 @@ struct interface {
 	STAILQ_ENTRY(interface) list;
 	char name[MAX_IFNAME_SIZE + 1];
 	struct sk_ts_info ts_info;
+	int locked; /* named on the command line */
 };
 
 struct config {
@@ -64,6 +66,48 @@ int config_get_int(struct config *cfg, const char *section,
 char *config_get_string(struct config *cfg, const char *section,
 			const char *option);
 
+/*
+ * Describes a setting to be copied by config_resolve() into the field
+ * at the given offset of a structure, an int for integer and enumerated
+ * settings, and a double for floating point settings.
+ */
+struct config_field {
+	const char *option;
+	size_t offset;
+};
+
+/*
+ * Copies a number of settings of a section, or of the global section if
+ * the section does not have them, into a structure. Once resolved, the
+ * values are read from the structure without looking up their names.
+ */
+void config_resolve(struct config *cfg, const char *section, void *dst,
+		    const struct config_field *fields, int n);
+
+/*
+ * Reads a configuration file again, into a new configuration that starts
+ * from the defaults plus the settings and interfaces given on the command
+ * line. The running configuration is left alone.
+ */
+struct config *config_reread(char *name, struct config *cfg);
+
+/*
+ * Finds the next setting that differs between two configurations. With
+ * a section, the port settings of that section are compared, otherwise
+ * the settings that only exist globally. The search starts at *index,
+ * initially zero, which is advanced past the match. Returns the name of
+ * the setting, or NULL when there are no more differences.
+ */
+const char *config_next_change(struct config *a, struct config *b,
+			       const char *section, int *index);
+
+/*
+ * Makes the settings of src those of cfg. The interfaces that cfg and
+ * src have in common keep their place in memory, and the interfaces that
+ * only cfg had are left in src, to be freed along with it.
+ */
+void config_adopt(struct config *cfg, struct config *src);
+
 int config_set_double(struct config *cfg, const char *option, double val);
 
 int config_set_section_int(struct config *cfg, const char *section,
@@ -0,0 +1,103 @@
+/**
+ * @file cpustat.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <time.h>
+
+#include "cpustat.h"
+
+int cpustat_enabled;
+
+/* Updated by all threads, the stages of the port threads included. */
+static uint64_t stage_ns[CPU_N_STAGES];
+static uint64_t stage_count[CPU_N_STAGES];
+
+/* The stage of the calling thread and when it was entered or resumed */
+static __thread int current = CPU_NONE;
+static __thread uint64_t since;
+
+static const char *stage_names[CPU_N_STAGES] = {
+	[CPU_PORT] = "port",
+	[CPU_RECV] = "recv",
+	[CPU_PARSE] = "parse",
+	[CPU_BMC] = "bmc",
+	[CPU_SERVO] = "servo",
+	[CPU_CLOCKADJ] = "clockadj",
+	[CPU_LOG] = "log",
+	[CPU_MANAGEMENT] = "management",
+};
+
+/*
+ * CLOCK_MONOTONIC_RAW is read in the vDSO, and unlike the TSC it is
+ * consistent between the cores the threads may migrate to.
+ */
+static uint64_t cpustat_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void cpustat_charge(uint64_t now)
+{
+	if (current == CPU_NONE)
+		return;
+	__atomic_fetch_add(&stage_ns[current], now - since, __ATOMIC_RELAXED);
+}
+
+int cpustat_switch(int stage)
+{
+	uint64_t now = cpustat_now();
+	int prev = current;
+
+	cpustat_charge(now);
+	current = stage;
+	since = now;
+	return prev;
+}
+
+void cpustat_return(int prev)
+{
+	uint64_t now = cpustat_now();
+
+	cpustat_charge(now);
+	if (current != CPU_NONE)
+		__atomic_fetch_add(&stage_count[current], 1, __ATOMIC_RELAXED);
+	current = prev;
+	since = now;
+}
+
+void cpustat_enable(void)
+{
+	cpustat_enabled = 1;
+}
+
+void cpustat_get(uint64_t ns[CPU_N_STAGES], uint64_t count[CPU_N_STAGES])
+{
+	int i;
+
+	for (i = 0; i < CPU_N_STAGES; i++) {
+		ns[i] = __atomic_load_n(&stage_ns[i], __ATOMIC_RELAXED);
+		count[i] = __atomic_load_n(&stage_count[i], __ATOMIC_RELAXED);
+	}
+}
+
+const char *cpustat_name(enum cpu_stage stage)
+{
+	return stage < CPU_N_STAGES ? stage_names[stage] : "unknown";
+}
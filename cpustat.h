@@ -0,0 +1,91 @@
+/**
+ * @file cpustat.h
+ * @brief Accounts the time spent in the stages of the processing.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_CPUSTAT_H
+#define HAVE_CPUSTAT_H
+
+#include <stdint.h>
+
+/**
+ * The stages of the processing. The time of a stage entered within
+ * another one is only charged to the inner stage, so the stages add up
+ * to the time spent in all of them. The port stage covers whatever is
+ * left of the handling of a port event.
+ */
+enum cpu_stage {
+	CPU_PORT,        /* port_event(), apart from the other stages */
+	CPU_RECV,        /* the receive system calls */
+	CPU_PARSE,       /* msg_post_recv() */
+	CPU_BMC,         /* handle_state_decision_event() */
+	CPU_SERVO,       /* servo_sample() */
+	CPU_CLOCKADJ,    /* the clock adjustment system calls */
+	CPU_LOG,         /* formatting and printing the log messages */
+	CPU_MANAGEMENT,  /* clock_manage() */
+	CPU_N_STAGES,
+};
+
+/* Returned by cpustat_enter() outside of any stage. */
+#define CPU_NONE -1
+
+extern int cpustat_enabled;
+
+int cpustat_switch(int stage);
+void cpustat_return(int prev);
+
+/**
+ * Start charging the time to a stage, if the accounting is enabled.
+ * This may be called from any thread.
+ * @param stage  The stage being entered.
+ * @return       The stage being left, to be passed to cpustat_leave().
+ */
+static inline int cpustat_enter(enum cpu_stage stage)
+{
+	return cpustat_enabled ? cpustat_switch(stage) : CPU_NONE;
+}
+
+/**
+ * Stop charging the time to the stage entered last.
+ * @param prev  The value returned by the matching cpustat_enter().
+ */
+static inline void cpustat_leave(int prev)
+{
+	if (cpustat_enabled)
+		cpustat_return(prev);
+}
+
+/**
+ * Enable the accounting. Must be called before any stage is entered.
+ */
+void cpustat_enable(void);
+
+/**
+ * Read the time spent in the stages so far.
+ * @param ns     Receives the nanoseconds spent in each stage.
+ * @param count  Receives the number of times each stage was entered.
+ */
+void cpustat_get(uint64_t ns[CPU_N_STAGES], uint64_t count[CPU_N_STAGES]);
+
+/**
+ * Get the name of a stage.
+ * @param stage  One of the stages.
+ * @return       A short name.
+ */
+const char *cpustat_name(enum cpu_stage stage);
+
+#endif
@@ -82,6 +82,8 @@ struct parent_ds {
 	struct parentDS pds;
 	struct ClockIdentity *ptl;
 	unsigned int path_length;
+	/* Incremented when the path trace list changes. */
+	unsigned int path_gen;
 };
 
 #define CURRENT_UTC_OFFSET  36 /* 1 Jul 2015 */
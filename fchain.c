@@ -0,0 +1,290 @@
+/**
+ * @file fchain.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "fchain.h"
+#include "filter_private.h"
+#include "print.h"
+
+#define FCHAIN_MAX_STAGES	8
+#define FCHAIN_MAX_LENGTH	4096
+#define DEFAULT_LENGTH		10
+#define DEFAULT_FENCE		3.0
+
+/* The outliers are only detected once the window has this many samples. */
+#define OUTLIER_MIN_SAMPLES	4
+
+enum fstage_type {
+	FSTAGE_AVERAGE,
+	FSTAGE_QUANTILE,
+	FSTAGE_OUTLIER,
+};
+
+struct fstage {
+	enum fstage_type type;
+	int len;
+	int cnt;
+	int index;
+	double param;   /* quantile, or the factor of the outlier fences */
+	tmv_t sum;      /* of the samples in the window of an average */
+	tmv_t *samples; /* circular buffer of the window */
+	int *order;     /* indices of the samples sorted by value, or NULL */
+};
+
+/*
+ * The stages and their windows are allocated in a single block when
+ * the chain is created, the stages first, then the samples and the
+ * orders of all of them.
+ */
+struct fchain {
+	struct filter filter;
+	int n;
+	struct fstage stage[];
+};
+
+static tmv_t window_quantile(struct fstage *s, double q)
+{
+	double pos = q * (s->cnt - 1);
+	int i = (int) pos;
+	tmv_t lo, hi;
+
+	lo = s->samples[s->order[i]];
+	if (i + 1 >= s->cnt || pos == i)
+		return lo;
+	hi = s->samples[s->order[i + 1]];
+	return tmv_add(lo, dbl_tmv((pos - i) * tmv_dbl(tmv_sub(hi, lo))));
+}
+
+/* Add a sample to the window, keeping the order sorted. */
+static void window_insert(struct fstage *s, tmv_t sample)
+{
+	int i;
+
+	s->samples[s->index] = sample;
+	if (s->cnt < s->len) {
+		s->cnt++;
+	} else {
+		/* Remove the index of the replaced value from the order. */
+		for (i = 0; i < s->cnt; i++)
+			if (s->order[i] == s->index)
+				break;
+		for (; i + 1 < s->cnt; i++)
+			s->order[i] = s->order[i + 1];
+	}
+
+	for (i = s->cnt - 1; i > 0; i--) {
+		if (tmv_cmp(s->samples[s->order[i - 1]], sample) <= 0)
+			break;
+		s->order[i] = s->order[i - 1];
+	}
+	s->order[i] = s->index;
+
+	s->index = (1 + s->index) % s->len;
+}
+
+static tmv_t average_sample(struct fstage *s, tmv_t sample)
+{
+	if (s->cnt == s->len)
+		s->sum = tmv_sub(s->sum, s->samples[s->index]);
+	else
+		s->cnt++;
+	s->samples[s->index] = sample;
+	s->index = (1 + s->index) % s->len;
+	s->sum = tmv_add(s->sum, sample);
+	return tmv_div(s->sum, s->cnt);
+}
+
+/*
+ * Replace a sample outside of the fences around the interquartile range
+ * of the window by the median. The sample still enters the window, so
+ * that a lasting change is followed once it fills a quarter of it.
+ */
+static tmv_t outlier_sample(struct fstage *s, tmv_t sample)
+{
+	tmv_t q1, q3, margin, out = sample;
+
+	if (s->cnt >= OUTLIER_MIN_SAMPLES) {
+		q1 = window_quantile(s, 0.25);
+		q3 = window_quantile(s, 0.75);
+		margin = dbl_tmv(s->param * tmv_dbl(tmv_sub(q3, q1)));
+		if (tmv_cmp(sample, tmv_sub(q1, margin)) < 0 ||
+		    tmv_cmp(sample, tmv_add(q3, margin)) > 0)
+			out = window_quantile(s, 0.5);
+	}
+	window_insert(s, sample);
+	return out;
+}
+
+static tmv_t fchain_sample(struct filter *filter, tmv_t sample)
+{
+	struct fchain *c = container_of(filter, struct fchain, filter);
+	struct fstage *s;
+	int i;
+
+	for (i = 0; i < c->n; i++) {
+		s = &c->stage[i];
+		switch (s->type) {
+		case FSTAGE_AVERAGE:
+			sample = average_sample(s, sample);
+			break;
+		case FSTAGE_QUANTILE:
+			window_insert(s, sample);
+			sample = window_quantile(s, s->param);
+			break;
+		case FSTAGE_OUTLIER:
+			sample = outlier_sample(s, sample);
+			break;
+		}
+	}
+	return sample;
+}
+
+static void fchain_reset(struct filter *filter)
+{
+	struct fchain *c = container_of(filter, struct fchain, filter);
+	int i;
+
+	for (i = 0; i < c->n; i++) {
+		c->stage[i].cnt = 0;
+		c->stage[i].index = 0;
+		c->stage[i].sum = tmv_zero();
+	}
+}
+
+static void fchain_destroy(struct filter *filter)
+{
+	struct fchain *c = container_of(filter, struct fchain, filter);
+
+	free(c);
+}
+
+/* Parse a stage of the form name[:length[:parameter]]. */
+static int parse_stage(char *tok, struct fstage *s)
+{
+	char *name, *arg, *end;
+	long len = DEFAULT_LENGTH;
+
+	name = strsep(&tok, ":");
+	if (!strcmp(name, "moving_average")) {
+		s->type = FSTAGE_AVERAGE;
+	} else if (!strcmp(name, "moving_median")) {
+		s->type = FSTAGE_QUANTILE;
+		s->param = 0.5;
+	} else if (!strcmp(name, "moving_quantile")) {
+		s->type = FSTAGE_QUANTILE;
+		s->param = 0.5;
+	} else if (!strcmp(name, "outlier")) {
+		s->type = FSTAGE_OUTLIER;
+		s->param = DEFAULT_FENCE;
+	} else {
+		pr_err("unknown filter '%s'", name);
+		return -1;
+	}
+
+	arg = strsep(&tok, ":");
+	if (arg) {
+		len = strtol(arg, &end, 10);
+		if (*end || len < 1 || len > FCHAIN_MAX_LENGTH) {
+			pr_err("bad length '%s' of filter %s", arg, name);
+			return -1;
+		}
+	}
+	s->len = len;
+
+	arg = strsep(&tok, ":");
+	if (arg) {
+		if (s->type == FSTAGE_AVERAGE || !strcmp(name, "moving_median")) {
+			pr_err("filter %s takes no parameter", name);
+			return -1;
+		}
+		s->param = strtod(arg, &end);
+		if (*end || s->param < 0.0 ||
+		    (s->type == FSTAGE_QUANTILE && s->param > 1.0)) {
+			pr_err("bad parameter '%s' of filter %s", arg, name);
+			return -1;
+		}
+	}
+	if (tok) {
+		pr_err("too many parameters of filter %s", name);
+		return -1;
+	}
+	return 0;
+}
+
+struct filter *fchain_create(const char *spec)
+{
+	struct fstage stages[FCHAIN_MAX_STAGES];
+	int i, n = 0, n_samples = 0, n_order = 0;
+	char *buf, *rest, *tok;
+	struct fchain *c;
+	size_t size;
+	tmv_t *samples;
+	int *order;
+
+	buf = strdup(spec);
+	if (!buf)
+		return NULL;
+	memset(stages, 0, sizeof(stages));
+	for (rest = buf; (tok = strsep(&rest, ", ")); ) {
+		if (!*tok)
+			continue;
+		if (n == FCHAIN_MAX_STAGES) {
+			pr_err("too many filters in '%s'", spec);
+			free(buf);
+			return NULL;
+		}
+		if (parse_stage(tok, &stages[n])) {
+			free(buf);
+			return NULL;
+		}
+		n_samples += stages[n].len;
+		if (stages[n].type != FSTAGE_AVERAGE)
+			n_order += stages[n].len;
+		n++;
+	}
+	free(buf);
+	if (!n) {
+		pr_err("no filter in '%s'", spec);
+		return NULL;
+	}
+
+	size = sizeof(*c) + n * sizeof(c->stage[0]) +
+		n_samples * sizeof(tmv_t) + n_order * sizeof(int);
+	c = calloc(1, size);
+	if (!c)
+		return NULL;
+	c->filter.destroy = fchain_destroy;
+	c->filter.sample = fchain_sample;
+	c->filter.reset = fchain_reset;
+	c->n = n;
+
+	samples = (tmv_t *) &c->stage[n];
+	order = (int *) (samples + n_samples);
+	for (i = 0; i < n; i++) {
+		c->stage[i] = stages[i];
+		c->stage[i].samples = samples;
+		samples += stages[i].len;
+		if (stages[i].type != FSTAGE_AVERAGE) {
+			c->stage[i].order = order;
+			order += stages[i].len;
+		}
+	}
+	return &c->filter;
+}
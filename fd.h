@@ -20,18 +20,24 @@
 #ifndef HAVE_FD_H
 #define HAVE_FD_H
 
-#define N_TIMER_FDS 6
+#define N_TIMER_FDS 7
 
+/*
+ * The port timers are not descriptors but live in the clock's timer
+ * wheel. They follow the sockets so that port_event() can tell all of
+ * the port's events apart by their index.
+ */
 enum {
 	FD_EVENT,
 	FD_GENERAL,
-	FD_ANNOUNCE_TIMER,
+	N_POLLFD,
+	FD_ANNOUNCE_TIMER = N_POLLFD,
 	FD_SYNC_RX_TIMER,
 	FD_DELAY_TIMER,
 	FD_QUALIFICATION_TIMER,
 	FD_MANNO_TIMER,
 	FD_SYNC_TX_TIMER,
-	N_POLLFD,
+	FD_DELAY_RESP_TIMER,
 };
 
 struct fdarray {
@@ -17,22 +17,32 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include "fchain.h"
 #include "filter_private.h"
 #include "mave.h"
 #include "mmedian.h"
+#include "mquantile.h"
 
-struct filter *filter_create(enum filter_type type, int length)
+struct filter *filter_create(enum filter_type type, int length,
+			     double quantile)
 {
 	switch (type) {
 	case FILTER_MOVING_AVERAGE:
 		return mave_create(length);
 	case FILTER_MOVING_MEDIAN:
 		return mmedian_create(length);
+	case FILTER_MOVING_QUANTILE:
+		return mquantile_create(length, quantile);
 	default:
 		return NULL;
 	}
 }
 
+struct filter *filter_chain_create(const char *spec)
+{
+	return fchain_create(spec);
+}
+
 void filter_destroy(struct filter *filter)
 {
 	filter->destroy(filter);
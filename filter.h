@@ -31,15 +31,32 @@ struct filter;
 enum filter_type {
 	FILTER_MOVING_AVERAGE,
 	FILTER_MOVING_MEDIAN,
+	FILTER_MOVING_QUANTILE,
 };
 
 /**
  * Create a new instance of a filter.
- * @param type    The type of the filter to create.
- * @param length  The filter's length.
+ * @param type      The type of the filter to create.
+ * @param length    The filter's length.
+ * @param quantile  The quantile selected by FILTER_MOVING_QUANTILE,
+ *                  between 0 and 1.
  * @return A pointer to a new filter on success, NULL otherwise.
  */
-struct filter *filter_create(enum filter_type type, int length);
+struct filter *filter_create(enum filter_type type, int length,
+			     double quantile);
+
+/**
+ * Create a chain of filters, each fed with the output of the previous one.
+ * The stages are given as a list separated by commas, each of the form
+ * name[:length[:parameter]], where the name is moving_average,
+ * moving_median, moving_quantile, or outlier. The parameter is the
+ * quantile selected by moving_quantile, or the factor of the
+ * interquartile range beyond which outlier replaces a sample by the
+ * median. The whole chain is allocated at once.
+ * @param spec  The list of the stages.
+ * @return A pointer to a new filter on success, NULL otherwise.
+ */
+struct filter *filter_chain_create(const char *spec);
 
 /**
  * Destroy an instance of a filter.
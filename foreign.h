@@ -21,12 +21,23 @@
 #define HAVE_FOREIGN_H
 
 #include <sys/queue.h>
+#include <time.h>
 
+#include "address.h"
 #include "ds.h"
+#include "msg.h"
 #include "port.h"
 
 #define FOREIGN_MASTER_THRESHOLD 2
 
+/**
+ * The arrival of an announce message from a foreign master.
+ */
+struct foreign_arrival {
+	struct timespec host;
+	Integer8 logMessageInterval;
+};
+
 struct foreign_clock {
 	/**
 	 * Pointer to next foreign_clock in list.
@@ -34,19 +45,29 @@ struct foreign_clock {
 	LIST_ENTRY(foreign_clock) list;
 
 	/**
-	 * A list of received announce messages.
-	 *
-	 * The data set field, foreignMasterPortIdentity, is the
-	 * sourcePortIdentity of the first message.
+	 * The arrivals of the recent announce messages, the latest first.
+	 * One more than the threshold is kept, so that the threshold is
+	 * still met after the oldest message expires.
 	 */
-	TAILQ_HEAD(messages, ptp_message) messages;
+	struct foreign_arrival arrivals[FOREIGN_MASTER_THRESHOLD + 1];
 
 	/**
-	 * Number of elements in the message list,
-	 * aka foreignMasterAnnounceMessages.
+	 * Number of valid arrivals, aka foreignMasterAnnounceMessages.
 	 */
 	unsigned int n_messages;
 
+	/**
+	 * The latest announce message without its TLVs, valid while
+	 * n_messages is not zero. The data set field,
+	 * foreignMasterPortIdentity, is its sourcePortIdentity.
+	 */
+	struct announce_msg announce;
+
+	/**
+	 * The address of the sender of the latest announce message.
+	 */
+	struct address address;
+
 	/**
 	 * Pointer to the associated port.
 	 */
@@ -57,6 +78,15 @@ struct foreign_clock {
 	 * in a form suitable for comparision in the BMCA.
 	 */
 	struct dataset dataset;
+
+	/**
+	 * Hash and length of the path trace of the latest announce
+	 * message, and whether it contains our clock identity. The hash
+	 * is zero until an announce message was checked.
+	 */
+	uint64_t path_hash;
+	unsigned int path_length;
+	int path_loop;
 };
 
 #endif
@@ -0,0 +1,184 @@
+/**
+ * @file freqfile.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freqfile.h"
+#include "print.h"
+
+/* Interval between the updates of the file in seconds */
+#define SAVE_INTERVAL 60
+#define MAX_LINE 256
+
+struct freqfile {
+	char *path;
+	char *name;
+	double sum;
+	unsigned int count;
+	double last_freq;
+	int saved;
+	time_t last_save;
+};
+
+/*
+ * The clocks of phc2sys may run in threads of their own and share the
+ * file, which is rewritten through a single temporary file.
+ */
+static pthread_mutex_t save_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static time_t monotonic_sec(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+static int freqfile_save(struct freqfile *f)
+{
+	char line[MAX_LINE], name[MAX_LINE], *tmp;
+	FILE *in, *out;
+	double freq;
+	int err = -1;
+
+	if (f->count) {
+		f->last_freq = f->sum / f->count;
+		f->sum = 0.0;
+		f->count = 0;
+		f->saved = 0;
+	}
+	if (f->saved)
+		return 0;
+
+	tmp = malloc(strlen(f->path) + 5);
+	if (!tmp)
+		return -1;
+	sprintf(tmp, "%s.tmp", f->path);
+
+	pthread_mutex_lock(&save_lock);
+	out = fopen(tmp, "w");
+	if (!out) {
+		pr_err("failed to open %s: %m", tmp);
+		goto out;
+	}
+	/* Keep the lines of the other clocks. */
+	in = fopen(f->path, "r");
+	if (in) {
+		while (fgets(line, sizeof(line), in)) {
+			if (sscanf(line, "%255s %lf", name, &freq) == 2 &&
+			    strcmp(name, f->name))
+				fputs(line, out);
+		}
+		fclose(in);
+	}
+	fprintf(out, "%s %.3f\n", f->name, f->last_freq);
+
+	if (fclose(out)) {
+		pr_err("failed to write %s: %m", tmp);
+		remove(tmp);
+		goto out;
+	}
+	if (rename(tmp, f->path)) {
+		pr_err("failed to rename %s: %m", tmp);
+		remove(tmp);
+		goto out;
+	}
+	f->saved = 1;
+	err = 0;
+out:
+	pthread_mutex_unlock(&save_lock);
+	free(tmp);
+	return err;
+}
+
+struct freqfile *freqfile_create(const char *path, const char *name)
+{
+	struct freqfile *f;
+
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return NULL;
+	f->path = strdup(path);
+	f->name = strdup(name);
+	if (!f->path || !f->name) {
+		free(f->path);
+		free(f->name);
+		free(f);
+		return NULL;
+	}
+	/* Nothing to save until the clock is locked. */
+	f->saved = 1;
+	f->last_save = monotonic_sec();
+	return f;
+}
+
+void freqfile_destroy(struct freqfile *f)
+{
+	freqfile_save(f);
+	free(f->path);
+	free(f->name);
+	free(f);
+}
+
+int freqfile_load(struct freqfile *f, double max_freq, double *freq)
+{
+	char line[MAX_LINE], name[MAX_LINE];
+	int found = 0;
+	double val;
+	FILE *in;
+
+	in = fopen(f->path, "r");
+	if (!in)
+		return -1;
+	while (fgets(line, sizeof(line), in)) {
+		if (sscanf(line, "%255s %lf", name, &val) == 2 &&
+		    !strcmp(name, f->name)) {
+			found = 1;
+			break;
+		}
+	}
+	fclose(in);
+
+	if (!found)
+		return -1;
+	if (!isfinite(val) || fabs(val) > max_freq) {
+		pr_warning("ignoring saved frequency %.0f of %s", val, f->name);
+		return -1;
+	}
+	*freq = val;
+	return 0;
+}
+
+void freqfile_sample(struct freqfile *f, double freq)
+{
+	time_t now;
+
+	f->sum += freq;
+	f->count++;
+
+	now = monotonic_sec();
+	if (now - f->last_save < SAVE_INTERVAL)
+		return;
+	f->last_save = now;
+	freqfile_save(f);
+}
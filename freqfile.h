@@ -0,0 +1,60 @@
+/**
+ * @file freqfile.h
+ * @brief Saves the frequency of a clock across restarts.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_FREQFILE_H
+#define HAVE_FREQFILE_H
+
+/** Opaque type */
+struct freqfile;
+
+/**
+ * Create a new instance of the frequency file of a clock. The file holds
+ * one line per clock with its name and frequency, so that it may be
+ * shared by the clocks of one program, also when they run in different
+ * threads.
+ * @param path  The path of the file.
+ * @param name  The name of the clock.
+ * @return A pointer to a new freqfile on success, NULL otherwise.
+ */
+struct freqfile *freqfile_create(const char *path, const char *name);
+
+/**
+ * Destroy an instance of freqfile, saving the frequency.
+ * @param f  Pointer to freqfile obtained via @ref freqfile_create().
+ */
+void freqfile_destroy(struct freqfile *f);
+
+/**
+ * Read the saved frequency of the clock.
+ * @param f         Pointer to freqfile obtained via @ref freqfile_create().
+ * @param max_freq  The largest absolute frequency accepted, in ppb.
+ * @param freq      Returns the frequency in ppb, as used by clockadj_set_freq().
+ * @return Zero on success, non-zero if no valid frequency was saved.
+ */
+int freqfile_load(struct freqfile *f, double max_freq, double *freq);
+
+/**
+ * Add the frequency of a locked clock. The mean of the frequencies is
+ * saved to the file once a minute.
+ * @param f     Pointer to freqfile obtained via @ref freqfile_create().
+ * @param freq  The frequency in ppb, as used by clockadj_set_freq().
+ */
+void freqfile_sample(struct freqfile *f, double freq);
+
+#endif
@@ -22,16 +22,24 @@
 
 #include "hash.h"
 
-#define HASH_TABLE_SIZE 200
+/*
+ * The table starts small and doubles whenever it holds as many entries
+ * as it has buckets, so that the chains stay short no matter how many
+ * interface sections a configuration has.
+ */
+#define HASH_INITIAL_SIZE 64
 
 struct node {
 	char *key;
 	void *data;
+	unsigned int hash;
 	struct node *next;
 };
 
 struct hash {
-	struct node *table[HASH_TABLE_SIZE];
+	struct node **table;
+	unsigned int size; /* a power of two */
+	unsigned int count;
 };
 
 static unsigned int hash_function(const char* s)
@@ -41,12 +49,44 @@ static unsigned int hash_function(const char* s)
 	for (i = 0; *s; s++) {
 		i = 131 * i + *s;
 	}
-	return i % HASH_TABLE_SIZE;
+	return i;
+}
+
+static void hash_grow(struct hash *ht)
+{
+	unsigned int i, size = ht->size * 2;
+	struct node *n, *next, **table;
+
+	table = calloc(size, sizeof(*table));
+	if (!table) {
+		/* Keep going with longer chains. */
+		return;
+	}
+	for (i = 0; i < ht->size; i++) {
+		for (n = ht->table[i]; n; n = next) {
+			next = n->next;
+			n->next = table[n->hash & (size - 1)];
+			table[n->hash & (size - 1)] = n;
+		}
+	}
+	free(ht->table);
+	ht->table = table;
+	ht->size = size;
 }
 
 struct hash *hash_create(void)
 {
 	struct hash *ht = calloc(1, sizeof(*ht));
+
+	if (!ht) {
+		return NULL;
+	}
+	ht->table = calloc(HASH_INITIAL_SIZE, sizeof(*ht->table));
+	if (!ht->table) {
+		free(ht);
+		return NULL;
+	}
+	ht->size = HASH_INITIAL_SIZE;
 	return ht;
 }
 
@@ -55,7 +95,7 @@ void hash_destroy(struct hash *ht, void (*func)(void *))
 	unsigned int i;
 	struct node *n, *next, **table = ht->table;
 
-	for (i = 0; i < HASH_TABLE_SIZE; i++) {
+	for (i = 0; i < ht->size; i++) {
 		for (n = table[i] ; n; n = next) {
 			next = n->next;
 			if (func) {
@@ -66,6 +106,7 @@ void hash_destroy(struct hash *ht, void (*func)(void *))
 		}
 	}
 
+	free(ht->table);
 	free(ht);
 }
 
@@ -76,8 +117,8 @@ int hash_insert(struct hash *ht, const char* key, void *data)
 
 	h = hash_function(key);
 
-	for (n = table[h] ; n; n = n->next) {
-		if (!strcmp(n->key, key)) {
+	for (n = table[h & (ht->size - 1)] ; n; n = n->next) {
+		if (n->hash == h && !strcmp(n->key, key)) {
 			/* reject duplicate keys */
 			return -1;
 		}
@@ -92,22 +133,47 @@ int hash_insert(struct hash *ht, const char* key, void *data)
 		return -1;
 	}
 	n->data = data;
-	n->next = table[h];
-	table[h] = n;
+	n->hash = h;
+	n->next = table[h & (ht->size - 1)];
+	table[h & (ht->size - 1)] = n;
+	if (++ht->count > ht->size) {
+		hash_grow(ht);
+	}
 	return 0;
 }
 
 void *hash_lookup(struct hash *ht, const char* key)
 {
 	unsigned int h;
-	struct node *n, **table = ht->table;
+	struct node *n;
 
 	h = hash_function(key);
 
-	for (n = table[h] ; n; n = n->next) {
-		if (!strcmp(n->key, key)) {
+	for (n = ht->table[h & (ht->size - 1)] ; n; n = n->next) {
+		if (n->hash == h && !strcmp(n->key, key)) {
 			return n->data;
 		}
 	}
 	return NULL;
 }
+
+void *hash_remove(struct hash *ht, const char* key)
+{
+	unsigned int h;
+	struct node *n, **prev;
+	void *data;
+
+	h = hash_function(key);
+
+	for (prev = &ht->table[h & (ht->size - 1)]; (n = *prev); prev = &n->next) {
+		if (n->hash == h && !strcmp(n->key, key)) {
+			*prev = n->next;
+			data = n->data;
+			free(n->key);
+			free(n);
+			ht->count--;
+			return data;
+		}
+	}
+	return NULL;
+}
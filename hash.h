@@ -54,6 +54,15 @@ int hash_insert(struct hash *ht, const char* key, void *data);
  */
 void *hash_lookup(struct hash *ht, const char* key);
 
+/**
+ * Removes an element from the hash table.
+ * @param ht   Hash table to modify.
+ * @param key  Key identifying the element to remove.
+ * @return  Pointer to the removed element's data, or NULL if the key is
+ *          not found.
+ */
+void *hash_remove(struct hash *ht, const char* key);
+
 #endif
 
 
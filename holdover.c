@@ -0,0 +1,350 @@
+/**
+ * @file holdover.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "holdover.h"
+#include "print.h"
+
+/*
+ * While the clock is locked, the frequencies applied by the servo are
+ * averaged into points spaced evenly over the window. When the holdover
+ * starts, a line is fitted to the points by least squares, optionally
+ * with a third term proportional to the temperature of the oscillator.
+ * The line gives the frequency for the rest of the holdover.
+ */
+#define MAX_POINTS 64
+#define MIN_POINTS 4
+/* Smallest spread of the temperatures in degrees to fit their term */
+#define MIN_TEMP_SPREAD 0.1
+
+struct point {
+	double time;
+	double freq;
+	double temp;
+};
+
+struct holdover {
+	struct point points[MAX_POINTS];
+	int num;
+	int index;
+	double window;
+	double interval;
+	/* Point being collected */
+	double sum_time;
+	double sum_freq;
+	double sum_temp;
+	double first_time;
+	unsigned int count;
+	double last_offset;
+	int temp_fd;
+	/* Model, relative to the time and temperature of the origin */
+	double time0;
+	double temp0;
+	double freq0;
+	double drift;
+	double temp_coeff;
+	int use_temp;
+	double freq0_error;
+	double drift_error;
+	int npoints;
+	/* Holdover */
+	int active;
+	double start_time;
+	double start_offset;
+};
+
+static double monotonic_time(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static double read_temp(struct holdover *h)
+{
+	char buf[32], *end;
+	long millidegrees;
+	ssize_t cnt;
+
+	if (h->temp_fd < 0)
+		return NAN;
+	/* A sysfs attribute is read again from the start. */
+	cnt = pread(h->temp_fd, buf, sizeof(buf) - 1, 0);
+	if (cnt <= 0)
+		return NAN;
+	buf[cnt] = '\0';
+	millidegrees = strtol(buf, &end, 10);
+	if (end == buf)
+		return NAN;
+	return millidegrees / 1000.0;
+}
+
+/* Solves the n x n system a * x = b by Gaussian elimination. */
+static int solve(double a[3][3], double b[3], double x[3], int n)
+{
+	int i, j, k, max;
+	double tmp, f;
+
+	for (i = 0; i < n; i++) {
+		max = i;
+		for (j = i + 1; j < n; j++) {
+			if (fabs(a[j][i]) > fabs(a[max][i]))
+				max = j;
+		}
+		if (fabs(a[max][i]) < 1e-12)
+			return -1;
+		for (k = 0; k < n; k++) {
+			tmp = a[i][k];
+			a[i][k] = a[max][k];
+			a[max][k] = tmp;
+		}
+		tmp = b[i];
+		b[i] = b[max];
+		b[max] = tmp;
+
+		for (j = i + 1; j < n; j++) {
+			f = a[j][i] / a[i][i];
+			for (k = i; k < n; k++)
+				a[j][k] -= f * a[i][k];
+			b[j] -= f * b[i];
+		}
+	}
+	for (i = n - 1; i >= 0; i--) {
+		x[i] = b[i];
+		for (j = i + 1; j < n; j++)
+			x[i] -= a[i][j] * x[j];
+		x[i] /= a[i][i];
+	}
+	return 0;
+}
+
+static int holdover_fit(struct holdover *h, double now)
+{
+	double a[3][3], b[3], x[3], v[3], r, ssr, stt, tmean;
+	double min_temp = INFINITY, max_temp = -INFINITY;
+	struct point *p;
+	int i, j, k, n = 0, terms;
+
+	memset(a, 0, sizeof(a));
+	memset(b, 0, sizeof(b));
+
+	/* The origin is the newest point. */
+	h->time0 = h->points[(h->index + MAX_POINTS - 1) % MAX_POINTS].time;
+	h->temp0 = 0.0;
+	h->use_temp = 0;
+
+	for (i = 0; i < h->num; i++) {
+		p = &h->points[i];
+		if (p->time < now - h->window)
+			continue;
+		if (isnan(p->temp)) {
+			min_temp = NAN;
+			break;
+		}
+		if (p->temp < min_temp)
+			min_temp = p->temp;
+		if (p->temp > max_temp)
+			max_temp = p->temp;
+		h->temp0 += p->temp;
+		n++;
+	}
+	if (!isnan(min_temp) && n && max_temp - min_temp >= MIN_TEMP_SPREAD) {
+		h->use_temp = 1;
+		h->temp0 /= n;
+	}
+	terms = h->use_temp ? 3 : 2;
+
+	n = 0;
+	tmean = 0.0;
+	for (i = 0; i < h->num; i++) {
+		p = &h->points[i];
+		if (p->time < now - h->window)
+			continue;
+		v[0] = 1.0;
+		v[1] = p->time - h->time0;
+		v[2] = h->use_temp ? p->temp - h->temp0 : 0.0;
+		for (j = 0; j < terms; j++) {
+			for (k = 0; k < terms; k++)
+				a[j][k] += v[j] * v[k];
+			b[j] += v[j] * p->freq;
+		}
+		tmean += v[1];
+		n++;
+	}
+	if (n < MIN_POINTS)
+		return -1;
+	if (solve(a, b, x, terms))
+		return -1;
+
+	h->freq0 = x[0];
+	h->drift = x[1];
+	h->temp_coeff = h->use_temp ? x[2] : 0.0;
+	h->npoints = n;
+
+	/* Standard errors of the frequency and the drift */
+	tmean /= n;
+	ssr = stt = 0.0;
+	for (i = 0; i < h->num; i++) {
+		p = &h->points[i];
+		if (p->time < now - h->window)
+			continue;
+		r = p->freq - h->freq0 - h->drift * (p->time - h->time0) -
+			h->temp_coeff * (h->use_temp ? p->temp - h->temp0 : 0.0);
+		ssr += r * r;
+		stt += (p->time - h->time0 - tmean) * (p->time - h->time0 - tmean);
+	}
+	r = n > terms ? sqrt(ssr / (n - terms)) : 0.0;
+	h->freq0_error = r / sqrt(n);
+	h->drift_error = stt > 0.0 ? r / sqrt(stt) : 0.0;
+
+	return 0;
+}
+
+struct holdover *holdover_create(int window, const char *temp_file)
+{
+	struct holdover *h;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return NULL;
+	h->temp_fd = -1;
+	if (temp_file && temp_file[0]) {
+		h->temp_fd = open(temp_file, O_RDONLY);
+		if (h->temp_fd < 0) {
+			pr_err("failed to open %s: %m", temp_file);
+			free(h);
+			return NULL;
+		}
+	}
+	h->window = window;
+	h->interval = h->window / MAX_POINTS;
+	return h;
+}
+
+void holdover_destroy(struct holdover *h)
+{
+	if (h->temp_fd >= 0)
+		close(h->temp_fd);
+	free(h);
+}
+
+void holdover_sample(struct holdover *h, double freq, int64_t offset)
+{
+	double now = monotonic_time();
+	struct point *p;
+
+	if (!h->count)
+		h->first_time = now;
+	h->sum_time += now;
+	h->sum_freq += freq;
+	h->sum_temp += read_temp(h);
+	h->count++;
+	h->last_offset = offset;
+
+	if (now - h->first_time < h->interval)
+		return;
+
+	p = &h->points[h->index];
+	p->time = h->sum_time / h->count;
+	p->freq = h->sum_freq / h->count;
+	p->temp = h->sum_temp / h->count;
+	h->index = (h->index + 1) % MAX_POINTS;
+	if (h->num < MAX_POINTS)
+		h->num++;
+
+	h->sum_time = 0.0;
+	h->sum_freq = 0.0;
+	h->sum_temp = 0.0;
+	h->count = 0;
+}
+
+int holdover_start(struct holdover *h)
+{
+	double now = monotonic_time();
+
+	/* The partial point is dropped, its samples may be disturbed. */
+	h->sum_time = 0.0;
+	h->sum_freq = 0.0;
+	h->sum_temp = 0.0;
+	h->count = 0;
+
+	if (holdover_fit(h, now))
+		return -1;
+
+	h->active = 1;
+	h->start_time = now;
+	h->start_offset = fabs(h->last_offset);
+	pr_debug("holdover: points %d freq %.3f drift %.3e temp %.3f "
+		 "sigma %.3f/%.3e", h->npoints, h->freq0, h->drift,
+		 h->temp_coeff, h->freq0_error, h->drift_error);
+	return 0;
+}
+
+void holdover_stop(struct holdover *h)
+{
+	h->active = 0;
+}
+
+int holdover_active(struct holdover *h)
+{
+	return h->active;
+}
+
+double holdover_freq(struct holdover *h)
+{
+	double freq, temp;
+
+	freq = h->freq0 + h->drift * (monotonic_time() - h->time0);
+	if (h->use_temp) {
+		temp = read_temp(h);
+		if (!isnan(temp))
+			freq += h->temp_coeff * (temp - h->temp0);
+	}
+	return freq;
+}
+
+void holdover_get_status(struct holdover *h, struct holdover_status *status)
+{
+	double now = monotonic_time(), dt;
+
+	memset(status, 0, sizeof(*status));
+	status->points = h->active ? h->npoints : h->num;
+	if (!h->active)
+		return;
+
+	dt = now - h->time0;
+	status->active = 1;
+	status->duration = now - h->start_time;
+	status->freq = holdover_freq(h);
+	status->drift = h->drift;
+	status->temp_coeff = h->temp_coeff;
+	/*
+	 * The offset at the loss of sync, plus the integral of the errors
+	 * of the frequency and its drift.
+	 */
+	status->error = h->start_offset + h->freq0_error * dt +
+		h->drift_error * dt * dt / 2.0;
+}
@@ -0,0 +1,102 @@
+/**
+ * @file holdover.h
+ * @brief Predicts the frequency of a clock during a loss of sync.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_HOLDOVER_H
+#define HAVE_HOLDOVER_H
+
+#include <stdint.h>
+
+/** Opaque type */
+struct holdover;
+
+struct holdover_status {
+	int active;
+	/* Seconds since the start of the holdover */
+	double duration;
+	/* Number of points in the model */
+	int points;
+	/* Predicted frequency in ppb, as used by clockadj_set_freq() */
+	double freq;
+	/* Drift of the frequency in ppb per second */
+	double drift;
+	/* Temperature coefficient in ppb per degree Celsius */
+	double temp_coeff;
+	/* Estimated time error in nanoseconds */
+	double error;
+};
+
+/**
+ * Create a new holdover model.
+ * @param window     The length of the history in seconds.
+ * @param temp_file  A file holding the temperature of the oscillator in
+ *                   millidegrees Celsius, as in hwmon, or NULL.
+ * @return A pointer to a new holdover on success, NULL otherwise.
+ */
+struct holdover *holdover_create(int window, const char *temp_file);
+
+/**
+ * Destroy a holdover model.
+ * @param h  Pointer obtained via @ref holdover_create().
+ */
+void holdover_destroy(struct holdover *h);
+
+/**
+ * Add the frequency of the clock while it is locked.
+ * @param h       Pointer obtained via @ref holdover_create().
+ * @param freq    The frequency in ppb, as used by clockadj_set_freq().
+ * @param offset  The offset from the master in nanoseconds.
+ */
+void holdover_sample(struct holdover *h, double freq, int64_t offset);
+
+/**
+ * Start the holdover, fitting the model to the history.
+ * @param h  Pointer obtained via @ref holdover_create().
+ * @return   Zero on success, non-zero if there is not enough history.
+ */
+int holdover_start(struct holdover *h);
+
+/**
+ * Stop the holdover. The history is kept, so that a new holdover may
+ * start right after the clock is locked again.
+ * @param h  Pointer obtained via @ref holdover_create().
+ */
+void holdover_stop(struct holdover *h);
+
+/**
+ * Tell whether the holdover is active.
+ * @param h  Pointer obtained via @ref holdover_create().
+ * @return   Non-zero between @ref holdover_start() and @ref holdover_stop().
+ */
+int holdover_active(struct holdover *h);
+
+/**
+ * Predict the frequency of the clock during the holdover.
+ * @param h  Pointer obtained via @ref holdover_create().
+ * @return   The frequency in ppb, as used by clockadj_set_freq().
+ */
+double holdover_freq(struct holdover *h);
+
+/**
+ * Obtain the state of the holdover.
+ * @param h       Pointer obtained via @ref holdover_create().
+ * @param status  Returns the state.
+ */
+void holdover_get_status(struct holdover *h, struct holdover_status *status);
+
+#endif
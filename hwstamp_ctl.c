@@ -18,6 +18,7 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,6 +26,7 @@
 #include <unistd.h>
 
 #include <arpa/inet.h>
+#include <linux/ethtool.h>
 #include <linux/net_tstamp.h>
 #include <linux/sockios.h>
 #include <net/if.h>
@@ -37,8 +39,11 @@ static void usage(char *progname)
 	fprintf(stderr,
 		"\n"
 		"usage: %s [options]\n\n"
+		" -a           use all interfaces capable of hardware time stamping\n"
+		" -c           print the time stamping capabilities\n"
 		" -h           prints this message and exits\n"
-		" -i [device]  interface device to use, for example 'eth0'\n"
+		" -i [device]  interface device to use, for example 'eth0',\n"
+		"              may be given several times\n"
 		" -r [%d..%d]   select receive time stamping:\n"
 		"\t\t%2d time stamp no incoming packet at all\n"
 		"\t\t%2d time stamp any incoming packet\n"
@@ -79,115 +84,352 @@ static void usage(char *progname)
 		HWTSTAMP_TX_ON);
 }
 
-int main(int argc, char *argv[])
+#define MAX_DEVICES 256
+
+struct settings {
+	int rxopt;
+	int txopt;
+	int setrx;
+	int settx;
+	int caps;
+};
+
+struct device {
+	char name[IF_NAMESIZE];
+	const struct settings *set;
+	pthread_t thread;
+	/* The output is kept apart when several devices run in parallel. */
+	FILE *out;
+	FILE *err;
+	char *buf;
+	size_t len;
+	char *errbuf;
+	size_t errlen;
+	int result;
+};
+
+static const char *tx_type_names[] = {
+	"off", "on", "onestep-sync", "onestep-p2p",
+};
+
+static const char *rx_filter_names[] = {
+	"none", "all", "some",
+	"ptpv1-l4-event", "ptpv1-l4-sync", "ptpv1-l4-delay-req",
+	"ptpv2-l4-event", "ptpv2-l4-sync", "ptpv2-l4-delay-req",
+	"ptpv2-l2-event", "ptpv2-l2-sync", "ptpv2-l2-delay-req",
+	"ptpv2-event", "ptpv2-sync", "ptpv2-delay-req",
+	"ntp-all",
+};
+
+#define N_NAMES(a) ((int) (sizeof(a) / sizeof(a[0])))
+
+/*
+ * The filters time stamping the PTPv2 event messages of each transport,
+ * from the most specific one, which time stamps the fewest packets.
+ */
+static const int l2_filters[] = {
+	HWTSTAMP_FILTER_PTP_V2_L2_EVENT, HWTSTAMP_FILTER_PTP_V2_EVENT,
+	HWTSTAMP_FILTER_ALL, -1
+};
+static const int l4_filters[] = {
+	HWTSTAMP_FILTER_PTP_V2_L4_EVENT, HWTSTAMP_FILTER_PTP_V2_EVENT,
+	HWTSTAMP_FILTER_ALL, -1
+};
+
+static int get_ts_info(int fd, const char *name, struct ethtool_ts_info *info)
 {
 	struct ifreq ifreq;
-	struct hwtstamp_config cfg;
-	char *device = NULL, *progname;
-	int c, err, fd, rxopt = HWTSTAMP_FILTER_NONE, txopt = HWTSTAMP_TX_OFF;
-	int setrx = 0, settx = 0;
 
-	/* Process the command line arguments. */
-	progname = strrchr(argv[0], '/');
-	progname = progname ? 1+progname : argv[0];
-	while (EOF != (c = getopt(argc, argv, "hi:r:t:v"))) {
-		switch (c) {
-		case 'i':
-			device = optarg;
-			break;
-		case 'r':
-			setrx = 1;
-			rxopt = atoi(optarg);
-			break;
-		case 't':
-			settx = 1;
-			txopt = atoi(optarg);
-			break;
-		case 'v':
-			version_show(stdout);
-			return 0;
-		case 'h':
-			usage(progname);
-			return 0;
-		case '?':
-		default:
-			usage(progname);
-			return -1;
-		}
+	memset(&ifreq, 0, sizeof(ifreq));
+	memset(info, 0, sizeof(*info));
+	info->cmd = ETHTOOL_GET_TS_INFO;
+	strncpy(ifreq.ifr_name, name, sizeof(ifreq.ifr_name) - 1);
+	ifreq.ifr_data = (void *) info;
+	return ioctl(fd, SIOCETHTOOL, &ifreq);
+}
+
+static void print_bits(FILE *fp, const char *title, uint32_t bits,
+		       const char **names, int n_names)
+{
+	int i;
+
+	fprintf(fp, "%s:\n", title);
+	for (i = 0; i < 32; i++) {
+		if (!(bits & (1U << i)))
+			continue;
+		fprintf(fp, "  %2d %s\n", i, i < n_names ? names[i] : "unknown");
 	}
+}
 
-	if (!device) {
-		usage(progname);
-		return -1;
+static void print_cheapest(FILE *fp, const char *transport, uint32_t bits,
+			   const int *filters)
+{
+	for (; *filters >= 0; filters++) {
+		if (bits & (1U << *filters)) {
+			fprintf(fp, "%s rx_filter %d\n", transport, *filters);
+			return;
+		}
 	}
+	fprintf(fp, "%s rx_filter none\n", transport);
+}
 
-	if (rxopt < HWTSTAMP_FILTER_NONE ||
-	    rxopt > HWTSTAMP_FILTER_PTP_V2_DELAY_REQ ||
-	    txopt < HWTSTAMP_TX_OFF || txopt > HWTSTAMP_TX_ON) {
-		usage(progname);
-		return -1;
+static void print_caps(struct device *d, int fd)
+{
+	struct ethtool_ts_info info;
+
+	if (get_ts_info(fd, d->name, &info)) {
+		fprintf(d->err, "ETHTOOL_GET_TS_INFO failed: %s\n",
+			strerror(errno));
+		return;
 	}
+	fprintf(d->out, "capabilities:\n"
+		"phc_index %d\n"
+		"so_timestamping 0x%x\n",
+		info.phc_index, info.so_timestamping);
+	print_bits(d->out, "tx_types", info.tx_types, tx_type_names,
+		   N_NAMES(tx_type_names));
+	print_bits(d->out, "rx_filters", info.rx_filters, rx_filter_names,
+		   N_NAMES(rx_filter_names));
+	print_cheapest(d->out, "L2", info.rx_filters, l2_filters);
+	print_cheapest(d->out, "UDP", info.rx_filters, l4_filters);
+}
+
+static void *configure(void *arg)
+{
+	struct device *d = arg;
+	const struct settings *set = d->set;
+	struct hwtstamp_config cfg;
+	struct ifreq ifreq;
+	int err, fd;
 
 	memset(&ifreq, 0, sizeof(ifreq));
 	memset(&cfg, 0, sizeof(cfg));
 
-	strncpy(ifreq.ifr_name, device, sizeof(ifreq.ifr_name) - 1);
+	strncpy(ifreq.ifr_name, d->name, sizeof(ifreq.ifr_name) - 1);
 
 	ifreq.ifr_data = (void *) &cfg;
 
 	fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
 	if (fd < 0) {
-		perror("socket");
-		return -1;
+		fprintf(d->err, "socket: %s\n", strerror(errno));
+		d->result = -1;
+		return NULL;
 	}
 
+	if (set->caps)
+		print_caps(d, fd);
+
 	/* First, attempt to get the current settings. */
 	err = ioctl(fd, SIOCGHWTSTAMP, &ifreq);
 	if (err < 0) {
 		err = errno;
 		if (err == ENOTTY)
-			fprintf(stderr,
+			fprintf(d->err,
 				"Kernel does not have support "
 				"for non-destructive SIOCGHWTSTAMP.\n");
 		else if (err == EOPNOTSUPP)
-			fprintf(stderr,
+			fprintf(d->err,
 				"Device driver does not have support "
 				"for non-destructive SIOCGHWTSTAMP.\n");
 		else
-			perror("SIOCGHWTSTAMP failed");
+			fprintf(d->err, "SIOCGHWTSTAMP failed: %s\n",
+				strerror(err));
 	} else {
-		printf("current settings:\n"
-		       "tx_type %d\n"
-		       "rx_filter %d\n",
-		       cfg.tx_type, cfg.rx_filter);
+		fprintf(d->out, "current settings:\n"
+			"tx_type %d\n"
+			"rx_filter %d\n",
+			cfg.tx_type, cfg.rx_filter);
 	}
 
 	/* Now, attempt to set values. Only change the values actually
 	 * requested by user, rather than blindly resetting th zero if
 	 * unrequested. */
-	if (settx || setrx) {
+	if (set->settx || set->setrx) {
 
-		if (settx)
-			cfg.tx_type = txopt;
+		if (set->settx)
+			cfg.tx_type = set->txopt;
 
-		if (setrx)
-			cfg.rx_filter = rxopt;
+		if (set->setrx)
+			cfg.rx_filter = set->rxopt;
 
 		err = ioctl(fd, SIOCSHWTSTAMP, &ifreq);
 		if (err < 0) {
 			err = errno;
-			perror("SIOCSHWTSTAMP failed");
+			fprintf(d->err, "SIOCSHWTSTAMP failed: %s\n",
+				strerror(err));
 			if (err == ERANGE)
-				fprintf(stderr,
+				fprintf(d->err,
 					"The requested time stamping mode is "
 					"not supported by the hardware.\n");
 		} else {
-			printf("new settings:\n"
-			       "tx_type %d\n"
-			       "rx_filter %d\n",
-			       cfg.tx_type, cfg.rx_filter);
+			fprintf(d->out, "new settings:\n"
+				"tx_type %d\n"
+				"rx_filter %d\n",
+				cfg.tx_type, cfg.rx_filter);
+		}
+	}
+
+	close(fd);
+	d->result = err;
+	return NULL;
+}
+
+/* Add the interfaces with a hardware time stamping capability. */
+static int add_all_devices(struct device *devices, int n)
+{
+	struct if_nameindex *ifs, *i;
+	struct ethtool_ts_info info;
+	int fd;
+
+	fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	ifs = if_nameindex();
+	if (!ifs) {
+		perror("if_nameindex");
+		close(fd);
+		return -1;
+	}
+	for (i = ifs; i->if_index && n < MAX_DEVICES; i++) {
+		if (get_ts_info(fd, i->if_name, &info) ||
+		    !(info.so_timestamping & SOF_TIMESTAMPING_RAW_HARDWARE))
+			continue;
+		strncpy(devices[n].name, i->if_name, IF_NAMESIZE - 1);
+		n++;
+	}
+	if_freenameindex(ifs);
+	close(fd);
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	struct device *devices;
+	struct settings set;
+	char *progname;
+	int all = 0, c, i, n = 0, err = 0;
+
+	memset(&set, 0, sizeof(set));
+	set.rxopt = HWTSTAMP_FILTER_NONE;
+	set.txopt = HWTSTAMP_TX_OFF;
+
+	devices = calloc(MAX_DEVICES, sizeof(*devices));
+	if (!devices) {
+		perror("calloc");
+		return -1;
+	}
+
+	/* Process the command line arguments. */
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1+progname : argv[0];
+	while (EOF != (c = getopt(argc, argv, "achi:r:t:v"))) {
+		switch (c) {
+		case 'a':
+			all = 1;
+			break;
+		case 'c':
+			set.caps = 1;
+			break;
+		case 'i':
+			if (n == MAX_DEVICES) {
+				fprintf(stderr, "too many interfaces\n");
+				return -1;
+			}
+			strncpy(devices[n++].name, optarg, IF_NAMESIZE - 1);
+			break;
+		case 'r':
+			set.setrx = 1;
+			set.rxopt = atoi(optarg);
+			break;
+		case 't':
+			set.settx = 1;
+			set.txopt = atoi(optarg);
+			break;
+		case 'v':
+			version_show(stdout);
+			return 0;
+		case 'h':
+			usage(progname);
+			return 0;
+		case '?':
+		default:
+			usage(progname);
+			return -1;
 		}
 	}
 
+	if (all) {
+		n = add_all_devices(devices, n);
+		if (n < 0)
+			return -1;
+		if (!n) {
+			fprintf(stderr, "no interface with hardware time stamping\n");
+			return -1;
+		}
+	}
+
+	if (!n) {
+		usage(progname);
+		return -1;
+	}
+
+	if (set.rxopt < HWTSTAMP_FILTER_NONE ||
+	    set.rxopt > HWTSTAMP_FILTER_PTP_V2_DELAY_REQ ||
+	    set.txopt < HWTSTAMP_TX_OFF || set.txopt > HWTSTAMP_TX_ON) {
+		usage(progname);
+		return -1;
+	}
+
+	if (n == 1) {
+		devices[0].set = &set;
+		devices[0].out = stdout;
+		devices[0].err = stderr;
+		configure(&devices[0]);
+		return devices[0].result;
+	}
+
+	/*
+	 * Configure the devices in parallel, as a driver may take a while
+	 * to reset its hardware, and print their reports in order.
+	 */
+	for (i = 0; i < n; i++) {
+		devices[i].set = &set;
+		devices[i].out = open_memstream(&devices[i].buf,
+						&devices[i].len);
+		if (!devices[i].out) {
+			perror("open_memstream");
+			return -1;
+		}
+		devices[i].err = open_memstream(&devices[i].errbuf,
+						&devices[i].errlen);
+		if (!devices[i].err) {
+			perror("open_memstream");
+			return -1;
+		}
+		if (pthread_create(&devices[i].thread, NULL, configure,
+				   &devices[i])) {
+			fprintf(stderr, "failed to start a thread\n");
+			devices[i].thread = 0;
+			configure(&devices[i]);
+		}
+	}
+	for (i = 0; i < n; i++) {
+		if (devices[i].thread)
+			pthread_join(devices[i].thread, NULL);
+		fclose(devices[i].out);
+		fclose(devices[i].err);
+		printf("%s:\n%s", devices[i].name, devices[i].buf);
+		fflush(stdout);
+		if (devices[i].errlen)
+			fprintf(stderr, "%s: %s", devices[i].name,
+				devices[i].errbuf);
+		free(devices[i].buf);
+		free(devices[i].errbuf);
+		if (devices[i].result)
+			err = devices[i].result;
+	}
+	free(devices);
 	return err;
 }
@@ -50,6 +50,17 @@ user_flags()
 			fi
 		done
 	done
+
+	# Look for epoll_create1().
+	for d in $dirs; do
+		files=$(find $d -type f -name epoll.h)
+		for f in $files; do
+			if grep -q epoll_create1 $f; then
+				printf " -DHAVE_EPOLL"
+				break 2
+			fi
+		done
+	done
 }
 
 #
@@ -82,6 +93,27 @@ kernel_flags()
 	if grep -q HWTSTAMP_TX_ONESTEP_SYNC ${prefix}${tstamp}; then
 		printf " -DHAVE_ONESTEP_SYNC"
 	fi
+
+	if grep -q HWTSTAMP_TX_ONESTEP_P2P ${prefix}${tstamp}; then
+		printf " -DHAVE_ONESTEP_P2P"
+	fi
+
+	if grep -q sock_txtime ${prefix}${tstamp}; then
+		printf " -DHAVE_SOCK_TXTIME"
+	fi
+
+	# The XDP transport needs BPF links and bpf_ktime_get_tai_ns().
+	xdp=/usr/include/linux/if_xdp.h
+	bpf=/usr/include/linux/bpf.h
+	if grep -q XDP_UMEM_REG ${prefix}${xdp} 2>/dev/null &&
+	   grep -q ktime_get_tai_ns ${prefix}${bpf} 2>/dev/null &&
+	   grep -q BPF_LINK_CREATE ${prefix}${bpf}; then
+		printf " -DHAVE_AF_XDP"
+	fi
+
+	if grep -q sk_select_reuseport ${prefix}${bpf} 2>/dev/null; then
+		printf " -DHAVE_REUSEPORT_EBPF"
+	fi
 }
 
 flags="$(user_flags)$(kernel_flags)"
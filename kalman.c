@@ -0,0 +1,308 @@
+/**
+ * @file kalman.c
+ * @brief Implements a clock servo based on a Kalman filter.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <math.h>
+
+#include "kalman.h"
+#include "print.h"
+#include "servo_private.h"
+
+/*
+ * The state is the offset of the clock in nanoseconds and its drift,
+ * which is the adjustment in ppb that would keep the offset constant.
+ * Between two samples, the offset grows by the difference between the
+ * drift and the adjustment applied in the meantime.
+ *
+ * The process noise models white phase noise and a random walk of the
+ * frequency. The measurement noise is estimated from the innovations,
+ * and is scaled by the inverse of the weight of each sample.
+ */
+
+/* Process noise of the offset in ns^2/s */
+#define PHASE_NOISE 1.0
+/* Process noise of the drift in ppb^2/s */
+#define FREQ_NOISE 0.01
+/* Initial variance of the drift in ppb^2, and with a known drift */
+#define FREQ_VAR_INIT 1e10
+#define FREQ_VAR_WARM 1e4
+/* Initial measurement noise with hardware and software time stamps */
+#define HWTS_MEAS_VAR 1e4
+#define SWTS_MEAS_VAR 1e8
+/* Lower bound of the measurement noise in ns^2 */
+#define MEAS_VAR_MIN 1.0
+/* Smoothing factor used for the estimate of the measurement noise */
+#define MEAS_VAR_SMOOTH 0.05
+/* Standard deviation of the drift in ppb required to lock */
+#define LOCK_FREQ_SIGMA 1000.0
+/* Innovations beyond this many standard deviations are outliers */
+#define OUTLIER_SIGMAS 5.0
+/* Number of consecutive outliers accepted as a change of the offset */
+#define OUTLIER_MAX 3
+/* The offset is corrected over this many sync intervals */
+#define CORR_INTERVALS 2.0
+
+struct kalman_servo {
+	struct servo servo;
+	/* State estimate */
+	double offset;
+	double drift;
+	/* Covariance of the estimate */
+	double p00, p01, p11;
+	/* Estimated variance of the measurements */
+	double meas_var;
+	double meas_var_init;
+	/* Adjustment returned by the last sample */
+	double adj;
+	uint64_t last_ts;
+	double interval;
+	int count;
+	int outliers;
+	int locked;
+	int leap;
+	int warm;
+};
+
+static void kalman_destroy(struct servo *servo)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+	free(s);
+}
+
+static void kalman_predict(struct kalman_servo *s, double dt)
+{
+	double q_pp, q_pf, q_ff;
+
+	q_ff = FREQ_NOISE * dt;
+	q_pf = FREQ_NOISE * dt * dt / 2.0;
+	q_pp = PHASE_NOISE * dt + FREQ_NOISE * dt * dt * dt / 3.0;
+
+	s->offset += (s->drift - s->adj) * dt;
+	s->p00 += 2.0 * dt * s->p01 + dt * dt * s->p11 + q_pp;
+	s->p01 += dt * s->p11 + q_pf;
+	s->p11 += q_ff;
+}
+
+/* Returns non-zero if the measurement was rejected as an outlier. */
+static int kalman_update(struct kalman_servo *s, double z, double weight,
+			 double dt)
+{
+	double k0, k1, limit, nu, nu2, r, var;
+
+	if (weight < 1e-3)
+		weight = 1e-3;
+
+	nu = z - s->offset;
+	nu2 = nu * nu;
+	r = s->meas_var / weight;
+	var = s->p00 + r;
+	limit = OUTLIER_SIGMAS * OUTLIER_SIGMAS * var;
+
+	if (s->locked && nu2 > limit) {
+		if (++s->outliers <= OUTLIER_MAX)
+			return 1;
+		/*
+		 * The innovations are consistently too large, so the model
+		 * no longer holds. Widen the covariance to let the estimate
+		 * follow the measurements again.
+		 */
+		s->p00 += nu2;
+		s->p11 += nu2 / (dt * dt);
+		var = s->p00 + r;
+		nu2 = limit;
+	}
+	s->outliers = 0;
+
+	k0 = s->p00 / var;
+	k1 = s->p01 / var;
+
+	s->offset += k0 * nu;
+	s->drift += k1 * nu;
+
+	s->p11 -= k1 * s->p01;
+	s->p01 *= 1.0 - k0;
+	s->p00 *= 1.0 - k0;
+
+	/*
+	 * Estimate the measurement noise from the residual, which unlike
+	 * the innovation does not depend on the uncertainty of the drift.
+	 */
+	if (nu2 > limit)
+		nu2 = limit;
+	nu2 *= (1.0 - k0) * (1.0 - k0);
+	s->meas_var += MEAS_VAR_SMOOTH * (nu2 + s->p00 - s->meas_var);
+	if (s->meas_var < MEAS_VAR_MIN)
+		s->meas_var = MEAS_VAR_MIN;
+	return 0;
+}
+
+static void kalman_init(struct kalman_servo *s, int64_t offset,
+			uint64_t local_ts)
+{
+	s->offset = offset;
+	s->drift = s->adj;
+	s->p00 = s->meas_var;
+	s->p01 = 0.0;
+	s->p11 = s->warm ? FREQ_VAR_WARM : FREQ_VAR_INIT;
+	s->warm = 0;
+	s->last_ts = local_ts;
+	s->outliers = 0;
+	s->locked = 0;
+	s->count = 1;
+}
+
+static double kalman_sample(struct servo *servo,
+			    int64_t offset,
+			    uint64_t local_ts,
+			    double weight,
+			    enum servo_state *state)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+	double adj, dt;
+
+	if (!s->count || local_ts <= s->last_ts) {
+		kalman_init(s, offset, local_ts);
+		*state = SERVO_UNLOCKED;
+		return s->adj;
+	}
+
+	/*
+	 * Reset the servo when the offset is greater than the max offset
+	 * value, as the PI servo does, so that the clock is stepped once
+	 * the drift is known again.
+	 */
+	if (s->locked && servo->step_threshold &&
+	    servo->step_threshold < fabs(offset)) {
+		kalman_init(s, offset, local_ts);
+		*state = SERVO_UNLOCKED;
+		return s->adj;
+	}
+
+	dt = (local_ts - s->last_ts) / 1e9;
+	s->last_ts = local_ts;
+	s->count++;
+
+	kalman_predict(s, dt);
+	kalman_update(s, offset, weight, dt);
+
+	pr_debug("kalman: offset %.0f drift %.3f sigma %.1f/%.3f meas %.1f",
+		 s->offset, s->drift, sqrt(s->p00), sqrt(s->p11),
+		 sqrt(s->meas_var));
+
+	if (!s->locked) {
+		if (sqrt(s->p11) > LOCK_FREQ_SIGMA) {
+			*state = SERVO_UNLOCKED;
+			return s->adj;
+		}
+		s->locked = 1;
+		if ((servo->first_update &&
+		     servo->first_step_threshold &&
+		     servo->first_step_threshold < fabs(s->offset)) ||
+		    (servo->step_threshold &&
+		     servo->step_threshold < fabs(s->offset))) {
+			/* The clock will be stepped by the offset. */
+			s->offset -= offset;
+			*state = SERVO_JUMP;
+		} else {
+			*state = SERVO_LOCKED;
+		}
+	} else {
+		*state = SERVO_LOCKED;
+	}
+
+	adj = s->drift + s->offset / (CORR_INTERVALS * s->interval);
+	if (adj < -servo->max_frequency)
+		adj = -servo->max_frequency;
+	else if (adj > servo->max_frequency)
+		adj = servo->max_frequency;
+
+	s->adj = adj;
+	return adj;
+}
+
+static void kalman_sync_interval(struct servo *servo, double interval)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+
+	s->interval = interval;
+}
+
+static void kalman_reset(struct servo *servo)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+
+	s->count = 0;
+	s->meas_var = s->meas_var_init;
+}
+
+static double kalman_rate_ratio(struct servo *servo)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+
+	if (!s->locked)
+		return 1.0;
+
+	return 1.0 - (s->drift - s->adj) / 1e9;
+}
+
+static void kalman_leap(struct servo *servo, int leap)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+
+	/*
+	 * Move the offset when the leap second is applied, as if the clock
+	 * was stepped in the opposite direction.
+	 */
+	if (s->leap && !leap && s->count)
+		s->offset += s->leap * 1e9;
+
+	s->leap = leap;
+}
+
+static void kalman_warm_start(struct servo *servo, double fadj)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+
+	s->adj = fadj;
+	s->warm = 1;
+}
+
+struct servo *kalman_servo_create(int fadj, int sw_ts)
+{
+	struct kalman_servo *s;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->servo.destroy = kalman_destroy;
+	s->servo.sample = kalman_sample;
+	s->servo.sync_interval = kalman_sync_interval;
+	s->servo.reset = kalman_reset;
+	s->servo.rate_ratio = kalman_rate_ratio;
+	s->servo.leap = kalman_leap;
+	s->servo.warm_start = kalman_warm_start;
+
+	s->adj = fadj;
+	s->interval = 1.0;
+	s->meas_var_init = sw_ts ? SWTS_MEAS_VAR : HWTS_MEAS_VAR;
+	s->meas_var = s->meas_var_init;
+
+	return &s->servo;
+}
@@ -19,6 +19,7 @@
  */
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 
 #include "linreg.h"
 #include "print.h"
@@ -26,7 +27,7 @@
 
 /* Maximum and minimum number of points used in regression,
    defined as a power of 2 */
-#define MAX_SIZE 6
+#define MAX_SIZE 10
 #define MIN_SIZE 2
 
 #define MAX_POINTS (1 << MAX_SIZE)
@@ -37,6 +38,8 @@
 #define ERR_INITIAL_UPDATES 10
 /* Maximum ratio of two err values to be considered equal */
 #define ERR_EQUALS 1.05
+/* Distance in ns of the newest point from the origin triggering a rebase */
+#define MAX_ORIGIN_DISTANCE (1LL << 40)
 
 /* Uncorrected local time vs remote time */
 struct point {
@@ -45,7 +48,22 @@ struct point {
 	double w;
 };
 
+/*
+ * Weighted means and co-moments of the points in a window relative to
+ * the origin, which can be updated in constant time as points enter and
+ * leave the window.
+ */
+struct sums {
+	double w;
+	double x;
+	double y;
+	double xx;
+	double xy;
+};
+
 struct result {
+	/* Running sums of the points in the window of this size */
+	struct sums sums;
 	/* Slope and intercept from latest regression */
 	double slope;
 	double intercept;
@@ -61,10 +79,14 @@ struct linreg_servo {
 	struct point points[MAX_POINTS];
 	/* Current time in x, y */
 	struct point reference;
+	/* Origin of the coordinates used in the sums */
+	struct point origin;
 	/* Number of stored points */
 	unsigned int num_points;
 	/* Index of the newest point */
 	unsigned int last_point;
+	/* Number of points added since the sums were recomputed */
+	unsigned int sum_updates;
 	/* Remainder from last update of reference.x */
 	double x_remainder;
 	/* Local time stamp of last update */
@@ -81,6 +103,8 @@ struct linreg_servo {
 	double frequency_ratio;
 	/* Upcoming leap second */
 	int leap;
+	/* Known drift, 1 before the first sample and 2 after it */
+	int warm;
 };
 
 static void linreg_destroy(struct servo *servo)
@@ -123,28 +147,135 @@ static void update_reference(struct linreg_servo *s, uint64_t local_ts)
 	s->last_update = local_ts;
 }
 
+static void sums_add(struct sums *sums, double x, double y, double w)
+{
+	double dx;
+
+	sums->w += w;
+	dx = x - sums->x;
+	sums->x += w * dx / sums->w;
+	sums->y += w * (y - sums->y) / sums->w;
+	sums->xx += w * dx * (x - sums->x);
+	sums->xy += w * dx * (y - sums->y);
+}
+
+static void sums_remove(struct sums *sums, double x, double y, double w)
+{
+	double dy, mx;
+
+	if (sums->w - w <= 0.0) {
+		sums->w = sums->x = sums->y = sums->xx = sums->xy = 0.0;
+		return;
+	}
+
+	dy = y - sums->y;
+	mx = sums->x - w * (x - sums->x) / (sums->w - w);
+	sums->xx -= w * (x - mx) * (x - sums->x);
+	sums->xy -= w * (x - mx) * dy;
+	sums->x = mx;
+	sums->y -= w * dy / (sums->w - w);
+	sums->w -= w;
+}
+
+static void point_coords(struct linreg_servo *s, unsigned int i,
+			 double *x, double *y)
+{
+	*x = (int64_t)(s->points[i].x - s->origin.x);
+	*y = (int64_t)(s->points[i].y - s->origin.y);
+}
+
+static void move_origin(struct linreg_servo *s, unsigned int i)
+{
+	unsigned int size;
+	double x, y;
+
+	point_coords(s, i, &x, &y);
+	s->origin = s->points[i];
+
+	for (size = MIN_SIZE; size <= MAX_SIZE; size++) {
+		s->results[size - MIN_SIZE].sums.x -= x;
+		s->results[size - MIN_SIZE].sums.y -= y;
+	}
+}
+
+/*
+ * Recompute the sums from the stored points to discard the rounding errors
+ * accumulated by the updates.
+ */
+static void recompute_sums(struct linreg_servo *s)
+{
+	unsigned int i, l, n, size;
+	struct sums sums;
+	double x, y;
+
+	memset(&sums, 0, sizeof(sums));
+	i = 0;
+
+	for (size = MIN_SIZE; size <= MAX_SIZE; size++) {
+		n = 1 << size;
+		for (; i < n && i < s->num_points; i++) {
+			/* Iterate points from newest to oldest */
+			l = (MAX_POINTS + s->last_point - i) % MAX_POINTS;
+			point_coords(s, l, &x, &y);
+			sums_add(&sums, x, y, s->points[l].w);
+		}
+		s->results[size - MIN_SIZE].sums = sums;
+	}
+
+	s->sum_updates = 0;
+}
+
 static void add_sample(struct linreg_servo *s, int64_t offset, double weight)
 {
+	unsigned int l, n, size;
+	struct point *p;
+	double x, y;
+
 	s->last_point = (s->last_point + 1) % MAX_POINTS;
 
-	s->points[s->last_point].x = s->reference.x;
-	s->points[s->last_point].y = s->reference.y - offset;
-	s->points[s->last_point].w = weight;
+	/* Remove the points leaving the windows, oldest first */
+	for (size = MAX_SIZE; size >= MIN_SIZE; size--) {
+		n = 1 << size;
+		if (n > s->num_points)
+			continue;
+		l = (s->last_point + MAX_POINTS - n) % MAX_POINTS;
+		point_coords(s, l, &x, &y);
+		sums_remove(&s->results[size - MIN_SIZE].sums, x, y,
+			    s->points[l].w);
+	}
+
+	p = &s->points[s->last_point];
+	p->x = s->reference.x;
+	p->y = s->reference.y - offset;
+	p->w = weight;
 
+	if (!s->num_points)
+		s->origin = *p;
 	if (s->num_points < MAX_POINTS)
 		s->num_points++;
+
+	if (++s->sum_updates >= MAX_POINTS) {
+		recompute_sums(s);
+		return;
+	}
+
+	if ((int64_t)(p->x - s->origin.x) > MAX_ORIGIN_DISTANCE)
+		move_origin(s, s->last_point);
+
+	point_coords(s, s->last_point, &x, &y);
+	for (size = MIN_SIZE; size <= MAX_SIZE; size++)
+		sums_add(&s->results[size - MIN_SIZE].sums, x, y, weight);
 }
 
 static void regress(struct linreg_servo *s)
 {
-	double x, y, y0, e, x_sum, y_sum, xy_sum, x2_sum, w, w_sum;
-	unsigned int i, l, n, size;
+	double xr, yr, y0, e;
+	unsigned int n, size;
 	struct result *res;
 
-	x_sum = 0.0, y_sum = 0.0, xy_sum = 0.0, x2_sum = 0.0; w_sum = 0.0;
-	i = 0;
-
 	y0 = (int64_t)(s->points[s->last_point].y - s->reference.y);
+	xr = (int64_t)(s->reference.x - s->origin.x);
+	yr = (int64_t)(s->reference.y - s->origin.y);
 
 	for (size = MIN_SIZE; size <= MAX_SIZE; size++) {
 		n = 1 << size;
@@ -167,25 +298,9 @@ static void regress(struct linreg_servo *s)
 			}
 		}
 
-		for (; i < n; i++) {
-			/* Iterate points from newest to oldest */
-			l = (MAX_POINTS + s->last_point - i) % MAX_POINTS;
-
-			x = (int64_t)(s->points[l].x - s->reference.x);
-			y = (int64_t)(s->points[l].y - s->reference.y);
-			w = s->points[l].w;
-
-			x_sum += x * w;
-			y_sum += y * w;
-			xy_sum += x * y * w;
-			x2_sum += x * x * w;
-			w_sum += w;
-		}
-
 		/* Get new intercept and slope */
-		res->slope = (xy_sum - x_sum * y_sum / w_sum) /
-				(x2_sum - x_sum * x_sum / w_sum);
-		res->intercept = (y_sum - res->slope * x_sum) / w_sum;
+		res->slope = res->sums.xy / res->sums.xx;
+		res->intercept = res->sums.y + res->slope * (xr - res->sums.x) - yr;
 	}
 }
 
@@ -238,8 +353,25 @@ static double linreg_sample(struct servo *servo,
 	update_size(s);
 
 	if (s->size < MIN_SIZE) {
-		/* Not enough points, wait for more */
-		*state = SERVO_UNLOCKED;
+		/*
+		 * Not enough points, wait for more. With a known drift, step
+		 * the clock by the first offset and keep the frequency.
+		 */
+		*state = s->warm == 2 ? SERVO_LOCKED : SERVO_UNLOCKED;
+		if (s->warm != 1)
+			return -s->clock_freq;
+		s->warm = 2;
+		if ((servo->first_update &&
+		     servo->first_step_threshold &&
+		     servo->first_step_threshold < fabs(offset)) ||
+		    (servo->step_threshold &&
+		     servo->step_threshold < fabs(offset))) {
+			move_reference(s, 0, -offset);
+			s->last_update -= offset;
+			*state = SERVO_JUMP;
+		} else {
+			*state = SERVO_LOCKED;
+		}
 		return -s->clock_freq;
 	}
 
@@ -299,13 +431,17 @@ static void linreg_reset(struct servo *servo)
 	unsigned int i;
 
 	s->num_points = 0;
+	s->sum_updates = 0;
 	s->last_update = 0;
 	s->size = 0;
 	s->frequency_ratio = 1.0;
+	s->warm = 0;
 
 	for (i = MIN_SIZE; i <= MAX_SIZE; i++) {
 		s->results[i - MIN_SIZE].slope = 0.0;
 		s->results[i - MIN_SIZE].err_updates = 0;
+		memset(&s->results[i - MIN_SIZE].sums, 0,
+		       sizeof(s->results[i - MIN_SIZE].sums));
 	}
 }
 
@@ -330,6 +466,15 @@ static void linreg_leap(struct servo *servo, int leap)
 	s->leap = leap;
 }
 
+static void linreg_warm_start(struct servo *servo, double fadj)
+{
+	struct linreg_servo *s = container_of(servo, struct linreg_servo, servo);
+
+	s->clock_freq = -fadj;
+	if (!s->num_points)
+		s->warm = 1;
+}
+
 struct servo *linreg_servo_create(int fadj)
 {
 	struct linreg_servo *s;
@@ -344,6 +489,7 @@ struct servo *linreg_servo_create(int fadj)
 	s->servo.reset = linreg_reset;
 	s->servo.rate_ratio = linreg_rate_ratio;
 	s->servo.leap = linreg_leap;
+	s->servo.warm_start = linreg_warm_start;
 
 	s->clock_freq = -fadj;
 	s->frequency_ratio = 1.0;
@@ -0,0 +1,107 @@
+/**
+ * @file mcache.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mcache.h"
+#include "tlv.h"
+
+/* The owners only cache a handful of IDs with small data sets. */
+#define MCACHE_SLOTS 16
+#define MCACHE_MAX_TLV 256
+
+struct mcache_entry {
+	int id;
+	int valid;
+	unsigned int gen;
+	int len;
+	uint8_t tlv[MCACHE_MAX_TLV];
+};
+
+struct mcache {
+	struct mcache_entry entry[MCACHE_SLOTS];
+	int used;
+};
+
+static struct mcache_entry *mcache_find(struct mcache *mc, int id)
+{
+	int i;
+
+	for (i = 0; i < mc->used; i++) {
+		if (mc->entry[i].id == id)
+			return &mc->entry[i];
+	}
+	return NULL;
+}
+
+struct mcache *mcache_create(void)
+{
+	return calloc(1, sizeof(struct mcache));
+}
+
+void mcache_destroy(struct mcache *mc)
+{
+	free(mc);
+}
+
+int mcache_get(struct mcache *mc, int id, unsigned int gen,
+	       struct ptp_message *rsp)
+{
+	struct mcache_entry *e = mcache_find(mc, id);
+
+	if (!e || !e->valid || e->gen != gen)
+		return 0;
+
+	memcpy(rsp->management.suffix, e->tlv, e->len);
+	rsp->header.messageLength += e->len;
+	/* Already in network byte order. */
+	rsp->tlv_count = 0;
+	return 1;
+}
+
+void mcache_put(struct mcache *mc, int id, unsigned int gen,
+		struct ptp_message *rsp)
+{
+	struct TLV *tlv = (struct TLV *) rsp->management.suffix;
+	struct mcache_entry *e;
+	int len;
+
+	len = sizeof(*tlv) + tlv->length;
+	tlv_pre_send(tlv, &rsp->last_tlv);
+	tlv->type = htons(tlv->type);
+	tlv->length = htons(tlv->length);
+	rsp->tlv_count = 0;
+
+	e = mcache_find(mc, id);
+	if (!e) {
+		if (mc->used == MCACHE_SLOTS)
+			return;
+		e = &mc->entry[mc->used++];
+		e->id = id;
+	}
+	if (len > MCACHE_MAX_TLV) {
+		e->valid = 0;
+		return;
+	}
+	memcpy(e->tlv, tlv, len);
+	e->len = len;
+	e->gen = gen;
+	e->valid = 1;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file mcache.h
+ * @brief Caches the management responses in network byte order.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_MCACHE_H
+#define HAVE_MCACHE_H
+
+#include "msg.h"
+
+/** Opaque type. */
+struct mcache;
+
+/**
+ * Create a cache of management responses. The entries are tagged with
+ * a generation number, which the owner increments whenever the data of
+ * the cached management IDs changes.
+ * @return  A pointer to a new instance on success, NULL otherwise.
+ */
+struct mcache *mcache_create(void);
+
+/**
+ * Destroy a cache.
+ * @param mc  A pointer obtained via mcache_create().
+ */
+void mcache_destroy(struct mcache *mc);
+
+/**
+ * Complete a management response from the cache.
+ *
+ * On a hit, the management TLV is appended to the response in network
+ * byte order, and msg_pre_send() only converts the header.
+ *
+ * @param mc   A pointer obtained via mcache_create().
+ * @param id   The management ID.
+ * @param gen  The current generation.
+ * @param rsp  A response without a TLV, from port_management_reply().
+ * @return     One on a hit, zero otherwise.
+ */
+int mcache_get(struct mcache *mc, int id, unsigned int gen,
+	       struct ptp_message *rsp);
+
+/**
+ * Convert the management TLV of a response to network byte order and
+ * keep a copy of it.
+ *
+ * The response is left ready for msg_pre_send(), which then only
+ * converts the header.
+ *
+ * @param mc   A pointer obtained via mcache_create().
+ * @param id   The management ID.
+ * @param gen  The current generation.
+ * @param rsp  A response with a single management TLV in host order.
+ */
+void mcache_put(struct mcache *mc, int id, unsigned int gen,
+		struct ptp_message *rsp);
+
+#endif
@@ -0,0 +1,633 @@
+/**
+ * @file metrics.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fsm.h"
+#include "metrics.h"
+#include "print.h"
+#include "util.h"
+
+#define BACKLOG		8
+/* Timeout of the socket operations of a client in seconds */
+#define CLIENT_TIMEOUT	1
+#define REQUEST_MAX	1024
+/* Attempts to copy the published state before giving up */
+#define READ_ATTEMPTS	100
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#define CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+struct metrics {
+	pthread_t thread;
+	int fd;
+	int stop[2];
+	char *path;
+	struct stateshm *state;
+	int max_ports;
+	/* Written by metrics_update(), seq is odd while it is in progress */
+	_Atomic uint32_t seq;
+	int num_ports;
+	struct metrics_port *ports;
+	struct msg_pool_stats pool;
+	int have_pool;
+	/* The copies used by the thread */
+	struct metrics_port *port_copy;
+};
+
+static const char *servo_state_str[] = {
+	"unlocked",
+	"jump",
+	"locked",
+};
+
+static int metrics_read(struct metrics *m, int *num,
+			struct msg_pool_stats *pool, int *have_pool)
+{
+	uint32_t seq;
+	int i;
+
+	for (i = 0; i < READ_ATTEMPTS; i++) {
+		seq = atomic_load_explicit(&m->seq, memory_order_acquire);
+		if (seq & 1)
+			continue;
+		*num = m->num_ports;
+		memcpy(m->port_copy, m->ports, *num * sizeof(*m->ports));
+		*pool = m->pool;
+		*have_pool = m->have_pool;
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&m->seq, memory_order_relaxed) == seq)
+			return 0;
+	}
+	return -1;
+}
+
+static void write_label(FILE *fp, const char *name, const char *value)
+{
+	fprintf(fp, "%s=\"", name);
+	for (; *value; value++) {
+		if (*value == '\\' || *value == '"')
+			fprintf(fp, "\\%c", *value);
+		else if (*value == '\n')
+			fprintf(fp, "\\n");
+		else
+			fputc(*value, fp);
+	}
+	fputc('"', fp);
+}
+
+static void write_family(FILE *fp, const char *name, const char *type,
+			 const char *unit, const char *help)
+{
+	fprintf(fp, "# TYPE %s %s\n", name, type);
+	if (unit)
+		fprintf(fp, "# UNIT %s %s\n", name, unit);
+	fprintf(fp, "# HELP %s %s\n", name, help);
+}
+
+enum clock_metric {
+	CM_INFO,
+	CM_OFFSET,
+	CM_ERROR,
+	CM_DELAY,
+	CM_FREQ,
+	CM_SERVO_STATE,
+	CM_UPDATES,
+	CM_AGE,
+	CM_NUM,
+};
+
+static const struct {
+	const char *family;
+	const char *sample;
+	const char *type;
+	const char *unit;
+	const char *help;
+} clock_metrics[CM_NUM] = {
+	{ "ptp_clock", "ptp_clock_info", "info", NULL,
+	  "The time source of the clock." },
+	{ "ptp_offset_nanoseconds", "ptp_offset_nanoseconds", "gauge",
+	  "nanoseconds", "The last offset of the clock from its source." },
+	{ "ptp_offset_rms_nanoseconds", "ptp_offset_rms_nanoseconds", "gauge",
+	  "nanoseconds", "The RMS of the recent offsets." },
+	{ "ptp_path_delay_nanoseconds", "ptp_path_delay_nanoseconds", "gauge",
+	  "nanoseconds", "The last path or reading delay." },
+	{ "ptp_frequency_adjustment_ppb", "ptp_frequency_adjustment_ppb",
+	  "gauge", NULL, "The frequency adjustment of the clock in ppb." },
+	{ "ptp_servo_state", "ptp_servo_state", "stateset", NULL,
+	  "The state of the clock servo." },
+	{ "ptp_clock_updates", "ptp_clock_updates_total", "counter", NULL,
+	  "The number of updates of the clock." },
+	{ "ptp_clock_update_age_seconds", "ptp_clock_update_age_seconds",
+	  "gauge", "seconds", "The time since the last update of the clock." },
+};
+
+static void write_clock_metric(FILE *fp, int k, struct stateshm_slot *p,
+			       uint64_t now)
+{
+	int i;
+
+	switch (k) {
+	case CM_INFO:
+		fprintf(fp, "%s{", clock_metrics[k].sample);
+		write_label(fp, "clock", p->clock);
+		fprintf(fp, ",");
+		write_label(fp, "source", p->source);
+		fprintf(fp, "} 1\n");
+		return;
+	case CM_SERVO_STATE:
+		for (i = 0; i < ARRAY_SIZE(servo_state_str); i++) {
+			fprintf(fp, "%s{", clock_metrics[k].sample);
+			write_label(fp, "clock", p->clock);
+			fprintf(fp, ",ptp_servo_state=\"%s\"} %d\n",
+				servo_state_str[i],
+				p->updates && p->servo_state == i);
+		}
+		return;
+	case CM_UPDATES:
+		break;
+	case CM_DELAY:
+		if (p->delay < 0)
+			return;
+		/* fall through */
+	default:
+		/* There is no value before the first update. */
+		if (!p->updates)
+			return;
+	}
+
+	fprintf(fp, "%s{", clock_metrics[k].sample);
+	write_label(fp, "clock", p->clock);
+	fprintf(fp, "} ");
+	switch (k) {
+	case CM_OFFSET:
+		fprintf(fp, "%" PRId64 "\n", p->offset);
+		break;
+	case CM_ERROR:
+		fprintf(fp, "%" PRId64 "\n", p->error);
+		break;
+	case CM_DELAY:
+		fprintf(fp, "%" PRId64 "\n", p->delay);
+		break;
+	case CM_FREQ:
+		fprintf(fp, "%.3f\n", p->freq);
+		break;
+	case CM_UPDATES:
+		fprintf(fp, "%" PRIu64 "\n", p->updates);
+		break;
+	case CM_AGE:
+		fprintf(fp, "%.3f\n", (now - p->monotonic) / 1e9);
+		break;
+	}
+}
+
+static void write_clocks(struct metrics *m, FILE *fp)
+{
+	struct stateshm_slot *slots;
+	struct timespec ts;
+	uint64_t now;
+	int i, j, k, n;
+
+	n = stateshm_slots(m->state);
+	slots = calloc(n, sizeof(*slots));
+	if (!slots)
+		return;
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < READ_ATTEMPTS; j++) {
+			if (!stateshm_read(stateshm_slot(m->state, i), &slots[i]))
+				break;
+		}
+		if (j == READ_ATTEMPTS)
+			slots[i].clock[0] = '\0';
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	for (k = 0; k < CM_NUM; k++) {
+		write_family(fp, clock_metrics[k].family, clock_metrics[k].type,
+			     clock_metrics[k].unit, clock_metrics[k].help);
+		for (i = 0; i < n; i++) {
+			if (slots[i].clock[0])
+				write_clock_metric(fp, k, &slots[i], now);
+		}
+	}
+	free(slots);
+}
+
+static const struct {
+	const char *family;
+	const char *help;
+	size_t offset;
+} port_counters[] = {
+	{ "ptp_port_messages_received",
+	  "The number of messages received, including the dropped ones.",
+	  offsetof(struct port_stats, rx) },
+	{ "ptp_port_messages_sent",
+	  "The number of messages sent.",
+	  offsetof(struct port_stats, tx) },
+	{ "ptp_port_messages_ignored",
+	  "The number of received messages ignored by the port.",
+	  offsetof(struct port_stats, rx_ignored) },
+	{ "ptp_port_messages_bad",
+	  "The number of malformed messages received.",
+	  offsetof(struct port_stats, rx_bad) },
+	{ "ptp_port_messages_without_timestamp",
+	  "The number of event messages received without a time stamp.",
+	  offsetof(struct port_stats, rx_no_ts) },
+	{ "ptp_port_tx_timestamp_timeouts",
+	  "The number of messages sent whose time stamp did not show up in time.",
+	  offsetof(struct port_stats, tx_ts_timeout) },
+};
+
+static void write_port_counters(FILE *fp, struct metrics_port *p, int k)
+{
+	uint64_t *counter;
+	int i;
+
+	counter = (uint64_t *) ((char *) &p->stats + port_counters[k].offset);
+	for (i = 0; i < MAX_MESSAGE_TYPES; i++) {
+		if (!strcmp(msg_type_string(i), "unknown"))
+			continue;
+		fprintf(fp, "%s_total{", port_counters[k].family);
+		write_label(fp, "interface", p->name);
+		fprintf(fp, ",port=\"%hu\",type=\"%s\"} %" PRIu64 "\n",
+			p->number, msg_type_string(i), counter[i]);
+	}
+}
+
+static void write_ports(struct metrics *m, FILE *fp, int num)
+{
+	struct metrics_port *p;
+	int i, j, k;
+
+	write_family(fp, "ptp_port_state", "stateset", NULL,
+		     "The state of the port.");
+	for (i = 0; i < num; i++) {
+		p = &m->port_copy[i];
+		for (j = PS_INITIALIZING; j <= PS_SLAVE; j++) {
+			fprintf(fp, "ptp_port_state{");
+			write_label(fp, "interface", p->name);
+			fprintf(fp, ",port=\"%hu\",ptp_port_state=\"%s\"} %d\n",
+				p->number, ps_str[j], p->state == j);
+		}
+	}
+	for (k = 0; k < ARRAY_SIZE(port_counters); k++) {
+		write_family(fp, port_counters[k].family, "counter", NULL,
+			     port_counters[k].help);
+		for (i = 0; i < num; i++)
+			write_port_counters(fp, &m->port_copy[i], k);
+	}
+}
+
+static void write_pool(FILE *fp, struct msg_pool_stats *pool)
+{
+	write_family(fp, "ptp_msg_pool_buffers", "gauge", NULL,
+		     "The number of message buffers.");
+	fprintf(fp, "ptp_msg_pool_buffers{state=\"allocated\"} %d\n"
+		"ptp_msg_pool_buffers{state=\"free\"} %d\n"
+		"ptp_msg_pool_buffers{state=\"limit\"} %d\n"
+		"ptp_msg_pool_buffers{state=\"high_water\"} %d\n",
+		pool->total, pool->free, pool->limit, pool->high_water);
+	write_family(fp, "ptp_msg_pool_allocations", "counter", NULL,
+		     "The number of message allocations by their result.");
+	fprintf(fp, "ptp_msg_pool_allocations_total{result=\"hit\"} %" PRIu64 "\n"
+		"ptp_msg_pool_allocations_total{result=\"miss\"} %" PRIu64 "\n"
+		"ptp_msg_pool_allocations_total{result=\"failure\"} %" PRIu64 "\n",
+		pool->hits, pool->misses, pool->failures);
+}
+
+static char *metrics_text(struct metrics *m, size_t *len)
+{
+	struct msg_pool_stats pool;
+	int have_pool, num;
+	char *text = NULL;
+	FILE *fp;
+
+	fp = open_memstream(&text, len);
+	if (!fp)
+		return NULL;
+	if (m->state)
+		write_clocks(m, fp);
+	if (!metrics_read(m, &num, &pool, &have_pool)) {
+		if (num)
+			write_ports(m, fp, num);
+		if (have_pool)
+			write_pool(fp, &pool);
+	}
+	fprintf(fp, "# EOF\n");
+	if (fclose(fp)) {
+		free(text);
+		return NULL;
+	}
+	return text;
+}
+
+static int send_all(int fd, const char *buf, size_t len)
+{
+	ssize_t cnt;
+
+	while (len) {
+		cnt = send(fd, buf, len, MSG_NOSIGNAL);
+		if (cnt <= 0)
+			return -1;
+		buf += cnt;
+		len -= cnt;
+	}
+	return 0;
+}
+
+static void send_status(int fd, const char *status)
+{
+	char buf[128];
+
+	snprintf(buf, sizeof(buf), "HTTP/1.0 %s\r\nContent-Length: 0\r\n"
+		 "Connection: close\r\n\r\n", status);
+	send_all(fd, buf, strlen(buf));
+}
+
+static void serve_client(struct metrics *m, int fd)
+{
+	struct timeval tv = { CLIENT_TIMEOUT, 0 };
+	char req[REQUEST_MAX + 1], head[256], *text;
+	char method[8], path[64];
+	size_t len = 0, text_len;
+	ssize_t cnt;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	/* Only the request line matters, the headers are ignored. */
+	while (len < REQUEST_MAX) {
+		cnt = recv(fd, req + len, REQUEST_MAX - len, 0);
+		if (cnt <= 0)
+			return;
+		len += cnt;
+		req[len] = '\0';
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+			break;
+	}
+	req[len] = '\0';
+	if (sscanf(req, "%7s %63s", method, path) != 2) {
+		send_status(fd, "400 Bad Request");
+		return;
+	}
+	if (strcmp(method, "GET") && strcmp(method, "HEAD")) {
+		send_status(fd, "405 Method Not Allowed");
+		return;
+	}
+	if (strcmp(path, "/metrics") && strcmp(path, "/")) {
+		send_status(fd, "404 Not Found");
+		return;
+	}
+
+	text = metrics_text(m, &text_len);
+	if (!text) {
+		send_status(fd, "500 Internal Server Error");
+		return;
+	}
+	snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+		 "Content-Type: " CONTENT_TYPE "\r\n"
+		 "Content-Length: %zu\r\nConnection: close\r\n\r\n", text_len);
+	if (!send_all(fd, head, strlen(head)) && strcmp(method, "HEAD"))
+		send_all(fd, text, text_len);
+	free(text);
+}
+
+static void *metrics_run(void *arg)
+{
+	struct metrics *m = arg;
+	struct pollfd pfd[2];
+	int fd;
+
+	pfd[0].fd = m->fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = m->stop[0];
+	pfd[1].events = POLLIN;
+
+	while (1) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			pr_err("metrics: poll failed: %m");
+			break;
+		}
+		if (pfd[1].revents)
+			break;
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+		fd = accept(m->fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+		serve_client(m, fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+static int open_unix(struct metrics *m, const char *path)
+{
+	struct sockaddr_un sa;
+	int fd;
+
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		pr_err("metrics: path %s too long", path);
+		return -1;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		pr_err("metrics: socket failed: %m");
+		return -1;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, path, sizeof(sa.sun_path) - 1);
+	unlink(path);
+	if (bind(fd, (struct sockaddr *) &sa, sizeof(sa))) {
+		pr_err("metrics: bind to %s failed: %m", path);
+		close(fd);
+		return -1;
+	}
+	m->path = strdup(path);
+	return fd;
+}
+
+static int open_tcp(const char *address)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[128], *port;
+	int err, fd = -1, on = 1;
+
+	if (strlen(address) >= sizeof(host)) {
+		pr_err("metrics: bad address %s", address);
+		return -1;
+	}
+	strcpy(host, address);
+	if (host[0] == '[') {
+		port = strchr(host, ']');
+		if (!port || port[1] != ':') {
+			pr_err("metrics: bad address %s", address);
+			return -1;
+		}
+		*port = '\0';
+		port += 2;
+		memmove(host, host + 1, strlen(host));
+	} else {
+		port = strrchr(host, ':');
+		if (port) {
+			*port++ = '\0';
+		} else {
+			port = host;
+		}
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	err = getaddrinfo(port != host && host[0] ? host : NULL, port,
+			  &hints, &res);
+	if (err) {
+		pr_err("metrics: bad address %s: %s", address,
+		       gai_strerror(err));
+		return -1;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+			    ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (!bind(fd, ai->ai_addr, ai->ai_addrlen))
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0)
+		pr_err("metrics: failed to bind to %s: %m", address);
+	return fd;
+}
+
+struct metrics *metrics_create(const char *address, struct stateshm *state,
+			       int ports)
+{
+	struct metrics *m;
+	sigset_t all, old;
+	int err;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+	m->fd = -1;
+	m->stop[0] = m->stop[1] = -1;
+	m->state = state;
+	m->max_ports = ports;
+	m->ports = calloc(ports ? ports : 1, sizeof(*m->ports));
+	m->port_copy = calloc(ports ? ports : 1, sizeof(*m->port_copy));
+	if (!m->ports || !m->port_copy)
+		goto err;
+
+	m->fd = address[0] == '/' ? open_unix(m, address) : open_tcp(address);
+	if (m->fd < 0)
+		goto err;
+	if (listen(m->fd, BACKLOG)) {
+		pr_err("metrics: listen failed: %m");
+		goto err;
+	}
+	if (pipe2(m->stop, O_CLOEXEC)) {
+		pr_err("metrics: pipe failed: %m");
+		goto err;
+	}
+
+	/* Leave the signals to the main thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	err = pthread_create(&m->thread, NULL, metrics_run, m);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		pr_err("metrics: pthread_create failed: %s", strerror(err));
+		goto err;
+	}
+	return m;
+err:
+	if (m->stop[0] >= 0) {
+		close(m->stop[0]);
+		close(m->stop[1]);
+	}
+	if (m->fd >= 0)
+		close(m->fd);
+	if (m->path) {
+		unlink(m->path);
+		free(m->path);
+	}
+	free(m->ports);
+	free(m->port_copy);
+	free(m);
+	return NULL;
+}
+
+void metrics_destroy(struct metrics *m)
+{
+	char c = 0;
+
+	if (write(m->stop[1], &c, 1) == 1)
+		pthread_join(m->thread, NULL);
+	close(m->stop[0]);
+	close(m->stop[1]);
+	close(m->fd);
+	if (m->path) {
+		unlink(m->path);
+		free(m->path);
+	}
+	free(m->ports);
+	free(m->port_copy);
+	free(m);
+}
+
+void metrics_update(struct metrics *m, struct metrics_port *ports, int num,
+		    struct msg_pool_stats *pool)
+{
+	if (num > m->max_ports)
+		num = m->max_ports;
+
+	atomic_fetch_add_explicit(&m->seq, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(m->ports, ports, num * sizeof(*ports));
+	m->num_ports = num;
+	if (pool) {
+		m->pool = *pool;
+		m->have_pool = 1;
+	}
+	atomic_fetch_add_explicit(&m->seq, 1, memory_order_release);
+}
@@ -0,0 +1,73 @@
+/**
+ * @file metrics.h
+ * @brief Serves the state of the clocks and ports as OpenMetrics text.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_METRICS_H
+#define HAVE_METRICS_H
+
+#include "config.h"
+#include "msg.h"
+#include "stateshm.h"
+
+/**
+ * The state and the message counters of a port as published to the
+ * exporter.
+ */
+struct metrics_port {
+	char name[MAX_IFNAME_SIZE + 1];
+	UInteger16 number;
+	uint8_t state; /* enum port_state */
+	struct port_stats stats;
+};
+
+/** Opaque type. */
+struct metrics;
+
+/**
+ * Start a thread serving the metrics over HTTP. The thread only reads
+ * the published state with the same consistency checks as the readers
+ * of the state file, so a slow client never holds up the caller.
+ * @param address  The path of a UNIX socket, starting with a slash, or
+ *                 a TCP port, optionally preceded by the host address
+ *                 and a colon, e.g. "127.0.0.1:9177" or "[::1]:9177".
+ * @param state    The state of the synchronized clocks.
+ * @param ports    The maximum number of ports to publish.
+ * @return         A pointer to a new instance on success, NULL otherwise.
+ */
+struct metrics *metrics_create(const char *address, struct stateshm *state,
+			       int ports);
+
+/**
+ * Stop the thread and close the socket.
+ * @param m  A pointer obtained via metrics_create().
+ */
+void metrics_destroy(struct metrics *m);
+
+/**
+ * Publish the state of the ports and of the message pool. To be called
+ * from a single thread, which never waits for the exporter.
+ * @param m      A pointer obtained via metrics_create().
+ * @param ports  The state of the ports.
+ * @param num    The number of ports, at most the number passed to
+ *               metrics_create().
+ * @param pool   The counters of the message pool.
+ */
+void metrics_update(struct metrics *m, struct metrics_port *ports, int num,
+		    struct msg_pool_stats *pool);
+
+#endif
@@ -23,6 +23,7 @@
 #ifndef HAVE_MISSING_H
 #define HAVE_MISSING_H
 
+#include <stdint.h>
 #include <time.h>
 #include <sys/syscall.h>
 #include <sys/timex.h>
@@ -54,6 +55,25 @@ enum _missing_hwtstamp_tx_types {
 };
 #endif
 
+#ifndef HAVE_ONESTEP_P2P
+enum _missing_hwtstamp_tx_types_p2p {
+	HWTSTAMP_TX_ONESTEP_P2P = 3,
+};
+#endif
+
+#ifndef HAVE_SOCK_TXTIME
+struct sock_txtime {
+	clockid_t clockid;
+	uint32_t flags;
+};
+#define SOF_TXTIME_REPORT_ERRORS (1 << 1)
+#endif
+
+#ifndef SO_EE_ORIGIN_TXTIME
+#define SO_EE_ORIGIN_TXTIME 6
+#define SO_EE_CODE_TXTIME_MISSED 2
+#endif
+
 #ifndef SIOCGHWTSTAMP
 #define SIOCGHWTSTAMP 0x89b1
 #endif
@@ -62,6 +82,19 @@ enum _missing_hwtstamp_tx_types {
 #define SO_SELECT_ERR_QUEUE 45
 #endif
 
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
 #ifndef HAVE_CLOCK_ADJTIME
 static inline int clock_adjtime(clockid_t id, struct timex *tx)
 {
@@ -82,6 +115,8 @@ static inline int clock_nanosleep(clockid_t clock_id, int flags,
 	return syscall(__NR_clock_nanosleep, clock_id, flags, request, remain);
 }
 
+#define TFD_TIMER_ABSTIME (1 << 0)
+
 static inline int timerfd_create(int clockid, int flags)
 {
 	return syscall(__NR_timerfd_create, clockid, flags);
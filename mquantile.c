@@ -0,0 +1,217 @@
+/**
+ * @file mquantile.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "mquantile.h"
+#include "filter_private.h"
+
+/*
+ * The samples in the window are split between two heaps. The low heap
+ * is a max-heap holding the samples up to and including the lower of
+ * the two order statistics around the quantile, and the high heap is a
+ * min-heap holding the rest. Each heap entry is the index of a sample
+ * in the circular buffer, and each sample knows its position in its
+ * heap, so that the sample leaving the window can be removed directly.
+ */
+struct heap {
+	int *slot;
+	int size;
+	int max; /* non-zero for a max-heap */
+};
+
+struct mquantile {
+	struct filter filter;
+	int cnt;
+	int len;
+	int index;
+	double quantile;
+	struct heap low;
+	struct heap high;
+	/* Position of each sample in its heap, negative in the high heap. */
+	int *pos;
+	/* Values stored in circular buffer. */
+	tmv_t *samples;
+};
+
+static int above(struct mquantile *m, struct heap *h, int a, int b)
+{
+	tmv_t x = m->samples[h->slot[a]], y = m->samples[h->slot[b]];
+
+	return h->max ? tmv_cmp(x, y) > 0 : tmv_cmp(x, y) < 0;
+}
+
+static void heap_set(struct mquantile *m, struct heap *h, int i, int slot)
+{
+	h->slot[i] = slot;
+	m->pos[slot] = h == &m->low ? i : -1 - i;
+}
+
+static void heap_swap(struct mquantile *m, struct heap *h, int i, int j)
+{
+	int tmp = h->slot[i];
+
+	heap_set(m, h, i, h->slot[j]);
+	heap_set(m, h, j, tmp);
+}
+
+static void sift_up(struct mquantile *m, struct heap *h, int i)
+{
+	int parent;
+
+	while (i) {
+		parent = (i - 1) / 2;
+		if (!above(m, h, i, parent))
+			break;
+		heap_swap(m, h, i, parent);
+		i = parent;
+	}
+}
+
+static void sift_down(struct mquantile *m, struct heap *h, int i)
+{
+	int child, top;
+
+	while (1) {
+		top = i;
+		child = 2 * i + 1;
+		if (child < h->size && above(m, h, child, top))
+			top = child;
+		child++;
+		if (child < h->size && above(m, h, child, top))
+			top = child;
+		if (top == i)
+			break;
+		heap_swap(m, h, i, top);
+		i = top;
+	}
+}
+
+static void heap_push(struct mquantile *m, struct heap *h, int slot)
+{
+	heap_set(m, h, h->size, slot);
+	sift_up(m, h, h->size++);
+}
+
+static void heap_remove(struct mquantile *m, struct heap *h, int i)
+{
+	if (i != --h->size) {
+		heap_set(m, h, i, h->slot[h->size]);
+		sift_up(m, h, i);
+		sift_down(m, h, i);
+	}
+}
+
+static int heap_pop(struct mquantile *m, struct heap *h)
+{
+	int slot = h->slot[0];
+
+	heap_remove(m, h, 0);
+	return slot;
+}
+
+static void mquantile_destroy(struct filter *filter)
+{
+	struct mquantile *m = container_of(filter, struct mquantile, filter);
+	free(m->low.slot);
+	free(m->high.slot);
+	free(m->pos);
+	free(m->samples);
+	free(m);
+}
+
+static tmv_t mquantile_sample(struct filter *filter, tmv_t sample)
+{
+	struct mquantile *m = container_of(filter, struct mquantile, filter);
+	tmv_t lower, upper;
+	double rank, frac;
+	int nlow, pos;
+
+	if (m->cnt < m->len) {
+		m->cnt++;
+	} else {
+		/* Remove the replaced value from its heap. */
+		pos = m->pos[m->index];
+		if (pos >= 0)
+			heap_remove(m, &m->low, pos);
+		else
+			heap_remove(m, &m->high, -1 - pos);
+	}
+
+	m->samples[m->index] = sample;
+	if (m->low.size && tmv_cmp(sample, m->samples[m->low.slot[0]]) <= 0)
+		heap_push(m, &m->low, m->index);
+	else
+		heap_push(m, &m->high, m->index);
+
+	m->index = (1 + m->index) % m->len;
+
+	/* Balance the heaps around the lower order statistic. */
+	rank = m->quantile * (m->cnt - 1);
+	nlow = (int) rank + 1;
+	frac = rank - (nlow - 1);
+
+	while (m->low.size > nlow)
+		heap_push(m, &m->high, heap_pop(m, &m->low));
+	while (m->low.size < nlow)
+		heap_push(m, &m->low, heap_pop(m, &m->high));
+
+	lower = m->samples[m->low.slot[0]];
+	if (!m->high.size || frac == 0.0)
+		return lower;
+	upper = m->samples[m->high.slot[0]];
+	if (frac == 0.5)
+		return tmv_div(tmv_add(lower, upper), 2);
+	return tmv_add(lower, dbl_tmv(frac * tmv_dbl(tmv_sub(upper, lower))));
+}
+
+static void mquantile_reset(struct filter *filter)
+{
+	struct mquantile *m = container_of(filter, struct mquantile, filter);
+	m->cnt = 0;
+	m->index = 0;
+	m->low.size = 0;
+	m->high.size = 0;
+}
+
+struct filter *mquantile_create(int length, double quantile)
+{
+	struct mquantile *m;
+
+	if (length < 1 || quantile < 0.0 || quantile > 1.0)
+		return NULL;
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+	m->filter.destroy = mquantile_destroy;
+	m->filter.sample = mquantile_sample;
+	m->filter.reset = mquantile_reset;
+	m->low.slot = calloc(length, sizeof(*m->low.slot));
+	m->high.slot = calloc(length, sizeof(*m->high.slot));
+	m->pos = calloc(length, sizeof(*m->pos));
+	m->samples = calloc(length, sizeof(*m->samples));
+	if (!m->low.slot || !m->high.slot || !m->pos || !m->samples) {
+		mquantile_destroy(&m->filter);
+		return NULL;
+	}
+	m->low.max = 1;
+	m->len = length;
+	m->quantile = quantile;
+	return &m->filter;
+}
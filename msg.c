@@ -19,12 +19,15 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <malloc.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/mman.h>
 
 #include <asm/byteorder.h>
 
-#include "contain.h"
 #include "msg.h"
 #include "print.h"
 #include "tlv.h"
@@ -33,28 +36,87 @@
 #define VERSION      0x02
 
 /*
- * Head room fits a VLAN Ethernet header, and 'msg' is 64 bit aligned.
+ * Each buffer starts on a cache line of its own.
  */
-#define MSG_HEADROOM 24
+#define MSG_ALIGN 64
+#define MSG_STRIDE(size) \
+	((offsetof(struct ptp_message, data) + (size) + MSG_ALIGN - 1) & \
+	 ~(MSG_ALIGN - 1))
 
-struct message_storage {
-	unsigned char reserved[MSG_HEADROOM];
-	struct ptp_message msg;
-} PACKED;
+/* The UDP transports send two bytes past the end of the message. */
+#define MSG_TAILROOM 2
 
-static TAILQ_HEAD(msg_pool, ptp_message) msg_pool = TAILQ_HEAD_INITIALIZER(msg_pool);
+/*
+ * The size classes of the buffers, by the room for the PDU. The small
+ * buffers hold the event messages, a Follow_Up with its TLV and an
+ * Announce, the medium ones an Announce with a path trace of some 50
+ * hops, and the full size ones anything else.
+ */
+enum {
+	MSG_SMALL,
+	MSG_MEDIUM,
+	MSG_FULL,
+	N_MSG_CLASSES
+};
+
+static const int msg_class_size[N_MSG_CLASSES] = {
+	[MSG_SMALL] = 128,
+	[MSG_MEDIUM] = 512,
+	[MSG_FULL] = sizeof(struct message_data),
+};
+
+/*
+ * The free buffers of each size class are kept in a cache of each
+ * thread, which serves the allocations and the releases without any
+ * synchronization, and in a lock-free list shared by the threads.
+ *
+ * A cache growing past MSG_CACHE_MAX buffers moves MSG_CACHE_BATCH of
+ * them to the shared list. An empty cache takes the whole shared list
+ * with one exchange, which cannot suffer from the ABA problem of
+ * popping single buffers, keeps up to MSG_CACHE_MAX buffers and puts
+ * the rest back. The shared list is made of segments, each pushed with
+ * one compare and swap. The head of a segment knows its tail and its
+ * length, so that the rest is put back as a single segment after a
+ * walk over the segment heads only.
+ */
+#define MSG_CACHE_MAX	64
+#define MSG_CACHE_BATCH	32
+
+struct msg_cache {
+	struct ptp_message *head[N_MSG_CLASSES];
+	int count[N_MSG_CLASSES];
+	/* Changes not yet added to pool_stats. */
+	int used;
+	int peak;
+	uint64_t hits;
+	int registered;
+};
+
+static __thread struct msg_cache msg_cache;
+static struct ptp_message *_Atomic msg_shared[N_MSG_CLASSES];
+static pthread_key_t msg_cache_key;
+static pthread_once_t msg_cache_once = PTHREAD_ONCE_INIT;
 
 static struct {
-	int total;
-	int count;
+	atomic_int total;
+	atomic_int used;
+	int limit;
+	atomic_int high_water;
+	_Atomic uint64_t hits;
+	_Atomic uint64_t misses;
+	_Atomic uint64_t failures;
 } pool_stats;
 
+/* The preallocated buffers, which are never returned to the heap. */
+static unsigned char *pool_slab;
+static size_t pool_slab_len;
+
 #ifdef DEBUG_POOL
 static void pool_debug(const char *str, void *addr)
 {
-	fprintf(stderr, "*** %p %10s total %d count %d used %d\n",
-		addr, str, pool_stats.total, pool_stats.count,
-		pool_stats.total - pool_stats.count);
+	fprintf(stderr, "*** %p %10s total %d used %d\n",
+		addr, str, atomic_load(&pool_stats.total),
+		atomic_load(&pool_stats.used) + msg_cache.used);
 }
 #else
 static void pool_debug(const char *str, void *addr)
@@ -182,45 +244,324 @@ static void timestamp_pre_send(struct Timestamp *ts)
 
 /* public methods */
 
-struct ptp_message *msg_allocate(void)
+static int msg_class(int len)
+{
+	int class;
+
+	for (class = MSG_SMALL; class < MSG_FULL; class++) {
+		if (len + MSG_TAILROOM <= msg_class_size[class])
+			break;
+	}
+	return class;
+}
+
+/* Add the counts of the calling thread to pool_stats. */
+static void cache_fold_stats(struct msg_cache *c)
+{
+	int high, used;
+
+	if (c->hits) {
+		atomic_fetch_add_explicit(&pool_stats.hits, c->hits,
+					  memory_order_relaxed);
+		c->hits = 0;
+	}
+	if (!c->used && !c->peak)
+		return;
+	used = atomic_fetch_add_explicit(&pool_stats.used, c->used,
+					 memory_order_relaxed);
+	high = atomic_load_explicit(&pool_stats.high_water,
+				    memory_order_relaxed);
+	while (used + c->peak > high &&
+	       !atomic_compare_exchange_weak_explicit(&pool_stats.high_water,
+						      &high, used + c->peak,
+						      memory_order_relaxed,
+						      memory_order_relaxed))
+		;
+	c->used = 0;
+	c->peak = 0;
+}
+
+/* Push a segment, whose head knows its tail and length. */
+static void shared_push(int class, struct ptp_message *first)
+{
+	struct ptp_message *head;
+
+	head = atomic_load_explicit(&msg_shared[class], memory_order_relaxed);
+	do {
+		first->pool.tail->pool.next = head;
+	} while (!atomic_compare_exchange_weak_explicit(&msg_shared[class],
+							&head, first,
+							memory_order_release,
+							memory_order_relaxed));
+}
+
+/* Move the first 'n' buffers of a cache to the shared list. */
+static void cache_flush(struct msg_cache *c, int class, int n)
+{
+	struct ptp_message *first = c->head[class], *last = first;
+	int i;
+
+	for (i = 1; i < n; i++)
+		last = last->pool.next;
+	c->head[class] = last->pool.next;
+	c->count[class] -= n;
+
+	first->pool.tail = last;
+	first->pool.count = n;
+	shared_push(class, first);
+}
+
+static void cache_destroy(void *arg)
+{
+	struct msg_cache *c = arg;
+	int class;
+
+	for (class = 0; class < N_MSG_CLASSES; class++) {
+		if (c->count[class])
+			cache_flush(c, class, c->count[class]);
+	}
+	cache_fold_stats(c);
+}
+
+static void cache_key_create(void)
+{
+	pthread_key_create(&msg_cache_key, cache_destroy);
+}
+
+/* Get the cache of the calling thread, which is flushed when it exits. */
+static struct msg_cache *cache_get(void)
+{
+	struct msg_cache *c = &msg_cache;
+
+	if (!c->registered) {
+		pthread_once(&msg_cache_once, cache_key_create);
+		pthread_setspecific(msg_cache_key, c);
+		c->registered = 1;
+	}
+	return c;
+}
+
+static struct ptp_message *cache_refill(struct msg_cache *c, int class)
+{
+	struct ptp_message *head, *last, *rest, *seg;
+	int i, n;
+
+	head = atomic_exchange_explicit(&msg_shared[class], NULL,
+					memory_order_acquire);
+	if (!head)
+		return NULL;
+
+	/* Take up to MSG_CACHE_MAX buffers of the first segment. */
+	n = head->pool.count;
+	if (n > MSG_CACHE_MAX) {
+		for (last = head, i = 1; i < MSG_CACHE_MAX; i++)
+			last = last->pool.next;
+		rest = last->pool.next;
+		rest->pool.tail = head->pool.tail;
+		rest->pool.count = n - MSG_CACHE_MAX;
+		n = MSG_CACHE_MAX;
+	} else {
+		last = head->pool.tail;
+		rest = last->pool.next;
+	}
+	last->pool.next = NULL;
+
+	/* Put the rest back as one segment. */
+	if (rest) {
+		for (seg = rest->pool.tail->pool.next; seg;
+		     seg = seg->pool.tail->pool.next) {
+			rest->pool.count += seg->pool.count;
+			rest->pool.tail = seg->pool.tail;
+		}
+		shared_push(class, rest);
+	}
+
+	c->head[class] = head;
+	c->count[class] = n;
+	cache_fold_stats(c);
+	return head;
+}
+
+/* Count a new buffer, unless the limit is reached. */
+static int pool_grow(void)
 {
-	struct message_storage *s;
-	struct ptp_message *m = TAILQ_FIRST(&msg_pool);
+	int total;
 
+	total = atomic_fetch_add_explicit(&pool_stats.total, 1,
+					  memory_order_relaxed);
+	if (pool_stats.limit && total >= pool_stats.limit) {
+		atomic_fetch_sub_explicit(&pool_stats.total, 1,
+					  memory_order_relaxed);
+		return -1;
+	}
+	return 0;
+}
+
+static struct ptp_message *msg_allocate_class(int class)
+{
+	struct msg_cache *c = cache_get();
+	struct ptp_message *m = c->head[class];
+
+	if (!m)
+		m = cache_refill(c, class);
 	if (m) {
-		TAILQ_REMOVE(&msg_pool, m, list);
-		pool_stats.count--;
+		c->head[class] = m->pool.next;
+		c->count[class]--;
+		c->hits++;
 		pool_debug("dequeue", m);
-	} else {
-		s = malloc(sizeof(*s));
-		if (s) {
-			m = &s->msg;
-			pool_stats.total++;
+	} else if (!pool_grow()) {
+		if (!posix_memalign((void **) &m, MSG_ALIGN,
+				    MSG_STRIDE(msg_class_size[class]))) {
+			atomic_fetch_add_explicit(&pool_stats.misses, 1,
+						  memory_order_relaxed);
 			pool_debug("allocate", m);
+		} else {
+			atomic_fetch_sub_explicit(&pool_stats.total, 1,
+						  memory_order_relaxed);
+			m = NULL;
 		}
 	}
-	if (m) {
-		memset(m, 0, sizeof(*m));
-		m->refcnt = 1;
+	if (!m) {
+		atomic_fetch_add_explicit(&pool_stats.failures, 1,
+					  memory_order_relaxed);
+		return NULL;
 	}
+	if (++c->used > c->peak)
+		c->peak = c->used;
+
+	memset(m, 0, offsetof(struct ptp_message, data));
+	memset(&m->data, 0, msg_class_size[class]);
+	m->size_class = class;
+	atomic_init(&m->refcnt, 1);
 
 	return m;
 }
 
+struct ptp_message *msg_allocate(void)
+{
+	return msg_allocate_class(MSG_FULL);
+}
+
+struct ptp_message *msg_allocate_len(int len)
+{
+	return msg_allocate_class(msg_class(len));
+}
+
+struct ptp_message *msg_fit(struct ptp_message *m, int cnt)
+{
+	int class = msg_class(cnt);
+	struct ptp_message *f;
+
+	if (class >= m->size_class || m->refcnt != 1)
+		return m;
+	f = msg_allocate_class(class);
+	if (!f)
+		return m;
+	f->hwts = m->hwts;
+	f->address = m->address;
+	memcpy(&f->data, &m->data, cnt);
+	msg_put(m);
+	return f;
+}
+
+int msg_keep_wire(struct ptp_message *m, int cnt)
+{
+	struct ptp_message *w = msg_allocate_len(cnt);
+
+	if (!w)
+		return -1;
+	memcpy(&w->data, &m->data, cnt);
+	m->wire = w;
+	return 0;
+}
+
 void msg_cleanup(void)
 {
-	struct message_storage *s;
-	struct ptp_message *m;
-	while ((m = TAILQ_FIRST(&msg_pool)) != NULL) {
-		TAILQ_REMOVE(&msg_pool, m, list);
-		s = container_of(m, struct message_storage, msg);
-		free(s);
+	struct msg_cache *c = cache_get();
+	struct ptp_message *m, *next;
+	int class;
+
+	for (class = 0; class < N_MSG_CLASSES; class++) {
+		if (c->count[class])
+			cache_flush(c, class, c->count[class]);
+		m = atomic_exchange(&msg_shared[class], NULL);
+		for (; m; m = next) {
+			next = m->pool.next;
+			atomic_fetch_sub(&pool_stats.total, 1);
+			if ((unsigned char *) m >= pool_slab &&
+			    (unsigned char *) m < pool_slab + pool_slab_len)
+				continue;
+			free(m);
+		}
+	}
+	cache_fold_stats(c);
+	if (pool_slab) {
+		munlock(pool_slab, pool_slab_len);
+		free(pool_slab);
+		pool_slab = NULL;
+		pool_slab_len = 0;
 	}
 }
 
+int msg_pool_init(int size, int limit, int lock)
+{
+	size_t stride = MSG_STRIDE(msg_class_size[MSG_FULL]);
+	struct ptp_message *m, *first = NULL;
+	int i;
+
+	if (limit && size > limit) {
+		pr_err("message pool of %d exceeds the limit of %d",
+		       size, limit);
+		return -1;
+	}
+	pool_stats.limit = limit;
+	if (!size || pool_slab)
+		return 0;
+
+	pool_slab_len = size * stride;
+	if (posix_memalign((void **) &pool_slab, MSG_ALIGN, pool_slab_len)) {
+		pr_err("failed to allocate a message pool of %d", size);
+		pool_slab = NULL;
+		pool_slab_len = 0;
+		return -1;
+	}
+	/* Touch every page now, rather than on first use. */
+	memset(pool_slab, 0, pool_slab_len);
+	if (lock && mlock(pool_slab, pool_slab_len)) {
+		pr_err("failed to lock the message pool: %m");
+		free(pool_slab);
+		pool_slab = NULL;
+		pool_slab_len = 0;
+		return -1;
+	}
+	for (i = size - 1; i >= 0; i--) {
+		m = (struct ptp_message *) (pool_slab + i * stride);
+		m->size_class = MSG_FULL;
+		m->pool.next = first;
+		first = m;
+	}
+	first->pool.tail = (struct ptp_message *) (pool_slab + (size - 1) * stride);
+	first->pool.count = size;
+	shared_push(MSG_FULL, first);
+	atomic_fetch_add(&pool_stats.total, size);
+	return 0;
+}
+
+void msg_pool_stats(struct msg_pool_stats *stats)
+{
+	cache_fold_stats(cache_get());
+	stats->total = atomic_load(&pool_stats.total);
+	stats->free = stats->total - atomic_load(&pool_stats.used);
+	stats->limit = pool_stats.limit;
+	stats->high_water = atomic_load(&pool_stats.high_water);
+	stats->hits = atomic_load(&pool_stats.hits);
+	stats->misses = atomic_load(&pool_stats.misses);
+	stats->failures = atomic_load(&pool_stats.failures);
+}
+
 void msg_get(struct ptp_message *m)
 {
-	m->refcnt++;
+	atomic_fetch_add_explicit(&m->refcnt, 1, memory_order_relaxed);
 }
 
 int msg_post_recv(struct ptp_message *m, int cnt)
@@ -307,6 +648,7 @@ int msg_post_recv(struct ptp_message *m, int cnt)
 		suffix = m->announce.suffix;
 		break;
 	case SIGNALING:
+		port_id_post_recv(&m->signaling.targetPortIdentity);
 		suffix = m->signaling.suffix;
 		break;
 	case MANAGEMENT:
@@ -366,6 +708,7 @@ int msg_pre_send(struct ptp_message *m)
 		suffix = m->announce.suffix;
 		break;
 	case SIGNALING:
+		port_id_pre_send(&m->signaling.targetPortIdentity);
 		suffix = m->signaling.suffix;
 		break;
 	case MANAGEMENT:
@@ -379,6 +722,48 @@ int msg_pre_send(struct ptp_message *m)
 	return 0;
 }
 
+static uint8_t *forward_suffix(struct ptp_message *m, int *pdulen)
+{
+	switch (msg_type(m)) {
+	case FOLLOW_UP:
+		*pdulen = sizeof(struct follow_up_msg);
+		return m->follow_up.suffix;
+	case DELAY_RESP:
+		*pdulen = sizeof(struct delay_resp_msg);
+		return m->delay_resp.suffix;
+	case ANNOUNCE:
+		*pdulen = sizeof(struct announce_msg);
+		return m->announce.suffix;
+	}
+	return NULL;
+}
+
+void msg_pre_forward(struct ptp_message *m)
+{
+	uint8_t *suffix;
+	int pdulen;
+
+	if (msg_type(m) == ANNOUNCE)
+		announce_pre_send(&m->announce);
+	suffix = forward_suffix(m, &pdulen);
+	suffix_pre_send(suffix, m->tlv_count, &m->last_tlv);
+	hdr_pre_send(&m->header);
+}
+
+void msg_post_forward(struct ptp_message *m)
+{
+	uint8_t *suffix;
+	int pdulen;
+
+	hdr_post_recv(&m->header);
+	if (msg_type(m) == ANNOUNCE)
+		announce_post_recv(&m->announce);
+	suffix = forward_suffix(m, &pdulen);
+	if (suffix)
+		suffix_post_recv(suffix, m->header.messageLength - pdulen,
+				 &m->last_tlv);
+}
+
 const char *msg_type_string(int type)
 {
 	switch (type) {
@@ -442,11 +827,26 @@ void msg_print(struct ptp_message *m, FILE *fp)
 
 void msg_put(struct ptp_message *m)
 {
-	m->refcnt--;
-	if (!m->refcnt) {
-		pool_stats.count++;
-		pool_debug("recycle", m);
-		TAILQ_INSERT_HEAD(&msg_pool, m, list);
+	struct msg_cache *c;
+	int class;
+
+	if (atomic_fetch_sub_explicit(&m->refcnt, 1,
+				      memory_order_acq_rel) != 1)
+		return;
+
+	pool_debug("recycle", m);
+	if (m->wire) {
+		msg_put(m->wire);
+		m->wire = NULL;
+	}
+	c = cache_get();
+	class = m->size_class;
+	m->pool.next = c->head[class];
+	c->head[class] = m;
+	c->used--;
+	if (++c->count[class] > MSG_CACHE_MAX) {
+		cache_flush(c, class, MSG_CACHE_BATCH);
+		cache_fold_stats(c);
 	}
 }
 
@@ -20,6 +20,7 @@
 #ifndef HAVE_MSG_H
 #define HAVE_MSG_H
 
+#include <stdatomic.h>
 #include <stdio.h>
 #include <sys/queue.h>
 #include <time.h>
@@ -60,12 +61,20 @@ enum timestamp_type {
 	TS_HARDWARE,
 	TS_LEGACY_HW,
 	TS_ONESTEP,
+	TS_P2P1STEP,
 };
 
 struct hw_timestamp {
 	enum timestamp_type type;
 	struct timespec ts;
 	struct timespec sw;
+	/* Key of a transmitted event message, see SOF_TIMESTAMPING_OPT_ID. */
+	unsigned int id;
+	int id_valid;
+	/* Launch time on CLOCK_TAI in nanoseconds, zero to send at once. */
+	uint64_t txtime;
+	/* Nanoseconds the transmit time stamp took to show up after sending. */
+	int64_t wait;
 };
 
 enum controlField {
@@ -168,25 +177,28 @@ struct message_data {
 	uint8_t buffer[1500];
 } PACKED;
 
+/*
+ * Head room in front of the PDU, which fits a VLAN Ethernet header.
+ */
+#define MSG_HEADROOM 24
+
+/*
+ * The PDU comes last, so that a buffer may end after the largest PDU of
+ * its size class, see msg_allocate_len(). Only the first bytes of the
+ * union may be valid storage.
+ */
 struct ptp_message {
-	union {
-		struct ptp_header          header;
-		struct announce_msg        announce;
-		struct sync_msg            sync;
-		struct delay_req_msg       delay_req;
-		struct follow_up_msg       follow_up;
-		struct delay_resp_msg      delay_resp;
-		struct pdelay_req_msg      pdelay_req;
-		struct pdelay_resp_msg     pdelay_resp;
-		struct pdelay_resp_fup_msg pdelay_resp_fup;
-		struct signaling_msg       signaling;
-		struct management_msg      management;
-		struct message_data        data;
-	} PACKED;
-	/**/
 	int tail_room;
-	int refcnt;
-	TAILQ_ENTRY(ptp_message) list;
+	/* Updated atomically, so that messages may be passed to threads. */
+	atomic_int refcnt;
+	/* Index of the size class of the buffer. */
+	int size_class;
+	/* Links of a free buffer in the message cache, see msg.c. */
+	struct {
+		struct ptp_message *next;
+		struct ptp_message *tail;
+		int count;
+	} pool;
 	struct {
 		/**
 		 * Contains the time stamp from the packet data in a
@@ -229,6 +241,27 @@ struct ptp_message {
 	 * directly from the message's buffer.
 	 */
 	struct tlv_extra last_tlv;
+	/**
+	 * The message as it was received, in network byte order, when
+	 * kept by msg_keep_wire() for forwarding it.
+	 */
+	struct ptp_message *wire;
+	/* The link layer header may be written in front of the PDU. */
+	unsigned char headroom[MSG_HEADROOM] __attribute__((aligned(8)));
+	union {
+		struct ptp_header          header;
+		struct announce_msg        announce;
+		struct sync_msg            sync;
+		struct delay_req_msg       delay_req;
+		struct follow_up_msg       follow_up;
+		struct delay_resp_msg      delay_resp;
+		struct pdelay_req_msg      pdelay_req;
+		struct pdelay_resp_msg     pdelay_resp;
+		struct pdelay_resp_fup_msg pdelay_resp_fup;
+		struct signaling_msg       signaling;
+		struct management_msg      management;
+		struct message_data        data;
+	} PACKED;
 };
 
 /**
@@ -279,17 +312,95 @@ static inline int msg_type(struct ptp_message *m)
  *
  * Messages are reference counted, and newly allocated messages have a
  * reference count of one. Allocated messages are freed using the
- * function @ref msg_put().
+ * function @ref msg_put(). Messages may be allocated, referenced and
+ * freed by any thread, and a message may be freed by another thread
+ * than the one which allocated it.
  *
  * @return Pointer to a message on success, NULL otherwise.
  */
 struct ptp_message *msg_allocate(void);
 
 /**
- * Release all of the memory in the message cache.
+ * Allocate a new message instance from the smallest size class which
+ * holds a message of a given length.
+ *
+ * Otherwise like @ref msg_allocate(). The buffers of the small classes
+ * are meant for event messages and Announce messages, whose length is
+ * known up front, and must not be grown past that length.
+ *
+ * @param len  The length of the message, including its TLVs.
+ * @return     Pointer to a message on success, NULL otherwise.
+ */
+struct ptp_message *msg_allocate_len(int len);
+
+/**
+ * Move a message which was just received into the smallest size class
+ * which holds it.
+ *
+ * The PDU, the time stamp and the address are copied to a new buffer,
+ * and the reference to the old buffer is released. The message is
+ * returned as it is when it is held elsewhere, already in the right
+ * class, or when no buffer is available. Must be called before
+ * msg_post_recv().
+ *
+ * @param m    A message with a reference count of one.
+ * @param cnt  The number of bytes received.
+ * @return     The message to use from now on.
+ */
+struct ptp_message *msg_fit(struct ptp_message *m, int cnt);
+
+/**
+ * Keep a copy of a message which was just received, before it is
+ * converted to the host byte order by msg_post_recv(). The copy is
+ * released together with the message.
+ *
+ * @param m    A message obtained using msg_allocate().
+ * @param cnt  The number of bytes received.
+ * @return     Zero on success, non-zero if the copy could not be made.
+ */
+int msg_keep_wire(struct ptp_message *m, int cnt);
+
+/**
+ * Release all of the memory in the message cache. The other threads
+ * which used messages must have exited.
  */
 void msg_cleanup(void);
 
+/**
+ * Counters describing the message cache.
+ */
+struct msg_pool_stats {
+	int total;      /* buffers in existence */
+	int free;       /* buffers waiting in the cache */
+	int limit;      /* maximum number of buffers, or zero */
+	int high_water; /* most buffers ever in use at once */
+	uint64_t hits;     /* allocations served from the cache */
+	uint64_t misses;   /* allocations served from the heap */
+	uint64_t failures; /* allocations refused */
+};
+
+/**
+ * Fill the message cache ahead of time.
+ *
+ * After this call, @ref msg_allocate() only falls back to the heap once
+ * all of the preallocated buffers are in use, and never allocates more
+ * than 'limit' buffers in total. The preallocated buffers are of the full
+ * size, the limit counts the buffers of all size classes.
+ *
+ * @param size   Number of buffers to preallocate.
+ * @param limit  Maximum number of buffers, or zero for no limit.
+ * @param lock   Pass non-zero to lock the preallocated buffers in memory.
+ * @return       Zero on success, non-zero otherwise.
+ */
+int msg_pool_init(int size, int limit, int lock);
+
+/**
+ * Obtain the counters of the message cache. The counts of the threads
+ * other than the caller may lag by a few dozen buffers.
+ * @param stats  Buffer to hold the counters.
+ */
+void msg_pool_stats(struct msg_pool_stats *stats);
+
 /**
  * Obtain a reference to a message, increasing its reference count by one.
  * @param m A message obtained using @ref msg_allocate().
@@ -311,6 +422,20 @@ int msg_post_recv(struct ptp_message *m, int cnt);
  */
 int msg_pre_send(struct ptp_message *m);
 
+/**
+ * Bring a received message back into network byte order, so that it may
+ * be sent again as is. The time stamps in the PDU are left alone, as
+ * @ref msg_post_recv() never converts them in place.
+ * @param m  A message which has passed through @ref msg_post_recv().
+ */
+void msg_pre_forward(struct ptp_message *m);
+
+/**
+ * Undo @ref msg_pre_forward(), bringing a message back into host byte order.
+ * @param m  A message which has passed through @ref msg_pre_forward().
+ */
+void msg_post_forward(struct ptp_message *m);
+
 /**
  * Print messages for debugging purposes.
  * @param type  Value of the messageType field as returned by @ref msg_type().
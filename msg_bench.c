@@ -0,0 +1,434 @@
+/**
+ * @file msg_bench.c
+ * @brief Microbenchmark of the message and TLV conversion routines.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ds.h"
+#include "msg.h"
+#include "print.h"
+#include "tlv.h"
+#include "version.h"
+
+#define N_ELEMS(a) (sizeof(a) / sizeof((a)[0]))
+#define PATH_TRACE_HOPS 8
+
+/*
+ * The program is linked with the heap functions wrapped, so that the
+ * allocations made by the code under test are counted.
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **ptr, size_t align, size_t size);
+
+static unsigned long allocations;
+
+void *__wrap_malloc(size_t size)
+{
+	allocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	allocations++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocations++;
+	return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void **ptr, size_t align, size_t size)
+{
+	allocations++;
+	return __real_posix_memalign(ptr, align, size);
+}
+
+/* A message as it is built by a port and as it arrives from the network. */
+struct packet {
+	const char *name;
+	uint8_t host[1500];
+	uint8_t wire[1500];
+	int tlv_count;
+	int len;
+};
+
+struct result {
+	double ns;
+	double allocs;
+};
+
+static void header_init(struct ptp_message *m, int type, int len)
+{
+	m->header.tsmt = type;
+	m->header.ver = PTP_VERSION;
+	m->header.messageLength = len;
+	m->header.correction = 0x12345;
+	m->header.sourcePortIdentity.portNumber = 1;
+	m->header.sequenceId = 4321;
+	m->header.logMessageInterval = -3;
+}
+
+static uint8_t *mgt_tlv_append(uint8_t *ptr, int id, int size)
+{
+	struct management_tlv *mgt = (struct management_tlv *) ptr;
+
+	mgt->type = TLV_MANAGEMENT;
+	mgt->length = sizeof(mgt->id) + size;
+	mgt->id = id;
+	memset(mgt->data, 0, size);
+	return ptr + sizeof(*mgt) + size;
+}
+
+/* Builds a message in host byte order and converts it for the wire. */
+static int packet_build(struct packet *pkt, int type)
+{
+	struct follow_up_info_tlv *fui;
+	struct path_trace_tlv *ptt;
+	struct ptp_message *m;
+	uint8_t *ptr;
+	int len;
+
+	m = msg_allocate();
+	if (!m)
+		return -1;
+
+	switch (type) {
+	case SYNC:
+		pkt->name = "sync";
+		len = sizeof(struct sync_msg);
+		break;
+	case FOLLOW_UP:
+		pkt->name = "follow_up_info";
+		m->follow_up.preciseOriginTimestamp.seconds_lsb = 1700000000;
+		m->follow_up.preciseOriginTimestamp.nanoseconds = 123456789;
+		fui = (struct follow_up_info_tlv *) m->follow_up.suffix;
+		fui->type = TLV_ORGANIZATION_EXTENSION;
+		fui->length = sizeof(*fui) - sizeof(struct TLV);
+		memcpy(fui->id, ieee8021_id, sizeof(fui->id));
+		fui->subtype[2] = 1;
+		fui->cumulativeScaledRateOffset = 1000;
+		m->tlv_count = 1;
+		len = sizeof(struct follow_up_msg) + sizeof(*fui);
+		break;
+	case DELAY_RESP:
+		pkt->name = "delay_resp";
+		m->delay_resp.receiveTimestamp.seconds_lsb = 1700000000;
+		m->delay_resp.requestingPortIdentity.portNumber = 2;
+		len = sizeof(struct delay_resp_msg);
+		break;
+	case ANNOUNCE:
+		pkt->name = "announce_path_trace";
+		m->announce.currentUtcOffset = 37;
+		m->announce.grandmasterClockQuality.offsetScaledLogVariance =
+			0x4e5d;
+		m->announce.stepsRemoved = PATH_TRACE_HOPS;
+		ptt = (struct path_trace_tlv *) m->announce.suffix;
+		ptt->type = TLV_PATH_TRACE;
+		ptt->length = PATH_TRACE_HOPS * sizeof(struct ClockIdentity);
+		memset(ptt->cid, 0xab, ptt->length);
+		m->tlv_count = 1;
+		len = sizeof(struct announce_msg) + sizeof(*ptt) + ptt->length;
+		break;
+	case MANAGEMENT:
+		pkt->name = "management_4tlv";
+		m->management.flags = RESPONSE;
+		m->management.targetPortIdentity.portNumber = 0xffff;
+		ptr = m->management.suffix;
+		ptr = mgt_tlv_append(ptr, TLV_DEFAULT_DATA_SET,
+				     sizeof(struct defaultDS));
+		ptr = mgt_tlv_append(ptr, TLV_CURRENT_DATA_SET,
+				     sizeof(struct currentDS));
+		ptr = mgt_tlv_append(ptr, TLV_PARENT_DATA_SET,
+				     sizeof(struct parentDS));
+		ptr = mgt_tlv_append(ptr, TLV_TIME_PROPERTIES_DATA_SET,
+				     sizeof(struct timePropertiesDS));
+		m->tlv_count = 4;
+		len = ptr - (uint8_t *) &m->header;
+		break;
+	default:
+		msg_put(m);
+		return -1;
+	}
+	header_init(m, type, len);
+	memcpy(pkt->host, &m->header, len);
+	pkt->tlv_count = m->tlv_count;
+
+	if (msg_pre_send(m)) {
+		msg_put(m);
+		return -1;
+	}
+	memcpy(pkt->wire, &m->header, len);
+	pkt->len = len;
+	msg_put(m);
+	return 0;
+}
+
+/*
+ * The path of a message through the codec: taken from the cache, filled
+ * from the wire and converted to host order, then built again in host
+ * order and converted for the wire, as when it is answered.
+ */
+static int packet_run(struct packet *pkt)
+{
+	struct ptp_message *m;
+	int err;
+
+	m = msg_allocate();
+	if (!m)
+		return -1;
+	memcpy(&m->header, pkt->wire, pkt->len);
+	m->hwts.ts.tv_sec = 1;
+	err = msg_post_recv(m, pkt->len);
+	if (!err) {
+		memcpy(&m->header, pkt->host, pkt->len);
+		m->tlv_count = pkt->tlv_count;
+		err = msg_pre_send(m);
+	}
+	msg_put(m);
+	return err;
+}
+
+/* Checks that both conversions agree with the message as it was built. */
+static int packet_check(struct packet *pkt)
+{
+	struct ptp_message *m;
+	int err;
+
+	m = msg_allocate();
+	if (!m)
+		return -1;
+	memcpy(&m->header, pkt->wire, pkt->len);
+	m->hwts.ts.tv_sec = 1;
+	err = msg_post_recv(m, pkt->len);
+	if (err) {
+		fprintf(stderr, "%s: msg_post_recv failed: %d\n",
+			pkt->name, err);
+	} else if (m->tlv_count != pkt->tlv_count) {
+		fprintf(stderr, "%s: found %d TLVs instead of %d\n",
+			pkt->name, m->tlv_count, pkt->tlv_count);
+		err = -1;
+	}
+	msg_put(m);
+	return err;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Runs the packets of a mix in turn. The best of the rounds is taken,
+ * as the slower ones only measure the interruptions.
+ */
+static int bench(struct packet **mix, int n_mix, long count, int rounds,
+		 struct result *r)
+{
+	double best = 0.0, ns, t0;
+	unsigned long allocs;
+	long i;
+	int k;
+
+	allocs = allocations;
+	for (k = 0; k < rounds; k++) {
+		t0 = now_ns();
+		for (i = 0; i < count; i++) {
+			if (packet_run(mix[i % n_mix]))
+				return -1;
+		}
+		ns = now_ns() - t0;
+		if (!k || ns < best)
+			best = ns;
+	}
+	r->ns = best / count;
+	r->allocs = (double) (allocations - allocs) / (count * rounds);
+	return 0;
+}
+
+/* Returns the number of regressions against a baseline. */
+static int compare(const char *file, const char *name, struct result *r,
+		   double tolerance)
+{
+	double ns, allocs;
+	char buf[64];
+	FILE *fp;
+	int bad = 0;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		fprintf(stderr, "failed to open %s: %m\n", file);
+		return 1;
+	}
+	while (fscanf(fp, "%63s %lf %lf", buf, &ns, &allocs) == 3) {
+		if (strcmp(buf, name))
+			continue;
+		if (r->ns > ns * (1.0 + tolerance / 100.0)) {
+			printf("  regression: %s %.1f ns/msg, baseline %.1f\n",
+			       name, r->ns, ns);
+			bad++;
+		}
+		if (r->allocs > allocs + 0.001) {
+			printf("  regression: %s %.3f allocs/msg, baseline %.3f\n",
+			       name, r->allocs, allocs);
+			bad++;
+		}
+		break;
+	}
+	fclose(fp);
+	return bad;
+}
+
+static void usage(char *progname)
+{
+	fprintf(stderr,
+		"\n"
+		"usage: %s [options]\n\n"
+		" -n [num]    messages per round (1000000)\n"
+		" -r [num]    number of rounds, the best one counts (5)\n"
+		" -b [file]   compare with the results saved in a file\n"
+		" -t [pct]    tolerated slow down against -b (10)\n"
+		" -w [file]   save the results to a file\n"
+		" -h          prints this message and exits\n"
+		" -v          prints the software version and exits\n"
+		"\n",
+		progname);
+}
+
+int main(int argc, char *argv[])
+{
+	static const int types[] = {
+		SYNC, FOLLOW_UP, DELAY_RESP, ANNOUNCE, MANAGEMENT,
+	};
+	/* What a slave port sees in a second at logSyncInterval -3 */
+	static const int slave_mix[] = {
+		0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1,
+		2, 2, 2, 2, 2, 2, 2, 2, 3, 4,
+	};
+	char *baseline = NULL, *output = NULL, *progname;
+	const char *name;
+	struct packet pkts[N_ELEMS(types)];
+	struct packet *mix[N_ELEMS(slave_mix)], *one;
+	int c, i, rounds = 5, bad = 0;
+	double tolerance = 10.0;
+	long count = 1000000;
+	struct result r;
+	FILE *fp = NULL;
+
+	print_set_progname("msg_bench");
+	print_set_syslog(0);
+	print_set_verbose(1);
+	print_set_level(LOG_ERR);
+
+	/* Process the command line arguments. */
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1 + progname : argv[0];
+	while (EOF != (c = getopt(argc, argv, "n:r:b:t:w:hv"))) {
+		switch (c) {
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'b':
+			baseline = optarg;
+			break;
+		case 't':
+			tolerance = atof(optarg);
+			break;
+		case 'w':
+			output = optarg;
+			break;
+		case 'v':
+			version_show(stdout);
+			return 0;
+		case 'h':
+			usage(progname);
+			return 0;
+		case '?':
+		default:
+			usage(progname);
+			return -1;
+		}
+	}
+	if (count < 1 || rounds < 1) {
+		usage(progname);
+		return -1;
+	}
+
+	/* Keep the buffers of the first rounds in the cache. */
+	if (msg_pool_init(4, 0, 0))
+		return -1;
+
+	for (i = 0; i < N_ELEMS(types); i++) {
+		if (packet_build(&pkts[i], types[i]) || packet_check(&pkts[i]))
+			return -1;
+	}
+	for (i = 0; i < N_ELEMS(slave_mix); i++) {
+		mix[i] = &pkts[slave_mix[i]];
+	}
+
+	if (output) {
+		fp = fopen(output, "w");
+		if (!fp) {
+			fprintf(stderr, "failed to open %s: %m\n", output);
+			return -1;
+		}
+	}
+
+	printf("%-20s %10s %12s\n", "messages", "ns/msg", "allocs/msg");
+	for (i = 0; i <= N_ELEMS(types); i++) {
+		if (i < N_ELEMS(types)) {
+			name = pkts[i].name;
+			one = &pkts[i];
+			if (bench(&one, 1, count, rounds, &r))
+				return -1;
+		} else {
+			name = "slave_mix";
+			if (bench(mix, N_ELEMS(mix), count, rounds, &r))
+				return -1;
+		}
+		printf("%-20s %10.1f %12.3f\n", name, r.ns, r.allocs);
+		if (fp)
+			fprintf(fp, "%s %.1f %.3f\n", name, r.ns, r.allocs);
+		if (baseline)
+			bad += compare(baseline, name, &r, tolerance);
+	}
+	if (fp)
+		fclose(fp);
+	msg_cleanup();
+
+	if (bad) {
+		printf("%d regressions against %s\n", bad, baseline);
+		return 1;
+	}
+	return 0;
+}
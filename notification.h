@@ -22,6 +22,9 @@
 
 enum notification {
 	NOTIFY_PORT_STATE,
+	NOTIFY_TIME_PROPERTIES,
+	NOTIFY_SYNC_SAMPLE,
+	NOTIFY_EVENT_CNT, /* the number of events, keep it last */
 };
 
 #endif
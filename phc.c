@@ -21,11 +21,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <linux/ptp_clock.h>
 
 #include "phc.h"
+#include "print.h"
 
 /*
  * On 32 bit platforms, the PHC driver's maximum adjustment (type
@@ -36,6 +39,8 @@
 #define BITS_PER_LONG	(sizeof(long)*8)
 #define MAX_PPB_32	32767999	/* 2^31 - 1 / 65.536 */
 
+#define NS_PER_SEC	1000000000LL
+
 static int phc_get_caps(clockid_t clkid, struct ptp_clock_caps *caps);
 
 clockid_t phc_open(char *phc)
@@ -99,3 +104,38 @@ int phc_has_pps(clockid_t clkid)
 		return 0;
 	return caps.pps;
 }
+
+int phc_read_offset(clockid_t src, clockid_t dst, int readings,
+		    int64_t good_delay, int64_t *offset, uint64_t *ts,
+		    int64_t *delay)
+{
+	struct timespec tdst1, tdst2, tsrc;
+	int i;
+	int64_t interval, best_interval = INT64_MAX;
+
+	/* Pick the quickest src reading. */
+	for (i = 0; i < readings; i++) {
+		if (clock_gettime(dst, &tdst1) ||
+				clock_gettime(src, &tsrc) ||
+				clock_gettime(dst, &tdst2)) {
+			pr_err("failed to read clock: %m");
+			return 0;
+		}
+
+		interval = (tdst2.tv_sec - tdst1.tv_sec) * NS_PER_SEC +
+			tdst2.tv_nsec - tdst1.tv_nsec;
+
+		if (best_interval > interval) {
+			best_interval = interval;
+			*offset = (tdst1.tv_sec - tsrc.tv_sec) * NS_PER_SEC +
+				tdst1.tv_nsec - tsrc.tv_nsec + interval / 2;
+			*ts = tdst2.tv_sec * NS_PER_SEC + tdst2.tv_nsec;
+		}
+		/* A quick enough reading cannot be improved much. */
+		if (best_interval <= good_delay)
+			break;
+	}
+	*delay = best_interval;
+
+	return 1;
+}
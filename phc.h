@@ -19,6 +19,8 @@
 #ifndef HAVE_PHC_H
 #define HAVE_PHC_H
 
+#include <stdint.h>
+
 #include "missing.h"
 
 /**
@@ -56,4 +58,22 @@ int phc_max_adj(clockid_t clkid);
  */
 int phc_has_pps(clockid_t clkid);
 
+/**
+ * Measure the offset between two clocks by bracketing a reading of the
+ * source clock with two readings of the destination clock.
+ *
+ * @param src        The source clock.
+ * @param dst        The destination clock.
+ * @param readings   The maximum number of readings, the quickest one is used.
+ * @param good_delay Stop at a reading at least this quick, in nanoseconds.
+ * @param offset     The offset of the destination from the source in
+ *                   nanoseconds.
+ * @param ts         The destination time corresponding to the 'offset'.
+ * @param delay      The time between the readings of the destination.
+ * @return           One on success, zero if a clock could not be read.
+ */
+int phc_read_offset(clockid_t src, clockid_t dst, int readings,
+		    int64_t good_delay, int64_t *offset, uint64_t *ts,
+		    int64_t *delay);
+
 #endif
@@ -24,6 +24,8 @@
 #include <limits.h>
 #include <net/if.h>
 #include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -31,6 +33,7 @@
 #include <sys/ioctl.h>
 #include <sys/queue.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -40,7 +43,10 @@
 #include "clockadj.h"
 #include "clockcheck.h"
 #include "ds.h"
+#include "filter.h"
+#include "freqfile.h"
 #include "fsm.h"
+#include "metrics.h"
 #include "missing.h"
 #include "notification.h"
 #include "ntpshm.h"
@@ -50,6 +56,8 @@
 #include "print.h"
 #include "servo.h"
 #include "sk.h"
+#include "servolog.h"
+#include "stateshm.h"
 #include "stats.h"
 #include "sysoff.h"
 #include "tlv.h"
@@ -68,11 +76,55 @@
  * PMC_UPDATE_INTERVAL otherwise subscription will time out before it is
  * renewed.
  */
+/* Delay of a PPS fetch after the expected pulse, and the retry interval */
+#define PPS_FETCH_DELAY (10 * 1000000LL)
+#define PPS_RETRY_INTERVAL (100 * 1000000LL)
+/* A PPS source is not used if it has not produced a pulse for this long */
+#define PPS_SOURCE_TIMEOUT (2500 * 1000000LL)
+/* Number of stable updates after which the update interval is doubled */
+#define STABLE_UPDATES 8
+
+/* Readings whose delay is compared to the percentile of the delays */
+#define DELAY_WINDOW 64
+#define DELAY_MIN_SAMPLES 16
+
+/*
+ * With the adaptive number of readings, the best delay of each update is
+ * compared to a low percentile of the recent delays. A number of updates
+ * within the band around it lowers the number of readings by one, and an
+ * update outside of it doubles the number, up to the kernel limit of the
+ * PTP_SYS_OFFSET ioctl.
+ */
+#define BAND_WINDOW 64
+#define BAND_PERCENTILE 0.1
+#define BAND_MIN_SAMPLES 16
+#define BAND_UPDATES 8
+#define MAX_READINGS 25
+
+/* Enough bins to cover all values counted by the summary statistics */
+#define MAX_HIST_BINS 42
+
+enum phc_method {
+	PHC_METHOD_AUTO,
+	PHC_METHOD_DIRECT,
+	PHC_METHOD_SYSOFF,
+};
+
+/* A sample of a clock going through the phases of its update */
+struct clock_update {
+	int pending;
+	int64_t offset;
+	int64_t delay;
+	uint64_t ts;
+	uint64_t mono_ts;
+	double ppb;
+	enum servo_state state;
+};
 
 struct clock {
 	LIST_ENTRY(clock) list;
 	clockid_t clkid;
-	int sysoff_supported;
+	int sysoff_method;
 	int is_utc;
 	int dest_only;
 	int state;
@@ -87,7 +139,43 @@ struct clock {
 	struct stats *offset_stats;
 	struct stats *freq_stats;
 	struct stats *delay_stats;
+	/* Moving percentile of the reading delays and the current limit */
+	struct filter *delay_filter;
+	int64_t delay_limit;
+	int delay_samples;
+	unsigned int delay_rejected;
+	/* Adaptive number of readings and the band of the lowest delays */
+	int readings;
+	struct filter *band_filter;
+	int64_t band;
+	int band_samples;
+	int band_updates;
 	struct clockcheck *sanity_check;
+	struct freqfile *freqfile;
+	double saved_freq;
+	int saved_freq_valid;
+	/* Current update interval and the time of the next update */
+	double interval;
+	uint64_t next_update;
+	int stable_updates;
+	struct node *node;
+	pthread_t thread;
+	int thread_started;
+	int state_slot;
+	int log_number;
+	struct clock_update upd;
+};
+
+struct pps_source {
+	LIST_ENTRY(pps_source) list;
+	int fd;
+	char *device;
+	unsigned int sequence;
+	/* Monotonic times of the next fetch and of the last new pulse */
+	uint64_t next_fetch;
+	uint64_t last_pulse;
+	int pending;
+	uint64_t pending_ts;
 };
 
 struct port {
@@ -99,10 +187,16 @@ struct port {
 
 struct node {
 	unsigned int stats_max_count;
+	int hist_bins;
+	double delay_percentile;
 	int sanity_freq_limit;
 	enum servo_type servo_type;
 	int phc_readings;
+	int adaptive_readings;
+	enum phc_method phc_method;
 	double phc_interval;
+	double phc_max_interval;
+	int64_t stable_offset;
 	int sync_offset;
 	int forced_sync_offset;
 	int utc_offset_traceable;
@@ -111,17 +205,39 @@ struct node {
 	struct pmc *pmc;
 	int pmc_ds_requested;
 	uint64_t pmc_last_update;
+	/* Non-zero if the time properties are known, and pushed on change */
+	int tds_valid;
+	int port_events;
 	int state_changed;
 	int clock_identity_set;
 	struct ClockIdentity clock_identity;
 	LIST_HEAD(port_head, port) ports;
 	LIST_HEAD(clock_head, clock) clocks;
 	struct clock *master;
+	struct stateshm *stateshm;
+	struct metrics *metrics;
+	struct servolog *servolog;
+	int n_clocks_added;
+	/* The PPS sources and the clock they synchronize */
+	LIST_HEAD(pps_head, pps_source) pps_sources;
+	struct pps_source *pps_selected;
+	struct clock *pps_clock;
+	/*
+	 * With threads, each clock is updated by its own thread holding
+	 * the lock for reading, while the main thread handles the pmc and
+	 * reconfigures the clocks holding it for writing.
+	 */
+	int threads;
+	int threads_stop;
+	int threads_failed;
+	pthread_rwlock_t lock;
+	pthread_mutex_t sleep_lock;
+	pthread_cond_t sleep_cond;
 };
 
 static struct config *phc2sys_config;
 
-static int update_pmc(struct node *node, int subscribe);
+static int update_pmc(struct node *node);
 static int clock_handle_leap(struct node *node, struct clock *clock,
 			     int64_t offset, uint64_t ts);
 static int run_pmc_get_utc_offset(struct node *node, int timeout);
@@ -165,7 +281,8 @@ static struct clock *clock_add(struct node *node, char *device)
 	struct clock *c;
 	clockid_t clkid = CLOCK_INVALID;
 	int max_ppb;
-	double ppb;
+	double ppb, limit;
+	char *freq_file;
 
 	if (device) {
 		clkid = clock_open(device);
@@ -179,8 +296,13 @@ static struct clock *clock_add(struct node *node, char *device)
 		return NULL;
 	}
 	c->clkid = clkid;
+	c->node = node;
 	c->servo_state = SERVO_UNLOCKED;
 	c->device = strdup(device);
+	c->log_number = node->n_clocks_added++;
+	if (node->servolog)
+		pr_info("%s: recorded as clock %d in the servo log",
+			device, c->log_number);
 
 	if (c->clkid == CLOCK_REALTIME) {
 		c->source_label = "sys";
@@ -200,6 +322,24 @@ static struct clock *clock_add(struct node *node, char *device)
 			return NULL;
 		}
 	}
+	c->readings = node->phc_readings;
+	if (node->adaptive_readings) {
+		c->band_filter = filter_create(FILTER_MOVING_QUANTILE,
+					       BAND_WINDOW, BAND_PERCENTILE);
+		if (!c->band_filter) {
+			pr_err("failed to create delay filter");
+			return NULL;
+		}
+	}
+	if (node->delay_percentile > 0.0) {
+		c->delay_filter = filter_create(FILTER_MOVING_QUANTILE,
+						DELAY_WINDOW,
+						node->delay_percentile / 100.0);
+		if (!c->delay_filter) {
+			pr_err("failed to create delay filter");
+			return NULL;
+		}
+	}
 	if (node->sanity_freq_limit) {
 		c->sanity_check = clockcheck_create(node->sanity_freq_limit);
 		if (!c->sanity_check) {
@@ -224,14 +364,33 @@ static struct clock *clock_add(struct node *node, char *device)
 		}
 	}
 
+	freq_file = config_get_string(phc2sys_config, NULL, "freq_file");
+	if (freq_file[0]) {
+		c->freqfile = freqfile_create(freq_file, device);
+		if (!c->freqfile) {
+			pr_err("failed to create frequency file");
+			return NULL;
+		}
+		limit = max_ppb;
+		if (node->sanity_freq_limit && node->sanity_freq_limit < limit)
+			limit = node->sanity_freq_limit;
+		/* Restored when the clock is first updated as a slave. */
+		if (!freqfile_load(c->freqfile, limit, &c->saved_freq))
+			c->saved_freq_valid = 1;
+	}
+
 	c->servo = servo_create(phc2sys_config, node->servo_type,
 				-ppb, max_ppb, 0);
-	servo_sync_interval(c->servo, node->phc_interval);
-
-	if (clkid != CLOCK_REALTIME)
-		c->sysoff_supported = (SYSOFF_SUPPORTED ==
-				       sysoff_probe(CLOCKID_TO_FD(clkid),
-						    node->phc_readings));
+	c->interval = node->phc_interval;
+	servo_sync_interval(c->servo, c->interval);
+
+	c->sysoff_method = SYSOFF_RUN_TIME_MISSING;
+	if (clkid != CLOCK_REALTIME) {
+		c->sysoff_method = sysoff_probe(CLOCKID_TO_FD(clkid),
+						node->phc_readings);
+		pr_info("%s: measuring offset to system clock with %s",
+			device, sysoff_method_name(c->sysoff_method));
+	}
 
 	LIST_INSERT_HEAD(&node->clocks, c, list);
 	return c;
@@ -281,11 +440,17 @@ static struct port *port_add(struct node *node, unsigned int number,
 	return p;
 }
 
-static void clock_reinit(struct clock *clock)
+static void clock_reinit(struct node *node, struct clock *clock)
 {
 	servo_reset(clock->servo);
 	clock->servo_state = SERVO_UNLOCKED;
 
+	if (clock->interval != node->phc_interval) {
+		clock->interval = node->phc_interval;
+		servo_sync_interval(clock->servo, clock->interval);
+	}
+	clock->stable_updates = 0;
+
 	if (clock->offset_stats) {
 		stats_reset(clock->offset_stats);
 		stats_reset(clock->freq_stats);
@@ -293,6 +458,68 @@ static void clock_reinit(struct clock *clock)
 	}
 }
 
+static int open_state_file(struct node *node)
+{
+	char *path = config_get_string(phc2sys_config, NULL, "state_file");
+	char *address = config_get_string(phc2sys_config, NULL,
+					  "metrics_address");
+	struct clock *c;
+	int n = 0;
+
+	if (!path[0] && !address[0])
+		return 0;
+
+	LIST_FOREACH(c, &node->clocks, list)
+		n++;
+	/* The exporter reads the state even without a file. */
+	node->stateshm = stateshm_create(path[0] ? path : NULL, n);
+	if (!node->stateshm) {
+		pr_err("failed to create state file");
+		return -1;
+	}
+	n = 0;
+	LIST_FOREACH(c, &node->clocks, list) {
+		c->state_slot = n++;
+		stateshm_set_clock(node->stateshm, c->state_slot, c->device);
+	}
+	if (address[0]) {
+		node->metrics = metrics_create(address, node->stateshm, 0);
+		if (!node->metrics) {
+			pr_err("failed to start the metrics exporter");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int open_servo_log(struct node *node)
+{
+	char *path = config_get_string(phc2sys_config, NULL, "servo_log_file");
+
+	if (!path[0])
+		return 0;
+	node->servolog = servolog_open(path,
+		config_get_int(phc2sys_config, NULL, "servo_log_size"),
+		config_get_int(phc2sys_config, NULL, "servo_log_files"));
+	if (!node->servolog) {
+		pr_err("failed to create the servo log");
+		return -1;
+	}
+	return 0;
+}
+
+static void close_freqfiles(struct node *node)
+{
+	struct clock *c;
+
+	LIST_FOREACH(c, &node->clocks, list) {
+		if (c->freqfile) {
+			freqfile_destroy(c->freqfile);
+			c->freqfile = NULL;
+		}
+	}
+}
+
 static void reconfigure(struct node *node)
 {
 	struct clock *c, *rt = NULL, *src = NULL, *last = NULL;
@@ -309,7 +536,7 @@ static void reconfigure(struct node *node)
 
 		if (c->new_state) {
 			if (c->new_state == PS_MASTER)
-				clock_reinit(c);
+				clock_reinit(node, c);
 
 			c->state = c->new_state;
 			c->new_state = 0;
@@ -375,7 +602,7 @@ static void reconfigure(struct node *node)
 	} else if (rt) {
 		if (rt->state != PS_MASTER) {
 			rt->state = PS_MASTER;
-			clock_reinit(rt);
+			clock_reinit(node, rt);
 		}
 		pr_info("selecting %s for synchronization", rt->device);
 	}
@@ -383,35 +610,41 @@ static void reconfigure(struct node *node)
 	pr_info("selecting %s as the master clock", src->device);
 }
 
-static int read_phc(clockid_t clkid, clockid_t sysclk, int readings,
-		    int64_t *offset, uint64_t *ts, int64_t *delay)
+/*
+ * Measure the offset between two PHCs by measuring both against the
+ * system clock with the offset ioctls, which bracket the readings of
+ * the PHCs more tightly than clock_gettime() on the destination PHC.
+ */
+static int read_phc_sysoff(struct clock *src, struct clock *dst, int readings,
+			   int64_t *offset, uint64_t *ts, int64_t *delay)
 {
-	struct timespec tdst1, tdst2, tsrc;
-	int i;
-	int64_t interval, best_interval = INT64_MAX;
-
-	/* Pick the quickest clkid reading. */
-	for (i = 0; i < readings; i++) {
-		if (clock_gettime(sysclk, &tdst1) ||
-				clock_gettime(clkid, &tsrc) ||
-				clock_gettime(sysclk, &tdst2)) {
-			pr_err("failed to read clock: %m");
-			return 0;
-		}
+	if (sysoff_measure_pair(CLOCKID_TO_FD(src->clkid), src->sysoff_method,
+				CLOCKID_TO_FD(dst->clkid), dst->sysoff_method,
+				readings, offset, ts, delay) < 0) {
+		pr_err("failed to measure clock offsets");
+		return 0;
+	}
+	return 1;
+}
 
-		interval = (tdst2.tv_sec - tdst1.tv_sec) * NS_PER_SEC +
-			tdst2.tv_nsec - tdst1.tv_nsec;
+static int use_phc_sysoff(struct node *node, struct clock *src,
+			  struct clock *dst)
+{
+	if (src->clkid == CLOCK_REALTIME || dst->clkid == CLOCK_REALTIME ||
+	    src->sysoff_method < 0 || dst->sysoff_method < 0)
+		return 0;
 
-		if (best_interval > interval) {
-			best_interval = interval;
-			*offset = (tdst1.tv_sec - tsrc.tv_sec) * NS_PER_SEC +
-				tdst1.tv_nsec - tsrc.tv_nsec + interval / 2;
-			*ts = tdst2.tv_sec * NS_PER_SEC + tdst2.tv_nsec;
-		}
+	switch (node->phc_method) {
+	case PHC_METHOD_AUTO:
+		/* The basic ioctl is not much better than clock_gettime(). */
+		return src->sysoff_method != SYSOFF_BASIC &&
+			dst->sysoff_method != SYSOFF_BASIC;
+	case PHC_METHOD_DIRECT:
+		return 0;
+	case PHC_METHOD_SYSOFF:
+		return 1;
 	}
-	*delay = best_interval;
-
-	return 1;
+	return 0;
 }
 
 static int64_t get_sync_offset(struct node *node, struct clock *dst)
@@ -423,7 +656,27 @@ static int64_t get_sync_offset(struct node *node, struct clock *dst)
 	return (int64_t)dst->sync_offset * NS_PER_SEC * direction;
 }
 
-static void update_clock_stats(struct clock *clock, unsigned int max_count,
+static void print_histogram(const char *label, struct stats *stats, int n)
+{
+	unsigned int counts[MAX_HIST_BINS];
+	char buf[MAX_HIST_BINS * 32] = "", *p = buf, *end = buf + sizeof(buf);
+	int i;
+
+	stats_get_histogram(stats, counts, n);
+	for (i = 0; i < n; i++) {
+		if (!counts[i])
+			continue;
+		if (i == n - 1 && i)
+			p += snprintf(p, end - p, " >=%llu:%u",
+				      1ULL << (i - 1), counts[i]);
+		else
+			p += snprintf(p, end - p, " <%llu:%u",
+				      1ULL << i, counts[i]);
+	}
+	pr_info("%s histogram%s", label, p == buf ? " empty" : buf);
+}
+
+static void update_clock_stats(struct node *node, struct clock *clock,
 			       int64_t offset, double freq, int64_t delay)
 {
 	struct stats_result offset_stats, freq_stats, delay_stats;
@@ -433,7 +686,7 @@ static void update_clock_stats(struct clock *clock, unsigned int max_count,
 	if (delay >= 0)
 		stats_add_value(clock->delay_stats, delay);
 
-	if (stats_get_num_values(clock->offset_stats) < max_count)
+	if (stats_get_num_values(clock->offset_stats) < node->stats_max_count)
 		return;
 
 	stats_get_result(clock->offset_stats, &offset_stats);
@@ -441,71 +694,182 @@ static void update_clock_stats(struct clock *clock, unsigned int max_count,
 
 	if (!stats_get_result(clock->delay_stats, &delay_stats)) {
 		pr_info("rms %4.0f max %4.0f "
+			"p50 %4.0f p99 %4.0f p99.9 %4.0f "
 			"freq %+6.0f +/- %3.0f "
-			"delay %5.0f +/- %3.0f",
+			"delay %5.0f +/- %3.0f "
+			"p50 %5.0f p99 %5.0f p99.9 %5.0f",
 			offset_stats.rms, offset_stats.max_abs,
+			offset_stats.p50_abs, offset_stats.p99_abs,
+			offset_stats.p999_abs,
 			freq_stats.mean, freq_stats.stddev,
-			delay_stats.mean, delay_stats.stddev);
+			delay_stats.mean, delay_stats.stddev,
+			delay_stats.p50_abs, delay_stats.p99_abs,
+			delay_stats.p999_abs);
 	} else {
 		pr_info("rms %4.0f max %4.0f "
+			"p50 %4.0f p99 %4.0f p99.9 %4.0f "
 			"freq %+6.0f +/- %3.0f",
 			offset_stats.rms, offset_stats.max_abs,
+			offset_stats.p50_abs, offset_stats.p99_abs,
+			offset_stats.p999_abs,
 			freq_stats.mean, freq_stats.stddev);
 	}
 
+	if (node->hist_bins) {
+		print_histogram("offset", clock->offset_stats, node->hist_bins);
+		if (stats_get_num_values(clock->delay_stats))
+			print_histogram("delay", clock->delay_stats,
+					node->hist_bins);
+	}
+	if (clock->delay_filter) {
+		pr_info("rejected %u readings with delay above %" PRId64,
+			clock->delay_rejected, clock->delay_limit);
+		clock->delay_rejected = 0;
+	}
+
 	stats_reset(clock->offset_stats);
 	stats_reset(clock->freq_stats);
 	stats_reset(clock->delay_stats);
 }
 
-static void update_clock(struct node *node, struct clock *clock,
-			 int64_t offset, uint64_t ts, int64_t delay)
+/*
+ * Double the update interval of the clock after a number of updates with
+ * a small offset, up to the maximum interval, and return to the base
+ * interval as soon as the offset grows.
+ */
+static void clock_adapt_interval(struct node *node, struct clock *clock,
+				 int64_t offset, enum servo_state state)
 {
-	enum servo_state state;
-	double ppb;
+	double interval = clock->interval;
 
-	if (clock_handle_leap(node, clock, offset, ts))
+	if (node->phc_max_interval <= node->phc_interval)
 		return;
 
-	offset += get_sync_offset(node, clock);
+	if (state == SERVO_LOCKED && llabs(offset) <= node->stable_offset) {
+		if (++clock->stable_updates < STABLE_UPDATES)
+			return;
+		clock->stable_updates = 0;
+		if (2.0 * interval > node->phc_max_interval)
+			return;
+		interval *= 2.0;
+	} else {
+		clock->stable_updates = 0;
+		if (interval == node->phc_interval)
+			return;
+		interval = node->phc_interval;
+	}
+
+	pr_info("%s: update interval %.3f s", clock->device, interval);
+	clock->interval = interval;
+	servo_sync_interval(clock->servo, interval);
+}
 
-	if (clock->sanity_check && clockcheck_sample(clock->sanity_check, ts))
+/*
+ * An update of a clock is split into phases, so that the updates of the
+ * clocks due at the same time can be done one phase at a time, see
+ * update_clocks().
+ *
+ * The mono_ts field of the update is the CLOCK_MONOTONIC time taken just
+ * before the measurement for the sanity check, or zero to let the check
+ * read it. Returns zero if the sample is not used.
+ */
+static int servo_update(struct node *node, struct clock *clock)
+{
+	struct clock_update *u = &clock->upd;
+
+	if (clock_handle_leap(node, clock, u->offset, u->ts))
+		return 0;
+
+	u->offset += get_sync_offset(node, clock);
+
+	if (clock->sanity_check &&
+	    clockcheck_sample_mono(clock->sanity_check, u->ts, u->mono_ts))
 		servo_reset(clock->servo);
 
-	ppb = servo_sample(clock->servo, offset, ts, 1.0, &state);
-	clock->servo_state = state;
+	if (clock->saved_freq_valid) {
+		clock->saved_freq_valid = 0;
+		pr_info("restoring frequency %+.0f ppb of %s",
+			clock->saved_freq, clock->device);
+		clockadj_set_freq(clock->clkid, clock->saved_freq);
+		servo_warm_start(clock->servo, -clock->saved_freq);
+	}
 
-	switch (state) {
+	u->ppb = servo_sample(clock->servo, u->offset, u->ts, 1.0, &u->state);
+	clock->servo_state = u->state;
+	clock_adapt_interval(node, clock, u->offset, u->state);
+	return 1;
+}
+
+static void adjust_clock(struct clock *clock)
+{
+	struct clock_update *u = &clock->upd;
+
+	switch (u->state) {
 	case SERVO_UNLOCKED:
 		break;
 	case SERVO_JUMP:
-		clockadj_step(clock->clkid, -offset);
+		clockadj_step(clock->clkid, -u->offset);
 		if (clock->sanity_check)
-			clockcheck_step(clock->sanity_check, -offset);
+			clockcheck_step(clock->sanity_check, -u->offset);
 		/* Fall through. */
 	case SERVO_LOCKED:
-		clockadj_set_freq(clock->clkid, -ppb);
+		clockadj_set_freq(clock->clkid, -u->ppb);
 		if (clock->clkid == CLOCK_REALTIME)
 			sysclk_set_sync();
 		if (clock->sanity_check)
-			clockcheck_set_freq(clock->sanity_check, -ppb);
+			clockcheck_set_freq(clock->sanity_check, -u->ppb);
+		if (clock->freqfile)
+			freqfile_sample(clock->freqfile, -u->ppb);
 		break;
 	}
+}
+
+static void report_clock(struct node *node, struct clock *clock)
+{
+	struct clock_update *u = &clock->upd;
+
+	if (node->stateshm) {
+		stateshm_update(node->stateshm, clock->state_slot,
+				node->master->device, u->offset, u->delay,
+				-u->ppb, u->state, u->ts);
+	}
+	if (node->servolog) {
+		servolog_put(node->servolog, clock->log_number, u->ts,
+			     u->offset, u->delay, u->ppb, 1.0, u->state);
+	}
 
 	if (clock->offset_stats) {
-		update_clock_stats(clock, node->stats_max_count, offset, ppb, delay);
+		update_clock_stats(node, clock, u->offset, u->ppb, u->delay);
 	} else {
-		if (delay >= 0) {
+		if (u->delay >= 0) {
 			pr_info("%s offset %9" PRId64 " s%d freq %+7.0f "
 				"delay %6" PRId64,
-				node->master->source_label, offset, state, ppb, delay);
+				node->master->source_label, u->offset, u->state,
+				u->ppb, u->delay);
 		} else {
 			pr_info("%s offset %9" PRId64 " s%d freq %+7.0f",
-				node->master->source_label, offset, state, ppb);
+				node->master->source_label, u->offset, u->state,
+				u->ppb);
 		}
 	}
 }
 
+static void update_clock(struct node *node, struct clock *clock,
+			 int64_t offset, uint64_t ts, int64_t delay,
+			 uint64_t mono_ts)
+{
+	struct clock_update *u = &clock->upd;
+
+	u->offset = offset;
+	u->ts = ts;
+	u->delay = delay;
+	u->mono_ts = mono_ts;
+	if (!servo_update(node, clock))
+		return;
+	adjust_clock(clock);
+	report_clock(node, clock);
+}
+
 static void enable_pps_output(clockid_t src)
 {
 	int enable = 1;
@@ -516,75 +880,178 @@ static void enable_pps_output(clockid_t src)
 		pr_warning("failed to enable PPS output");
 }
 
-static int read_pps(int fd, int64_t *offset, uint64_t *ts)
+/* Returns: 1 if a new pulse was fetched, 0 otherwise */
+static int fetch_pps(struct pps_source *pps, uint64_t *ts)
 {
 	struct pps_fdata pfd;
 
-	pfd.timeout.sec = 10;
-	pfd.timeout.nsec = 0;
+	/* Return the last pulse without waiting for the next one. */
+	memset(&pfd, 0, sizeof(pfd));
 	pfd.timeout.flags = ~PPS_TIME_INVALID;
-	if (ioctl(fd, PPS_FETCH, &pfd)) {
-		pr_err("failed to fetch PPS: %m");
+	if (ioctl(pps->fd, PPS_FETCH, &pfd)) {
+		pr_err("failed to fetch PPS from %s: %m", pps->device);
 		return 0;
 	}
+	if (!pfd.info.assert_sequence ||
+	    pfd.info.assert_sequence == pps->sequence)
+		return 0;
+	pps->sequence = pfd.info.assert_sequence;
 
 	*ts = pfd.info.assert_tu.sec * NS_PER_SEC;
 	*ts += pfd.info.assert_tu.nsec;
-
-	*offset = *ts % NS_PER_SEC;
-	if (*offset > NS_PER_SEC / 2)
-		*offset -= NS_PER_SEC;
-
 	return 1;
 }
 
-static int do_pps_loop(struct node *node, struct clock *clock, int fd)
+static void pps_update(struct node *node, uint64_t pps_ts)
 {
-	int64_t pps_offset, phc_offset, phc_delay;
-	uint64_t pps_ts, phc_ts;
+	int64_t pps_offset, phc_offset, phc_delay, rem;
+	struct clock *clock = node->pps_clock;
 	clockid_t src = node->master->clkid;
+	uint64_t phc_ts;
+
+	pps_offset = pps_ts % NS_PER_SEC;
+	if (pps_offset > NS_PER_SEC / 2)
+		pps_offset -= NS_PER_SEC;
+
+	/* If a PHC is available, use it to get the whole number
+	   of seconds in the offset and PPS for the rest. */
+	if (src != CLOCK_INVALID) {
+		if (!phc_read_offset(src, clock->clkid, node->phc_readings, 0,
+			      &phc_offset, &phc_ts, &phc_delay))
+			return;
+
+		/* Convert the time stamp of the pulse to the PHC time. */
+		phc_ts = pps_ts - phc_offset;
+
+		/* Check if it is close to the start of the second. */
+		rem = phc_ts % NS_PER_SEC;
+		if (rem > NS_PER_SEC / 2)
+			rem -= NS_PER_SEC;
+		if (llabs(rem) > PHC_PPS_OFFSET_LIMIT) {
+			pr_warning("PPS is not in sync with PHC"
+				   " (%+.9f)", rem / 1e9);
+			return;
+		}
+
+		pps_offset = pps_ts - (phc_ts - rem);
+	}
 
+	update_clock(node, clock, pps_offset, pps_ts, -1, 0);
+}
+
+/*
+ * Fetch the pulses of the PPS sources which are due. The clock is
+ * updated from the first source in the order of the command line
+ * which produced a pulse recently, the others are only kept track of
+ * to fail over to them.
+ */
+static void pps_poll(struct node *node, uint64_t now)
+{
+	struct pps_source *pps, *best = NULL;
+	struct timespec tp;
+	uint64_t pps_ts;
+	int64_t age;
+
+	LIST_FOREACH(pps, &node->pps_sources, list) {
+		if (pps->next_fetch > now)
+			continue;
+		pps->next_fetch = now + PPS_RETRY_INTERVAL;
+		if (!fetch_pps(pps, &pps_ts) ||
+		    clock_gettime(CLOCK_REALTIME, &tp))
+			continue;
+
+		/* Ignore a pulse older than a second, e.g. on start. */
+		age = tp.tv_sec * NS_PER_SEC + tp.tv_nsec - pps_ts;
+		if (age < 0 || age >= NS_PER_SEC)
+			continue;
+		pps->last_pulse = now;
+		pps->pending = 1;
+		pps->pending_ts = pps_ts;
+
+		/* Fetch again shortly after the next pulse is expected. */
+		pps->next_fetch = now + NS_PER_SEC - age + PPS_FETCH_DELAY;
+	}
+
+	LIST_FOREACH(pps, &node->pps_sources, list) {
+		if (pps->last_pulse &&
+		    now - pps->last_pulse < PPS_SOURCE_TIMEOUT) {
+			best = pps;
+			break;
+		}
+	}
+	if (best != node->pps_selected) {
+		if (best)
+			pr_notice("selecting PPS source %s", best->device);
+		else
+			pr_warning("no PPS source available");
+		node->pps_selected = best;
+	}
+
+	LIST_FOREACH(pps, &node->pps_sources, list) {
+		if (!pps->pending)
+			continue;
+		pps->pending = 0;
+		if (pps == best)
+			pps_update(node, pps->pending_ts);
+	}
+}
+
+static void init_pps(struct node *node, struct clock *clock)
+{
+	node->pps_clock = clock;
 	node->master->source_label = "pps";
+	servo_sync_interval(clock->servo, 1.0);
+	/* The update interval is given by the PPS signal. */
+	node->phc_max_interval = 0.0;
 
-	if (src == CLOCK_INVALID) {
+	if (node->master->clkid == CLOCK_INVALID) {
 		/* The sync offset can't be applied with PPS alone. */
 		node->sync_offset = 0;
 	} else {
 		enable_pps_output(node->master->clkid);
 	}
+}
 
-	while (is_running()) {
-		if (!read_pps(fd, &pps_offset, &pps_ts)) {
-			continue;
-		}
-
-		/* If a PHC is available, use it to get the whole number
-		   of seconds in the offset and PPS for the rest. */
-		if (src != CLOCK_INVALID) {
-			if (!read_phc(src, clock->clkid, node->phc_readings,
-				      &phc_offset, &phc_ts, &phc_delay))
-				return -1;
+static int pps_add(struct node *node, const char *device)
+{
+	struct pps_source *pps, *last;
 
-			/* Convert the time stamp to the PHC time. */
-			phc_ts -= phc_offset;
+	pps = calloc(1, sizeof(*pps));
+	if (!pps) {
+		pr_err("failed to allocate memory for a PPS source");
+		return -1;
+	}
+	pps->fd = open(device, O_RDONLY);
+	if (pps->fd < 0) {
+		fprintf(stderr, "cannot open '%s': %m\n", device);
+		free(pps);
+		return -1;
+	}
+	pps->device = strdup(device);
 
-			/* Check if it is close to the start of the second. */
-			if (phc_ts % NS_PER_SEC > PHC_PPS_OFFSET_LIMIT) {
-				pr_warning("PPS is not in sync with PHC"
-					   " (0.%09lld)", phc_ts % NS_PER_SEC);
-				continue;
-			}
+	/* Keep the order of the command line, which is the priority. */
+	if (LIST_EMPTY(&node->pps_sources)) {
+		LIST_INSERT_HEAD(&node->pps_sources, pps, list);
+		return 0;
+	}
+	LIST_FOREACH(last, &node->pps_sources, list) {
+		if (!LIST_NEXT(last, list))
+			break;
+	}
+	LIST_INSERT_AFTER(last, pps, list);
+	return 0;
+}
 
-			phc_ts = phc_ts / NS_PER_SEC * NS_PER_SEC;
-			pps_offset = pps_ts - phc_ts;
-		}
+static void pps_close(struct node *node)
+{
+	struct pps_source *pps;
 
-		if (update_pmc(node, 0) < 0)
-			continue;
-		update_clock(node, clock, pps_offset, pps_ts, -1);
+	while ((pps = LIST_FIRST(&node->pps_sources))) {
+		LIST_REMOVE(pps, list);
+		close(pps->fd);
+		free(pps->device);
+		free(pps);
 	}
-	close(fd);
-	return 0;
 }
 
 static int update_needed(struct clock *c)
@@ -604,60 +1071,437 @@ static int update_needed(struct clock *c)
 	return 0;
 }
 
-static int do_loop(struct node *node, int subscriptions)
+static int get_monotonic_time(uint64_t *ts)
+{
+	struct timespec tp;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &tp)) {
+		pr_err("failed to read clock: %m");
+		return -1;
+	}
+	*ts = tp.tv_sec * NS_PER_SEC + tp.tv_nsec;
+	return 0;
+}
+
+static int pmc_update_due(struct node *node, uint64_t ts)
+{
+	return !(ts > node->pmc_last_update &&
+		 ts - node->pmc_last_update < PMC_UPDATE_INTERVAL);
+}
+
+/* Returns the earliest time at which a clock or the pmc needs an update. */
+static uint64_t next_update(struct node *node, uint64_t now)
 {
-	struct timespec interval;
+	struct pps_source *pps;
+	uint64_t next, pmc_next;
 	struct clock *clock;
+
+	/* Wake up at least once per base interval. */
+	next = now + node->phc_interval * NS_PER_SEC;
+
+	if (node->pps_clock) {
+		LIST_FOREACH(pps, &node->pps_sources, list) {
+			if (pps->next_fetch < next)
+				next = pps->next_fetch;
+		}
+	} else if (node->master && !node->threads) {
+		LIST_FOREACH(clock, &node->clocks, list) {
+			if (update_needed(clock) && clock->next_update < next)
+				next = clock->next_update;
+		}
+	}
+	if (node->pmc) {
+		pmc_next = node->pmc_last_update + PMC_UPDATE_INTERVAL;
+		if (pmc_next > now && pmc_next < next)
+			next = pmc_next;
+	}
+
+	return next < now ? now : next;
+}
+
+static void schedule_update(struct clock *clock, uint64_t now)
+{
+	clock->next_update += clock->interval * NS_PER_SEC;
+	/* Don't try to catch up with the missed updates. */
+	if (clock->next_update <= now)
+		clock->next_update = now + clock->interval * NS_PER_SEC;
+}
+
+/* Handles the management messages which arrived between the updates. */
+static void recv_pmc(struct node *node)
+{
 	uint64_t ts;
+
+	if (get_monotonic_time(&ts))
+		return;
+
+	if (pmc_update_due(node, ts)) {
+		/* Take the response to the request sent by update_pmc(),
+		   without sending another one. */
+		node->pmc_ds_requested = 1;
+		if (run_pmc_get_utc_offset(node, 0) > 0)
+			node->pmc_last_update = ts;
+	} else {
+		run_pmc_events(node);
+	}
+}
+
+/* Returns: 0 to skip the clock updates, 1 otherwise */
+static int handle_pmc(struct node *node, int subscriptions,
+		      int readable, int expired)
+{
+	if (readable)
+		recv_pmc(node);
+
+	if (expired && update_pmc(node) < 0)
+		return 0;
+
+	if (subscriptions && node->state_changed) {
+		/* The changes of the offset are pushed before the port
+		 * state changes, get it only if it is still unknown. */
+		if (!node->tds_valid &&
+		    run_pmc_get_utc_offset(node, 1000) <= 0) {
+			pr_err("failed to get UTC offset");
+			return 0;
+		}
+		reconfigure(node);
+	}
+	return 1;
+}
+
+/* Returns the upper limit of the band of the lowest delays, or zero. */
+static int64_t band_limit(struct clock *clock)
+{
+	if (!clock->band_filter || clock->band_samples < BAND_MIN_SAMPLES)
+		return 0;
+	return clock->band + clock->band / 4;
+}
+
+/*
+ * Take fewer readings while the best one consistently falls in the band
+ * of the lowest delays, and more as soon as it does not.
+ */
+static void adapt_readings(struct clock *clock, int64_t delay)
+{
+	int readings = clock->readings;
+
+	if (delay < 0)
+		return;
+
+	if (clock->band_samples < BAND_MIN_SAMPLES) {
+		clock->band_samples++;
+	} else if (delay <= band_limit(clock)) {
+		if (++clock->band_updates >= BAND_UPDATES && readings > 1) {
+			clock->band_updates = 0;
+			readings--;
+		}
+	} else {
+		clock->band_updates = 0;
+		readings *= 2;
+		if (readings > MAX_READINGS)
+			readings = MAX_READINGS;
+	}
+	clock->band = tmv_to_nanoseconds(
+		filter_sample(clock->band_filter, nanoseconds_to_tmv(delay)));
+
+	if (readings != clock->readings) {
+		pr_debug("%s: %d readings per update, delay band %" PRId64,
+			 clock->device, readings, clock->band);
+		clock->readings = readings;
+	}
+}
+
+/*
+ * Reject the readings which took longer than the percentile of the
+ * recent delays, as they are the most likely to be disturbed by an
+ * interrupt or a preemption between the readings of the two clocks.
+ */
+static int delay_rejected(struct clock *clock, int64_t delay)
+{
+	int reject;
+
+	if (delay < 0)
+		return 0;
+
+	reject = clock->delay_samples >= DELAY_MIN_SAMPLES &&
+		 delay > clock->delay_limit;
+	if (reject) {
+		clock->delay_rejected++;
+		pr_debug("%s: rejected reading with delay %" PRId64,
+			 clock->device, delay);
+	} else {
+		clock->delay_samples++;
+	}
+	clock->delay_limit = tmv_to_nanoseconds(
+		filter_sample(clock->delay_filter, nanoseconds_to_tmv(delay)));
+	return reject;
+}
+
+/* Returns 1 if a sample was taken, 0 if not, or -1 on error. */
+static int measure_clock(struct node *node, struct clock *clock,
+			 int64_t *offset, uint64_t *ts, int64_t *delay)
+{
+	if (clock->clkid == CLOCK_REALTIME &&
+	    node->master->sysoff_method >= 0) {
+		/* use sysoff */
+		if (sysoff_measure(CLOCKID_TO_FD(node->master->clkid),
+				   node->master->sysoff_method,
+				   clock->readings,
+				   offset, ts, delay) < 0)
+			return -1;
+	} else if (use_phc_sysoff(node, node->master, clock)) {
+		/* use sysoff on both clocks */
+		if (!read_phc_sysoff(node->master, clock, clock->readings,
+				     offset, ts, delay))
+			return 0;
+	} else {
+		/* use phc */
+		if (!phc_read_offset(node->master->clkid, clock->clkid,
+			      clock->readings, band_limit(clock),
+			      offset, ts, delay))
+			return 0;
+	}
+	if (clock->band_filter)
+		adapt_readings(clock, *delay);
+	if (clock->delay_filter && delay_rejected(clock, *delay))
+		return 0;
+	return 1;
+}
+
+/* Returns: -1 in case of a fatal error, 0 otherwise */
+static int measure_and_update(struct node *node, struct clock *clock,
+			      uint64_t now)
+{
 	int64_t offset, delay;
+	uint64_t ts;
+	int r;
 
-	interval.tv_sec = node->phc_interval;
-	interval.tv_nsec = (node->phc_interval - interval.tv_sec) * 1e9;
+	r = measure_clock(node, clock, &offset, &ts, &delay);
+	if (r <= 0)
+		return r;
+	update_clock(node, clock, offset, ts, delay, now);
+	return 0;
+}
 
-	while (is_running()) {
-		clock_nanosleep(CLOCK_MONOTONIC, 0, &interval, NULL);
-		if (update_pmc(node, subscriptions) < 0)
+/*
+ * Update all clocks which are due, one phase at a time. The offsets are
+ * measured back to back, so that they refer to nearly the same time,
+ * and the adjustments are issued back to back after all servos ran, so
+ * that the clocks are skewed as little as possible. The logging is left
+ * for the end.
+ */
+static int update_clocks(struct node *node, uint64_t now)
+{
+	struct clock *clock;
+	struct clock_update *u;
+	int r;
+
+	LIST_FOREACH(clock, &node->clocks, list) {
+		u = &clock->upd;
+		u->pending = 0;
+		if (!update_needed(clock) || clock->next_update > now)
 			continue;
+		schedule_update(clock, now);
+		r = measure_clock(node, clock, &u->offset, &u->ts, &u->delay);
+		if (r < 0)
+			return -1;
+		u->mono_ts = now;
+		u->pending = r;
+	}
+	LIST_FOREACH(clock, &node->clocks, list) {
+		if (clock->upd.pending)
+			clock->upd.pending = servo_update(node, clock);
+	}
+	LIST_FOREACH(clock, &node->clocks, list) {
+		if (clock->upd.pending)
+			adjust_clock(clock);
+	}
+	LIST_FOREACH(clock, &node->clocks, list) {
+		if (clock->upd.pending)
+			report_clock(node, clock);
+	}
+	return 0;
+}
 
-		if (subscriptions) {
-			run_pmc_events(node);
-			if (node->state_changed) {
-				/* force getting offset, as it may have
-				 * changed after the port state change */
-				if (run_pmc_get_utc_offset(node, 1000) <= 0) {
-					pr_err("failed to get UTC offset");
-					continue;
-				}
-				reconfigure(node);
-			}
-		}
-		if (!node->master)
+static void *clock_thread(void *arg)
+{
+	struct clock *clock = arg;
+	struct node *node = clock->node;
+	struct timespec deadline;
+	uint64_t now;
+	int err = 0;
+
+	pthread_mutex_lock(&node->sleep_lock);
+	while (!node->threads_stop && !err) {
+		deadline.tv_sec = clock->next_update / NS_PER_SEC;
+		deadline.tv_nsec = clock->next_update % NS_PER_SEC;
+		if (pthread_cond_timedwait(&node->sleep_cond, &node->sleep_lock,
+					   &deadline) != ETIMEDOUT)
 			continue;
+		pthread_mutex_unlock(&node->sleep_lock);
+
+		pthread_rwlock_rdlock(&node->lock);
+		err = get_monotonic_time(&now);
+		if (!err && clock->next_update <= now) {
+			schedule_update(clock, now);
+			if (node->master && update_needed(clock))
+				err = measure_and_update(node, clock, now);
+		}
+		pthread_rwlock_unlock(&node->lock);
 
-		LIST_FOREACH(clock, &node->clocks, list) {
-			if (!update_needed(clock))
-				continue;
+		pthread_mutex_lock(&node->sleep_lock);
+	}
+	if (err)
+		node->threads_failed = 1;
+	pthread_mutex_unlock(&node->sleep_lock);
+	return NULL;
+}
 
-			if (clock->clkid == CLOCK_REALTIME &&
-			    node->master->sysoff_supported) {
-				/* use sysoff */
-				if (sysoff_measure(CLOCKID_TO_FD(node->master->clkid),
-						   node->phc_readings,
-						   &offset, &ts, &delay))
-					return -1;
-			} else {
-				/* use phc */
-				if (!read_phc(node->master->clkid, clock->clkid,
-					      node->phc_readings,
-					      &offset, &ts, &delay))
-					continue;
-			}
-			update_clock(node, clock, offset, ts, delay);
+static void stop_threads(struct node *node)
+{
+	struct clock *clock;
+
+	pthread_mutex_lock(&node->sleep_lock);
+	node->threads_stop = 1;
+	pthread_cond_broadcast(&node->sleep_cond);
+	pthread_mutex_unlock(&node->sleep_lock);
+
+	LIST_FOREACH(clock, &node->clocks, list) {
+		if (clock->thread_started) {
+			pthread_join(clock->thread, NULL);
+			clock->thread_started = 0;
+		}
+	}
+}
+
+static int init_locks(struct node *node)
+{
+	pthread_condattr_t attr;
+
+	if (pthread_condattr_init(&attr) ||
+	    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) ||
+	    pthread_cond_init(&node->sleep_cond, &attr) ||
+	    pthread_mutex_init(&node->sleep_lock, NULL) ||
+	    pthread_rwlock_init(&node->lock, NULL)) {
+		pr_err("failed to initialize locks");
+		return -1;
+	}
+	pthread_condattr_destroy(&attr);
+	return 0;
+}
+
+static int start_threads(struct node *node)
+{
+	struct clock *clock;
+	sigset_t mask, old;
+	int err = 0;
+
+	/* Leave the termination signals to the main thread. */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &old);
+
+	LIST_FOREACH(clock, &node->clocks, list) {
+		err = pthread_create(&clock->thread, NULL, clock_thread, clock);
+		if (err) {
+			pr_err("failed to create clock thread: %s",
+			       strerror(err));
+			break;
 		}
+		clock->thread_started = 1;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err) {
+		stop_threads(node);
+		return -1;
 	}
 	return 0;
 }
 
+static int do_loop(struct node *node, int subscriptions)
+{
+	struct itimerspec timer;
+	struct pollfd pollfd[2];
+	uint64_t expirations, next, now;
+	int cnt, nfd, r = -1, tfd, update;
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (tfd < 0) {
+		pr_err("failed to create timer: %m");
+		return -1;
+	}
+	memset(&timer, 0, sizeof(timer));
+
+	if (node->threads && !node->pps_clock && start_threads(node)) {
+		close(tfd);
+		return -1;
+	}
+
+	while (is_running()) {
+		if (node->threads_failed)
+			goto out;
+		if (get_monotonic_time(&now))
+			goto out;
+		next = next_update(node, now);
+		timer.it_value.tv_sec = next / NS_PER_SEC;
+		timer.it_value.tv_nsec = next % NS_PER_SEC;
+		if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &timer, NULL)) {
+			pr_err("failed to set timer: %m");
+			goto out;
+		}
+
+		pollfd[0].fd = tfd;
+		pollfd[0].events = POLLIN;
+		nfd = 1;
+		if (node->pmc) {
+			pollfd[1].fd = pmc_get_transport_fd(node->pmc);
+			pollfd[1].events = POLLIN|POLLPRI;
+			nfd = 2;
+		}
+
+		cnt = poll(pollfd, nfd, -1);
+		if (cnt < 0) {
+			if (errno == EINTR)
+				continue;
+			pr_err("poll failed: %m");
+			goto out;
+		}
+
+		if (pollfd[0].revents & POLLIN &&
+		    read(tfd, &expirations, sizeof(expirations)) < 0) {
+			pr_err("failed to read timer: %m");
+			goto out;
+		}
+
+		pthread_rwlock_wrlock(&node->lock);
+		update = handle_pmc(node, subscriptions,
+				 nfd > 1 && pollfd[1].revents & (POLLIN|POLLPRI),
+				 pollfd[0].revents & POLLIN);
+		pthread_rwlock_unlock(&node->lock);
+
+		if (!update || node->threads || !node->master ||
+		    !(pollfd[0].revents & POLLIN))
+			continue;
+
+		if (get_monotonic_time(&now))
+			goto out;
+
+		if (node->pps_clock) {
+			pps_poll(node, now);
+			continue;
+		}
+
+		if (update_clocks(node, now))
+			goto out;
+	}
+	r = 0;
+out:
+	stop_threads(node);
+	close(tfd);
+	return r;
+}
+
 static int check_clock_identity(struct node *node, struct ptp_message *msg)
 {
 	if (!node->clock_identity_set)
@@ -733,6 +1577,28 @@ static int clock_compute_state(struct node *node, struct clock *clock)
 	return state;
 }
 
+static void update_time_properties(struct node *node,
+				   struct timePropertiesDS *tds)
+{
+	if (tds->flags & PTP_TIMESCALE) {
+		node->sync_offset = tds->currentUtcOffset;
+		if (tds->flags & LEAP_61)
+			node->leap = 1;
+		else if (tds->flags & LEAP_59)
+			node->leap = -1;
+		else
+			node->leap = 0;
+		node->utc_offset_traceable = tds->flags & UTC_OFF_VALID &&
+					     tds->flags & TIME_TRACEABLE;
+	} else {
+		node->sync_offset = 0;
+		node->leap = 0;
+		node->utc_offset_traceable = 0;
+	}
+	/* Later changes are pushed to the subscription. */
+	node->tds_valid = 1;
+}
+
 static int recv_subscribed(struct node *node, struct ptp_message *msg,
 			   int excluded)
 {
@@ -766,6 +1632,9 @@ static int recv_subscribed(struct node *node, struct ptp_message *msg,
 			}
 		}
 		return 1;
+	case TLV_TIME_PROPERTIES_DATA_SET:
+		update_time_properties(node, get_mgt_data(msg));
+		return 1;
 	}
 	return 0;
 }
@@ -776,7 +1645,9 @@ static void send_subscription(struct node *node)
 
 	memset(&sen, 0, sizeof(sen));
 	sen.duration = PMC_SUBSCRIBE_DURATION;
-	sen.bitmask[0] = 1 << NOTIFY_PORT_STATE;
+	sen.bitmask[0] = 1 << NOTIFY_TIME_PROPERTIES;
+	if (node->port_events)
+		sen.bitmask[0] |= 1 << NOTIFY_PORT_STATE;
 	pmc_send_set_action(node->pmc, TLV_SUBSCRIBE_EVENTS_NP, &sen, sizeof(sen));
 }
 
@@ -899,28 +1770,12 @@ static int run_pmc_get_utc_offset(struct node *node, int timeout)
 {
 	struct ptp_message *msg;
 	int res;
-	struct timePropertiesDS *tds;
 
 	res = run_pmc(node, timeout, TLV_TIME_PROPERTIES_DATA_SET, &msg);
 	if (res <= 0)
 		return res;
 
-	tds = (struct timePropertiesDS *)get_mgt_data(msg);
-	if (tds->flags & PTP_TIMESCALE) {
-		node->sync_offset = tds->currentUtcOffset;
-		if (tds->flags & LEAP_61)
-			node->leap = 1;
-		else if (tds->flags & LEAP_59)
-			node->leap = -1;
-		else
-			node->leap = 0;
-		node->utc_offset_traceable = tds->flags & UTC_OFF_VALID &&
-					     tds->flags & TIME_TRACEABLE;
-	} else {
-		node->sync_offset = 0;
-		node->leap = 0;
-		node->utc_offset_traceable = 0;
-	}
+	update_time_properties(node, get_mgt_data(msg));
 	msg_put(msg);
 	return 1;
 }
@@ -1046,6 +1901,7 @@ static int auto_init_ports(struct node *node, int add_rt)
 		return -1;
 	}
 
+	node->port_events = 1;
 	res = run_pmc_subscribe(node, 1000);
 	if (res <= 0) {
 		pr_err("failed to subscribe");
@@ -1098,23 +1954,18 @@ static int auto_init_ports(struct node *node, int add_rt)
 }
 
 /* Returns: -1 in case of error, 0 otherwise */
-static int update_pmc(struct node *node, int subscribe)
+static int update_pmc(struct node *node)
 {
-	struct timespec tp;
 	uint64_t ts;
 
-	if (clock_gettime(CLOCK_MONOTONIC, &tp)) {
-		pr_err("failed to read clock: %m");
+	if (get_monotonic_time(&ts))
 		return -1;
-	}
-	ts = tp.tv_sec * NS_PER_SEC + tp.tv_nsec;
 
-	if (node->pmc &&
-	    !(ts > node->pmc_last_update &&
-	      ts - node->pmc_last_update < PMC_UPDATE_INTERVAL)) {
-		if (subscribe)
-			run_pmc_subscribe(node, 0);
-		if (run_pmc_get_utc_offset(node, 0) > 0)
+	if (node->pmc && pmc_update_due(node, ts)) {
+		/* Renew the subscription. The time properties are pushed
+		   to it, so they are requested only until they are known. */
+		run_pmc_subscribe(node, 0);
+		if (node->tds_valid || run_pmc_get_utc_offset(node, 0) > 0)
 			node->pmc_last_update = ts;
 	}
 
@@ -1195,20 +2046,34 @@ static void usage(char *progname)
 		" -O [offset]    slave-master time offset (0)\n"
 		" -w             wait for ptp4l\n"
 		" common options:\n"
-		" -E [pi|linreg] clock servo (pi)\n"
+		" -E [pi|linreg|kalman|auto] clock servo (pi)\n"
+		" -e [auto|direct|sysoff] PHC to PHC measurement (auto)\n"
 		" -P [kp]        proportional constant (0.7)\n"
 		" -I [ki]        integration constant (0.3)\n"
 		" -S [step]      step threshold (disabled)\n"
 		" -F [step]      step threshold only on start (0.00002)\n"
 		" -R [rate]      slave clock update rate in HZ (1.0)\n"
-		" -N [num]       number of master clock readings per update (5)\n"
+		" -U [interval]  maximum slave clock update interval (disabled)\n"
+		" -T [offset]    offset limit for longer update intervals (100)\n"
+		" -N [num|auto]  number of master clock readings per update (5)\n"
 		" -L [limit]     sanity frequency limit in ppb (200000000)\n"
+		" -A [ppb]       minimum change of frequency adjustments (0.0)\n"
 		" -M [num]       NTP SHM segment number (0)\n"
+		" -C [path]      chronyd SOCK refclock socket\n"
+		"                (/var/run/chrony.ptp.sock)\n"
 		" -u [num]       number of clock updates in summary stats (0)\n"
+		" -H [num]       number of bins in summary histograms (0)\n"
+		" -D [pct]       reject readings with delay above percentile (off)\n"
 		" -n [num]       domain number (0)\n"
 		" -x             apply leap seconds by servo instead of kernel\n"
+		" -j             update each slave clock in its own thread\n"
 		" -z [path]      server address for UDS (/var/run/ptp4l)\n"
+		" -k [file]      save and restore the clock frequencies in file\n"
+		" -p [file]      publish the clock states in shared memory file\n"
+		" -g [file]      record the servo samples in binary file\n"
+		" -X [address]   serve OpenMetrics on UNIX socket or [host:]port\n"
 		" -l [num]       set the logging level to 'num' (6)\n"
+		" -Q [num]       queue up to 'num' messages for a logging thread (0)\n"
 		" -m             print messages to stdout\n"
 		" -q             do not print messages to the syslog\n"
 		" -v             prints the software version and exits\n"
@@ -1224,20 +2089,25 @@ int main(int argc, char *argv[])
 	struct clock *src, *dst;
 	struct config *cfg;
 	int autocfg = 0, rt = 0;
-	int c, domain_number = 0, pps_fd = -1;
+	int c, domain_number = 0;
 	int r = -1, wait_sync = 0;
 	int print_level = LOG_INFO, use_syslog = 1, verbose = 0;
-	int ntpshm_segment;
+	int logging_queue = 0;
+	int ntpshm_segment, stable_offset;
 	double phc_rate, tmp;
+	unsigned long adj_issued, adj_avoided;
 	struct node node = {
 		.sanity_freq_limit = 200000000,
 		.servo_type = CLOCK_SERVO_PI,
 		.phc_readings = 5,
 		.phc_interval = 1.0,
+		.stable_offset = 100,
 		.kernel_leap = 1,
 	};
 
 	handle_term_signals();
+	if (init_locks(&node))
+		return -1;
 
 	cfg = phc2sys_config = config_create();
 	if (!cfg) {
@@ -1251,7 +2121,7 @@ int main(int argc, char *argv[])
 	progname = strrchr(argv[0], '/');
 	progname = progname ? 1+progname : argv[0];
 	while (EOF != (c = getopt(argc, argv,
-				  "arc:d:s:E:P:I:S:F:R:N:O:L:M:i:u:wn:xz:l:mqvh"))) {
+				  "arc:d:s:A:D:E:e:P:I:S:F:R:U:T:N:O:L:M:C:i:u:H:wn:xjz:k:p:g:X:l:Q:mqvh"))) {
 		switch (c) {
 		case 'a':
 			autocfg = 1;
@@ -1263,12 +2133,8 @@ int main(int argc, char *argv[])
 			dst_name = strdup(optarg);
 			break;
 		case 'd':
-			pps_fd = open(optarg, O_RDONLY);
-			if (pps_fd < 0) {
-				fprintf(stderr,
-					"cannot open '%s': %m\n", optarg);
+			if (pps_add(&node, optarg))
 				goto end;
-			}
 			break;
 		case 'i':
 			fprintf(stderr,
@@ -1281,14 +2147,33 @@ int main(int argc, char *argv[])
 				node.servo_type = CLOCK_SERVO_PI;
 			} else if (!strcasecmp(optarg, "linreg")) {
 				node.servo_type = CLOCK_SERVO_LINREG;
+			} else if (!strcasecmp(optarg, "kalman")) {
+				node.servo_type = CLOCK_SERVO_KALMAN;
 			} else if (!strcasecmp(optarg, "ntpshm")) {
 				node.servo_type = CLOCK_SERVO_NTPSHM;
+			} else if (!strcasecmp(optarg, "refclock_sock")) {
+				node.servo_type = CLOCK_SERVO_REFCLOCK_SOCK;
+			} else if (!strcasecmp(optarg, "auto")) {
+				node.servo_type = CLOCK_SERVO_AUTO;
 			} else {
 				fprintf(stderr,
 					"invalid servo name %s\n", optarg);
 				goto end;
 			}
 			break;
+		case 'e':
+			if (!strcasecmp(optarg, "auto")) {
+				node.phc_method = PHC_METHOD_AUTO;
+			} else if (!strcasecmp(optarg, "direct")) {
+				node.phc_method = PHC_METHOD_DIRECT;
+			} else if (!strcasecmp(optarg, "sysoff")) {
+				node.phc_method = PHC_METHOD_SYSOFF;
+			} else {
+				fprintf(stderr,
+					"invalid method name %s\n", optarg);
+				goto end;
+			}
+			break;
 		case 'P':
 			if (get_arg_val_d(c, optarg, &tmp, 0.0, DBL_MAX) ||
 			    config_set_double(cfg, "pi_proportional_const", tmp))
@@ -1314,9 +2199,23 @@ int main(int argc, char *argv[])
 				goto end;
 			node.phc_interval = 1.0 / phc_rate;
 			break;
+		case 'U':
+			if (get_arg_val_d(c, optarg, &node.phc_max_interval,
+					  0.0, DBL_MAX))
+				goto end;
+			break;
+		case 'T':
+			if (get_arg_val_i(c, optarg, &stable_offset, 0, INT_MAX))
+				goto end;
+			node.stable_offset = stable_offset;
+			break;
 		case 'N':
-			if (get_arg_val_i(c, optarg, &node.phc_readings, 1, INT_MAX))
+			if (!strcasecmp(optarg, "auto")) {
+				node.adaptive_readings = 1;
+			} else if (get_arg_val_i(c, optarg, &node.phc_readings,
+						 1, INT_MAX)) {
 				goto end;
+			}
 			break;
 		case 'O':
 			if (get_arg_val_i(c, optarg, &node.sync_offset,
@@ -1324,6 +2223,11 @@ int main(int argc, char *argv[])
 				goto end;
 			node.forced_sync_offset = -1;
 			break;
+		case 'A':
+			if (get_arg_val_d(c, optarg, &tmp, 0.0, DBL_MAX) ||
+			    config_set_double(cfg, "min_freq_change", tmp))
+				goto end;
+			break;
 		case 'L':
 			if (get_arg_val_i(c, optarg, &node.sanity_freq_limit, 0, INT_MAX))
 				goto end;
@@ -1333,11 +2237,26 @@ int main(int argc, char *argv[])
 			    config_set_int(cfg, "ntpshm_segment", ntpshm_segment))
 				goto end;
 			break;
+		case 'C':
+			if (config_set_string(cfg, "refclock_sock_address",
+					      optarg))
+				goto end;
+			break;
 		case 'u':
 			if (get_arg_val_ui(c, optarg, &node.stats_max_count,
 					  0, UINT_MAX))
 				goto end;
 			break;
+		case 'H':
+			if (get_arg_val_i(c, optarg, &node.hist_bins,
+					  2, MAX_HIST_BINS))
+				goto end;
+			break;
+		case 'D':
+			if (get_arg_val_d(c, optarg, &node.delay_percentile,
+					  1.0, 100.0))
+				goto end;
+			break;
 		case 'w':
 			wait_sync = 1;
 			break;
@@ -1348,6 +2267,9 @@ int main(int argc, char *argv[])
 		case 'x':
 			node.kernel_leap = 0;
 			break;
+		case 'j':
+			node.threads = 1;
+			break;
 		case 'z':
 			if (strlen(optarg) > MAX_IFNAME_SIZE) {
 				fprintf(stderr, "path %s too long, max is %d\n",
@@ -1358,11 +2280,31 @@ int main(int argc, char *argv[])
 				goto end;
 			}
 			break;
+		case 'k':
+			if (config_set_string(cfg, "freq_file", optarg))
+				goto end;
+			break;
+		case 'p':
+			if (config_set_string(cfg, "state_file", optarg))
+				goto end;
+			break;
+		case 'g':
+			if (config_set_string(cfg, "servo_log_file", optarg))
+				goto end;
+			break;
+		case 'X':
+			if (config_set_string(cfg, "metrics_address", optarg))
+				goto end;
+			break;
 		case 'l':
 			if (get_arg_val_i(c, optarg, &print_level,
 					  PRINT_LEVEL_MIN, PRINT_LEVEL_MAX))
 				goto end;
 			break;
+		case 'Q':
+			if (get_arg_val_i(c, optarg, &logging_queue, 0, 65536))
+				goto end;
+			break;
 		case 'm':
 			verbose = 1;
 			break;
@@ -1382,12 +2324,12 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (autocfg && (src_name || dst_name || pps_fd >= 0 || wait_sync || node.forced_sync_offset)) {
+	if (autocfg && (src_name || dst_name || !LIST_EMPTY(&node.pps_sources) || wait_sync || node.forced_sync_offset)) {
 		fprintf(stderr,
 			"autoconfiguration cannot be mixed with manual config options.\n");
 		goto bad_usage;
 	}
-	if (!autocfg && pps_fd < 0 && !src_name) {
+	if (!autocfg && LIST_EMPTY(&node.pps_sources) && !src_name) {
 		fprintf(stderr,
 			"autoconfiguration or valid source clock must be selected.\n");
 		goto bad_usage;
@@ -1399,7 +2341,13 @@ int main(int argc, char *argv[])
 		goto bad_usage;
 	}
 
-	if (node.servo_type == CLOCK_SERVO_NTPSHM) {
+	if (node.hist_bins && !node.stats_max_count) {
+		fprintf(stderr, "histograms need summary stats enabled by -u\n");
+		goto bad_usage;
+	}
+
+	if (node.servo_type == CLOCK_SERVO_NTPSHM ||
+	    node.servo_type == CLOCK_SERVO_REFCLOCK_SOCK) {
 		node.kernel_leap = 0;
 		node.sanity_freq_limit = 0;
 	}
@@ -1408,12 +2356,20 @@ int main(int argc, char *argv[])
 	print_set_verbose(verbose);
 	print_set_syslog(use_syslog);
 	print_set_level(print_level);
+	if (print_set_async(logging_queue))
+		goto end;
+	clockadj_set_min_change(config_get_double(cfg, NULL,
+						  "min_freq_change"));
+	if (open_servo_log(&node))
+		goto end;
 
 	if (autocfg) {
 		if (init_pmc(cfg, &node, domain_number))
 			goto end;
 		if (auto_init_ports(&node, rt) < 0)
 			goto end;
+		if (open_state_file(&node))
+			goto end;
 		r = do_loop(&node, 1);
 		goto end;
 	}
@@ -1437,7 +2393,7 @@ int main(int argc, char *argv[])
 	}
 	dst->state = PS_MASTER;
 
-	if (pps_fd >= 0 && dst->clkid != CLOCK_REALTIME) {
+	if (!LIST_EMPTY(&node.pps_sources) && dst->clkid != CLOCK_REALTIME) {
 		fprintf(stderr,
 			"cannot use a pps device unless destination is CLOCK_REALTIME\n");
 		goto bad_usage;
@@ -1473,18 +2429,32 @@ int main(int argc, char *argv[])
 			close_pmc(&node);
 	}
 
-	if (pps_fd >= 0) {
+	if (open_state_file(&node))
+		goto end;
+
+	if (!LIST_EMPTY(&node.pps_sources)) {
 		/* only one destination clock allowed with PPS until we
 		 * implement a mean to specify PTP port to PPS mapping */
-		servo_sync_interval(dst->servo, 1.0);
-		r = do_pps_loop(&node, dst, pps_fd);
-	} else {
-		r = do_loop(&node, 0);
+		init_pps(&node, dst);
 	}
+	r = do_loop(&node, 0);
 
 end:
+	clockadj_get_stats(&adj_issued, &adj_avoided);
+	if (adj_issued || adj_avoided)
+		pr_info("clock adjustments: %lu issued, %lu avoided",
+			adj_issued, adj_avoided);
+	pps_close(&node);
+	close_freqfiles(&node);
+	if (node.metrics)
+		metrics_destroy(node.metrics);
+	if (node.stateshm)
+		stateshm_destroy(node.stateshm);
+	if (node.servolog)
+		servolog_close(node.servolog);
 	if (node.pmc)
 		close_pmc(&node);
+	print_set_async(0);
 	config_destroy(cfg);
 	return r;
 bad_usage:
@@ -32,6 +32,7 @@
 #include <sys/ioctl.h>
 #include <sys/queue.h>
 #include <sys/stat.h>
+#include <sys/timex.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <math.h>
@@ -49,6 +50,8 @@
 #include "version.h"
 
 #define NSEC2SEC 1000000000.0
+#define BENCH_COUNT 10000
+#define BENCH_READINGS 5
 
 /* trap the alarm signal so that pause() will wake up on receipt */
 static void handle_alarm(int s)
@@ -168,6 +171,8 @@ static void usage(const char *progname)
 		"  cmp             compare PHC offset to CLOCK_REALTIME\n"
 		"  caps            display device capabilities (default if no command given)\n"
 		"  wait <seconds>  pause between commands\n"
+		"  bench [count] [readings]\n"
+		"                  measure the latency of reading and adjusting the PHC\n"
 		"\n",
 		progname);
 }
@@ -367,10 +372,12 @@ static int do_cmp(clockid_t clkid, int cmdc, char *cmdv[])
 	struct timespec ts, rta, rtb;
 	int64_t sys_offset, delay = 0, offset;
 	uint64_t sys_ts;
+	int method;
 
-	if (SYSOFF_SUPPORTED ==
-	    sysoff_measure(CLOCKID_TO_FD(clkid),
-			   9, &sys_offset, &sys_ts, &delay)) {
+	method = sysoff_probe(CLOCKID_TO_FD(clkid), 9);
+	if (method >= 0 &&
+	    sysoff_measure(CLOCKID_TO_FD(clkid), method,
+			   9, &sys_offset, &sys_ts, &delay) >= 0) {
 		pr_notice( "offset from CLOCK_REALTIME is %"PRId64"ns\n",
 			sys_offset);
 		return 0;
@@ -438,6 +445,150 @@ static int do_wait(clockid_t clkid, int cmdc, char *cmdv[])
 	return 1;
 }
 
+static int cmp_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int64_t bench_elapsed(struct timespec *t1, struct timespec *t2)
+{
+	return (t2->tv_sec - t1->tv_sec) * 1000000000LL +
+		t2->tv_nsec - t1->tv_nsec;
+}
+
+static void bench_report(const char *name, int64_t *lat, int n)
+{
+	if (!n) {
+		pr_notice("%-20s not supported", name);
+		return;
+	}
+	qsort(lat, n, sizeof(*lat), cmp_int64);
+	pr_notice("%-20s %8" PRId64 " %8" PRId64 " %8" PRId64 " %8" PRId64
+		  " %8" PRId64 " %8" PRId64, name, lat[0], lat[n / 2],
+		  lat[(int64_t) n * 90 / 100], lat[(int64_t) n * 99 / 100],
+		  lat[(int64_t) n * 999 / 1000], lat[n - 1]);
+}
+
+/*
+ * Measure the latency of the system calls reading and adjusting a PHC,
+ * and the window of the readings of each sysoff method, which bounds
+ * the accuracy of the offsets measured by phc2sys. The offset is
+ * adjusted by alternating steps of +1 and -1 ns and the frequency is
+ * rewritten with its current value, so that the clock is left as it
+ * was, but a clock disciplined by another process is disturbed.
+ */
+static int do_bench(clockid_t clkid, int cmdc, char *cmdv[])
+{
+	int64_t *lat, *window, offset, delay;
+	int i, n, count = BENCH_COUNT, readings = BENCH_READINGS;
+	int args = 0, fd = CLOCKID_TO_FD(clkid), method;
+	struct timespec t1, t2, ts;
+	enum parser_result r;
+	struct timex tx;
+	uint64_t sys_ts;
+	char name[32];
+
+	if (cmdc > args && !name_is_a_command(cmdv[args])) {
+		r = get_ranged_int(cmdv[args], &count, 1, INT_MAX / 1000);
+		if (r != PARSED_OK) {
+			pr_err("bench: bad count '%s'", cmdv[args]);
+			return -2;
+		}
+		args++;
+	}
+	if (cmdc > args && !name_is_a_command(cmdv[args])) {
+		r = get_ranged_int(cmdv[args], &readings, 1, PTP_MAX_SAMPLES);
+		if (r != PARSED_OK) {
+			pr_err("bench: bad number of readings '%s'", cmdv[args]);
+			return -2;
+		}
+		args++;
+	}
+
+	lat = calloc(2 * count, sizeof(*lat));
+	if (!lat) {
+		pr_err("bench: low memory");
+		return -1;
+	}
+	window = lat + count;
+
+	pr_notice("%d iterations, latency and window in ns", count);
+	pr_notice("%-20s %8s %8s %8s %8s %8s %8s",
+		  "", "min", "50%", "90%", "99%", "99.9%", "max");
+
+	for (i = 0, n = 0; i < count; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (clock_gettime(clkid, &ts))
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &t2);
+		lat[n++] = bench_elapsed(&t1, &t2);
+	}
+	bench_report("gettime", lat, n);
+
+	if (clkid == CLOCK_REALTIME) {
+		pr_notice("not a PHC, skipping the rest");
+		free(lat);
+		return args;
+	}
+
+	for (method = SYSOFF_PRECISE; method < SYSOFF_LAST; method++) {
+		for (i = 0, n = 0; i < count; i++) {
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			if (sysoff_measure(fd, method, readings, &offset,
+					   &sys_ts, &delay) < 0)
+				break;
+			clock_gettime(CLOCK_MONOTONIC, &t2);
+			lat[n] = bench_elapsed(&t1, &t2);
+			window[n++] = delay;
+		}
+		bench_report(sysoff_method_name(method), lat, n);
+		if (n && method != SYSOFF_PRECISE) {
+			snprintf(name, sizeof(name), "  window (%d)", readings);
+			bench_report(name, window, n);
+		}
+	}
+
+	memset(&tx, 0, sizeof(tx));
+	if (clock_adjtime(clkid, &tx) < 0) {
+		pr_err("bench: failed to read the frequency: %m");
+		free(lat);
+		return -1;
+	}
+	tx.modes = ADJ_FREQUENCY;
+	for (i = 0, n = 0; i < count; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (clock_adjtime(clkid, &tx) < 0)
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &t2);
+		lat[n++] = bench_elapsed(&t1, &t2);
+	}
+	bench_report("adjtime frequency", lat, n);
+
+	memset(&tx, 0, sizeof(tx));
+	tx.modes = ADJ_SETOFFSET | ADJ_NANO;
+	for (i = 0, n = 0; i < count; i++) {
+		/* Step by +1 and -1 ns, as -1 ns is -1 s + 999999999 ns. */
+		tx.time.tv_sec = i % 2 ? -1 : 0;
+		tx.time.tv_usec = i % 2 ? 999999999 : 1;
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (clock_adjtime(clkid, &tx) < 0)
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &t2);
+		lat[n++] = bench_elapsed(&t1, &t2);
+	}
+	if (n % 2) {
+		tx.time.tv_sec = -1;
+		tx.time.tv_usec = 999999999;
+		clock_adjtime(clkid, &tx);
+	}
+	bench_report("adjtime offset", lat, n);
+
+	free(lat);
+	return args;
+}
+
 static const struct cmd_t all_commands[] = {
 	{ "set", &do_set },
 	{ "get", &do_get },
@@ -446,6 +597,7 @@ static const struct cmd_t all_commands[] = {
 	{ "cmp", &do_cmp },
 	{ "caps", &do_caps },
 	{ "wait", &do_wait },
+	{ "bench", &do_bench },
 	{ 0, 0 }
 };
 
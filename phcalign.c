@@ -0,0 +1,245 @@
+/**
+ * @file phcalign.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "clockadj.h"
+#include "missing.h"
+#include "phc.h"
+#include "phcalign.h"
+#include "print.h"
+#include "servo.h"
+#include "sysoff.h"
+
+/* The number of readings of a measurement, the quickest one is used */
+#define PHCALIGN_READINGS 5
+
+struct phcalign_clock {
+	int phc_index;
+	clockid_t clkid;
+	int sysoff_method;
+	int max_adj;
+	struct servo *servo;
+	enum servo_state state;
+};
+
+struct phcalign {
+	struct config *cfg;
+	double interval;
+	struct phcalign_clock *clocks;
+	int n_clocks;
+	int ref;
+};
+
+static struct phcalign_clock *phcalign_find(struct phcalign *pa, int phc_index)
+{
+	int i;
+
+	for (i = 0; i < pa->n_clocks; i++) {
+		if (pa->clocks[i].phc_index == phc_index)
+			return &pa->clocks[i];
+	}
+	return NULL;
+}
+
+/* Continue steering a clock from its current frequency. */
+static void phcalign_warm_start(struct phcalign_clock *pc)
+{
+	double fadj = clockadj_get_freq(pc->clkid);
+
+	servo_reset(pc->servo);
+	servo_warm_start(pc->servo, -fadj);
+	pc->state = SERVO_UNLOCKED;
+}
+
+struct phcalign *phcalign_create(struct config *cfg, double interval)
+{
+	struct phcalign *pa;
+
+	pa = calloc(1, sizeof(*pa));
+	if (!pa)
+		return NULL;
+	pa->cfg = cfg;
+	pa->interval = interval;
+	return pa;
+}
+
+void phcalign_destroy(struct phcalign *pa)
+{
+	int i;
+
+	for (i = 0; i < pa->n_clocks; i++) {
+		servo_destroy(pa->clocks[i].servo);
+		phc_close(pa->clocks[i].clkid);
+	}
+	free(pa->clocks);
+	free(pa);
+}
+
+int phcalign_add(struct phcalign *pa, int phc_index)
+{
+	struct phcalign_clock *clocks, *pc;
+	char phc[32];
+	int fadj;
+
+	if (phcalign_find(pa, phc_index))
+		return 0;
+
+	clocks = realloc(pa->clocks, (pa->n_clocks + 1) * sizeof(*clocks));
+	if (!clocks) {
+		pr_err("low memory");
+		return -1;
+	}
+	pa->clocks = clocks;
+	pc = &pa->clocks[pa->n_clocks];
+
+	snprintf(phc, sizeof(phc), "/dev/ptp%d", phc_index);
+	pc->phc_index = phc_index;
+	pc->clkid = phc_open(phc);
+	if (pc->clkid == CLOCK_INVALID) {
+		pr_err("failed to open %s: %m", phc);
+		return -1;
+	}
+	pc->max_adj = phc_max_adj(pc->clkid);
+	if (!pc->max_adj) {
+		pr_err("%s is not adjustable", phc);
+		phc_close(pc->clkid);
+		return -1;
+	}
+	fadj = (int) clockadj_get_freq(pc->clkid);
+	pc->servo = servo_create(pa->cfg, CLOCK_SERVO_PI, -fadj, pc->max_adj, 0);
+	if (!pc->servo) {
+		pr_err("failed to create the servo of %s", phc);
+		phc_close(pc->clkid);
+		return -1;
+	}
+	servo_sync_interval(pc->servo, pa->interval);
+	pc->state = SERVO_UNLOCKED;
+	pc->sysoff_method = sysoff_probe(CLOCKID_TO_FD(pc->clkid),
+					 PHCALIGN_READINGS);
+	pr_info("aligning %s, measuring offset with %s", phc,
+		sysoff_method_name(pc->sysoff_method));
+
+	pa->n_clocks++;
+	return 0;
+}
+
+int phcalign_count(struct phcalign *pa)
+{
+	return pa->n_clocks;
+}
+
+int phcalign_set_reference(struct phcalign *pa, int phc_index)
+{
+	struct phcalign_clock *pc = phcalign_find(pa, phc_index);
+	int ref;
+
+	if (!pc)
+		return -1;
+	ref = pc - pa->clocks;
+	if (ref == pa->ref)
+		return 0;
+	if (pa->ref < pa->n_clocks)
+		phcalign_warm_start(&pa->clocks[pa->ref]);
+	pa->ref = ref;
+	pr_info("aligning the PHCs to /dev/ptp%d", phc_index);
+	return 0;
+}
+
+int phcalign_locked(struct phcalign *pa, int phc_index)
+{
+	struct phcalign_clock *pc = phcalign_find(pa, phc_index);
+
+	if (!pc)
+		return 0;
+	return pc - pa->clocks == pa->ref || pc->state == SERVO_LOCKED;
+}
+
+/*
+ * Prefer measuring both PHCs against the system clock with the offset
+ * ioctls, as phc2sys does, which bracket the readings more tightly than
+ * clock_gettime() on the reference.
+ */
+static int phcalign_measure(struct phcalign_clock *src,
+			    struct phcalign_clock *dst,
+			    int64_t *offset, uint64_t *ts)
+{
+	int64_t delay;
+
+	if (src->sysoff_method >= 0 && src->sysoff_method != SYSOFF_BASIC &&
+	    dst->sysoff_method >= 0 && dst->sysoff_method != SYSOFF_BASIC) {
+		return !sysoff_measure_pair(CLOCKID_TO_FD(src->clkid),
+					    src->sysoff_method,
+					    CLOCKID_TO_FD(dst->clkid),
+					    dst->sysoff_method,
+					    PHCALIGN_READINGS,
+					    offset, ts, &delay);
+	}
+	return phc_read_offset(src->clkid, dst->clkid, PHCALIGN_READINGS, 0,
+			       offset, ts, &delay);
+}
+
+void phcalign_update(struct phcalign *pa)
+{
+	struct phcalign_clock *ref, *pc;
+	int64_t offset;
+	uint64_t ts;
+	double ppb;
+	int i;
+
+	if (pa->n_clocks < 2)
+		return;
+	ref = &pa->clocks[pa->ref];
+
+	for (i = 0; i < pa->n_clocks; i++) {
+		pc = &pa->clocks[i];
+		if (pc == ref)
+			continue;
+		if (!phcalign_measure(ref, pc, &offset, &ts)) {
+			pr_err("failed to measure /dev/ptp%d against /dev/ptp%d",
+			       pc->phc_index, ref->phc_index);
+			continue;
+		}
+		ppb = servo_sample(pc->servo, offset, ts, 1.0, &pc->state);
+
+		switch (pc->state) {
+		case SERVO_UNLOCKED:
+			break;
+		case SERVO_JUMP:
+			clockadj_step(pc->clkid, -offset);
+			/* Fall through. */
+		case SERVO_LOCKED:
+			clockadj_set_freq(pc->clkid, -ppb);
+			break;
+		}
+		pr_debug("/dev/ptp%d offset %9" PRId64 " s%d freq %+7.0f",
+			 pc->phc_index, offset, pc->state, ppb);
+	}
+}
+
+void phcalign_step(struct phcalign *pa, int64_t offset)
+{
+	int i;
+
+	for (i = 0; i < pa->n_clocks; i++) {
+		if (i != pa->ref)
+			clockadj_step(pa->clocks[i].clkid, -offset);
+	}
+}
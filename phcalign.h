@@ -0,0 +1,95 @@
+/**
+ * @file phcalign.h
+ * @brief Keeps the PHCs of a boundary clock aligned to one of them.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_PHCALIGN_H
+#define HAVE_PHCALIGN_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+/** Opaque type */
+struct phcalign;
+
+/**
+ * Create a new instance of the PHC alignment. Each added PHC other than
+ * the reference is steered by a servo of its own to the reference.
+ * @param cfg       The configuration, for the parameters of the servos.
+ * @param interval  The interval between the updates in seconds.
+ * @return A pointer to a new phcalign on success, NULL otherwise.
+ */
+struct phcalign *phcalign_create(struct config *cfg, double interval);
+
+/**
+ * Destroy an instance of phcalign, closing the PHCs.
+ * @param pa  Pointer to phcalign obtained via @ref phcalign_create().
+ */
+void phcalign_destroy(struct phcalign *pa);
+
+/**
+ * Add a PHC to the aligned clocks. Adding a PHC again has no effect.
+ * The first PHC added becomes the reference.
+ * @param pa         Pointer to phcalign obtained via @ref phcalign_create().
+ * @param phc_index  The index of the PHC.
+ * @return Zero on success, non-zero otherwise.
+ */
+int phcalign_add(struct phcalign *pa, int phc_index);
+
+/**
+ * Get the number of the aligned PHCs.
+ * @param pa  Pointer to phcalign obtained via @ref phcalign_create().
+ * @return The number of PHCs, the reference included.
+ */
+int phcalign_count(struct phcalign *pa);
+
+/**
+ * Select the PHC to which the others are aligned. The reference is no
+ * longer adjusted, while the previous reference becomes aligned and is
+ * warm started with its current frequency.
+ * @param pa         Pointer to phcalign obtained via @ref phcalign_create().
+ * @param phc_index  The index of a PHC previously added.
+ * @return Zero on success, non-zero if the PHC was not added.
+ */
+int phcalign_set_reference(struct phcalign *pa, int phc_index);
+
+/**
+ * Tell whether a PHC is aligned closely to the reference.
+ * @param pa         Pointer to phcalign obtained via @ref phcalign_create().
+ * @param phc_index  The index of the PHC.
+ * @return One if the PHC is the reference or its servo is locked,
+ *         zero otherwise.
+ */
+int phcalign_locked(struct phcalign *pa, int phc_index);
+
+/**
+ * Measure the offsets of the PHCs from the reference and adjust them.
+ * @param pa  Pointer to phcalign obtained via @ref phcalign_create().
+ */
+void phcalign_update(struct phcalign *pa);
+
+/**
+ * Step the aligned PHCs along with the reference, so that they stay
+ * aligned.
+ * @param pa      Pointer to phcalign obtained via @ref phcalign_create().
+ * @param offset  The offset removed from the reference in nanoseconds,
+ *                as passed to clockadj_step() negated.
+ */
+void phcalign_step(struct phcalign *pa, int64_t offset);
+
+#endif
@@ -44,6 +44,8 @@ struct pi_servo {
 	double ki;
 	double last_freq;
 	int count;
+	int warm;
+	int sw_ts;
 	/* configuration: */
 	double configured_pi_kp;
 	double configured_pi_ki;
@@ -77,6 +79,21 @@ static double pi_sample(struct servo *servo,
 		s->local[0] = local_ts;
 		*state = SERVO_UNLOCKED;
 		s->count = 1;
+		if (!s->warm)
+			break;
+		/* The drift is already known, skip the estimation. */
+		s->warm = 0;
+		if ((servo->first_update &&
+		     servo->first_step_threshold &&
+		     servo->first_step_threshold < fabs(offset)) ||
+		    (servo->step_threshold &&
+		     servo->step_threshold < fabs(offset)))
+			*state = SERVO_JUMP;
+		else
+			*state = SERVO_LOCKED;
+
+		ppb = s->drift;
+		s->count = 2;
 		break;
 	case 1:
 		s->offset[1] = offset;
@@ -177,22 +194,17 @@ static void pi_reset(struct servo *servo)
 	s->count = 0;
 }
 
-struct servo *pi_servo_create(struct config *cfg, int fadj, int sw_ts)
+static void pi_warm_start(struct servo *servo, double fadj)
 {
-	struct pi_servo *s;
+	struct pi_servo *s = container_of(servo, struct pi_servo, servo);
 
-	s = calloc(1, sizeof(*s));
-	if (!s)
-		return NULL;
+	s->drift = fadj;
+	s->last_freq = fadj;
+	s->warm = 1;
+}
 
-	s->servo.destroy = pi_destroy;
-	s->servo.sample  = pi_sample;
-	s->servo.sync_interval = pi_sync_interval;
-	s->servo.reset   = pi_reset;
-	s->drift         = fadj;
-	s->last_freq     = fadj;
-	s->kp            = 0.0;
-	s->ki            = 0.0;
+static void pi_configure(struct pi_servo *s, struct config *cfg)
+{
 	s->configured_pi_kp = config_get_double(cfg, NULL, "pi_proportional_const");
 	s->configured_pi_ki = config_get_double(cfg, NULL, "pi_integral_const");
 	s->configured_pi_kp_scale = config_get_double(cfg, NULL, "pi_proportional_scale");
@@ -218,7 +230,7 @@ struct servo *pi_servo_create(struct config *cfg, int fadj, int sw_ts)
 		s->configured_pi_kp_norm_max = MAX_KP_NORM_MAX;
 		s->configured_pi_ki_norm_max = MAX_KI_NORM_MAX;
 	} else if (!s->configured_pi_kp_scale || !s->configured_pi_ki_scale) {
-		if (sw_ts) {
+		if (s->sw_ts) {
 			s->configured_pi_kp_scale = SWTS_KP_SCALE;
 			s->configured_pi_ki_scale = SWTS_KI_SCALE;
 		} else {
@@ -226,6 +238,35 @@ struct servo *pi_servo_create(struct config *cfg, int fadj, int sw_ts)
 			s->configured_pi_ki_scale = HWTS_KI_SCALE;
 		}
 	}
+}
+
+static void pi_reconfigure(struct servo *servo, struct config *cfg)
+{
+	struct pi_servo *s = container_of(servo, struct pi_servo, servo);
+
+	pi_configure(s, cfg);
+}
+
+struct servo *pi_servo_create(struct config *cfg, int fadj, int sw_ts)
+{
+	struct pi_servo *s;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->servo.destroy = pi_destroy;
+	s->servo.sample  = pi_sample;
+	s->servo.sync_interval = pi_sync_interval;
+	s->servo.reset   = pi_reset;
+	s->servo.warm_start = pi_warm_start;
+	s->servo.reconfigure = pi_reconfigure;
+	s->drift         = fadj;
+	s->last_freq     = fadj;
+	s->kp            = 0.0;
+	s->ki            = 0.0;
+	s->sw_ts         = sw_ts;
+	pi_configure(s, cfg);
 
 	return &s->servo;
 }
@@ -22,10 +22,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <arpa/inet.h>
 
+#include "cpustat.h"
 #include "ds.h"
 #include "fsm.h"
 #include "pmc_common.h"
@@ -41,7 +43,13 @@
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 #define P41 ((double)(1ULL << 41))
 
+/* Time to wait for further replies once every request was answered */
+#define BATCH_LINGER 10
+
 static struct pmc *pmc;
+/* Receives the informational messages, kept off stdout with JSON output */
+static FILE *info_fp;
+static int json_output;
 
 static void do_get_action(int action, int index, char *str);
 static void do_set_action(int action, int index, char *str);
@@ -88,6 +96,14 @@ struct management_id idtab[] = {
 	{ "PRIMARY_DOMAIN", TLV_PRIMARY_DOMAIN, not_supported },
 	{ "TIME_STATUS_NP", TLV_TIME_STATUS_NP, do_get_action },
 	{ "GRANDMASTER_SETTINGS_NP", TLV_GRANDMASTER_SETTINGS_NP, do_set_action },
+	{ "MSG_POOL_STATS_NP", TLV_MSG_POOL_STATS_NP, do_get_action },
+	{ "CLOCK_STATS_NP", TLV_CLOCK_STATS_NP, do_get_action },
+	{ "HOLDOVER_NP", TLV_HOLDOVER_NP, do_get_action },
+	{ "SNAPSHOT_NP", TLV_SNAPSHOT_NP, do_get_action },
+	{ "SYNC_SAMPLE_NP", TLV_SYNC_SAMPLE_NP, do_get_action },
+	{ "MANAGEMENT_STATS_NP", TLV_MANAGEMENT_STATS_NP, do_get_action },
+	{ "CPU_STATS_NP", TLV_CPU_STATS_NP, do_get_action },
+	{ "PERF_STATS_NP", TLV_PERF_STATS_NP, do_get_action },
 /* Port management ID values */
 	{ "NULL_MANAGEMENT", TLV_NULL_MANAGEMENT, null_management },
 	{ "CLOCK_DESCRIPTION", TLV_CLOCK_DESCRIPTION, do_get_action },
@@ -107,6 +123,8 @@ struct management_id idtab[] = {
 	{ "DELAY_MECHANISM", TLV_DELAY_MECHANISM, do_get_action },
 	{ "LOG_MIN_PDELAY_REQ_INTERVAL", TLV_LOG_MIN_PDELAY_REQ_INTERVAL, do_get_action },
 	{ "PORT_DATA_SET_NP", TLV_PORT_DATA_SET_NP, do_set_action },
+	{ "PORT_STATS_NP", TLV_PORT_STATS_NP, do_set_action },
+	{ "TX_TIMESTAMP_STATS_NP", TLV_TX_TIMESTAMP_STATS_NP, do_set_action },
 };
 
 static const char *action_string[] = {
@@ -181,20 +199,268 @@ static char *portaddr2str(struct PortAddress *addr)
 	return buf;
 }
 
+static void show_default_ds(FILE *fp, struct defaultDS *dds)
+{
+	fprintf(fp, "DEFAULT_DATA_SET "
+		IFMT "twoStepFlag             %d"
+		IFMT "slaveOnly               %d"
+		IFMT "numberPorts             %hu"
+		IFMT "priority1               %hhu"
+		IFMT "clockClass              %hhu"
+		IFMT "clockAccuracy           0x%02hhx"
+		IFMT "offsetScaledLogVariance 0x%04hx"
+		IFMT "priority2               %hhu"
+		IFMT "clockIdentity           %s"
+		IFMT "domainNumber            %hhu",
+		dds->flags & DDS_TWO_STEP_FLAG ? 1 : 0,
+		dds->flags & DDS_SLAVE_ONLY ? 1 : 0,
+		dds->numberPorts,
+		dds->priority1,
+		dds->clockQuality.clockClass,
+		dds->clockQuality.clockAccuracy,
+		dds->clockQuality.offsetScaledLogVariance,
+		dds->priority2,
+		cid2str(&dds->clockIdentity),
+		dds->domainNumber);
+}
+
+static void show_current_ds(FILE *fp, struct currentDS *cds)
+{
+	fprintf(fp, "CURRENT_DATA_SET "
+		IFMT "stepsRemoved     %hd"
+		IFMT "offsetFromMaster %.1f"
+		IFMT "meanPathDelay    %.1f",
+		cds->stepsRemoved, cds->offsetFromMaster / 65536.0,
+		cds->meanPathDelay / 65536.0);
+}
+
+static void show_parent_ds(FILE *fp, struct parentDS *pds)
+{
+	fprintf(fp, "PARENT_DATA_SET "
+		IFMT "parentPortIdentity                    %s"
+		IFMT "parentStats                           %hhu"
+		IFMT "observedParentOffsetScaledLogVariance 0x%04hx"
+		IFMT "observedParentClockPhaseChangeRate    0x%08x"
+		IFMT "grandmasterPriority1                  %hhu"
+		IFMT "gm.ClockClass                         %hhu"
+		IFMT "gm.ClockAccuracy                      0x%02hhx"
+		IFMT "gm.OffsetScaledLogVariance            0x%04hx"
+		IFMT "grandmasterPriority2                  %hhu"
+		IFMT "grandmasterIdentity                   %s",
+		pid2str(&pds->parentPortIdentity),
+		pds->parentStats,
+		pds->observedParentOffsetScaledLogVariance,
+		pds->observedParentClockPhaseChangeRate,
+		pds->grandmasterPriority1,
+		pds->grandmasterClockQuality.clockClass,
+		pds->grandmasterClockQuality.clockAccuracy,
+		pds->grandmasterClockQuality.offsetScaledLogVariance,
+		pds->grandmasterPriority2,
+		cid2str(&pds->grandmasterIdentity));
+}
+
+static void show_time_properties_ds(FILE *fp, struct timePropertiesDS *tp)
+{
+	fprintf(fp, "TIME_PROPERTIES_DATA_SET "
+		IFMT "currentUtcOffset      %hd"
+		IFMT "leap61                %d"
+		IFMT "leap59                %d"
+		IFMT "currentUtcOffsetValid %d"
+		IFMT "ptpTimescale          %d"
+		IFMT "timeTraceable         %d"
+		IFMT "frequencyTraceable    %d"
+		IFMT "timeSource            0x%02hhx",
+		tp->currentUtcOffset,
+		tp->flags & LEAP_61 ? 1 : 0,
+		tp->flags & LEAP_59 ? 1 : 0,
+		tp->flags & UTC_OFF_VALID ? 1 : 0,
+		tp->flags & PTP_TIMESCALE ? 1 : 0,
+		tp->flags & TIME_TRACEABLE ? 1 : 0,
+		tp->flags & FREQ_TRACEABLE ? 1 : 0,
+		tp->timeSource);
+}
+
+static void show_time_status(FILE *fp, struct time_status_np *tsn)
+{
+	fprintf(fp, "TIME_STATUS_NP "
+		IFMT "master_offset              %" PRId64
+		IFMT "ingress_time               %" PRId64
+		IFMT "cumulativeScaledRateOffset %+.9f"
+		IFMT "scaledLastGmPhaseChange    %d"
+		IFMT "gmTimeBaseIndicator        %hu"
+		IFMT "lastGmPhaseChange          0x%04hx'%016" PRIx64 ".%04hx"
+		IFMT "gmPresent                  %s"
+		IFMT "gmIdentity                 %s",
+		tsn->master_offset,
+		tsn->ingress_time,
+		(tsn->cumulativeScaledRateOffset + 0.0) / P41,
+		tsn->scaledLastGmPhaseChange,
+		tsn->gmTimeBaseIndicator,
+		tsn->lastGmPhaseChange.nanoseconds_msb,
+		tsn->lastGmPhaseChange.nanoseconds_lsb,
+		tsn->lastGmPhaseChange.fractional_nanoseconds,
+		tsn->gmPresent ? "true" : "false",
+		cid2str(&tsn->gmIdentity));
+}
+
+static void show_port_ds(FILE *fp, struct portDS *p)
+{
+	if (p->portState > PS_SLAVE) {
+		p->portState = 0;
+	}
+	fprintf(fp, "PORT_DATA_SET "
+		IFMT "portIdentity            %s"
+		IFMT "portState               %s"
+		IFMT "logMinDelayReqInterval  %hhd"
+		IFMT "peerMeanPathDelay       %" PRId64
+		IFMT "logAnnounceInterval     %hhd"
+		IFMT "announceReceiptTimeout  %hhu"
+		IFMT "logSyncInterval         %hhd"
+		IFMT "delayMechanism          %hhu"
+		IFMT "logMinPdelayReqInterval %hhd"
+		IFMT "versionNumber           %hhu",
+		pid2str(&p->portIdentity), ps_str[p->portState],
+		p->logMinDelayReqInterval, p->peerMeanPathDelay >> 16,
+		p->logAnnounceInterval, p->announceReceiptTimeout,
+		p->logSyncInterval, p->delayMechanism,
+		p->logMinPdelayReqInterval, p->versionNumber);
+}
+
+static void show_snapshot(FILE *fp, struct snapshot_np *snp)
+{
+	int i;
+
+	fprintf(fp, "SNAPSHOT_NP "
+		IFMT "portCount %hu" IFMT, snp->portCount);
+	show_default_ds(fp, &snp->dds);
+	fprintf(fp, IFMT);
+	show_current_ds(fp, &snp->cds);
+	fprintf(fp, IFMT);
+	show_parent_ds(fp, &snp->pds);
+	fprintf(fp, IFMT);
+	show_time_properties_ds(fp, &snp->tds);
+	fprintf(fp, IFMT);
+	show_time_status(fp, &snp->tsn);
+	for (i = 0; i < snp->portCount; i++) {
+		fprintf(fp, IFMT);
+		show_port_ds(fp, &snp->ports[i]);
+	}
+}
+
+/* The counters are copied out of the packed TLV, as they may be unaligned. */
+static void show_port_counters(FILE *fp, const char *name, const void *data)
+{
+	uint64_t counter[MAX_MESSAGE_TYPES];
+	char label[64];
+	int i;
+
+	memcpy(counter, data, sizeof(counter));
+
+	for (i = 0; i < MAX_MESSAGE_TYPES; i++) {
+		if (!strcmp(msg_type_string(i), "unknown"))
+			continue;
+		snprintf(label, sizeof(label), "%s_%s", name,
+			 msg_type_string(i));
+		fprintf(fp, IFMT "%-35s %" PRIu64, label, counter[i]);
+	}
+}
+
+static void show_port_stats(FILE *fp, struct port_stats_np *psn)
+{
+	fprintf(fp, "PORT_STATS_NP "
+		IFMT "portIdentity %s", pid2str(&psn->portIdentity));
+	show_port_counters(fp, "rx", psn->stats.rx);
+	show_port_counters(fp, "tx", psn->stats.tx);
+	show_port_counters(fp, "rx_ignored", psn->stats.rx_ignored);
+	show_port_counters(fp, "rx_bad", psn->stats.rx_bad);
+	show_port_counters(fp, "rx_no_ts", psn->stats.rx_no_ts);
+	show_port_counters(fp, "tx_ts_timeout", psn->stats.tx_ts_timeout);
+}
+
+static void show_cpu_stats(FILE *fp, struct cpu_stats_np *csn)
+{
+	int i;
+
+	fprintf(fp, "CPU_STATS_NP "
+		IFMT "enabled    %hhu", csn->enabled);
+	for (i = 0; i < CPU_STATS_STAGES && i < CPU_N_STAGES; i++) {
+		fprintf(fp, IFMT "%-10s %" PRIu64 " us in %" PRIu64,
+			cpustat_name(i), csn->stage[i].ns / 1000,
+			csn->stage[i].count);
+	}
+}
+
+static void show_perf_stats(FILE *fp, struct perf_stats_np *psn)
+{
+	fprintf(fp, "PERF_STATS_NP "
+		IFMT "wakeups            %" PRIu64
+		IFMT "events             %" PRIu64
+		IFMT "events_per_wakeup  %.2f"
+		IFMT "pool_total         %u"
+		IFMT "pool_high_water    %u"
+		IFMT "pool_hits          %" PRIu64
+		IFMT "pool_misses        %" PRIu64
+		IFMT "pool_failures      %" PRIu64
+		IFMT "txts_count         %" PRIu64
+		IFMT "txts_timeouts      %" PRIu64
+		IFMT "txts_p99           %" PRId64
+		IFMT "txts_max           %" PRId64
+		IFMT "servo_us           %" PRIu64
+		IFMT "servo_count        %" PRIu64
+		IFMT "adj_issued         %" PRIu64
+		IFMT "adj_avoided        %" PRIu64,
+		psn->wakeups, psn->events,
+		psn->wakeups ? (double) psn->events / psn->wakeups : 0.0,
+		psn->pool_total, psn->pool_high_water, psn->pool_hits,
+		psn->pool_misses, psn->pool_failures, psn->txts_count,
+		psn->txts_timeouts, psn->txts_p99, psn->txts_max,
+		psn->servo_ns / 1000, psn->servo_count, psn->adj_issued,
+		psn->adj_avoided);
+}
+
+static void show_txts_stats(FILE *fp, struct tx_timestamp_stats_np *tsn)
+{
+	int i;
+
+	fprintf(fp, "TX_TIMESTAMP_STATS_NP "
+		IFMT "portIdentity      %s"
+		IFMT "count             %u"
+		IFMT "timeouts          %u"
+		IFMT "timeout           %u"
+		IFMT "suggested_timeout %u"
+		IFMT "mean              %" PRId64
+		IFMT "p50               %" PRId64
+		IFMT "p99               %" PRId64
+		IFMT "p99.9             %" PRId64
+		IFMT "max               %" PRId64,
+		pid2str(&tsn->portIdentity), tsn->count, tsn->timeouts,
+		tsn->timeout, tsn->suggested_timeout, tsn->mean, tsn->p50,
+		tsn->p99, tsn->p999, tsn->max);
+	for (i = 0; i < TX_TIMESTAMP_HIST_BINS; i++) {
+		if (!tsn->histogram[i])
+			continue;
+		if (i == TX_TIMESTAMP_HIST_BINS - 1)
+			fprintf(fp, IFMT "hist_ge_%-9llu %u",
+				1ULL << (i - 1), tsn->histogram[i]);
+		else
+			fprintf(fp, IFMT "hist_lt_%-9llu %u",
+				1ULL << i, tsn->histogram[i]);
+	}
+}
+
 static void pmc_show(struct ptp_message *msg, FILE *fp)
 {
 	int action;
 	struct TLV *tlv;
 	struct management_tlv *mgt;
 	struct management_tlv_datum *mtd;
-	struct defaultDS *dds;
-	struct currentDS *cds;
-	struct parentDS *pds;
-	struct timePropertiesDS *tp;
-	struct time_status_np *tsn;
 	struct grandmaster_settings_np *gsn;
+	struct msg_pool_stats_np *mps;
+	struct clock_stats_np *csn;
+	struct holdover_np *hon;
+	struct sync_sample_np *ssn;
+	struct management_stats_np *msn;
 	struct mgmt_clock_description *cd;
-	struct portDS *p;
 	struct port_ds_np *pnp;
 	if (msg_type(msg) != MANAGEMENT) {
 		return;
@@ -254,81 +520,16 @@ static void pmc_show(struct ptp_message *msg, FILE *fp)
 			text2str(msg->last_tlv.cd.userDescription));
 		break;
 	case TLV_DEFAULT_DATA_SET:
-		dds = (struct defaultDS *) mgt->data;
-		fprintf(fp, "DEFAULT_DATA_SET "
-			IFMT "twoStepFlag             %d"
-			IFMT "slaveOnly               %d"
-			IFMT "numberPorts             %hu"
-			IFMT "priority1               %hhu"
-			IFMT "clockClass              %hhu"
-			IFMT "clockAccuracy           0x%02hhx"
-			IFMT "offsetScaledLogVariance 0x%04hx"
-			IFMT "priority2               %hhu"
-			IFMT "clockIdentity           %s"
-			IFMT "domainNumber            %hhu",
-			dds->flags & DDS_TWO_STEP_FLAG ? 1 : 0,
-			dds->flags & DDS_SLAVE_ONLY ? 1 : 0,
-			dds->numberPorts,
-			dds->priority1,
-			dds->clockQuality.clockClass,
-			dds->clockQuality.clockAccuracy,
-			dds->clockQuality.offsetScaledLogVariance,
-			dds->priority2,
-			cid2str(&dds->clockIdentity),
-			dds->domainNumber);
+		show_default_ds(fp, (struct defaultDS *) mgt->data);
 		break;
 	case TLV_CURRENT_DATA_SET:
-		cds = (struct currentDS *) mgt->data;
-		fprintf(fp, "CURRENT_DATA_SET "
-			IFMT "stepsRemoved     %hd"
-			IFMT "offsetFromMaster %.1f"
-			IFMT "meanPathDelay    %.1f",
-			cds->stepsRemoved, cds->offsetFromMaster / 65536.0,
-			cds->meanPathDelay / 65536.0);
+		show_current_ds(fp, (struct currentDS *) mgt->data);
 		break;
 	case TLV_PARENT_DATA_SET:
-		pds = (struct parentDS *) mgt->data;
-		fprintf(fp, "PARENT_DATA_SET "
-			IFMT "parentPortIdentity                    %s"
-			IFMT "parentStats                           %hhu"
-			IFMT "observedParentOffsetScaledLogVariance 0x%04hx"
-			IFMT "observedParentClockPhaseChangeRate    0x%08x"
-			IFMT "grandmasterPriority1                  %hhu"
-			IFMT "gm.ClockClass                         %hhu"
-			IFMT "gm.ClockAccuracy                      0x%02hhx"
-			IFMT "gm.OffsetScaledLogVariance            0x%04hx"
-			IFMT "grandmasterPriority2                  %hhu"
-			IFMT "grandmasterIdentity                   %s",
-			pid2str(&pds->parentPortIdentity),
-			pds->parentStats,
-			pds->observedParentOffsetScaledLogVariance,
-			pds->observedParentClockPhaseChangeRate,
-			pds->grandmasterPriority1,
-			pds->grandmasterClockQuality.clockClass,
-			pds->grandmasterClockQuality.clockAccuracy,
-			pds->grandmasterClockQuality.offsetScaledLogVariance,
-			pds->grandmasterPriority2,
-			cid2str(&pds->grandmasterIdentity));
+		show_parent_ds(fp, (struct parentDS *) mgt->data);
 		break;
 	case TLV_TIME_PROPERTIES_DATA_SET:
-		tp = (struct timePropertiesDS *) mgt->data;
-		fprintf(fp, "TIME_PROPERTIES_DATA_SET "
-			IFMT "currentUtcOffset      %hd"
-			IFMT "leap61                %d"
-			IFMT "leap59                %d"
-			IFMT "currentUtcOffsetValid %d"
-			IFMT "ptpTimescale          %d"
-			IFMT "timeTraceable         %d"
-			IFMT "frequencyTraceable    %d"
-			IFMT "timeSource            0x%02hhx",
-			tp->currentUtcOffset,
-			tp->flags & LEAP_61 ? 1 : 0,
-			tp->flags & LEAP_59 ? 1 : 0,
-			tp->flags & UTC_OFF_VALID ? 1 : 0,
-			tp->flags & PTP_TIMESCALE ? 1 : 0,
-			tp->flags & TIME_TRACEABLE ? 1 : 0,
-			tp->flags & FREQ_TRACEABLE ? 1 : 0,
-			tp->timeSource);
+		show_time_properties_ds(fp, (struct timePropertiesDS *) mgt->data);
 		break;
 	case TLV_PRIORITY1:
 		mtd = (struct management_tlv_datum *) mgt->data;
@@ -369,26 +570,7 @@ static void pmc_show(struct ptp_message *msg, FILE *fp)
 			IFMT "ptpTimescale %d", mtd->val & PTP_TIMESCALE ? 1 : 0);
 		break;
 	case TLV_TIME_STATUS_NP:
-		tsn = (struct time_status_np *) mgt->data;
-		fprintf(fp, "TIME_STATUS_NP "
-			IFMT "master_offset              %" PRId64
-			IFMT "ingress_time               %" PRId64
-			IFMT "cumulativeScaledRateOffset %+.9f"
-			IFMT "scaledLastGmPhaseChange    %d"
-			IFMT "gmTimeBaseIndicator        %hu"
-			IFMT "lastGmPhaseChange          0x%04hx'%016" PRIx64 ".%04hx"
-			IFMT "gmPresent                  %s"
-			IFMT "gmIdentity                 %s",
-			tsn->master_offset,
-			tsn->ingress_time,
-			(tsn->cumulativeScaledRateOffset + 0.0) / P41,
-			tsn->scaledLastGmPhaseChange,
-			tsn->gmTimeBaseIndicator,
-			tsn->lastGmPhaseChange.nanoseconds_msb,
-			tsn->lastGmPhaseChange.nanoseconds_lsb,
-			tsn->lastGmPhaseChange.fractional_nanoseconds,
-			tsn->gmPresent ? "true" : "false",
-			cid2str(&tsn->gmIdentity));
+		show_time_status(fp, (struct time_status_np *) mgt->data);
 		break;
 	case TLV_GRANDMASTER_SETTINGS_NP:
 		gsn = (struct grandmaster_settings_np *) mgt->data;
@@ -416,27 +598,93 @@ static void pmc_show(struct ptp_message *msg, FILE *fp)
 			gsn->time_flags & FREQ_TRACEABLE ? 1 : 0,
 			gsn->time_source);
 		break;
+	case TLV_MSG_POOL_STATS_NP:
+		mps = (struct msg_pool_stats_np *) mgt->data;
+		fprintf(fp, "MSG_POOL_STATS_NP "
+			IFMT "total      %u"
+			IFMT "free       %u"
+			IFMT "limit      %u"
+			IFMT "high_water %u"
+			IFMT "hits       %" PRIu64
+			IFMT "misses     %" PRIu64
+			IFMT "failures   %" PRIu64,
+			mps->total, mps->free, mps->limit, mps->high_water,
+			mps->hits, mps->misses, mps->failures);
+		break;
+	case TLV_CLOCK_STATS_NP:
+		csn = (struct clock_stats_np *) mgt->data;
+		fprintf(fp, "CLOCK_STATS_NP "
+			IFMT "offset_samples %u"
+			IFMT "offset_rms     %" PRId64
+			IFMT "offset_max     %" PRId64
+			IFMT "offset_p50     %" PRId64
+			IFMT "offset_p99     %" PRId64
+			IFMT "offset_p99.9   %" PRId64
+			IFMT "delay_samples  %u"
+			IFMT "delay_mean     %" PRId64
+			IFMT "delay_p50      %" PRId64
+			IFMT "delay_p99      %" PRId64
+			IFMT "delay_p99.9    %" PRId64,
+			csn->offset_samples, csn->offset_rms, csn->offset_max,
+			csn->offset_p50, csn->offset_p99, csn->offset_p999,
+			csn->delay_samples, csn->delay_mean, csn->delay_p50,
+			csn->delay_p99, csn->delay_p999);
+		break;
+	case TLV_SNAPSHOT_NP:
+		show_snapshot(fp, (struct snapshot_np *) mgt->data);
+		break;
+	case TLV_PORT_STATS_NP:
+		show_port_stats(fp, (struct port_stats_np *) mgt->data);
+		break;
+	case TLV_CPU_STATS_NP:
+		show_cpu_stats(fp, (struct cpu_stats_np *) mgt->data);
+		break;
+	case TLV_PERF_STATS_NP:
+		show_perf_stats(fp, (struct perf_stats_np *) mgt->data);
+		break;
+	case TLV_TX_TIMESTAMP_STATS_NP:
+		show_txts_stats(fp, (struct tx_timestamp_stats_np *) mgt->data);
+		break;
+	case TLV_SYNC_SAMPLE_NP:
+		ssn = (struct sync_sample_np *) mgt->data;
+		fprintf(fp, "SYNC_SAMPLE_NP "
+			IFMT "sequence      %u"
+			IFMT "master_offset %" PRId64
+			IFMT "path_delay    %" PRId64
+			IFMT "ingress_time  %" PRId64
+			IFMT "frequency     %.3f"
+			IFMT "servo_state   %hhu",
+			ssn->sequence, ssn->master_offset, ssn->path_delay,
+			ssn->ingress_time, ssn->frequency / 65536.0,
+			ssn->servo_state);
+		break;
+	case TLV_MANAGEMENT_STATS_NP:
+		msn = (struct management_stats_np *) mgt->data;
+		fprintf(fp, "MANAGEMENT_STATS_NP "
+			IFMT "admitted  %" PRIu64
+			IFMT "dropped   %" PRIu64
+			IFMT "overflows %" PRIu64
+			IFMT "sources   %u"
+			IFMT "limited   %u",
+			msn->admitted, msn->dropped, msn->overflows,
+			msn->sources, msn->limited);
+		break;
+	case TLV_HOLDOVER_NP:
+		hon = (struct holdover_np *) mgt->data;
+		fprintf(fp, "HOLDOVER_NP "
+			IFMT "active     %d"
+			IFMT "duration   %u"
+			IFMT "points     %u"
+			IFMT "frequency  %.3f"
+			IFMT "drift      %.3f"
+			IFMT "temp_coeff %.3f"
+			IFMT "error      %" PRId64,
+			hon->active, hon->duration, hon->points,
+			hon->frequency / 65536.0, hon->drift / 65536.0,
+			hon->temp_coeff / 65536.0, hon->error);
+		break;
 	case TLV_PORT_DATA_SET:
-		p = (struct portDS *) mgt->data;
-		if (p->portState > PS_SLAVE) {
-			p->portState = 0;
-		}
-		fprintf(fp, "PORT_DATA_SET "
-			IFMT "portIdentity            %s"
-			IFMT "portState               %s"
-			IFMT "logMinDelayReqInterval  %hhd"
-			IFMT "peerMeanPathDelay       %" PRId64
-			IFMT "logAnnounceInterval     %hhd"
-			IFMT "announceReceiptTimeout  %hhu"
-			IFMT "logSyncInterval         %hhd"
-			IFMT "delayMechanism          %hhu"
-			IFMT "logMinPdelayReqInterval %hhd"
-			IFMT "versionNumber           %hhu",
-			pid2str(&p->portIdentity), ps_str[p->portState],
-			p->logMinDelayReqInterval, p->peerMeanPathDelay >> 16,
-			p->logAnnounceInterval, p->announceReceiptTimeout,
-			p->logSyncInterval, p->delayMechanism,
-			p->logMinPdelayReqInterval, p->versionNumber);
+		show_port_ds(fp, (struct portDS *) mgt->data);
 		break;
 	case TLV_PORT_DATA_SET_NP:
 		pnp = (struct port_ds_np *) mgt->data;
@@ -494,6 +742,8 @@ static void do_set_action(int action, int index, char *str)
 {
 	struct grandmaster_settings_np gsn;
 	struct management_tlv_datum mtd;
+	struct tx_timestamp_stats_np tsn;
+	struct port_stats_np psn;
 	struct port_ds_np pnp;
 	int cnt, code = idtab[index].code;
 	int leap_61, leap_59, utc_off_valid;
@@ -589,12 +839,22 @@ static void do_set_action(int action, int index, char *str)
 		}
 		pmc_send_set_action(pmc, code, &pnp, sizeof(pnp));
 		break;
+	case TLV_PORT_STATS_NP:
+		/* The counters are reset, whatever the values. */
+		memset(&psn, 0, sizeof(psn));
+		pmc_send_set_action(pmc, code, &psn, sizeof(psn));
+		break;
+	case TLV_TX_TIMESTAMP_STATS_NP:
+		/* The statistics are reset, whatever the values. */
+		memset(&tsn, 0, sizeof(tsn));
+		pmc_send_set_action(pmc, code, &tsn, sizeof(tsn));
+		break;
 	}
 }
 
 static void not_supported(int action, int index, char *str)
 {
-	fprintf(stdout, "sorry, %s not supported yet\n", idtab[index].name);
+	fprintf(info_fp, "sorry, %s not supported yet\n", idtab[index].name);
 }
 
 static void null_management(int action, int index, char *str)
@@ -602,7 +862,7 @@ static void null_management(int action, int index, char *str)
 	if (action == GET)
 		pmc_send_get_action(pmc, idtab[index].code);
 	else
-		puts("non-get actions still todo");
+		fprintf(info_fp, "non-get actions still todo\n");
 }
 
 static int parse_action(char *s)
@@ -693,11 +953,11 @@ static int do_command(char *str)
 		return -1;
 
 	if (id == AMBIGUOUS_ID) {
-		fprintf(stdout, "id %s is too ambiguous\n", id_str);
+		fprintf(info_fp, "id %s is too ambiguous\n", id_str);
 		return 0;
 	}
 
-	fprintf(stdout, "sending: %s %s\n",
+	fprintf(info_fp, "sending: %s %s\n",
 		action_string[action], idtab[id].name);
 
 	idtab[id].func(action, id, str);
@@ -705,6 +965,455 @@ static int do_command(char *str)
 	return 0;
 }
 
+/*
+ * In the batch mode all commands are sent without waiting for the
+ * replies, each to every destination, and the replies are matched to
+ * the requests by their sequenceId.
+ */
+struct batch_request {
+	const char *command;
+	int dest;
+	int replies;
+};
+
+struct batch {
+	char **commands;
+	int num_commands;
+	struct address *dests;
+	char **dest_names;
+	int num_dests;
+	struct batch_request *req;
+	int num_req;
+	int answered;
+	UInteger16 first_seq;
+};
+
+static int64_t monotonic_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static const char *id2str(int code)
+{
+	static char buf[8];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(idtab); i++) {
+		if (idtab[i].code == code)
+			return idtab[i].name;
+	}
+	snprintf(buf, sizeof(buf), "0x%04hx", (uint16_t) code);
+	return buf;
+}
+
+static void json_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(fp, "\\%c", *str);
+		else if ((unsigned char) *str < 0x20)
+			fprintf(fp, "\\u%04x", *str);
+		else
+			fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+static int is_json_number(const char *str)
+{
+	if (*str == '-')
+		str++;
+	if (*str == '0' && str[1] >= '0' && str[1] <= '9')
+		return 0;
+	if (*str < '0' || *str > '9')
+		return 0;
+	while (*str >= '0' && *str <= '9')
+		str++;
+	if (*str == '.') {
+		str++;
+		if (*str < '0' || *str > '9')
+			return 0;
+		while (*str >= '0' && *str <= '9')
+			str++;
+	}
+	return *str == '\0';
+}
+
+static void json_value(FILE *fp, const char *str)
+{
+	if (!strcmp(str, "true") || !strcmp(str, "false") ||
+	    is_json_number(str))
+		fputs(str, fp);
+	else
+		json_string(fp, str);
+}
+
+/*
+ * Convert the fields printed by pmc_show() to a JSON object. Lines with
+ * a name and no value start a nested object, e.g. the data sets of the
+ * SNAPSHOT_NP response. Repeated names get a numeric suffix.
+ */
+#define MAX_SECTIONS 64
+
+static void json_data(FILE *fp, char *text)
+{
+	char *line, *key, *value, *end, *save, *sections[MAX_SECTIONS];
+	int i, first = 1, section = 0, num_sections = 0, count;
+
+	fprintf(fp, "{");
+	line = strtok_r(text, "\n", &save);
+	/* The first line is the header of the message. */
+	while ((line = strtok_r(NULL, "\n", &save))) {
+		key = line + strspn(line, " \t");
+		if (!*key)
+			continue;
+		value = key + strcspn(key, " \t");
+		if (*value)
+			*value++ = '\0';
+		value += strspn(value, " \t");
+		end = value + strlen(value);
+		while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+			*--end = '\0';
+
+		if (!*value) {
+			if (section)
+				fprintf(fp, "}");
+			fprintf(fp, "%s", first ? "" : ", ");
+			for (i = 0, count = 0; i < num_sections; i++) {
+				if (!strcmp(sections[i], key))
+					count++;
+			}
+			if (num_sections < MAX_SECTIONS)
+				sections[num_sections++] = key;
+			if (count)
+				fprintf(fp, "\"%s.%d\": {", key, count);
+			else
+				fprintf(fp, "\"%s\": {", key);
+			section = 1;
+			first = 1;
+			continue;
+		}
+		fprintf(fp, "%s\"%s\": ", first ? "" : ", ", key);
+		json_value(fp, value);
+		first = 0;
+	}
+	if (section)
+		fprintf(fp, "}");
+	fprintf(fp, "}");
+}
+
+static void show_json(struct batch *b, struct batch_request *req,
+		      struct ptp_message *msg, FILE *fp)
+{
+	struct management_error_status *mes;
+	struct management_tlv *mgt;
+	char *text = NULL;
+	size_t len;
+	FILE *mf;
+
+	fprintf(fp, "{");
+	if (req) {
+		fprintf(fp, "\"command\": ");
+		json_string(fp, req->command);
+		if (req->dest >= 0) {
+			fprintf(fp, ", \"address\": ");
+			json_string(fp, b->dest_names[req->dest]);
+		}
+		fprintf(fp, ", ");
+	}
+	fprintf(fp, "\"source\": \"%s\", \"seq\": %hu, \"action\": \"%s\"",
+		pid2str(&msg->header.sourcePortIdentity),
+		msg->header.sequenceId,
+		action_string[management_action(msg)]);
+	if (msg->tlv_count != 1)
+		goto out;
+
+	mgt = (struct management_tlv *) msg->management.suffix;
+	if (mgt->type == TLV_MANAGEMENT_ERROR_STATUS) {
+		mes = (struct management_error_status *) mgt;
+		fprintf(fp, ", \"id\": \"%s\", \"error\": %hu",
+			id2str(mes->id), mes->error);
+		goto out;
+	}
+	if (mgt->type != TLV_MANAGEMENT)
+		goto out;
+	fprintf(fp, ", \"id\": \"%s\"", id2str(mgt->id));
+
+	mf = open_memstream(&text, &len);
+	if (!mf)
+		goto out;
+	pmc_show(msg, mf);
+	fclose(mf);
+	fprintf(fp, ", \"data\": ");
+	json_data(fp, text);
+	free(text);
+out:
+	fprintf(fp, "}\n");
+	fflush(fp);
+}
+
+static void show_no_reply(struct batch *b, struct batch_request *req)
+{
+	if (json_output) {
+		fprintf(stdout, "{\"command\": ");
+		json_string(stdout, req->command);
+		if (req->dest >= 0) {
+			fprintf(stdout, ", \"address\": ");
+			json_string(stdout, b->dest_names[req->dest]);
+		}
+		fprintf(stdout, ", \"seq\": %hu, \"error\": \"timeout\"}\n",
+			(UInteger16) (b->first_seq + (req - b->req)));
+	} else if (req->dest >= 0) {
+		fprintf(stderr, "no reply from %s: %s\n",
+			b->dest_names[req->dest], req->command);
+	} else {
+		fprintf(stderr, "no reply: %s\n", req->command);
+	}
+}
+
+static void batch_recv(struct batch *b)
+{
+	struct batch_request *req = NULL;
+	struct ptp_message *msg;
+	int action, index;
+
+	msg = pmc_recv(pmc);
+	if (!msg)
+		return;
+	if (msg_type(msg) != MANAGEMENT)
+		goto out;
+	action = management_action(msg);
+	if (action != RESPONSE && action != ACKNOWLEDGE) {
+		if (!json_output)
+			pmc_show(msg, stdout);
+		goto out;
+	}
+	index = (UInteger16) (msg->header.sequenceId - b->first_seq);
+	if (index < b->num_req) {
+		req = &b->req[index];
+		if (!req->replies++)
+			b->answered++;
+	}
+	if (json_output)
+		show_json(b, req, msg, stdout);
+	else
+		pmc_show(msg, stdout);
+out:
+	msg_put(msg);
+}
+
+static void batch_send(struct batch *b, int cmd, int dest)
+{
+	struct batch_request *req;
+	UInteger16 seq;
+	int err;
+
+	if (dest >= 0)
+		pmc_destination(pmc, &b->dests[dest]);
+	seq = pmc_sequence_id(pmc);
+	err = do_command(b->commands[cmd]);
+	if (err && dest <= 0) {
+		if (json_output) {
+			fprintf(stdout, "{\"command\": ");
+			json_string(stdout, b->commands[cmd]);
+			fprintf(stdout, ", \"error\": \"bad command\"}\n");
+		} else {
+			fprintf(stderr, "bad command: %s\n", b->commands[cmd]);
+		}
+	}
+	if (seq == pmc_sequence_id(pmc))
+		return;
+	req = &b->req[b->num_req++];
+	req->command = b->commands[cmd];
+	req->dest = dest;
+	req->replies = 0;
+}
+
+static int run_batch(struct batch *b, int timeout, int unicast)
+{
+	int cnt, cmd = 0, dest = 0, i, ret = 0, tmo;
+	int64_t last_send = 0, last_reply = 0, now;
+	struct pollfd pollfd;
+
+	cnt = b->num_commands * (b->num_dests ? b->num_dests : 1);
+	if (cnt > 65536) {
+		fprintf(stderr, "too many requests, at most 65536 allowed\n");
+		return -1;
+	}
+	b->req = calloc(cnt ? cnt : 1, sizeof(*b->req));
+	if (!b->req) {
+		fprintf(stderr, "low memory\n");
+		return -1;
+	}
+	b->first_seq = pmc_sequence_id(pmc);
+
+	pollfd.fd = pmc_get_transport_fd(pmc);
+
+	while (is_running()) {
+		pollfd.events = POLLIN | POLLPRI;
+		if (cmd < b->num_commands) {
+			pollfd.events |= POLLOUT;
+			tmo = -1;
+		} else {
+			now = monotonic_ms();
+			tmo = last_send + timeout - now;
+			/*
+			 * Unlike the multicast messages, which may be answered
+			 * by any number of clocks, the unicast requests are
+			 * complete with their first replies.
+			 */
+			if (unicast && b->answered == b->num_req &&
+			    tmo > last_reply + BATCH_LINGER - now)
+				tmo = last_reply + BATCH_LINGER - now;
+			if (tmo < 0)
+				tmo = 0;
+		}
+
+		cnt = poll(&pollfd, 1, tmo);
+		if (cnt < 0) {
+			if (EINTR == errno) {
+				continue;
+			} else {
+				pr_emerg("poll failed");
+				ret = -1;
+				break;
+			}
+		} else if (!cnt) {
+			break;
+		}
+		if (pollfd.revents & (POLLIN|POLLPRI)) {
+			batch_recv(b);
+			last_reply = monotonic_ms();
+		}
+		if (pollfd.revents & POLLOUT) {
+			batch_send(b, cmd, b->num_dests ? dest : -1);
+			if (++dest >= b->num_dests) {
+				dest = 0;
+				cmd++;
+			}
+			last_send = monotonic_ms();
+		}
+	}
+
+	for (i = 0; i < b->num_req; i++) {
+		if (!b->req[i].replies)
+			show_no_reply(b, &b->req[i]);
+	}
+	free(b->req);
+	return ret;
+}
+
+static int read_commands(struct batch *b, const char *path)
+{
+	char line[1024], *cmd, **commands;
+	int length;
+	FILE *fp;
+
+	fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!fp) {
+		fprintf(stderr, "failed to open %s: %m\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		length = strlen(line);
+		if (length && line[length - 1] == '\n')
+			line[--length] = '\0';
+		cmd = line + strspn(line, " \t");
+		if (!*cmd || *cmd == '#')
+			continue;
+		commands = realloc(b->commands,
+				   (b->num_commands + 1) * sizeof(*commands));
+		if (!commands)
+			goto nomem;
+		b->commands = commands;
+		b->commands[b->num_commands] = strdup(cmd);
+		if (!b->commands[b->num_commands])
+			goto nomem;
+		b->num_commands++;
+	}
+	if (fp != stdin)
+		fclose(fp);
+	return 0;
+nomem:
+	fprintf(stderr, "low memory\n");
+	if (fp != stdin)
+		fclose(fp);
+	return -1;
+}
+
+static int add_commands(struct batch *b, char **cmds, int num)
+{
+	char **commands;
+	int i;
+
+	if (!num)
+		return 0;
+	commands = realloc(b->commands,
+			   (b->num_commands + num) * sizeof(*commands));
+	if (!commands)
+		goto nomem;
+	b->commands = commands;
+	for (i = 0; i < num; i++) {
+		b->commands[b->num_commands] = strdup(cmds[i]);
+		if (!b->commands[b->num_commands])
+			goto nomem;
+		b->num_commands++;
+	}
+	return 0;
+nomem:
+	fprintf(stderr, "low memory\n");
+	return -1;
+}
+
+static int add_destination(struct batch *b, char *name,
+			   enum transport_type type)
+{
+	struct address addr, *dests;
+	char **names;
+
+	memset(&addr, 0, sizeof(addr));
+	switch (type) {
+	case TRANS_UDP_IPV4:
+		addr.sin.sin_family = AF_INET;
+		addr.len = sizeof(addr.sin);
+		if (inet_pton(AF_INET, name, &addr.sin.sin_addr) != 1)
+			goto bad;
+		break;
+	case TRANS_UDP_IPV6:
+		addr.sin6.sin6_family = AF_INET6;
+		addr.len = sizeof(addr.sin6);
+		if (inet_pton(AF_INET6, name, &addr.sin6.sin6_addr) != 1)
+			goto bad;
+		break;
+	default:
+		fprintf(stderr, "destination addresses need a UDP transport\n");
+		return -1;
+	}
+
+	dests = realloc(b->dests, (b->num_dests + 1) * sizeof(*dests));
+	if (!dests)
+		goto nomem;
+	b->dests = dests;
+	names = realloc(b->dest_names, (b->num_dests + 1) * sizeof(*names));
+	if (!names)
+		goto nomem;
+	b->dest_names = names;
+	b->dests[b->num_dests] = addr;
+	b->dest_names[b->num_dests] = name;
+	b->num_dests++;
+	return 0;
+bad:
+	fprintf(stderr, "bad address %s\n", name);
+	return -1;
+nomem:
+	fprintf(stderr, "low memory\n");
+	return -1;
+}
+
 static void usage(char *progname)
 {
 	fprintf(stderr,
@@ -714,6 +1423,11 @@ static void usage(char *progname)
 		" -4        UDP IPV4 (default)\n"
 		" -6        UDP IPV6\n"
 		" -u        UDS local\n\n"
+		" Batch Mode\n\n"
+		" -a [addr] send the commands to this address, may be repeated\n"
+		" -f [file] read the commands from the file, '-' for stdin\n"
+		" -j        print the replies as JSON lines\n"
+		" -w [ms]   time to wait for the replies, default 100\n\n"
 		" Other Options\n\n"
 		" -b [num]  boundary hops, default 1\n"
 		" -d [num]  domain number, default 0\n"
@@ -730,11 +1444,12 @@ static void usage(char *progname)
 
 int main(int argc, char *argv[])
 {
-	const char *iface_name = NULL;
-	char *progname;
-	int c, cnt, length, tmo = -1, batch_mode = 0, zero_datalen = 0;
-	int ret = 0;
+	const char *iface_name = NULL, *batch_file = NULL;
+	char *progname, **dest_args = NULL;
+	int c, cnt, i, length, tmo = -1, batch_mode = 0, zero_datalen = 0;
+	int num_dest_args = 0, timeout = 100, ret = 0;
 	char line[1024], *command = NULL, uds_local[MAX_IFNAME_SIZE + 1];
+	struct batch batch;
 	enum transport_type transport_type = TRANS_UDP_IPV4;
 	UInteger8 boundary_hops = 1, domain_number = 0, transport_specific = 0;
 	struct ptp_message *msg;
@@ -743,16 +1458,23 @@ int main(int argc, char *argv[])
 	struct pollfd pollfd[N_FD];
 
 	handle_term_signals();
+	info_fp = stdout;
+	memset(&batch, 0, sizeof(batch));
 
 	cfg = config_create();
 	if (!cfg) {
 		return -1;
 	}
+	dest_args = calloc(argc, sizeof(*dest_args));
+	if (!dest_args) {
+		config_destroy(cfg);
+		return -1;
+	}
 
 	/* Process the command line arguments. */
 	progname = strrchr(argv[0], '/');
 	progname = progname ? 1+progname : argv[0];
-	while (EOF != (c = getopt(argc, argv, "246u""b:d:hi:s:t:vz"))) {
+	while (EOF != (c = getopt(argc, argv, "246u""a:b:d:f:hi:js:t:vw:z"))) {
 		switch (c) {
 		case '2':
 			transport_type = TRANS_IEEE_802_3;
@@ -766,15 +1488,27 @@ int main(int argc, char *argv[])
 		case 'u':
 			transport_type = TRANS_UDS;
 			break;
+		case 'a':
+			dest_args[num_dest_args++] = optarg;
+			batch_mode = 1;
+			break;
 		case 'b':
 			boundary_hops = atoi(optarg);
 			break;
 		case 'd':
 			domain_number = atoi(optarg);
 			break;
+		case 'f':
+			batch_file = optarg;
+			batch_mode = 1;
+			break;
 		case 'i':
 			iface_name = optarg;
 			break;
+		case 'j':
+			json_output = 1;
+			batch_mode = 1;
+			break;
 		case 's':
 			if (strlen(optarg) > MAX_IFNAME_SIZE) {
 				fprintf(stderr, "path %s too long, max is %d\n",
@@ -795,6 +1529,14 @@ int main(int argc, char *argv[])
 			version_show(stdout);
 			config_destroy(cfg);
 			return 0;
+		case 'w':
+			timeout = atoi(optarg);
+			if (timeout < 0) {
+				fprintf(stderr, "bad timeout %s\n", optarg);
+				config_destroy(cfg);
+				return -1;
+			}
+			break;
 		case 'z':
 			zero_datalen = 1;
 			break;
@@ -822,6 +1564,26 @@ int main(int argc, char *argv[])
 	if (optind < argc) {
 		batch_mode = 1;
 	}
+	for (i = 0; i < num_dest_args; i++) {
+		if (add_destination(&batch, dest_args[i], transport_type)) {
+			ret = -1;
+			goto out;
+		}
+	}
+	if (batch_mode) {
+		if ((batch_file || optind == argc) &&
+		    read_commands(&batch, batch_file ? batch_file : "-")) {
+			ret = -1;
+			goto out;
+		}
+		if (add_commands(&batch, argv + optind, argc - optind)) {
+			ret = -1;
+			goto out;
+		}
+	}
+	if (json_output) {
+		info_fp = stderr;
+	}
 
 	print_set_progname(progname);
 	print_set_syslog(1);
@@ -831,28 +1593,24 @@ int main(int argc, char *argv[])
 			 domain_number, transport_specific, zero_datalen);
 	if (!pmc) {
 		fprintf(stderr, "failed to create pmc\n");
-		config_destroy(cfg);
-		return -1;
+		ret = -1;
+		goto out;
+	}
+
+	if (batch_mode) {
+		ret = run_batch(&batch, timeout,
+				transport_type == TRANS_UDS || batch.num_dests);
+		goto destroy;
 	}
 
-	pollfd[0].fd = batch_mode ? -1 : STDIN_FILENO;
+	pollfd[0].fd = STDIN_FILENO;
 	pollfd[1].fd = pmc_get_transport_fd(pmc);
 
 	while (is_running()) {
-		if (batch_mode && !command) {
-			if (optind < argc) {
-				command = argv[optind++];
-			} else {
-				/* No more commands, wait a bit for
-				   any outstanding replies and exit. */
-				tmo = 100;
-			}
-		}
-
 		pollfd[0].events = 0;
 		pollfd[1].events = POLLIN | POLLPRI;
 
-		if (!batch_mode && !command)
+		if (!command)
 			pollfd[0].events |= POLLIN | POLLPRI;
 		if (command)
 			pollfd[1].events |= POLLOUT;
@@ -872,7 +1630,7 @@ int main(int argc, char *argv[])
 		if (pollfd[0].revents & POLLHUP) {
 			if (tmo == -1) {
 				/* Wait a bit longer for outstanding replies. */
-				tmo = 100;
+				tmo = timeout;
 				pollfd[0].fd = -1;
 				pollfd[0].events = 0;
 			} else {
@@ -904,9 +1662,17 @@ int main(int argc, char *argv[])
 			}
 		}
 	}
-
+destroy:
 	pmc_destroy(pmc);
 	msg_cleanup();
+out:
+	for (i = 0; i < batch.num_commands; i++) {
+		free(batch.commands[i]);
+	}
+	free(batch.commands);
+	free(batch.dests);
+	free(batch.dest_names);
+	free(dest_args);
 	config_destroy(cfg);
 	return ret;
 }
@@ -0,0 +1,420 @@
+/**
+ * @file pmc_client.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "msg.h"
+#include "pmc_client.h"
+#include "pmc_common.h"
+#include "print.h"
+
+#define DEFAULT_TIMEOUT		1000 /* milliseconds */
+/* The messages received in one call, so that a flood cannot starve the loop. */
+#define MAX_BURST		64
+
+struct pmc_request {
+	LIST_ENTRY(pmc_request) list;
+	UInteger16 sequence_id;
+	int id;
+	uint64_t deadline;
+	pmc_client_cb cb;
+	void *ctx;
+	/* Only report the errors, used for the subscription. */
+	int errors_only;
+};
+
+struct pmc_client {
+	struct config *cfg;
+	struct pmc *pmc;
+	LIST_HEAD(, pmc_request) requests;
+	int timeout;
+	UInteger16 target_port;
+
+	struct subscribe_events_np sen;
+	uint64_t renew; /* zero if not subscribed */
+	pmc_client_cb notify_cb;
+	void *notify_ctx;
+};
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+struct pmc_client *pmc_client_create(const char *server,
+				     UInteger8 domain_number)
+{
+	char uds_local[MAX_IFNAME_SIZE + 1];
+	static unsigned int instance;
+	struct pmc_client *pc;
+	struct PortIdentity pid;
+	pid_t self = getpid();
+
+	pc = calloc(1, sizeof(*pc));
+	if (!pc)
+		return NULL;
+	LIST_INIT(&pc->requests);
+	pc->timeout = DEFAULT_TIMEOUT;
+	pc->target_port = 0xffff;
+
+	pc->cfg = config_create();
+	if (!pc->cfg)
+		goto failed;
+	if (server && config_set_string(pc->cfg, "uds_address", server))
+		goto failed;
+
+	instance++;
+	snprintf(uds_local, sizeof(uds_local), "/var/run/pmc_client.%d.%u",
+		 self, instance);
+	pc->pmc = pmc_create(pc->cfg, TRANS_UDS, uds_local, 0, domain_number,
+			     0, 1);
+	if (!pc->pmc)
+		goto failed;
+
+	/* Make the source unique, so that each client gets its own
+	   subscription from the server. */
+	memset(&pid, 0, sizeof(pid));
+	memcpy(pid.clockIdentity.id, &self, sizeof(self));
+	pid.portNumber = instance;
+	pmc_source(pc->pmc, &pid);
+
+	return pc;
+failed:
+	if (pc->cfg)
+		config_destroy(pc->cfg);
+	free(pc);
+	return NULL;
+}
+
+void pmc_client_destroy(struct pmc_client *pc)
+{
+	struct pmc_request *r;
+
+	while ((r = LIST_FIRST(&pc->requests))) {
+		LIST_REMOVE(r, list);
+		free(r);
+	}
+	pmc_destroy(pc->pmc);
+	config_destroy(pc->cfg);
+	free(pc);
+}
+
+int pmc_client_fd(struct pmc_client *pc)
+{
+	return pmc_get_transport_fd(pc->pmc);
+}
+
+int pmc_client_timeout(struct pmc_client *pc)
+{
+	uint64_t next = pc->renew, now;
+	struct pmc_request *r;
+
+	LIST_FOREACH(r, &pc->requests, list) {
+		if (!next || r->deadline < next)
+			next = r->deadline;
+	}
+	if (!next)
+		return -1;
+	now = now_ms();
+	return next > now ? next - now : 0;
+}
+
+void pmc_client_set_timeout(struct pmc_client *pc, int timeout)
+{
+	pc->timeout = timeout;
+}
+
+void pmc_client_target_port(struct pmc_client *pc, UInteger16 port_number)
+{
+	pc->target_port = port_number;
+	pmc_target_port(pc->pmc, port_number);
+}
+
+static void drop_request(struct pmc_request *r)
+{
+	LIST_REMOVE(r, list);
+	free(r);
+}
+
+/* Send a GET request if data is NULL, a SET request otherwise. */
+static int send_request(struct pmc_client *pc, int id, void *data, int size,
+			pmc_client_cb cb, void *ctx, int errors_only)
+{
+	struct pmc_request *r;
+	int err;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -1;
+	r->sequence_id = pmc_sequence_id(pc->pmc);
+	r->id = id;
+	r->deadline = now_ms() + pc->timeout;
+	r->cb = cb;
+	r->ctx = ctx;
+	r->errors_only = errors_only;
+	LIST_INSERT_HEAD(&pc->requests, r, list);
+
+	if (data)
+		err = pmc_send_set_action(pc->pmc, id, data, size);
+	else
+		err = pmc_send_get_action(pc->pmc, id);
+	if (err) {
+		drop_request(r);
+		return -1;
+	}
+	return r->sequence_id;
+}
+
+int pmc_client_get(struct pmc_client *pc, int id, pmc_client_cb cb, void *ctx)
+{
+	return send_request(pc, id, NULL, 0, cb, ctx, 0);
+}
+
+int pmc_client_set(struct pmc_client *pc, int id, void *data, int size,
+		   pmc_client_cb cb, void *ctx)
+{
+	return send_request(pc, id, data, size, cb, ctx, 0);
+}
+
+void pmc_client_cancel(struct pmc_client *pc, int sequence_id)
+{
+	struct pmc_request *r;
+
+	LIST_FOREACH(r, &pc->requests, list) {
+		if (r->sequence_id == sequence_id) {
+			drop_request(r);
+			return;
+		}
+	}
+}
+
+static int send_subscription(struct pmc_client *pc)
+{
+	int seq;
+
+	/* The subscription belongs to the clock, not to a port. */
+	pmc_target_port(pc->pmc, 0xffff);
+	seq = send_request(pc, TLV_SUBSCRIBE_EVENTS_NP, &pc->sen,
+			   sizeof(pc->sen), pc->notify_cb, pc->notify_ctx, 1);
+	pmc_target_port(pc->pmc, pc->target_port);
+	return seq < 0 ? -1 : 0;
+}
+
+int pmc_client_subscribe(struct pmc_client *pc, unsigned int events,
+			 int duration, pmc_client_cb cb, void *ctx)
+{
+	int i;
+
+	if (events && (duration < 1 || duration > UINT16_MAX))
+		return -1;
+
+	memset(&pc->sen, 0, sizeof(pc->sen));
+	pc->sen.duration = duration;
+	for (i = 0; i < NOTIFY_EVENT_CNT; i++) {
+		if (events & (1U << i))
+			pc->sen.bitmask[i / 8] |= 1 << (i % 8);
+	}
+	pc->notify_cb = cb;
+	pc->notify_ctx = ctx;
+	pc->renew = events ? now_ms() + duration * 1000ULL / 2 : 0;
+
+	return send_subscription(pc);
+}
+
+static int dispatch(struct pmc_client *pc, struct ptp_message *msg)
+{
+	struct management_error_status *mes;
+	struct pmc_client_response rsp;
+	struct management_tlv *mgt;
+	struct pmc_request *r;
+	struct TLV *tlv;
+
+	if (msg_type(msg) != MANAGEMENT ||
+	    management_action(msg) != RESPONSE || msg->tlv_count != 1)
+		return 0;
+
+	memset(&rsp, 0, sizeof(rsp));
+	rsp.sequence_id = msg->header.sequenceId;
+	rsp.source = msg->header.sourcePortIdentity;
+
+	tlv = (struct TLV *) msg->management.suffix;
+	switch (tlv->type) {
+	case TLV_MANAGEMENT:
+		mgt = (struct management_tlv *) msg->management.suffix;
+		rsp.id = mgt->id;
+		if (mgt->length > sizeof(mgt->id))
+			rsp.data = mgt->data;
+		break;
+	case TLV_MANAGEMENT_ERROR_STATUS:
+		mes = (struct management_error_status *) msg->management.suffix;
+		rsp.id = mes->id;
+		rsp.status = mes->error;
+		break;
+	default:
+		return 0;
+	}
+
+	LIST_FOREACH(r, &pc->requests, list) {
+		if (r->sequence_id == rsp.sequence_id && r->id == rsp.id)
+			break;
+	}
+	if (r) {
+		pmc_client_cb cb = r->cb;
+		void *ctx = r->ctx;
+
+		/* The callback may send new requests. */
+		if (r->errors_only && !rsp.status)
+			cb = NULL;
+		drop_request(r);
+		if (!cb)
+			return 0;
+		cb(ctx, &rsp);
+		return 1;
+	}
+
+	/* Anything else coming from the server is a notification. */
+	if (!pc->renew || !pc->notify_cb || rsp.status)
+		return 0;
+	rsp.notification = 1;
+	pc->notify_cb(pc->notify_ctx, &rsp);
+	return 1;
+}
+
+static int expire(struct pmc_client *pc, uint64_t now)
+{
+	struct pmc_client_response rsp;
+	struct pmc_request *r;
+	pmc_client_cb cb;
+	int cnt = 0;
+	void *ctx;
+
+	/* Start over after each callback, which may change the list. */
+	while (1) {
+		LIST_FOREACH(r, &pc->requests, list) {
+			if (r->deadline <= now)
+				break;
+		}
+		if (!r)
+			return cnt;
+		memset(&rsp, 0, sizeof(rsp));
+		rsp.id = r->id;
+		rsp.status = -ETIMEDOUT;
+		rsp.sequence_id = r->sequence_id;
+		cb = r->cb;
+		ctx = r->ctx;
+		drop_request(r);
+		if (cb) {
+			cb(ctx, &rsp);
+			cnt++;
+		}
+	}
+}
+
+int pmc_client_process(struct pmc_client *pc)
+{
+	struct ptp_message *msg;
+	struct pollfd pfd;
+	int cnt = 0, i;
+	uint64_t now;
+
+	pfd.fd = pmc_client_fd(pc);
+	pfd.events = POLLIN;
+	for (i = 0; i < MAX_BURST; i++) {
+		if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN))
+			break;
+		msg = pmc_recv(pc->pmc);
+		if (!msg)
+			continue;
+		cnt += dispatch(pc, msg);
+		msg_put(msg);
+	}
+	if (pfd.revents & (POLLERR | POLLNVAL))
+		return -1;
+
+	now = now_ms();
+	cnt += expire(pc, now);
+	if (pc->renew && pc->renew <= now) {
+		pc->renew = now + pc->sen.duration * 1000ULL / 2;
+		send_subscription(pc);
+	}
+	return cnt;
+}
+
+static const void *dataset(const struct pmc_client_response *r, int id)
+{
+	return r->id == id ? r->data : NULL;
+}
+
+const struct defaultDS *pmc_client_default_ds(const struct pmc_client_response *r)
+{
+	return dataset(r, TLV_DEFAULT_DATA_SET);
+}
+
+const struct currentDS *pmc_client_current_ds(const struct pmc_client_response *r)
+{
+	return dataset(r, TLV_CURRENT_DATA_SET);
+}
+
+const struct parentDS *pmc_client_parent_ds(const struct pmc_client_response *r)
+{
+	return dataset(r, TLV_PARENT_DATA_SET);
+}
+
+const struct timePropertiesDS *
+pmc_client_time_properties_ds(const struct pmc_client_response *r)
+{
+	return dataset(r, TLV_TIME_PROPERTIES_DATA_SET);
+}
+
+const struct portDS *pmc_client_port_ds(const struct pmc_client_response *r)
+{
+	return dataset(r, TLV_PORT_DATA_SET);
+}
+
+const struct port_ds_np *pmc_client_port_ds_np(const struct pmc_client_response *r)
+{
+	return dataset(r, TLV_PORT_DATA_SET_NP);
+}
+
+const struct time_status_np *
+pmc_client_time_status_np(const struct pmc_client_response *r)
+{
+	return dataset(r, TLV_TIME_STATUS_NP);
+}
+
+const struct sync_sample_np *
+pmc_client_sync_sample_np(const struct pmc_client_response *r)
+{
+	return dataset(r, TLV_SYNC_SAMPLE_NP);
+}
+
+const struct holdover_np *pmc_client_holdover_np(const struct pmc_client_response *r)
+{
+	return dataset(r, TLV_HOLDOVER_NP);
+}
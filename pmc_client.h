@@ -0,0 +1,203 @@
+/**
+ * @file pmc_client.h
+ * @brief Non-blocking PTP management client for use in an event loop.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_PMC_CLIENT_H
+#define HAVE_PMC_CLIENT_H
+
+#include "ddt.h"
+#include "notification.h"
+#include "tlv.h"
+
+/*
+ * The client talks to ptp4l over its UNIX domain socket. It never
+ * blocks: the caller polls the descriptor returned by pmc_client_fd()
+ * for input, with the timeout returned by pmc_client_timeout(), and
+ * calls pmc_client_process() when either of them fires. The responses
+ * and the notifications are passed to the callbacks given with the
+ * requests, from within pmc_client_process().
+ *
+ * A typical loop looks like this:
+ *
+ *	pc = pmc_client_create(NULL, 0);
+ *	pmc_client_subscribe(pc, 1 << NOTIFY_PORT_STATE, 60, port_cb, ctx);
+ *	pmc_client_get(pc, TLV_TIME_STATUS_NP, status_cb, ctx);
+ *	while (1) {
+ *		pfd.fd = pmc_client_fd(pc);
+ *		pfd.events = POLLIN;
+ *		poll(&pfd, 1, pmc_client_timeout(pc));
+ *		pmc_client_process(pc);
+ *	}
+ */
+
+/** Opaque type */
+struct pmc_client;
+
+/**
+ * A response to a request, a notification, or the failure of a request.
+ */
+struct pmc_client_response {
+	/** The management ID, e.g. TLV_DEFAULT_DATA_SET. */
+	int id;
+	/**
+	 * Zero on success, the managementErrorId of a MANAGEMENT_ERROR_STATUS
+	 * returned by the server, or -ETIMEDOUT if no response came in time.
+	 */
+	int status;
+	/** Non-zero if the data set was pushed by a subscription. */
+	int notification;
+	/** The sequenceId of the request, or of the notification. */
+	UInteger16 sequence_id;
+	/** The port which sent the response. */
+	struct PortIdentity source;
+	/**
+	 * The data set in host byte order, or NULL if status is not zero.
+	 * It is only valid during the callback. Use the typed accessors
+	 * below rather than casting it.
+	 */
+	const void *data;
+};
+
+/**
+ * Callback invoked for responses and notifications.
+ * @param ctx  The context pointer given with the request.
+ * @param rsp  The response.
+ */
+typedef void (*pmc_client_cb)(void *ctx, const struct pmc_client_response *rsp);
+
+/**
+ * Create a client and open its socket.
+ * @param server         The path of the socket of ptp4l, or NULL for the
+ *                       default /var/run/ptp4l.
+ * @param domain_number  The domain number of the requests.
+ * @return A pointer to a new client on success, NULL otherwise.
+ */
+struct pmc_client *pmc_client_create(const char *server,
+				     UInteger8 domain_number);
+
+/**
+ * Destroy a client. The pending requests are dropped without calling
+ * their callbacks and the subscription is left to expire.
+ * @param pc  A pointer obtained via pmc_client_create().
+ */
+void pmc_client_destroy(struct pmc_client *pc);
+
+/**
+ * Get the descriptor to poll for input.
+ * @param pc  A pointer obtained via pmc_client_create().
+ * @return The file descriptor of the socket.
+ */
+int pmc_client_fd(struct pmc_client *pc);
+
+/**
+ * Get the time until pmc_client_process() needs to be called even if
+ * no input arrives, to expire requests and renew the subscription.
+ * @param pc  A pointer obtained via pmc_client_create().
+ * @return The timeout in milliseconds, or -1 if there is nothing to wait
+ *         for, suitable for poll().
+ */
+int pmc_client_timeout(struct pmc_client *pc);
+
+/**
+ * Receive the pending messages, pass them to the callbacks, and expire
+ * the requests which timed out. This never blocks.
+ * @param pc  A pointer obtained via pmc_client_create().
+ * @return The number of callbacks invoked, or -1 on a socket error.
+ */
+int pmc_client_process(struct pmc_client *pc);
+
+/**
+ * Set the time to wait for a response before a request fails with
+ * -ETIMEDOUT. The default is 1000 milliseconds.
+ * @param pc       A pointer obtained via pmc_client_create().
+ * @param timeout  The timeout in milliseconds.
+ */
+void pmc_client_set_timeout(struct pmc_client *pc, int timeout);
+
+/**
+ * Select the port the following requests are sent to.
+ * @param pc           A pointer obtained via pmc_client_create().
+ * @param port_number  The number of the port, or 0xffff for all ports.
+ */
+void pmc_client_target_port(struct pmc_client *pc, UInteger16 port_number);
+
+/**
+ * Send a GET request.
+ * @param pc   A pointer obtained via pmc_client_create().
+ * @param id   The management ID of the data set.
+ * @param cb   The callback to invoke with the response, once.
+ * @param ctx  A pointer passed to the callback.
+ * @return The sequenceId of the request, or -1 on error.
+ */
+int pmc_client_get(struct pmc_client *pc, int id, pmc_client_cb cb, void *ctx);
+
+/**
+ * Send a SET request.
+ * @param pc    A pointer obtained via pmc_client_create().
+ * @param id    The management ID of the data set.
+ * @param data  The data set in host byte order.
+ * @param size  The size of the data set.
+ * @param cb    The callback to invoke with the response, once, or NULL.
+ * @param ctx   A pointer passed to the callback.
+ * @return The sequenceId of the request, or -1 on error.
+ */
+int pmc_client_set(struct pmc_client *pc, int id, void *data, int size,
+		   pmc_client_cb cb, void *ctx);
+
+/**
+ * Drop a pending request without calling its callback.
+ * @param pc           A pointer obtained via pmc_client_create().
+ * @param sequence_id  The value returned by pmc_client_get() or
+ *                     pmc_client_set().
+ */
+void pmc_client_cancel(struct pmc_client *pc, int sequence_id);
+
+/**
+ * Subscribe to events. The subscription is renewed by the client at half
+ * of its duration until it is replaced or cancelled. A failure of the
+ * subscription request is passed to the callback with the id
+ * TLV_SUBSCRIBE_EVENTS_NP.
+ * @param pc        A pointer obtained via pmc_client_create().
+ * @param events    A mask of (1 << NOTIFY_*) bits, or zero to unsubscribe.
+ * @param duration  The duration of the subscription in seconds, from 1 to
+ *                  65535, ignored when unsubscribing.
+ * @param cb        The callback to invoke with the notifications.
+ * @param ctx       A pointer passed to the callback.
+ * @return Zero on success, -1 on error.
+ */
+int pmc_client_subscribe(struct pmc_client *pc, unsigned int events,
+			 int duration, pmc_client_cb cb, void *ctx);
+
+/*
+ * Typed access to the data sets. Each function returns NULL if the
+ * response does not carry the data set of that type.
+ */
+const struct defaultDS *pmc_client_default_ds(const struct pmc_client_response *r);
+const struct currentDS *pmc_client_current_ds(const struct pmc_client_response *r);
+const struct parentDS *pmc_client_parent_ds(const struct pmc_client_response *r);
+const struct timePropertiesDS *
+pmc_client_time_properties_ds(const struct pmc_client_response *r);
+const struct portDS *pmc_client_port_ds(const struct pmc_client_response *r);
+const struct port_ds_np *pmc_client_port_ds_np(const struct pmc_client_response *r);
+const struct time_status_np *
+pmc_client_time_status_np(const struct pmc_client_response *r);
+const struct sync_sample_np *
+pmc_client_sync_sample_np(const struct pmc_client_response *r);
+const struct holdover_np *pmc_client_holdover_np(const struct pmc_client_response *r);
+
+#endif
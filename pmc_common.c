@@ -59,6 +59,9 @@ struct pmc {
 	struct transport *transport;
 	struct fdarray fdarray;
 	int zero_length_gets;
+	/* Unicast destination, used instead of the default address if set */
+	struct address destination;
+	int unicast;
 };
 
 struct pmc *pmc_create(struct config *cfg, enum transport_type transport_type,
@@ -151,6 +154,10 @@ static int pmc_send(struct pmc *pmc, struct ptp_message *msg, int pdulen)
 		pr_err("msg_pre_send failed");
 		return -1;
 	}
+	if (pmc->unicast) {
+		msg->address = pmc->destination;
+		return transport_sendto(pmc->transport, &pmc->fdarray, 0, msg);
+	}
 	return transport_send(pmc->transport, &pmc->fdarray, 0, msg);
 }
 
@@ -192,6 +199,36 @@ static int pmc_tlv_datalen(struct pmc *pmc, int id)
 	case TLV_GRANDMASTER_SETTINGS_NP:
 		len += sizeof(struct grandmaster_settings_np);
 		break;
+	case TLV_MSG_POOL_STATS_NP:
+		len += sizeof(struct msg_pool_stats_np);
+		break;
+	case TLV_CLOCK_STATS_NP:
+		len += sizeof(struct clock_stats_np);
+		break;
+	case TLV_HOLDOVER_NP:
+		len += sizeof(struct holdover_np);
+		break;
+	case TLV_SNAPSHOT_NP:
+		len += sizeof(struct snapshot_np);
+		break;
+	case TLV_SYNC_SAMPLE_NP:
+		len += sizeof(struct sync_sample_np);
+		break;
+	case TLV_MANAGEMENT_STATS_NP:
+		len += sizeof(struct management_stats_np);
+		break;
+	case TLV_CPU_STATS_NP:
+		len += sizeof(struct cpu_stats_np);
+		break;
+	case TLV_PERF_STATS_NP:
+		len += sizeof(struct perf_stats_np);
+		break;
+	case TLV_PORT_STATS_NP:
+		len += sizeof(struct port_stats_np);
+		break;
+	case TLV_TX_TIMESTAMP_STATS_NP:
+		len += sizeof(struct tx_timestamp_stats_np);
+		break;
 	case TLV_NULL_MANAGEMENT:
 		break;
 	case TLV_CLOCK_DESCRIPTION:
@@ -222,7 +259,7 @@ int pmc_get_transport_fd(struct pmc *pmc)
 
 int pmc_send_get_action(struct pmc *pmc, int id)
 {
-	int datalen, pdulen;
+	int datalen, err, pdulen;
 	struct ptp_message *msg;
 	struct management_tlv *mgt;
 	msg = pmc_message(pmc, GET);
@@ -254,15 +291,15 @@ int pmc_send_get_action(struct pmc *pmc, int id)
 		cd->protocolAddress = (struct PortAddress *) buf;
 	}
 
-	pmc_send(pmc, msg, pdulen);
+	err = pmc_send(pmc, msg, pdulen);
 	msg_put(msg);
 
-	return 0;
+	return err < 0 ? -1 : 0;
 }
 
 int pmc_send_set_action(struct pmc *pmc, int id, void *data, int datasize)
 {
-	int pdulen;
+	int err, pdulen;
 	struct ptp_message *msg;
 	struct management_tlv *mgt;
 	msg = pmc_message(pmc, SET);
@@ -277,10 +314,10 @@ int pmc_send_set_action(struct pmc *pmc, int id, void *data, int datasize)
 	pdulen = msg->header.messageLength + sizeof(*mgt) + datasize;
 	msg->header.messageLength = pdulen;
 	msg->tlv_count = 1;
-	pmc_send(pmc, msg, pdulen);
+	err = pmc_send(pmc, msg, pdulen);
 	msg_put(msg);
 
-	return 0;
+	return err < 0 ? -1 : 0;
 }
 
 struct ptp_message *pmc_recv(struct pmc *pmc)
@@ -332,7 +369,27 @@ void pmc_target_port(struct pmc *pmc, UInteger16 portNumber)
 	pmc->target.portNumber = portNumber;
 }
 
+void pmc_source(struct pmc *pmc, struct PortIdentity *pid)
+{
+	pmc->port_identity = *pid;
+}
+
 void pmc_target_all(struct pmc *pmc)
 {
 	memset(&pmc->target, 0xff, sizeof(pmc->target));
 }
+
+void pmc_destination(struct pmc *pmc, struct address *addr)
+{
+	if (addr) {
+		pmc->destination = *addr;
+		pmc->unicast = 1;
+	} else {
+		pmc->unicast = 0;
+	}
+}
+
+UInteger16 pmc_sequence_id(struct pmc *pmc)
+{
+	return pmc->sequence_id;
+}
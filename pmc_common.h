@@ -46,4 +46,28 @@ int pmc_target(struct pmc *pmc, struct PortIdentity *pid);
 void pmc_target_port(struct pmc *pmc, UInteger16 portNumber);
 void pmc_target_all(struct pmc *pmc);
 
+/**
+ * Set the source port identity of the following messages. The server
+ * keeps one subscription per source, so the clients sharing a server
+ * need distinct identities.
+ * @param pmc  A pointer obtained via pmc_create().
+ * @param pid  The new source port identity.
+ */
+void pmc_source(struct pmc *pmc, struct PortIdentity *pid);
+
+/**
+ * Select the address the following messages are sent to.
+ * @param pmc   A pointer obtained via pmc_create().
+ * @param addr  A unicast address of the transport, or NULL to send the
+ *              messages to the default address again.
+ */
+void pmc_destination(struct pmc *pmc, struct address *addr);
+
+/**
+ * Get the sequence ID of the next message.
+ * @param pmc  A pointer obtained via pmc_create().
+ * @return     The sequenceId the next sent message will carry.
+ */
+UInteger16 pmc_sequence_id(struct pmc *pmc);
+
 #endif
@@ -19,6 +19,7 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <malloc.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -26,74 +27,347 @@
 
 #include "bmc.h"
 #include "clock.h"
+#include "cpustat.h"
 #include "filter.h"
+#include "hash.h"
+#include "mcache.h"
 #include "missing.h"
 #include "msg.h"
 #include "phc.h"
 #include "port.h"
 #include "print.h"
 #include "sk.h"
+#include "stats.h"
 #include "tlv.h"
 #include "tmv.h"
+#include "trace.h"
 #include "tsproc.h"
+#include "unicast.h"
 #include "util.h"
+#include "wheel.h"
+#include "worker.h"
 
 #define ALLOWED_LOST_RESPONSES 3
 #define ANNOUNCE_SPAN 1
 
-enum syfu_state {
-	SF_EMPTY,
-	SF_HAVE_SYNC,
-	SF_HAVE_FUP,
-};
+/*
+ * The number of consecutive two step Sync messages whose halves may be
+ * paired in any order, a power of two.
+ */
+#define SYFU_RING 8
 
-enum syfu_event {
-	SYNC_MISMATCH,
-	SYNC_MATCH,
-	FUP_MISMATCH,
-	FUP_MATCH,
+struct syfu_slot {
+	struct ptp_message *sync;
+	struct ptp_message *fup;
 };
 
+/* Most Pdelay exchanges in the window of the neighbor rate ratio */
+#define NRATE_MAX_POINTS 32
+/* Distance in ns of the newest point from the reference triggering a rebase */
+#define NRATE_MAX_DISTANCE (1LL << 36)
+
+/*
+ * Least squares fit of the peer's time vs the local time over a sliding
+ * window of Pdelay exchanges. The points are kept relative to a
+ * reference, as the local time x and the difference d of the times, so
+ * the slope of d is the deviation of the ratio from one.
+ */
 struct nrate_estimator {
 	double ratio;
-	tmv_t origin1;
-	tmv_t ingress1;
-	unsigned int max_count;
+	tmv_t origin0;
+	tmv_t ingress0;
+	struct {
+		double x;
+		double d;
+	} points[NRATE_MAX_POINTS];
+	/* Running sums of the points in the window */
+	double sx, sd, sxx, sxd;
+	unsigned int size;
 	unsigned int count;
+	unsigned int head;
 	int ratio_valid;
 };
 
-struct port {
-	LIST_ENTRY(port) list;
+#define N_TXTS_PENDING 8
+
+/* The port, its warm part, and its counters start on a cache line. */
+#define PORT_ALIGN 64
+
+/*
+ * A master honors a message interval request for this many of the
+ * requested intervals, and a slave repeats its request after this many
+ * sync messages. The faster of the live requests wins, so one slave
+ * asking for a slow rate cannot starve another one that needs a fast rate.
+ */
+#define N_INTERVAL_REQ		16
+#define INTERVAL_REQ_HOLD	32
+#define INTERVAL_REQ_REFRESH	8
+
+/*
+ * A received peer delay response or follow up, reduced to the fields
+ * used by port_peer_delay(), so that the receive buffer is not held
+ * for the duration of the exchange.
+ */
+struct pdelay_rx {
+	int valid;
+	int one_step;
+	struct PortIdentity source;
+	struct PortIdentity requesting;
+	UInteger16 sequenceId;
+	Integer64 correction;
+	struct timestamp origin; /* t2 of a response, t3 of a follow up */
+	struct timespec ingress; /* t4 of a response */
+};
+
+/*
+ * The settings of a port, resolved once when the port is opened, so that
+ * the port does not look them up by name when it is initialized again.
+ */
+struct port_config {
+	int boundary_clock_jbod;
+	int network_transport;
+	int delayAsymmetry;
+	int follow_up_info;
+	int freq_est_interval;
+	int hybrid_e2e;
+	int path_trace_enabled;
+	int ingressLatency;
+	int egressLatency;
+	int sync_batch;
+	int delay_resp_batch;
+	int tx_timestamp_async;
+	int tx_launch_lead;
+	int tx_timestamp_tuning;
+	int unicast_listen;
+	int unicast_max_clients;
+	int unicast_max_duration;
+	int delay_mechanism;
+	int fault_badpeernet_interval;
+	int fault_reset_interval;
+	int tsproc_mode;
+	int delay_filter;
+	int delay_filter_length;
+	int logMinDelayReqInterval;
+	int logAnnounceInterval;
+	int announceReceiptTimeout;
+	int syncReceiptTimeout;
+	int transportSpecific;
+	int logSyncInterval;
+	int logMinPdelayReqInterval;
+	int neighborPropDelayThresh;
+	int min_neighbor_prop_delay;
+	int adaptive_interval;
+	int adaptive_lock_count;
+	int adaptive_offset_threshold;
+	int adaptive_logSyncInterval;
+	int adaptive_logMinDelayReqInterval;
+	int allow_interval_requests;
+	int kernel_filter;
+	double delay_filter_quantile;
+};
+
+#define PORT_CFG(option) { #option, offsetof(struct port_config, option) }
+
+static const struct config_field port_config_fields[] = {
+	PORT_CFG(boundary_clock_jbod),
+	PORT_CFG(network_transport),
+	PORT_CFG(delayAsymmetry),
+	PORT_CFG(follow_up_info),
+	PORT_CFG(freq_est_interval),
+	PORT_CFG(hybrid_e2e),
+	PORT_CFG(path_trace_enabled),
+	PORT_CFG(ingressLatency),
+	PORT_CFG(egressLatency),
+	PORT_CFG(sync_batch),
+	PORT_CFG(delay_resp_batch),
+	PORT_CFG(tx_timestamp_async),
+	PORT_CFG(tx_launch_lead),
+	PORT_CFG(tx_timestamp_tuning),
+	PORT_CFG(unicast_listen),
+	PORT_CFG(unicast_max_clients),
+	PORT_CFG(unicast_max_duration),
+	PORT_CFG(delay_mechanism),
+	PORT_CFG(fault_badpeernet_interval),
+	PORT_CFG(fault_reset_interval),
+	PORT_CFG(tsproc_mode),
+	PORT_CFG(delay_filter),
+	PORT_CFG(delay_filter_length),
+	PORT_CFG(logMinDelayReqInterval),
+	PORT_CFG(logAnnounceInterval),
+	PORT_CFG(announceReceiptTimeout),
+	PORT_CFG(syncReceiptTimeout),
+	PORT_CFG(transportSpecific),
+	PORT_CFG(logSyncInterval),
+	PORT_CFG(logMinPdelayReqInterval),
+	PORT_CFG(neighborPropDelayThresh),
+	PORT_CFG(min_neighbor_prop_delay),
+	PORT_CFG(adaptive_interval),
+	PORT_CFG(adaptive_lock_count),
+	PORT_CFG(adaptive_offset_threshold),
+	PORT_CFG(adaptive_logSyncInterval),
+	PORT_CFG(adaptive_logMinDelayReqInterval),
+	PORT_CFG(allow_interval_requests),
+	PORT_CFG(kernel_filter),
+	PORT_CFG(delay_filter_quantile),
+};
+
+#define N_PORT_CONFIG_FIELDS \
+	(sizeof(port_config_fields) / sizeof(port_config_fields[0]))
+
+struct txts_pending {
+	struct ptp_message *msg;
+	struct ptp_message *fup;
+	tmv_t sent;
+	tmv_t deadline;
+	unsigned int id;
+	/* a message forwarded by a transparent clock, see tc_complete() */
+	int tc;
+	tmv_t ingress;
+	struct ptp_header hdr; /* as sent, in network byte order */
+};
+
+/* The number of time stamps needed before suggesting a timeout */
+#define TXTS_SUGGEST_MIN 1000
+
+/*
+ * Message templates. The messages sent periodically are built once in
+ * network byte order, and only rebuilt when the data they are made of
+ * changes, as told by comparing the keys. A transmission copies the
+ * template and patches the sequence id, flags and time stamps in place.
+ */
+enum template_type {
+	TMPL_ANNOUNCE,
+	TMPL_SYNC,
+	TMPL_FOLLOW_UP,
+	TMPL_DELAY_REQ,
+	N_TEMPLATES,
+};
+
+struct template_key {
+	UInteger8 domainNumber;
+	Integer8 logMessageInterval;
+	UInteger16 stepsRemoved;
+	struct parentDS pds;
+	struct timePropertiesDS tds;
+	unsigned int path_gen;
+};
+
+/* Large enough for an announce message with the longest path trace. */
+#define TEMPLATE_SIZE sizeof(struct message_data)
+
+struct msg_template {
+	struct template_key key;
+	int valid;
+	int len;
+	unsigned char data[TEMPLATE_SIZE];
+};
+
+#define N_TC_RESIDENCE 16
+
+/* The residence time of an event message forwarded by a transparent clock */
+struct tc_residence {
+	struct PortIdentity source;
+	UInteger16 sequenceId;
+	uint8_t type;
+	uint8_t valid;
+	tmv_t residence;
+};
+
+/*
+ * The cold part of a port: the state machine, the configuration, the
+ * interval requests, the foreign masters and the larger tables. It is
+ * allocated apart from struct port, so that the fields used for every
+ * message stay within a few cache lines.
+ */
+struct port_cold {
 	char *name;
-	struct clock *clock;
-	struct transport *trp;
-	enum timestamp_type timestamping;
-	struct fdarray fda;
+	struct port_config cfg;
+	struct wheel_timer timer[N_TIMER_FDS];
 	int fault_fd;
 	int phc_index;
 	int jbod;
+	struct port *shared; /* the owner of our transport, if not NULL */
 	struct foreign_clock *best;
-	enum syfu_state syfu;
-	struct ptp_message *last_syncfup;
+	int bmc_changed;
+	/* message interval requests sent as a slave */
+	int                 adaptive_interval;
+	int                 adaptive_lock_count;
+	int                 adaptive_offset_threshold;
+	Integer8            adaptive_logSyncInterval;
+	Integer8            adaptive_logMinDelayReqInterval;
+	int                 adaptive_count;
+	int                 adaptive_refresh;
+	int                 adaptive_slow;
+	/* message interval requests honored as a master */
+	int                 allow_interval_requests;
+	Integer8            initial_logSyncInterval;
+	Integer8            initial_logMinDelayReqInterval;
+	uint64_t            sync_req_expiry[N_INTERVAL_REQ];
+	uint64_t            delay_req_expiry[N_INTERVAL_REQ];
+	/* unicast transmissions granted as a master, if not NULL */
+	struct unicast_table *unicast;
+	UInteger32          unicast_max_duration;
+	struct fault_interval flt_interval_pertype[FT_CNT];
+	enum fault_type     last_fault_type;
+	unsigned int        versionNumber; /*UInteger4*/
+	/* foreignMasterDS */
+	LIST_HEAD(fm, foreign_clock) foreign_masters;
+	struct hash *foreign_index; /* by port identity */
+	/* delay responses held back to be sent together, if batch is set */
+	uint64_t delay_resp_batch;
+	int dresp_count;
+	struct ptp_message *dresp[SK_TX_BATCH];
+	struct msg_template templates[N_TEMPLATES];
+	/* transparent clock, residence times of the messages sent here */
+	struct tc_residence tc[N_TC_RESIDENCE];
+	unsigned int tc_next;
+	/* the time the tx time stamps took, since the start and recently */
+	struct stats *txts_wait;
+	struct stats *txts_wait_recent;
+	unsigned int txts_timeouts; /* since the start or the last reset */
+	tmv_t txts_summary;
+	/* management responses, see clock_mgmt_changed() */
+	struct mcache *mgmt_cache;
+};
+
+/*
+ * The fields used for every received message and every transmission
+ * come first. The peer delay exchange and the pending time stamps follow
+ * on cache lines of their own, and the rest is out of line.
+ */
+struct port {
+	/* first, as clock.c walks the list through its own view of a port */
+	LIST_ENTRY(port) list;
+	struct port_cold *cold;
+	/* hot: receive and transmit */
+	struct clock *clock;
+	struct transport *trp;
+	struct fdarray fda;
+	enum timestamp_type timestamping;
+	struct worker *worker; /* receives on our behalf, if not NULL */
+	struct port *next_domain; /* of the ports sharing our transport */
+	struct ptp_message *rx_msg[SK_RX_BATCH]; /* refilled as consumed */
+	int tx_async;
+	int sync_batch;
+	int txts_count;
+	int rx_timestamp_offset;
+	int tx_timestamp_offset;
+	/* hot: synchronization */
+	struct syfu_slot syfu[SYFU_RING]; /* indexed by the sequence ID */
+	UInteger16 syfu_last; /* sequence ID of the last pair */
+	int syfu_paired; /* whether syfu_last is valid */
 	struct ptp_message *delay_req;
 	struct ptp_message *peer_delay_req;
-	struct ptp_message *peer_delay_resp;
-	struct ptp_message *peer_delay_fup;
-	int peer_portid_valid;
-	struct PortIdentity peer_portid;
 	struct {
 		UInteger16 announce;
 		UInteger16 delayreq;
+		UInteger16 signaling;
 		UInteger16 sync;
 	} seqnum;
+	int log_sync_interval;
 	tmv_t peer_delay;
 	struct tsproc *tsproc;
-	int log_sync_interval;
 	struct nrate_estimator nrate;
-	unsigned int pdr_missing;
-	unsigned int multiple_seq_pdr_count;
-	unsigned int multiple_pdr_detected;
 	/* portDS */
 	struct PortIdentity portIdentity;
 	enum port_state     state; /*portState*/
@@ -115,26 +389,42 @@ struct port {
 	int                 hybrid_e2e;
 	int                 min_neighbor_prop_delay;
 	int                 path_trace_enabled;
-	int                 rx_timestamp_offset;
-	int                 tx_timestamp_offset;
-	struct fault_interval flt_interval_pertype[FT_CNT];
-	enum fault_type     last_fault_type;
-	unsigned int        versionNumber; /*UInteger4*/
-	/* foreignMasterDS */
-	LIST_HEAD(fm, foreign_clock) foreign_masters;
+	uint64_t            ptl_hash; /* of the path trace list we set */
+	unsigned int        ptl_gen;
+	/* warm: the peer delay exchange */
+	struct pdelay_rx peer_delay_resp __attribute__((aligned(PORT_ALIGN)));
+	struct pdelay_rx peer_delay_fup;
+	/* buffers of the peer delay messages, reused from one exchange to the next */
+	struct ptp_message *pdelay_req_buf;
+	struct ptp_message *pdelay_resp_buf;
+	struct ptp_message *pdelay_fup_buf;
+	int peer_portid_valid;
+	struct PortIdentity peer_portid;
+	unsigned int pdr_missing;
+	unsigned int multiple_seq_pdr_count;
+	unsigned int multiple_pdr_detected;
+	/* event messages waiting for their transmit time stamps */
+	struct txts_pending txts[N_TXTS_PENDING];
+	/* message counters, apart from the fields used by other threads */
+	struct port_stats stats __attribute__((aligned(PORT_ALIGN)));
 };
 
 #define portnum(p) (p->portIdentity.portNumber)
 
+#define msgtype_stat(p, counter, m) (p->stats.counter[msg_type(m)]++)
+
 #define NSEC2SEC 1000000000LL
 
 static int port_capable(struct port *p);
+static int port_send(struct port *p, struct ptp_message *msg, int event);
 static int port_is_ieee8021as(struct port *p);
 static void port_nrate_initialize(struct port *p);
+static void port_peer_delay(struct port *p);
+static void txts_wait_add(struct port *p, int64_t wait);
+static void tc_complete(struct port *q, struct txts_pending *e, tmv_t egress);
 
-static int announce_compare(struct ptp_message *m1, struct ptp_message *m2)
+static int announce_compare(struct announce_msg *a, struct announce_msg *b)
 {
-	struct announce_msg *a = &m1->announce, *b = &m2->announce;
 	int len =
 		sizeof(a->grandmasterPriority1) +
 		sizeof(a->grandmasterClockQuality) +
@@ -145,34 +435,33 @@ static int announce_compare(struct ptp_message *m1, struct ptp_message *m2)
 	return memcmp(&a->grandmasterPriority1, &b->grandmasterPriority1, len);
 }
 
-static void announce_to_dataset(struct ptp_message *m, struct port *p,
+static void announce_to_dataset(struct announce_msg *a, struct port *p,
 				struct dataset *out)
 {
-	struct announce_msg *a = &m->announce;
 	out->priority1    = a->grandmasterPriority1;
 	out->identity     = a->grandmasterIdentity;
 	out->quality      = a->grandmasterClockQuality;
 	out->priority2    = a->grandmasterPriority2;
 	out->stepsRemoved = a->stepsRemoved;
-	out->sender       = m->header.sourcePortIdentity;
+	out->sender       = a->hdr.sourcePortIdentity;
 	out->receiver     = p->portIdentity;
 }
 
-static int msg_current(struct ptp_message *m, struct timespec now)
+static int arrival_current(struct foreign_arrival *a, struct timespec now)
 {
 	int64_t t1, t2, tmo;
 
-	t1 = m->ts.host.tv_sec * NSEC2SEC + m->ts.host.tv_nsec;
+	t1 = a->host.tv_sec * NSEC2SEC + a->host.tv_nsec;
 	t2 = now.tv_sec * NSEC2SEC + now.tv_nsec;
 
-	if (m->header.logMessageInterval < -63) {
+	if (a->logMessageInterval < -63) {
 		tmo = 0;
-	} else if (m->header.logMessageInterval > 31) {
+	} else if (a->logMessageInterval > 31) {
 		tmo = INT64_MAX;
-	} else if (m->header.logMessageInterval < 0) {
-		tmo = 4LL * NSEC2SEC / (1 << -m->header.logMessageInterval);
+	} else if (a->logMessageInterval < 0) {
+		tmo = 4LL * NSEC2SEC / (1 << -a->logMessageInterval);
 	} else {
-		tmo = 4LL * (1 << m->header.logMessageInterval) * NSEC2SEC;
+		tmo = 4LL * (1 << a->logMessageInterval) * NSEC2SEC;
 	}
 
 	return t2 - t1 < tmo;
@@ -191,15 +480,9 @@ static int pid_eq(struct PortIdentity *a, struct PortIdentity *b)
 	return 0 == memcmp(a, b, sizeof(*a));
 }
 
-static int source_pid_eq(struct ptp_message *m1, struct ptp_message *m2)
-{
-	return pid_eq(&m1->header.sourcePortIdentity,
-		      &m2->header.sourcePortIdentity);
-}
-
 enum fault_type last_fault_type(struct port *port)
 {
-	return port->last_fault_type;
+	return port->cold->last_fault_type;
 }
 
 int fault_interval(struct port *port, enum fault_type ft,
@@ -209,14 +492,14 @@ int fault_interval(struct port *port, enum fault_type ft,
 		return -EINVAL;
 	if (ft < 0 || ft >= FT_CNT)
 		return -EINVAL;
-	i->type = port->flt_interval_pertype[ft].type;
-	i->val = port->flt_interval_pertype[ft].val;
+	i->type = port->cold->flt_interval_pertype[ft].type;
+	i->val = port->cold->flt_interval_pertype[ft].val;
 	return 0;
 }
 
 int port_fault_fd(struct port *port)
 {
-	return port->fault_fd;
+	return port->cold->fault_fd;
 }
 
 struct fdarray *port_fda(struct port *port)
@@ -224,11 +507,8 @@ struct fdarray *port_fda(struct port *port)
 	return &port->fda;
 }
 
-int set_tmo_log(int fd, unsigned int scale, int log_seconds)
+static uint64_t tmo_log_ns(unsigned int scale, int log_seconds)
 {
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
 	uint64_t ns;
 	int i;
 
@@ -238,19 +518,43 @@ int set_tmo_log(int fd, unsigned int scale, int log_seconds)
 		for (i = 1, ns = scale * 500000000ULL; i < log_seconds; i++) {
 			ns >>= 1;
 		}
-		tmo.it_value.tv_nsec = ns;
+		return ns;
+	}
+	return (uint64_t) scale * (1 << log_seconds) * NS_PER_SEC;
+}
 
-		while (tmo.it_value.tv_nsec >= NS_PER_SEC) {
-			tmo.it_value.tv_nsec -= NS_PER_SEC;
-			tmo.it_value.tv_sec++;
-		}
+static uint64_t tmo_random_ns(int min, int span, int log_seconds)
+{
+	uint64_t min_ns, span_ns;
+
+	if (log_seconds >= 0) {
+		min_ns = min * NS_PER_SEC << log_seconds;
+		span_ns = span * NS_PER_SEC << log_seconds;
+	} else {
+		min_ns = min * NS_PER_SEC >> -log_seconds;
+		span_ns = span * NS_PER_SEC >> -log_seconds;
+	}
+
+	return min_ns + (span_ns * (random() % (1 << 15) + 1) >> 15);
+}
+
+static int set_tmo_ns(int fd, uint64_t ns)
+{
+	struct itimerspec tmo = {
+		{0, 0}, {0, 0}
+	};
 
-	} else
-		tmo.it_value.tv_sec = scale * (1 << log_seconds);
+	tmo.it_value.tv_sec = ns / NS_PER_SEC;
+	tmo.it_value.tv_nsec = ns % NS_PER_SEC;
 
 	return timerfd_settime(fd, 0, &tmo, NULL);
 }
 
+int set_tmo_log(int fd, unsigned int scale, int log_seconds)
+{
+	return set_tmo_ns(fd, tmo_log_ns(scale, log_seconds));
+}
+
 int set_tmo_lin(int fd, int seconds)
 {
 	struct itimerspec tmo = {
@@ -263,72 +567,122 @@ int set_tmo_lin(int fd, int seconds)
 
 int set_tmo_random(int fd, int min, int span, int log_seconds)
 {
-	uint64_t value_ns, min_ns, span_ns;
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
+	return set_tmo_ns(fd, tmo_random_ns(min, span, log_seconds));
+}
 
-	if (log_seconds >= 0) {
-		min_ns = min * NS_PER_SEC << log_seconds;
-		span_ns = span * NS_PER_SEC << log_seconds;
-	} else {
-		min_ns = min * NS_PER_SEC >> -log_seconds;
-		span_ns = span * NS_PER_SEC >> -log_seconds;
-	}
+static struct wheel_timer *port_timer(struct port *p, int index)
+{
+	return &p->cold->timer[index - FD_ANNOUNCE_TIMER];
+}
+
+static int port_tmo_log(struct port *p, int index,
+			unsigned int scale, int log_seconds)
+{
+	wheel_set(clock_wheel(p->clock), port_timer(p, index),
+		  tmo_log_ns(scale, log_seconds));
+	return 0;
+}
 
-	value_ns = min_ns + (span_ns * (random() % (1 << 15) + 1) >> 15);
+/*
+ * With launch times, a message leaves at the next multiple of its
+ * interval on CLOCK_TAI, and the timer fires tx_launch_lead before it.
+ */
+static int port_launch_enabled(struct port *p)
+{
+	return p->cold->cfg.tx_launch_lead && !p->sync_batch;
+}
 
-	tmo.it_value.tv_sec = value_ns / NS_PER_SEC;
-	tmo.it_value.tv_nsec = value_ns % NS_PER_SEC;
+static int port_tmo_launch(struct port *p, int index, int log_seconds)
+{
+	uint64_t lead = p->cold->cfg.tx_launch_lead, now, period;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_TAI, &ts);
+	now = ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+	period = tmo_log_ns(1, log_seconds);
+	wheel_set(clock_wheel(p->clock), port_timer(p, index),
+		  ((now + lead) / period + 1) * period - lead - now);
+	return 0;
+}
 
-	return timerfd_settime(fd, 0, &tmo, NULL);
+/* Returns the launch time of the message due now, or zero for none. */
+static uint64_t port_launch_time(struct port *p, int log_seconds)
+{
+	uint64_t launch, now, period;
+	struct timespec ts;
+
+	if (!port_launch_enabled(p))
+		return 0;
+	clock_gettime(CLOCK_TAI, &ts);
+	now = ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+	period = tmo_log_ns(1, log_seconds);
+	launch = now + p->cold->cfg.tx_launch_lead + period / 2;
+	launch = launch / period * period;
+	if (launch <= now) {
+		pr_debug("port %hu: too late for the launch time", portnum(p));
+		return 0;
+	}
+	return launch;
+}
+
+static int port_tmo_random(struct port *p, int index,
+			   int min, int span, int log_seconds)
+{
+	wheel_set(clock_wheel(p->clock), port_timer(p, index),
+		  tmo_random_ns(min, span, log_seconds));
+	return 0;
 }
 
 int port_set_fault_timer_log(struct port *port,
 			     unsigned int scale, int log_seconds)
 {
-	return set_tmo_log(port->fault_fd, scale, log_seconds);
+	return set_tmo_log(port->cold->fault_fd, scale, log_seconds);
 }
 
 int port_set_fault_timer_lin(struct port *port, int seconds)
 {
-	return set_tmo_lin(port->fault_fd, seconds);
+	return set_tmo_lin(port->cold->fault_fd, seconds);
 }
 
 static void fc_clear(struct foreign_clock *fc)
 {
-	struct ptp_message *m;
-
-	while (fc->n_messages) {
-		m = TAILQ_LAST(&fc->messages, messages);
-		TAILQ_REMOVE(&fc->messages, m, list);
-		fc->n_messages--;
-		msg_put(m);
-	}
+	fc->n_messages = 0;
 }
 
 static void fc_prune(struct foreign_clock *fc)
 {
 	struct timespec now;
-	struct ptp_message *m;
 
 	clock_gettime(CLOCK_MONOTONIC, &now);
 
-	while (fc->n_messages > FOREIGN_MASTER_THRESHOLD) {
-		m = TAILQ_LAST(&fc->messages, messages);
-		TAILQ_REMOVE(&fc->messages, m, list);
+	if (fc->n_messages > FOREIGN_MASTER_THRESHOLD)
+		fc->n_messages = FOREIGN_MASTER_THRESHOLD;
+
+	while (fc->n_messages &&
+	       !arrival_current(&fc->arrivals[fc->n_messages - 1], now)) {
 		fc->n_messages--;
-		msg_put(m);
 	}
+}
 
-	while (!TAILQ_EMPTY(&fc->messages)) {
-		m = TAILQ_LAST(&fc->messages, messages);
-		if (msg_current(m, now))
-			break;
-		TAILQ_REMOVE(&fc->messages, m, list);
-		fc->n_messages--;
-		msg_put(m);
+/*
+ * Records a pruned foreign master's announce message. Returns non-zero
+ * if it is different than the last one.
+ */
+static int fc_add(struct foreign_clock *fc, struct ptp_message *m)
+{
+	int diff = 0;
+
+	if (fc->n_messages) {
+		diff = announce_compare(&m->announce, &fc->announce);
+		memmove(&fc->arrivals[1], &fc->arrivals[0],
+			fc->n_messages * sizeof(fc->arrivals[0]));
 	}
+	fc->arrivals[0].host = m->ts.host;
+	fc->arrivals[0].logMessageInterval = m->header.logMessageInterval;
+	fc->n_messages++;
+	fc->announce = m->announce;
+	fc->address = m->address;
+	return diff;
 }
 
 static void ts_add(struct timespec *ts, int ns)
@@ -354,22 +708,27 @@ static void ts_to_timestamp(struct timespec *src, struct Timestamp *dst)
 	dst->nanoseconds = src->tv_nsec;
 }
 
+/* Like ts_to_timestamp(), for a message in network byte order. */
+static void ts_to_net_timestamp(struct timespec *src, struct Timestamp *dst)
+{
+	dst->seconds_lsb = htonl(src->tv_sec);
+	dst->seconds_msb = 0;
+	dst->nanoseconds = htonl(src->tv_nsec);
+}
+
 /*
  * Returns non-zero if the announce message is different than last.
  */
 static int add_foreign_master(struct port *p, struct ptp_message *m)
 {
 	struct foreign_clock *fc;
-	struct ptp_message *tmp;
-	int broke_threshold = 0, diff = 0;
+	const char *key;
+	int broke_threshold = 0;
 
-	LIST_FOREACH(fc, &p->foreign_masters, list) {
-		if (msg_source_equal(m, fc))
-			break;
-	}
+	key = pid2str(&m->header.sourcePortIdentity);
+	fc = hash_lookup(p->cold->foreign_index, key);
 	if (!fc) {
-		pr_notice("port %hu: new foreign master %s", portnum(p),
-			pid2str(&m->header.sourcePortIdentity));
+		pr_notice("port %hu: new foreign master %s", portnum(p), key);
 
 		fc = malloc(sizeof(*fc));
 		if (!fc) {
@@ -377,8 +736,12 @@ static int add_foreign_master(struct port *p, struct ptp_message *m)
 			return 0;
 		}
 		memset(fc, 0, sizeof(*fc));
-		TAILQ_INIT(&fc->messages);
-		LIST_INSERT_HEAD(&p->foreign_masters, fc, list);
+		if (hash_insert(p->cold->foreign_index, key, fc)) {
+			pr_err("low memory, failed to add foreign master");
+			free(fc);
+			return 0;
+		}
+		LIST_INSERT_HEAD(&p->cold->foreign_masters, fc, list);
 		fc->port = p;
 		fc->dataset.sender = m->header.sourcePortIdentity;
 		/* We do not count this first message, see 9.5.3(b) */
@@ -393,21 +756,10 @@ static int add_foreign_master(struct port *p, struct ptp_message *m)
 		broke_threshold = 1;
 
 	/*
-	 * Okay, go ahead and add this announcement.
-	 */
-	msg_get(m);
-	fc->n_messages++;
-	TAILQ_INSERT_HEAD(&fc->messages, m, list);
-
-	/*
-	 * Test if this announcement contains changed information.
+	 * Okay, go ahead and add this announcement, testing if it
+	 * contains changed information.
 	 */
-	if (fc->n_messages > 1) {
-		tmp = TAILQ_NEXT(m, list);
-		diff = announce_compare(m, tmp);
-	}
-
-	return broke_threshold || diff;
+	return fc_add(fc, m) || broke_threshold;
 }
 
 static int follow_up_info_append(struct port *p, struct ptp_message *m)
@@ -440,11 +792,14 @@ static struct follow_up_info_tlv *follow_up_info_extract(struct ptp_message *m)
 static void free_foreign_masters(struct port *p)
 {
 	struct foreign_clock *fc;
-	while ((fc = LIST_FIRST(&p->foreign_masters)) != NULL) {
+	while ((fc = LIST_FIRST(&p->cold->foreign_masters)) != NULL) {
 		LIST_REMOVE(fc, list);
-		fc_clear(fc);
+		hash_remove(p->cold->foreign_index,
+			    pid2str(&fc->dataset.sender));
 		free(fc);
 	}
+	p->cold->best = NULL;
+	p->cold->bmc_changed = 1;
 }
 
 static int fup_sync_ok(struct ptp_message *fup, struct ptp_message *sync)
@@ -491,11 +846,39 @@ static int path_trace_append(struct port *p, struct ptp_message *m,
 	return ptt->length + sizeof(ptt->type) + sizeof(ptt->length);
 }
 
+/*
+ * Hash the clock identities of a path trace a word at a time. Zero is
+ * reserved for a path trace which was not hashed yet.
+ */
+static uint64_t path_trace_hash(struct path_trace_tlv *ptt, int cnt)
+{
+	uint64_t h = 0xcbf29ce484222325ULL, w;
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		memcpy(&w, &ptt->cid[i], sizeof(w));
+		h = (h ^ w) * 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	return h ? h : 1;
+}
+
+static struct foreign_clock *path_trace_sender(struct port *p,
+					       struct ptp_message *m)
+{
+	if (p->cold->best && msg_source_equal(m, p->cold->best))
+		return p->cold->best;
+	return hash_lookup(p->cold->foreign_index,
+			   pid2str(&m->header.sourcePortIdentity));
+}
+
 static int path_trace_ignore(struct port *p, struct ptp_message *m)
 {
+	struct foreign_clock *fc;
 	struct ClockIdentity cid;
 	struct path_trace_tlv *ptt;
-	int i, cnt;
+	uint64_t hash;
+	int i, cnt, loop = 0;
 
 	if (!p->path_trace_enabled) {
 		return 0;
@@ -511,12 +894,26 @@ static int path_trace_ignore(struct port *p, struct ptp_message *m)
 		return 1;
 	}
 	cnt = path_length(ptt);
+	hash = path_trace_hash(ptt, cnt);
+
+	/* An unchanged path trace of a known master was checked before. */
+	fc = path_trace_sender(p, m);
+	if (fc && fc->path_hash == hash && fc->path_length == cnt)
+		return fc->path_loop;
+
 	cid = clock_identity(p->clock);
 	for (i = 0; i < cnt; i++) {
-		if (0 == memcmp(&ptt->cid[i], &cid, sizeof(cid)))
-			return 1;
+		if (0 == memcmp(&ptt->cid[i], &cid, sizeof(cid))) {
+			loop = 1;
+			break;
+		}
 	}
-	return 0;
+	if (fc) {
+		fc->path_hash = hash;
+		fc->path_length = cnt;
+		fc->path_loop = loop;
+	}
+	return loop;
 }
 
 static int peer_prepare_and_send(struct port *p, struct ptp_message *msg,
@@ -531,6 +928,8 @@ static int peer_prepare_and_send(struct port *p, struct ptp_message *msg,
 		return -1;
 	}
 	if (msg_sots_valid(msg)) {
+		if (event == TRANS_EVENT)
+			txts_wait_add(p, msg->hwts.wait);
 		ts_add(&msg->hwts.ts, p->tx_timestamp_offset);
 	}
 	return 0;
@@ -602,12 +1001,10 @@ not_capable:
 	return 0;
 }
 
-static int port_clr_tmo(int fd)
+static int port_clr_tmo(struct port *p, int index)
 {
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
-	return timerfd_settime(fd, 0, &tmo, NULL);
+	wheel_clear(clock_wheel(p->clock), port_timer(p, index));
+	return 0;
 }
 
 static int port_ignore(struct port *p, struct ptp_message *m)
@@ -688,6 +1085,8 @@ static int port_management_fill_response(struct port *target,
 	struct portDS *pds;
 	struct port_ds_np *pdsnp;
 	struct port_properties_np *ppn;
+	struct port_stats_np *psn;
+	struct tx_timestamp_stats_np *tsn;
 	struct clock_description *desc;
 	struct mgmt_clock_description *cd;
 	uint8_t *buf;
@@ -765,24 +1164,7 @@ static int port_management_fill_response(struct port *target,
 		break;
 	case TLV_PORT_DATA_SET:
 		pds = (struct portDS *) tlv->data;
-		pds->portIdentity            = target->portIdentity;
-		if (target->state == PS_GRAND_MASTER) {
-			pds->portState = PS_MASTER;
-		} else {
-			pds->portState = target->state;
-		}
-		pds->logMinDelayReqInterval  = target->logMinDelayReqInterval;
-		pds->peerMeanPathDelay       = target->peerMeanPathDelay;
-		pds->logAnnounceInterval     = target->logAnnounceInterval;
-		pds->announceReceiptTimeout  = target->announceReceiptTimeout;
-		pds->logSyncInterval         = target->logSyncInterval;
-		if (target->delayMechanism) {
-			pds->delayMechanism = target->delayMechanism;
-		} else {
-			pds->delayMechanism = DM_E2E;
-		}
-		pds->logMinPdelayReqInterval = target->logMinPdelayReqInterval;
-		pds->versionNumber           = target->versionNumber;
+		port_data_set(target, pds);
 		datalen = sizeof(*pds);
 		respond = 1;
 		break;
@@ -806,7 +1188,7 @@ static int port_management_fill_response(struct port *target,
 		break;
 	case TLV_VERSION_NUMBER:
 		mtd = (struct management_tlv_datum *) tlv->data;
-		mtd->val = target->versionNumber;
+		mtd->val = target->cold->versionNumber;
 		datalen = sizeof(*mtd);
 		respond = 1;
 		break;
@@ -832,6 +1214,19 @@ static int port_management_fill_response(struct port *target,
 		datalen = sizeof(*pdsnp);
 		respond = 1;
 		break;
+	case TLV_PORT_STATS_NP:
+		psn = (struct port_stats_np *) tlv->data;
+		psn->portIdentity = target->portIdentity;
+		psn->stats = target->stats;
+		datalen = sizeof(*psn);
+		respond = 1;
+		break;
+	case TLV_TX_TIMESTAMP_STATS_NP:
+		tsn = (struct tx_timestamp_stats_np *) tlv->data;
+		port_get_txts_stats(target, tsn);
+		datalen = sizeof(*tsn);
+		respond = 1;
+		break;
 	case TLV_PORT_PROPERTIES_NP:
 		ppn = (struct port_properties_np *)tlv->data;
 		ppn->portIdentity = target->portIdentity;
@@ -840,7 +1235,7 @@ static int port_management_fill_response(struct port *target,
 		else
 			ppn->port_state = target->state;
 		ppn->timestamping = target->timestamping;
-		ptp_text_set(&ppn->interface, target->name);
+		ptp_text_set(&ppn->interface, target->cold->name);
 		datalen = sizeof(*ppn) + ppn->interface.length;
 		respond = 1;
 		break;
@@ -857,11 +1252,33 @@ static int port_management_fill_response(struct port *target,
 	return respond;
 }
 
+/*
+ * The responses which only change with the port state, the intervals,
+ * the peer delay and the SET requests are kept in network byte order.
+ */
+static int port_management_cacheable(int id)
+{
+	switch (id) {
+	case TLV_CLOCK_DESCRIPTION:
+	case TLV_PORT_DATA_SET:
+	case TLV_LOG_ANNOUNCE_INTERVAL:
+	case TLV_ANNOUNCE_RECEIPT_TIMEOUT:
+	case TLV_LOG_SYNC_INTERVAL:
+	case TLV_VERSION_NUMBER:
+	case TLV_DELAY_MECHANISM:
+	case TLV_LOG_MIN_PDELAY_REQ_INTERVAL:
+		return 1;
+	}
+	return 0;
+}
+
 static int port_management_get_response(struct port *target,
 					struct port *ingress, int id,
 					struct ptp_message *req)
 {
 	struct PortIdentity pid = port_identity(target);
+	int cacheable = port_management_cacheable(id);
+	unsigned int gen = clock_mgmt_gen(target->clock);
 	struct ptp_message *rsp;
 	int respond;
 
@@ -869,7 +1286,13 @@ static int port_management_get_response(struct port *target,
 	if (!rsp) {
 		return 0;
 	}
-	respond = port_management_fill_response(target, rsp, id);
+	if (cacheable && mcache_get(target->cold->mgmt_cache, id, gen, rsp)) {
+		respond = 1;
+	} else {
+		respond = port_management_fill_response(target, rsp, id);
+		if (respond && cacheable)
+			mcache_put(target->cold->mgmt_cache, id, gen, rsp);
+	}
 	if (respond)
 		port_prepare_and_send(ingress, rsp, 0);
 	msg_put(rsp);
@@ -892,15 +1315,64 @@ static int port_management_set(struct port *target,
 		target->neighborPropDelayThresh = pdsnp->neighborPropDelayThresh;
 		respond = 1;
 		break;
+	case TLV_PORT_STATS_NP:
+	case TLV_TX_TIMESTAMP_STATS_NP:
+		/* Reset the counters after reporting them. */
+		respond = 1;
+		break;
 	}
 	if (respond && !port_management_get_response(target, ingress, id, req))
 		pr_err("port %hu: failed to send management set response", portnum(target));
+	if (id == TLV_PORT_STATS_NP)
+		memset(&target->stats, 0, sizeof(target->stats));
+	if (id == TLV_TX_TIMESTAMP_STATS_NP) {
+		stats_reset(target->cold->txts_wait);
+		target->cold->txts_timeouts = 0;
+	}
 	return respond ? 1 : 0;
 }
 
+static void nrate_sums_add(struct nrate_estimator *n, double x, double d)
+{
+	n->sx += x;
+	n->sd += d;
+	n->sxx += x * x;
+	n->sxd += x * d;
+}
+
+static unsigned int nrate_oldest(struct nrate_estimator *n)
+{
+	return (n->head + n->size - n->count) % n->size;
+}
+
+static void nrate_reset(struct nrate_estimator *n)
+{
+	n->count = 0;
+	n->head = 0;
+	n->sx = n->sd = n->sxx = n->sxd = 0.0;
+}
+
+/* Move the reference to the oldest point and recompute the sums. */
+static void nrate_rebase(struct nrate_estimator *n)
+{
+	unsigned int i, j = nrate_oldest(n);
+	double ox = n->points[j].x, od = n->points[j].d;
+
+	n->ingress0 = tmv_add(n->ingress0, nanoseconds_to_tmv(ox));
+	n->origin0 = tmv_add(n->origin0, nanoseconds_to_tmv(ox + od));
+	n->sx = n->sd = n->sxx = n->sxd = 0.0;
+	for (i = 0; i < n->count; i++, j = (j + 1) % n->size) {
+		n->points[j].x -= ox;
+		n->points[j].d -= od;
+		nrate_sums_add(n, n->points[j].x, n->points[j].d);
+	}
+}
+
 static void port_nrate_calculate(struct port *p, tmv_t origin, tmv_t ingress)
 {
 	struct nrate_estimator *n = &p->nrate;
+	double x, d, den;
+	unsigned int i;
 
 	/*
 	 * We experienced a successful exchanges of peer delay request
@@ -908,25 +1380,45 @@ static void port_nrate_calculate(struct port *p, tmv_t origin, tmv_t ingress)
 	 */
 	p->pdr_missing = 0;
 
-	if (!n->ingress1) {
-		n->ingress1 = ingress;
-		n->origin1 = origin;
-		return;
+	if (n->count) {
+		if (tmv_to_nanoseconds(tmv_sub(ingress, n->ingress0)) >
+		    NRATE_MAX_DISTANCE)
+			nrate_rebase(n);
+		x = tmv_to_nanoseconds(tmv_sub(ingress, n->ingress0));
+		if (x <= n->points[(n->head + n->size - 1) % n->size].x) {
+			pr_warning("bad timestamps in nrate calculation");
+			nrate_reset(n);
+		} else if (x > NRATE_MAX_DISTANCE) {
+			nrate_reset(n);
+		}
+	}
+	if (!n->count) {
+		n->ingress0 = ingress;
+		n->origin0 = origin;
+	}
+	x = tmv_to_nanoseconds(tmv_sub(ingress, n->ingress0));
+	d = tmv_to_nanoseconds(tmv_sub(origin, n->origin0)) - x;
+
+	if (n->count == n->size) {
+		i = nrate_oldest(n);
+		n->sx -= n->points[i].x;
+		n->sd -= n->points[i].d;
+		n->sxx -= n->points[i].x * n->points[i].x;
+		n->sxd -= n->points[i].x * n->points[i].d;
+		n->count--;
 	}
+	n->points[n->head].x = x;
+	n->points[n->head].d = d;
+	n->head = (n->head + 1) % n->size;
 	n->count++;
-	if (n->count < n->max_count) {
+	nrate_sums_add(n, x, d);
+
+	if (n->count < 2)
 		return;
-	}
-	if (tmv_eq(ingress, n->ingress1)) {
-		pr_warning("bad timestamps in nrate calculation");
+	den = n->count * n->sxx - n->sx * n->sx;
+	if (den <= 0.0)
 		return;
-	}
-	n->ratio =
-		tmv_dbl(tmv_sub(origin, n->origin1)) /
-		tmv_dbl(tmv_sub(ingress, n->ingress1));
-	n->ingress1 = ingress;
-	n->origin1 = origin;
-	n->count = 0;
+	n->ratio = 1.0 + (n->count * n->sxd - n->sx * n->sd) / den;
 	n->ratio_valid = 1;
 }
 
@@ -947,17 +1439,18 @@ static void port_nrate_initialize(struct port *p)
 
 	p->peer_portid_valid = 0;
 
-	p->nrate.origin1 = tmv_zero();
-	p->nrate.ingress1 = tmv_zero();
-	p->nrate.max_count = (1 << shift);
-	p->nrate.count = 0;
+	/* The window spans freq_est_interval, as far as the points fit. */
+	p->nrate.size = NRATE_MAX_POINTS;
+	if (shift < 31 && (1U << shift) + 1 < NRATE_MAX_POINTS)
+		p->nrate.size = (1U << shift) + 1;
+	nrate_reset(&p->nrate);
 	p->nrate.ratio = 1.0;
 	p->nrate.ratio_valid = 0;
 }
 
 static int port_set_announce_tmo(struct port *p)
 {
-	return set_tmo_random(p->fda.fd[FD_ANNOUNCE_TIMER],
+	return port_tmo_random(p, FD_ANNOUNCE_TIMER,
 			      p->announceReceiptTimeout,
 			      p->announce_span, p->logAnnounceInterval);
 }
@@ -965,35 +1458,52 @@ static int port_set_announce_tmo(struct port *p)
 static int port_set_delay_tmo(struct port *p)
 {
 	if (p->delayMechanism == DM_P2P) {
-		return set_tmo_log(p->fda.fd[FD_DELAY_TIMER], 1,
+		return port_tmo_log(p, FD_DELAY_TIMER, 1,
 			       p->logMinPdelayReqInterval);
 	} else {
-		return set_tmo_random(p->fda.fd[FD_DELAY_TIMER], 0, 2,
+		return port_tmo_random(p, FD_DELAY_TIMER, 0, 2,
 				p->logMinDelayReqInterval);
 	}
 }
 
 static int port_set_manno_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_MANNO_TIMER], 1, p->logAnnounceInterval);
+	if (port_launch_enabled(p))
+		return port_tmo_launch(p, FD_MANNO_TIMER,
+				       p->logAnnounceInterval);
+	return port_tmo_log(p, FD_MANNO_TIMER, 1, p->logAnnounceInterval);
 }
 
 static int port_set_qualification_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_QUALIFICATION_TIMER],
+	return port_tmo_log(p, FD_QUALIFICATION_TIMER,
 		       1+clock_steps_removed(p->clock), p->logAnnounceInterval);
 }
 
 static int port_set_sync_rx_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_SYNC_RX_TIMER],
-			   p->syncReceiptTimeout, p->logSyncInterval);
+	int log_interval = p->logSyncInterval;
+
+	/* The master may have slowed down on our request. */
+	if (p->cold->adaptive_interval && p->log_sync_interval > log_interval)
+		log_interval = p->log_sync_interval;
+
+	return port_tmo_log(p, FD_SYNC_RX_TIMER,
+			   p->syncReceiptTimeout, log_interval);
 }
 
 static int port_set_sync_tx_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_SYNC_TX_TIMER], 1, p->logSyncInterval);
-}
+	if (p->sync_batch) {
+		wheel_set_aligned(clock_wheel(p->clock),
+				  port_timer(p, FD_SYNC_TX_TIMER),
+				  tmo_log_ns(1, p->logSyncInterval));
+		return 0;
+	}
+	if (port_launch_enabled(p))
+		return port_tmo_launch(p, FD_SYNC_TX_TIMER, p->logSyncInterval);
+	return port_tmo_log(p, FD_SYNC_TX_TIMER, 1, p->logSyncInterval);
+}
 
 static void port_show_transition(struct port *p,
 				 enum port_state next, enum fsm_event event)
@@ -1015,6 +1525,383 @@ static void port_slave_priority_warning(struct port *p)
 	pr_warning("port %hu: defaultDS.priority1 probably misconfigured", n);
 }
 
+static uint64_t log_interval_ns(int log_interval)
+{
+	if (log_interval < -30)
+		log_interval = -30;
+	else if (log_interval > 30)
+		log_interval = 30;
+	return log_interval < 0 ? NSEC2SEC >> -log_interval :
+		NSEC2SEC << log_interval;
+}
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * NSEC2SEC + now.tv_nsec;
+}
+
+static void port_interval_reset(struct port *p)
+{
+	memset(p->cold->sync_req_expiry, 0, sizeof(p->cold->sync_req_expiry));
+	memset(p->cold->delay_req_expiry, 0, sizeof(p->cold->delay_req_expiry));
+	p->logSyncInterval = p->cold->initial_logSyncInterval;
+	p->logMinDelayReqInterval = p->cold->initial_logMinDelayReqInterval;
+	clock_mgmt_changed(p->clock);
+}
+
+static void record_interval_request(uint64_t *expiry, Integer8 initial,
+				    Integer8 req, uint64_t now)
+{
+	int i;
+
+	switch (req) {
+	case MSG_INTERVAL_NO_CHANGE:
+	case MSG_INTERVAL_STOP:
+		return;
+	case MSG_INTERVAL_INITIAL:
+		i = 0;
+		break;
+	default:
+		/* Never send faster than configured. */
+		i = req - initial;
+		if (i < 0)
+			i = 0;
+		else if (i >= N_INTERVAL_REQ)
+			i = N_INTERVAL_REQ - 1;
+		break;
+	}
+	expiry[i] = now + INTERVAL_REQ_HOLD * log_interval_ns(initial + i);
+}
+
+static Integer8 requested_interval(uint64_t *expiry, Integer8 initial,
+				   uint64_t now)
+{
+	int i;
+
+	for (i = 0; i < N_INTERVAL_REQ; i++) {
+		if (expiry[i] > now)
+			return initial + i;
+	}
+	return initial;
+}
+
+static void port_update_intervals(struct port *p)
+{
+	uint64_t now;
+	Integer8 val;
+
+	if (!p->cold->allow_interval_requests)
+		return;
+
+	now = monotonic_ns();
+
+	val = requested_interval(p->cold->sync_req_expiry,
+				 p->cold->initial_logSyncInterval, now);
+	if (val != p->logSyncInterval) {
+		p->logSyncInterval = val;
+		clock_mgmt_changed(p->clock);
+		pr_info("port %hu: sync interval 2^%d", portnum(p), val);
+	}
+	if (p->delayMechanism != DM_E2E)
+		return;
+	val = requested_interval(p->cold->delay_req_expiry,
+				 p->cold->initial_logMinDelayReqInterval, now);
+	if (val != p->logMinDelayReqInterval) {
+		p->logMinDelayReqInterval = val;
+		clock_mgmt_changed(p->clock);
+		pr_info("port %hu: minimum delay request interval 2^%d",
+			portnum(p), val);
+	}
+}
+
+static int port_tx_interval_request(struct port *p, Integer8 sync_interval,
+				    Integer8 delay_interval)
+{
+	struct msg_interval_req_tlv *mir;
+	struct ptp_message *msg;
+	int err;
+
+	msg = msg_allocate();
+	if (!msg)
+		return -1;
+
+	msg->hwts.type = p->timestamping;
+
+	msg->header.tsmt               = SIGNALING | p->transportSpecific;
+	msg->header.ver                = PTP_VERSION;
+	msg->header.messageLength      = sizeof(struct signaling_msg) +
+					 sizeof(struct msg_interval_req_tlv);
+	msg->header.domainNumber       = clock_domain_number(p->clock);
+	msg->header.sourcePortIdentity = p->portIdentity;
+	msg->header.sequenceId         = p->seqnum.signaling++;
+	msg->header.control            = CTL_OTHER;
+	msg->header.logMessageInterval = 0x7f;
+
+	msg->signaling.targetPortIdentity = clock_parent_identity(p->clock);
+
+	mir = (struct msg_interval_req_tlv *) msg->signaling.suffix;
+	mir->type = TLV_ORGANIZATION_EXTENSION;
+	mir->length = sizeof(*mir) - sizeof(struct TLV);
+	memcpy(mir->id, ieee8021_id, sizeof(ieee8021_id));
+	mir->subtype[2] = 2;
+	mir->linkDelayInterval = delay_interval;
+	mir->timeSyncInterval = sync_interval;
+	mir->announceInterval = MSG_INTERVAL_NO_CHANGE;
+	/* computeNeighborRateRatio and computeNeighborPropDelay */
+	mir->flags = 0x3;
+	msg->tlv_count = 1;
+
+	/* Spare the other slaves by sending the request to the master only. */
+	if (p->cold->best && p->cold->best->n_messages) {
+		msg->address = p->cold->best->address;
+		msg->header.flagField[0] |= UNICAST;
+	}
+
+	err = port_prepare_and_send(p, msg, 0);
+	if (err)
+		pr_err("port %hu: send signaling failed", portnum(p));
+	msg_put(msg);
+	return err;
+}
+
+/*
+ * Ask the master for slower sync and delay request rates once the servo
+ * has been locked with a small offset for a while, and for the initial
+ * rates as soon as the offset or the servo state show a disturbance.
+ */
+static void port_adapt_interval(struct port *p, enum servo_state state)
+{
+	int64_t offset;
+	int slow;
+
+	if (!p->cold->adaptive_interval)
+		return;
+
+	offset = tmv_to_nanoseconds(clock_master_offset(p->clock));
+	if (state == SERVO_LOCKED &&
+	    llabs(offset) <= p->cold->adaptive_offset_threshold) {
+		if (p->cold->adaptive_count < p->cold->adaptive_lock_count)
+			p->cold->adaptive_count++;
+	} else {
+		p->cold->adaptive_count = 0;
+	}
+	slow = p->cold->adaptive_count >= p->cold->adaptive_lock_count;
+
+	if (slow == p->cold->adaptive_slow &&
+	    ++p->cold->adaptive_refresh < INTERVAL_REQ_REFRESH)
+		return;
+
+	if (slow != p->cold->adaptive_slow)
+		pr_info("port %hu: requesting %s message rates", portnum(p),
+			slow ? "slow" : "initial");
+
+	p->cold->adaptive_slow = slow;
+	p->cold->adaptive_refresh = 0;
+
+	if (slow)
+		port_tx_interval_request(p, p->cold->adaptive_logSyncInterval,
+			p->cold->adaptive_logMinDelayReqInterval);
+	else
+		port_tx_interval_request(p, MSG_INTERVAL_INITIAL,
+					 MSG_INTERVAL_INITIAL);
+}
+
+static int unicast_type(Enumeration8 message_type)
+{
+	switch (message_type >> 4) {
+	case ANNOUNCE:
+		return UNICAST_ANNOUNCE;
+	case SYNC:
+		return UNICAST_SYNC;
+	case DELAY_RESP:
+		return UNICAST_DELAY_RESP;
+	}
+	return -1;
+}
+
+/*
+ * Grants a unicast transmission, returning the duration of the grant,
+ * which is zero if the request is denied.
+ */
+static UInteger32 port_unicast_grant(struct port *p, struct ptp_message *m,
+				     struct request_unicast_xmit_tlv *req)
+{
+	Integer8 min_period;
+	UInteger32 duration;
+	int type;
+
+	type = unicast_type(req->message_type);
+	switch (type) {
+	case UNICAST_ANNOUNCE:
+		min_period = p->logAnnounceInterval;
+		break;
+	case UNICAST_SYNC:
+		min_period = p->cold->initial_logSyncInterval;
+		break;
+	case UNICAST_DELAY_RESP:
+		min_period = p->cold->initial_logMinDelayReqInterval;
+		break;
+	default:
+		return 0;
+	}
+	if (req->logInterMessagePeriod < min_period)
+		return 0;
+	duration = req->durationField;
+	if (duration > p->cold->unicast_max_duration)
+		duration = p->cold->unicast_max_duration;
+	if (!duration)
+		return 0;
+	if (unicast_grant(p->cold->unicast, &m->header.sourcePortIdentity,
+			  &m->address, type, req->logInterMessagePeriod,
+			  duration)) {
+		pl_warning(60, "port %hu: too many unicast clients", portnum(p));
+		return 0;
+	}
+	pr_debug("port %hu: granted %s to %s for %u seconds", portnum(p),
+		 msg_type_string(req->message_type >> 4),
+		 pid2str(&m->header.sourcePortIdentity), duration);
+	return duration;
+}
+
+/*
+ * Answers the unicast negotiation TLVs of a signaling message with one
+ * signaling message carrying all of the grants and acknowledgements.
+ */
+static void process_unicast_negotiation(struct port *p, struct ptp_message *m)
+{
+	struct request_unicast_xmit_tlv *req;
+	struct grant_unicast_xmit_tlv *grant;
+	struct cancel_unicast_xmit_tlv *cancel, *ack;
+	struct ptp_message *rsp = NULL;
+	uint8_t *ptr = m->signaling.suffix;
+	struct TLV *tlv;
+	int i, len = sizeof(struct signaling_msg), type;
+
+	for (i = 0; i < m->tlv_count; i++) {
+		tlv = (struct TLV *) ptr;
+		ptr += sizeof(*tlv) + tlv->length;
+		if (tlv->type != TLV_REQUEST_UNICAST_TRANSMISSION &&
+		    tlv->type != TLV_CANCEL_UNICAST_TRANSMISSION)
+			continue;
+		if (len + sizeof(*grant) > sizeof(rsp->data.buffer))
+			break;
+		if (!rsp) {
+			rsp = msg_allocate();
+			if (!rsp)
+				return;
+		}
+		if (tlv->type == TLV_REQUEST_UNICAST_TRANSMISSION) {
+			req = (struct request_unicast_xmit_tlv *) tlv;
+			grant = (struct grant_unicast_xmit_tlv *)
+				((uint8_t *) &rsp->signaling + len);
+			grant->type = TLV_GRANT_UNICAST_TRANSMISSION;
+			grant->length = sizeof(*grant) - sizeof(struct TLV);
+			grant->message_type = req->message_type & 0xf0;
+			grant->logInterMessagePeriod = req->logInterMessagePeriod;
+			grant->durationField = port_unicast_grant(p, m, req);
+			grant->reserved = 0;
+			grant->flags = grant->durationField ?
+				GRANT_UNICAST_RENEWAL_INVITED : 0;
+			len += sizeof(*grant);
+		} else {
+			cancel = (struct cancel_unicast_xmit_tlv *) tlv;
+			type = unicast_type(cancel->message_type_flags);
+			if (type >= 0)
+				unicast_cancel(p->cold->unicast,
+					       &m->header.sourcePortIdentity,
+					       type);
+			ack = (struct cancel_unicast_xmit_tlv *)
+				((uint8_t *) &rsp->signaling + len);
+			ack->type = TLV_ACKNOWLEDGE_CANCEL_UNICAST_TRANSMISSION;
+			ack->length = sizeof(*ack) - sizeof(struct TLV);
+			ack->message_type_flags =
+				cancel->message_type_flags & 0xf0;
+			ack->reserved = 0;
+			len += sizeof(*ack);
+		}
+		rsp->tlv_count++;
+	}
+	if (!rsp)
+		return;
+
+	rsp->hwts.type = p->timestamping;
+
+	rsp->header.tsmt               = SIGNALING | p->transportSpecific;
+	rsp->header.ver                = PTP_VERSION;
+	rsp->header.messageLength      = len;
+	rsp->header.domainNumber       = clock_domain_number(p->clock);
+	rsp->header.sourcePortIdentity = p->portIdentity;
+	rsp->header.sequenceId         = p->seqnum.signaling++;
+	rsp->header.control            = CTL_OTHER;
+	rsp->header.logMessageInterval = 0x7f;
+	rsp->header.flagField[0]      |= UNICAST;
+
+	rsp->signaling.targetPortIdentity = m->header.sourcePortIdentity;
+	rsp->address = m->address;
+
+	if (port_prepare_and_send(p, rsp, 0))
+		pr_err("port %hu: send unicast negotiation failed", portnum(p));
+	msg_put(rsp);
+}
+
+static void process_signaling(struct port *p, struct ptp_message *m)
+{
+	struct PortIdentity *target = &m->signaling.targetPortIdentity;
+	struct PortIdentity wildcard;
+	struct msg_interval_req_tlv *mir;
+	struct organization_tlv *org;
+	uint8_t *ptr = m->signaling.suffix;
+	struct TLV *tlv;
+	uint64_t now;
+	int i;
+
+	if (!p->cold->allow_interval_requests && !p->cold->unicast)
+		return;
+
+	switch (p->state) {
+	case PS_MASTER:
+	case PS_GRAND_MASTER:
+		break;
+	default:
+		return;
+	}
+
+	memset(&wildcard, 0xff, sizeof(wildcard));
+	if (!pid_eq(target, &p->portIdentity) && !pid_eq(target, &wildcard))
+		return;
+
+	if (p->cold->unicast)
+		process_unicast_negotiation(p, m);
+	if (!p->cold->allow_interval_requests)
+		return;
+
+	now = monotonic_ns();
+
+	for (i = 0; i < m->tlv_count; i++) {
+		tlv = (struct TLV *) ptr;
+		ptr += sizeof(*tlv) + tlv->length;
+		if (tlv->type != TLV_ORGANIZATION_EXTENSION)
+			continue;
+		org = (struct organization_tlv *) tlv;
+		if (memcmp(org->id, ieee8021_id, sizeof(ieee8021_id)) ||
+		    org->subtype[0] || org->subtype[1] || org->subtype[2] != 2)
+			continue;
+		mir = (struct msg_interval_req_tlv *) tlv;
+		record_interval_request(p->cold->sync_req_expiry,
+					p->cold->initial_logSyncInterval,
+					mir->timeSyncInterval, now);
+		if (p->delayMechanism == DM_E2E)
+			record_interval_request(p->cold->delay_req_expiry,
+				p->cold->initial_logMinDelayReqInterval,
+				mir->linkDelayInterval, now);
+	}
+
+	port_update_intervals(p);
+}
+
 static void port_synchronize(struct port *p,
 			     struct timespec ingress_ts,
 			     struct timestamp origin_ts,
@@ -1032,6 +1919,7 @@ static void port_synchronize(struct port *p,
 	t1c = tmv_add(t1, tmv_add(c1, c2));
 
 	state = clock_synchronize(p->clock, t2, t1c);
+	port_adapt_interval(p, state);
 	switch (state) {
 	case SERVO_UNLOCKED:
 		port_dispatch(p, EV_SYNCHRONIZATION_FAULT, 0);
@@ -1057,87 +1945,718 @@ static void port_synchronize(struct port *p,
  * Handle out of order packets. The network stack might
  * provide the follow up _before_ the sync message. After all,
  * they can arrive on two different ports. In addition, time
- * stamping in PHY devices might delay the event packets.
+ * stamping in PHY devices might delay the event packets, so
+ * that at high rates the halves of consecutive Sync messages
+ * may be interleaved.
+ *
+ * The halves wait in a ring indexed by the sequence ID. A half
+ * left over from an older sequence is released when its slot
+ * is taken again.
  */
-static void port_syfufsm(struct port *p, enum syfu_event event,
-			 struct ptp_message *m)
+static void syfu_slot_flush(struct syfu_slot *s)
 {
-	struct ptp_message *syn, *fup;
+	if (s->sync) {
+		msg_put(s->sync);
+		s->sync = NULL;
+	}
+	if (s->fup) {
+		msg_put(s->fup);
+		s->fup = NULL;
+	}
+}
 
-	switch (p->syfu) {
-	case SF_EMPTY:
-		switch (event) {
-		case SYNC_MISMATCH:
-			msg_get(m);
-			p->last_syncfup = m;
-			p->syfu = SF_HAVE_SYNC;
-			break;
-		case FUP_MISMATCH:
-			msg_get(m);
-			p->last_syncfup = m;
-			p->syfu = SF_HAVE_FUP;
-			break;
-		case SYNC_MATCH:
-			break;
-		case FUP_MATCH:
+static struct syfu_slot *syfu_slot(struct port *p, struct ptp_message *m)
+{
+	UInteger16 seq = m->header.sequenceId;
+	struct syfu_slot *s = &p->syfu[seq & (SYFU_RING - 1)];
+
+	if ((s->sync && s->sync->header.sequenceId != seq) ||
+	    (s->fup && s->fup->header.sequenceId != seq))
+		syfu_slot_flush(s);
+	return s;
+}
+
+/* Whether a pair is older than the last one given to the servo. */
+static int syfu_stale(struct port *p, UInteger16 seq)
+{
+	UInteger16 age = p->syfu_last - seq;
+
+	return p->syfu_paired && age < SYFU_RING;
+}
+
+static void port_syfu_pair(struct port *p, struct syfu_slot *s)
+{
+	struct ptp_message *syn = s->sync, *fup = s->fup;
+
+	if (!syfu_stale(p, syn->header.sequenceId)) {
+		port_synchronize(p, syn->hwts.ts, fup->ts.pdu,
+				 syn->header.correction,
+				 fup->header.correction);
+		p->syfu_last = syn->header.sequenceId;
+		p->syfu_paired = 1;
+	}
+	syfu_slot_flush(s);
+}
+
+static void port_syfu_sync(struct port *p, struct ptp_message *m)
+{
+	struct syfu_slot *s = syfu_slot(p, m);
+
+	if (s->fup && !fup_sync_ok(s->fup, m))
+		syfu_slot_flush(s);
+	if (s->sync)
+		msg_put(s->sync);
+	msg_get(m);
+	s->sync = m;
+	if (s->fup)
+		port_syfu_pair(p, s);
+}
+
+static void port_syfu_fup(struct port *p, struct ptp_message *m)
+{
+	struct syfu_slot *s = syfu_slot(p, m);
+
+	if (s->fup)
+		msg_put(s->fup);
+	msg_get(m);
+	s->fup = m;
+	if (s->sync)
+		port_syfu_pair(p, s);
+}
+
+/*
+ * Suggests a tx_timestamp_timeout in milliseconds, twice the 99.9th
+ * percentile of the time the time stamps took, or zero while there are
+ * too few of them to tell.
+ */
+static unsigned int txts_suggested_timeout(struct port *p)
+{
+	struct stats_result res;
+	int64_t ns;
+
+	if (stats_get_num_values(p->cold->txts_wait) < TXTS_SUGGEST_MIN ||
+	    stats_get_result(p->cold->txts_wait, &res))
+		return 0;
+	ns = 2.0 * res.p999_abs;
+	return ns > 1000000 ? (ns + 999999) / 1000000 : 1;
+}
+
+static void txts_summary(struct port *p, tmv_t now)
+{
+	int interval = clock_summary_interval(p->clock);
+	struct stats_result res;
+	unsigned int timeout;
+
+	/* Like the clock, print a summary only for intervals above 1 s. */
+	if ((interval > 0 || p->cold->cfg.tx_timestamp_tuning) &&
+	    !tmv_is_zero(p->cold->txts_summary) &&
+	    !stats_get_result(p->cold->txts_wait_recent, &res)) {
+		pr_info("port %hu: tx timestamp wait p50 %.0f p99 %.0f "
+			"p99.9 %.0f max %.0f", portnum(p), res.p50_abs,
+			res.p99_abs, res.p999_abs, res.max_abs);
+		timeout = txts_suggested_timeout(p);
+		if (p->cold->cfg.tx_timestamp_tuning && timeout)
+			pr_info("port %hu: suggested tx_timestamp_timeout %u, "
+				"now %d", portnum(p), timeout, sk_tx_timeout);
+	}
+	interval = interval < 0 ? 0 : interval > 30 ? 30 : interval;
+	p->cold->txts_summary =
+		tmv_add(now, nanoseconds_to_tmv(NS_PER_SEC << interval));
+	stats_reset(p->cold->txts_wait_recent);
+}
+
+/* Records the nanoseconds a transmit time stamp took to show up. */
+static void txts_wait_add(struct port *p, int64_t wait)
+{
+	struct timespec ts;
+	tmv_t now;
+
+	stats_add_value(p->cold->txts_wait, wait);
+	stats_add_value(p->cold->txts_wait_recent, wait);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = timespec_to_tmv(ts);
+	if (tmv_cmp(now, p->cold->txts_summary) >= 0)
+		txts_summary(p, now);
+}
+
+void port_get_txts_stats(struct port *p, struct tx_timestamp_stats_np *tsn)
+{
+	unsigned int hist[TX_TIMESTAMP_HIST_BINS];
+	struct stats_result res;
+
+	memset(tsn, 0, sizeof(*tsn));
+	tsn->portIdentity = p->portIdentity;
+	tsn->count = stats_get_num_values(p->cold->txts_wait);
+	tsn->timeouts = p->cold->txts_timeouts;
+	tsn->timeout = sk_tx_timeout;
+	tsn->suggested_timeout = txts_suggested_timeout(p);
+	if (!stats_get_result(p->cold->txts_wait, &res)) {
+		tsn->mean = res.mean;
+		tsn->p50 = res.p50_abs;
+		tsn->p99 = res.p99_abs;
+		tsn->p999 = res.p999_abs;
+		tsn->max = res.max_abs;
+	}
+	/* The TLV is packed, so its histogram may be unaligned. */
+	stats_get_histogram(p->cold->txts_wait, hist, TX_TIMESTAMP_HIST_BINS);
+	memcpy(tsn->histogram, hist, sizeof(hist));
+}
+
+/*
+ * Deferred transmit time stamps. When tx_timestamp_async is enabled,
+ * two-step event messages are sent with TRANS_DEFER, and their time
+ * stamps are read from the error queue whenever the port has an event.
+ */
+static int txts_event(struct port *p)
+{
+	return p->tx_async ? TRANS_DEFER : TRANS_EVENT;
+}
+
+static struct txts_pending *txts_slot(struct port *p, struct ptp_message *msg,
+				      struct ptp_message *fup)
+{
+	struct txts_pending *e = NULL;
+	struct timespec now;
+	int i;
+
+	for (i = 0; i < N_TXTS_PENDING; i++) {
+		if (!p->txts[i].msg) {
+			e = &p->txts[i];
 			break;
 		}
+	}
+	if (!e) {
+		pr_err("port %hu: too many pending tx timestamps", portnum(p));
+		return NULL;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	e->sent = timespec_to_tmv(now);
+	/* A message with a launch time leaves only later. */
+	if (msg->hwts.txtime)
+		e->sent = tmv_add(e->sent, nanoseconds_to_tmv(
+					  p->cold->cfg.tx_launch_lead));
+	e->deadline = tmv_add(e->sent, dbl_tmv(sk_tx_timeout * 1e6));
+	msg_get(msg);
+	e->msg = msg;
+	if (fup)
+		msg_get(fup);
+	e->fup = fup;
+	e->id = msg->hwts.id;
+	p->txts_count++;
+	return e;
+}
+
+static int txts_add(struct port *p, struct ptp_message *msg,
+		    struct ptp_message *fup)
+{
+	return txts_slot(p, msg, fup) ? 0 : -1;
+}
+
+static void txts_remove(struct port *p, struct txts_pending *e)
+{
+	msg_put(e->msg);
+	if (e->fup)
+		msg_put(e->fup);
+	memset(e, 0, sizeof(*e));
+	p->txts_count--;
+}
+
+static void txts_flush(struct port *p)
+{
+	int i;
+
+	for (i = 0; i < N_TXTS_PENDING; i++) {
+		if (p->txts[i].msg)
+			txts_remove(p, &p->txts[i]);
+	}
+}
+
+static int txts_pending(struct port *p, struct ptp_message *msg)
+{
+	int i;
+
+	if (!p->txts_count)
+		return 0;
+	for (i = 0; i < N_TXTS_PENDING; i++) {
+		if (p->txts[i].msg == msg)
+			return 1;
+	}
+	return 0;
+}
+
+static int txts_complete(struct port *p, struct txts_pending *e,
+			 struct timespec ts)
+{
+	struct ptp_message *msg = e->msg, *fup = e->fup;
+	struct timespec now;
+	int err = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	txts_wait_add(p, tmv_to_nanoseconds(tmv_sub(timespec_to_tmv(now),
+						    e->sent)));
+	ts_add(&ts, p->tx_timestamp_offset);
+
+	if (e->tc) {
+		tc_complete(p, e, timespec_to_tmv(ts));
+		txts_remove(p, e);
+		return 0;
+	}
+
+	/* Take over the references held by the table entry. */
+	memset(e, 0, sizeof(*e));
+	p->txts_count--;
+
+	msg->hwts.ts = ts;
+
+	switch (msg_type(msg)) {
+	case SYNC:
+		ts_to_net_timestamp(&msg->hwts.ts,
+				    &fup->follow_up.preciseOriginTimestamp);
+		err = port_send(p, fup, 0);
+		if (err)
+			pr_err("port %hu: send follow up failed", portnum(p));
 		break;
+	case PDELAY_RESP:
+		ts_to_timestamp(&msg->hwts.ts,
+				&fup->pdelay_resp_fup.responseOriginTimestamp);
+		err = peer_prepare_and_send(p, fup, 0);
+		if (err)
+			pr_err("port %hu: send pdelay_resp_fup failed",
+			       portnum(p));
+		break;
+	case PDELAY_REQ:
+		/* The response may have arrived before the time stamp. */
+		if (msg == p->peer_delay_req)
+			port_peer_delay(p);
+		break;
+	}
 
-	case SF_HAVE_SYNC:
-		switch (event) {
-		case SYNC_MISMATCH:
-			msg_put(p->last_syncfup);
-			msg_get(m);
-			p->last_syncfup = m;
-			break;
-		case SYNC_MATCH:
-			break;
-		case FUP_MISMATCH:
-			msg_put(p->last_syncfup);
-			msg_get(m);
-			p->last_syncfup = m;
-			p->syfu = SF_HAVE_FUP;
-			break;
-		case FUP_MATCH:
-			syn = p->last_syncfup;
-			port_synchronize(p, syn->hwts.ts, m->ts.pdu,
-					 syn->header.correction,
-					 m->header.correction);
-			msg_put(p->last_syncfup);
-			p->syfu = SF_EMPTY;
+	msg_put(msg);
+	if (fup)
+		msg_put(fup);
+	return err;
+}
+
+static int txts_keyed(struct txts_pending *e, unsigned char *pkt, int cnt,
+		      struct hw_timestamp *hwts)
+{
+	struct ptp_header *hdr = e->tc ? &e->hdr : &e->msg->header;
+
+	if (hwts->id_valid)
+		return e->id == hwts->id;
+	/*
+	 * Without a key, the error queue returns the message as it was
+	 * sent, so look for its PTP header in the looped back packet.
+	 */
+	return memmem(pkt, cnt, hdr, sizeof(*hdr)) != NULL;
+}
+
+static int txts_match(struct port *p, unsigned char *pkt, int cnt,
+		      struct hw_timestamp *hwts)
+{
+	struct txts_pending *e;
+	int i;
+
+	for (i = 0; i < N_TXTS_PENDING; i++) {
+		e = &p->txts[i];
+		if (e->msg && txts_keyed(e, pkt, cnt, hwts))
+			return txts_complete(p, e, hwts->ts);
+	}
+	pr_debug("port %hu: ignoring unmatched tx timestamp", portnum(p));
+	return 0;
+}
+
+static int txts_poll(struct port *p)
+{
+	unsigned char pkt[1600];
+	struct hw_timestamp hwts;
+	struct txts_pending *e;
+	struct timespec now;
+	int cnt, err = 0, i, len;
+
+	while (1) {
+		memset(&hwts, 0, sizeof(hwts));
+		hwts.type = p->timestamping;
+		len = sizeof(pkt);
+		cnt = transport_txts(p->trp, &p->fda, pkt, &len, &hwts);
+		if (cnt < 0)
+			return -1;
+		if (!cnt)
 			break;
+		if (!hwts.ts.tv_sec && !hwts.ts.tv_nsec)
+			continue;
+		if (txts_match(p, pkt, len, &hwts))
+			err = -1;
+	}
+	if (err || !p->txts_count)
+		return err;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < N_TXTS_PENDING; i++) {
+		e = &p->txts[i];
+		if (!e->msg)
+			continue;
+		if (tmv_to_nanoseconds(tmv_sub(timespec_to_tmv(now),
+					       e->deadline)) < 0)
+			continue;
+		pr_err("port %hu: timed out while waiting for tx timestamp",
+		       portnum(p));
+		msgtype_stat(p, tx_ts_timeout, e->msg);
+		p->cold->txts_timeouts++;
+		pr_err("increasing tx_timestamp_timeout may correct "
+		       "this issue, but it is likely caused by a driver bug");
+		/* A forwarded message only loses its correction. */
+		if (!e->tc)
+			err = -1;
+		txts_remove(p, e);
+	}
+	return err;
+}
+
+int port_sync_wait(struct port *p)
+{
+	struct pollfd pfd = { -1, POLLPRI, 0 };
+	struct timespec now;
+	int64_t left;
+	tmv_t first = tmv_zero();
+	int i, n;
+
+	/* The first port to wait sends the held back messages of all. */
+	if (transport_flush(p->trp))
+		return -1;
+	pfd.fd = transport_txts_fd(p->trp, &p->fda);
+
+	while (1) {
+		if (txts_poll(p))
+			return -1;
+		for (n = 0, i = 0; i < N_TXTS_PENDING; i++) {
+			if (!p->txts[i].msg || p->txts[i].tc ||
+			    msg_type(p->txts[i].msg) != SYNC)
+				continue;
+			if (!n++ || tmv_cmp(p->txts[i].deadline, first) < 0)
+				first = p->txts[i].deadline;
 		}
-		break;
+		if (!n)
+			return 0;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left = tmv_to_nanoseconds(tmv_sub(first, timespec_to_tmv(now)));
+		/* An expired entry is dropped by the next txts_poll(). */
+		poll(&pfd, 1, left > 0 ? (left + 999999) / 1000000 : 0);
+	}
+}
 
-	case SF_HAVE_FUP:
-		switch (event) {
-		case SYNC_MISMATCH:
-			msg_put(p->last_syncfup);
-			msg_get(m);
-			p->last_syncfup = m;
-			p->syfu = SF_HAVE_SYNC;
-			break;
-		case SYNC_MATCH:
-			fup = p->last_syncfup;
-			port_synchronize(p, m->hwts.ts, fup->ts.pdu,
-					 m->header.correction,
-					 fup->header.correction);
-			msg_put(p->last_syncfup);
-			p->syfu = SF_EMPTY;
-			break;
-		case FUP_MISMATCH:
-			msg_put(p->last_syncfup);
+/*
+ * Transparent clock. The received messages leave through the other
+ * ports as they are, in network byte order, without being copied. An
+ * event message is sent out of all of the ports before any of the time
+ * stamps is collected, so that the egress ports do not wait for each
+ * other. The time stamps are collected with the deferred ones of the
+ * port's own messages, without blocking the event loop. The residence
+ * time on each egress port is kept there until the matching Follow_Up
+ * or Delay_Resp message passes by. A Follow_Up overtaking the time stamp
+ * of its Sync waits in the pending entry.
+ */
+static int port_is_tc(struct port *p)
+{
+	switch (clock_type(p->clock)) {
+	case CLOCK_TYPE_P2P:
+	case CLOCK_TYPE_E2E:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int tc_blocked(struct port *p, struct port *q)
+{
+	if (p == q)
+		return 1;
+	switch (q->state) {
+	case PS_INITIALIZING:
+	case PS_FAULTY:
+	case PS_DISABLED:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void tc_store(struct port *q, int type, struct PortIdentity *source,
+		     UInteger16 sequenceId, tmv_t residence)
+{
+	struct port_cold *c = q->cold;
+	struct tc_residence *r = &c->tc[c->tc_next++ % N_TC_RESIDENCE];
+
+	r->source = *source;
+	r->sequenceId = sequenceId;
+	r->type = type;
+	r->valid = 1;
+	r->residence = residence;
+}
+
+static int tc_lookup(struct port *q, int type, struct PortIdentity *source,
+		     UInteger16 sequenceId, tmv_t *residence)
+{
+	struct tc_residence *r;
+	int i;
+
+	for (i = 0; i < N_TC_RESIDENCE; i++) {
+		r = &q->cold->tc[i];
+		if (r->valid && r->type == type &&
+		    r->sequenceId == sequenceId && pid_eq(&r->source, source)) {
+			r->valid = 0;
+			*residence = r->residence;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void tc_fwd_general(struct port *p, struct ptp_message *m)
+{
+	struct port *q;
+
+	msg_pre_forward(m);
+	for (q = clock_first_port(p->clock); q; q = LIST_NEXT(q, list)) {
+		if (tc_blocked(p, q))
+			continue;
+		if (transport_send(q->trp, &q->fda, TRANS_GENERAL, m) <= 0) {
+			pr_err("port %hu: forwarding %s failed", portnum(q),
+			       msg_type_string(msg_type(m)));
+			continue;
+		}
+		msgtype_stat(q, tx, m);
+	}
+	msg_post_forward(m);
+}
+
+static int tc_pending(struct txts_pending *e, int type,
+		      struct PortIdentity *source, UInteger16 sequenceId)
+{
+	struct PortIdentity pid = e->hdr.sourcePortIdentity;
+
+	pid.portNumber = ntohs(pid.portNumber);
+	return e->tc && (e->hdr.tsmt & 0x0f) == type &&
+		ntohs(e->hdr.sequenceId) == sequenceId && pid_eq(&pid, source);
+}
+
+/* The Follow_Up is in network byte order, apart from its correction. */
+static void tc_send_folup(struct port *q, struct ptp_message *m,
+			  Integer64 correction, tmv_t residence)
+{
+	m->header.correction =
+		host2net64(correction + tmv_to_TimeInterval(residence));
+	if (transport_send(q->trp, &q->fda, TRANS_GENERAL, m) <= 0) {
+		pr_err("port %hu: forwarding follow up failed", portnum(q));
+		return;
+	}
+	msgtype_stat(q, tx, m);
+}
+
+/* Each egress port adds the residence time of the Sync it sent. */
+static void tc_fwd_folup(struct port *p, struct ptp_message *m)
+{
+	Integer64 correction = m->header.correction;
+	struct PortIdentity source = m->header.sourcePortIdentity;
+	UInteger16 sequenceId = m->header.sequenceId;
+	struct txts_pending *e;
+	tmv_t residence;
+	struct port *q;
+	int i;
+
+	msg_pre_forward(m);
+	for (q = clock_first_port(p->clock); q; q = LIST_NEXT(q, list)) {
+		if (tc_blocked(p, q))
+			continue;
+		if (tc_lookup(q, SYNC, &source, sequenceId, &residence)) {
+			tc_send_folup(q, m, correction, residence);
+			continue;
+		}
+		for (i = 0; q->txts_count && i < N_TXTS_PENDING; i++) {
+			e = &q->txts[i];
+			if (e->fup || !tc_pending(e, SYNC, &source, sequenceId))
+				continue;
 			msg_get(m);
-			p->last_syncfup = m;
-			break;
-		case FUP_MATCH:
+			e->fup = m;
 			break;
 		}
+	}
+	m->header.correction = host2net64(correction);
+	msg_post_forward(m);
+}
+
+/*
+ * A one-step Sync cannot carry a residence time which is only known
+ * after it has been sent, so it leaves as a two-step Sync followed by a
+ * Follow_Up with its origin time stamp.
+ */
+static void tc_fwd_onestep(struct port *p, struct ptp_message *sync)
+{
+	struct ptp_message *fup;
+
+	fup = msg_allocate_len(sizeof(struct follow_up_msg));
+	if (!fup)
+		return;
+
+	fup->header = sync->header;
+	fup->header.tsmt          = FOLLOW_UP | (sync->header.tsmt & 0xf0);
+	fup->header.messageLength = sizeof(struct follow_up_msg);
+	fup->header.correction    = 0;
+	fup->header.control       = CTL_FOLLOW_UP;
+	fup->header.flagField[0] &= ~TWO_STEP;
+
+	/* Both time stamps are still in network byte order. */
+	fup->follow_up.preciseOriginTimestamp = sync->sync.originTimestamp;
+
+	tc_fwd_folup(p, fup);
+	msg_put(fup);
+}
+
+static void tc_complete(struct port *q, struct txts_pending *e, tmv_t egress)
+{
+	struct PortIdentity source = e->hdr.sourcePortIdentity;
+	tmv_t residence = tmv_sub(egress, e->ingress);
+	struct ptp_message *fup = e->fup;
+	Integer64 correction;
+
+	if (!fup) {
+		source.portNumber = ntohs(source.portNumber);
+		tc_store(q, e->hdr.tsmt & 0x0f, &source,
+			 ntohs(e->hdr.sequenceId), residence);
+		return;
+	}
+	correction = fup->header.correction;
+	msg_pre_forward(fup);
+	tc_send_folup(q, fup, correction, residence);
+	fup->header.correction = host2net64(correction);
+	msg_post_forward(fup);
+}
+
+static void tc_fwd_event(struct port *p, struct ptp_message *m)
+{
+	int type = msg_type(m), onestep = type == SYNC && one_step(m);
+	struct txts_pending *e;
+	tmv_t ingress;
+	struct port *q;
+
+	if (!msg_sots_valid(m))
+		return;
+	ingress = timespec_to_tmv(m->hwts.ts);
+	/* A peer to peer clock also accounts for the ingress link. */
+	if (type == SYNC && p->delayMechanism == DM_P2P) {
+		ingress = tmv_sub(ingress, p->peer_delay);
+		ingress = tmv_sub(ingress, correction_to_tmv(p->asymmetry));
+	}
+
+	if (onestep)
+		m->header.flagField[0] |= TWO_STEP;
+	msg_pre_forward(m);
+
+	for (q = clock_first_port(p->clock); q; q = LIST_NEXT(q, list)) {
+		if (tc_blocked(p, q))
+			continue;
+		if (transport_send(q->trp, &q->fda, TRANS_DEFER, m) <= 0) {
+			pr_err("port %hu: forwarding %s failed", portnum(q),
+			       msg_type_string(type));
+			continue;
+		}
+		msgtype_stat(q, tx, m);
+		/* The message went out on every port, each with its own key. */
+		e = txts_slot(q, m, NULL);
+		if (!e)
+			continue;
+		e->tc = 1;
+		e->ingress = ingress;
+		e->hdr = m->header;
+	}
+
+	msg_post_forward(m);
+	if (onestep) {
+		m->header.flagField[0] &= ~TWO_STEP;
+		tc_fwd_onestep(p, m);
+	}
+}
+
+/* The ingress port saw the Delay_Req leave towards the master. */
+static void tc_fwd_delay_resp(struct port *p, struct ptp_message *m)
+{
+	struct PortIdentity source = m->delay_resp.requestingPortIdentity;
+	Integer64 correction = m->header.correction;
+	tmv_t residence;
+
+	source.portNumber = ntohs(source.portNumber);
+	if (!tc_lookup(p, DELAY_REQ, &source, m->header.sequenceId, &residence))
+		return;
+	m->header.correction += tmv_to_TimeInterval(residence);
+	tc_fwd_general(p, m);
+	m->header.correction = correction;
+}
+
+static void tc_forward(struct port *p, struct ptp_message *m)
+{
+	int e2e = clock_type(p->clock) == CLOCK_TYPE_E2E;
+
+	switch (msg_type(m)) {
+	case SYNC:
+		tc_fwd_event(p, m);
+		break;
+	case FOLLOW_UP:
+		tc_fwd_folup(p, m);
+		break;
+	case DELAY_REQ:
+		if (e2e)
+			tc_fwd_event(p, m);
+		break;
+	case DELAY_RESP:
+		if (e2e)
+			tc_fwd_delay_resp(p, m);
+		break;
+	case ANNOUNCE:
+		tc_fwd_general(p, m);
 		break;
 	}
 }
 
+/*
+ * Returns a message buffer for a peer delay message of length len. The
+ * buffer kept in the slot is cleared and reused, unless it is still held
+ * elsewhere, e.g. by a pending transmit time stamp. Then a new buffer
+ * takes its place. Either way, the caller gets its own reference.
+ */
+static struct ptp_message *pdelay_buf(struct ptp_message **slot, size_t len)
+{
+	struct ptp_message *m = *slot;
+
+	if (m && m->refcnt == 1) {
+		memset(&m->data, 0, len);
+		memset(&m->hwts, 0, sizeof(m->hwts));
+		msg_get(m);
+		return m;
+	}
+	m = msg_allocate_len(len);
+	if (!m)
+		return NULL;
+	if (*slot)
+		msg_put(*slot);
+	msg_get(m);
+	*slot = m;
+	return m;
+}
+
+static void pdelay_rx_save(struct pdelay_rx *d, struct ptp_message *m,
+			   struct PortIdentity *requesting)
+{
+	d->valid = 1;
+	d->one_step = one_step(m);
+	d->source = m->header.sourcePortIdentity;
+	d->requesting = *requesting;
+	d->sequenceId = m->header.sequenceId;
+	d->correction = m->header.correction;
+	d->origin = m->ts.pdu;
+	d->ingress = m->hwts.ts;
+}
+
 static int port_pdelay_request(struct port *p)
 {
 	struct ptp_message *msg;
@@ -1148,7 +2667,16 @@ static int port_pdelay_request(struct port *p)
 		p->multiple_seq_pdr_count = 0;
 	p->multiple_pdr_detected = 0;
 
-	msg = msg_allocate();
+	/* Give up the previous request, so that its buffer may be reused. */
+	if (p->peer_delay_req) {
+		if (port_capable(p)) {
+			p->pdr_missing++;
+		}
+		msg_put(p->peer_delay_req);
+		p->peer_delay_req = NULL;
+	}
+
+	msg = pdelay_buf(&p->pdelay_req_buf, sizeof(struct pdelay_req_msg));
 	if (!msg)
 		return -1;
 
@@ -1165,22 +2693,19 @@ static int port_pdelay_request(struct port *p)
 	msg->header.logMessageInterval = port_is_ieee8021as(p) ?
 		p->logMinPdelayReqInterval : 0x7f;
 
-	err = peer_prepare_and_send(p, msg, 1);
+	err = peer_prepare_and_send(p, msg, txts_event(p));
 	if (err) {
 		pr_err("port %hu: send peer delay request failed", portnum(p));
 		goto out;
 	}
-	if (msg_sots_missing(msg)) {
+	if (p->tx_async) {
+		if (txts_add(p, msg, NULL))
+			goto out;
+	} else if (msg_sots_missing(msg)) {
 		pr_err("missing timestamp on transmitted peer delay request");
 		goto out;
 	}
 
-	if (p->peer_delay_req) {
-		if (port_capable(p)) {
-			p->pdr_missing++;
-		}
-		msg_put(p->peer_delay_req);
-	}
 	p->peer_delay_req = msg;
 	return 0;
 out:
@@ -1188,50 +2713,144 @@ out:
 	return -1;
 }
 
-static int port_delay_request(struct port *p)
+static void template_key_init(struct port *p, struct template_key *key,
+			      Integer8 interval)
 {
+	memset(key, 0, sizeof(*key));
+	key->domainNumber = clock_domain_number(p->clock);
+	key->logMessageInterval = interval;
+}
+
+static void template_build(struct port *p, enum template_type type,
+			   struct template_key *key, struct ptp_message *msg)
+{
+	int pdulen;
+
+	msg->header.ver                = PTP_VERSION;
+	msg->header.domainNumber       = key->domainNumber;
+	msg->header.sourcePortIdentity = p->portIdentity;
+	msg->header.logMessageInterval = key->logMessageInterval;
+
+	switch (type) {
+	case TMPL_ANNOUNCE:
+		pdulen = sizeof(struct announce_msg);
+		if (p->path_trace_enabled)
+			pdulen += path_trace_append(p, msg,
+						    clock_parent_ds(p->clock));
+		msg->header.tsmt          = ANNOUNCE | p->transportSpecific;
+		msg->header.messageLength = pdulen;
+		msg->header.control       = CTL_OTHER;
+		msg->header.flagField[1]  = key->tds.flags;
+
+		msg->announce.currentUtcOffset = key->tds.currentUtcOffset;
+		msg->announce.grandmasterPriority1 =
+			key->pds.grandmasterPriority1;
+		msg->announce.grandmasterClockQuality =
+			key->pds.grandmasterClockQuality;
+		msg->announce.grandmasterPriority2 =
+			key->pds.grandmasterPriority2;
+		msg->announce.grandmasterIdentity =
+			key->pds.grandmasterIdentity;
+		msg->announce.stepsRemoved = key->stepsRemoved;
+		msg->announce.timeSource = key->tds.timeSource;
+		break;
+	case TMPL_SYNC:
+		msg->header.tsmt          = SYNC | p->transportSpecific;
+		msg->header.messageLength = sizeof(struct sync_msg);
+		msg->header.control       = CTL_SYNC;
+		if (p->timestamping < TS_ONESTEP)
+			msg->header.flagField[0] |= TWO_STEP;
+		break;
+	case TMPL_FOLLOW_UP:
+		pdulen = sizeof(struct follow_up_msg);
+		if (p->follow_up_info)
+			pdulen += follow_up_info_append(p, msg);
+		msg->header.tsmt          = FOLLOW_UP | p->transportSpecific;
+		msg->header.messageLength = pdulen;
+		msg->header.control       = CTL_FOLLOW_UP;
+		break;
+	case TMPL_DELAY_REQ:
+		msg->header.tsmt          = DELAY_REQ | p->transportSpecific;
+		msg->header.messageLength = sizeof(struct delay_req_msg);
+		msg->header.correction    = -p->asymmetry;
+		msg->header.control       = CTL_DELAY_REQ;
+		break;
+	case N_TEMPLATES:
+		break;
+	}
+}
+
+/*
+ * Returns a new message in network byte order made from a template,
+ * after rebuilding the template if the key has changed.
+ */
+static struct ptp_message *port_template(struct port *p,
+					 enum template_type type,
+					 struct template_key *key)
+{
+	struct msg_template *t = &p->cold->templates[type];
 	struct ptp_message *msg;
 
-	/* Time to send a new request, forget current pdelay resp and fup */
-	if (p->peer_delay_resp) {
-		msg_put(p->peer_delay_resp);
-		p->peer_delay_resp = NULL;
+	if (t->valid && !memcmp(&t->key, key, sizeof(*key))) {
+		msg = msg_allocate_len(t->len);
+		if (!msg)
+			return NULL;
+		msg->hwts.type = p->timestamping;
+		memcpy(&msg->data, t->data, t->len);
+		return msg;
 	}
-	if (p->peer_delay_fup) {
-		msg_put(p->peer_delay_fup);
-		p->peer_delay_fup = NULL;
+
+	msg = msg_allocate();
+	if (!msg)
+		return NULL;
+	msg->hwts.type = p->timestamping;
+
+	template_build(p, type, key, msg);
+	if (msg_pre_send(msg)) {
+		msg_put(msg);
+		return NULL;
 	}
+	t->len = ntohs(msg->header.messageLength);
+	t->valid = t->len <= sizeof(t->data);
+	if (t->valid) {
+		memcpy(t->data, &msg->data, t->len);
+		t->key = *key;
+	}
+	return msg;
+}
+
+static int port_delay_request(struct port *p)
+{
+	struct template_key key;
+	struct ptp_message *msg;
+
+	/* Time to send a new request, forget current pdelay resp and fup */
+	p->peer_delay_resp.valid = 0;
+	p->peer_delay_fup.valid = 0;
 
 	if (p->delayMechanism == DM_P2P)
 		return port_pdelay_request(p);
 
-	msg = msg_allocate();
+	template_key_init(p, &key, 0x7f);
+	msg = port_template(p, TMPL_DELAY_REQ, &key);
 	if (!msg)
 		return -1;
 
-	msg->hwts.type = p->timestamping;
-
-	msg->header.tsmt               = DELAY_REQ | p->transportSpecific;
-	msg->header.ver                = PTP_VERSION;
-	msg->header.messageLength      = sizeof(struct delay_req_msg);
-	msg->header.domainNumber       = clock_domain_number(p->clock);
-	msg->header.correction         = -p->asymmetry;
-	msg->header.sourcePortIdentity = p->portIdentity;
-	msg->header.sequenceId         = p->seqnum.delayreq++;
-	msg->header.control            = CTL_DELAY_REQ;
-	msg->header.logMessageInterval = 0x7f;
+	msg->header.sequenceId = htons(p->seqnum.delayreq++);
 
 	if (p->hybrid_e2e) {
-		struct ptp_message *dst = TAILQ_FIRST(&p->best->messages);
-		msg->address = dst->address;
+		msg->address = p->cold->best->address;
 		msg->header.flagField[0] |= UNICAST;
 	}
 
-	if (port_prepare_and_send(p, msg, 1)) {
+	if (port_send(p, msg, txts_event(p))) {
 		pr_err("port %hu: send delay request failed", portnum(p));
 		goto out;
 	}
-	if (msg_sots_missing(msg)) {
+	if (p->tx_async) {
+		if (txts_add(p, msg, NULL))
+			goto out;
+	} else if (msg_sots_missing(msg)) {
 		pr_err("missing timestamp on transmitted delay request");
 		goto out;
 	}
@@ -1246,57 +2865,63 @@ out:
 	return -1;
 }
 
-static int port_tx_announce(struct port *p)
+/*
+ * Sends an announce message to the multicast address, or to the unicast
+ * client holding the grant g.
+ */
+static int port_tx_announce(struct port *p, struct unicast_grant *g)
 {
-	struct parent_ds *dad = clock_parent_ds(p->clock);
-	struct timePropertiesDS *tp = clock_time_properties(p->clock);
+	struct template_key key;
 	struct ptp_message *msg;
-	int err, pdulen;
+	int err;
 
 	if (!port_capable(p)) {
 		return 0;
 	}
-	msg = msg_allocate();
-	if (!msg)
-		return -1;
-
-	pdulen = sizeof(struct announce_msg);
-	msg->hwts.type = p->timestamping;
 
+	template_key_init(p, &key, p->logAnnounceInterval);
+	key.stepsRemoved = clock_steps_removed(p->clock);
+	key.pds = clock_parent_ds(p->clock)->pds;
+	key.tds = *clock_time_properties(p->clock);
 	if (p->path_trace_enabled)
-		pdulen += path_trace_append(p, msg, dad);
+		key.path_gen = clock_parent_ds(p->clock)->path_gen;
 
-	msg->header.tsmt               = ANNOUNCE | p->transportSpecific;
-	msg->header.ver                = PTP_VERSION;
-	msg->header.messageLength      = pdulen;
-	msg->header.domainNumber       = clock_domain_number(p->clock);
-	msg->header.sourcePortIdentity = p->portIdentity;
-	msg->header.sequenceId         = p->seqnum.announce++;
-	msg->header.control            = CTL_OTHER;
-	msg->header.logMessageInterval = p->logAnnounceInterval;
-
-	msg->header.flagField[1] = tp->flags;
+	msg = port_template(p, TMPL_ANNOUNCE, &key);
+	if (!msg)
+		return -1;
 
-	msg->announce.currentUtcOffset        = tp->currentUtcOffset;
-	msg->announce.grandmasterPriority1    = dad->pds.grandmasterPriority1;
-	msg->announce.grandmasterClockQuality = dad->pds.grandmasterClockQuality;
-	msg->announce.grandmasterPriority2    = dad->pds.grandmasterPriority2;
-	msg->announce.grandmasterIdentity     = dad->pds.grandmasterIdentity;
-	msg->announce.stepsRemoved            = clock_steps_removed(p->clock);
-	msg->announce.timeSource              = tp->timeSource;
+	if (g) {
+		msg->header.sequenceId         = htons(g->sequenceId++);
+		msg->header.logMessageInterval = g->logInterMessagePeriod;
+		msg->header.flagField[0]      |= UNICAST;
+		msg->address                   = g->client->address;
+	} else {
+		msg->header.sequenceId         = htons(p->seqnum.announce++);
+		msg->hwts.txtime = port_launch_time(p, p->logAnnounceInterval);
+	}
 
-	err = port_prepare_and_send(p, msg, 0);
+	err = port_send(p, msg, 0);
 	if (err)
 		pr_err("port %hu: send announce failed", portnum(p));
 	msg_put(msg);
 	return err;
 }
 
-static int port_tx_sync(struct port *p)
+/*
+ * Sends a sync message, and its follow up, to the multicast address or
+ * to the unicast client holding the grant g.
+ */
+static int port_tx_sync(struct port *p, struct unicast_grant *g)
 {
+	int event = p->timestamping >= TS_ONESTEP ? TRANS_ONESTEP : txts_event(p);
 	struct ptp_message *msg, *fup;
-	int err, pdulen;
-	int event = p->timestamping == TS_ONESTEP ? TRANS_ONESTEP : TRANS_EVENT;
+	struct template_key key;
+	UInteger16 seqnum;
+	int err;
+
+	/* On a common tick, the sync messages may leave all at once. */
+	if (event == TRANS_DEFER && p->sync_batch && !g)
+		event = TRANS_BATCH;
 
 	if (!port_capable(p)) {
 		return 0;
@@ -1304,64 +2929,59 @@ static int port_tx_sync(struct port *p)
 	if (port_sync_incapable(p)) {
 		return 0;
 	}
-	msg = msg_allocate();
+	if (!g)
+		port_update_intervals(p);
+
+	template_key_init(p, &key, p->logSyncInterval);
+	msg = port_template(p, TMPL_SYNC, &key);
 	if (!msg)
 		return -1;
-	fup = msg_allocate();
+	fup = port_template(p, TMPL_FOLLOW_UP, &key);
 	if (!fup) {
 		msg_put(msg);
 		return -1;
 	}
 
-	pdulen = sizeof(struct sync_msg);
-	msg->hwts.type = p->timestamping;
-
-	msg->header.tsmt               = SYNC | p->transportSpecific;
-	msg->header.ver                = PTP_VERSION;
-	msg->header.messageLength      = pdulen;
-	msg->header.domainNumber       = clock_domain_number(p->clock);
-	msg->header.sourcePortIdentity = p->portIdentity;
-	msg->header.sequenceId         = p->seqnum.sync++;
-	msg->header.control            = CTL_SYNC;
-	msg->header.logMessageInterval = p->logSyncInterval;
-
-	if (p->timestamping != TS_ONESTEP)
-		msg->header.flagField[0] |= TWO_STEP;
+	seqnum = g ? g->sequenceId++ : p->seqnum.sync++;
+	msg->header.sequenceId = htons(seqnum);
+	fup->header.sequenceId = htons(seqnum);
+	if (g) {
+		msg->header.logMessageInterval = g->logInterMessagePeriod;
+		msg->header.flagField[0]      |= UNICAST;
+		msg->address                   = g->client->address;
+		fup->header.logMessageInterval = g->logInterMessagePeriod;
+		fup->header.flagField[0]      |= UNICAST;
+		fup->address                   = g->client->address;
+	} else {
+		msg->hwts.txtime = port_launch_time(p, p->logSyncInterval);
+	}
 
-	err = port_prepare_and_send(p, msg, event);
+	err = port_send(p, msg, event);
 	if (err) {
 		pr_err("port %hu: send sync failed", portnum(p));
 		goto out;
 	}
-	if (p->timestamping == TS_ONESTEP) {
+	if (p->timestamping >= TS_ONESTEP) {
 		goto out;
-	} else if (msg_sots_missing(msg)) {
+	} else if (!p->tx_async && msg_sots_missing(msg)) {
 		pr_err("missing timestamp on transmitted sync");
 		err = -1;
 		goto out;
 	}
 
 	/*
-	 * Send the follow up message right away.
+	 * Send the follow up message right away, or as soon as the time
+	 * stamp arrives.
 	 */
-	pdulen = sizeof(struct follow_up_msg);
-	fup->hwts.type = p->timestamping;
-
-	if (p->follow_up_info)
-		pdulen += follow_up_info_append(p, fup);
-
-	fup->header.tsmt               = FOLLOW_UP | p->transportSpecific;
-	fup->header.ver                = PTP_VERSION;
-	fup->header.messageLength      = pdulen;
-	fup->header.domainNumber       = clock_domain_number(p->clock);
-	fup->header.sourcePortIdentity = p->portIdentity;
-	fup->header.sequenceId         = p->seqnum.sync - 1;
-	fup->header.control            = CTL_FOLLOW_UP;
-	fup->header.logMessageInterval = p->logSyncInterval;
+	if (p->tx_async) {
+		err = txts_add(p, msg, fup);
+		goto out;
+	}
 
-	ts_to_timestamp(&msg->hwts.ts, &fup->follow_up.preciseOriginTimestamp);
+	ts_to_net_timestamp(&msg->hwts.ts,
+			    &fup->follow_up.preciseOriginTimestamp);
 
-	err = port_prepare_and_send(p, fup, 0);
+	err = port_send(p, fup, 0);
 	if (err)
 		pr_err("port %hu: send follow up failed", portnum(p));
 out:
@@ -1392,12 +3012,49 @@ static int port_is_enabled(struct port *p)
 	return 1;
 }
 
-static void flush_last_sync(struct port *p)
+/*
+ * Let the kernel drop the messages of other domains, along with those
+ * that the port would ignore in its current state.
+ */
+static void port_filter(struct port *p)
 {
-	if (p->syfu != SF_EMPTY) {
-		msg_put(p->last_syncfup);
-		p->syfu = SF_EMPTY;
+	int types = 1 << ANNOUNCE | 1 << SIGNALING | 1 << MANAGEMENT |
+		1 << PDELAY_REQ | 1 << PDELAY_RESP | 1 << PDELAY_RESP_FOLLOW_UP;
+
+	if (!port_is_enabled(p) || !p->cold->cfg.kernel_filter)
+		return;
+	/* The sockets of a shared transport carry the other domains too. */
+	if (p->cold->shared || p->next_domain)
+		return;
+	/* A transparent clock forwards the messages of any state. */
+	if (port_is_tc(p))
+		return;
+
+	switch (p->state) {
+	case PS_MASTER:
+	case PS_GRAND_MASTER:
+		types |= 1 << DELAY_REQ;
+		break;
+	case PS_UNCALIBRATED:
+	case PS_SLAVE:
+		types |= 1 << SYNC | 1 << FOLLOW_UP | 1 << DELAY_RESP;
+		break;
+	default:
+		break;
 	}
+	if (transport_filter(p->trp, &p->fda, clock_domain_number(p->clock),
+			     types))
+		pr_warning("port %hu: failed to update the socket filter",
+			   portnum(p));
+}
+
+static void flush_last_sync(struct port *p)
+{
+	int i;
+
+	for (i = 0; i < SYFU_RING; i++)
+		syfu_slot_flush(&p->syfu[i]);
+	p->syfu_paired = 0;
 }
 
 static void flush_delay_req(struct port *p)
@@ -1414,14 +3071,8 @@ static void flush_peer_delay(struct port *p)
 		msg_put(p->peer_delay_req);
 		p->peer_delay_req = NULL;
 	}
-	if (p->peer_delay_resp) {
-		msg_put(p->peer_delay_resp);
-		p->peer_delay_resp = NULL;
-	}
-	if (p->peer_delay_fup) {
-		msg_put(p->peer_delay_fup);
-		p->peer_delay_fup = NULL;
-	}
+	p->peer_delay_resp.valid = 0;
+	p->peer_delay_fup.valid = 0;
 }
 
 static void port_clear_fda(struct port *p, int count)
@@ -1439,54 +3090,111 @@ static void port_disable(struct port *p)
 	flush_last_sync(p);
 	flush_delay_req(p);
 	flush_peer_delay(p);
+	txts_flush(p);
+	p->cold->dresp_count = 0;
 
-	p->best = NULL;
+	p->cold->best = NULL;
 	free_foreign_masters(p);
-	transport_close(p->trp, &p->fda);
+	if (p->cold->unicast)
+		unicast_clear(p->cold->unicast);
+	if (p->worker)
+		worker_forget(p->worker, p);
+	if (!p->cold->shared)
+		transport_close(p->trp, &p->fda);
 
 	for (i = 0; i < N_TIMER_FDS; i++) {
-		close(p->fda.fd[FD_ANNOUNCE_TIMER + i]);
+		port_clr_tmo(p, FD_ANNOUNCE_TIMER + i);
 	}
 	port_clear_fda(p, N_POLLFD);
 	clock_fda_changed(p->clock);
 }
 
-static int port_initialize(struct port *p)
+/*
+ * Copies the settings that may change while the port is running from the
+ * resolved configuration into the port.
+ */
+static void port_set_options(struct port *p)
+{
+	p->asymmetry = p->cold->cfg.delayAsymmetry;
+	p->asymmetry <<= 16;
+	p->follow_up_info = p->cold->cfg.follow_up_info;
+	p->freq_est_interval = p->cold->cfg.freq_est_interval;
+	p->hybrid_e2e = p->cold->cfg.hybrid_e2e;
+	p->path_trace_enabled = p->cold->cfg.path_trace_enabled;
+	p->rx_timestamp_offset = p->cold->cfg.ingressLatency;
+	p->tx_timestamp_offset = p->cold->cfg.egressLatency;
+	if (p->cold->cfg.network_transport != TRANS_UDS)
+		p->cold->delay_resp_batch = 1000ULL *
+			p->cold->cfg.delay_resp_batch;
+	p->cold->flt_interval_pertype[FT_BAD_PEER_NETWORK].val =
+		p->cold->cfg.fault_badpeernet_interval;
+	p->cold->flt_interval_pertype[FT_UNSPECIFIED].val =
+		p->cold->cfg.fault_reset_interval;
+	if (p->cold->unicast)
+		p->cold->unicast_max_duration =
+			p->cold->cfg.unicast_max_duration;
+}
+
+/*
+ * Copies the message intervals and the settings that go with them from
+ * the resolved configuration into the port.
+ */
+static void port_set_intervals(struct port *p)
+{
+	struct port_config *cfg = &p->cold->cfg;
+
+	p->logMinDelayReqInterval  = cfg->logMinDelayReqInterval;
+	p->logAnnounceInterval     = cfg->logAnnounceInterval;
+	p->announceReceiptTimeout  = cfg->announceReceiptTimeout;
+	p->syncReceiptTimeout      = cfg->syncReceiptTimeout;
+	p->transportSpecific       = cfg->transportSpecific;
+	p->transportSpecific     <<= 4;
+	p->logSyncInterval         = cfg->logSyncInterval;
+	p->logMinPdelayReqInterval = cfg->logMinPdelayReqInterval;
+	p->neighborPropDelayThresh = cfg->neighborPropDelayThresh;
+	p->min_neighbor_prop_delay = cfg->min_neighbor_prop_delay;
+	p->cold->adaptive_interval       = cfg->adaptive_interval;
+	p->cold->adaptive_lock_count     = cfg->adaptive_lock_count;
+	p->cold->adaptive_offset_threshold = cfg->adaptive_offset_threshold;
+	p->cold->adaptive_logSyncInterval = cfg->adaptive_logSyncInterval;
+	p->cold->adaptive_logMinDelayReqInterval =
+		cfg->adaptive_logMinDelayReqInterval;
+	p->cold->allow_interval_requests = cfg->allow_interval_requests;
+	p->cold->initial_logSyncInterval = p->logSyncInterval;
+	p->cold->initial_logMinDelayReqInterval = p->logMinDelayReqInterval;
+	port_interval_reset(p);
+}
+
+/* Hands the descriptors of a newly opened transport to the other domains. */
+static void port_share_fda(struct port *p)
 {
-	struct config *cfg = clock_config(p->clock);
-	int fd[N_TIMER_FDS], i;
+	struct port *q;
+
+	for (q = p->next_domain; q; q = q->next_domain)
+		q->fda = p->fda;
+}
 
+static int port_initialize(struct port *p)
+{
 	p->multiple_seq_pdr_count  = 0;
 	p->multiple_pdr_detected   = 0;
-	p->last_fault_type         = FT_UNSPECIFIED;
-	p->logMinDelayReqInterval  = config_get_int(cfg, p->name, "logMinDelayReqInterval");
+	p->cold->last_fault_type         = FT_UNSPECIFIED;
 	p->peerMeanPathDelay       = 0;
-	p->logAnnounceInterval     = config_get_int(cfg, p->name, "logAnnounceInterval");
-	p->announceReceiptTimeout  = config_get_int(cfg, p->name, "announceReceiptTimeout");
-	p->syncReceiptTimeout      = config_get_int(cfg, p->name, "syncReceiptTimeout");
-	p->transportSpecific       = config_get_int(cfg, p->name, "transportSpecific");
-	p->transportSpecific     <<= 4;
-	p->logSyncInterval         = config_get_int(cfg, p->name, "logSyncInterval");
-	p->logMinPdelayReqInterval = config_get_int(cfg, p->name, "logMinPdelayReqInterval");
-	p->neighborPropDelayThresh = config_get_int(cfg, p->name, "neighborPropDelayThresh");
-	p->min_neighbor_prop_delay = config_get_int(cfg, p->name, "min_neighbor_prop_delay");
-
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		fd[i] = -1;
-	}
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		fd[i] = timerfd_create(CLOCK_MONOTONIC, 0);
-		if (fd[i] < 0) {
-			pr_err("timerfd_create: %s", strerror(errno));
-			goto no_timers;
-		}
-	}
-	if (transport_open(p->trp, p->name, &p->fda, p->timestamping))
+	p->cold->adaptive_count          = 0;
+	p->cold->adaptive_refresh        = 0;
+	p->cold->adaptive_slow           = 0;
+	port_set_intervals(p);
+
+	if (p->cold->shared)
+		p->fda = p->cold->shared->fda;
+	else if (transport_open(p->trp, p->cold->name, &p->fda,
+				p->timestamping))
 		goto no_tropen;
-
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		p->fda.fd[FD_ANNOUNCE_TIMER + i] = fd[i];
-	}
+	else
+		port_share_fda(p);
+	if (p->worker &&
+	    worker_watch(p->worker, p, p->trp, p->timestamping, &p->fda))
+		goto no_watch;
 
 	if (port_set_announce_tmo(p))
 		goto no_tmo;
@@ -1497,13 +3205,12 @@ static int port_initialize(struct port *p)
 	return 0;
 
 no_tmo:
-	transport_close(p->trp, &p->fda);
+	if (p->worker)
+		worker_forget(p->worker, p);
+no_watch:
+	if (!p->cold->shared)
+		transport_close(p->trp, &p->fda);
 no_tropen:
-no_timers:
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		if (fd[i] >= 0)
-			close(fd[i]);
-	}
 	return -1;
 }
 
@@ -1511,12 +3218,20 @@ static int port_renew_transport(struct port *p)
 {
 	int res;
 
-	if (!port_is_enabled(p)) {
+	if (!port_is_enabled(p) || p->cold->shared) {
 		return 0;
 	}
+	if (p->worker)
+		worker_forget(p->worker, p);
 	transport_close(p->trp, &p->fda);
-	port_clear_fda(p, FD_ANNOUNCE_TIMER);
-	res = transport_open(p->trp, p->name, &p->fda, p->timestamping);
+	port_clear_fda(p, N_POLLFD);
+	res = transport_open(p->trp, p->cold->name, &p->fda, p->timestamping);
+	port_share_fda(p);
+	if (!res)
+		port_filter(p);
+	if (!res && p->worker)
+		res = worker_watch(p->worker, p, p->trp, p->timestamping,
+				   &p->fda);
 	/* Need to call clock_fda_changed even if transport_open failed in
 	 * order to update clock to the now closed descriptors. */
 	clock_fda_changed(p->clock);
@@ -1528,8 +3243,7 @@ static int port_renew_transport(struct port *p)
  */
 static int update_current_master(struct port *p, struct ptp_message *m)
 {
-	struct foreign_clock *fc = p->best;
-	struct ptp_message *tmp;
+	struct foreign_clock *fc = p->cold->best;
 	struct parent_ds *dad;
 	struct path_trace_tlv *ptt;
 	struct timePropertiesDS tds;
@@ -1546,24 +3260,24 @@ static int update_current_master(struct port *p, struct ptp_message *m)
 	if (p->path_trace_enabled) {
 		ptt = (struct path_trace_tlv *) m->announce.suffix;
 		dad = clock_parent_ds(p->clock);
-		memcpy(dad->ptl, ptt->cid, ptt->length);
-		dad->path_length = path_length(ptt);
+		/* The hash of this path trace was taken in port_ignore(). */
+		if (!fc->path_hash || fc->path_hash != p->ptl_hash ||
+		    dad->path_gen != p->ptl_gen) {
+			memcpy(dad->ptl, ptt->cid, ptt->length);
+			dad->path_length = path_length(ptt);
+			dad->path_gen++;
+			p->ptl_hash = fc->path_hash;
+			p->ptl_gen = dad->path_gen;
+		}
 	}
 	port_set_announce_tmo(p);
 	fc_prune(fc);
-	msg_get(m);
-	fc->n_messages++;
-	TAILQ_INSERT_HEAD(&fc->messages, m, list);
-	if (fc->n_messages > 1) {
-		tmp = TAILQ_NEXT(m, list);
-		return announce_compare(m, tmp);
-	}
-	return 0;
+	return fc_add(fc, m);
 }
 
 struct dataset *port_best_foreign(struct port *port)
 {
-	return port->best ? &port->best->dataset : NULL;
+	return port->cold->best ? &port->cold->best->dataset : NULL;
 }
 
 /* message processing routines */
@@ -1601,6 +3315,56 @@ static int process_announce(struct port *p, struct ptp_message *m)
 	return result;
 }
 
+/*
+ * Batched delay responses. The responses are built in buffers owned by
+ * the port, and sent with one system call when the batch is full or when
+ * the first response has waited for delay_resp_batch.
+ */
+static struct ptp_message *dresp_next(struct port *p)
+{
+	struct ptp_message *msg = p->cold->dresp[p->cold->dresp_count];
+
+	if (!msg) {
+		msg = msg_allocate_len(sizeof(struct delay_resp_msg));
+		p->cold->dresp[p->cold->dresp_count] = msg;
+	} else {
+		memset(&msg->delay_resp, 0, sizeof(msg->delay_resp));
+	}
+	return msg;
+}
+
+static int dresp_flush(struct port *p)
+{
+	int cnt, i, n = p->cold->dresp_count;
+
+	port_clr_tmo(p, FD_DELAY_RESP_TIMER);
+	if (!n)
+		return 0;
+	p->cold->dresp_count = 0;
+
+	cnt = transport_send_batch(p->trp, &p->fda, p->cold->dresp, n);
+	for (i = 0; i < cnt; i++)
+		msgtype_stat(p, tx, p->cold->dresp[i]);
+	if (cnt < n) {
+		pr_err("port %hu: send delay response failed", portnum(p));
+		return -1;
+	}
+	return 0;
+}
+
+static int dresp_queue(struct port *p)
+{
+	if (msg_pre_send(p->cold->dresp[p->cold->dresp_count]))
+		return -1;
+	if (++p->cold->dresp_count == SK_TX_BATCH)
+		return dresp_flush(p);
+	if (p->cold->dresp_count == 1)
+		wheel_set(clock_wheel(p->clock),
+			  port_timer(p, FD_DELAY_RESP_TIMER),
+			  p->cold->delay_resp_batch);
+	return 0;
+}
+
 static int process_delay_req(struct port *p, struct ptp_message *m)
 {
 	struct ptp_message *msg;
@@ -1609,12 +3373,17 @@ static int process_delay_req(struct port *p, struct ptp_message *m)
 	if (p->state != PS_MASTER && p->state != PS_GRAND_MASTER)
 		return 0;
 
+	/* The master answers the requests forwarded by a transparent clock. */
+	if (port_is_tc(p))
+		return 0;
+
 	if (p->delayMechanism == DM_P2P) {
 		pr_warning("port %hu: delay request on P2P port", portnum(p));
 		return 0;
 	}
 
-	msg = msg_allocate();
+	msg = p->cold->delay_resp_batch ? dresp_next(p) :
+		msg_allocate_len(sizeof(struct delay_resp_msg));
 	if (!msg)
 		return -1;
 
@@ -1634,12 +3403,16 @@ static int process_delay_req(struct port *p, struct ptp_message *m)
 
 	msg->delay_resp.requestingPortIdentity = m->header.sourcePortIdentity;
 
-	if (p->hybrid_e2e && m->header.flagField[0] & UNICAST) {
+	if ((p->hybrid_e2e || p->cold->unicast) &&
+	    m->header.flagField[0] & UNICAST) {
 		msg->address = m->address;
 		msg->header.flagField[0] |= UNICAST;
 		msg->header.logMessageInterval = 0x7f;
 	}
 
+	if (p->cold->delay_resp_batch)
+		return dresp_queue(p);
+
 	err = port_prepare_and_send(p, msg, 0);
 	if (err)
 		pr_err("port %hu: send delay response failed", portnum(p));
@@ -1654,7 +3427,7 @@ static void process_delay_resp(struct port *p, struct ptp_message *m)
 	struct PortIdentity master;
 	tmv_t c3, t3, t4, t4c;
 
-	if (!p->delay_req)
+	if (!p->delay_req || txts_pending(p, p->delay_req))
 		return;
 
 	master = clock_parent_identity(p->clock);
@@ -1690,13 +3463,13 @@ static void process_delay_resp(struct port *p, struct ptp_message *m)
 		return;
 	}
 	p->logMinDelayReqInterval = rsp->hdr.logMessageInterval;
+	clock_mgmt_changed(p->clock);
 	pr_notice("port %hu: minimum delay request interval 2^%d",
 		  portnum(p), p->logMinDelayReqInterval);
 }
 
 static void process_follow_up(struct port *p, struct ptp_message *m)
 {
-	enum syfu_event event;
 	struct PortIdentity master;
 	switch (p->state) {
 	case PS_INITIALIZING:
@@ -1723,13 +3496,7 @@ static void process_follow_up(struct port *p, struct ptp_message *m)
 		clock_follow_up_info(p->clock, fui);
 	}
 
-	if (p->syfu == SF_HAVE_SYNC &&
-	    p->last_syncfup->header.sequenceId == m->header.sequenceId) {
-		event = FUP_MATCH;
-	} else {
-		event = FUP_MISMATCH;
-	}
-	port_syfufsm(p, event, m);
+	port_syfu_fup(p, m);
 }
 
 static int process_pdelay_req(struct port *p, struct ptp_message *m)
@@ -1744,6 +3511,7 @@ static int process_pdelay_req(struct port *p, struct ptp_message *m)
 	if (p->delayMechanism == DM_AUTO) {
 		pr_info("port %hu: peer detected, switch to P2P", portnum(p));
 		p->delayMechanism = DM_P2P;
+		clock_mgmt_changed(p->clock);
 		port_set_delay_tmo(p);
 	}
 	if (p->peer_portid_valid) {
@@ -1762,10 +3530,10 @@ static int process_pdelay_req(struct port *p, struct ptp_message *m)
 			pid2str(&p->peer_portid));
 	}
 
-	rsp = msg_allocate();
+	rsp = pdelay_buf(&p->pdelay_resp_buf, sizeof(struct pdelay_resp_msg));
 	if (!rsp)
 		return -1;
-	fup = msg_allocate();
+	fup = pdelay_buf(&p->pdelay_fup_buf, sizeof(struct pdelay_resp_fup_msg));
 	if (!fup) {
 		msg_put(rsp);
 		return -1;
@@ -1781,10 +3549,23 @@ static int process_pdelay_req(struct port *p, struct ptp_message *m)
 	rsp->header.sequenceId         = m->header.sequenceId;
 	rsp->header.control            = CTL_OTHER;
 	rsp->header.logMessageInterval = 0x7f;
+	rsp->pdelay_resp.requestingPortIdentity = m->header.sourcePortIdentity;
+
 	/*
-	 * NB - There is no kernel support for one step P2P messaging,
-	 * so we always send a follow up message.
+	 * In one step mode, the hardware adds the turnaround time to the
+	 * correction of the response, which then needs no follow up. The
+	 * latencies are added here, because the time stamps are not seen.
 	 */
+	if (p->timestamping == TS_P2P1STEP) {
+		rsp->header.correction = m->header.correction +
+			((Integer64) (p->rx_timestamp_offset +
+				      p->tx_timestamp_offset) << 16);
+		err = peer_prepare_and_send(p, rsp, TRANS_ONESTEP);
+		if (err)
+			pr_err("port %hu: send peer delay response failed",
+			       portnum(p));
+		goto out;
+	}
 	rsp->header.flagField[0] |= TWO_STEP;
 
 	/*
@@ -1792,7 +3573,6 @@ static int process_pdelay_req(struct port *p, struct ptp_message *m)
 	 * fields, neither in the response or the follow up.
 	 */
 	ts_to_timestamp(&m->hwts.ts, &rsp->pdelay_resp.requestReceiptTimestamp);
-	rsp->pdelay_resp.requestingPortIdentity = m->header.sourcePortIdentity;
 
 	fup->hwts.type = p->timestamping;
 
@@ -1808,11 +3588,15 @@ static int process_pdelay_req(struct port *p, struct ptp_message *m)
 
 	fup->pdelay_resp_fup.requestingPortIdentity = m->header.sourcePortIdentity;
 
-	err = peer_prepare_and_send(p, rsp, 1);
+	err = peer_prepare_and_send(p, rsp, txts_event(p));
 	if (err) {
 		pr_err("port %hu: send peer delay response failed", portnum(p));
 		goto out;
 	}
+	if (p->tx_async) {
+		err = txts_add(p, rsp, fup);
+		goto out;
+	}
 	if (msg_sots_missing(rsp)) {
 		pr_err("missing timestamp on transmitted peer delay response");
 		goto out;
@@ -1835,26 +3619,26 @@ static void port_peer_delay(struct port *p)
 {
 	tmv_t c1, c2, t1, t2, t3, t3c, t4;
 	struct ptp_message *req = p->peer_delay_req;
-	struct ptp_message *rsp = p->peer_delay_resp;
-	struct ptp_message *fup = p->peer_delay_fup;
+	struct pdelay_rx *rsp = &p->peer_delay_resp;
+	struct pdelay_rx *fup = &p->peer_delay_fup;
 
 	/* Check for response, validate port and sequence number. */
 
-	if (!rsp)
+	if (!req || !rsp->valid || txts_pending(p, req))
 		return;
 
-	if (!pid_eq(&rsp->pdelay_resp.requestingPortIdentity, &p->portIdentity))
+	if (!pid_eq(&rsp->requesting, &p->portIdentity))
 		return;
 
-	if (rsp->header.sequenceId != ntohs(req->header.sequenceId))
+	if (rsp->sequenceId != ntohs(req->header.sequenceId))
 		return;
 
 	t1 = timespec_to_tmv(req->hwts.ts);
-	t4 = timespec_to_tmv(rsp->hwts.ts);
-	c1 = correction_to_tmv(rsp->header.correction + p->asymmetry);
+	t4 = timespec_to_tmv(rsp->ingress);
+	c1 = correction_to_tmv(rsp->correction + p->asymmetry);
 
 	/* Process one-step response immediately. */
-	if (one_step(rsp)) {
+	if (rsp->one_step) {
 		t2 = tmv_zero();
 		t3 = tmv_zero();
 		c2 = tmv_zero();
@@ -1863,22 +3647,22 @@ static void port_peer_delay(struct port *p)
 
 	/* Check for follow up, validate port and sequence number. */
 
-	if (!fup)
+	if (!fup->valid)
 		return;
 
-	if (!pid_eq(&fup->pdelay_resp_fup.requestingPortIdentity, &p->portIdentity))
+	if (!pid_eq(&fup->requesting, &p->portIdentity))
 		return;
 
-	if (fup->header.sequenceId != rsp->header.sequenceId)
+	if (fup->sequenceId != rsp->sequenceId)
 		return;
 
-	if (!source_pid_eq(fup, rsp))
+	if (!pid_eq(&fup->source, &rsp->source))
 		return;
 
 	/* Process follow up response. */
-	t2 = timestamp_to_tmv(rsp->ts.pdu);
-	t3 = timestamp_to_tmv(fup->ts.pdu);
-	c2 = correction_to_tmv(fup->header.correction);
+	t2 = timestamp_to_tmv(rsp->origin);
+	t3 = timestamp_to_tmv(fup->origin);
+	c2 = correction_to_tmv(fup->correction);
 calc:
 	t3c = tmv_add(t3, tmv_add(c1, c2));
 	tsproc_set_clock_rate_ratio(p->tsproc, p->nrate.ratio *
@@ -1889,6 +3673,7 @@ calc:
 		return;
 
 	p->peerMeanPathDelay = tmv_to_TimeInterval(p->peer_delay);
+	clock_mgmt_changed(p->clock);
 
 	if (p->follow_up_info)
 		port_nrate_calculate(p, t3c, t4);
@@ -1904,15 +3689,16 @@ calc:
 
 static int process_pdelay_resp(struct port *p, struct ptp_message *m)
 {
-	if (p->peer_delay_resp) {
-		if (!source_pid_eq(p->peer_delay_resp, m)) {
+	if (p->peer_delay_resp.valid) {
+		if (!pid_eq(&p->peer_delay_resp.source,
+			    &m->header.sourcePortIdentity)) {
 			pr_err("port %hu: multiple peer responses", portnum(p));
 			if (!p->multiple_pdr_detected) {
 				p->multiple_pdr_detected = 1;
 				p->multiple_seq_pdr_count++;
 			}
 			if (p->multiple_seq_pdr_count >= 3) {
-				p->last_fault_type = FT_BAD_PEER_NETWORK;
+				p->cold->last_fault_type = FT_BAD_PEER_NETWORK;
 				return -1;
 			}
 		}
@@ -1937,11 +3723,8 @@ static int process_pdelay_resp(struct port *p, struct ptp_message *m)
 			pid2str(&p->peer_portid));
 	}
 
-	if (p->peer_delay_resp) {
-		msg_put(p->peer_delay_resp);
-	}
-	msg_get(m);
-	p->peer_delay_resp = m;
+	pdelay_rx_save(&p->peer_delay_resp, m,
+		       &m->pdelay_resp.requestingPortIdentity);
 	port_peer_delay(p);
 	return 0;
 }
@@ -1951,17 +3734,13 @@ static void process_pdelay_resp_fup(struct port *p, struct ptp_message *m)
 	if (!p->peer_delay_req)
 		return;
 
-	if (p->peer_delay_fup)
-		msg_put(p->peer_delay_fup);
-
-	msg_get(m);
-	p->peer_delay_fup = m;
+	pdelay_rx_save(&p->peer_delay_fup, m,
+		       &m->pdelay_resp_fup.requestingPortIdentity);
 	port_peer_delay(p);
 }
 
 static void process_sync(struct port *p, struct ptp_message *m)
 {
-	enum syfu_event event;
 	struct PortIdentity master;
 	switch (p->state) {
 	case PS_INITIALIZING:
@@ -1996,68 +3775,143 @@ static void process_sync(struct port *p, struct ptp_message *m)
 		return;
 	}
 
-	if (p->syfu == SF_HAVE_FUP &&
-	    fup_sync_ok(p->last_syncfup, m) &&
-	    p->last_syncfup->header.sequenceId == m->header.sequenceId) {
-		event = SYNC_MATCH;
-	} else {
-		event = SYNC_MISMATCH;
-	}
-	port_syfufsm(p, event, m);
+	port_syfu_sync(p, m);
 }
 
 /* public methods */
 
 void port_close(struct port *p)
 {
+	unsigned int timeout;
+	struct port **q;
+	int i;
+
 	if (port_is_enabled(p)) {
 		port_disable(p);
 	}
-	transport_destroy(p->trp);
+	for (i = 0; i < N_TIMER_FDS; i++) {
+		port_clr_tmo(p, FD_ANNOUNCE_TIMER + i);
+	}
+	if (p->cold->shared) {
+		q = &p->cold->shared->next_domain;
+		for (; *q != p; q = &(*q)->next_domain)
+			;
+		*q = p->next_domain;
+	} else {
+		transport_destroy(p->trp);
+	}
 	tsproc_destroy(p->tsproc);
-	if (p->fault_fd >= 0)
-		close(p->fault_fd);
+	timeout = txts_suggested_timeout(p);
+	if (p->cold->cfg.tx_timestamp_tuning && timeout)
+		pr_notice("port %hu: suggested tx_timestamp_timeout %u",
+			  portnum(p), timeout);
+	stats_destroy(p->cold->txts_wait);
+	stats_destroy(p->cold->txts_wait_recent);
+	mcache_destroy(p->cold->mgmt_cache);
+	if (p->cold->fault_fd >= 0)
+		close(p->cold->fault_fd);
+	for (i = 0; i < SK_RX_BATCH; i++) {
+		if (p->rx_msg[i])
+			msg_put(p->rx_msg[i]);
+	}
+	for (i = 0; i < SK_TX_BATCH; i++) {
+		if (p->cold->dresp[i])
+			msg_put(p->cold->dresp[i]);
+	}
+	if (p->pdelay_req_buf)
+		msg_put(p->pdelay_req_buf);
+	if (p->pdelay_resp_buf)
+		msg_put(p->pdelay_resp_buf);
+	if (p->pdelay_fup_buf)
+		msg_put(p->pdelay_fup_buf);
+	free_foreign_masters(p);
+	hash_destroy(p->cold->foreign_index, NULL);
+	if (p->cold->unicast)
+		unicast_destroy(p->cold->unicast);
+	free(p->cold);
 	free(p);
 }
 
 struct foreign_clock *port_compute_best(struct port *p)
 {
 	struct foreign_clock *fc;
-	struct ptp_message *tmp;
 
-	p->best = NULL;
+	p->cold->best = NULL;
 
-	LIST_FOREACH(fc, &p->foreign_masters, list) {
-		tmp = TAILQ_FIRST(&fc->messages);
-		if (!tmp)
+	LIST_FOREACH(fc, &p->cold->foreign_masters, list) {
+		if (!fc->n_messages)
 			continue;
 
-		announce_to_dataset(tmp, p, &fc->dataset);
+		announce_to_dataset(&fc->announce, p, &fc->dataset);
 
 		fc_prune(fc);
 
 		if (fc->n_messages < FOREIGN_MASTER_THRESHOLD)
 			continue;
 
-		if (!p->best)
-			p->best = fc;
-		else if (dscmp(&fc->dataset, &p->best->dataset) > 0)
-			p->best = fc;
+		if (!p->cold->best)
+			p->cold->best = fc;
+		else if (dscmp(&fc->dataset, &p->cold->best->dataset) > 0)
+			p->cold->best = fc;
 		else
 			fc_clear(fc);
 	}
 
-	return p->best;
+	return p->cold->best;
+}
+
+void port_unicast_timer(struct port *p, struct wheel_timer *t)
+{
+	struct unicast_grant *g;
+
+	g = unicast_timer(p->cold->unicast, t);
+	if (!g)
+		return;
+
+	switch (t->index - UNICAST_TIMER_BASE) {
+	case UNICAST_ANNOUNCE:
+		port_tx_announce(p, g);
+		break;
+	case UNICAST_SYNC:
+		port_tx_sync(p, g);
+		break;
+	}
+}
+
+struct foreign_clock *port_update_best(struct port *p)
+{
+	if (!p->cold->bmc_changed) {
+		if (!p->cold->best)
+			return NULL;
+		fc_prune(p->cold->best);
+		if (p->cold->best->n_messages >= FOREIGN_MASTER_THRESHOLD)
+			return p->cold->best;
+		p->cold->bmc_changed = 1;
+	}
+	return port_compute_best(p);
+}
+
+void port_set_bmc_changed(struct port *p)
+{
+	p->cold->bmc_changed = 1;
+}
+
+int port_clear_bmc_changed(struct port *p)
+{
+	int changed = p->cold->bmc_changed;
+
+	p->cold->bmc_changed = 0;
+	return changed;
 }
 
 static void port_e2e_transition(struct port *p, enum port_state next)
 {
-	port_clr_tmo(p->fda.fd[FD_ANNOUNCE_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_RX_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_DELAY_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_QUALIFICATION_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_MANNO_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_TX_TIMER]);
+	port_clr_tmo(p, FD_ANNOUNCE_TIMER);
+	port_clr_tmo(p, FD_SYNC_RX_TIMER);
+	port_clr_tmo(p, FD_DELAY_TIMER);
+	port_clr_tmo(p, FD_QUALIFICATION_TIMER);
+	port_clr_tmo(p, FD_MANNO_TIMER);
+	port_clr_tmo(p, FD_SYNC_TX_TIMER);
 
 	switch (next) {
 	case PS_INITIALIZING:
@@ -2074,7 +3928,10 @@ static void port_e2e_transition(struct port *p, enum port_state next)
 		break;
 	case PS_MASTER:
 	case PS_GRAND_MASTER:
-		set_tmo_log(p->fda.fd[FD_MANNO_TIMER], 1, -10); /*~1ms*/
+		/* A transparent clock only forwards the master's messages. */
+		if (port_is_tc(p))
+			break;
+		port_tmo_log(p, FD_MANNO_TIMER, 1, -10); /*~1ms*/
 		port_set_sync_tx_tmo(p);
 		break;
 	case PS_PASSIVE:
@@ -2093,12 +3950,12 @@ static void port_e2e_transition(struct port *p, enum port_state next)
 
 static void port_p2p_transition(struct port *p, enum port_state next)
 {
-	port_clr_tmo(p->fda.fd[FD_ANNOUNCE_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_RX_TIMER]);
+	port_clr_tmo(p, FD_ANNOUNCE_TIMER);
+	port_clr_tmo(p, FD_SYNC_RX_TIMER);
 	/* Leave FD_DELAY_TIMER running. */
-	port_clr_tmo(p->fda.fd[FD_QUALIFICATION_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_MANNO_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_TX_TIMER]);
+	port_clr_tmo(p, FD_QUALIFICATION_TIMER);
+	port_clr_tmo(p, FD_MANNO_TIMER);
+	port_clr_tmo(p, FD_SYNC_TX_TIMER);
 
 	switch (next) {
 	case PS_INITIALIZING:
@@ -2115,7 +3972,10 @@ static void port_p2p_transition(struct port *p, enum port_state next)
 		break;
 	case PS_MASTER:
 	case PS_GRAND_MASTER:
-		set_tmo_log(p->fda.fd[FD_MANNO_TIMER], 1, -10); /*~1ms*/
+		/* A transparent clock only forwards the master's messages. */
+		if (port_is_tc(p))
+			break;
+		port_tmo_log(p, FD_MANNO_TIMER, 1, -10); /*~1ms*/
 		port_set_sync_tx_tmo(p);
 		break;
 	case PS_PASSIVE:
@@ -2150,6 +4010,9 @@ int port_dispatch(struct port *p, enum fsm_event event, int mdiff)
 	    ((i.val == FRI_ASAP && i.type == FTMO_LOG2_SECONDS) ||
 	     (i.val == 0 && i.type == FTMO_LINEAR_SECONDS)))
 		fri_asap = 1;
+	/* The owner of the transport handles its faults. */
+	if (p->cold->shared)
+		fri_asap = 1;
 	if (PS_INITIALIZING == next || (PS_FAULTY == next && fri_asap)) {
 		/*
 		 * This is a special case. Since we initialize the
@@ -2162,51 +4025,225 @@ int port_dispatch(struct port *p, enum fsm_event event, int mdiff)
 		next = port_initialize(p) ? PS_FAULTY : PS_LISTENING;
 		port_show_transition(p, next, event);
 		p->state = next;
+		clock_mgmt_changed(p->clock);
+		port_filter(p);
 		if (next == PS_LISTENING && p->delayMechanism == DM_P2P) {
 			port_set_delay_tmo(p);
 		}
-		port_notify_event(p, NOTIFY_PORT_STATE);
-		return 1;
+		port_notify_event(p, NOTIFY_PORT_STATE);
+		return 1;
+	}
+
+	if (next == p->state)
+		return 0;
+
+	port_show_transition(p, next, event);
+
+	if (p->delayMechanism == DM_P2P) {
+		port_p2p_transition(p, next);
+	} else {
+		port_e2e_transition(p, next);
+	}
+
+	if (p->cold->allow_interval_requests)
+		port_interval_reset(p);
+
+	/* The slaves negotiate again with the next master. */
+	if (p->cold->unicast && next != PS_MASTER && next != PS_GRAND_MASTER)
+		unicast_clear(p->cold->unicast);
+
+	p->state = next;
+	clock_mgmt_changed(p->clock);
+	port_filter(p);
+	port_notify_event(p, NOTIFY_PORT_STATE);
+
+	if (p->cold->jbod && next == PS_UNCALIBRATED) {
+		if (clock_switch_phc(p->clock, p->cold->phc_index)) {
+			p->cold->last_fault_type = FT_SWITCH_PHC;
+			return port_dispatch(p, EV_FAULT_DETECTED, 0);
+		}
+		clock_sync_interval(p->clock, p->log_sync_interval);
+	}
+
+	return 0;
+}
+
+static enum fsm_event port_process(struct port *p, struct ptp_message *msg)
+{
+	enum fsm_event event = EV_NONE;
+
+	if (port_ignore(p, msg)) {
+		msgtype_stat(p, rx_ignored, msg);
+		msg_put(msg);
+		return EV_NONE;
+	}
+	trace(TRACE_RX_MSG, portnum(p), msg_type(msg),
+	      msg->header.sequenceId,
+	      tmv_to_nanoseconds(timespec_to_tmv(msg->hwts.ts)));
+
+	if (port_is_tc(p))
+		tc_forward(p, msg);
+
+	switch (msg_type(msg)) {
+	case SYNC:
+		process_sync(p, msg);
+		break;
+	case DELAY_REQ:
+		if (process_delay_req(p, msg))
+			event = EV_FAULT_DETECTED;
+		break;
+	case PDELAY_REQ:
+		if (process_pdelay_req(p, msg))
+			event = EV_FAULT_DETECTED;
+		break;
+	case PDELAY_RESP:
+		if (process_pdelay_resp(p, msg))
+			event = EV_FAULT_DETECTED;
+		break;
+	case FOLLOW_UP:
+		process_follow_up(p, msg);
+		break;
+	case DELAY_RESP:
+		process_delay_resp(p, msg);
+		break;
+	case PDELAY_RESP_FOLLOW_UP:
+		process_pdelay_resp_fup(p, msg);
+		break;
+	case ANNOUNCE:
+		if (process_announce(p, msg))
+			event = EV_STATE_DECISION_EVENT;
+		break;
+	case SIGNALING:
+		process_signaling(p, msg);
+		break;
+	case MANAGEMENT:
+		if (clock_manage(p->clock, p, msg))
+			event = EV_STATE_DECISION_EVENT;
+		break;
+	}
+
+	msg_put(msg);
+	return event;
+}
+
+/* Applies an event of a port of another domain, outside of its poll loop. */
+static void port_domain_event(struct port *p, enum fsm_event event)
+{
+	switch (event) {
+	case EV_NONE:
+		break;
+	case EV_STATE_DECISION_EVENT:
+		port_set_bmc_changed(p);
+		clock_pending_decision(p->clock);
+		break;
+	default:
+		port_dispatch(p, event, 0);
+		break;
+	}
+}
+
+/*
+ * Passes a message to the port of its domain sharing our transport or,
+ * coming over the UDS, to the clock of its domain. Returns non-zero if
+ * the message was taken.
+ */
+static int port_receive_domain(struct port *p, struct ptp_message *msg)
+{
+	struct clock *c;
+	struct port *q;
+
+	for (q = p->next_domain; q; q = q->next_domain) {
+		if (msg->header.domainNumber == clock_domain_number(q->clock)) {
+			msgtype_stat(q, rx, msg);
+			port_domain_event(q, port_process(q, msg));
+			return 1;
+		}
 	}
-
-	if (next == p->state)
+	if (p->cold->cfg.network_transport != TRANS_UDS ||
+	    msg_type(msg) != MANAGEMENT)
 		return 0;
-
-	port_show_transition(p, next, event);
-
-	if (p->delayMechanism == DM_P2P) {
-		port_p2p_transition(p, next);
-	} else {
-		port_e2e_transition(p, next);
+	c = clock_domain(p->clock, msg->header.domainNumber);
+	if (!c)
+		return 0;
+	if (clock_manage(c, p, msg)) {
+		for (q = clock_first_port(c); q; q = LIST_NEXT(q, list))
+			port_set_bmc_changed(q);
+		clock_pending_decision(c);
 	}
+	msg_put(msg);
+	return 1;
+}
 
-	p->state = next;
-	port_notify_event(p, NOTIFY_PORT_STATE);
-
-	if (p->jbod && next == PS_UNCALIBRATED) {
-		if (clock_switch_phc(p->clock, p->phc_index)) {
-			p->last_fault_type = FT_SWITCH_PHC;
-			return port_dispatch(p, EV_FAULT_DETECTED, 0);
+static enum fsm_event port_receive(struct port *p, struct ptp_message *msg,
+				   int cnt)
+{
+	int err, stage;
+
+	msg = msg_fit(msg, cnt);
+	msgtype_stat(p, rx, msg);
+	/* Keep the original bytes of the management messages to forward. */
+	if (msg_type(msg) == MANAGEMENT &&
+	    cnt >= (int) sizeof(struct management_msg) &&
+	    msg->management.boundaryHops)
+		msg_keep_wire(msg, cnt);
+	stage = cpustat_enter(CPU_PARSE);
+	err = msg_post_recv(msg, cnt);
+	cpustat_leave(stage);
+	if (err) {
+		switch (err) {
+		case -EBADMSG:
+			pr_err("port %hu: bad message", portnum(p));
+			msgtype_stat(p, rx_bad, msg);
+			break;
+		case -ETIME:
+			if (sk_hwts_filtered(msg_type(msg))) {
+				/* not time stamped by the hardware on purpose */
+				msgtype_stat(p, rx_ignored, msg);
+				break;
+			}
+			pr_err("port %hu: received %s without timestamp",
+				portnum(p), msg_type_string(msg_type(msg)));
+			msgtype_stat(p, rx_no_ts, msg);
+			break;
+		case -EPROTO:
+			pr_debug("port %hu: ignoring message", portnum(p));
+			msgtype_stat(p, rx_ignored, msg);
+			break;
 		}
-		clock_sync_interval(p->clock, p->log_sync_interval);
+		msg_put(msg);
+		return EV_NONE;
 	}
-
-	return 0;
+	if (msg_sots_valid(msg)) {
+		ts_add(&msg->hwts.ts, -p->rx_timestamp_offset);
+		clock_check_ts(p->clock, msg->hwts.ts);
+	}
+	if (msg->header.domainNumber != clock_domain_number(p->clock) &&
+	    port_receive_domain(p, msg))
+		return EV_NONE;
+	return port_process(p, msg);
 }
 
-enum fsm_event port_event(struct port *p, int fd_index)
+static enum fsm_event port_handle_event(struct port *p, int fd_index)
 {
-	enum fsm_event event = EV_NONE;
+	enum fsm_event ev, event = EV_NONE;
 	struct ptp_message *msg;
-	int cnt, fd = p->fda.fd[fd_index], err;
+	int cnt[SK_RX_BATCH], fd = p->fda.fd[fd_index], i, num, stage;
+
+	trace(TRACE_PORT_EVENT, portnum(p), 0, 0, fd_index);
+
+	if ((p->tx_async || p->worker || port_is_tc(p)) &&
+	    (p->txts_count || fd_index == FD_EVENT)) {
+		if (txts_poll(p))
+			return EV_FAULT_DETECTED;
+	}
 
 	switch (fd_index) {
 	case FD_ANNOUNCE_TIMER:
 	case FD_SYNC_RX_TIMER:
 		pr_debug("port %hu: %s timeout", portnum(p),
 			 fd_index == FD_SYNC_RX_TIMER ? "rx sync" : "announce");
-		if (p->best)
-			fc_clear(p->best);
+		if (p->cold->best)
+			fc_clear(p->cold->best);
 		port_set_announce_tmo(p);
 		if (clock_slave_only(p->clock) && p->delayMechanism != DM_P2P &&
 		    port_renew_transport(p)) {
@@ -2226,132 +4263,178 @@ enum fsm_event port_event(struct port *p, int fd_index)
 	case FD_MANNO_TIMER:
 		pr_debug("port %hu: master tx announce timeout", portnum(p));
 		port_set_manno_tmo(p);
-		return port_tx_announce(p) ? EV_FAULT_DETECTED : EV_NONE;
+		return port_tx_announce(p, NULL) ? EV_FAULT_DETECTED : EV_NONE;
 
 	case FD_SYNC_TX_TIMER:
 		pr_debug("port %hu: master sync timeout", portnum(p));
 		port_set_sync_tx_tmo(p);
-		return port_tx_sync(p) ? EV_FAULT_DETECTED : EV_NONE;
+		return port_tx_sync(p, NULL) ? EV_FAULT_DETECTED : EV_NONE;
+
+	case FD_DELAY_RESP_TIMER:
+		return dresp_flush(p) ? EV_FAULT_DETECTED : EV_NONE;
 	}
 
-	msg = msg_allocate();
-	if (!msg)
-		return EV_FAULT_DETECTED;
+	/* The worker receives the messages, this was the error queue. */
+	if (p->worker)
+		return EV_NONE;
 
-	msg->hwts.type = p->timestamping;
+	for (i = 0; i < SK_RX_BATCH; i++) {
+		if (!p->rx_msg[i]) {
+			p->rx_msg[i] = msg_allocate();
+			if (!p->rx_msg[i])
+				return EV_FAULT_DETECTED;
+		}
+		p->rx_msg[i]->hwts.type = p->timestamping;
+	}
 
-	cnt = transport_recv(p->trp, fd, msg);
-	if (cnt <= 0) {
+	stage = cpustat_enter(CPU_RECV);
+	num = transport_recv_batch(p->trp, fd, p->rx_msg, cnt, SK_RX_BATCH);
+	cpustat_leave(stage);
+	if (num < 0) {
 		pr_err("port %hu: recv message failed", portnum(p));
-		msg_put(msg);
 		return EV_FAULT_DETECTED;
 	}
-	err = msg_post_recv(msg, cnt);
-	if (err) {
-		switch (err) {
-		case -EBADMSG:
-			pr_err("port %hu: bad message", portnum(p));
-			break;
-		case -ETIME:
-			pr_err("port %hu: received %s without timestamp",
-				portnum(p), msg_type_string(msg_type(msg)));
-			break;
-		case -EPROTO:
-			pr_debug("port %hu: ignoring message", portnum(p));
-			break;
+	for (i = 0; i < num; i++) {
+		msg = p->rx_msg[i];
+		p->rx_msg[i] = NULL;
+		if (event == EV_FAULT_DETECTED) {
+			msg_put(msg);
+			continue;
 		}
-		msg_put(msg);
-		return EV_NONE;
-	}
-	if (msg_sots_valid(msg)) {
-		ts_add(&msg->hwts.ts, -p->rx_timestamp_offset);
-		clock_check_ts(p->clock, msg->hwts.ts);
-	}
-	if (port_ignore(p, msg)) {
-		msg_put(msg);
-		return EV_NONE;
-	}
-
-	switch (msg_type(msg)) {
-	case SYNC:
-		process_sync(p, msg);
-		break;
-	case DELAY_REQ:
-		if (process_delay_req(p, msg))
-			event = EV_FAULT_DETECTED;
-		break;
-	case PDELAY_REQ:
-		if (process_pdelay_req(p, msg))
-			event = EV_FAULT_DETECTED;
-		break;
-	case PDELAY_RESP:
-		if (process_pdelay_resp(p, msg))
+		if (cnt[i] <= 0) {
+			pr_err("port %hu: recv message failed", portnum(p));
+			msg_put(msg);
 			event = EV_FAULT_DETECTED;
-		break;
-	case FOLLOW_UP:
-		process_follow_up(p, msg);
-		break;
-	case DELAY_RESP:
-		process_delay_resp(p, msg);
-		break;
-	case PDELAY_RESP_FOLLOW_UP:
-		process_pdelay_resp_fup(p, msg);
-		break;
-	case ANNOUNCE:
-		if (process_announce(p, msg))
-			event = EV_STATE_DECISION_EVENT;
-		break;
-	case SIGNALING:
-		break;
-	case MANAGEMENT:
-		if (clock_manage(p->clock, p, msg))
-			event = EV_STATE_DECISION_EVENT;
-		break;
+			continue;
+		}
+		ev = port_receive(p, msg, cnt[i]);
+		if (ev != EV_NONE)
+			event = ev;
 	}
+	return event;
+}
 
-	msg_put(msg);
+enum fsm_event port_event(struct port *p, int fd_index)
+{
+	enum fsm_event event;
+	int stage;
+
+	stage = cpustat_enter(CPU_PORT);
+	event = port_handle_event(p, fd_index);
+	cpustat_leave(stage);
 	return event;
 }
 
+enum fsm_event port_rx(struct port *p, struct ptp_message *msg, int cnt)
+{
+	if (cnt <= 0) {
+		pr_err("port %hu: recv message failed", portnum(p));
+		msg_put(msg);
+		return EV_FAULT_DETECTED;
+	}
+	if (p->tx_async && p->txts_count && txts_poll(p)) {
+		msg_put(msg);
+		return EV_FAULT_DETECTED;
+	}
+	return port_receive(p, msg, cnt);
+}
+
 int port_forward(struct port *p, struct ptp_message *msg)
 {
 	int cnt;
 	cnt = transport_send(p->trp, &p->fda, 0, msg);
-	return cnt <= 0 ? -1 : 0;
+	if (cnt <= 0)
+		return -1;
+	msgtype_stat(p, tx, msg);
+	return 0;
 }
 
 int port_forward_to(struct port *p, struct ptp_message *msg)
 {
 	int cnt;
 	cnt = transport_sendto(p->trp, &p->fda, 0, msg);
-	return cnt <= 0 ? -1 : 0;
+	if (cnt <= 0)
+		return -1;
+	msgtype_stat(p, tx, msg);
+	return 0;
 }
 
-int port_prepare_and_send(struct port *p, struct ptp_message *msg, int event)
+/* Sends a message which is in network byte order already. */
+static int port_send(struct port *p, struct ptp_message *msg, int event)
 {
 	int cnt;
 
-	if (msg_pre_send(msg))
-		return -1;
 	if (msg->header.flagField[0] & UNICAST) {
 		cnt = transport_sendto(p->trp, &p->fda, event, msg);
 	} else {
 		cnt = transport_send(p->trp, &p->fda, event, msg);
 	}
 	if (cnt <= 0) {
+		/* Zero means that the time stamp did not show up in time. */
+		if (!cnt && event == TRANS_EVENT) {
+			msgtype_stat(p, tx_ts_timeout, msg);
+			p->cold->txts_timeouts++;
+		}
 		return -1;
 	}
+	msgtype_stat(p, tx, msg);
 	if (msg_sots_valid(msg)) {
+		if (event == TRANS_EVENT)
+			txts_wait_add(p, msg->hwts.wait);
 		ts_add(&msg->hwts.ts, p->tx_timestamp_offset);
 	}
 	return 0;
 }
 
+int port_prepare_and_send(struct port *p, struct ptp_message *msg, int event)
+{
+	if (msg_pre_send(msg))
+		return -1;
+	return port_send(p, msg, event);
+}
+
 struct PortIdentity port_identity(struct port *p)
 {
 	return p->portIdentity;
 }
 
+struct clock *port_clock(struct port *p)
+{
+	return p->clock;
+}
+
+const char *port_name(struct port *p)
+{
+	return p->cold->name;
+}
+
+void port_get_stats(struct port *p, struct port_stats *stats)
+{
+	*stats = p->stats;
+}
+
+void port_data_set(struct port *p, struct portDS *pds)
+{
+	pds->portIdentity            = p->portIdentity;
+	if (p->state == PS_GRAND_MASTER) {
+		pds->portState = PS_MASTER;
+	} else {
+		pds->portState = p->state;
+	}
+	pds->logMinDelayReqInterval  = p->logMinDelayReqInterval;
+	pds->peerMeanPathDelay       = p->peerMeanPathDelay;
+	pds->logAnnounceInterval     = p->logAnnounceInterval;
+	pds->announceReceiptTimeout  = p->announceReceiptTimeout;
+	pds->logSyncInterval         = p->logSyncInterval;
+	if (p->delayMechanism) {
+		pds->delayMechanism = p->delayMechanism;
+	} else {
+		pds->delayMechanism = DM_E2E;
+	}
+	pds->logMinPdelayReqInterval = p->logMinPdelayReqInterval;
+	pds->versionNumber           = p->cold->versionNumber;
+}
+
 int port_number(struct port *p)
 {
 	return portnum(p);
@@ -2534,27 +4617,36 @@ struct port *port_open(int phc_index,
 		       struct clock *clock)
 {
 	struct config *cfg = clock_config(clock);
-	struct port *p = malloc(sizeof(*p));
 	enum transport_type transport;
+	struct port *p;
 	int i;
 
-	if (!p)
+	if (posix_memalign((void **) &p, PORT_ALIGN, sizeof(*p)))
 		return NULL;
 
 	memset(p, 0, sizeof(*p));
+	p->cold = calloc(1, sizeof(*p->cold));
+	if (!p->cold) {
+		free(p);
+		return NULL;
+	}
+	config_resolve(cfg, interface->name, &p->cold->cfg, port_config_fields,
+		       N_PORT_CONFIG_FIELDS);
 
-	p->phc_index = phc_index;
-	p->jbod = config_get_int(cfg, interface->name, "boundary_clock_jbod");
-	transport = config_get_int(cfg, interface->name, "network_transport");
+	p->cold->phc_index = phc_index;
+	p->cold->jbod = p->cold->cfg.boundary_clock_jbod;
+	transport = p->cold->cfg.network_transport;
 
 	if (transport == TRANS_UDS)
 		; /* UDS cannot have a PHC. */
+	else if (transport == TRANS_REPLAY)
+		; /* The replay has no interface. */
 	else if (!interface->ts_info.valid)
 		pr_warning("port %d: get_ts_info not supported", number);
 	else if (phc_index >= 0 && phc_index != interface->ts_info.phc_index) {
-		if (p->jbod) {
+		if (p->cold->jbod) {
 			pr_warning("port %d: just a bunch of devices", number);
-			p->phc_index = interface->ts_info.phc_index;
+			p->cold->phc_index = interface->ts_info.phc_index;
 		} else {
 			pr_err("port %d: PHC device mismatch", number);
 			pr_err("port %d: /dev/ptp%d requested, ptp%d attached",
@@ -2563,26 +4655,68 @@ struct port *port_open(int phc_index,
 		}
 	}
 
-	p->name = interface->name;
-	p->asymmetry = config_get_int(cfg, p->name, "delayAsymmetry");
-	p->asymmetry <<= 16;
+	p->cold->name = interface->name;
 	p->announce_span = transport == TRANS_UDS ? 0 : ANNOUNCE_SPAN;
-	p->follow_up_info = config_get_int(cfg, p->name, "follow_up_info");
-	p->freq_est_interval = config_get_int(cfg, p->name, "freq_est_interval");
-	p->hybrid_e2e = config_get_int(cfg, p->name, "hybrid_e2e");
-	p->path_trace_enabled = config_get_int(cfg, p->name, "path_trace_enabled");
-	p->rx_timestamp_offset = config_get_int(cfg, p->name, "ingressLatency");
-	p->tx_timestamp_offset = config_get_int(cfg, p->name, "egressLatency");
+	port_set_options(p);
+	p->sync_batch = transport != TRANS_UDS && p->cold->cfg.sync_batch;
+	/* The XDP and replay transports take their time stamps while sending. */
+	if ((transport == TRANS_XDP || transport == TRANS_REPLAY) &&
+	    (p->cold->cfg.tx_timestamp_async || p->sync_batch)) {
+		pr_warning("port %d: tx_timestamp_async and sync_batch "
+			   "are not used with the %s transport", number,
+			   transport == TRANS_XDP ? "XDP" : "replay");
+		p->sync_batch = 0;
+	}
+	/*
+	 * The batched sync messages are matched with their time stamps, and
+	 * so are the messages of a transparent clock, as its error queue
+	 * also holds the time stamps of the forwarded messages.
+	 */
+	p->tx_async = transport != TRANS_UDS && transport != TRANS_XDP &&
+		transport != TRANS_REPLAY &&
+		(p->cold->cfg.tx_timestamp_async || p->sync_batch ||
+		 clock_type(clock) == CLOCK_TYPE_P2P ||
+		 clock_type(clock) == CLOCK_TYPE_E2E);
 	p->clock = clock;
+	p->cold->foreign_index = hash_create();
+	if (!p->cold->foreign_index)
+		goto err_port;
+	if (transport != TRANS_UDS &&
+	    p->cold->cfg.unicast_listen) {
+		p->cold->unicast = unicast_create(clock_wheel(clock), p,
+			p->cold->cfg.unicast_max_clients);
+		if (!p->cold->unicast)
+			goto err_index;
+		p->cold->unicast_max_duration =
+			p->cold->cfg.unicast_max_duration;
+	}
 	p->trp = transport_create(cfg, transport);
 	if (!p->trp)
-		goto err_port;
+		goto err_index;
+	if (transport != TRANS_UDS)
+		p->worker = clock_worker(clock, number);
 	p->timestamping = timestamping;
 	p->portIdentity.clockIdentity = clock_identity(clock);
 	p->portIdentity.portNumber = number;
 	p->state = PS_INITIALIZING;
-	p->delayMechanism = config_get_int(cfg, p->name, "delay_mechanism");
-	p->versionNumber = PTP_VERSION;
+	p->delayMechanism = p->cold->cfg.delay_mechanism;
+	p->cold->versionNumber = PTP_VERSION;
+
+	if (timestamping == TS_P2P1STEP && p->delayMechanism == DM_E2E) {
+		pr_err("port %d: one step P2P time stamping needs P2P", number);
+		goto err_transport;
+	}
+
+	if (transport != TRANS_UDS && clock_type(clock) == CLOCK_TYPE_P2P &&
+	    p->delayMechanism != DM_P2P) {
+		pr_err("port %d: P2P transparent clock needs P2P", number);
+		goto err_transport;
+	}
+	if (transport != TRANS_UDS && clock_type(clock) == CLOCK_TYPE_E2E &&
+	    p->delayMechanism == DM_P2P) {
+		pr_err("port %d: E2E transparent clock needs E2E", number);
+		goto err_transport;
+	}
 
 	if (p->hybrid_e2e && p->delayMechanism != DM_E2E) {
 		pr_warning("port %d: hybrid_e2e only works with E2E", number);
@@ -2590,45 +4724,262 @@ struct port *port_open(int phc_index,
 
 	/* Set fault timeouts to a default value */
 	for (i = 0; i < FT_CNT; i++) {
-		p->flt_interval_pertype[i].type = FTMO_LOG2_SECONDS;
-		p->flt_interval_pertype[i].val = 4;
+		p->cold->flt_interval_pertype[i].type = FTMO_LOG2_SECONDS;
+		p->cold->flt_interval_pertype[i].val = 4;
 	}
-	p->flt_interval_pertype[FT_BAD_PEER_NETWORK].type = FTMO_LINEAR_SECONDS;
-	p->flt_interval_pertype[FT_BAD_PEER_NETWORK].val =
-		config_get_int(cfg, p->name, "fault_badpeernet_interval");
+	p->cold->flt_interval_pertype[FT_BAD_PEER_NETWORK].type =
+		FTMO_LINEAR_SECONDS;
+	p->cold->flt_interval_pertype[FT_BAD_PEER_NETWORK].val =
+		p->cold->cfg.fault_badpeernet_interval;
 
-	p->flt_interval_pertype[FT_UNSPECIFIED].val =
-		config_get_int(cfg, p->name, "fault_reset_interval");
+	p->cold->flt_interval_pertype[FT_UNSPECIFIED].val =
+		p->cold->cfg.fault_reset_interval;
 
-	p->tsproc = tsproc_create(config_get_int(cfg, p->name, "tsproc_mode"),
-				  config_get_int(cfg, p->name, "delay_filter"),
-				  config_get_int(cfg, p->name, "delay_filter_length"));
+	p->tsproc = tsproc_create(p->cold->cfg.tsproc_mode,
+				  p->cold->cfg.delay_filter,
+				  p->cold->cfg.delay_filter_length,
+				  p->cold->cfg.delay_filter_quantile);
 	if (!p->tsproc) {
 		pr_err("Failed to create time stamp processor");
 		goto err_transport;
 	}
+	if (tsproc_set_filters(p->tsproc,
+			       config_get_string(cfg, p->cold->name,
+						 "delay_filter_chain"), "")) {
+		pr_err("port %d: bad delay_filter_chain", number);
+		goto err_stats;
+	}
+	p->cold->txts_wait = stats_create();
+	p->cold->txts_wait_recent = stats_create();
+	p->cold->mgmt_cache = mcache_create();
+	if (!p->cold->txts_wait || !p->cold->txts_wait_recent ||
+	    !p->cold->mgmt_cache)
+		goto err_stats;
 	p->nrate.ratio = 1.0;
 
 	port_clear_fda(p, N_POLLFD);
-	p->fault_fd = -1;
+	for (i = 0; i < N_TIMER_FDS; i++) {
+		wheel_timer_init(&p->cold->timer[i], p, FD_ANNOUNCE_TIMER + i);
+	}
+	p->cold->fault_fd = -1;
 	if (number) {
-		p->fault_fd = timerfd_create(CLOCK_MONOTONIC, 0);
-		if (p->fault_fd < 0) {
+		p->cold->fault_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+		if (p->cold->fault_fd < 0) {
 			pr_err("timerfd_create failed: %m");
-			goto err_tsproc;
+			goto err_stats;
 		}
 	}
 	return p;
 
-err_tsproc:
+err_stats:
+	if (p->cold->txts_wait)
+		stats_destroy(p->cold->txts_wait);
+	if (p->cold->txts_wait_recent)
+		stats_destroy(p->cold->txts_wait_recent);
+	if (p->cold->mgmt_cache)
+		mcache_destroy(p->cold->mgmt_cache);
 	tsproc_destroy(p->tsproc);
 err_transport:
 	transport_destroy(p->trp);
+err_index:
+	if (p->cold->unicast)
+		unicast_destroy(p->cold->unicast);
+	hash_destroy(p->cold->foreign_index, NULL);
+err_port:
+	free(p->cold);
+	free(p);
+	return NULL;
+}
+
+struct port *port_open_domain(struct port *owner, struct clock *clock)
+{
+	struct port *p, **tail;
+	int i;
+
+	if (owner->worker || owner->tx_async) {
+		pr_err("port %hu: port_threads, tx_timestamp_async and "
+		       "sync_batch cannot serve other domains", portnum(owner));
+		return NULL;
+	}
+	if (owner->cold->unicast)
+		pr_warning("port %hu: no unicast negotiation in domain %hhu",
+			   portnum(owner), clock_domain_number(clock));
+
+	if (posix_memalign((void **) &p, PORT_ALIGN, sizeof(*p)))
+		return NULL;
+
+	memset(p, 0, sizeof(*p));
+	p->cold = calloc(1, sizeof(*p->cold));
+	if (!p->cold) {
+		free(p);
+		return NULL;
+	}
+	p->cold->cfg = owner->cold->cfg;
+	p->cold->phc_index = owner->cold->phc_index;
+	p->cold->name = owner->cold->name;
+	p->announce_span = owner->announce_span;
+	port_set_options(p);
+	p->clock = clock;
+	p->cold->foreign_index = hash_create();
+	if (!p->cold->foreign_index)
+		goto err_port;
+	p->trp = owner->trp;
+	p->cold->shared = owner;
+	p->timestamping = owner->timestamping;
+	p->portIdentity.clockIdentity = clock_identity(clock);
+	p->portIdentity.portNumber = portnum(owner);
+	p->state = PS_INITIALIZING;
+	p->delayMechanism = owner->delayMechanism;
+	p->cold->versionNumber = PTP_VERSION;
+	memcpy(p->cold->flt_interval_pertype, owner->cold->flt_interval_pertype,
+	       sizeof(p->cold->flt_interval_pertype));
+
+	p->tsproc = tsproc_create(p->cold->cfg.tsproc_mode,
+				  p->cold->cfg.delay_filter,
+				  p->cold->cfg.delay_filter_length,
+				  p->cold->cfg.delay_filter_quantile);
+	if (!p->tsproc) {
+		pr_err("Failed to create time stamp processor");
+		goto err_index;
+	}
+	if (tsproc_set_filters(p->tsproc,
+			       config_get_string(clock_config(owner->clock),
+						 p->cold->name,
+						 "delay_filter_chain"),
+			       "")) {
+		pr_err("port %hu: bad delay_filter_chain", portnum(owner));
+		goto err_stats;
+	}
+	p->cold->txts_wait = stats_create();
+	p->cold->txts_wait_recent = stats_create();
+	p->cold->mgmt_cache = mcache_create();
+	if (!p->cold->txts_wait || !p->cold->txts_wait_recent ||
+	    !p->cold->mgmt_cache)
+		goto err_stats;
+	p->nrate.ratio = 1.0;
+
+	port_clear_fda(p, N_POLLFD);
+	for (i = 0; i < N_TIMER_FDS; i++) {
+		wheel_timer_init(&p->cold->timer[i], p, FD_ANNOUNCE_TIMER + i);
+	}
+	p->cold->fault_fd = -1;
+
+	for (tail = &owner->next_domain; *tail; tail = &(*tail)->next_domain)
+		;
+	*tail = p;
+	return p;
+
+err_stats:
+	if (p->cold->txts_wait)
+		stats_destroy(p->cold->txts_wait);
+	if (p->cold->txts_wait_recent)
+		stats_destroy(p->cold->txts_wait_recent);
+	if (p->cold->mgmt_cache)
+		mcache_destroy(p->cold->mgmt_cache);
+	tsproc_destroy(p->tsproc);
+err_index:
+	hash_destroy(p->cold->foreign_index, NULL);
 err_port:
+	free(p->cold);
 	free(p);
 	return NULL;
 }
 
+/* The settings that port_reload() applies to a running port. */
+static const char *port_live_options[] = {
+	"adaptive_interval",
+	"adaptive_lock_count",
+	"adaptive_logMinDelayReqInterval",
+	"adaptive_logSyncInterval",
+	"adaptive_offset_threshold",
+	"allow_interval_requests",
+	"announceReceiptTimeout",
+	"delayAsymmetry",
+	"delay_resp_batch",
+	"egressLatency",
+	"fault_badpeernet_interval",
+	"fault_reset_interval",
+	"follow_up_info",
+	"freq_est_interval",
+	"hybrid_e2e",
+	"ingressLatency",
+	"logAnnounceInterval",
+	"logMinDelayReqInterval",
+	"logMinPdelayReqInterval",
+	"logSyncInterval",
+	"min_neighbor_prop_delay",
+	"neighborPropDelayThresh",
+	"path_trace_enabled",
+	"syncReceiptTimeout",
+	"transportSpecific",
+	"unicast_max_duration",
+	NULL,
+};
+
+enum port_reload port_reload_check(struct port *p, struct config *old,
+				   struct config *cfg)
+{
+	enum port_reload result = PORT_RELOAD_NONE;
+	const char *option, **live;
+	int i = 0;
+
+	while ((option = config_next_change(old, cfg, p->cold->name, &i))) {
+		for (live = port_live_options; *live; live++) {
+			if (!strcmp(*live, option))
+				break;
+		}
+		if (!*live) {
+			pr_info("port %hu: %s changed, opening the port again",
+				portnum(p), option);
+			return PORT_RELOAD_REOPEN;
+		}
+		pr_info("port %hu: %s changed", portnum(p), option);
+		result = PORT_RELOAD_LIVE;
+	}
+	return result;
+}
+
+void port_reload(struct port *p)
+{
+	int i;
+
+	config_resolve(clock_config(p->clock), p->cold->name, &p->cold->cfg,
+		       port_config_fields, N_PORT_CONFIG_FIELDS);
+	port_set_options(p);
+	port_set_intervals(p);
+	for (i = 0; i < N_TEMPLATES; i++) {
+		p->cold->templates[i].valid = 0;
+	}
+
+	/* Run the timers of the current state at the new intervals. */
+	switch (p->state) {
+	case PS_LISTENING:
+	case PS_PASSIVE:
+		port_set_announce_tmo(p);
+		break;
+	case PS_MASTER:
+	case PS_GRAND_MASTER:
+		if (port_is_tc(p))
+			break;
+		port_set_manno_tmo(p);
+		port_set_sync_tx_tmo(p);
+		break;
+	case PS_UNCALIBRATED:
+	case PS_SLAVE:
+		port_set_announce_tmo(p);
+		if (p->delayMechanism != DM_P2P)
+			port_set_delay_tmo(p);
+		break;
+	default:
+		break;
+	}
+	if (p->delayMechanism == DM_P2P && port_is_enabled(p))
+		port_set_delay_tmo(p);
+	/* The ports of the other domains share our settings. */
+	if (p->next_domain)
+		port_reload(p->next_domain);
+}
+
 enum port_state port_state(struct port *port)
 {
 	return port->state;
@@ -25,6 +25,7 @@
 #include "fsm.h"
 #include "notification.h"
 #include "transport.h"
+#include "wheel.h"
 
 /* forward declarations */
 struct interface;
@@ -52,6 +53,35 @@ struct dataset *port_best_foreign(struct port *port);
  */
 void port_close(struct port *port);
 
+/**
+ * Tells how a port takes a change of its configuration.
+ */
+enum port_reload {
+	PORT_RELOAD_NONE,   /* no setting of the port changed */
+	PORT_RELOAD_LIVE,   /* port_reload() applies the changes */
+	PORT_RELOAD_REOPEN, /* the port has to be opened again */
+};
+
+/**
+ * Compare the settings of a port in two configurations.
+ *
+ * @param port  A pointer previously obtained via port_open().
+ * @param old   The configuration the port is running with.
+ * @param cfg   The new configuration.
+ * @return      How the port takes the changes, if any.
+ */
+enum port_reload port_reload_check(struct port *port, struct config *old,
+				   struct config *cfg);
+
+/**
+ * Apply the settings of the clock's configuration to a running port, and
+ * run the timers of its current state at the new message intervals. Only
+ * for changes found to be PORT_RELOAD_LIVE by port_reload_check().
+ *
+ * @param port  A pointer previously obtained via port_open().
+ */
+void port_reload(struct port *port);
+
 /**
  * Computes the 'best' foreign master discovered on a port. This has
  * the side effect of updating the 'dataset' field of the returned
@@ -62,6 +92,53 @@ void port_close(struct port *port);
  */
 struct foreign_clock *port_compute_best(struct port *port);
 
+/**
+ * Computes the 'best' foreign master of a port like port_compute_best(),
+ * but only when it may have changed: the port was marked with
+ * port_set_bmc_changed(), or the announce messages of its current best
+ * foreign master have expired. In the latter case the port is marked.
+ *
+ * @param port A pointer previously obtained via port_open().
+ * @return A pointer to the port's best foreign master, or NULL.
+ */
+struct foreign_clock *port_update_best(struct port *port);
+
+/**
+ * Handles an expired timer of the unicast clients of a port, sending the
+ * unicast message due, if any.
+ * @param port A pointer previously obtained via port_open().
+ * @param t    A timer with an index of UNICAST_TIMER_BASE or above.
+ */
+void port_unicast_timer(struct port *port, struct wheel_timer *t);
+
+/**
+ * Sends the sync messages held back by the transport, then waits for the
+ * transmit time stamps of the sync messages sent by a port with
+ * sync_batch enabled, and sends the follow up messages. To be called
+ * after the sync timers of all the ports have been handled, so that the
+ * sync messages leave back to back.
+ *
+ * @param port A pointer previously obtained via port_open().
+ * @return Zero on success, non-zero if a time stamp did not arrive.
+ */
+int port_sync_wait(struct port *port);
+
+/**
+ * Marks the inputs of the state decision of a port as changed, e.g.
+ * after it received a different announce message.
+ *
+ * @param port A pointer previously obtained via port_open().
+ */
+void port_set_bmc_changed(struct port *port);
+
+/**
+ * Clears the mark set by port_set_bmc_changed().
+ *
+ * @param port A pointer previously obtained via port_open().
+ * @return Non-zero if the port was marked.
+ */
+int port_clear_bmc_changed(struct port *port);
+
 /**
  * Dispatch a port event. This may cause a state transition on the
  * port, with the associated side effect.
@@ -84,6 +161,19 @@ int port_dispatch(struct port *p, enum fsm_event event, int mdiff);
  */
 enum fsm_event port_event(struct port *port, int fd_index);
 
+/**
+ * Generates state machine events for a message that was received on
+ * the port's behalf by a worker thread.
+ *
+ * @param port A pointer previously obtained via port_open().
+ * @param msg  The received message. The caller's reference passes to
+ *             the port.
+ * @param cnt  The length of the message, or a negative value if it
+ *             could not be received.
+ * @return One of the @a fsm_event codes.
+ */
+enum fsm_event port_rx(struct port *port, struct ptp_message *msg, int cnt);
+
 /**
  * Forward a message on a given port.
  * @param port    A pointer previously obtained via port_open().
@@ -119,6 +209,41 @@ int port_prepare_and_send(struct port *p, struct ptp_message *msg, int event);
  */
 struct PortIdentity port_identity(struct port *p);
 
+/**
+ * Obtain the clock of a port.
+ * @param p        A pointer previously obtained via port_open().
+ * @return         The clock passed to port_open() or port_open_domain().
+ */
+struct clock *port_clock(struct port *p);
+
+/**
+ * Obtain the name of a port's interface.
+ * @param p        A pointer previously obtained via port_open().
+ * @return         The name of the network interface of 'p'.
+ */
+const char *port_name(struct port *p);
+
+/**
+ * Copy the message counters of a port.
+ * @param p      A port instance.
+ * @param stats  Receives the counters.
+ */
+void port_get_stats(struct port *p, struct port_stats *stats);
+
+/**
+ * Obtain the statistics of the wait for the transmit time stamps.
+ * @param p    A port instance.
+ * @param tsn  Receives the statistics in host byte order.
+ */
+void port_get_txts_stats(struct port *p, struct tx_timestamp_stats_np *tsn);
+
+/**
+ * Obtain the port data set of a port.
+ * @param p        A pointer previously obtained via port_open().
+ * @param pds      Receives the port data set in host byte order.
+ */
+void port_data_set(struct port *p, struct portDS *pds);
+
 /**
  * Obtain a port number.
  * @param p        A port instance.
@@ -200,6 +325,17 @@ struct port *port_open(int phc_index,
 		       struct interface *interface,
 		       struct clock *clock);
 
+/**
+ * Open a port of another domain on the transport of an open port. The
+ * new port receives the messages of its domain from the owner, which
+ * demultiplexes them after a single receive, and sends over the same
+ * sockets. It must be closed before its owner.
+ * @param owner  The port owning the transport.
+ * @param clock  The clock of the other domain.
+ * @return A pointer to an open port on success, or NULL otherwise.
+ */
+struct port *port_open_domain(struct port *owner, struct clock *clock);
+
 /**
  * Returns a port's current state.
  * @param port  A port instance.
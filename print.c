@@ -16,19 +16,58 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <syslog.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "cpustat.h"
 #include "print.h"
 
+#define PRINT_MSG_LEN 1024
+/* The interval in which the logging thread looks at the queue in ms */
+#define PRINT_FLUSH_INTERVAL 100
+
 static int verbose = 0;
-static int print_level = LOG_INFO;
+int print_active_level = LOG_INFO;
 static int use_syslog = 1;
 static const char *progname;
 
+/*
+ * A record of the queue is owned by the producers while its seq equals
+ * the position of the producer, and by the logging thread while it
+ * equals the position plus one.
+ */
+struct print_record {
+	atomic_ulong seq;
+	int level;
+	struct timespec ts;
+	char msg[PRINT_MSG_LEN];
+};
+
+static struct {
+	struct print_record *records;
+	unsigned long mask;
+	atomic_ulong head; /* next record to be written */
+	unsigned long tail; /* next record to be printed */
+	atomic_ulong dropped;
+	unsigned long reported;
+	atomic_int sleeping;
+	atomic_int running;
+	int wakeup;
+	pthread_t thread;
+} queue;
+
 void print_set_progname(const char *name)
 {
 	progname = name;
@@ -41,7 +80,7 @@ void print_set_syslog(int value)
 
 void print_set_level(int level)
 {
-	print_level = level;
+	print_active_level = level;
 }
 
 void print_set_verbose(int value)
@@ -49,31 +88,217 @@ void print_set_verbose(int value)
 	verbose = value ? 1 : 0;
 }
 
+static void print_emit(int level, struct timespec *ts, const char *buf)
+{
+	FILE *f;
+
+	if (verbose) {
+		f = level >= LOG_NOTICE ? stdout : stderr;
+		fprintf(f, "%s[%ld.%03ld]: %s\n",
+			progname ? progname : "",
+			ts->tv_sec, ts->tv_nsec / 1000000, buf);
+		fflush(f);
+	}
+	if (use_syslog) {
+		syslog(level, "[%ld.%03ld] %s",
+		       ts->tv_sec, ts->tv_nsec / 1000000, buf);
+	}
+}
+
+static void print_report_dropped(void)
+{
+	unsigned long dropped;
+	struct timespec ts;
+	char buf[64];
+
+	dropped = atomic_load_explicit(&queue.dropped, memory_order_relaxed);
+	if (dropped == queue.reported)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	snprintf(buf, sizeof(buf), "dropped %lu log messages",
+		 dropped - queue.reported);
+	print_emit(LOG_WARNING, &ts, buf);
+	queue.reported = dropped;
+}
+
+/* Print the queued records, returning the number of them. */
+static int print_drain(void)
+{
+	struct print_record *r;
+	int n = 0;
+
+	while (1) {
+		r = &queue.records[queue.tail & queue.mask];
+		if (atomic_load_explicit(&r->seq, memory_order_acquire) !=
+		    queue.tail + 1)
+			break;
+		print_emit(r->level, &r->ts, r->msg);
+		atomic_store_explicit(&r->seq, queue.tail + queue.mask + 1,
+				      memory_order_release);
+		queue.tail++;
+		n++;
+	}
+	print_report_dropped();
+	return n;
+}
+
+static void print_wakeup(void)
+{
+	uint64_t one = 1;
+
+	/* Failing with EAGAIN is fine, the thread is woken anyway. */
+	if (write(queue.wakeup, &one, sizeof(one)) < 0)
+		return;
+}
+
+static void *print_run(void *arg)
+{
+	struct pollfd pfd = { .fd = queue.wakeup, .events = POLLIN };
+	uint64_t count;
+
+	while (atomic_load(&queue.running)) {
+		if (print_drain())
+			continue;
+		/*
+		 * Announce the sleep before checking the queue once more,
+		 * so that a producer filling the queue either sees the flag
+		 * or has its records found here.
+		 */
+		atomic_store(&queue.sleeping, 1);
+		if (print_drain()) {
+			atomic_store(&queue.sleeping, 0);
+			continue;
+		}
+		if (poll(&pfd, 1, PRINT_FLUSH_INTERVAL) > 0 &&
+		    read(queue.wakeup, &count, sizeof(count)) < 0)
+			break;
+		atomic_store(&queue.sleeping, 0);
+	}
+	print_drain();
+	return NULL;
+}
+
+/* Queue a record, returning non-zero if the queue is full. */
+static int print_queue(int level, struct timespec *ts, char const *format,
+		       va_list ap)
+{
+	struct print_record *r;
+	unsigned long pos, seq;
+
+	pos = atomic_load_explicit(&queue.head, memory_order_relaxed);
+	while (1) {
+		r = &queue.records[pos & queue.mask];
+		seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(
+				    &queue.head, &pos, pos + 1,
+				    memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if ((long) (seq - pos) < 0) {
+			return -1;
+		} else {
+			pos = atomic_load_explicit(&queue.head,
+						   memory_order_relaxed);
+		}
+	}
+	r->level = level;
+	r->ts = *ts;
+	vsnprintf(r->msg, sizeof(r->msg), format, ap);
+	atomic_store_explicit(&r->seq, pos + 1, memory_order_release);
+	/*
+	 * The thread finds the records by itself in a moment. Only when a
+	 * quarter of the queue has filled up it is woken right away.
+	 */
+	if (!(pos & (queue.mask >> 2)) && atomic_exchange(&queue.sleeping, 0))
+		print_wakeup();
+	return 0;
+}
+
+int print_set_async(int records)
+{
+	sigset_t all, old;
+	unsigned long i, size;
+	int err;
+
+	if (queue.records) {
+		atomic_store(&queue.running, 0);
+		print_wakeup();
+		pthread_join(queue.thread, NULL);
+		close(queue.wakeup);
+		free(queue.records);
+		queue.records = NULL;
+	}
+	if (records <= 0)
+		return 0;
+
+	for (size = 1; size < records; size <<= 1)
+		;
+	queue.wakeup = eventfd(0, EFD_NONBLOCK);
+	if (queue.wakeup < 0) {
+		pr_err("failed to create the log queue event: %m");
+		return -1;
+	}
+	queue.records = calloc(size, sizeof(*queue.records));
+	if (!queue.records) {
+		pr_err("failed to allocate the log queue");
+		close(queue.wakeup);
+		return -1;
+	}
+	for (i = 0; i < size; i++)
+		atomic_init(&queue.records[i].seq, i);
+	queue.mask = size - 1;
+	atomic_init(&queue.head, 0);
+	queue.tail = 0;
+	atomic_init(&queue.sleeping, 0);
+	atomic_init(&queue.running, 1);
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	err = pthread_create(&queue.thread, NULL, print_run, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		close(queue.wakeup);
+		free(queue.records);
+		queue.records = NULL;
+		pr_err("failed to start the logging thread: %s", strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+unsigned long print_dropped(void)
+{
+	return atomic_load_explicit(&queue.dropped, memory_order_relaxed);
+}
+
 void print(int level, char const *format, ...)
 {
 	struct timespec ts;
 	va_list ap;
-	char buf[1024];
-	FILE *f;
+	char buf[PRINT_MSG_LEN];
+	int full, stage;
 
-	if (level > print_level)
+	if (level > print_active_level)
 		return;
 
+	stage = cpustat_enter(CPU_LOG);
 	clock_gettime(CLOCK_MONOTONIC, &ts);
 
+	if (queue.records) {
+		va_start(ap, format);
+		full = print_queue(level, &ts, format, ap);
+		va_end(ap);
+		if (full)
+			atomic_fetch_add_explicit(&queue.dropped, 1,
+						  memory_order_relaxed);
+		cpustat_leave(stage);
+		return;
+	}
+
 	va_start(ap, format);
 	vsnprintf(buf, sizeof(buf), format, ap);
 	va_end(ap);
 
-	if (verbose) {
-		f = level >= LOG_NOTICE ? stdout : stderr;
-		fprintf(f, "%s[%ld.%03ld]: %s\n",
-			progname ? progname : "",
-			ts.tv_sec, ts.tv_nsec / 1000000, buf);
-		fflush(f);
-	}
-	if (use_syslog) {
-		syslog(level, "[%ld.%03ld] %s",
-		       ts.tv_sec, ts.tv_nsec / 1000000, buf);
-	}
+	print_emit(level, &ts, buf);
+	cpustat_leave(stage);
 }
@@ -27,6 +27,22 @@
 #define PRINT_LEVEL_MIN LOG_EMERG
 #define PRINT_LEVEL_MAX LOG_DEBUG
 
+/* The highest level of the messages compiled into the programs */
+#ifndef PRINT_LEVEL_BUILD
+#define PRINT_LEVEL_BUILD PRINT_LEVEL_MAX
+#endif
+
+/* The highest level of the messages printed, set by print_set_level() */
+extern int print_active_level;
+
+/*
+ * The check is done before the call, so that the arguments of a disabled
+ * message are not even evaluated, and it is a constant for the levels
+ * above PRINT_LEVEL_BUILD, so that the compiler removes those messages.
+ */
+#define print_enabled(l) \
+	((l) <= PRINT_LEVEL_BUILD && (l) <= print_active_level)
+
 #ifdef __GNUC__
 __attribute__ ((format (printf, 2, 3)))
 #endif
@@ -37,19 +53,44 @@ void print_set_syslog(int value);
 void print_set_level(int level);
 void print_set_verbose(int value);
 
-#define pr_emerg(x...)   print(LOG_EMERG, x)
-#define pr_alert(x...)   print(LOG_ALERT, x)
-#define pr_crit(x...)    print(LOG_CRIT, x)
-#define pr_err(x...)     print(LOG_ERR, x)
-#define pr_warning(x...) print(LOG_WARNING, x)
-#define pr_notice(x...)  print(LOG_NOTICE, x)
-#define pr_info(x...)    print(LOG_INFO, x)
-#define pr_debug(x...)   print(LOG_DEBUG, x)
+/**
+ * Queue the messages for a background thread which prints them, so that
+ * a slow system log does not delay the caller. This function must not
+ * be called while other threads may print. When the queue is full,
+ * the messages are dropped and counted, and the thread reports how many
+ * were lost once it catches up.
+ * @param records  The size of the queue, rounded up to a power of two,
+ *                 or zero to print the messages synchronously. Any
+ *                 previous queue is flushed first.
+ * @return         Zero on success, non-zero otherwise.
+ */
+int print_set_async(int records);
+
+/**
+ * Get the number of messages dropped because the queue was full.
+ * @return  The count since the start of the program.
+ */
+unsigned long print_dropped(void);
+
+#define PRINT(l, x...) \
+	do { \
+		if (print_enabled(l)) \
+			print(l, x); \
+	} while (0)
+
+#define pr_emerg(x...)   PRINT(LOG_EMERG, x)
+#define pr_alert(x...)   PRINT(LOG_ALERT, x)
+#define pr_crit(x...)    PRINT(LOG_CRIT, x)
+#define pr_err(x...)     PRINT(LOG_ERR, x)
+#define pr_warning(x...) PRINT(LOG_WARNING, x)
+#define pr_notice(x...)  PRINT(LOG_NOTICE, x)
+#define pr_info(x...)    PRINT(LOG_INFO, x)
+#define pr_debug(x...)   PRINT(LOG_DEBUG, x)
 
 #define PRINT_RL(l, i, x...) \
 	do { \
 		static time_t last = -i; \
-		if (!rate_limited(i, &last)) \
+		if (print_enabled(l) && !rate_limited(i, &last)) \
 			print(l, x); \
 	} while (0);
 
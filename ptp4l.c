@@ -24,17 +24,22 @@
 #include <unistd.h>
 
 #include "clock.h"
+#include "clockadj.h"
 #include "config.h"
+#include "cpustat.h"
 #include "ntpshm.h"
 #include "pi.h"
 #include "print.h"
 #include "raw.h"
+#include "replay.h"
 #include "sk.h"
+#include "trace.h"
 #include "transport.h"
 #include "udp6.h"
 #include "uds.h"
 #include "util.h"
 #include "version.h"
+#include "xdp.h"
 
 int assume_two_step = 0;
 
@@ -70,14 +75,90 @@ static void usage(char *progname)
 		progname);
 }
 
+/* Applies the settings that belong to the program rather than the clock. */
+static void set_globals(struct config *cfg)
+{
+	print_set_verbose(config_get_int(cfg, NULL, "verbose"));
+	print_set_syslog(config_get_int(cfg, NULL, "use_syslog"));
+	print_set_level(config_get_int(cfg, NULL, "logging_level"));
+
+	assume_two_step = config_get_int(cfg, NULL, "assume_two_step");
+	sk_check_fupsync = config_get_int(cfg, NULL, "check_fup_sync");
+	sk_tx_timeout = config_get_int(cfg, NULL, "tx_timestamp_timeout");
+
+	/* A slave only clock using E2E needs time stamps only on Sync. */
+	sk_hwts_filter = config_get_int(cfg, NULL, "hwts_filter");
+	if (sk_hwts_filter == HWTS_FILTER_AUTO) {
+		sk_hwts_filter =
+			config_get_int(cfg, NULL, "slaveOnly") &&
+			config_get_int(cfg, NULL, "delay_mechanism") == DM_E2E ?
+			HWTS_FILTER_SYNC : HWTS_FILTER_NORMAL;
+	}
+}
+
+static void reload_config(struct clock *clock, struct config *cfg,
+			  char *file)
+{
+	struct config *new;
+
+	if (!file) {
+		pr_warning("no configuration file to reload");
+		return;
+	}
+	pr_notice("reloading %s", file);
+	new = config_reread(file, cfg);
+	if (!new) {
+		pr_err("failed to read %s, keeping the running configuration",
+		       file);
+		return;
+	}
+	if (clock_reload(clock, new))
+		pr_err("failed to apply all of the new configuration");
+	config_destroy(new);
+	set_globals(cfg);
+}
+
+/*
+ * Run on the NUMA node of the interfaces, so that the ports, the message
+ * pool and the socket buffers are allocated in its memory.
+ */
+static int set_numa_affinity(struct config *cfg)
+{
+	struct interface *iface;
+	int n, node = -1;
+
+	STAILQ_FOREACH(iface, &cfg->interfaces, list) {
+		n = sk_interface_numa_node(iface->name);
+		if (n < 0)
+			continue;
+		if (node < 0)
+			node = n;
+		else if (n != node)
+			pr_warning("interface %s is on NUMA node %d, not %d",
+				   iface->name, n, node);
+	}
+	if (node < 0) {
+		pr_info("the NUMA node of the interfaces is not known");
+		return 0;
+	}
+	pr_info("running on NUMA node %d", node);
+	return set_numa_node(node);
+}
+
 int main(int argc, char *argv[])
 {
-	char *config = NULL, *req_phc = NULL, *progname;
+	char *config = NULL, *req_phc = NULL, *progname, *trace_file;
 	int c, err = -1, print_level;
+	enum clock_type type;
+	unsigned long adj_issued, adj_avoided;
 	struct clock *clock = NULL;
 	struct config *cfg;
 
-	if (handle_term_signals())
+	if (handle_term_signals() || handle_reload_signal())
+		return -1;
+
+	if (transport_register(TRANS_XDP, xdp_transport_create) ||
+	    transport_register(TRANS_REPLAY, replay_transport_create))
 		return -1;
 
 	cfg = config_create();
@@ -176,13 +257,9 @@ int main(int argc, char *argv[])
 	}
 
 	print_set_progname(progname);
-	print_set_verbose(config_get_int(cfg, NULL, "verbose"));
-	print_set_syslog(config_get_int(cfg, NULL, "use_syslog"));
-	print_set_level(config_get_int(cfg, NULL, "logging_level"));
-
-	assume_two_step = config_get_int(cfg, NULL, "assume_two_step");
-	sk_check_fupsync = config_get_int(cfg, NULL, "check_fup_sync");
-	sk_tx_timeout = config_get_int(cfg, NULL, "tx_timestamp_timeout");
+	set_globals(cfg);
+	if (print_set_async(config_get_int(cfg, NULL, "logging_queue")))
+		goto out;
 
 	if (config_get_int(cfg, NULL, "clock_servo") == CLOCK_SERVO_NTPSHM) {
 		config_set_int(cfg, "kernel_leap", 0);
@@ -195,8 +272,41 @@ int main(int argc, char *argv[])
 		goto out;
 	}
 
-	clock = clock_create(cfg->n_interfaces > 1 ? CLOCK_TYPE_BOUNDARY :
-			     CLOCK_TYPE_ORDINARY, cfg, req_phc);
+	if (config_get_int(cfg, NULL, "numa_affinity") &&
+	    set_numa_affinity(cfg))
+		goto out;
+
+	if (set_scheduling(config_get_int(cfg, NULL, "sched_priority"),
+			   config_get_int(cfg, NULL, "clock_thread_cpu"),
+			   config_get_int(cfg, NULL, "lock_memory")))
+		goto out;
+
+	trace_file = config_get_string(cfg, NULL, "trace_file");
+	if (trace_file[0] &&
+	    trace_open(trace_file, config_get_int(cfg, NULL, "trace_size")))
+		goto out;
+
+	if (config_get_int(cfg, NULL, "cpu_accounting"))
+		cpustat_enable();
+
+	type = config_get_int(cfg, NULL, "clock_type");
+	switch (type) {
+	case CLOCK_TYPE_ORDINARY:
+		if (cfg->n_interfaces > 1)
+			type = CLOCK_TYPE_BOUNDARY;
+		break;
+	case CLOCK_TYPE_P2P:
+	case CLOCK_TYPE_E2E:
+		if (cfg->n_interfaces < 2) {
+			fprintf(stderr, "a transparent clock needs two ports\n");
+			goto out;
+		}
+		break;
+	default:
+		break;
+	}
+
+	clock = clock_create(type, cfg, req_phc);
 	if (!clock) {
 		fprintf(stderr, "failed to create a clock\n");
 		goto out;
@@ -205,12 +315,21 @@ int main(int argc, char *argv[])
 	err = 0;
 
 	while (is_running()) {
+		if (reload_requested())
+			reload_config(clock, cfg, config);
 		if (clock_poll(clock))
 			break;
 	}
 out:
-	if (clock)
+	if (clock) {
+		clockadj_get_stats(&adj_issued, &adj_avoided);
+		if (adj_issued || adj_avoided)
+			pr_info("clock adjustments: %lu issued, %lu avoided",
+				adj_issued, adj_avoided);
 		clock_destroy(clock);
+	}
+	trace_close();
+	print_set_async(0);
 	config_destroy(cfg);
 	return err;
 }
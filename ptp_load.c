@@ -0,0 +1,634 @@
+/**
+ * @file ptp_load.c
+ * @brief Emulates many slaves or masters to measure the capacity of ptp4l.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "ds.h"
+#include "msg.h"
+#include "print.h"
+#include "stats.h"
+#include "tlv.h"
+#include "tmv.h"
+#include "transport.h"
+#include "util.h"
+#include "version.h"
+
+/* The number of requests of a node which can wait for a response. */
+#define PENDING 64
+#define MAX_NODES 0xfffe
+#define GRACE_PERIOD NS_PER_SEC
+
+/*
+ * Each emulated port has an identity of its own. The node index is kept
+ * in the last two octets, and the index after the last node is the one
+ * sending the management probes.
+ */
+struct node {
+	UInteger16 seq;
+	UInteger16 sent_seq[PENDING];
+	struct timespec sent[PENDING];
+	uint8_t waiting[PENDING];
+};
+
+/* Requests sent at a fixed rate, spread evenly over the nodes. */
+struct schedule {
+	uint64_t period;
+	uint64_t count;
+};
+
+struct load {
+	struct transport *trp;
+	struct fdarray fda;
+	struct ClockIdentity base;
+	UInteger8 domain;
+	int masters;
+	int nodes;
+	struct node *node;
+	struct stats *latency;
+	unsigned long sent;
+	unsigned long requests;
+	unsigned long answered;
+	unsigned long failed;
+	unsigned long delay_req;
+	uint64_t start;
+};
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static struct PortIdentity node_identity(struct load *l, int index)
+{
+	struct PortIdentity pid;
+
+	pid.clockIdentity = l->base;
+	pid.clockIdentity.id[6] = index >> 8;
+	pid.clockIdentity.id[7] = index & 0xff;
+	pid.portNumber = 1;
+	return pid;
+}
+
+/* Returns the index of an emulated node, or -1. */
+static int node_index(struct load *l, struct PortIdentity *pid)
+{
+	int index;
+
+	if (memcmp(pid->clockIdentity.id, l->base.id, 6) ||
+	    pid->portNumber != 1)
+		return -1;
+	index = pid->clockIdentity.id[6] << 8 | pid->clockIdentity.id[7];
+	return index <= l->nodes ? index : -1;
+}
+
+static void ts_to_timestamp(struct timespec *src, struct Timestamp *dst)
+{
+	dst->seconds_lsb = src->tv_sec;
+	dst->seconds_msb = 0;
+	dst->nanoseconds = src->tv_nsec;
+}
+
+static struct ptp_message *load_message(struct load *l, int type, int len,
+					int index)
+{
+	struct ptp_message *msg;
+
+	msg = msg_allocate();
+	if (!msg)
+		return NULL;
+	msg->hwts.type = TS_SOFTWARE;
+	msg->header.tsmt = type;
+	msg->header.ver = PTP_VERSION;
+	msg->header.messageLength = len;
+	msg->header.domainNumber = l->domain;
+	msg->header.sourcePortIdentity = node_identity(l, index);
+	msg->header.logMessageInterval = 0x7f;
+	return msg;
+}
+
+/* Sends a message, event messages with their transmit time stamp. */
+static int load_send(struct load *l, struct ptp_message *msg, int event)
+{
+	int cnt;
+
+	if (msg_pre_send(msg)) {
+		msg_put(msg);
+		return -1;
+	}
+	cnt = transport_send(l->trp, &l->fda, event, msg);
+	if (cnt <= 0 || (event == TRANS_EVENT && msg_sots_missing(msg))) {
+		l->failed++;
+		msg_put(msg);
+		return -1;
+	}
+	l->sent++;
+	return 0;
+}
+
+/* Called after sending, when the header is in network byte order. */
+static void load_request(struct load *l, struct ptp_message *msg, int index)
+{
+	struct node *n = &l->node[index];
+	UInteger16 seq = ntohs(msg->header.sequenceId);
+	int slot = seq % PENDING;
+
+	n->sent_seq[slot] = seq;
+	n->sent[slot] = msg->hwts.ts;
+	n->waiting[slot] = 1;
+	l->requests++;
+}
+
+static void load_response(struct load *l, int index, UInteger16 seq,
+			  struct timespec ts)
+{
+	struct node *n = &l->node[index];
+	int slot = seq % PENDING;
+	tmv_t t;
+
+	if (!n->waiting[slot] || n->sent_seq[slot] != seq)
+		return;
+	n->waiting[slot] = 0;
+	t = tmv_sub(timespec_to_tmv(ts), timespec_to_tmv(n->sent[slot]));
+	stats_add_value(l->latency, tmv_to_nanoseconds(t) / 1e3);
+	l->answered++;
+}
+
+static int send_delay_req(struct load *l, int index)
+{
+	struct ptp_message *msg;
+
+	msg = load_message(l, DELAY_REQ, sizeof(struct delay_req_msg), index);
+	if (!msg)
+		return -1;
+	msg->header.sequenceId = l->node[index].seq++;
+	msg->header.control = CTL_DELAY_REQ;
+	if (load_send(l, msg, TRANS_EVENT))
+		return 0;
+	load_request(l, msg, index);
+	msg_put(msg);
+	return 0;
+}
+
+static int send_announce(struct load *l, int index)
+{
+	struct ptp_message *msg;
+
+	msg = load_message(l, ANNOUNCE, sizeof(struct announce_msg), index);
+	if (!msg)
+		return -1;
+	msg->header.sequenceId = l->node[index].seq++;
+	msg->header.control = CTL_OTHER;
+	msg->header.logMessageInterval = 0;
+	msg->header.flagField[1] = PTP_TIMESCALE;
+	msg->announce.currentUtcOffset = CURRENT_UTC_OFFSET;
+	msg->announce.grandmasterPriority1 = 128;
+	msg->announce.grandmasterClockQuality.clockClass = 248;
+	msg->announce.grandmasterClockQuality.clockAccuracy = 0xfe;
+	msg->announce.grandmasterClockQuality.offsetScaledLogVariance = 0xffff;
+	msg->announce.grandmasterPriority2 = 128;
+	msg->announce.grandmasterIdentity = node_identity(l, index).clockIdentity;
+	msg->announce.timeSource = INTERNAL_OSCILLATOR;
+	load_send(l, msg, TRANS_GENERAL);
+	msg_put(msg);
+	return 0;
+}
+
+static int send_sync(struct load *l, int index)
+{
+	struct ptp_message *msg, *fup;
+	UInteger16 seq = l->node[index].seq++;
+
+	msg = load_message(l, SYNC, sizeof(struct sync_msg), index);
+	if (!msg)
+		return -1;
+	msg->header.sequenceId = seq;
+	msg->header.control = CTL_SYNC;
+	msg->header.logMessageInterval = 0;
+	msg->header.flagField[0] = TWO_STEP;
+	if (load_send(l, msg, TRANS_EVENT))
+		return 0;
+
+	fup = load_message(l, FOLLOW_UP, sizeof(struct follow_up_msg), index);
+	if (!fup) {
+		msg_put(msg);
+		return -1;
+	}
+	fup->header.sequenceId = seq;
+	fup->header.control = CTL_FOLLOW_UP;
+	fup->header.logMessageInterval = 0;
+	ts_to_timestamp(&msg->hwts.ts, &fup->follow_up.preciseOriginTimestamp);
+	load_send(l, fup, TRANS_GENERAL);
+	msg_put(fup);
+	msg_put(msg);
+	return 0;
+}
+
+static int send_probe(struct load *l)
+{
+	struct management_tlv *mgt;
+	struct ptp_message *msg;
+
+	msg = load_message(l, MANAGEMENT, sizeof(struct management_msg),
+			   l->nodes);
+	if (!msg)
+		return -1;
+	msg->header.sequenceId = l->node[l->nodes].seq++;
+	msg->header.control = CTL_MANAGEMENT;
+	memset(&msg->management.targetPortIdentity, 0xff,
+	       sizeof(msg->management.targetPortIdentity));
+	msg->management.flags = GET;
+	mgt = (struct management_tlv *) msg->management.suffix;
+	mgt->type = TLV_MANAGEMENT;
+	mgt->length = sizeof(mgt->id);
+	mgt->id = TLV_CURRENT_DATA_SET;
+	msg->header.messageLength += sizeof(*mgt);
+	msg->tlv_count = 1;
+	/* The response can only be matched with the time of the request. */
+	if (load_send(l, msg, TRANS_EVENT))
+		return 0;
+	load_request(l, msg, l->nodes);
+	msg_put(msg);
+	return 0;
+}
+
+static int send_delay_resp(struct load *l, struct ptp_message *req)
+{
+	struct ptp_message *msg;
+
+	/* With equal clocks, the slave selects the lowest identity. */
+	msg = load_message(l, DELAY_RESP, sizeof(struct delay_resp_msg), 0);
+	if (!msg)
+		return -1;
+	msg->header.control = CTL_DELAY_RESP;
+	msg->header.logMessageInterval = 0;
+	msg->header.sequenceId = req->header.sequenceId;
+	msg->header.correction = req->header.correction;
+	ts_to_timestamp(&req->hwts.ts, &msg->delay_resp.receiveTimestamp);
+	msg->delay_resp.requestingPortIdentity =
+		req->header.sourcePortIdentity;
+	load_send(l, msg, TRANS_GENERAL);
+	msg_put(msg);
+	return 0;
+}
+
+static int load_receive(struct load *l, int fd)
+{
+	struct ptp_message *msg;
+	struct PortIdentity pid;
+	int cnt, err = 0, index;
+
+	msg = msg_allocate();
+	if (!msg)
+		return -1;
+	msg->hwts.type = TS_SOFTWARE;
+	cnt = transport_recv(l->trp, fd, msg);
+	if (cnt <= 0) {
+		msg_put(msg);
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	}
+	/* Only the event socket has time stamps, take one for the others. */
+	if (!msg->hwts.ts.tv_sec && !msg->hwts.ts.tv_nsec)
+		clock_gettime(CLOCK_REALTIME, &msg->hwts.ts);
+	if (msg_post_recv(msg, cnt) ||
+	    msg->header.domainNumber != l->domain) {
+		msg_put(msg);
+		return 0;
+	}
+	switch (msg_type(msg)) {
+	case DELAY_RESP:
+		/* The requesting port number is left in network byte order. */
+		pid = msg->delay_resp.requestingPortIdentity;
+		pid.portNumber = ntohs(pid.portNumber);
+		index = node_index(l, &pid);
+			if (!l->masters && index >= 0 && index < l->nodes)
+			load_response(l, index, msg->header.sequenceId,
+				      msg->hwts.ts);
+		break;
+	case DELAY_REQ:
+		if (l->masters && node_index(l, &msg->header.sourcePortIdentity) < 0) {
+			l->delay_req++;
+			err = send_delay_resp(l, msg);
+		}
+		break;
+	case MANAGEMENT:
+		if (management_action(msg) == RESPONSE &&
+		    node_index(l, &msg->management.targetPortIdentity) == l->nodes)
+			load_response(l, l->nodes, msg->header.sequenceId,
+				      msg->hwts.ts);
+		break;
+	}
+	msg_put(msg);
+	return err;
+}
+
+/* Runs the requests which are due, and returns when the next one is. */
+static uint64_t schedule_run(struct load *l, struct schedule *s,
+			     uint64_t now, int (*send)(struct load *, int),
+			     int nodes, int *err)
+{
+	uint64_t due;
+
+	if (!s->period)
+		return UINT64_MAX;
+	while ((due = l->start + s->count * s->period) <= now) {
+		if (send(l, s->count % nodes)) {
+			*err = -1;
+			break;
+		}
+		s->count++;
+	}
+	return due;
+}
+
+static int send_probe_any(struct load *l, int index)
+{
+	return send_probe(l);
+}
+
+static void schedule_init(struct schedule *s, double rate, int nodes)
+{
+	s->period = rate > 0.0 ? NS_PER_SEC / (rate * nodes) : 0;
+	s->count = 0;
+}
+
+static int load_run(struct load *l, double rate, double announce_rate,
+		    double probe_rate, int duration)
+{
+	struct schedule sync, announce, delay_req, probe;
+	struct pollfd pfd[N_POLLFD];
+	uint64_t end, now, next, due;
+	int i, n, err = 0;
+	struct timespec tmo;
+
+	for (i = 0; i < N_POLLFD; i++) {
+		pfd[i].fd = l->fda.fd[i];
+		pfd[i].events = POLLIN | POLLPRI;
+	}
+	n = l->fda.fd[FD_GENERAL] == l->fda.fd[FD_EVENT] ? 1 : 2;
+
+	if (l->masters) {
+		schedule_init(&sync, rate, l->nodes);
+		schedule_init(&announce, announce_rate, l->nodes);
+		schedule_init(&delay_req, 0.0, l->nodes);
+		schedule_init(&probe, probe_rate, 1);
+	} else {
+		schedule_init(&sync, 0.0, l->nodes);
+		schedule_init(&announce, 0.0, l->nodes);
+		schedule_init(&delay_req, rate, l->nodes);
+		schedule_init(&probe, 0.0, 1);
+	}
+
+	l->start = monotonic_ns();
+	end = l->start + duration * NS_PER_SEC;
+	while (is_running() && !err) {
+		now = monotonic_ns();
+		next = end + GRACE_PERIOD;
+		if (now >= next)
+			break;
+		if (now < end) {
+			due = schedule_run(l, &announce, now, send_announce,
+					   l->nodes, &err);
+			next = due < next ? due : next;
+			due = schedule_run(l, &sync, now, send_sync,
+					   l->nodes, &err);
+			next = due < next ? due : next;
+			due = schedule_run(l, &delay_req, now, send_delay_req,
+					   l->nodes, &err);
+			next = due < next ? due : next;
+			due = schedule_run(l, &probe, now, send_probe_any,
+					   1, &err);
+			next = due < next ? due : next;
+		}
+		now = monotonic_ns();
+		if (next <= now)
+			continue;
+		tmo.tv_sec = (next - now) / NS_PER_SEC;
+		tmo.tv_nsec = (next - now) % NS_PER_SEC;
+		if (ppoll(pfd, n, &tmo, NULL) < 0) {
+			if (errno != EINTR) {
+				pr_err("poll failed: %m");
+				err = -1;
+			}
+			continue;
+		}
+		for (i = 0; i < n && !err; i++) {
+			if (pfd[i].revents & (POLLIN | POLLPRI))
+				err = load_receive(l, pfd[i].fd);
+		}
+	}
+	return err;
+}
+
+static void load_report(struct load *l, double rate, int duration)
+{
+	unsigned long lost = l->requests - l->answered;
+	struct stats_result res;
+
+	printf("%s:        %d at %.3f msg/s\n",
+	       l->masters ? "masters" : "slaves ", l->nodes, rate);
+	printf("sent:           %lu (%.1f msg/s), %lu failed\n",
+	       l->sent, (double) l->sent / duration, l->failed);
+	if (l->masters)
+		printf("delay requests: %lu (%.1f msg/s)\n", l->delay_req,
+		       (double) l->delay_req / duration);
+	printf("%s %lu of %lu, %lu lost (%.3f%%)\n",
+	       l->masters ? "probes:        " : "responses:     ",
+	       l->answered, l->requests, lost,
+	       l->requests ? 100.0 * lost / l->requests : 0.0);
+	if (stats_get_result(l->latency, &res))
+		return;
+	printf("latency [us]:   min %.1f mean %.1f p50 %.1f p99 %.1f "
+	       "p99.9 %.1f max %.1f\n", res.min, res.mean, res.p50_abs,
+	       res.p99_abs, res.p999_abs, res.max);
+}
+
+static void usage(char *progname)
+{
+	fprintf(stderr,
+		"\n"
+		"usage: %s [options]\n\n"
+		" Network Transport\n\n"
+		" -2          IEEE 802.3\n"
+		" -4          UDP IPV4 (default)\n"
+		" -6          UDP IPV6\n\n"
+		" Load\n\n"
+		" -i [dev]    interface facing the target\n"
+		" -s [num]    emulate 'num' slaves sending Delay_Req (default 1)\n"
+		" -m [num]    emulate 'num' masters sending Announce and Sync\n"
+		" -r [rate]   Delay_Req or Sync messages per second of a node (1)\n"
+		" -a [rate]   Announce messages per second of a master (1)\n"
+		" -p [rate]   management probes per second with -m (10)\n"
+		" -d [num]    domain number (0)\n"
+		" -t [sec]    duration of the test (10)\n\n"
+		" Other Options\n\n"
+		" -f [file]   read configuration from 'file'\n"
+		" -l [num]    set the logging level to 'num' (3)\n"
+		" -h          prints this message and exits\n"
+		" -v          prints the software version and exits\n"
+		"\n",
+		progname);
+}
+
+int main(int argc, char *argv[])
+{
+	double rate = 1.0, announce_rate = 1.0, probe_rate = 10.0;
+	enum transport_type transport = TRANS_UDP_IPV4;
+	char *config = NULL, *iface = NULL, *progname;
+	int c, domain = 0, duration = 10, err = -1, n;
+	struct load l = { 0 };
+	struct config *cfg;
+
+	handle_term_signals();
+
+	cfg = config_create();
+	if (!cfg)
+		return -1;
+	print_set_progname("ptp_load");
+	print_set_syslog(0);
+	print_set_verbose(1);
+	print_set_level(LOG_ERR);
+	l.nodes = 1;
+
+	/* Process the command line arguments. */
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1+progname : argv[0];
+	while (EOF != (c = getopt(argc, argv, "246i:s:m:r:a:p:d:t:f:l:hv"))) {
+		switch (c) {
+		case '2':
+			transport = TRANS_IEEE_802_3;
+			break;
+		case '4':
+			transport = TRANS_UDP_IPV4;
+			break;
+		case '6':
+			transport = TRANS_UDP_IPV6;
+			break;
+		case 'i':
+			iface = optarg;
+			break;
+		case 's':
+		case 'm':
+			if (get_arg_val_i(c, optarg, &l.nodes, 1, MAX_NODES))
+				goto out;
+			l.masters = c == 'm';
+			break;
+		case 'r':
+			if (get_arg_val_d(c, optarg, &rate, 1e-3, 1e6))
+				goto out;
+			break;
+		case 'a':
+			if (get_arg_val_d(c, optarg, &announce_rate, 0.0, 1e6))
+				goto out;
+			break;
+		case 'p':
+			if (get_arg_val_d(c, optarg, &probe_rate, 0.0, 1e6))
+				goto out;
+			break;
+		case 'd':
+			if (get_arg_val_i(c, optarg, &domain, 0, 255))
+				goto out;
+			break;
+		case 't':
+			if (get_arg_val_i(c, optarg, &duration, 1, INT_MAX))
+				goto out;
+			break;
+		case 'f':
+			config = optarg;
+			break;
+		case 'l':
+			if (get_arg_val_i(c, optarg, &n, PRINT_LEVEL_MIN,
+					  PRINT_LEVEL_MAX))
+				goto out;
+			print_set_level(n);
+			break;
+		case 'v':
+			version_show(stdout);
+			err = 0;
+			goto out;
+		case 'h':
+			usage(progname);
+			err = 0;
+			goto out;
+		case '?':
+		default:
+			usage(progname);
+			goto out;
+		}
+	}
+	if (!iface) {
+		fprintf(stderr, "no interface specified\n");
+		usage(progname);
+		goto out;
+	}
+	if (config && config_read(config, cfg))
+		goto out;
+	if (config_set_int(cfg, "domainNumber", domain))
+		goto out;
+
+	/* Keep the emulated identities apart from those of other runs. */
+	if (generate_clock_identity(&l.base, iface)) {
+		pr_err("failed to generate a clock identity");
+		goto out;
+	}
+	l.base.id[3] = 0x4c;
+	l.base.id[4] = getpid() & 0xff;
+	l.base.id[5] = getpid() >> 8 & 0xff;
+	l.domain = domain;
+
+	l.node = calloc(l.nodes + 1, sizeof(*l.node));
+	l.latency = stats_create();
+	if (!l.node || !l.latency)
+		goto out;
+	l.trp = transport_create(cfg, transport);
+	if (!l.trp) {
+		pr_err("failed to create transport");
+		goto out;
+	}
+	if (transport_open(l.trp, iface, &l.fda, TS_SOFTWARE)) {
+		pr_err("failed to open transport");
+		transport_destroy(l.trp);
+		goto out;
+	}
+
+	err = load_run(&l, rate, announce_rate, probe_rate, duration);
+	if (!err)
+		load_report(&l, rate, duration);
+
+	transport_close(l.trp, &l.fda);
+	transport_destroy(l.trp);
+out:
+	if (l.latency)
+		stats_destroy(l.latency);
+	free(l.node);
+	msg_cleanup();
+	config_destroy(cfg);
+	return err;
+}
@@ -0,0 +1,573 @@
+/**
+ * @file ptp_servo.c
+ * @brief Utility program to compare the clock servos and filters offline.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "filter.h"
+#include "print.h"
+#include "servo.h"
+#include "tmv.h"
+#include "util.h"
+#include "version.h"
+
+#define NS_PER_SEC 1000000000LL
+#define MAX_PPB 512000
+#define N_ELEMS(a) (sizeof(a) / sizeof((a)[0]))
+
+/*
+ * A trace is a sequence of samples of the offset which the clock would
+ * have if it was never adjusted, plus the noise of the measurement. The
+ * simulation applies the adjustments of the servo to the free running
+ * offset, as the clock would.
+ */
+struct sample {
+	double time;
+	double free_offset;
+	double noise;
+};
+
+struct trace {
+	struct sample *samples;
+	int count;
+	int size;
+	/* Frequency of the clock when the trace starts */
+	double freq;
+	/* The noise is known and the residuals are the true offsets. */
+	int synthetic;
+};
+
+struct synth_params {
+	int count;
+	double interval;
+	double offset;
+	double drift;
+	double wander;
+	double noise;
+	double step;
+	double delay;
+	unsigned int seed;
+};
+
+struct result {
+	double cpu;
+	double lock_time;
+	double rms;
+	double max;
+	int samples;
+};
+
+static const struct {
+	const char *name;
+	enum servo_type type;
+} servos[] = {
+	{ "pi", CLOCK_SERVO_PI },
+	{ "linreg", CLOCK_SERVO_LINREG },
+	{ "kalman", CLOCK_SERVO_KALMAN },
+	{ "nullf", CLOCK_SERVO_NULLF },
+	{ "auto", CLOCK_SERVO_AUTO },
+};
+
+static const struct {
+	const char *name;
+	enum filter_type type;
+} filters[] = {
+	{ "moving_average", FILTER_MOVING_AVERAGE },
+	{ "moving_median", FILTER_MOVING_MEDIAN },
+	{ "moving_quantile", FILTER_MOVING_QUANTILE },
+};
+
+static uint64_t rand_state;
+
+static double uniform(void)
+{
+	/* xorshift64* is good enough and reproducible everywhere. */
+	rand_state ^= rand_state >> 12;
+	rand_state ^= rand_state << 25;
+	rand_state ^= rand_state >> 27;
+	return ((rand_state * 2685821657736338717ULL) >> 11) * 0x1.0p-53;
+}
+
+static double gauss(void)
+{
+	double u = uniform(), v = uniform();
+
+	return sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * v);
+}
+
+static struct sample *trace_add(struct trace *t)
+{
+	struct sample *s;
+
+	if (t->count == t->size) {
+		t->size = t->size ? 2 * t->size : 1024;
+		s = realloc(t->samples, t->size * sizeof(*s));
+		if (!s) {
+			fprintf(stderr, "out of memory\n");
+			return NULL;
+		}
+		t->samples = s;
+	}
+	s = &t->samples[t->count++];
+	memset(s, 0, sizeof(*s));
+	return s;
+}
+
+static int synth_trace(struct trace *t, struct synth_params *p)
+{
+	double drift = p->drift, offset = p->offset;
+	struct sample *s;
+	int i;
+
+	rand_state = p->seed ? p->seed : 1;
+	t->synthetic = 1;
+
+	for (i = 0; i < p->count; i++) {
+		s = trace_add(t);
+		if (!s)
+			return -1;
+		s->time = i * p->interval;
+		s->free_offset = offset;
+		s->noise = p->noise * gauss();
+		if (p->delay > 0.0)
+			/* Queuing delay in the network is exponential. */
+			s->noise += -p->delay * log(1.0 - uniform());
+
+		drift += p->wander * sqrt(p->interval) * gauss();
+		offset += drift * p->interval;
+		if (p->step && i == p->count / 2)
+			offset += p->step;
+	}
+	return 0;
+}
+
+/*
+ * Read a trace from the output of ptp4l or phc2sys, or from lines of
+ * "time offset freq". The free running offset is reconstructed from the
+ * frequency adjustments and steps which were applied to the clock.
+ */
+static int read_trace(struct trace *t, const char *path)
+{
+	double adj = 0.0, freq, last_time = 0.0, time, total = 0.0;
+	int first = 1, state;
+	long long offset;
+	struct sample *s;
+	char line[1024];
+	char *p;
+	FILE *f;
+
+	f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		p = strstr(line, "offset ");
+		if (p) {
+			if (sscanf(p, "offset %lld s%d freq %lf",
+				   &offset, &state, &freq) != 3)
+				continue;
+			p = strchr(line, '[');
+			if (!p || sscanf(p, "[%lf]", &time) != 1)
+				continue;
+		} else {
+			if (sscanf(line, "%lf %lld %lf", &time, &offset,
+				   &freq) != 3)
+				continue;
+			state = 2;
+		}
+
+		if (first) {
+			t->freq = adj = freq;
+			last_time = time;
+			first = 0;
+		}
+		total += adj * (time - last_time);
+		last_time = time;
+
+		s = trace_add(t);
+		if (!s)
+			break;
+		s->time = time;
+		s->free_offset = offset + total;
+
+		switch (state) {
+		case 1:
+			/* The clock was stepped by the offset. */
+			total += offset;
+			/* fall through */
+		case 2:
+			adj = freq;
+			break;
+		}
+	}
+
+	if (f != stdin)
+		fclose(f);
+	if (!t->count) {
+		fprintf(stderr, "%s: no samples found\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+static double timer_overhead(void)
+{
+	struct timespec t0, t1;
+	double min = 1e9, ns;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ns = (t1.tv_sec - t0.tv_sec) * 1e9 + t1.tv_nsec - t0.tv_nsec;
+		if (ns < min)
+			min = ns;
+	}
+	return min;
+}
+
+static int run_servo(struct config *cfg, enum servo_type type, int sw_ts,
+		     struct trace *t, double overhead, struct result *r)
+{
+	double adj, applied, interval, ns, offset, residual, total = 0.0;
+	double last_time, steps = 0.0, sum2 = 0.0;
+	struct timespec t0, t1;
+	enum servo_state state;
+	struct servo *servo;
+	uint64_t local_ts;
+	int i, locked = 0;
+
+	servo = servo_create(cfg, type, t->freq, MAX_PPB, sw_ts);
+	if (!servo)
+		return -1;
+
+	interval = t->count > 1 ? t->samples[1].time - t->samples[0].time : 1.0;
+	servo_sync_interval(servo, interval);
+
+	memset(r, 0, sizeof(*r));
+	r->lock_time = -1.0;
+	applied = t->freq;
+	last_time = t->samples[0].time;
+
+	for (i = 0; i < t->count; i++) {
+		total += applied * (t->samples[i].time - last_time);
+		last_time = t->samples[i].time;
+		residual = t->samples[i].free_offset - total - steps;
+		offset = residual + t->samples[i].noise;
+		if (!t->synthetic)
+			residual = offset;
+
+		local_ts = 1000 * NS_PER_SEC +
+			(int64_t) (t->samples[i].time * 1e9 + offset);
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		adj = servo_sample(servo, (int64_t) offset, local_ts, 1.0,
+				   &state);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ns = (t1.tv_sec - t0.tv_sec) * 1e9 + t1.tv_nsec - t0.tv_nsec;
+		r->cpu += ns - overhead;
+
+		switch (state) {
+		case SERVO_UNLOCKED:
+			locked = 0;
+			break;
+		case SERVO_JUMP:
+			steps += offset;
+			applied = adj;
+			locked = 0;
+			break;
+		case SERVO_LOCKED:
+			applied = adj;
+			if (!locked && r->lock_time < 0.0)
+				r->lock_time = t->samples[i].time -
+					t->samples[0].time;
+			locked = 1;
+			break;
+		}
+
+		/* Only the second half of the trace counts as steady state. */
+		if (i >= t->count / 2) {
+			sum2 += residual * residual;
+			if (fabs(residual) > r->max)
+				r->max = fabs(residual);
+			r->samples++;
+		}
+	}
+
+	servo_destroy(servo);
+
+	r->cpu /= t->count;
+	r->rms = r->samples ? sqrt(sum2 / r->samples) : 0.0;
+	return 0;
+}
+
+/* The samples before the filter's window is full are not counted. */
+static void run_filter(struct filter *filter, int length, struct trace *t,
+		       double overhead, struct result *r)
+{
+	struct timespec t0, t1;
+	double err, ns, sum2 = 0.0;
+	tmv_t delay;
+	int i;
+
+	memset(r, 0, sizeof(*r));
+
+	for (i = 0; i < t->count; i++) {
+		delay = dbl_tmv(t->samples[i].noise);
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		delay = filter_sample(filter, delay);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ns = (t1.tv_sec - t0.tv_sec) * 1e9 + t1.tv_nsec - t0.tv_nsec;
+		r->cpu += ns - overhead;
+
+		if (i >= length) {
+			err = tmv_dbl(delay);
+			sum2 += err * err;
+			if (fabs(err) > r->max)
+				r->max = fabs(err);
+			r->samples++;
+		}
+	}
+
+	r->cpu /= t->count;
+	r->rms = r->samples ? sqrt(sum2 / r->samples) : 0.0;
+}
+
+static void usage(char *progname)
+{
+	fprintf(stderr,
+		"\n"
+		"usage: %s [options]\n\n"
+		" -E [name]   run only the named servo, or filter with -F\n"
+		" -F          compare the delay filters instead of the servos\n"
+		" -C [chain]  with -F, run also a chain of filters\n"
+		" -L [len]    filter length (10)\n"
+		" -Q [q]      quantile of the moving_quantile filter (0.5)\n"
+		" -f [file]   read the servo settings from a configuration file\n"
+		" -r [file]   replay the offsets logged by ptp4l or phc2sys\n"
+		" -s          tune the servos for software time stamping\n"
+		" synthetic trace:\n"
+		" -n [num]    number of samples (1000)\n"
+		" -i [sec]    sample interval (1.0)\n"
+		" -o [ns]     initial offset (1000)\n"
+		" -d [ppb]    initial frequency offset (10000)\n"
+		" -w [ppb]    frequency wander per square root second (0.1)\n"
+		" -N [ns]     standard deviation of the measurement noise (20)\n"
+		" -D [ns]     mean of the exponential queuing delay (0)\n"
+		" -j [ns]     phase step in the middle of the trace (0)\n"
+		" -S [seed]   seed of the random numbers (1)\n"
+		" -l [num]    set the logging level to 'num' (3)\n"
+		" -h          prints this message and exits\n"
+		" -v          prints the software version and exits\n"
+		"\n",
+		progname);
+}
+
+int main(int argc, char *argv[])
+{
+	struct synth_params synth = {
+		.count = 1000, .interval = 1.0, .offset = 1000.0,
+		.drift = 10000.0, .wander = 0.1, .noise = 20.0, .seed = 1,
+	};
+	char *chain = NULL, *config = NULL, *name = NULL, *progname;
+	char *replay = NULL;
+	struct filter *filter;
+	int c, filter_mode = 0, i, length = 10, n, sw_ts = 0;
+	struct trace trace = { 0 };
+	double overhead, quantile = 0.5;
+	struct config *cfg;
+	struct result r;
+	int err = -1;
+
+	cfg = config_create();
+	if (!cfg)
+		return -1;
+	print_set_progname("ptp_servo");
+	print_set_syslog(0);
+	print_set_verbose(1);
+	print_set_level(LOG_ERR);
+
+	/* Process the command line arguments. */
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1+progname : argv[0];
+	while (EOF != (c = getopt(argc, argv,
+				  "E:FC:L:Q:f:r:sn:i:o:d:w:N:D:j:S:l:hv"))) {
+		switch (c) {
+		case 'E':
+			name = optarg;
+			break;
+		case 'F':
+			filter_mode = 1;
+			break;
+		case 'C':
+			chain = optarg;
+			break;
+		case 'L':
+			if (get_arg_val_i(c, optarg, &length, 1, INT_MAX))
+				goto out;
+			break;
+		case 'Q':
+			if (get_arg_val_d(c, optarg, &quantile, 0.0, 1.0))
+				goto out;
+			break;
+		case 'f':
+			config = optarg;
+			break;
+		case 'r':
+			replay = optarg;
+			break;
+		case 's':
+			sw_ts = 1;
+			break;
+		case 'n':
+			if (get_arg_val_i(c, optarg, &synth.count, 2, INT_MAX))
+				goto out;
+			break;
+		case 'i':
+			if (get_arg_val_d(c, optarg, &synth.interval,
+					  1e-6, 1e6))
+				goto out;
+			break;
+		case 'o':
+			if (get_arg_val_d(c, optarg, &synth.offset,
+					  -1e18, 1e18))
+				goto out;
+			break;
+		case 'd':
+			if (get_arg_val_d(c, optarg, &synth.drift,
+					  -MAX_PPB, MAX_PPB))
+				goto out;
+			break;
+		case 'w':
+			if (get_arg_val_d(c, optarg, &synth.wander, 0.0, 1e6))
+				goto out;
+			break;
+		case 'N':
+			if (get_arg_val_d(c, optarg, &synth.noise, 0.0, 1e12))
+				goto out;
+			break;
+		case 'D':
+			if (get_arg_val_d(c, optarg, &synth.delay, 0.0, 1e12))
+				goto out;
+			break;
+		case 'j':
+			if (get_arg_val_d(c, optarg, &synth.step, -1e18, 1e18))
+				goto out;
+			break;
+		case 'S':
+			if (get_arg_val_ui(c, optarg, &synth.seed, 0, UINT_MAX))
+				goto out;
+			break;
+		case 'l':
+			if (get_arg_val_i(c, optarg, &n, PRINT_LEVEL_MIN,
+					  PRINT_LEVEL_MAX))
+				goto out;
+			print_set_level(n);
+			break;
+		case 'v':
+			version_show(stdout);
+			err = 0;
+			goto out;
+		case 'h':
+			usage(progname);
+			err = 0;
+			goto out;
+		case '?':
+		default:
+			usage(progname);
+			goto out;
+		}
+	}
+
+	if (config && config_read(config, cfg))
+		goto out;
+
+	if (replay && !filter_mode) {
+		if (read_trace(&trace, replay))
+			goto out;
+	} else if (synth_trace(&trace, &synth)) {
+		goto out;
+	}
+
+	overhead = timer_overhead();
+
+	if (filter_mode) {
+		printf("%-16s %10s %10s %10s\n",
+		       "filter", "ns/sample", "rms", "max");
+		for (i = 0; i < N_ELEMS(filters); i++) {
+			if (name && strcmp(name, filters[i].name))
+				continue;
+			filter = filter_create(filters[i].type, length,
+					       quantile);
+			if (!filter) {
+				fprintf(stderr, "failed to create %s\n",
+					filters[i].name);
+				goto out;
+			}
+			run_filter(filter, length, &trace, overhead, &r);
+			filter_destroy(filter);
+			printf("%-16s %10.1f %10.1f %10.1f\n", filters[i].name,
+			       r.cpu, r.rms, r.max);
+		}
+		if (chain) {
+			filter = filter_chain_create(chain);
+			if (!filter) {
+				fprintf(stderr, "failed to create %s\n", chain);
+				goto out;
+			}
+			run_filter(filter, length, &trace, overhead, &r);
+			filter_destroy(filter);
+			printf("%-16s %10.1f %10.1f %10.1f\n", "chain",
+			       r.cpu, r.rms, r.max);
+		}
+		err = 0;
+		goto out;
+	}
+
+	printf("%-16s %10s %10s %10s %10s\n",
+	       "servo", "ns/sample", "lock [s]", "rms", "max");
+	for (i = 0; i < N_ELEMS(servos); i++) {
+		if (name ? strcmp(name, servos[i].name) :
+		    servos[i].type == CLOCK_SERVO_NULLF)
+			continue;
+		if (run_servo(cfg, servos[i].type, sw_ts, &trace, overhead,
+			      &r)) {
+			fprintf(stderr, "failed to create %s\n",
+				servos[i].name);
+			goto out;
+		}
+		printf("%-16s %10.1f %10.1f %10.1f %10.1f\n", servos[i].name,
+		       r.cpu, r.lock_time, r.rms, r.max);
+	}
+	err = 0;
+out:
+	free(trace.samples);
+	config_destroy(cfg);
+	return err;
+}
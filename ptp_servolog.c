@@ -0,0 +1,143 @@
+/**
+ * @file ptp_servolog.c
+ * @brief Utility program to convert the servo log of ptp4l and phc2sys to CSV.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "servolog.h"
+#include "version.h"
+
+static void usage(char *progname)
+{
+	fprintf(stderr,
+		"\n"
+		"usage: %s [options] file [file ...]\n\n"
+		" -c [num]   convert only the records of clock 'num'\n"
+		" -n         omit the header line\n"
+		" -h         prints this message and exits\n"
+		" -v         prints the software version and exits\n"
+		"\n",
+		progname);
+}
+
+static int convert(const char *file, int clock)
+{
+	struct servolog_header *hdr;
+	struct servolog_record *r;
+	uint64_t count, i;
+	struct stat st;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		perror(file);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		perror("fstat");
+		close(fd);
+		return -1;
+	}
+	if (st.st_size < sizeof(*hdr)) {
+		fprintf(stderr, "%s: not a servo log\n", file);
+		close(fd);
+		return -1;
+	}
+	hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	if (memcmp(hdr->magic, SERVOLOG_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != SERVOLOG_VERSION ||
+	    hdr->record_size != sizeof(*r)) {
+		fprintf(stderr, "%s: not a servo log or bad version\n", file);
+		munmap(hdr, st.st_size);
+		return -1;
+	}
+
+	/* The file may still be written, or truncated when closed. */
+	count = atomic_load_explicit(&hdr->count, memory_order_acquire);
+	if (count > (st.st_size - sizeof(*hdr)) / sizeof(*r))
+		count = (st.st_size - sizeof(*hdr)) / sizeof(*r);
+
+	r = (struct servolog_record *) (hdr + 1);
+	for (i = 0; i < count; i++, r++) {
+		if (clock >= 0 && r->clock != clock)
+			continue;
+		printf("%" PRIu64 ".%09" PRIu64 ",%" PRIu64 ".%09" PRIu64
+		       ",%hu,%" PRId64 ",%" PRId64 ",%.3f,%hhu,%.3f\n",
+		       r->time / 1000000000, r->time % 1000000000,
+		       r->ts / 1000000000, r->ts % 1000000000,
+		       r->clock, r->offset, r->delay, r->freq, r->state,
+		       r->weight);
+	}
+
+	munmap(hdr, st.st_size);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int c, clock = -1, err = 0, header = 1;
+	char *progname;
+
+	/* Process the command line arguments. */
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1+progname : argv[0];
+	while (EOF != (c = getopt(argc, argv, "c:nhv"))) {
+		switch (c) {
+		case 'c':
+			clock = atoi(optarg);
+			break;
+		case 'n':
+			header = 0;
+			break;
+		case 'v':
+			version_show(stdout);
+			return 0;
+		case 'h':
+			usage(progname);
+			return 0;
+		case '?':
+		default:
+			usage(progname);
+			return -1;
+		}
+	}
+	if (optind >= argc) {
+		usage(progname);
+		return -1;
+	}
+
+	if (header)
+		printf("time,ts,clock,offset,delay,freq,state,weight\n");
+	for (; optind < argc; optind++) {
+		if (convert(argv[optind], clock))
+			err = -1;
+	}
+	return err;
+}
@@ -0,0 +1,319 @@
+/**
+ * @file ptp_trace.c
+ * @brief Utility program to read the trace ring of ptp4l.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "msg.h"
+#include "trace.h"
+#include "version.h"
+
+#define DEFAULT_TRACE_FILE "/dev/shm/ptp4l-trace"
+
+/* The intervals reported with -l, each ending with an event. */
+enum stage {
+	ST_POLL_TO_RECV,
+	ST_RECV_TO_PORT,
+	ST_PORT_TO_SERVO,
+	ST_SERVO_TO_ADJ,
+	ST_RECV_TO_ADJ,
+	ST_KERNEL_TO_RECV,
+	N_STAGES,
+};
+
+static const char *stage_names[N_STAGES] = {
+	"poll to recv",
+	"recv to port",
+	"port to servo",
+	"servo to adj",
+	"recv to adj",
+	"kernel to recv",
+};
+
+static const char *event_names[TRACE_N_EVENTS] = {
+	"port_event",
+	"rx",
+	"rx_sw",
+	"rx_msg",
+	"servo",
+	"adj_freq",
+	"adj_step",
+};
+
+static const char *type_names[16] = {
+	"SYNC", "DELAY_REQ", "PDELAY_REQ", "PDELAY_RESP",
+	"0x4", "0x5", "0x6", "0x7",
+	"FOLLOW_UP", "DELAY_RESP", "PDELAY_RESP_FOLLOW_UP", "ANNOUNCE",
+	"SIGNALING", "MANAGEMENT", "0xE", "0xF",
+};
+
+struct samples {
+	int64_t *val;
+	int count;
+};
+
+static void usage(char *progname)
+{
+	fprintf(stderr,
+		"\n"
+		"usage: %s [options]\n\n"
+		" -f [file]  read the trace ring from 'file', default %s\n"
+		" -l         report the latency distributions\n"
+		" -n [num]   dump only the last 'num' records\n"
+		" -h         prints this message and exits\n"
+		" -v         prints the software version and exits\n"
+		"\n",
+		progname, DEFAULT_TRACE_FILE);
+}
+
+/*
+ * Copy the valid records out of the ring, oldest first, skipping the
+ * ones that are being overwritten while we read.
+ */
+static int snapshot(struct trace_header *hdr, struct trace_record *out)
+{
+	struct trace_record *ring = (struct trace_record *) (hdr + 1);
+	uint64_t head, i, seq, start;
+	struct trace_record *r;
+	int n = 0;
+
+	head = atomic_load_explicit(&hdr->head, memory_order_acquire);
+	start = head > hdr->size ? head - hdr->size : 0;
+
+	for (i = start; i < head; i++) {
+		r = &ring[i & (hdr->size - 1)];
+		seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+		if (seq != i + 1)
+			continue;
+		out[n].time = r->time;
+		out[n].value = r->value;
+		out[n].event = r->event;
+		out[n].port = r->port;
+		out[n].sequence_id = r->sequence_id;
+		out[n].type = r->type;
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&r->seq, memory_order_relaxed) != seq)
+			continue;
+		atomic_store_explicit(&out[n].seq, seq, memory_order_relaxed);
+		n++;
+	}
+	return n;
+}
+
+static void dump(struct trace_record *rec, int n)
+{
+	const char *name;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		name = rec[i].event < TRACE_N_EVENTS ?
+			event_names[rec[i].event] : "unknown";
+		printf("%" PRIu64 ".%09" PRIu64 " %-10s port %-3hu",
+		       rec[i].time / 1000000000, rec[i].time % 1000000000,
+		       name, rec[i].port);
+		if (rec[i].event == TRACE_RX_MSG)
+			printf(" %-21s seq %-5hu", type_names[rec[i].type & 0xf],
+			       rec[i].sequence_id);
+		printf(" %" PRId64 "\n", rec[i].value);
+	}
+}
+
+static void add(struct samples *s, int64_t val)
+{
+	s->val[s->count++] = val;
+}
+
+static int cmp(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int64_t percentile(struct samples *s, int p)
+{
+	return s->val[(int64_t) (s->count - 1) * p / 100];
+}
+
+static int report(struct trace_record *rec, int n)
+{
+	uint64_t poll = 0, recv = 0, port = 0, servo = 0, chain = 0;
+	struct samples st[N_STAGES];
+	int i;
+
+	for (i = 0; i < N_STAGES; i++) {
+		st[i].val = malloc(n * sizeof(*st[i].val));
+		st[i].count = 0;
+		if (!st[i].val) {
+			fprintf(stderr, "out of memory\n");
+			return -1;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		switch (rec[i].event) {
+		case TRACE_PORT_EVENT:
+			/* Only the socket events lead to a receive. */
+			poll = rec[i].value < 2 ? rec[i].time : 0;
+			break;
+		case TRACE_RX_SW:
+			add(&st[ST_KERNEL_TO_RECV], rec[i].value);
+			/* fall through */
+		case TRACE_RX:
+			if (poll)
+				add(&st[ST_POLL_TO_RECV], rec[i].time - poll);
+			recv = rec[i].time;
+			poll = 0;
+			break;
+		case TRACE_RX_MSG:
+			if (recv)
+				add(&st[ST_RECV_TO_PORT], rec[i].time - recv);
+			if (rec[i].type == SYNC || rec[i].type == FOLLOW_UP) {
+				port = rec[i].time;
+				chain = recv;
+			}
+			recv = 0;
+			break;
+		case TRACE_SERVO:
+			if (port)
+				add(&st[ST_PORT_TO_SERVO], rec[i].time - port);
+			servo = rec[i].time;
+			port = 0;
+			break;
+		case TRACE_ADJ_FREQ:
+		case TRACE_ADJ_STEP:
+			if (servo)
+				add(&st[ST_SERVO_TO_ADJ], rec[i].time - servo);
+			if (chain)
+				add(&st[ST_RECV_TO_ADJ], rec[i].time - chain);
+			servo = 0;
+			chain = 0;
+			break;
+		}
+	}
+
+	printf("%-15s %8s %10s %10s %10s %10s %10s\n", "interval [ns]",
+	       "count", "min", "median", "p90", "p99", "max");
+	for (i = 0; i < N_STAGES; i++) {
+		if (st[i].count) {
+			qsort(st[i].val, st[i].count, sizeof(*st[i].val), cmp);
+			printf("%-15s %8d %10" PRId64 " %10" PRId64 " %10" PRId64
+			       " %10" PRId64 " %10" PRId64 "\n",
+			       stage_names[i], st[i].count, st[i].val[0],
+			       percentile(&st[i], 50), percentile(&st[i], 90),
+			       percentile(&st[i], 99),
+			       st[i].val[st[i].count - 1]);
+		}
+		free(st[i].val);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char *file = DEFAULT_TRACE_FILE, *progname;
+	int c, err, fd, latency = 0, last = 0, n;
+	struct trace_header *hdr;
+	struct trace_record *rec;
+	struct stat st;
+
+	/* Process the command line arguments. */
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1+progname : argv[0];
+	while (EOF != (c = getopt(argc, argv, "f:ln:hv"))) {
+		switch (c) {
+		case 'f':
+			file = optarg;
+			break;
+		case 'l':
+			latency = 1;
+			break;
+		case 'n':
+			last = atoi(optarg);
+			break;
+		case 'v':
+			version_show(stdout);
+			return 0;
+		case 'h':
+			usage(progname);
+			return 0;
+		case '?':
+		default:
+			usage(progname);
+			return -1;
+		}
+	}
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		perror(file);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		perror("fstat");
+		close(fd);
+		return -1;
+	}
+	if (st.st_size < sizeof(*hdr)) {
+		fprintf(stderr, "%s: not a trace file\n", file);
+		close(fd);
+		return -1;
+	}
+	hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != TRACE_VERSION ||
+	    hdr->record_size != sizeof(struct trace_record) ||
+	    !hdr->size || (hdr->size & (hdr->size - 1)) ||
+	    st.st_size < sizeof(*hdr) + hdr->size * sizeof(*rec)) {
+		fprintf(stderr, "%s: not a trace file or bad version\n", file);
+		munmap(hdr, st.st_size);
+		return -1;
+	}
+
+	rec = malloc(hdr->size * sizeof(*rec));
+	if (!rec) {
+		fprintf(stderr, "out of memory\n");
+		munmap(hdr, st.st_size);
+		return -1;
+	}
+	n = snapshot(hdr, rec);
+	munmap(hdr, st.st_size);
+
+	err = 0;
+	if (latency)
+		err = report(rec, n);
+	else if (last > 0 && last < n)
+		dump(rec + n - last, last);
+	else
+		dump(rec, n);
+
+	free(rec);
+	return err;
+}
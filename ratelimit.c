@@ -0,0 +1,184 @@
+/**
+ * @file ratelimit.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <time.h>
+
+#include "hash.h"
+#include "print.h"
+#include "ratelimit.h"
+
+struct bucket {
+	TAILQ_ENTRY(bucket) list;
+	char *key;
+	double tokens;
+	uint64_t last;
+	int limited;
+};
+
+struct ratelimit {
+	/* The buckets of the sources, the most recently used first */
+	TAILQ_HEAD(buckets, bucket) buckets;
+	struct hash *index;
+	struct bucket shared;
+	const char *name;
+	double rate;
+	double burst;
+	unsigned int max;
+	struct ratelimit_stats stats;
+};
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static double bucket_tokens(struct ratelimit *rl, struct bucket *b,
+			    uint64_t now)
+{
+	double tokens = b->tokens + (now - b->last) * rl->rate / 1e9;
+
+	return tokens < rl->burst ? tokens : rl->burst;
+}
+
+static void bucket_remove(struct ratelimit *rl, struct bucket *b)
+{
+	hash_remove(rl->index, b->key);
+	TAILQ_REMOVE(&rl->buckets, b, list);
+	if (b->limited)
+		rl->stats.limited--;
+	rl->stats.sources--;
+	free(b);
+}
+
+static struct bucket *bucket_add(struct ratelimit *rl, const char *source,
+				 uint64_t now)
+{
+	struct bucket *b;
+	size_t len;
+
+	if (rl->stats.sources >= rl->max) {
+		/* Recycle the least recently used bucket if it is full. */
+		b = TAILQ_LAST(&rl->buckets, buckets);
+		if (bucket_tokens(rl, b, now) < rl->burst)
+			goto shared;
+		bucket_remove(rl, b);
+	}
+	len = strlen(source) + 1;
+	b = calloc(1, sizeof(*b) + len);
+	if (!b)
+		goto shared;
+	b->key = (char *) (b + 1);
+	memcpy(b->key, source, len);
+	b->tokens = rl->burst;
+	b->last = now;
+	if (hash_insert(rl->index, b->key, b)) {
+		free(b);
+		goto shared;
+	}
+	TAILQ_INSERT_HEAD(&rl->buckets, b, list);
+	rl->stats.sources++;
+	return b;
+shared:
+	rl->stats.overflows++;
+	return &rl->shared;
+}
+
+struct ratelimit *ratelimit_create(const char *name, double rate, int burst,
+				   int sources)
+{
+	struct ratelimit *rl;
+
+	rl = calloc(1, sizeof(*rl));
+	if (!rl)
+		return NULL;
+	rl->index = hash_create();
+	if (!rl->index) {
+		free(rl);
+		return NULL;
+	}
+	TAILQ_INIT(&rl->buckets);
+	rl->name = name;
+	rl->rate = rate;
+	rl->burst = burst;
+	rl->max = sources > 0 ? sources : 1;
+	rl->shared.key = "new sources";
+	rl->shared.tokens = rl->burst;
+	rl->shared.last = monotonic_ns();
+	return rl;
+}
+
+void ratelimit_destroy(struct ratelimit *rl)
+{
+	struct bucket *b;
+
+	while ((b = TAILQ_FIRST(&rl->buckets))) {
+		TAILQ_REMOVE(&rl->buckets, b, list);
+		free(b);
+	}
+	hash_destroy(rl->index, NULL);
+	free(rl);
+}
+
+int ratelimit_check(struct ratelimit *rl, const char *source)
+{
+	struct bucket *b;
+	uint64_t now;
+
+	if (rl->rate <= 0.0) {
+		rl->stats.admitted++;
+		return 0;
+	}
+	now = monotonic_ns();
+	b = hash_lookup(rl->index, source);
+	if (b) {
+		TAILQ_REMOVE(&rl->buckets, b, list);
+		TAILQ_INSERT_HEAD(&rl->buckets, b, list);
+	} else {
+		b = bucket_add(rl, source, now);
+	}
+	b->tokens = bucket_tokens(rl, b, now);
+	b->last = now;
+
+	if (b->tokens >= 1.0) {
+		b->tokens -= 1.0;
+		if (b->limited) {
+			b->limited = 0;
+			rl->stats.limited--;
+		}
+		rl->stats.admitted++;
+		return 0;
+	}
+	if (!b->limited) {
+		pr_warning("%s rate limit exceeded by %s", rl->name, b->key);
+		b->limited = 1;
+		rl->stats.limited++;
+	}
+	rl->stats.dropped++;
+	return -1;
+}
+
+void ratelimit_stats(struct ratelimit *rl, struct ratelimit_stats *stats)
+{
+	*stats = rl->stats;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file ratelimit.h
+ * @brief Limits the rate of the messages from each source.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_RATELIMIT_H
+#define HAVE_RATELIMIT_H
+
+#include <stdint.h>
+
+/**
+ * Counters of a rate limiter.
+ */
+struct ratelimit_stats {
+	uint64_t admitted;  /* messages within the limit */
+	uint64_t dropped;   /* messages over the limit */
+	uint64_t overflows; /* messages charged to the shared bucket */
+	unsigned int sources; /* sources being tracked */
+	unsigned int limited; /* of them currently over the limit */
+};
+
+/** Opaque type. */
+struct ratelimit;
+
+/**
+ * Create a rate limiter with a token bucket for each source. When the
+ * table of sources is full and none of them is idle, the messages of
+ * the new sources are charged to a single bucket shared by all of them.
+ * @param name     The name of the limited messages, used in the log.
+ * @param rate     The number of messages per second of each source, or
+ *                 zero to only count the messages.
+ * @param burst    The size of the buckets, i.e. the number of messages
+ *                 a source may send without any pause.
+ * @param sources  The maximum number of sources to track.
+ * @return         A pointer to a new instance on success, NULL otherwise.
+ */
+struct ratelimit *ratelimit_create(const char *name, double rate, int burst,
+				   int sources);
+
+/**
+ * Destroy a rate limiter.
+ * @param rl  A pointer obtained via ratelimit_create().
+ */
+void ratelimit_destroy(struct ratelimit *rl);
+
+/**
+ * Take a token from the bucket of a source.
+ * @param rl      A pointer obtained via ratelimit_create().
+ * @param source  A string identifying the source of the message.
+ * @return        Zero if the message is within the limit, non-zero if
+ *                it should be dropped.
+ */
+int ratelimit_check(struct ratelimit *rl, const char *source);
+
+/**
+ * Get the counters of a rate limiter.
+ * @param rl     A pointer obtained via ratelimit_create().
+ * @param stats  Receives the counters.
+ */
+void ratelimit_stats(struct ratelimit *rl, struct ratelimit_stats *stats);
+
+#endif
@@ -20,14 +20,17 @@
 #include <fcntl.h>
 #include <linux/filter.h>
 #include <linux/if_ether.h>
+#include <linux/if_packet.h>
 #include <net/ethernet.h>
 #include <net/if.h>
 #include <netinet/in.h>
-#include <netpacket/packet.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/queue.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -46,19 +49,81 @@
 #include "transport_private.h"
 #include "util.h"
 
+/*
+ * The optional TPACKET_V3 receive ring. A block is handed to user space
+ * once it is full, or after RING_TIMEOUT milliseconds.
+ */
+#define RING_BLOCK_SIZE	(1 << 14)
+#define RING_BLOCKS	16
+#define RING_FRAME_SIZE	2048
+#define RING_TIMEOUT	1
+
+struct raw_ring {
+	unsigned char *map;
+	size_t len;
+	int fd;
+	int block_size;
+	int block; /* the block being read */
+	int left;  /* packets not yet read from the block */
+	struct tpacket3_hdr *pkt;
+	int tstamp;
+};
+
+/*
+ * With sync_batch, the sync messages of all the ports leave through one
+ * unbound packet socket, each addressed to the interface of its port, so
+ * that a tick takes a single sendmmsg() call. Their time stamps come back
+ * on the error queue of that socket, and are sorted out to the ports by
+ * the source port identity of the looped back frames.
+ */
+#define BATCH_FRAME_LEN	256
+#define BATCH_STASH	4
+#define OFF_SPID	(ETH_HLEN + 20)
+#define SPID_LEN	10
+
+struct raw_txts {
+	struct hw_timestamp hwts;
+	int len;
+	unsigned char pkt[BATCH_FRAME_LEN];
+};
+
 struct raw {
 	struct transport t;
 	struct address src_addr;
 	struct address ptp_addr;
 	struct address p2p_addr;
-	int vlan;
+	/* detected on receive, maybe by a worker thread, used on transmit */
+	atomic_int vlan;
+	struct raw_ring ring[2];
+	/* sync_batch */
+	LIST_ENTRY(raw) list;
+	int batched;
+	int ifindex;
+	unsigned char spid[SPID_LEN];
+	struct raw_txts stash[BATCH_STASH];
+	int nstash;
 };
 
+static struct {
+	LIST_HEAD(raw_users, raw) users;
+	int fd;
+	int count;
+	struct sk_txbuf tx[SK_TX_BATCH];
+	struct address addr[SK_TX_BATCH];
+	unsigned char frame[SK_TX_BATCH][BATCH_FRAME_LEN];
+} batch = { .fd = -1 };
+
 #define OP_AND  (BPF_ALU | BPF_AND | BPF_K)
 #define OP_JEQ  (BPF_JMP | BPF_JEQ | BPF_K)
 #define OP_JUN  (BPF_JMP | BPF_JA)
 #define OP_LDB  (BPF_LD  | BPF_B   | BPF_ABS)
 #define OP_LDH  (BPF_LD  | BPF_H   | BPF_ABS)
+#define OP_LDBX (BPF_LD  | BPF_B   | BPF_IND)
+#define OP_LDK  (BPF_LD  | BPF_IMM)
+#define OP_LDXK (BPF_LDX | BPF_IMM)
+#define OP_LSHX (BPF_ALU | BPF_LSH | BPF_X)
+#define OP_JSET (BPF_JMP | BPF_JSET | BPF_K)
+#define OP_TAX  (BPF_MISC | BPF_TAX)
 #define OP_RETK (BPF_RET | BPF_K)
 
 #define PTP_GEN_BIT 0x08 /* indicates general message, if set in message type */
@@ -81,6 +146,48 @@ static struct sock_filter raw_filter[N_RAW_FILTER] = {
 	{OP_RETK, 0, 0, 0           }, /*reject*/
 };
 
+#define N_RAW_PTP_FILTER    17
+#define RAW_PTP_FILTER_DOMAIN 8
+#define RAW_PTP_FILTER_TYPES  14
+
+/*
+ * Accepts the messages of one domain whose type has its bit set in a
+ * mask. The index register holds the length of the VLAN tag, if any.
+ */
+static struct sock_filter raw_ptp_filter[N_RAW_PTP_FILTER] = {
+	{OP_LDH,  0, 0, OFF_ETYPE            },
+	{OP_JEQ,  0, 3, ETH_P_8021Q          }, /*f goto non-vlan block*/
+	{OP_LDH,  0, 0, OFF_ETYPE + 4        },
+	{OP_LDXK, 0, 0, VLAN_HLEN            },
+	{OP_JUN,  0, 0, 1                    }, /*goto test ethertype*/
+	{OP_LDXK, 0, 0, 0                    },
+	{OP_JEQ,  0, 9, ETH_P_1588           }, /*f goto reject*/
+	{OP_LDBX, 0, 0, ETH_HLEN + 4         }, /*domainNumber*/
+	{OP_JEQ,  0, 7, 0                    }, /*f goto reject*/
+	{OP_LDBX, 0, 0, ETH_HLEN             }, /*messageType*/
+	{OP_AND,  0, 0, 0x0f                 },
+	{OP_TAX,  0, 0, 0                    },
+	{OP_LDK,  0, 0, 1                    },
+	{OP_LSHX, 0, 0, 0                    },
+	{OP_JSET, 0, 1, 0                    }, /*f goto reject*/
+	{OP_RETK, 0, 0, 1500                 }, /*accept*/
+	{OP_RETK, 0, 0, 0                    }, /*reject*/
+};
+
+static int raw_set_filter(int fd, int domain, int types)
+{
+	struct sock_fprog prg = { N_RAW_PTP_FILTER, raw_ptp_filter };
+
+	raw_ptp_filter[RAW_PTP_FILTER_DOMAIN].k = domain;
+	raw_ptp_filter[RAW_PTP_FILTER_TYPES].k = types;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prg, sizeof(prg))) {
+		pr_err("setsockopt SO_ATTACH_FILTER failed: %m");
+		return -1;
+	}
+	return 0;
+}
+
 static int raw_configure(int fd, int event, int index,
 			 unsigned char *addr1, unsigned char *addr2, int enable)
 {
@@ -142,15 +249,271 @@ static int raw_configure(int fd, int event, int index,
 	return -1;
 }
 
+static void raw_ring_close(struct raw_ring *r)
+{
+	if (r->map)
+		munmap(r->map, r->len);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
+
+static int raw_ring_open(struct raw_ring *r, int fd, int event,
+			 enum timestamp_type ts_type)
+{
+	struct tpacket_req3 req;
+	int block_size = RING_BLOCK_SIZE, flags, version = TPACKET_V3;
+	unsigned char buf[RING_FRAME_SIZE];
+
+	if (block_size < getpagesize())
+		block_size = getpagesize();
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION,
+		       &version, sizeof(version))) {
+		pr_warning("raw: TPACKET_V3 not supported: %m");
+		return -1;
+	}
+	if (event && ts_type != TS_SOFTWARE) {
+		flags = SOF_TIMESTAMPING_RAW_HARDWARE;
+		if (setsockopt(fd, SOL_PACKET, PACKET_TIMESTAMP,
+			       &flags, sizeof(flags))) {
+			pr_warning("raw: PACKET_TIMESTAMP failed: %m");
+			return -1;
+		}
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = block_size;
+	req.tp_block_nr = RING_BLOCKS;
+	req.tp_frame_size = RING_FRAME_SIZE;
+	req.tp_frame_nr = block_size / RING_FRAME_SIZE * RING_BLOCKS;
+	req.tp_retire_blk_tov = RING_TIMEOUT;
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) {
+		pr_warning("raw: PACKET_RX_RING failed: %m");
+		return -1;
+	}
+	r->len = (size_t) block_size * RING_BLOCKS;
+	r->map = mmap(NULL, r->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (r->map == MAP_FAILED) {
+		pr_warning("raw: mmap of the rx ring failed: %m");
+		r->map = NULL;
+		memset(&req, 0, sizeof(req));
+		setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+		return -1;
+	}
+	r->fd = fd;
+	r->block_size = block_size;
+	r->tstamp = event;
+
+	/* Anything queued before the ring existed would never be read. */
+	while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) >= 0)
+		;
+	return 0;
+}
+
+static struct raw_ring *raw_ring_find(struct raw *raw, int fd)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (raw->ring[i].map && raw->ring[i].fd == fd)
+			return &raw->ring[i];
+	}
+	return NULL;
+}
+
+static int raw_batch_open(struct raw *raw, enum timestamp_type ts_type)
+{
+	int flags;
+
+	switch (ts_type) {
+	case TS_SOFTWARE:
+		flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+		break;
+	case TS_HARDWARE:
+		flags = SOF_TIMESTAMPING_TX_HARDWARE |
+			SOF_TIMESTAMPING_RAW_HARDWARE;
+		break;
+	default:
+		/* The other modes never defer their sync messages. */
+		return -1;
+	}
+	if (batch.fd < 0) {
+		/* With protocol zero, the socket receives nothing. */
+		batch.fd = socket(PF_PACKET, SOCK_RAW, 0);
+		if (batch.fd < 0) {
+			pr_err("raw: batch socket failed: %m");
+			return -1;
+		}
+		if (setsockopt(batch.fd, SOL_SOCKET, SO_TIMESTAMPING,
+			       &flags, sizeof(flags))) {
+			pr_err("raw: batch SO_TIMESTAMPING failed: %m");
+			goto no_option;
+		}
+		flags = 1;
+		if (setsockopt(batch.fd, SOL_SOCKET, SO_SELECT_ERR_QUEUE,
+			       &flags, sizeof(flags))) {
+			pr_err("raw: batch SO_SELECT_ERR_QUEUE failed: %m");
+			goto no_option;
+		}
+		LIST_INIT(&batch.users);
+	}
+	LIST_INSERT_HEAD(&batch.users, raw, list);
+	raw->batched = 1;
+	raw->nstash = 0;
+	return 0;
+no_option:
+	close(batch.fd);
+	batch.fd = -1;
+	return -1;
+}
+
+static void raw_batch_close(struct raw *raw)
+{
+	if (!raw->batched)
+		return;
+	LIST_REMOVE(raw, list);
+	raw->batched = 0;
+	if (LIST_EMPTY(&batch.users)) {
+		close(batch.fd);
+		batch.fd = -1;
+		batch.count = 0;
+	}
+}
+
+static struct raw *raw_batch_owner(unsigned char *pkt, int len)
+{
+	struct raw *raw;
+
+	if (len < OFF_SPID + SPID_LEN)
+		return NULL;
+	LIST_FOREACH(raw, &batch.users, list) {
+		if (!memcmp(pkt + OFF_SPID, raw->spid, SPID_LEN))
+			return raw;
+	}
+	return NULL;
+}
+
+static int raw_flush(struct transport *t)
+{
+	int cnt, n = batch.count;
+
+	if (!n)
+		return 0;
+	batch.count = 0;
+	cnt = sk_send_batch(batch.fd, batch.tx, n);
+	if (cnt < n) {
+		pr_err("raw: sent %d of %d batched messages", cnt, n);
+		return -1;
+	}
+	return 0;
+}
+
+/* Holds a frame back until raw_flush(), which runs once the batch is full. */
+static int raw_batch_add(struct raw *raw, unsigned char *frame, int len)
+{
+	struct address *addr;
+	int i = batch.count;
+
+	if (len > BATCH_FRAME_LEN) {
+		pr_err("raw: message too long to be batched");
+		return -1;
+	}
+	memcpy(batch.frame[i], frame, len);
+	memcpy(raw->spid, frame + OFF_SPID, SPID_LEN);
+
+	addr = &batch.addr[i];
+	memset(addr, 0, sizeof(*addr));
+	addr->sll.sll_family = AF_PACKET;
+	addr->sll.sll_ifindex = raw->ifindex;
+	addr->sll.sll_protocol = htons(ETH_P_1588);
+	addr->sll.sll_halen = MAC_LEN;
+	memcpy(addr->sll.sll_addr, frame, MAC_LEN);
+	addr->len = sizeof(addr->sll);
+
+	batch.tx[i].buf = batch.frame[i];
+	batch.tx[i].len = len;
+	batch.tx[i].addr = addr;
+	batch.count++;
+
+	if (batch.count == SK_TX_BATCH && raw_flush(&raw->t))
+		return -1;
+	return len;
+}
+
+static int raw_txts(struct transport *t, struct fdarray *fda, void *buf,
+		    int *len, struct hw_timestamp *hwts)
+{
+	struct raw *owner, *raw = container_of(t, struct raw, t);
+	struct raw_txts *e;
+	int cnt, plen;
+
+	cnt = sk_receive_txts(fda->fd[FD_EVENT], buf, len, hwts);
+	if (cnt || !raw->batched)
+		return cnt;
+
+	if (raw->nstash) {
+		e = &raw->stash[--raw->nstash];
+		plen = e->len < *len ? e->len : *len;
+		memcpy(buf, e->pkt, plen);
+		*len = plen;
+		hwts->ts = e->hwts.ts;
+		hwts->id_valid = 0;
+		return 1;
+	}
+	while (1) {
+		e = NULL;
+		plen = *len;
+		cnt = sk_receive_txts(batch.fd, buf, &plen, hwts);
+		if (cnt <= 0)
+			return cnt;
+		owner = raw_batch_owner(buf, plen);
+		if (owner == raw) {
+			*len = plen;
+			return 1;
+		}
+		if (owner && owner->nstash < BATCH_STASH) {
+			e = &owner->stash[owner->nstash++];
+		}
+		if (!e) {
+			pr_debug("raw: dropping a batched tx time stamp");
+			continue;
+		}
+		e->hwts = *hwts;
+		e->len = plen < BATCH_FRAME_LEN ? plen : BATCH_FRAME_LEN;
+		memcpy(e->pkt, buf, e->len);
+	}
+}
+
+static int raw_txts_fd(struct transport *t, struct fdarray *fda)
+{
+	struct raw *raw = container_of(t, struct raw, t);
+
+	return raw->batched ? batch.fd : fda->fd[FD_EVENT];
+}
+
 static int raw_close(struct transport *t, struct fdarray *fda)
 {
+	struct raw *raw = container_of(t, struct raw, t);
+
+	raw_batch_close(raw);
+	raw_ring_close(&raw->ring[0]);
+	raw_ring_close(&raw->ring[1]);
 	close(fda->fd[0]);
 	close(fda->fd[1]);
 	return 0;
 }
 
-static int open_socket(const char *name, int event, unsigned char *ptp_dst_mac,
-		       unsigned char *p2p_dst_mac)
+static int raw_msg_filter(struct transport *t, struct fdarray *fda,
+			  int domain, int types)
+{
+	if (raw_set_filter(fda->fd[FD_EVENT], domain, types & SK_EVENT_TYPES) ||
+	    raw_set_filter(fda->fd[FD_GENERAL], domain, types & ~SK_EVENT_TYPES))
+		return -1;
+	return 0;
+}
+
+int raw_open_socket(const char *name, int event, unsigned char *ptp_dst_mac,
+		    unsigned char *p2p_dst_mac)
 {
 	struct sockaddr_ll addr;
 	int fd, index;
@@ -205,7 +568,7 @@ static int raw_open(struct transport *t, const char *name,
 	struct raw *raw = container_of(t, struct raw, t);
 	unsigned char ptp_dst_mac[MAC_LEN];
 	unsigned char p2p_dst_mac[MAC_LEN];
-	int efd, gfd;
+	int busy_poll, efd, gfd, one = 1, prefer_busy_poll;
 	char *str;
 
 	str = config_get_string(t->cfg, name, "ptp_dst_mac");
@@ -224,11 +587,11 @@ static int raw_open(struct transport *t, const char *name,
 	if (sk_interface_macaddr(name, &raw->src_addr))
 		goto no_mac;
 
-	efd = open_socket(name, 1, ptp_dst_mac, p2p_dst_mac);
+	efd = raw_open_socket(name, 1, ptp_dst_mac, p2p_dst_mac);
 	if (efd < 0)
 		goto no_event;
 
-	gfd = open_socket(name, 0, ptp_dst_mac, p2p_dst_mac);
+	gfd = raw_open_socket(name, 0, ptp_dst_mac, p2p_dst_mac);
 	if (gfd < 0)
 		goto no_general;
 
@@ -238,6 +601,46 @@ static int raw_open(struct transport *t, const char *name,
 	if (sk_general_init(gfd))
 		goto no_timestamping;
 
+	/* Only the event socket waits for its messages to leave. */
+	if (config_get_int(t->cfg, name, "tx_launch_lead") &&
+	    (sk_set_txtime(efd, 1) || sk_set_txtime(gfd, 0)))
+		goto no_timestamping;
+
+	busy_poll = config_get_int(t->cfg, name, "busy_poll");
+	prefer_busy_poll = config_get_int(t->cfg, name, "prefer_busy_poll");
+	sk_set_busy_poll(efd, busy_poll, prefer_busy_poll);
+	sk_set_busy_poll(gfd, busy_poll, prefer_busy_poll);
+
+	/*
+	 * The ring carries a single time stamp per frame, so it cannot
+	 * serve the legacy mode or the software time stamps needed by
+	 * check_fup_sync.
+	 */
+	if (config_get_int(t->cfg, name, "raw_rx_ring")) {
+		if (ts_type == TS_LEGACY_HW || sk_check_fupsync ||
+		    raw_ring_open(&raw->ring[0], efd, 1, ts_type) ||
+		    raw_ring_open(&raw->ring[1], gfd, 0, ts_type)) {
+			pr_warning("raw: using recvmsg on %s", name);
+			raw_ring_close(&raw->ring[0]);
+			raw_ring_close(&raw->ring[1]);
+		}
+	}
+
+	/*
+	 * The frames of the batch socket pass by the event socket on
+	 * their way out, so keep them from being received as well.
+	 */
+	if (config_get_int(t->cfg, NULL, "sync_batch")) {
+		raw->ifindex = sk_interface_index(efd, name);
+		if (raw->ifindex < 0 || raw_batch_open(raw, ts_type) ||
+		    setsockopt(efd, SOL_PACKET, PACKET_IGNORE_OUTGOING,
+			       &one, sizeof(one))) {
+			pr_warning("raw: sending the sync messages of %s "
+				   "one by one", name);
+			raw_batch_close(raw);
+		}
+	}
+
 	fda->fd[FD_EVENT] = efd;
 	fda->fd[FD_GENERAL] = gfd;
 	return 0;
@@ -251,6 +654,101 @@ no_mac:
 	return -1;
 }
 
+static int raw_vlan(struct raw *raw)
+{
+	return atomic_load_explicit(&raw->vlan, memory_order_relaxed);
+}
+
+static void raw_check_vlan(struct raw *raw, struct eth_hdr *hdr)
+{
+	if (raw_vlan(raw)) {
+		if (ETH_P_1588 == ntohs(hdr->type)) {
+			pr_notice("raw: disabling VLAN mode");
+			atomic_store_explicit(&raw->vlan, 0,
+					      memory_order_relaxed);
+		}
+	} else {
+		if (ETH_P_8021Q == ntohs(hdr->type)) {
+			pr_notice("raw: switching to VLAN mode");
+			atomic_store_explicit(&raw->vlan, 1,
+					      memory_order_relaxed);
+		}
+	}
+}
+
+/* Returns the length of the message, or -EAGAIN if the ring is empty. */
+static int raw_ring_recv(struct raw *raw, struct raw_ring *r, void *buf,
+			 int buflen, struct address *addr,
+			 struct hw_timestamp *hwts)
+{
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *pkt;
+	struct sockaddr_ll *sll;
+	unsigned char *frame;
+	int cnt, hlen, status;
+
+	bd = (struct tpacket_block_desc *) (r->map + r->block * r->block_size);
+	while (!r->pkt) {
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status,
+				      __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			return -EAGAIN;
+		r->left = bd->hdr.bh1.num_pkts;
+		if (r->left) {
+			r->pkt = (struct tpacket3_hdr *)
+				((unsigned char *) bd +
+				 bd->hdr.bh1.offset_to_first_pkt);
+			break;
+		}
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+				 __ATOMIC_RELEASE);
+		r->block = (r->block + 1) % RING_BLOCKS;
+		bd = (struct tpacket_block_desc *)
+			(r->map + r->block * r->block_size);
+	}
+	pkt = r->pkt;
+
+	frame = (unsigned char *) pkt + pkt->tp_mac;
+	cnt = pkt->tp_snaplen;
+	raw_check_vlan(raw, (struct eth_hdr *) frame);
+	if (raw_vlan(raw)) {
+		hlen = sizeof(struct vlan_hdr);
+	} else {
+		hlen = sizeof(struct eth_hdr);
+	}
+	cnt -= hlen;
+	if (cnt > buflen)
+		cnt = buflen;
+	if (cnt > 0)
+		memcpy(buf, frame + hlen, cnt);
+
+	if (addr) {
+		sll = (struct sockaddr_ll *) ((unsigned char *) pkt +
+			TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+		memcpy(&addr->sll, sll, sizeof(addr->sll));
+		addr->len = sizeof(addr->sll);
+	}
+
+	memset(&hwts->ts, 0, sizeof(hwts->ts));
+	status = hwts->type == TS_SOFTWARE ?
+		TP_STATUS_TS_SOFTWARE : TP_STATUS_TS_RAW_HARDWARE;
+	if (r->tstamp && (pkt->tp_status & status)) {
+		hwts->ts.tv_sec = pkt->tp_sec;
+		hwts->ts.tv_nsec = pkt->tp_nsec;
+	}
+
+	/* Give the block back as soon as its last packet is copied. */
+	if (--r->left) {
+		r->pkt = (struct tpacket3_hdr *)
+			((unsigned char *) pkt + pkt->tp_next_offset);
+	} else {
+		r->pkt = NULL;
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+				 __ATOMIC_RELEASE);
+		r->block = (r->block + 1) % RING_BLOCKS;
+	}
+	return cnt < 0 ? -1 : cnt;
+}
+
 static int raw_recv(struct transport *t, int fd, void *buf, int buflen,
 		    struct address *addr, struct hw_timestamp *hwts)
 {
@@ -258,8 +756,18 @@ static int raw_recv(struct transport *t, int fd, void *buf, int buflen,
 	unsigned char *ptr = buf;
 	struct eth_hdr *hdr;
 	struct raw *raw = container_of(t, struct raw, t);
+	struct raw_ring *r = raw_ring_find(raw, fd);
 
-	if (raw->vlan) {
+	if (r) {
+		cnt = raw_ring_recv(raw, r, buf, buflen, addr, hwts);
+		if (cnt == -EAGAIN) {
+			errno = EAGAIN;
+			return -1;
+		}
+		return cnt;
+	}
+
+	if (raw_vlan(raw)) {
 		hlen = sizeof(struct vlan_hdr);
 	} else {
 		hlen = sizeof(struct eth_hdr);
@@ -275,18 +783,70 @@ static int raw_recv(struct transport *t, int fd, void *buf, int buflen,
 	if (cnt < 0)
 		return cnt;
 
-	if (raw->vlan) {
-		if (ETH_P_1588 == ntohs(hdr->type)) {
-			pr_notice("raw: disabling VLAN mode");
-			raw->vlan = 0;
+	raw_check_vlan(raw, hdr);
+	return cnt;
+}
+
+static int raw_recv_batch(struct transport *t, int fd, struct sk_rxbuf *rx,
+			  int n)
+{
+	int cnt, hlen, i, len, num;
+	unsigned char *ptr;
+	struct raw *raw = container_of(t, struct raw, t);
+	struct raw_ring *r = raw_ring_find(raw, fd);
+
+	if (r) {
+		for (i = 0; i < n; i++) {
+			cnt = raw_ring_recv(raw, r, rx[i].buf, rx[i].buflen,
+					    rx[i].addr, rx[i].hwts);
+			if (cnt == -EAGAIN)
+				break;
+			rx[i].cnt = cnt;
 		}
+		return i;
+	}
+
+	if (raw_vlan(raw)) {
+		hlen = sizeof(struct vlan_hdr);
 	} else {
-		if (ETH_P_8021Q == ntohs(hdr->type)) {
-			pr_notice("raw: switching to VLAN mode");
-			raw->vlan = 1;
+		hlen = sizeof(struct eth_hdr);
+	}
+	for (i = 0; i < n; i++) {
+		rx[i].buf = (unsigned char *) rx[i].buf - hlen;
+		rx[i].buflen += hlen;
+	}
+
+	num = sk_receive_batch(fd, rx, n);
+
+	for (i = 0; i < num; i++) {
+		ptr = rx[i].buf;
+		cnt = rx[i].cnt;
+		if (cnt < 0)
+			continue;
+		raw_check_vlan(raw, (struct eth_hdr *) ptr);
+		/*
+		 * Every message in the batch was read with the same header
+		 * length. If the mode changed part way through, move the
+		 * payload to where the caller expects it.
+		 */
+		if (raw_vlan(raw)) {
+			len = sizeof(struct vlan_hdr);
+		} else {
+			len = sizeof(struct eth_hdr);
 		}
+		if (cnt < len) {
+			rx[i].cnt = -1;
+			continue;
+		}
+		cnt -= len;
+		if (len != hlen) {
+			if (cnt > rx[i].buflen - hlen)
+				cnt = rx[i].buflen - hlen;
+			memmove(ptr + hlen, ptr + len, cnt);
+		}
+		rx[i].cnt = cnt;
 	}
-	return cnt;
+	return num;
 }
 
 static int raw_send(struct transport *t, struct fdarray *fda, int event,
@@ -311,7 +871,13 @@ static int raw_send(struct transport *t, struct fdarray *fda, int event,
 
 	hdr->type = htons(ETH_P_1588);
 
-	cnt = send(fd, ptr, len, 0);
+	if (event == TRANS_BATCH) {
+		if (raw->batched)
+			return raw_batch_add(raw, ptr, len);
+		event = TRANS_DEFER;
+	}
+
+	cnt = sk_send(fd, ptr, len, NULL, hwts->txtime);
 	if (cnt < 1) {
 		pr_err("send failed: %d %m", errno);
 		return cnt;
@@ -322,6 +888,26 @@ static int raw_send(struct transport *t, struct fdarray *fda, int event,
 	return event == TRANS_EVENT ? sk_receive(fd, pkt, len, NULL, hwts, MSG_ERRQUEUE) : cnt;
 }
 
+static int raw_send_batch(struct transport *t, struct fdarray *fda,
+			  struct sk_txbuf *tx, int n)
+{
+	struct raw *raw = container_of(t, struct raw, t);
+	struct eth_hdr *hdr;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		hdr = (struct eth_hdr *) ((unsigned char *) tx[i].buf -
+					  sizeof(*hdr));
+		addr_to_mac(&hdr->dst, tx[i].addr ? tx[i].addr : &raw->ptp_addr);
+		addr_to_mac(&hdr->src, &raw->src_addr);
+		hdr->type = htons(ETH_P_1588);
+		tx[i].buf = hdr;
+		tx[i].len += sizeof(*hdr);
+		tx[i].addr = NULL;
+	}
+	return sk_send_batch(fda->fd[FD_GENERAL], tx, n);
+}
+
 static void raw_release(struct transport *t)
 {
 	struct raw *raw = container_of(t, struct raw, t);
@@ -351,9 +937,17 @@ struct transport *raw_transport_create(void)
 	raw->t.close   = raw_close;
 	raw->t.open    = raw_open;
 	raw->t.recv    = raw_recv;
+	raw->t.recv_batch = raw_recv_batch;
+	raw->t.send_batch = raw_send_batch;
+	raw->t.flush   = raw_flush;
+	raw->t.txts    = raw_txts;
+	raw->t.txts_fd = raw_txts_fd;
+	raw->t.filter  = raw_msg_filter;
 	raw->t.send    = raw_send;
 	raw->t.release = raw_release;
 	raw->t.physical_addr = raw_physical_addr;
 	raw->t.protocol_addr = raw_protocol_addr;
+	raw->ring[0].fd = -1;
+	raw->ring[1].fd = -1;
 	return &raw->t;
 }
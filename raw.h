@@ -29,4 +29,16 @@
  */
 struct transport *raw_transport_create(void);
 
+/**
+ * Open a packet socket receiving either the event or the general PTP
+ * messages on an interface, and join the PTP multicast groups.
+ * @param name         The name of the network interface.
+ * @param event        Non-zero for the event messages.
+ * @param ptp_dst_mac  The multicast address of the PTP messages.
+ * @param p2p_dst_mac  The multicast address of the peer delay messages.
+ * @return A socket on success, -1 otherwise.
+ */
+int raw_open_socket(const char *name, int event, unsigned char *ptp_dst_mac,
+		    unsigned char *p2p_dst_mac);
+
 #endif
@@ -0,0 +1,155 @@
+/**
+ * @file refclock_sock.c
+ * @brief Implements a servo sending the samples to the SOCK reference clock
+ *        of chronyd as soon as they are made.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "print.h"
+#include "refclock_sock.h"
+#include "servo_private.h"
+#include "util.h"
+
+#define SOCK_MAGIC 0x534f434b
+
+/* Declaration of the sample from chrony (refclock_sock.c) */
+struct sock_sample {
+	struct timeval tv; /* system time of the measurement */
+	double offset;     /* true time minus system time in seconds */
+	int pulse;
+	int leap;          /* 0 - normal, 1 - insert, 2 - delete */
+	int _pad;
+	int magic;
+};
+
+struct refclock_sock_servo {
+	struct servo servo;
+	struct sockaddr_un addr;
+	int fd;
+	int leap;
+	time_t last_error;
+};
+
+static void refclock_sock_destroy(struct servo *servo)
+{
+	struct refclock_sock_servo *s =
+		container_of(servo, struct refclock_sock_servo, servo);
+
+	close(s->fd);
+	free(s);
+}
+
+static double refclock_sock_sample(struct servo *servo,
+				   int64_t offset,
+				   uint64_t local_ts,
+				   double weight,
+				   enum servo_state *state)
+{
+	struct refclock_sock_servo *s =
+		container_of(servo, struct refclock_sock_servo, servo);
+	struct sock_sample sample;
+	uint64_t local_us = local_ts / 1000;
+
+	/*
+	 * The time of the measurement has only microsecond resolution,
+	 * the offset from it carries the rest of the nanoseconds.
+	 */
+	memset(&sample, 0, sizeof(sample));
+	sample.tv.tv_sec = local_us / 1000000;
+	sample.tv.tv_usec = local_us % 1000000;
+	sample.offset = ((int64_t)(local_ts - local_us * 1000) - offset) / 1e9;
+	sample.magic = SOCK_MAGIC;
+
+	switch (s->leap) {
+	case -1:
+		sample.leap = 2;
+		break;
+	case 1:
+		sample.leap = 1;
+		break;
+	default:
+		sample.leap = 0;
+	}
+
+	if (sendto(s->fd, &sample, sizeof(sample), MSG_DONTWAIT,
+		   (struct sockaddr *)&s->addr, sizeof(s->addr)) !=
+	    sizeof(sample) && !rate_limited(60, &s->last_error)) {
+		/* chronyd is not running, or is busy */
+		pr_warning("refclock_sock: failed to send sample to %s: %m",
+			   s->addr.sun_path);
+	}
+
+	*state = SERVO_UNLOCKED;
+	return 0.0;
+}
+
+static void refclock_sock_sync_interval(struct servo *servo, double interval)
+{
+}
+
+static void refclock_sock_reset(struct servo *servo)
+{
+}
+
+static void refclock_sock_leap(struct servo *servo, int leap)
+{
+	struct refclock_sock_servo *s =
+		container_of(servo, struct refclock_sock_servo, servo);
+
+	s->leap = leap;
+}
+
+struct servo *refclock_sock_servo_create(struct config *cfg)
+{
+	char *path = config_get_string(cfg, NULL, "refclock_sock_address");
+	struct refclock_sock_servo *s;
+
+	if (strlen(path) >= sizeof(s->addr.sun_path)) {
+		pr_err("refclock_sock: path %s is too long", path);
+		return NULL;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->servo.destroy = refclock_sock_destroy;
+	s->servo.sample = refclock_sock_sample;
+	s->servo.sync_interval = refclock_sock_sync_interval;
+	s->servo.reset = refclock_sock_reset;
+	s->servo.leap = refclock_sock_leap;
+
+	s->addr.sun_family = AF_UNIX;
+	strncpy(s->addr.sun_path, path, sizeof(s->addr.sun_path) - 1);
+
+	s->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (s->fd < 0) {
+		pr_err("refclock_sock: failed to create socket: %m");
+		free(s);
+		return NULL;
+	}
+
+	return &s->servo;
+}
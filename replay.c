@@ -0,0 +1,527 @@
+/**
+ * @file replay.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <arpa/inet.h>
+#include <byteswap.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/if_ether.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "address.h"
+#include "clockadj.h"
+#include "config.h"
+#include "contain.h"
+#include "ether.h"
+#include "msg.h"
+#include "print.h"
+#include "replay.h"
+#include "tmv.h"
+#include "transport_private.h"
+
+/*
+ * The messages of a pcap file are handed to the port one at a time, as
+ * fast as possible or at a multiple of the pace of the capture, through
+ * a timer which expires when the next one is due. The time stamps of the capture are
+ * those of a free running clock, which the servo adjusts as CLOCK_REPLAY.
+ * The messages sent are discarded.
+ */
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NS		0xa1b23c4d
+#define PCAP_HDR_LEN		24
+#define PCAP_REC_LEN		16
+
+#define LINKTYPE_ETHERNET	1
+#define LINKTYPE_LINUX_SLL	113
+#define LINKTYPE_LINUX_SLL2	276
+
+#define EVENT_PORT		319
+#define GENERAL_PORT		320
+
+/* How far ahead a Delay_Req of the capture is looked for. */
+#define REPLAY_LOOKAHEAD	64
+
+struct replay_msg {
+	uint8_t *pdu;
+	int len;
+	enum transport_type proto;
+	struct timespec ts;
+};
+
+struct replay {
+	struct transport t;
+	const char *name;
+	uint8_t *data;
+	size_t size;
+	int swapped;
+	int nsec;
+	int linktype;
+	int speed;
+	int fd;
+	/* The message due next, and the offset of the record after it. */
+	struct replay_msg next;
+	int have_next;
+	size_t pos;
+	/* The first message and the last one handed out, and when. */
+	struct timespec first;
+	struct timespec last;
+	uint64_t start;
+	uint64_t handed;
+	/*
+	 * A Delay_Req of the port is answered by the Delay_Resp to the
+	 * next Delay_Req of the capture, whose identity it is given.
+	 */
+	struct PortIdentity alias_port;
+	struct PortIdentity own_port;
+	UInteger16 alias_seq;
+	UInteger16 own_seq;
+	int alias_valid;
+	uint64_t count;
+	uint64_t lat_sum;
+	uint64_t lat_min;
+	uint64_t lat_max;
+};
+
+/* The number of transports which have not reached the end of a capture. */
+static int replay_active;
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * NS_PER_SEC + now.tv_nsec;
+}
+
+static int64_t timespec_ns(struct timespec ts)
+{
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static uint32_t replay_u32(struct replay *r, uint8_t *ptr)
+{
+	uint32_t val;
+
+	memcpy(&val, ptr, sizeof(val));
+	return r->swapped ? bswap_32(val) : val;
+}
+
+static uint16_t be16(uint8_t *ptr)
+{
+	uint16_t val;
+
+	memcpy(&val, ptr, sizeof(val));
+	return ntohs(val);
+}
+
+/* Finds the PTP message in a captured frame. */
+static uint8_t *replay_pdu(struct replay *r, uint8_t *frame, int len,
+			   int *pdulen, enum transport_type *proto)
+{
+	int off, type, mlen;
+
+	switch (r->linktype) {
+	case LINKTYPE_ETHERNET:
+		off = ETH_HLEN;
+		type = len < off ? 0 : be16(frame + OFF_ETYPE);
+		break;
+	case LINKTYPE_LINUX_SLL:
+		off = 16;
+		type = len < off ? 0 : be16(frame + 14);
+		break;
+	case LINKTYPE_LINUX_SLL2:
+		off = 20;
+		type = len < off ? 0 : be16(frame);
+		break;
+	default:
+		return NULL;
+	}
+	while ((type == ETH_P_8021Q || type == ETH_P_8021AD) &&
+	       len >= off + VLAN_HLEN) {
+		type = be16(frame + off + 2);
+		off += VLAN_HLEN;
+	}
+
+	switch (type) {
+	case ETH_P_1588:
+		*proto = TRANS_IEEE_802_3;
+		break;
+	case ETH_P_IP:
+		/* Only the first fragment starts with the UDP header. */
+		if (len < off + 20 || frame[off + 9] != IPPROTO_UDP ||
+		    be16(frame + off + 6) & 0x1fff)
+			return NULL;
+		off += (frame[off] & 0x0f) * 4;
+		*proto = TRANS_UDP_IPV4;
+		break;
+	case ETH_P_IPV6:
+		if (len < off + 40 || frame[off + 6] != IPPROTO_UDP)
+			return NULL;
+		off += 40;
+		*proto = TRANS_UDP_IPV6;
+		break;
+	default:
+		return NULL;
+	}
+	if (*proto != TRANS_IEEE_802_3) {
+		if (len < off + 8)
+			return NULL;
+		type = be16(frame + off + 2);
+		if (type != EVENT_PORT && type != GENERAL_PORT)
+			return NULL;
+		off += 8;
+	}
+	if (len < off + (int) sizeof(struct ptp_header))
+		return NULL;
+
+	/* Leave out the padding of short Ethernet frames. */
+	*pdulen = len - off;
+	mlen = be16(frame + off + 2);
+	if (mlen >= (int) sizeof(struct ptp_header) && mlen < *pdulen)
+		*pdulen = mlen;
+	return frame + off;
+}
+
+/* Reads the next PTP message of the capture, starting at an offset. */
+static int replay_read(struct replay *r, size_t *pos, struct replay_msg *m)
+{
+	uint32_t caplen;
+	uint8_t *rec;
+
+	while (*pos + PCAP_REC_LEN <= r->size) {
+		rec = r->data + *pos;
+		caplen = replay_u32(r, rec + 8);
+		if (caplen > r->size - *pos - PCAP_REC_LEN)
+			return -1;
+		*pos += PCAP_REC_LEN + caplen;
+		m->pdu = replay_pdu(r, rec + PCAP_REC_LEN, caplen, &m->len,
+				    &m->proto);
+		if (!m->pdu)
+			continue;
+		m->ts.tv_sec = replay_u32(r, rec);
+		m->ts.tv_nsec = replay_u32(r, rec + 4);
+		if (!r->nsec)
+			m->ts.tv_nsec *= 1000;
+		return 0;
+	}
+	return -1;
+}
+
+static int replay_load(struct replay *r, const char *file)
+{
+	uint32_t magic;
+	struct stat st;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		pr_err("replay: failed to open %s: %m", file);
+		return -1;
+	}
+	if (fstat(fd, &st) || st.st_size < PCAP_HDR_LEN) {
+		pr_err("replay: %s is not a pcap file", file);
+		close(fd);
+		return -1;
+	}
+	r->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (r->data == MAP_FAILED) {
+		pr_err("replay: failed to map %s: %m", file);
+		r->data = NULL;
+		return -1;
+	}
+	r->size = st.st_size;
+
+	memcpy(&magic, r->data, sizeof(magic));
+	if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS) {
+		magic = bswap_32(magic);
+		r->swapped = 1;
+	}
+	if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS) {
+		pr_err("replay: %s is not a pcap file", file);
+		goto unmap;
+	}
+	r->nsec = magic == PCAP_MAGIC_NS;
+
+	/* The upper bits may describe the frame check sequence. */
+	r->linktype = replay_u32(r, r->data + 20) & 0xffff;
+	switch (r->linktype) {
+	case LINKTYPE_ETHERNET:
+	case LINKTYPE_LINUX_SLL:
+	case LINKTYPE_LINUX_SLL2:
+		break;
+	default:
+		pr_err("replay: %s has unsupported link type %d",
+		       file, r->linktype);
+		goto unmap;
+	}
+	return 0;
+unmap:
+	munmap(r->data, r->size);
+	r->data = NULL;
+	return -1;
+}
+
+static uint64_t replay_due(struct replay *r)
+{
+	int64_t delta;
+
+	if (!r->speed || !r->start)
+		return 1;
+	delta = timespec_ns(r->next.ts) - timespec_ns(r->first);
+	return delta > 0 ? r->start + delta / r->speed : 1;
+}
+
+/* Lets the timer expire when the next message is due. */
+static void replay_arm(struct replay *r)
+{
+	struct itimerspec its;
+	uint64_t due;
+
+	memset(&its, 0, sizeof(its));
+	if (r->have_next) {
+		due = replay_due(r);
+		its.it_value.tv_sec = due / NS_PER_SEC;
+		its.it_value.tv_nsec = due % NS_PER_SEC;
+	}
+	if (timerfd_settime(r->fd, TFD_TIMER_ABSTIME, &its, NULL))
+		pr_err("replay: timerfd_settime failed: %m");
+}
+
+static void replay_finish(struct replay *r)
+{
+	double secs = (monotonic_ns() - r->start) / 1e9, freq;
+	unsigned int steps;
+	int64_t stepped;
+
+	pr_info("replay %s: %" PRIu64 " messages in %.3f s, %.0f messages/s",
+		r->name, r->count, secs, secs > 0.0 ? r->count / secs : 0.0);
+	if (r->count > 1) {
+		pr_info("replay %s: latency min %" PRIu64 " avg %" PRIu64
+			" max %" PRIu64 " ns", r->name, r->lat_min,
+			r->lat_sum / (r->count - 1), r->lat_max);
+	}
+	stepped = clockadj_get_replay(&freq, &steps);
+	pr_info("replay %s: clock frequency %+.0f ppb, %u steps of %+" PRId64
+		" ns in total", r->name, freq, steps, stepped);
+
+	/* The last port to finish ends the program. */
+	if (!--replay_active)
+		raise(SIGINT);
+}
+
+static int replay_close(struct transport *t, struct fdarray *fda)
+{
+	close(fda->fd[FD_EVENT]);
+	return 0;
+}
+
+static int replay_open(struct transport *t, const char *name,
+		       struct fdarray *fda, enum timestamp_type tt)
+{
+	struct replay *r = container_of(t, struct replay, t);
+	char path[PATH_MAX];
+	const char *file;
+
+	/* After a fault, the replay goes on where it stopped. */
+	if (!r->data) {
+		file = config_get_string(t->cfg, name, "replay_file");
+		if (!file[0]) {
+			snprintf(path, sizeof(path), "%s.pcap", name);
+			file = path;
+		}
+		if (replay_load(r, file))
+			return -1;
+		r->pos = PCAP_HDR_LEN;
+		r->have_next = !replay_read(r, &r->pos, &r->next);
+		if (!r->have_next) {
+			pr_err("replay: no PTP messages in %s", file);
+			munmap(r->data, r->size);
+			r->data = NULL;
+			return -1;
+		}
+		r->name = name;
+		r->speed = config_get_int(t->cfg, name, "replay_speed");
+		r->last = r->next.ts;
+		r->lat_min = UINT64_MAX;
+		t->type = r->next.proto;
+		replay_active++;
+	}
+
+	r->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (r->fd < 0) {
+		pr_err("replay: timerfd_create failed: %m");
+		return -1;
+	}
+	replay_arm(r);
+	fda->fd[FD_EVENT] = r->fd;
+	fda->fd[FD_GENERAL] = -1;
+	return 0;
+}
+
+static int replay_recv(struct transport *t, int fd, void *buf, int buflen,
+		       struct address *addr, struct hw_timestamp *hwts)
+{
+	struct replay *r = container_of(t, struct replay, t);
+	struct delay_resp_msg *rsp = buf;
+	uint64_t now, lat;
+	int cnt;
+
+	if (!r->have_next)
+		return 0;
+
+	/*
+	 * At the pace of the capture, the latency is how late a message
+	 * is handed out, otherwise how long the previous one took.
+	 */
+	now = monotonic_ns();
+	lat = 0;
+	if (r->speed && r->start)
+		lat = now - replay_due(r);
+	else if (r->handed)
+		lat = now - r->handed;
+	if (r->count) {
+		r->lat_sum += lat;
+		if (lat < r->lat_min)
+			r->lat_min = lat;
+		if (lat > r->lat_max)
+			r->lat_max = lat;
+	}
+	if (!r->start) {
+		r->start = now;
+		r->first = r->next.ts;
+	}
+
+	cnt = r->next.len < buflen ? r->next.len : buflen;
+	memcpy(buf, r->next.pdu, cnt);
+	/* The buffer only holds the PDU, not a whole struct ptp_message. */
+	if (r->alias_valid && cnt >= (int) sizeof(*rsp) &&
+	    (rsp->hdr.tsmt & 0x0f) == DELAY_RESP &&
+	    rsp->hdr.sequenceId == r->alias_seq &&
+	    !memcmp(&rsp->requestingPortIdentity, &r->alias_port,
+		    sizeof(r->alias_port))) {
+		rsp->hdr.sequenceId = r->own_seq;
+		rsp->requestingPortIdentity = r->own_port;
+		r->alias_valid = 0;
+	}
+	hwts->ts = clockadj_replay_time(r->next.ts);
+	hwts->sw = hwts->ts;
+	addr->len = 0;
+
+	r->last = r->next.ts;
+	r->handed = now;
+	r->count++;
+	r->have_next = !replay_read(r, &r->pos, &r->next);
+	replay_arm(r);
+	if (!r->have_next)
+		replay_finish(r);
+	return cnt;
+}
+
+/* The time of CLOCK_REPLAY, for the messages sent. */
+static struct timespec replay_now(struct replay *r)
+{
+	struct timespec ts = r->last;
+	uint64_t ns;
+
+	if (r->speed && r->handed) {
+		ns = (monotonic_ns() - r->handed) * r->speed + ts.tv_nsec;
+		ts.tv_sec += ns / NS_PER_SEC;
+		ts.tv_nsec = ns % NS_PER_SEC;
+	}
+	return clockadj_replay_time(ts);
+}
+
+static int replay_is_delay_req(struct replay_msg *m, struct ptp_header *hdr)
+{
+	memcpy(hdr, m->pdu, sizeof(*hdr));
+	return (hdr->tsmt & 0x0f) == DELAY_REQ;
+}
+
+static int replay_send(struct transport *t, struct fdarray *fda, int event,
+		       int peer, void *buf, int buflen, struct address *addr,
+		       struct hw_timestamp *hwts)
+{
+	struct replay *r = container_of(t, struct replay, t);
+	struct ptp_header *own = buf;
+	struct replay_msg req;
+	struct ptp_header hdr;
+	size_t pos = r->pos;
+	int i, found;
+
+	if (event == TRANS_GENERAL)
+		return buflen;
+	hwts->ts = replay_now(r);
+	if ((own->tsmt & 0x0f) != DELAY_REQ || !r->have_next)
+		return buflen;
+
+	/*
+	 * The Delay_Req of the capture takes the place of this one, with
+	 * its transmit time stamp, so that the delay remains realistic.
+	 */
+	req = r->next;
+	found = replay_is_delay_req(&req, &hdr);
+	for (i = 0; !found && i < REPLAY_LOOKAHEAD; i++) {
+		if (replay_read(r, &pos, &req))
+			break;
+		found = replay_is_delay_req(&req, &hdr);
+	}
+	if (found) {
+		r->alias_port = hdr.sourcePortIdentity;
+		r->alias_seq = hdr.sequenceId;
+		r->own_port = own->sourcePortIdentity;
+		r->own_seq = own->sequenceId;
+		r->alias_valid = 1;
+		hwts->ts = clockadj_replay_time(req.ts);
+	}
+	return buflen;
+}
+
+static void replay_release(struct transport *t)
+{
+	struct replay *r = container_of(t, struct replay, t);
+
+	if (r->data)
+		munmap(r->data, r->size);
+	free(r);
+}
+
+struct transport *replay_transport_create(void)
+{
+	struct replay *r;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+	r->t.close   = replay_close;
+	r->t.open    = replay_open;
+	r->t.recv    = replay_recv;
+	r->t.send    = replay_send;
+	r->t.release = replay_release;
+	return &r->t;
+}
@@ -18,39 +18,23 @@
  */
 #include <string.h>
 
+#include "autoservo.h"
 #include "config.h"
+#include "kalman.h"
 #include "linreg.h"
 #include "ntpshm.h"
 #include "nullf.h"
 #include "pi.h"
+#include "refclock_sock.h"
 #include "servo_private.h"
 
 #define NSEC_PER_SEC 1000000000
 
-struct servo *servo_create(struct config *cfg, enum servo_type type,
-			   int fadj, int max_ppb, int sw_ts)
+static void servo_configure(struct servo *servo, struct config *cfg)
 {
 	double servo_first_step_threshold;
 	double servo_step_threshold;
 	int servo_max_frequency;
-	struct servo *servo;
-
-	switch (type) {
-	case CLOCK_SERVO_PI:
-		servo = pi_servo_create(cfg, fadj, sw_ts);
-		break;
-	case CLOCK_SERVO_LINREG:
-		servo = linreg_servo_create(fadj);
-		break;
-	case CLOCK_SERVO_NTPSHM:
-		servo = ntpshm_servo_create(cfg);
-		break;
-	case CLOCK_SERVO_NULLF:
-		servo = nullf_servo_create();
-		break;
-	default:
-		return NULL;
-	}
 
 	servo_step_threshold = config_get_double(cfg, NULL, "step_threshold");
 	if (servo_step_threshold > 0.0) {
@@ -70,11 +54,47 @@ struct servo *servo_create(struct config *cfg, enum servo_type type,
 	}
 
 	servo_max_frequency = config_get_int(cfg, NULL, "max_frequency");
-	servo->max_frequency = max_ppb;
+	servo->max_frequency = servo->max_ppb;
 	if (servo_max_frequency && servo->max_frequency > servo_max_frequency) {
 		servo->max_frequency = servo_max_frequency;
 	}
+}
 
+struct servo *servo_create(struct config *cfg, enum servo_type type,
+			   int fadj, int max_ppb, int sw_ts)
+{
+	struct servo *servo;
+
+	switch (type) {
+	case CLOCK_SERVO_PI:
+		servo = pi_servo_create(cfg, fadj, sw_ts);
+		break;
+	case CLOCK_SERVO_LINREG:
+		servo = linreg_servo_create(fadj);
+		break;
+	case CLOCK_SERVO_NTPSHM:
+		servo = ntpshm_servo_create(cfg);
+		break;
+	case CLOCK_SERVO_NULLF:
+		servo = nullf_servo_create();
+		break;
+	case CLOCK_SERVO_KALMAN:
+		servo = kalman_servo_create(fadj, sw_ts);
+		break;
+	case CLOCK_SERVO_REFCLOCK_SOCK:
+		servo = refclock_sock_servo_create(cfg);
+		break;
+	case CLOCK_SERVO_AUTO:
+		servo = auto_servo_create(cfg, fadj, max_ppb, sw_ts);
+		break;
+	default:
+		return NULL;
+	}
+	if (!servo)
+		return NULL;
+
+	servo->max_ppb = max_ppb;
+	servo_configure(servo, cfg);
 	servo->first_update = 1;
 
 	return servo;
@@ -124,3 +144,16 @@ void servo_leap(struct servo *servo, int leap)
 	if (servo->leap)
 		servo->leap(servo, leap);
 }
+
+void servo_warm_start(struct servo *servo, double fadj)
+{
+	if (servo->warm_start)
+		servo->warm_start(servo, fadj);
+}
+
+void servo_reconfigure(struct servo *servo, struct config *cfg)
+{
+	servo_configure(servo, cfg);
+	if (servo->reconfigure)
+		servo->reconfigure(servo, cfg);
+}
@@ -35,6 +35,9 @@ enum servo_type {
 	CLOCK_SERVO_LINREG,
 	CLOCK_SERVO_NTPSHM,
 	CLOCK_SERVO_NULLF,
+	CLOCK_SERVO_KALMAN,
+	CLOCK_SERVO_REFCLOCK_SOCK,
+	CLOCK_SERVO_AUTO,
 };
 
 /**
@@ -123,4 +126,23 @@ double servo_rate_ratio(struct servo *servo);
  */
 void servo_leap(struct servo *servo, int leap);
 
+/**
+ * Inform a clock servo about a recent estimate of the frequency of the
+ * clock, e.g. saved by a previous run, so that it may lock without
+ * estimating the frequency first. The clock must already be running at
+ * this frequency.
+ * @param servo   Pointer to a servo obtained via @ref servo_create().
+ * @param fadj    The frequency in the units of @ref servo_create().
+ */
+void servo_warm_start(struct servo *servo, double fadj);
+
+/**
+ * Apply the settings of a new configuration to a running clock servo,
+ * keeping its state. The new constants take effect with the next call
+ * to @ref servo_sync_interval().
+ * @param servo   Pointer to a servo obtained via @ref servo_create().
+ * @param cfg     The new configuration.
+ */
+void servo_reconfigure(struct servo *servo, struct config *cfg);
+
 #endif
@@ -21,11 +21,14 @@
 
 #include "contain.h"
 
+struct config;
+
 struct servo {
 	double max_frequency;
 	double step_threshold;
 	double first_step_threshold;
 	int first_update;
+	int max_ppb;
 
 	void (*destroy)(struct servo *servo);
 
@@ -40,6 +43,10 @@ struct servo {
 	double (*rate_ratio)(struct servo *servo);
 
 	void (*leap)(struct servo *servo, int leap);
+
+	void (*warm_start)(struct servo *servo, double fadj);
+
+	void (*reconfigure)(struct servo *servo, struct config *cfg);
 };
 
 #endif
@@ -0,0 +1,188 @@
+/**
+ * @file servolog.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "print.h"
+#include "servolog.h"
+
+struct servolog {
+	char *path;
+	char *name; /* room for the path of a rotated file */
+	uint64_t size;
+	int files;
+	struct servolog_header *hdr;
+	struct servolog_record *records;
+	size_t map_len;
+	pthread_mutex_t lock;
+};
+
+static int servolog_map(struct servolog *sl)
+{
+	struct servolog_header *hdr;
+	int fd;
+
+	fd = open(sl->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		pr_err("failed to open servo log %s: %m", sl->path);
+		return -1;
+	}
+	if (ftruncate(fd, sl->map_len)) {
+		pr_err("failed to size servo log %s: %m", sl->path);
+		close(fd);
+		return -1;
+	}
+	hdr = mmap(NULL, sl->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		pr_err("failed to map servo log %s: %m", sl->path);
+		return -1;
+	}
+
+	memcpy(hdr->magic, SERVOLOG_MAGIC, sizeof(hdr->magic));
+	hdr->version = SERVOLOG_VERSION;
+	hdr->record_size = sizeof(struct servolog_record);
+	hdr->size = sl->size;
+	atomic_store(&hdr->count, 0);
+
+	sl->records = (struct servolog_record *) (hdr + 1);
+	sl->hdr = hdr;
+	return 0;
+}
+
+/* Unmap the file being written, dropping the room left in it. */
+static void servolog_unmap(struct servolog *sl)
+{
+	uint64_t count;
+
+	if (!sl->hdr)
+		return;
+	count = atomic_load(&sl->hdr->count);
+	munmap(sl->hdr, sl->map_len);
+	sl->hdr = NULL;
+	if (count < sl->size &&
+	    truncate(sl->path, sizeof(*sl->hdr) + count * sizeof(*sl->records)))
+		pr_err("failed to truncate servo log %s: %m", sl->path);
+}
+
+static int servolog_rotate(struct servolog *sl)
+{
+	char *from, *to;
+	size_t len = strlen(sl->path) + 16;
+	int i;
+
+	servolog_unmap(sl);
+	from = sl->name;
+	to = sl->name + len;
+	for (i = sl->files - 1; i > 0; i--) {
+		snprintf(to, len, "%s.%d", sl->path, i);
+		if (i > 1)
+			snprintf(from, len, "%s.%d", sl->path, i - 1);
+		else
+			snprintf(from, len, "%s", sl->path);
+		if (rename(from, to) && i == 1) {
+			pr_err("failed to rename servo log %s: %m", from);
+			return -1;
+		}
+	}
+	return servolog_map(sl);
+}
+
+struct servolog *servolog_open(const char *path, unsigned int size,
+			       int files)
+{
+	struct servolog *sl;
+
+	sl = calloc(1, sizeof(*sl));
+	if (!sl)
+		return NULL;
+	sl->path = strdup(path);
+	sl->name = malloc(2 * (strlen(path) + 16));
+	if (!sl->path || !sl->name)
+		goto err;
+	sl->size = size;
+	sl->files = files;
+	sl->map_len = sizeof(struct servolog_header) +
+		sl->size * sizeof(struct servolog_record);
+	if (servolog_map(sl))
+		goto err;
+	pthread_mutex_init(&sl->lock, NULL);
+	return sl;
+err:
+	free(sl->name);
+	free(sl->path);
+	free(sl);
+	return NULL;
+}
+
+void servolog_close(struct servolog *sl)
+{
+	servolog_unmap(sl);
+	pthread_mutex_destroy(&sl->lock);
+	free(sl->name);
+	free(sl->path);
+	free(sl);
+}
+
+void servolog_put(struct servolog *sl, int clock, uint64_t ts,
+		  int64_t offset, int64_t delay, double freq, double weight,
+		  int state)
+{
+	struct servolog_record *r;
+	struct timespec now;
+	uint64_t count;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&sl->lock);
+
+	if (sl->hdr && atomic_load_explicit(&sl->hdr->count,
+					    memory_order_relaxed) == sl->size &&
+	    servolog_rotate(sl)) {
+		/* Give up rather than failing on every sample. */
+		servolog_unmap(sl);
+		pr_err("servo log stopped");
+	}
+	if (!sl->hdr) {
+		pthread_mutex_unlock(&sl->lock);
+		return;
+	}
+
+	count = atomic_load_explicit(&sl->hdr->count, memory_order_relaxed);
+	r = &sl->records[count];
+	r->time = now.tv_sec * 1000000000ULL + now.tv_nsec;
+	r->ts = ts;
+	r->offset = offset;
+	r->delay = delay;
+	r->freq = freq;
+	r->weight = weight;
+	r->clock = clock;
+	r->state = state;
+	r->reserved = 0;
+	atomic_store_explicit(&sl->hdr->count, count + 1,
+			      memory_order_release);
+
+	pthread_mutex_unlock(&sl->lock);
+}
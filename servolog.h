@@ -0,0 +1,94 @@
+/**
+ * @file servolog.h
+ * @brief Records the servo samples in memory mapped, rotating files.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_SERVOLOG_H
+#define HAVE_SERVOLOG_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define SERVOLOG_MAGIC		"PTPSLOG"
+#define SERVOLOG_VERSION	1
+
+/**
+ * Each file starts with this header, which is followed by the records.
+ * The count of the records written is updated after each record, so
+ * that a file may be read while it is being written. Once the file is
+ * full, it is renamed with the suffix ".1", the older files are shifted
+ * to the next suffix, and a new file is started.
+ */
+struct servolog_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t size; /* number of records the file can hold */
+	_Atomic uint64_t count;
+	uint8_t reserved[32];
+};
+
+/**
+ * A servo sample, in the units of the servo.
+ */
+struct servolog_record {
+	uint64_t time;   /* CLOCK_MONOTONIC in nanoseconds */
+	uint64_t ts;     /* local time stamp of the sample in nanoseconds */
+	int64_t offset;  /* nanoseconds */
+	int64_t delay;   /* path or reading delay in nanoseconds, -1 if none */
+	double freq;     /* servo output in ppb */
+	float weight;
+	uint16_t clock;  /* domain in ptp4l, number of the clock in phc2sys */
+	uint8_t state;   /* enum servo_state */
+	uint8_t reserved;
+};
+
+/** Opaque type */
+struct servolog;
+
+/**
+ * Create the first file of a servo log.
+ * @param path   The path of the file being written.
+ * @param size   The number of records per file.
+ * @param files  The number of files kept, the one being written included.
+ * @return A pointer to a new servolog on success, NULL otherwise.
+ */
+struct servolog *servolog_open(const char *path, unsigned int size,
+			       int files);
+
+/**
+ * Close a servo log, truncating the last file to the records written.
+ * @param sl  Pointer to servolog obtained via @ref servolog_open().
+ */
+void servolog_close(struct servolog *sl);
+
+/**
+ * Append a sample to a servo log. This may be called from any thread.
+ * @param sl      Pointer to servolog obtained via @ref servolog_open().
+ * @param clock   The domain or the number of the clock.
+ * @param ts      The local time stamp of the sample in nanoseconds.
+ * @param offset  The offset in nanoseconds.
+ * @param delay   The delay in nanoseconds, or -1 if not known.
+ * @param freq    The frequency returned by the servo in ppb.
+ * @param weight  The weight of the sample.
+ * @param state   The state of the servo.
+ */
+void servolog_put(struct servolog *sl, int clock, uint64_t ts,
+		  int64_t offset, int64_t delay, double freq, double weight,
+		  int state);
+
+#endif
@@ -18,6 +18,10 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #include <errno.h>
+#include <time.h>
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#include <linux/bpf.h>
 #include <linux/net_tstamp.h>
 #include <linux/sockios.h>
 #include <linux/ethtool.h>
@@ -25,25 +29,100 @@
 #include <netinet/in.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <ifaddrs.h>
 #include <stdlib.h>
 #include <poll.h>
+#include <stdio.h>
 
 #include "address.h"
 #include "ether.h"
 #include "missing.h"
+#include "msg.h"
 #include "print.h"
 #include "sk.h"
+#include "tmv.h"
+#include "trace.h"
 
 /* globals */
 
 int sk_tx_timeout = 1;
 int sk_check_fupsync;
+int sk_hwts_filter = HWTS_FILTER_NORMAL;
 
 /* private methods */
 
-static int hwts_init(int fd, const char *device, int rx_filter, int one_step)
+/* What a receive filter covers, the layers first and then the messages */
+#define RXF_L2		(1 << 0)
+#define RXF_L4		(1 << 1)
+#define RXF_SYNC	(1 << 2)
+#define RXF_DELAY_REQ	(1 << 3)
+#define RXF_EVENT	(RXF_SYNC | RXF_DELAY_REQ | (1 << 4))
+#define RXF_ALL		(RXF_L2 | RXF_L4 | RXF_EVENT | (1 << 5))
+
+static const struct {
+	int filter;
+	int covers;
+	const char *name;
+	const char *cost;
+} hwts_filters[] = {
+	{ HWTSTAMP_FILTER_ALL, RXF_ALL,
+	  "all", "every received packet" },
+	{ HWTSTAMP_FILTER_PTP_V2_EVENT, RXF_L2 | RXF_L4 | RXF_EVENT,
+	  "ptp_v2_event", "all PTP event messages" },
+	{ HWTSTAMP_FILTER_PTP_V2_L4_EVENT, RXF_L4 | RXF_EVENT,
+	  "ptp_v2_l4_event", "PTP event messages over UDP" },
+	{ HWTSTAMP_FILTER_PTP_V2_L2_EVENT, RXF_L2 | RXF_EVENT,
+	  "ptp_v2_l2_event", "PTP event messages over Ethernet" },
+	{ HWTSTAMP_FILTER_PTP_V2_SYNC, RXF_L2 | RXF_L4 | RXF_SYNC,
+	  "ptp_v2_sync", "PTP Sync messages" },
+	{ HWTSTAMP_FILTER_PTP_V2_L4_SYNC, RXF_L4 | RXF_SYNC,
+	  "ptp_v2_l4_sync", "PTP Sync messages over UDP" },
+	{ HWTSTAMP_FILTER_PTP_V2_L2_SYNC, RXF_L2 | RXF_SYNC,
+	  "ptp_v2_l2_sync", "PTP Sync messages over Ethernet" },
+	{ HWTSTAMP_FILTER_PTP_V2_DELAY_REQ, RXF_L2 | RXF_L4 | RXF_DELAY_REQ,
+	  "ptp_v2_delay_req", "PTP Delay_Req messages" },
+	{ HWTSTAMP_FILTER_PTP_V2_L4_DELAY_REQ, RXF_L4 | RXF_DELAY_REQ,
+	  "ptp_v2_l4_delay_req", "PTP Delay_Req messages over UDP" },
+	{ HWTSTAMP_FILTER_PTP_V2_L2_DELAY_REQ, RXF_L2 | RXF_DELAY_REQ,
+	  "ptp_v2_l2_delay_req", "PTP Delay_Req messages over Ethernet" },
+};
+
+#define N_HWTS_FILTERS (sizeof(hwts_filters) / sizeof(hwts_filters[0]))
+
+static int hwts_filter_index(int filter)
+{
+	int i;
+
+	for (i = 0; i < N_HWTS_FILTERS; i++) {
+		if (hwts_filters[i].filter == filter)
+			return i;
+	}
+	return -1;
+}
+
+static const char *hwts_filter_name(int filter)
+{
+	int i = hwts_filter_index(filter);
+
+	return i < 0 ? "unknown" : hwts_filters[i].name;
+}
+
+/* Tell whether the granted filter time stamps everything wanted. */
+static int hwts_filter_covers(int granted, int wanted)
+{
+	int g = hwts_filter_index(granted), w = hwts_filter_index(wanted);
+
+	if (g < 0 || w < 0)
+		return granted == wanted;
+
+	return (hwts_filters[g].covers & hwts_filters[w].covers) ==
+		hwts_filters[w].covers;
+}
+
+static int hwts_init(int fd, const char *device, int rx_filter, int tx_type,
+		     int *granted)
 {
 	struct ifreq ifreq;
 	struct hwtstamp_config cfg, req;
@@ -53,9 +132,24 @@ static int hwts_init(int fd, const char *device, int rx_filter, int one_step)
 	memset(&cfg, 0, sizeof(cfg));
 
 	strncpy(ifreq.ifr_name, device, sizeof(ifreq.ifr_name) - 1);
-
 	ifreq.ifr_data = (void *) &cfg;
-	cfg.tx_type    = one_step ? HWTSTAMP_TX_ONESTEP_SYNC : HWTSTAMP_TX_ON;
+
+	/*
+	 * Reconfiguring the time stamping unit can take a driver a long
+	 * time, so leave it alone if it already does what we want. A
+	 * broader filter is good enough, unless a narrow one was asked
+	 * for to spare the other traffic.
+	 */
+	if (!ioctl(fd, SIOCGHWTSTAMP, &ifreq) && cfg.tx_type == tx_type &&
+	    (cfg.rx_filter == rx_filter ||
+	     (sk_hwts_filter == HWTS_FILTER_NORMAL &&
+	      hwts_filter_covers(cfg.rx_filter, rx_filter)))) {
+		*granted = cfg.rx_filter;
+		return 0;
+	}
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.tx_type    = tx_type;
 	cfg.rx_filter  = rx_filter;
 	req = cfg;
 	err = ioctl(fd, SIOCSHWTSTAMP, &ifreq);
@@ -69,17 +163,117 @@ static int hwts_init(int fd, const char *device, int rx_filter, int one_step)
 		pr_warning("rx_filter %d not %d", cfg.rx_filter, req.rx_filter);
 
 		if (cfg.tx_type != req.tx_type ||
-		    (cfg.rx_filter != HWTSTAMP_FILTER_ALL &&
-		     cfg.rx_filter != HWTSTAMP_FILTER_PTP_V2_EVENT)) {
+		    !hwts_filter_covers(cfg.rx_filter, req.rx_filter)) {
 			return -1;
 		}
 	}
 
+	*granted = cfg.rx_filter;
+	return 0;
+}
+
+static int hwts_config(int fd, const char *device, enum timestamp_type type,
+		       enum transport_type transport)
+{
+	int i, n = 0, err, filters[4], granted, tx_type = HWTSTAMP_TX_ON;
+
+	switch (type) {
+	case TS_ONESTEP:
+		tx_type = HWTSTAMP_TX_ONESTEP_SYNC;
+		break;
+	case TS_P2P1STEP:
+		tx_type = HWTSTAMP_TX_ONESTEP_P2P;
+		break;
+	default:
+		break;
+	}
+
+	/* Try the narrow filters first, the most general one of each kind. */
+	switch (transport) {
+	case TRANS_UDP_IPV4:
+	case TRANS_UDP_IPV6:
+		if (sk_hwts_filter == HWTS_FILTER_SYNC) {
+			filters[n++] = HWTSTAMP_FILTER_PTP_V2_SYNC;
+			filters[n++] = HWTSTAMP_FILTER_PTP_V2_L4_SYNC;
+		} else if (sk_hwts_filter == HWTS_FILTER_DELAY_REQ) {
+			filters[n++] = HWTSTAMP_FILTER_PTP_V2_DELAY_REQ;
+			filters[n++] = HWTSTAMP_FILTER_PTP_V2_L4_DELAY_REQ;
+		}
+		filters[n++] = HWTSTAMP_FILTER_PTP_V2_EVENT;
+		filters[n++] = HWTSTAMP_FILTER_PTP_V2_L4_EVENT;
+		break;
+	case TRANS_IEEE_802_3:
+		if (sk_hwts_filter == HWTS_FILTER_SYNC) {
+			filters[n++] = HWTSTAMP_FILTER_PTP_V2_SYNC;
+			filters[n++] = HWTSTAMP_FILTER_PTP_V2_L2_SYNC;
+		} else if (sk_hwts_filter == HWTS_FILTER_DELAY_REQ) {
+			filters[n++] = HWTSTAMP_FILTER_PTP_V2_DELAY_REQ;
+			filters[n++] = HWTSTAMP_FILTER_PTP_V2_L2_DELAY_REQ;
+		}
+		filters[n++] = HWTSTAMP_FILTER_PTP_V2_EVENT;
+		filters[n++] = HWTSTAMP_FILTER_PTP_V2_L2_EVENT;
+		break;
+	case TRANS_DEVICENET:
+	case TRANS_CONTROLNET:
+	case TRANS_PROFINET:
+	case TRANS_UDS:
+	case TRANS_XDP:
+	case TRANS_REPLAY:
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		err = hwts_init(fd, device, filters[i], tx_type, &granted);
+		if (!err)
+			break;
+		pr_info("driver rejected HWTSTAMP filter %s",
+			hwts_filter_name(filters[i]));
+	}
+	if (i == n) {
+		pr_err("ioctl SIOCSHWTSTAMP failed: %m");
+		return -1;
+	}
+
+	i = hwts_filter_index(granted);
+	pr_info("%s: rx_filter %s, time stamping %s", device,
+		hwts_filter_name(granted), i < 0 ? "unknown packets" :
+		hwts_filters[i].cost);
+	if (granted == HWTSTAMP_FILTER_ALL)
+		pr_warning("%s: time stamping all received packets may slow "
+			   "down other traffic", device);
+
 	return 0;
 }
 
 /* public methods */
 
+int sk_hwts_prepare(const char *device, enum timestamp_type type,
+		    enum transport_type transport)
+{
+	int err, fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		pr_err("socket failed: %m");
+		return -1;
+	}
+	err = hwts_config(fd, device, type, transport);
+	close(fd);
+	return err;
+}
+
+int sk_hwts_filtered(int msgtype)
+{
+	switch (sk_hwts_filter) {
+	case HWTS_FILTER_SYNC:
+		return msgtype != SYNC;
+	case HWTS_FILTER_DELAY_REQ:
+		return msgtype != DELAY_REQ;
+	default:
+		return 0;
+	}
+}
+
 int sk_interface_index(int fd, const char *name)
 {
 	struct ifreq ifreq;
@@ -97,7 +291,11 @@ int sk_interface_index(int fd, const char *name)
 
 int sk_general_init(int fd)
 {
-	int on = sk_check_fupsync ? 1 : 0;
+	int on = 1;
+
+	/* Leave the general messages without any receive time stamp. */
+	if (!sk_check_fupsync)
+		return 0;
 	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0) {
 		pr_err("ioctl SO_TIMESTAMPNS failed: %m");
 		return -1;
@@ -178,6 +376,23 @@ int sk_interface_macaddr(const char *name, struct address *mac)
 	return 0;
 }
 
+int sk_interface_numa_node(const char *name)
+{
+	char path[64 + IF_NAMESIZE];
+	int node = -1;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node",
+		 name);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "%d", &node) != 1)
+		node = -1;
+	fclose(f);
+	return node;
+}
+
 int sk_interface_addr(const char *name, int family, struct address *addr)
 {
 	struct ifaddrs *ifaddr, *i;
@@ -214,50 +429,36 @@ int sk_interface_addr(const char *name, int family, struct address *addr)
 static short sk_events = POLLPRI;
 static short sk_revents = POLLPRI;
 
-int sk_receive(int fd, void *buf, int buflen,
-	       struct address *addr, struct hw_timestamp *hwts, int flags)
+static int sk_receive_ts(struct msghdr *msg, struct hw_timestamp *hwts)
 {
-	char control[256];
-	int cnt = 0, res = 0, level, type;
+	int level, type;
 	struct cmsghdr *cm;
-	struct iovec iov = { buf, buflen };
-	struct msghdr msg;
+	struct sock_extended_err *err;
 	struct timespec *sw, *ts = NULL;
 
-	memset(control, 0, sizeof(control));
-	memset(&msg, 0, sizeof(msg));
-	if (addr) {
-		msg.msg_name = &addr->ss;
-		msg.msg_namelen = sizeof(addr->ss);
-	}
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
-	msg.msg_control = control;
-	msg.msg_controllen = sizeof(control);
-
-	if (flags == MSG_ERRQUEUE) {
-		struct pollfd pfd = { fd, sk_events, 0 };
-		res = poll(&pfd, 1, sk_tx_timeout);
-		if (res < 1) {
-			pr_err(res ? "poll for tx timestamp failed: %m" :
-			             "timed out while polling for tx timestamp");
-			pr_err("increasing tx_timestamp_timeout may correct "
-			       "this issue, but it is likely caused by a driver bug");
-			return res;
-		} else if (!(pfd.revents & sk_revents)) {
-			pr_err("poll for tx timestamp woke up on non ERR event");
-			return -1;
-		}
-	}
-
-	cnt = recvmsg(fd, &msg, flags);
-	if (cnt < 1)
-		pr_err("recvmsg%sfailed: %m",
-		       flags == MSG_ERRQUEUE ? " tx timestamp " : " ");
+	hwts->id_valid = 0;
 
-	for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+	for (cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm)) {
 		level = cm->cmsg_level;
 		type  = cm->cmsg_type;
+		if ((SOL_IP == level && IP_RECVERR == type) ||
+		    (SOL_IPV6 == level && IPV6_RECVERR == type) ||
+		    (SOL_PACKET == level && PACKET_TX_TIMESTAMP == type)) {
+			if (cm->cmsg_len < CMSG_LEN(sizeof(*err)))
+				continue;
+			err = (struct sock_extended_err *) CMSG_DATA(cm);
+			if (err->ee_origin == SO_EE_ORIGIN_TXTIME) {
+				pr_err("message dropped: %s",
+				       err->ee_code == SO_EE_CODE_TXTIME_MISSED ?
+				       "launch time missed" :
+				       "invalid launch time");
+				return -1;
+			}
+			if (err->ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+				continue;
+			hwts->id = err->ee_data;
+			hwts->id_valid = 1;
+		}
 		if (SOL_SOCKET == level && SO_TIMESTAMPING == type) {
 			if (cm->cmsg_len < sizeof(*ts) * 3) {
 				pr_warning("short SO_TIMESTAMPING message");
@@ -275,12 +476,9 @@ int sk_receive(int fd, void *buf, int buflen,
 		}
 	}
 
-	if (addr)
-		addr->len = msg.msg_namelen;
-
 	if (!ts) {
 		memset(&hwts->ts, 0, sizeof(hwts->ts));
-		return cnt;
+		return 0;
 	}
 
 	switch (hwts->type) {
@@ -289,15 +487,485 @@ int sk_receive(int fd, void *buf, int buflen,
 		break;
 	case TS_HARDWARE:
 	case TS_ONESTEP:
+	case TS_P2P1STEP:
 		hwts->ts = ts[2];
 		break;
 	case TS_LEGACY_HW:
 		hwts->ts = ts[1];
 		break;
 	}
+	return 0;
+}
+
+static void sk_trace_rx(struct hw_timestamp *hwts)
+{
+	struct timespec now;
+
+	if (!trace_enabled())
+		return;
+	if (hwts->type != TS_SOFTWARE ||
+	    (!hwts->ts.tv_sec && !hwts->ts.tv_nsec)) {
+		trace(TRACE_RX, 0, 0, 0,
+		      hwts->ts.tv_sec * NS_PER_SEC + hwts->ts.tv_nsec);
+		return;
+	}
+	clock_gettime(CLOCK_REALTIME, &now);
+	trace(TRACE_RX_SW, 0, 0, 0,
+	      (now.tv_sec - hwts->ts.tv_sec) * NS_PER_SEC +
+	      now.tv_nsec - hwts->ts.tv_nsec);
+}
+
+static int sk_recv_errqueue(int fd, void *buf, int buflen,
+			    struct hw_timestamp *hwts, int flags)
+{
+	char control[256];
+	struct iovec iov = { buf, buflen };
+	struct msghdr msg;
+	int cnt;
+
+	memset(control, 0, sizeof(control));
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cnt = recvmsg(fd, &msg, MSG_ERRQUEUE | flags);
+	if (cnt < 0)
+		return cnt;
+	if (sk_receive_ts(&msg, hwts))
+		return -1;
+	/*
+	 * The kernel only hands out a meaningful key with
+	 * SOF_TIMESTAMPING_OPT_ID, which we always pair with OPT_TSONLY.
+	 * A looped back payload means the key is not to be trusted.
+	 */
+	if (cnt > 0)
+		hwts->id_valid = 0;
 	return cnt;
 }
 
+static int sk_receive_errqueue(int fd, void *buf, int buflen,
+			       struct hw_timestamp *hwts)
+{
+	unsigned int id = hwts->id;
+	struct timespec start, now;
+	int cnt, limit, res, timeout;
+	int64_t ahead = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	limit = sk_tx_timeout;
+	/* A message with a launch time leaves only later. */
+	if (hwts->txtime) {
+		clock_gettime(CLOCK_TAI, &now);
+		ahead = hwts->txtime - (now.tv_sec * NS_PER_SEC + now.tv_nsec);
+		if (ahead > 0)
+			limit += (ahead + 999999) / 1000000;
+		else
+			ahead = 0;
+	}
+	timeout = limit;
+
+	while (1) {
+		struct pollfd pfd = { fd, sk_events, 0 };
+		res = poll(&pfd, 1, timeout);
+		if (res < 1) {
+			pr_err(res ? "poll for tx timestamp failed: %m" :
+			             "timed out while polling for tx timestamp");
+			pr_err("increasing tx_timestamp_timeout may correct "
+			       "this issue, but it is likely caused by a driver bug");
+			return res;
+		} else if (!(pfd.revents & sk_revents)) {
+			pr_err("poll for tx timestamp woke up on non ERR event");
+			return -1;
+		}
+
+		cnt = sk_recv_errqueue(fd, buf, buflen, hwts, 0);
+		if (cnt < 0) {
+			pr_err("recvmsg tx timestamp failed: %m");
+			return -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		hwts->wait = (now.tv_sec - start.tv_sec) * NS_PER_SEC +
+			now.tv_nsec - start.tv_nsec - ahead;
+		if (!hwts->id_valid) {
+			if (!cnt) {
+				pr_err("recvmsg tx timestamp failed: no data");
+				return -1;
+			}
+			return cnt;
+		}
+		/*
+		 * Nothing was sent after the message we are waiting for,
+		 * so a key at or beyond the expected one is ours. With
+		 * OPT_TSONLY there is no payload to count.
+		 */
+		if ((int) (hwts->id - id) >= 0) {
+			return cnt > 0 ? cnt : 1;
+		}
+		/* A late time stamp of an earlier message, drop it. */
+		pr_debug("dropping tx timestamp with key %u, expected %u",
+			 hwts->id, id);
+
+		timeout = limit -
+			((now.tv_sec - start.tv_sec) * 1000 +
+			 (now.tv_nsec - start.tv_nsec) / 1000000);
+		if (timeout < 0)
+			timeout = 0;
+	}
+}
+
+int sk_receive(int fd, void *buf, int buflen,
+	       struct address *addr, struct hw_timestamp *hwts, int flags)
+{
+	char control[256];
+	int cnt = 0;
+	struct iovec iov = { buf, buflen };
+	struct msghdr msg;
+
+	if (flags == MSG_ERRQUEUE)
+		return sk_receive_errqueue(fd, buf, buflen, hwts);
+
+	memset(control, 0, sizeof(control));
+	memset(&msg, 0, sizeof(msg));
+	if (addr) {
+		msg.msg_name = &addr->ss;
+		msg.msg_namelen = sizeof(addr->ss);
+	}
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cnt = recvmsg(fd, &msg, flags);
+	if (cnt < 1)
+		pr_err("recvmsg failed: %m");
+
+	if (sk_receive_ts(&msg, hwts))
+		return -1;
+
+	if (cnt > 0)
+		sk_trace_rx(hwts);
+
+	if (addr)
+		addr->len = msg.msg_namelen;
+
+	return cnt;
+}
+
+int sk_receive_txts(int fd, void *buf, int *len, struct hw_timestamp *hwts)
+{
+	int cnt;
+
+	cnt = sk_recv_errqueue(fd, buf, *len, hwts, MSG_DONTWAIT);
+	if (cnt < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		pr_err("recvmsg tx timestamp failed: %m");
+		return -1;
+	}
+	if (!cnt && !hwts->id_valid)
+		return 0;
+
+	*len = cnt;
+	return 1;
+}
+
+int sk_receive_batch(int fd, struct sk_rxbuf *rx, int n)
+{
+	char control[SK_RX_BATCH][256];
+	struct iovec iov[SK_RX_BATCH];
+	struct mmsghdr mmsg[SK_RX_BATCH];
+	int cnt, i;
+
+	if (n > SK_RX_BATCH)
+		n = SK_RX_BATCH;
+
+	memset(mmsg, 0, n * sizeof(mmsg[0]));
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = rx[i].buf;
+		iov[i].iov_len = rx[i].buflen;
+		if (rx[i].addr) {
+			mmsg[i].msg_hdr.msg_name = &rx[i].addr->ss;
+			mmsg[i].msg_hdr.msg_namelen = sizeof(rx[i].addr->ss);
+		}
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+		mmsg[i].msg_hdr.msg_control = control[i];
+		mmsg[i].msg_hdr.msg_controllen = sizeof(control[i]);
+	}
+
+	cnt = recvmmsg(fd, mmsg, n, MSG_DONTWAIT, NULL);
+	if (cnt < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		pr_err("recvmmsg failed: %m");
+		return -1;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		rx[i].cnt = mmsg[i].msg_len;
+		if (sk_receive_ts(&mmsg[i].msg_hdr, rx[i].hwts))
+			rx[i].cnt = -1;
+		else
+			sk_trace_rx(rx[i].hwts);
+		if (rx[i].addr)
+			rx[i].addr->len = mmsg[i].msg_hdr.msg_namelen;
+	}
+	return cnt;
+}
+
+int sk_send_batch(int fd, struct sk_txbuf *tx, int n)
+{
+	struct iovec iov[SK_TX_BATCH];
+	struct mmsghdr mmsg[SK_TX_BATCH];
+	int cnt, i;
+
+	if (n > SK_TX_BATCH)
+		n = SK_TX_BATCH;
+
+	memset(mmsg, 0, n * sizeof(mmsg[0]));
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = tx[i].buf;
+		iov[i].iov_len = tx[i].len;
+		if (tx[i].addr) {
+			mmsg[i].msg_hdr.msg_name = &tx[i].addr->sa;
+			mmsg[i].msg_hdr.msg_namelen = tx[i].addr->len;
+		}
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	cnt = sendmmsg(fd, mmsg, n, 0);
+	if (cnt < 0)
+		pr_err("sendmmsg failed: %m");
+	return cnt;
+}
+
+int sk_set_filter(int fd, int offset, int domain, int types)
+{
+	struct sock_filter code[] = {
+		/* domainNumber */
+		BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, offset + 4),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, domain, 0, 7),
+		/* 1 << messageType */
+		BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, offset),
+		BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x0f),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD  | BPF_IMM, 1),
+		BPF_STMT(BPF_ALU | BPF_LSH | BPF_X, 0),
+		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, types, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xffff),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog prg = { sizeof(code) / sizeof(code[0]), code };
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prg, sizeof(prg))) {
+		pr_err("setsockopt SO_ATTACH_FILTER failed: %m");
+		return -1;
+	}
+	return 0;
+}
+
+#ifdef HAVE_REUSEPORT_EBPF
+
+#define INSN(c, d, s, o, i) \
+	{ .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) }
+
+#define N_STEER_PROG	18
+#define STEER_PROG_OFF	1
+#define STEER_PROG_MAP	10
+
+/*
+ * Hands a datagram to the socket registered under its domainNumber,
+ * or leaves the choice to the kernel when there is none.
+ */
+static struct bpf_insn steer_prog[N_STEER_PROG] = {
+	INSN(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),    /* r6 = ctx */
+	INSN(BPF_ALU64 | BPF_MOV | BPF_K, 2, 0, 0, 0),    /* r2 = offset */
+	INSN(BPF_ALU64 | BPF_MOV | BPF_X, 3, 10, 0, 0),
+	INSN(BPF_ALU64 | BPF_ADD | BPF_K, 3, 0, 0, -8),
+	INSN(BPF_ALU64 | BPF_MOV | BPF_K, 4, 0, 0, 1),
+	INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_skb_load_bytes),
+	INSN(BPF_JMP | BPF_JNE | BPF_K, 0, 0, 9, 0),      /* goto pass */
+	INSN(BPF_LDX | BPF_B | BPF_MEM, 2, 10, -8, 0),
+	INSN(BPF_STX | BPF_W | BPF_MEM, 10, 2, -4, 0),    /* key = domain */
+	INSN(BPF_ALU64 | BPF_MOV | BPF_X, 1, 6, 0, 0),
+	INSN(BPF_LD | BPF_DW | BPF_IMM, 2, BPF_PSEUDO_MAP_FD, 0, 0),
+	INSN(0, 0, 0, 0, 0),
+	INSN(BPF_ALU64 | BPF_MOV | BPF_X, 3, 10, 0, 0),
+	INSN(BPF_ALU64 | BPF_ADD | BPF_K, 3, 0, 0, -4),
+	INSN(BPF_ALU64 | BPF_MOV | BPF_K, 4, 0, 0, 0),
+	INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_sk_select_reuseport),
+	INSN(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, SK_PASS), /* pass: */
+	INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+};
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/* Opens the socket map of a group, creating and pinning it if needed. */
+static int steer_map(const char *path)
+{
+	union bpf_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.pathname = (uintptr_t) path;
+	fd = sys_bpf(BPF_OBJ_GET, &attr);
+	if (fd >= 0 || errno != ENOENT)
+		return fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_REUSEPORT_SOCKARRAY;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(uint64_t);
+	attr.max_entries = 256;
+	fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (fd < 0)
+		return fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.pathname = (uintptr_t) path;
+	attr.bpf_fd = fd;
+	if (!sys_bpf(BPF_OBJ_PIN, &attr))
+		return fd;
+	close(fd);
+	if (errno != EEXIST)
+		return -1;
+	/* Another instance got there first. */
+	memset(&attr, 0, sizeof(attr));
+	attr.pathname = (uintptr_t) path;
+	return sys_bpf(BPF_OBJ_GET, &attr);
+}
+
+int sk_set_reuseport_steering(int fd, const char *path, int offset,
+			      const uint8_t *domains, int n)
+{
+	int i, map_fd, prog_fd = -1, err = -1;
+	union bpf_attr attr;
+	uint32_t key;
+	uint64_t val = fd;
+
+	map_fd = steer_map(path);
+	if (map_fd < 0) {
+		pr_err("opening the socket map %s failed: %m", path);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		key = domains[i];
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = map_fd;
+		attr.key = (uintptr_t) &key;
+		attr.value = (uintptr_t) &val;
+		if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr)) {
+			pr_err("adding the socket to %s failed: %m", path);
+			goto out;
+		}
+	}
+
+	steer_prog[STEER_PROG_OFF].imm = offset + 4;
+	steer_prog[STEER_PROG_MAP].imm = map_fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_SK_REUSEPORT;
+	attr.insns = (uintptr_t) steer_prog;
+	attr.insn_cnt = N_STEER_PROG;
+	attr.license = (uintptr_t) "GPL";
+	prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (prog_fd < 0) {
+		pr_err("loading the steering program failed: %m");
+		goto out;
+	}
+	/* The group keeps the program, and the program keeps the map. */
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_EBPF,
+		       &prog_fd, sizeof(prog_fd))) {
+		pr_err("setsockopt SO_ATTACH_REUSEPORT_EBPF failed: %m");
+		goto out;
+	}
+	err = 0;
+out:
+	if (prog_fd >= 0)
+		close(prog_fd);
+	close(map_fd);
+	return err;
+}
+
+#else
+
+int sk_set_reuseport_steering(int fd, const char *path, int offset,
+			      const uint8_t *domains, int n)
+{
+	pr_err("socket steering not supported");
+	return -1;
+}
+
+#endif
+
+int sk_send(int fd, void *buf, int len, struct address *addr,
+	    uint64_t txtime)
+{
+	char control[CMSG_SPACE(sizeof(txtime))];
+	struct iovec iov = { buf, len };
+	struct cmsghdr *cm;
+	struct msghdr msg;
+
+	if (!txtime) {
+		return addr ? sendto(fd, buf, len, 0, &addr->sa, addr->len) :
+			send(fd, buf, len, 0);
+	}
+	memset(control, 0, sizeof(control));
+	memset(&msg, 0, sizeof(msg));
+	if (addr) {
+		msg.msg_name = &addr->ss;
+		msg.msg_namelen = addr->len;
+	}
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_TXTIME;
+	cm->cmsg_len = CMSG_LEN(sizeof(txtime));
+	memcpy(CMSG_DATA(cm), &txtime, sizeof(txtime));
+
+	return sendmsg(fd, &msg, 0);
+}
+
+int sk_set_txtime(int fd, int report)
+{
+	struct sock_txtime cfg = {
+		.clockid = CLOCK_TAI,
+		.flags = report ? SOF_TXTIME_REPORT_ERRORS : 0,
+	};
+
+	if (setsockopt(fd, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg))) {
+		pr_err("setsockopt SO_TXTIME failed: %m");
+		return -1;
+	}
+	return 0;
+}
+
+int sk_set_busy_poll(int fd, int usec, int prefer)
+{
+	if (usec &&
+	    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec))) {
+		pr_warning("setsockopt SO_BUSY_POLL failed: %m");
+		return -1;
+	}
+	if (prefer &&
+	    setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+		       &prefer, sizeof(prefer))) {
+		pr_warning("setsockopt SO_PREFER_BUSY_POLL failed: %m");
+		return -1;
+	}
+	return 0;
+}
+
 int sk_set_priority(int fd, uint8_t dscp)
 {
 	int tos;
@@ -324,7 +992,7 @@ int sk_set_priority(int fd, uint8_t dscp)
 int sk_timestamping_init(int fd, const char *device, enum timestamp_type type,
 			 enum transport_type transport)
 {
-	int err, filter1, filter2 = 0, flags, one_step;
+	int flags, keyed = 0, opt;
 
 	switch (type) {
 	case TS_SOFTWARE:
@@ -334,6 +1002,7 @@ int sk_timestamping_init(int fd, const char *device, enum timestamp_type type,
 		break;
 	case TS_HARDWARE:
 	case TS_ONESTEP:
+	case TS_P2P1STEP:
 		flags = SOF_TIMESTAMPING_TX_HARDWARE |
 			SOF_TIMESTAMPING_RX_HARDWARE |
 			SOF_TIMESTAMPING_RAW_HARDWARE;
@@ -347,36 +1016,28 @@ int sk_timestamping_init(int fd, const char *device, enum timestamp_type type,
 		return -1;
 	}
 
-	if (type != TS_SOFTWARE) {
-		filter1 = HWTSTAMP_FILTER_PTP_V2_EVENT;
-		one_step = type == TS_ONESTEP ? 1 : 0;
-		switch (transport) {
-		case TRANS_UDP_IPV4:
-		case TRANS_UDP_IPV6:
-			filter2 = HWTSTAMP_FILTER_PTP_V2_L4_EVENT;
-			break;
-		case TRANS_IEEE_802_3:
-			filter2 = HWTSTAMP_FILTER_PTP_V2_L2_EVENT;
-			break;
-		case TRANS_DEVICENET:
-		case TRANS_CONTROLNET:
-		case TRANS_PROFINET:
-		case TRANS_UDS:
-			return -1;
-		}
-		err = hwts_init(fd, device, filter1, one_step);
-		if (err) {
-			pr_info("driver rejected most general HWTSTAMP filter");
-			err = hwts_init(fd, device, filter2, one_step);
-			if (err) {
-				pr_err("ioctl SIOCSHWTSTAMP failed: %m");
-				return err;
-			}
+	if (type != TS_SOFTWARE && hwts_config(fd, device, type, transport)) {
+		return -1;
+	}
+
+	/*
+	 * On UDP sockets, have the kernel key each transmit time stamp
+	 * and leave out the looped back packet. Older kernels reject
+	 * these options, and then the payload is matched instead.
+	 */
+	if (transport == TRANS_UDP_IPV4 || transport == TRANS_UDP_IPV6) {
+		opt = flags | SOF_TIMESTAMPING_OPT_ID |
+			SOF_TIMESTAMPING_OPT_TSONLY;
+		keyed = !setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING,
+				    &opt, sizeof(opt));
+		if (!keyed) {
+			pr_info("%s: keyed tx time stamps not supported: %m",
+				device);
 		}
 	}
 
-	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING,
-		       &flags, sizeof(flags)) < 0) {
+	if (!keyed && setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING,
+				 &flags, sizeof(flags)) < 0) {
 		pr_err("ioctl SO_TIMESTAMPING failed: %m");
 		return -1;
 	}
@@ -39,6 +39,19 @@ struct sk_ts_info {
 	unsigned int rx_filters;
 };
 
+/**
+ * Configure the hardware time stamping unit of a network interface
+ * ahead of opening any sockets on it. This lets the slow driver
+ * reconfiguration of many interfaces proceed in parallel, after which
+ * sk_timestamping_init() finds the interface already set up.
+ * @param device      The name of the network interface to configure.
+ * @param type        The requested flavor of time stamping.
+ * @param transport   The type of transport to be used.
+ * @return            Zero on success, non-zero otherwise.
+ */
+int sk_hwts_prepare(const char *device, enum timestamp_type type,
+		    enum transport_type transport);
+
 /**
  * Obtain the numerical index from a network interface by name.
  * @param fd      An open socket.
@@ -48,7 +61,8 @@ struct sk_ts_info {
 int sk_interface_index(int fd, const char *device);
 
 /**
- * Prepare a given socket for PTP "general" messages.
+ * Prepare a given socket for PTP "general" messages. Receive time
+ * stamps are requested only when sk_check_fupsync is set.
  * @param fd  An open socket.
  * @return    Zero on success, non-zero otherwise.
  */
@@ -70,6 +84,13 @@ int sk_get_ts_info(const char *name, struct sk_ts_info *sk_info);
  */
 int sk_interface_macaddr(const char *name, struct address *mac);
 
+/**
+ * Obtain the NUMA node of the device of a network interface.
+ * @param name  The name of the interface
+ * @return      The node, or -1 if it is not known.
+ */
+int sk_interface_numa_node(const char *name);
+
 /**
  * Obtains the first IP address assigned to a network interface.
  * @param name   The name of the interface
@@ -80,7 +101,9 @@ int sk_interface_macaddr(const char *name, struct address *mac);
 int sk_interface_addr(const char *name, int family, struct address *addr);
 
 /**
- * Read a message from a socket.
+ * Read a message from a socket. With MSG_ERRQUEUE, this waits for the
+ * time stamp of the event message just sent, whose key is passed in
+ * hwts->id. Older time stamps found in the error queue are dropped.
  * @param fd      An open socket.
  * @param buf     Buffer to receive the message.
  * @param buflen  Size of 'buf' in bytes.
@@ -88,11 +111,154 @@ int sk_interface_addr(const char *name, int family, struct address *addr);
  *                address. May be NULL.
  * @param hwts    Pointer to a buffer to receive the message's time stamp.
  * @param flags   Flags to pass to RECV(2).
- * @return
+ * @return        The length of the message, or with MSG_ERRQUEUE a
+ *                positive value when the time stamp was received. Zero
+ *                or negative on failure.
  */
 int sk_receive(int fd, void *buf, int buflen,
 	       struct address *addr, struct hw_timestamp *hwts, int flags);
 
+/**
+ * Read one transmit time stamp from a socket's error queue without
+ * blocking. Sockets set up for UDP return only the time stamp and the
+ * key of the packet, other sockets return the looped back packet.
+ * @param fd      An open socket.
+ * @param buf     Buffer to receive the looped back packet.
+ * @param len     On entry the size of 'buf' in bytes, on return the
+ *                length of the looped back packet.
+ * @param hwts    Pointer to a buffer to receive the time stamp. The key
+ *                is marked valid when the packet was not returned.
+ * @return        One if a time stamp was read, zero if the error queue
+ *                is empty, or negative on failure.
+ */
+int sk_receive_txts(int fd, void *buf, int *len, struct hw_timestamp *hwts);
+
+/** Maximum number of messages read by one call to sk_receive_batch(). */
+#define SK_RX_BATCH 16
+
+/**
+ * Describes one receive buffer for sk_receive_batch().
+ * @buf:     Buffer to receive the message.
+ * @buflen:  Size of 'buf' in bytes.
+ * @addr:    Pointer to a buffer to receive the message's source
+ *           address. May be NULL.
+ * @hwts:    Pointer to a buffer to receive the message's time stamp.
+ * @cnt:     Set to the length of the received message, or to a
+ *           negative value if the message's control data was invalid.
+ */
+struct sk_rxbuf {
+	void *buf;
+	int buflen;
+	struct address *addr;
+	struct hw_timestamp *hwts;
+	int cnt;
+};
+
+/**
+ * Read all pending messages from a socket, up to a limit, without
+ * blocking.
+ * @param fd      An open socket.
+ * @param rx      Array of receive buffers.
+ * @param n       Number of elements in 'rx', at most SK_RX_BATCH.
+ * @return        The number of messages received, which may be zero,
+ *                or negative on failure.
+ */
+int sk_receive_batch(int fd, struct sk_rxbuf *rx, int n);
+
+/** Maximum number of messages sent by one call to sk_send_batch(). */
+#define SK_TX_BATCH 16
+
+/**
+ * Describes one message for sk_send_batch().
+ * @buf:     The message.
+ * @len:     Length of 'buf' in bytes.
+ * @addr:    Destination address, or NULL on a socket that needs none.
+ */
+struct sk_txbuf {
+	void *buf;
+	int len;
+	struct address *addr;
+};
+
+/**
+ * Send a number of messages with a single system call.
+ * @param fd      An open socket.
+ * @param tx      Array of messages.
+ * @param n       Number of elements in 'tx', at most SK_TX_BATCH.
+ * @return        The number of messages sent, or negative on failure.
+ */
+int sk_send_batch(int fd, struct sk_txbuf *tx, int n);
+
+/**
+ * The message types, as used in the mask passed to sk_set_filter(),
+ * that are carried by the event socket. The general socket carries
+ * the others.
+ */
+#define SK_EVENT_TYPES 0x00ff
+
+/**
+ * Attach a filter to a socket that accepts only PTP messages of the
+ * given domain and types.
+ * @param fd      An open socket.
+ * @param offset  Offset of the PTP header in the packets seen by the filter.
+ * @param domain  The domain number to accept.
+ * @param types   Bit mask of the message types to accept.
+ * @return        Zero on success, non-zero otherwise.
+ */
+int sk_set_filter(int fd, int offset, int domain, int types);
+
+/** Where the socket maps of sk_set_reuseport_steering() are pinned. */
+#define SK_BPF_PIN_DIR "/sys/fs/bpf"
+
+/** The most domains a socket may serve with sk_set_reuseport_steering(). */
+#define SK_STEER_DOMAINS 16
+
+/**
+ * Steer the unicast datagrams arriving at a group of sockets bound with
+ * SO_REUSEPORT to the member that serves their domain. The members
+ * register in a socket map pinned in the BPF file system, so separate
+ * processes may share the group.
+ * @param fd      A socket of the group, already bound.
+ * @param path    Where the socket map of the group is pinned.
+ * @param offset  Offset of the PTP header in the packets seen by the program.
+ * @param domains The domain numbers served by this socket.
+ * @param n       The number of entries in @a domains.
+ * @return        Zero on success, non-zero otherwise.
+ */
+int sk_set_reuseport_steering(int fd, const char *path, int offset,
+			      const uint8_t *domains, int n);
+
+/**
+ * Send a message, optionally at a given time. Launch times require
+ * sk_set_txtime() and a qdisc honoring them, such as ETF.
+ * @param fd      An open socket.
+ * @param buf     The message.
+ * @param len     The length of the message.
+ * @param addr    The destination, or NULL for a connected socket.
+ * @param txtime  The launch time on CLOCK_TAI in nanoseconds, zero
+ *                to send at once.
+ * @return        The number of bytes sent, or negative on failure.
+ */
+int sk_send(int fd, void *buf, int len, struct address *addr,
+	    uint64_t txtime);
+
+/**
+ * Enable launch times on CLOCK_TAI for a socket.
+ * @param fd      An open socket.
+ * @param report  Whether to report dropped messages on the error queue.
+ * @return        Zero on success, non-zero otherwise.
+ */
+int sk_set_txtime(int fd, int report);
+
+/**
+ * Let receive calls on a socket busy poll the device queue.
+ * @param fd      An open socket.
+ * @param usec    Time to poll for in microseconds, zero to leave unchanged.
+ * @param prefer  Whether to prefer busy polling over interrupt processing.
+ * @return        Zero on success, non-zero otherwise.
+ */
+int sk_set_busy_poll(int fd, int usec, int prefer);
+
 /**
  * Set DSCP value for socket.
  * @param fd    An open socket.
@@ -118,6 +284,32 @@ int sk_timestamping_init(int fd, const char *device, enum timestamp_type type,
  */
 extern int sk_tx_timeout;
 
+/**
+ * Selects which received event messages the hardware should time stamp.
+ * The narrow modes only work for ports which never need time stamps on
+ * the other event messages, e.g. the SYNC mode for a slave only clock
+ * using the E2E delay mechanism.
+ */
+enum hwts_filter_mode {
+	HWTS_FILTER_NORMAL,     /* all PTP event messages */
+	HWTS_FILTER_SYNC,       /* only Sync messages */
+	HWTS_FILTER_DELAY_REQ,  /* only Delay_Req messages */
+	HWTS_FILTER_AUTO,       /* resolved by the program from its role */
+};
+
+/**
+ * The hwts_filter_mode used when configuring the hardware time stamping.
+ */
+extern int sk_hwts_filter;
+
+/**
+ * Tell whether the time stamp of a received event message is missing
+ * because the hardware was asked not to time stamp it.
+ * @param msgtype  The type of the PTP message.
+ * @return         One if the message is excluded by sk_hwts_filter.
+ */
+int sk_hwts_filtered(int msgtype);
+
 /**
  * Enables the SO_TIMESTAMPNS socket option on the both the event and
  * general sockets in order to test the order of paired sync and
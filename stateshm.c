@@ -0,0 +1,203 @@
+/**
+ * @file stateshm.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "print.h"
+#include "stateshm.h"
+
+/* Weight of a new offset in the estimate of the error */
+#define ERROR_SMOOTH (1.0 / 16)
+
+struct stateshm {
+	struct stateshm_header *hdr;
+	struct stateshm_slot *slots;
+	double *variance;
+	size_t map_len;
+	int n;
+};
+
+static void name_copy(char *dst, const char *src)
+{
+	strncpy(dst, src ? src : "", STATESHM_NAME_LEN - 1);
+	dst[STATESHM_NAME_LEN - 1] = '\0';
+}
+
+static int hist_bin(int64_t value)
+{
+	int bin;
+
+	if (value < 0)
+		value = -value;
+	if (value < 1)
+		return 0;
+	bin = 1 + ilogb((double) value);
+	return bin < STATESHM_HIST_BINS ? bin : STATESHM_HIST_BINS - 1;
+}
+
+static void slot_begin(struct stateshm_slot *slot)
+{
+	atomic_fetch_add_explicit(&slot->seq, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static void slot_end(struct stateshm_slot *slot)
+{
+	atomic_fetch_add_explicit(&slot->seq, 1, memory_order_release);
+}
+
+struct stateshm *stateshm_create(const char *path, int slots)
+{
+	struct stateshm *s;
+	int fd;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->variance = calloc(slots, sizeof(*s->variance));
+	if (!s->variance) {
+		free(s);
+		return NULL;
+	}
+	s->n = slots;
+	s->map_len = sizeof(*s->hdr) + slots * sizeof(*s->slots);
+
+	if (!path) {
+		s->hdr = mmap(NULL, s->map_len, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (s->hdr == MAP_FAILED) {
+			pr_err("failed to map the state: %m");
+			goto err;
+		}
+		goto init;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		pr_err("failed to open state file %s: %m", path);
+		goto err;
+	}
+	if (ftruncate(fd, s->map_len)) {
+		pr_err("failed to size state file %s: %m", path);
+		close(fd);
+		goto err;
+	}
+	s->hdr = mmap(NULL, s->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      fd, 0);
+	close(fd);
+	if (s->hdr == MAP_FAILED) {
+		pr_err("failed to map state file %s: %m", path);
+		goto err;
+	}
+init:
+	memcpy(s->hdr->magic, STATESHM_MAGIC, sizeof(s->hdr->magic));
+	s->hdr->version = STATESHM_VERSION;
+	s->hdr->slot_size = sizeof(struct stateshm_slot);
+	s->hdr->slots = slots;
+	s->hdr->pid = getpid();
+	s->slots = (struct stateshm_slot *) (s->hdr + 1);
+	return s;
+err:
+	free(s->variance);
+	free(s);
+	return NULL;
+}
+
+void stateshm_destroy(struct stateshm *s)
+{
+	munmap(s->hdr, s->map_len);
+	free(s->variance);
+	free(s);
+}
+
+int stateshm_slots(struct stateshm *s)
+{
+	return s->n;
+}
+
+struct stateshm_slot *stateshm_slot(struct stateshm *s, int slot)
+{
+	return slot >= 0 && slot < s->n ? &s->slots[slot] : NULL;
+}
+
+void stateshm_set_clock(struct stateshm *s, int slot, const char *name)
+{
+	struct stateshm_slot *p;
+
+	if (slot < 0 || slot >= s->n)
+		return;
+	p = &s->slots[slot];
+
+	slot_begin(p);
+	name_copy(p->clock, name);
+	p->source[0] = '\0';
+	p->servo_state = 0;
+	p->updates = 0;
+	p->monotonic = 0;
+	p->time = 0;
+	p->offset = 0;
+	p->delay = -1;
+	p->error = 0;
+	p->freq = 0.0;
+	memset(p->offset_hist, 0, sizeof(p->offset_hist));
+	memset(p->delay_hist, 0, sizeof(p->delay_hist));
+	slot_end(p);
+
+	s->variance[slot] = 0.0;
+}
+
+void stateshm_update(struct stateshm *s, int slot, const char *source,
+		     int64_t offset, int64_t delay, double freq, int state,
+		     uint64_t ts)
+{
+	struct stateshm_slot *p;
+	struct timespec now;
+	double *var;
+
+	if (slot < 0 || slot >= s->n)
+		return;
+	p = &s->slots[slot];
+	var = &s->variance[slot];
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!p->updates)
+		*var = (double) offset * offset;
+	else
+		*var += ERROR_SMOOTH * ((double) offset * offset - *var);
+
+	slot_begin(p);
+	if (strncmp(p->source, source ? source : "", STATESHM_NAME_LEN - 1))
+		name_copy(p->source, source);
+	p->servo_state = state;
+	p->updates++;
+	p->monotonic = now.tv_sec * 1000000000ULL + now.tv_nsec;
+	p->time = ts;
+	p->offset = offset;
+	p->delay = delay;
+	p->error = llround(sqrt(*var));
+	p->freq = freq;
+	p->offset_hist[hist_bin(offset)]++;
+	if (delay >= 0)
+		p->delay_hist[hist_bin(delay)]++;
+	slot_end(p);
+}
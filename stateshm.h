@@ -0,0 +1,155 @@
+/**
+ * @file stateshm.h
+ * @brief Publishes the state of the synchronized clocks in shared memory.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_STATESHM_H
+#define HAVE_STATESHM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#define STATESHM_MAGIC		"PTPSTATE"
+#define STATESHM_VERSION	2
+#define STATESHM_NAME_LEN	32
+#define STATESHM_HIST_BINS	32
+
+/**
+ * The file starts with this header, which is followed by one slot for
+ * each clock synchronized by the writing process.
+ */
+struct stateshm_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t slot_size;
+	uint32_t slots;
+	uint32_t pid; /* of the writing process */
+	uint8_t reserved[40];
+};
+
+/**
+ * The state of a clock after its last update. The seq field is odd
+ * while the slot is being written, and it is incremented again when
+ * the write is complete, so readers must copy a slot with
+ * stateshm_read() or check seq before and after copying it.
+ */
+struct stateshm_slot {
+	_Atomic uint32_t seq;
+	uint32_t servo_state; /* enum servo_state */
+	char clock[STATESHM_NAME_LEN];  /* the synchronized clock */
+	char source[STATESHM_NAME_LEN]; /* its time source */
+	uint64_t updates;   /* number of updates so far */
+	uint64_t monotonic; /* CLOCK_MONOTONIC of the update in ns */
+	uint64_t time;      /* time of the clock at the measurement in ns */
+	int64_t offset;     /* measured offset of the clock from the source */
+	int64_t delay;      /* path or reading delay in ns, -1 if unknown */
+	int64_t error;      /* RMS of the recent offsets in ns */
+	double freq;        /* frequency adjustment in ppb */
+	/*
+	 * Histograms of the absolute offsets and delays since the clock
+	 * was set. The first bin counts the values below 1 ns, the bin i
+	 * the values from 2^(i-1) up to 2^i ns, and the last bin also all
+	 * larger values.
+	 */
+	uint32_t offset_hist[STATESHM_HIST_BINS];
+	uint32_t delay_hist[STATESHM_HIST_BINS];
+	uint8_t reserved[16];
+};
+
+/**
+ * Copy a slot consistently. This does not make any system call.
+ * @param slot  A slot in the mapped file.
+ * @param copy  Receives the state of the slot.
+ * @return      Zero when the copy is consistent, non-zero if the slot
+ *              changed while it was copied and the caller should retry.
+ */
+static inline int stateshm_read(struct stateshm_slot *slot,
+				struct stateshm_slot *copy)
+{
+	uint32_t seq;
+
+	seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+	if (seq & 1)
+		return -1;
+	memcpy((char *) copy + sizeof(copy->seq),
+	       (char *) slot + sizeof(slot->seq),
+	       sizeof(*copy) - sizeof(copy->seq));
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq)
+		return -1;
+	atomic_store_explicit(&copy->seq, seq, memory_order_relaxed);
+	return 0;
+}
+
+/** Opaque type. */
+struct stateshm;
+
+/**
+ * Create the shared memory file and map it.
+ * @param path   The file to map, preferably on a tmpfs such as /dev/shm,
+ *               or NULL to keep the state in the memory of the process.
+ * @param slots  The number of clocks to publish.
+ * @return       A pointer to a new instance on success, NULL otherwise.
+ */
+struct stateshm *stateshm_create(const char *path, int slots);
+
+/**
+ * Unmap the shared memory file. The file remains.
+ * @param s  A pointer obtained via stateshm_create().
+ */
+void stateshm_destroy(struct stateshm *s);
+
+/**
+ * Get the number of slots.
+ * @param s  A pointer obtained via stateshm_create().
+ * @return   The number of clocks published.
+ */
+int stateshm_slots(struct stateshm *s);
+
+/**
+ * Get a slot, e.g. to read it with stateshm_read() in another thread.
+ * @param s     A pointer obtained via stateshm_create().
+ * @param slot  The index of the slot.
+ * @return      The slot, or NULL if the index is out of range.
+ */
+struct stateshm_slot *stateshm_slot(struct stateshm *s, int slot);
+
+/**
+ * Set the name of the clock published in a slot and clear its state.
+ * @param s     A pointer obtained via stateshm_create().
+ * @param slot  The index of the slot.
+ * @param name  The name of the clock.
+ */
+void stateshm_set_clock(struct stateshm *s, int slot, const char *name);
+
+/**
+ * Publish the state of a clock after an update.
+ * @param s       A pointer obtained via stateshm_create().
+ * @param slot    The index of the slot.
+ * @param source  The name of the time source.
+ * @param offset  The measured offset in nanoseconds.
+ * @param delay   The delay of the measurement, or -1 if unknown.
+ * @param freq    The frequency adjustment in ppb.
+ * @param state   The state of the servo.
+ * @param ts      The time of the clock at the measurement.
+ */
+void stateshm_update(struct stateshm *s, int slot, const char *source,
+		     int64_t offset, int64_t delay, double freq, int state,
+		     uint64_t ts);
+
+#endif
@@ -22,6 +22,18 @@
 
 #include "stats.h"
 
+/*
+ * The percentiles are estimated from a histogram of the absolute values
+ * with logarithmic bins. Each power of two is split into HIST_SUBBINS
+ * linear bins, so the error of the estimate is below 1/(2*HIST_SUBBINS)
+ * of the value, in constant memory and time per value. The first bin
+ * holds the values below one and the last bin everything above the
+ * range.
+ */
+#define HIST_SUBBINS 16
+#define HIST_OCTAVES 40
+#define HIST_BINS (1 + HIST_OCTAVES * HIST_SUBBINS)
+
 struct stats {
 	unsigned int num;
 	double min;
@@ -29,8 +41,63 @@ struct stats {
 	double mean;
 	double sum_sqr;
 	double sum_diff_sqr;
+	unsigned int hist[HIST_BINS];
 };
 
+static int hist_bin(double value)
+{
+	int exp, bin;
+	double frac;
+
+	value = fabs(value);
+	if (!(value >= 1.0))
+		return 0;
+
+	/* value = frac * 2^exp, where 0.5 <= frac < 1 */
+	frac = frexp(value, &exp);
+	if (exp > HIST_OCTAVES)
+		return HIST_BINS - 1;
+
+	bin = (frac * 2.0 - 1.0) * HIST_SUBBINS;
+	return 1 + (exp - 1) * HIST_SUBBINS + bin;
+}
+
+static double hist_value(int bin)
+{
+	int octave;
+
+	if (!bin)
+		return 0.0;
+	bin--;
+	octave = bin / HIST_SUBBINS;
+	bin %= HIST_SUBBINS;
+
+	/* Middle of the bin */
+	return ldexp(1.0 + (bin + 0.5) / HIST_SUBBINS, octave);
+}
+
+static double hist_percentile(struct stats *stats, double max_abs,
+			      double percent)
+{
+	unsigned int rank, count = 0;
+	double value;
+	int i;
+
+	/* Nearest rank */
+	rank = ceil(percent / 100.0 * stats->num);
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < HIST_BINS - 1; i++) {
+		count += stats->hist[i];
+		if (count >= rank)
+			break;
+	}
+
+	value = hist_value(i);
+	return value < max_abs ? value : max_abs;
+}
+
 struct stats *stats_create(void)
 {
 	struct stats *stats;
@@ -57,6 +124,7 @@ void stats_add_value(struct stats *stats, double value)
 	stats->mean = old_mean + (value - old_mean) / stats->num;
 	stats->sum_sqr += value * value;
 	stats->sum_diff_sqr += (value - old_mean) * (value - stats->mean);
+	stats->hist[hist_bin(value)]++;
 }
 
 unsigned int stats_get_num_values(struct stats *stats)
@@ -75,10 +143,27 @@ int stats_get_result(struct stats *stats, struct stats_result *result)
 	result->mean = stats->mean;
 	result->rms = sqrt(stats->sum_sqr / stats->num);
 	result->stddev = sqrt(stats->sum_diff_sqr / stats->num);
+	result->p50_abs = hist_percentile(stats, result->max_abs, 50.0);
+	result->p99_abs = hist_percentile(stats, result->max_abs, 99.0);
+	result->p999_abs = hist_percentile(stats, result->max_abs, 99.9);
 
 	return 0;
 }
 
+void stats_get_histogram(struct stats *stats, unsigned int *counts, int n)
+{
+	int i, octave;
+
+	memset(counts, 0, n * sizeof(*counts));
+	if (n < 1)
+		return;
+	counts[0] = stats->hist[0];
+	for (i = 1; i < HIST_BINS; i++) {
+		octave = 1 + (i - 1) / HIST_SUBBINS;
+		counts[octave < n ? octave : n - 1] += stats->hist[i];
+	}
+}
+
 void stats_reset(struct stats *stats)
 {
 	memset(stats, 0, sizeof *stats);
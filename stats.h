@@ -56,6 +56,10 @@ struct stats_result {
 	double mean;
 	double rms;
 	double stddev;
+	/* Percentiles of the absolute values, estimated to about 3% */
+	double p50_abs;
+	double p99_abs;
+	double p999_abs;
 };
 
 /**
@@ -66,6 +70,16 @@ struct stats_result {
  */
 int stats_get_result(struct stats *stats, struct stats_result *result);
 
+/**
+ * Get a histogram of the absolute values with one bin per power of two.
+ * @param stats  Pointer to stats obtained via @ref stats_create().
+ * @param counts Receives the counts. The first element counts the values
+ *               below 1, the element i the values from 2^(i-1) up to 2^i,
+ *               and the last element also all larger values.
+ * @param n      The number of elements in counts.
+ */
+void stats_get_histogram(struct stats *stats, unsigned int *counts, int n);
+
 /**
  * Reset all statistics.
  * @param stats Pointer to stats obtained via @ref stats_create().
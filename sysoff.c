@@ -17,13 +17,20 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
-#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <linux/ptp_clock.h>
 
+#include "print.h"
 #include "sysoff.h"
 
 #define NS_PER_SEC 1000000000LL
+/* Minimum time between two reports of failing measurements, in seconds. */
+#define ERROR_INTERVAL 10
+/* Number of clocks whose failures are limited separately, by descriptor. */
+#define ERROR_SLOTS 16
 
 #ifdef PTP_SYS_OFFSET
 
@@ -32,77 +39,168 @@ static int64_t pctns(struct ptp_clock_time *t)
 	return t->sec * NS_PER_SEC + t->nsec;
 }
 
-static struct {
-	int64_t interval;
-	int64_t offset;
-	uint64_t timestamp;
-} samples[PTP_MAX_SAMPLES];
-
-static void insertion_sort(int length, int64_t interval, int64_t offset, uint64_t ts)
+/*
+ * A failure while probing only means that the method is not supported.
+ * At run time it is reported, but not on every reading of the clock.
+ * The limit is kept per clock, in a small table of the calling thread.
+ */
+static void sysoff_error(int fd, const char *request, int quiet)
 {
-	int i = length - 1;
-	while (i >= 0) {
-		if (samples[i].interval < interval)
-			break;
-		samples[i+1] = samples[i];
-		i--;
+	static __thread struct {
+		time_t last;
+		unsigned int skipped;
+	} slot[ERROR_SLOTS];
+	struct timespec now;
+	int err = errno, i = fd % ERROR_SLOTS;
+
+	if (quiet) {
+		pr_debug("ioctl %s: %s", request, strerror(err));
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (slot[i].last && now.tv_sec - slot[i].last < ERROR_INTERVAL) {
+		slot[i].skipped++;
+		return;
 	}
-	samples[i+1].interval = interval;
-	samples[i+1].offset = offset;
-	samples[i+1].timestamp = ts;
+	if (slot[i].skipped)
+		pr_err("ioctl %s: %s (%u more failures)", request,
+		       strerror(err), slot[i].skipped);
+	else
+		pr_err("ioctl %s: %s", request, strerror(err));
+	slot[i].last = now.tv_sec;
+	slot[i].skipped = 0;
 }
 
-static int64_t sysoff_estimate(struct ptp_clock_time *pct, int n_samples,
-			       uint64_t *ts, int64_t *delay)
+/*
+ * Only the reading bracketed by the shortest interval of the system
+ * clock is used, as it is the least disturbed by the delays.
+ */
+static void sysoff_select(struct ptp_clock_time *t1, struct ptp_clock_time *tp,
+			  struct ptp_clock_time *t2, int *first,
+			  int64_t *result, uint64_t *ts, int64_t *delay)
 {
-	int64_t t1, t2, tp;
-	int64_t interval, offset;
-	int i;
+	int64_t interval, start = pctns(t1), end = pctns(t2);
+
+	interval = end - start;
+	if (!*first && interval >= *delay)
+		return;
+	*first = 0;
+	*delay = interval;
+	*result = (start + end) / 2 - pctns(tp);
+	*ts = (start + end) / 2;
+}
 
+static int sysoff_basic(int fd, int n_samples, int quiet,
+			int64_t *result, uint64_t *ts, int64_t *delay)
+{
+	struct ptp_sys_offset pso;
+	int i, first = 1;
+
+	memset(&pso, 0, sizeof(pso));
+	pso.n_samples = n_samples;
+	if (ioctl(fd, PTP_SYS_OFFSET, &pso)) {
+		sysoff_error(fd, "PTP_SYS_OFFSET", quiet);
+		return SYSOFF_RUN_TIME_MISSING;
+	}
 	for (i = 0; i < n_samples; i++) {
-		t1 = pctns(&pct[2*i]);
-		tp = pctns(&pct[2*i+1]);
-		t2 = pctns(&pct[2*i+2]);
-		interval = t2 - t1;
-		offset = (t2 + t1) / 2 - tp;
-		insertion_sort(i, interval, offset, (t2 + t1) / 2);
+		sysoff_select(&pso.ts[2*i], &pso.ts[2*i+1], &pso.ts[2*i+2],
+			      &first, result, ts, delay);
 	}
-	*ts = samples[0].timestamp;
-	*delay = samples[0].interval;
-	return samples[0].offset;
+	return SYSOFF_BASIC;
 }
 
-int sysoff_measure(int fd, int n_samples,
-		   int64_t *result, uint64_t *ts, int64_t *delay)
+static int sysoff_extended(int fd, int n_samples, int quiet,
+			   int64_t *result, uint64_t *ts, int64_t *delay)
 {
-	struct ptp_sys_offset pso;
+#ifdef PTP_SYS_OFFSET_EXTENDED
+	struct ptp_sys_offset_extended pso;
+	int i, first = 1;
+
+	memset(&pso, 0, sizeof(pso));
 	pso.n_samples = n_samples;
-	if (ioctl(fd, PTP_SYS_OFFSET, &pso)) {
-		perror("ioctl PTP_SYS_OFFSET");
+	if (ioctl(fd, PTP_SYS_OFFSET_EXTENDED, &pso)) {
+		sysoff_error(fd, "PTP_SYS_OFFSET_EXTENDED", quiet);
 		return SYSOFF_RUN_TIME_MISSING;
 	}
-	*result = sysoff_estimate(pso.ts, n_samples, ts, delay);
-	return SYSOFF_SUPPORTED;
+	for (i = 0; i < n_samples; i++) {
+		sysoff_select(&pso.ts[i][0], &pso.ts[i][1], &pso.ts[i][2],
+			      &first, result, ts, delay);
+	}
+	return SYSOFF_EXTENDED;
+#else
+	return SYSOFF_COMPILE_TIME_MISSING;
+#endif
+}
+
+static int sysoff_precise(int fd, int quiet, int64_t *result, uint64_t *ts,
+			  int64_t *delay)
+{
+#ifdef PTP_SYS_OFFSET_PRECISE
+	struct ptp_sys_offset_precise pso;
+
+	memset(&pso, 0, sizeof(pso));
+	if (ioctl(fd, PTP_SYS_OFFSET_PRECISE, &pso)) {
+		sysoff_error(fd, "PTP_SYS_OFFSET_PRECISE", quiet);
+		return SYSOFF_RUN_TIME_MISSING;
+	}
+	/* The time stamps are captured by the hardware at the same time. */
+	*result = pctns(&pso.sys_realtime) - pctns(&pso.device);
+	*ts = pctns(&pso.sys_realtime);
+	*delay = 0;
+	return SYSOFF_PRECISE;
+#else
+	return SYSOFF_COMPILE_TIME_MISSING;
+#endif
+}
+
+static int sysoff_run(int fd, int method, int n_samples, int quiet,
+		      int64_t *result, uint64_t *ts, int64_t *delay)
+{
+	switch (method) {
+	case SYSOFF_PRECISE:
+		return sysoff_precise(fd, quiet, result, ts, delay);
+	case SYSOFF_EXTENDED:
+		return sysoff_extended(fd, n_samples, quiet, result, ts, delay);
+	case SYSOFF_BASIC:
+		return sysoff_basic(fd, n_samples, quiet, result, ts, delay);
+	}
+	return SYSOFF_RUN_TIME_MISSING;
+}
+
+int sysoff_measure(int fd, int method, int n_samples,
+		   int64_t *result, uint64_t *ts, int64_t *delay)
+{
+	return sysoff_run(fd, method, n_samples, 0, result, ts, delay);
 }
 
 int sysoff_probe(int fd, int n_samples)
 {
 	int64_t junk, delay;
 	uint64_t ts;
+	int method;
+
+	/* The cross time stamps don't need repeated readings. */
+	if (sysoff_precise(fd, 1, &junk, &ts, &delay) == SYSOFF_PRECISE)
+		return SYSOFF_PRECISE;
 
 	if (n_samples > PTP_MAX_SAMPLES) {
-		fprintf(stderr, "warning: %d exceeds kernel max readings %d\n",
-			n_samples, PTP_MAX_SAMPLES);
-		fprintf(stderr, "falling back to clock_gettime method\n");
+		pr_warning("%d exceeds kernel max readings %d",
+			   n_samples, PTP_MAX_SAMPLES);
+		pr_warning("falling back to clock_gettime method");
 		return SYSOFF_RUN_TIME_MISSING;
 	}
 
-	return sysoff_measure(fd, n_samples, &junk, &ts, &delay);
+	for (method = SYSOFF_EXTENDED; method < SYSOFF_LAST; method++) {
+		if (sysoff_run(fd, method, n_samples, 1,
+			       &junk, &ts, &delay) == method)
+			return method;
+	}
+	return SYSOFF_RUN_TIME_MISSING;
 }
 
 #else /* !PTP_SYS_OFFSET */
 
-int sysoff_measure(int fd, int n_samples,
+int sysoff_measure(int fd, int method, int n_samples,
 		   int64_t *result, uint64_t *ts, int64_t *delay)
 {
 	return SYSOFF_COMPILE_TIME_MISSING;
@@ -114,3 +212,39 @@ int sysoff_probe(int fd, int n_samples)
 }
 
 #endif /* PTP_SYS_OFFSET */
+
+int sysoff_measure_pair(int src_fd, int src_method, int dst_fd,
+			int dst_method, int n_samples,
+			int64_t *result, uint64_t *ts, int64_t *delay)
+{
+	int64_t src_offset, dst_offset, src_delay, dst_delay;
+	uint64_t src_ts, dst_ts;
+	int err;
+
+	err = sysoff_measure(src_fd, src_method, n_samples,
+			     &src_offset, &src_ts, &src_delay);
+	if (err < 0)
+		return err;
+	err = sysoff_measure(dst_fd, dst_method, n_samples,
+			     &dst_offset, &dst_ts, &dst_delay);
+	if (err < 0)
+		return err;
+
+	*result = src_offset - dst_offset;
+	*ts = dst_ts - dst_offset;
+	*delay = src_delay + dst_delay;
+	return 0;
+}
+
+const char *sysoff_method_name(int method)
+{
+	switch (method) {
+	case SYSOFF_PRECISE:
+		return "PTP_SYS_OFFSET_PRECISE";
+	case SYSOFF_EXTENDED:
+		return "PTP_SYS_OFFSET_EXTENDED";
+	case SYSOFF_BASIC:
+		return "PTP_SYS_OFFSET";
+	}
+	return "clock_gettime";
+}
@@ -20,27 +20,63 @@
 
 #include <stdint.h>
 
+/*
+ * The measurement methods, in the order of preference, and the reasons
+ * why no method is available.
+ */
 enum {
-	SYSOFF_SUPPORTED,
-	SYSOFF_COMPILE_TIME_MISSING,
-	SYSOFF_RUN_TIME_MISSING,
+	SYSOFF_COMPILE_TIME_MISSING = -2,
+	SYSOFF_RUN_TIME_MISSING = -1,
+	SYSOFF_PRECISE,
+	SYSOFF_EXTENDED,
+	SYSOFF_BASIC,
+	SYSOFF_LAST,
 };
 
 /**
- * Check to see if the PTP_SYS_OFFSET ioctl is supported.
- * @param fd  An open file descriptor to a PHC device.
- * @return  One of the SYSOFF_ enumeration values.
+ * Find the best method of measuring the offset supported by a PHC.
+ * @param fd         An open file descriptor to a PHC device.
+ * @param n_samples  The number of consecutive readings to make.
+ * @return  One of the SYSOFF_ methods, or a negative SYSOFF_ value if
+ *          no method is supported.
  */
 int sysoff_probe(int fd, int n_samples);
 
 /**
  * Measure the offset between a PHC and the system time.
  * @param fd         An open file descriptor to a PHC device.
+ * @param method     The method returned by sysoff_probe().
  * @param n_samples  The number of consecutive readings to make.
  * @param result     The estimated offset in nanoseconds.
  * @param ts         The system time corresponding to the 'result'.
  * @param delay      The delay in reading of the clock in nanoseconds.
- * @return  One of the SYSOFF_ enumeration values.
+ * @return  The method used, or a negative SYSOFF_ value on failure.
  */
-int sysoff_measure(int fd, int n_samples,
+int sysoff_measure(int fd, int method, int n_samples,
 		   int64_t *result, uint64_t *ts, int64_t *delay);
+
+/**
+ * Measure the offset between two PHCs, by measuring both of them
+ * against the system time.
+ * @param src_fd     An open file descriptor to the source PHC.
+ * @param src_method The method returned by sysoff_probe() for the source.
+ * @param dst_fd     An open file descriptor to the destination PHC.
+ * @param dst_method The method returned by sysoff_probe() for the
+ *                   destination.
+ * @param n_samples  The number of consecutive readings to make.
+ * @param result     The offset of the destination from the source in
+ *                   nanoseconds.
+ * @param ts         The destination time corresponding to the 'result'.
+ * @param delay      The sum of the delays in reading the clocks.
+ * @return  Zero on success, a negative SYSOFF_ value on failure.
+ */
+int sysoff_measure_pair(int src_fd, int src_method, int dst_fd,
+			int dst_method, int n_samples,
+			int64_t *result, uint64_t *ts, int64_t *delay);
+
+/**
+ * Get the name of a measurement method.
+ * @param method  One of the SYSOFF_ values.
+ * @return  The name of the ioctl implementing the method.
+ */
+const char *sysoff_method_name(int method);
@@ -23,6 +23,7 @@
 #include <libgen.h>
 #include <limits.h>
 #include <linux/net_tstamp.h>
+#include <sched.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdarg.h>
@@ -32,6 +33,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "print.h"
@@ -42,8 +44,15 @@
 #define DEFAULT_RUNDIR "/var/run/timemaster"
 
 #define DEFAULT_FIRST_SHM_SEGMENT 0
+#define DEFAULT_RESTART 0
+#define DEFAULT_RESTART_DELAY 1.0
+
+/* programs running shorter than this are restarted with a doubled delay */
+#define RESTART_MIN_UPTIME 60.0
+#define RESTART_MAX_BACKOFF 64
 
 #define DEFAULT_NTP_PROGRAM CHRONYD
+#define DEFAULT_NTP_REFCLOCK REFCLOCK_SHM
 #define DEFAULT_NTP_MINPOLL 6
 #define DEFAULT_NTP_MAXPOLL 10
 #define DEFAULT_PTP_DELAY 1e-4
@@ -69,6 +78,11 @@ enum ntp_program {
 	NTPD,
 };
 
+enum ntp_refclock {
+	REFCLOCK_SHM,
+	REFCLOCK_SOCK,
+};
+
 struct ntp_server {
 	char *address;
 	int minpoll;
@@ -99,13 +113,19 @@ struct program_config {
 	char *path;
 	char **options;
 	char **settings;
+	cpu_set_t cpus;
+	int sched_policy;
+	int sched_priority;
 };
 
 struct timemaster_config {
 	struct source **sources;
 	enum ntp_program ntp_program;
+	enum ntp_refclock ntp_refclock;
 	char *rundir;
 	int first_shm_segment;
+	int restart;
+	double restart_delay;
 	struct program_config chronyd;
 	struct program_config ntpd;
 	struct program_config phc2sys;
@@ -117,9 +137,22 @@ struct config_file {
 	char *content;
 };
 
+struct command {
+	char **args;
+	cpu_set_t cpus;
+	int sched_policy;
+	int sched_priority;
+	pid_t pid;
+	double start_time;
+	double restart_time;
+	double restart_delay;
+};
+
 struct script {
 	struct config_file **configs;
-	char ***commands;
+	struct command **commands;
+	int restart;
+	double restart_delay;
 };
 
 static void free_parray(void **a)
@@ -169,6 +202,57 @@ static int parse_double(char *s, double *d)
 	return 0;
 }
 
+static int parse_cpus(char *s, cpu_set_t *cpus)
+{
+	unsigned long first, last;
+	char *end;
+
+	CPU_ZERO(cpus);
+
+	/* a list of CPUs and ranges of CPUs, e.g. 0,2-3 */
+	while (*s) {
+		first = strtoul(s, &end, 10);
+		if (end == s)
+			return 1;
+		last = first;
+		if (*end == '-') {
+			s = end + 1;
+			last = strtoul(s, &end, 10);
+			if (end == s)
+				return 1;
+		}
+		if (first > last || last >= CPU_SETSIZE)
+			return 1;
+		for (; first <= last; first++)
+			CPU_SET(first, cpus);
+		s = end;
+		if (*s == ',')
+			s++;
+		else if (*s)
+			return 1;
+	}
+
+	return CPU_COUNT(cpus) ? 0 : 1;
+}
+
+static int parse_sched_policy(char *s, int *policy)
+{
+	if (!strcasecmp(s, "other"))
+		*policy = SCHED_OTHER;
+	else if (!strcasecmp(s, "fifo"))
+		*policy = SCHED_FIFO;
+	else if (!strcasecmp(s, "rr"))
+		*policy = SCHED_RR;
+	else if (!strcasecmp(s, "batch"))
+		*policy = SCHED_BATCH;
+	else if (!strcasecmp(s, "idle"))
+		*policy = SCHED_IDLE;
+	else
+		return 1;
+
+	return 0;
+}
+
 static char *parse_word(char *s)
 {
 	while (*s && !isspace(*s))
@@ -346,6 +430,7 @@ static int parse_program_settings(char **settings,
 				  struct program_config *config)
 {
 	char *name, *value;
+	int r = 0;
 
 	for (; *settings; settings++) {
 		parse_setting(*settings, &name, &value);
@@ -353,10 +438,36 @@ static int parse_program_settings(char **settings,
 			replace_string(value, &config->path);
 		} else if (!strcasecmp(name, "options")) {
 			parse_words(value, &config->options);
+		} else if (!strcasecmp(name, "cpus")) {
+			r = parse_cpus(value, &config->cpus);
+		} else if (!strcasecmp(name, "sched_policy")) {
+			r = parse_sched_policy(value, &config->sched_policy);
+		} else if (!strcasecmp(name, "sched_priority")) {
+			r = parse_int(value, &config->sched_priority);
 		} else {
 			pr_err("unknown program setting %s", name);
 			return 1;
 		}
+		if (r) {
+			pr_err("invalid value %s for %s", value, name);
+			return 1;
+		}
+	}
+
+	if (config->sched_policy == SCHED_FIFO ||
+	    config->sched_policy == SCHED_RR) {
+		if (config->sched_priority <
+		    sched_get_priority_min(config->sched_policy) ||
+		    config->sched_priority >
+		    sched_get_priority_max(config->sched_policy)) {
+			pr_err("invalid sched_priority %d for %s",
+			       config->sched_priority, config->path);
+			return 1;
+		}
+	} else if (config->sched_priority) {
+		pr_err("sched_priority of %s needs sched_policy fifo or rr",
+		       config->path);
+		return 1;
 	}
 
 	return 0;
@@ -379,10 +490,25 @@ static int parse_timemaster_settings(char **settings,
 				pr_err("unknown ntp program %s", value);
 				return 1;
 			}
+		} else if (!strcasecmp(name, "ntp_refclock")) {
+			if (!strcasecmp(value, "shm")) {
+				config->ntp_refclock = REFCLOCK_SHM;
+			} else if (!strcasecmp(value, "sock")) {
+				config->ntp_refclock = REFCLOCK_SOCK;
+			} else {
+				pr_err("unknown ntp refclock %s", value);
+				return 1;
+			}
 		} else if (!strcasecmp(name, "rundir")) {
 			replace_string(value, &config->rundir);
 		} else if (!strcasecmp(name, "first_shm_segment")) {
 			r = parse_int(value, &config->first_shm_segment);
+		} else if (!strcasecmp(name, "restart")) {
+			r = parse_bool(value, &config->restart);
+		} else if (!strcasecmp(name, "restart_delay")) {
+			r = parse_double(value, &config->restart_delay);
+			if (!r && config->restart_delay < 0.0)
+				r = 1;
 		} else {
 			pr_err("unknown timemaster setting %s", name);
 			return 1;
@@ -458,6 +584,9 @@ static void init_program_config(struct program_config *config,
 	config->path = xstrdup(name);
 	config->settings = (char **)parray_new();
 	config->options = (char **)parray_new();
+	CPU_ZERO(&config->cpus);
+	config->sched_policy = -1;
+	config->sched_priority = 0;
 
 	va_start(ap, name);
 
@@ -504,8 +633,11 @@ static struct timemaster_config *config_parse(char *path)
 
 	config->sources = (struct source **)parray_new();
 	config->ntp_program = DEFAULT_NTP_PROGRAM;
+	config->ntp_refclock = DEFAULT_NTP_REFCLOCK;
 	config->rundir = xstrdup(DEFAULT_RUNDIR);
 	config->first_shm_segment = DEFAULT_FIRST_SHM_SEGMENT;
+	config->restart = DEFAULT_RESTART;
+	config->restart_delay = DEFAULT_RESTART_DELAY;
 
 	init_program_config(&config->chronyd, "chronyd",
 			    NULL, DEFAULT_CHRONYD_SETTINGS, NULL);
@@ -564,6 +696,12 @@ static struct timemaster_config *config_parse(char *path)
 		ret = 1;
 	}
 
+	if (!ret && config->ntp_refclock == REFCLOCK_SOCK &&
+	    config->ntp_program != CHRONYD) {
+		pr_err("the SOCK refclock is supported only by chronyd");
+		ret = 1;
+	}
+
 	fclose(f);
 
 	if (section_name)
@@ -599,7 +737,8 @@ static char **get_ptp4l_command(struct program_config *config,
 }
 
 static char **get_phc2sys_command(struct program_config *config, int domain,
-				  int poll, int shm_segment, char *uds_path)
+				  int poll, int shm_segment, char *uds_path,
+				  char *sock_path)
 {
 	char **command = (char **)parray_new();
 
@@ -610,13 +749,34 @@ static char **get_phc2sys_command(struct program_config *config, int domain,
 		      xstrdup("-R"), string_newf("%.2f", poll > 0 ?
 						1.0 / (1 << poll) : 1 << -poll),
 		      xstrdup("-z"), xstrdup(uds_path),
-		      xstrdup("-n"), string_newf("%d", domain),
-		      xstrdup("-E"), xstrdup("ntpshm"),
-		      xstrdup("-M"), string_newf("%d", shm_segment), NULL);
+		      xstrdup("-n"), string_newf("%d", domain), NULL);
+
+	if (sock_path)
+		parray_extend((void ***)&command,
+			      xstrdup("-E"), xstrdup("refclock_sock"),
+			      xstrdup("-C"), xstrdup(sock_path), NULL);
+	else
+		parray_extend((void ***)&command,
+			      xstrdup("-E"), xstrdup("ntpshm"),
+			      xstrdup("-M"), string_newf("%d", shm_segment),
+			      NULL);
 
 	return command;
 }
 
+static void add_command(struct script *script, char **args,
+			struct program_config *config)
+{
+	struct command *command = xcalloc(1, sizeof(*command));
+
+	command->args = args;
+	command->cpus = config->cpus;
+	command->sched_policy = config->sched_policy;
+	command->sched_priority = config->sched_priority;
+
+	parray_append((void ***)&script->commands, command);
+}
+
 static char *get_refid(char *prefix, unsigned int number)
 {
 	if (number < 10)
@@ -628,14 +788,24 @@ static char *get_refid(char *prefix, unsigned int number)
 	return NULL;
 };
 
-static void add_shm_source(int shm_segment, int poll, int dpoll, double delay,
-			   char *ntp_options, char *prefix,
-			   struct timemaster_config *config, char **ntp_config)
+static void add_shm_source(int shm_segment, char *sock_path, int poll,
+			   int dpoll, double delay, char *ntp_options,
+			   char *prefix, struct timemaster_config *config,
+			   char **ntp_config)
 {
 	char *refid = get_refid(prefix, shm_segment);
 
 	switch (config->ntp_program) {
 	case CHRONYD:
+		if (sock_path) {
+			/* the samples are pushed, dpoll doesn't apply */
+			string_appendf(ntp_config,
+				       "refclock SOCK %s poll %d "
+				       "refid %s precision 1.0e-9 delay %.1e %s\n",
+				       sock_path, poll, refid, delay,
+				       ntp_options);
+			break;
+		}
 		string_appendf(ntp_config,
 			       "refclock SHM %d poll %d dpoll %d "
 			       "refid %s precision 1.0e-9 delay %.1e %s\n",
@@ -671,7 +841,7 @@ static int add_ptp_source(struct ptp_domain *source,
 			  struct script *script)
 {
 	struct config_file *config_file;
-	char **command, *uds_path, **interfaces;
+	char **command, *uds_path, *sock_path, **interfaces;
 	int i, j, num_interfaces, *phc, *phcs, hw_ts;
 	struct sk_ts_info ts_info;
 
@@ -748,11 +918,23 @@ static int add_ptp_source(struct ptp_domain *source,
 
 		uds_path = string_newf("%s/ptp4l.%d.socket",
 				       config->rundir, *shm_segment);
+		sock_path = NULL;
+		if (config->ntp_refclock == REFCLOCK_SOCK)
+			sock_path = string_newf("%s/refclock.%d.sock",
+						config->rundir, *shm_segment);
 
 		config_file = xmalloc(sizeof(*config_file));
 		config_file->path = string_newf("%s/ptp4l.%d.conf",
 						config->rundir, *shm_segment);
 		config_file->content = xstrdup("[global]\n");
+		/*
+		 * let a restarted ptp4l set the PHC to the frequency saved
+		 * by its previous instance, unless the file is overridden
+		 */
+		if (config->restart && phcs[i] >= 0)
+			string_appendf(&config_file->content,
+				       "freq_file %s/ptp4l.%d.freq\n",
+				       config->rundir, *shm_segment);
 		extend_config_string(&config_file->content,
 				     config->ptp4l.settings);
 		extend_config_string(&config_file->content,
@@ -767,33 +949,42 @@ static int add_ptp_source(struct ptp_domain *source,
 			/* HW time stamping */
 			command = get_ptp4l_command(&config->ptp4l, config_file,
 						    interfaces, 1);
-			parray_append((void ***)&script->commands, command);
+			add_command(script, command, &config->ptp4l);
 
 			command = get_phc2sys_command(&config->phc2sys,
 						      source->domain,
 						      source->phc2sys_poll,
-						      *shm_segment, uds_path);
-			parray_append((void ***)&script->commands, command);
+						      *shm_segment, uds_path,
+						      sock_path);
+			add_command(script, command, &config->phc2sys);
 		} else {
 			/* SW time stamping */
 			command = get_ptp4l_command(&config->ptp4l, config_file,
 						    interfaces, 0);
-			parray_append((void ***)&script->commands, command);
-
-			string_appendf(&config_file->content,
-				       "clock_servo ntpshm\n"
-				       "ntpshm_segment %d\n", *shm_segment);
+			add_command(script, command, &config->ptp4l);
+
+			if (sock_path)
+				string_appendf(&config_file->content,
+					       "clock_servo refclock_sock\n"
+					       "refclock_sock_address %s\n",
+					       sock_path);
+			else
+				string_appendf(&config_file->content,
+					       "clock_servo ntpshm\n"
+					       "ntpshm_segment %d\n",
+					       *shm_segment);
 		}
 
 		parray_append((void ***)&script->configs, config_file);
 
-		add_shm_source(*shm_segment, source->ntp_poll,
+		add_shm_source(*shm_segment, sock_path, source->ntp_poll,
 			       source->phc2sys_poll, source->delay,
 			       source->ntp_options, "PTP", config, ntp_config);
 
 		(*shm_segment)++;
 
 		free(uds_path);
+		free(sock_path);
 		free(interfaces);
 	}
 
@@ -832,6 +1023,7 @@ static struct config_file *add_ntp_program(struct timemaster_config *config,
 					   struct script *script)
 {
 	struct config_file *ntp_config = xmalloc(sizeof(*ntp_config));
+	struct program_config *program = NULL;
 	char **command = NULL;
 
 	ntp_config->content = xstrdup("");
@@ -843,25 +1035,28 @@ static struct config_file *add_ntp_program(struct timemaster_config *config,
 		ntp_config->path = string_newf("%s/chrony.conf",
 					       config->rundir);
 		command = get_chronyd_command(&config->chronyd, ntp_config);
+		program = &config->chronyd;
 		break;
 	case NTPD:
 		extend_config_string(&ntp_config->content,
 				     config->ntpd.settings);
 		ntp_config->path = string_newf("%s/ntp.conf", config->rundir);
 		command = get_ntpd_command(&config->ntpd, ntp_config);
+		program = &config->ntpd;
 		break;
 	}
 
 	parray_append((void ***)&script->configs, ntp_config);
-	parray_append((void ***)&script->commands, command);
+	add_command(script, command, program);
 
 	return ntp_config;
 }
 
 static void script_destroy(struct script *script)
 {
-	char ***commands, **command;
+	struct command **commands;
 	struct config_file *config, **configs;
+	char **arg;
 
 	for (configs = script->configs; *configs; configs++) {
 		config = *configs;
@@ -872,8 +1067,9 @@ static void script_destroy(struct script *script)
 	free(script->configs);
 
 	for (commands = script->commands; *commands; commands++) {
-		for (command = *commands; *command; command++)
-			free(*command);
+		for (arg = (*commands)->args; *arg; arg++)
+			free(*arg);
+		free((*commands)->args);
 		free(*commands);
 	}
 	free(script->commands);
@@ -890,7 +1086,9 @@ static struct script *script_create(struct timemaster_config *config)
 	int ret = 0, shm_segment;
 
 	script->configs = (struct config_file **)parray_new();
-	script->commands = (char ***)parray_new();
+	script->commands = (struct command **)parray_new();
+	script->restart = config->restart;
+	script->restart_delay = config->restart_delay;
 
 	ntp_config = add_ntp_program(config, script);
 	shm_segment = config->first_shm_segment;
@@ -920,23 +1118,39 @@ static struct script *script_create(struct timemaster_config *config)
 	return script;
 }
 
-static pid_t start_program(char **command, sigset_t *mask)
+static pid_t spawn_program(struct command *command, sigset_t *mask)
 {
-	char **arg, *s;
+	struct sched_param param = {
+		.sched_priority = command->sched_priority,
+	};
 	pid_t pid;
 
 #ifdef HAVE_POSIX_SPAWN
 	posix_spawnattr_t attr;
+	short flags = POSIX_SPAWN_SETSIGMASK;
 
 	if (posix_spawnattr_init(&attr)) {
 		pr_err("failed to init spawn attributes: %m");
 		return 0;
 	}
 
+	if (command->sched_policy >= 0) {
+		flags |= POSIX_SPAWN_SETSCHEDULER;
+		if (posix_spawnattr_setschedpolicy(&attr,
+						   command->sched_policy) ||
+		    posix_spawnattr_setschedparam(&attr, &param)) {
+			pr_err("failed to set scheduling of %s: %m",
+			       command->args[0]);
+			posix_spawnattr_destroy(&attr);
+			return 0;
+		}
+	}
+
 	if (posix_spawnattr_setsigmask(&attr, mask) ||
-	    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK) ||
-	    posix_spawnp(&pid, command[0], NULL, &attr, command, environ)) {
-		pr_err("failed to spawn %s: %m", command[0]);
+	    posix_spawnattr_setflags(&attr, flags) ||
+	    posix_spawnp(&pid, command->args[0], NULL, &attr,
+			 command->args, environ)) {
+		pr_err("failed to spawn %s: %m", command->args[0]);
 		posix_spawnattr_destroy(&attr);
 		return 0;
 	}
@@ -957,15 +1171,48 @@ static pid_t start_program(char **command, sigset_t *mask)
 			exit(100);
 		}
 
-		execvp(command[0], (char **)command);
+		if (command->sched_policy >= 0 &&
+		    sched_setscheduler(0, command->sched_policy, &param)) {
+			pr_err("sched_setscheduler() failed: %m");
+			exit(102);
+		}
+
+		execvp(command->args[0], command->args);
 
-		pr_err("failed to execute %s: %m", command[0]);
+		pr_err("failed to execute %s: %m", command->args[0]);
 
 		exit(101);
 	}
 #endif
 
-	for (s = xstrdup(""), arg = command; *arg; arg++)
+	return pid;
+}
+
+static pid_t start_program(struct command *command, sigset_t *mask)
+{
+	int affinity = CPU_COUNT(&command->cpus) > 0;
+	char **arg, *s;
+	cpu_set_t cpus;
+	pid_t pid;
+
+	/* the child inherits the CPU affinity of timemaster */
+	if (affinity &&
+	    (sched_getaffinity(0, sizeof(cpus), &cpus) ||
+	     sched_setaffinity(0, sizeof(command->cpus), &command->cpus))) {
+		pr_err("failed to set CPU affinity of %s: %m",
+		       command->args[0]);
+		return 0;
+	}
+
+	pid = spawn_program(command, mask);
+
+	if (affinity && sched_setaffinity(0, sizeof(cpus), &cpus))
+		pr_err("failed to restore CPU affinity: %m");
+
+	if (!pid)
+		return 0;
+
+	for (s = xstrdup(""), arg = command->args; *arg; arg++)
 		string_appendf(&s, "%s ", *arg);
 
 	pr_info("process %d started: %s", pid, s);
@@ -1028,17 +1275,121 @@ static int remove_config_files(struct config_file **configs)
 	return 0;
 }
 
+static double monotonic_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int log_status(pid_t pid, int status)
+{
+	if (!WIFEXITED(status)) {
+		pr_info("process %d terminated abnormally", pid);
+		return 1;
+	}
+
+	pr_info("process %d terminated with status %d", pid,
+		WEXITSTATUS(status));
+
+	return WEXITSTATUS(status) ? 1 : 0;
+}
+
+static void schedule_restart(struct script *script, struct command *command)
+{
+	double now = monotonic_time();
+
+	/* back off if the program keeps failing soon after start */
+	if (!command->restart_delay ||
+	    now - command->start_time >= RESTART_MIN_UPTIME)
+		command->restart_delay = script->restart_delay;
+	else if (command->restart_delay <
+		 script->restart_delay * RESTART_MAX_BACKOFF)
+		command->restart_delay *= 2.0;
+
+	command->restart_time = now + command->restart_delay;
+
+	pr_info("restarting %s in %.1f seconds", command->args[0],
+		command->restart_delay);
+}
+
+/* Sets failed if any of the reaped processes failed. */
+static int script_reap(struct script *script, int *failed)
+{
+	struct command **commands, *command;
+	int status, essential = 0;
+	pid_t pid;
+
+	/* SIGCHLD signals are merged, collect all terminated processes */
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (commands = script->commands;
+		     (command = *commands); commands++) {
+			if (command->pid == pid)
+				break;
+		}
+		if (!command)
+			continue;
+
+		command->pid = 0;
+		if (log_status(pid, status))
+			*failed = 1;
+
+		if (script->restart) {
+			schedule_restart(script, command);
+			continue;
+		}
+
+		/*
+		 * assume only the first process (i.e. chronyd or ntpd) is
+		 * essential and continue if other processes terminate
+		 */
+		if (commands == script->commands)
+			essential = 1;
+		else
+			pr_info("process %d terminated (ignored)", pid);
+	}
+
+	return essential;
+}
+
+static double script_restart(struct script *script, sigset_t *mask)
+{
+	struct command **commands, *command;
+	double now = monotonic_time(), next = 0.0;
+
+	for (commands = script->commands; (command = *commands); commands++) {
+		if (!command->restart_time)
+			continue;
+
+		if (command->restart_time <= now) {
+			command->restart_time = 0.0;
+			command->start_time = now;
+			command->pid = start_program(command, mask);
+			if (command->pid)
+				continue;
+			schedule_restart(script, command);
+		}
+
+		if (!next || command->restart_time < next)
+			next = command->restart_time;
+	}
+
+	/* time remaining to the next restart, zero if there is none */
+	return next ? next - now : 0.0;
+}
+
 static int script_run(struct script *script)
 {
+	struct command **commands, *command;
+	struct timespec timeout;
 	sigset_t mask, old_mask;
 	siginfo_t info;
-	pid_t pid, *pids;
-	int i, num_commands, status, ret = 0;
-
-	for (num_commands = 0; script->commands[num_commands]; num_commands++)
-		;
+	double delay;
+	int r, status, ret = 0;
+	pid_t pid;
 
-	if (!num_commands) {
+	if (!*script->commands) {
 		/* nothing to do */
 		return 0;
 	}
@@ -1058,11 +1409,10 @@ static int script_run(struct script *script)
 		return 1;
 	}
 
-	pids = xcalloc(num_commands, sizeof(*pids));
-
-	for (i = 0; i < num_commands; i++) {
-		pids[i] = start_program(script->commands[i], &old_mask);
-		if (!pids[i]) {
+	for (commands = script->commands; (command = *commands); commands++) {
+		command->start_time = monotonic_time();
+		command->pid = start_program(command, &old_mask);
+		if (!command->pid) {
 			kill(getpid(), SIGTERM);
 			break;
 		}
@@ -1070,19 +1420,24 @@ static int script_run(struct script *script)
 
 	/* wait for one of the blocked signals */
 	while (1) {
-		if (sigwaitinfo(&mask, &info) < 0) {
-			if (errno == EINTR)
+		delay = script_restart(script, &old_mask);
+		if (delay > 0.0) {
+			timeout.tv_sec = delay;
+			timeout.tv_nsec = (delay - timeout.tv_sec) * 1e9;
+			r = sigtimedwait(&mask, &info, &timeout);
+		} else {
+			r = sigwaitinfo(&mask, &info);
+		}
+		if (r < 0) {
+			if (errno == EINTR || errno == EAGAIN)
 				continue;
 			pr_err("sigwaitinfo() failed: %m");
 			break;
 		}
 
-		/*
-		 * assume only the first process (i.e. chronyd or ntpd) is
-		 * essential and continue if other processes terminate
-		 */
-		if (info.si_signo == SIGCHLD && info.si_pid != pids[0]) {
-			pr_info("process %d terminated (ignored)", info.si_pid);
+		if (info.si_signo == SIGCHLD) {
+			if (script_reap(script, &ret))
+				break;
 			continue;
 		}
 
@@ -1091,27 +1446,18 @@ static int script_run(struct script *script)
 	}
 
 	/* kill all started processes */
-	for (i = 0; i < num_commands; i++) {
-		if (pids[i] > 0) {
-			pr_debug("killing process %d", pids[i]);
-			kill(pids[i], SIGTERM);
+	for (commands = script->commands; (command = *commands); commands++) {
+		if (command->pid > 0) {
+			pr_debug("killing process %d", command->pid);
+			kill(command->pid, SIGTERM);
 		}
 	}
 
 	while ((pid = wait(&status)) >= 0) {
-		if (!WIFEXITED(status)) {
-			pr_info("process %d terminated abnormally", pid);
+		if (log_status(pid, status))
 			ret = 1;
-		} else {
-			if (WEXITSTATUS(status))
-				ret = 1;
-			pr_info("process %d terminated with status %d", pid,
-				WEXITSTATUS(status));
-		}
 	}
 
-	free(pids);
-
 	if (remove_config_files(script->configs))
 		return 1;
 
@@ -1120,8 +1466,9 @@ static int script_run(struct script *script)
 
 static void script_print(struct script *script)
 {
-	char ***commands, **command;
+	struct command **commands;
 	struct config_file *config, **configs;
+	char **arg;
 
 	for (configs = script->configs; *configs; configs++) {
 		config = *configs;
@@ -1130,8 +1477,8 @@ static void script_print(struct script *script)
 
 	fprintf(stderr, "commands:\n\n");
 	for (commands = script->commands; *commands; commands++) {
-		for (command = *commands; *command; command++)
-			fprintf(stderr, "%s ", *command);
+		for (arg = (*commands)->args; *arg; arg++)
+			fprintf(stderr, "%s ", *arg);
 		fprintf(stderr, "\n");
 	}
 }
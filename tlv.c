@@ -18,6 +18,7 @@
  */
 #include <arpa/inet.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "port.h"
@@ -51,222 +52,852 @@ static uint16_t flip16(uint16_t *p) {
 	return v;
 }
 
-static int mgt_post_recv(struct management_tlv *m, uint16_t data_len,
-			 struct tlv_extra *extra)
+static void default_ds_n2h(struct defaultDS *dds)
 {
-	struct defaultDS *dds;
-	struct currentDS *cds;
-	struct parentDS *pds;
-	struct timePropertiesDS *tp;
-	struct portDS *p;
-	struct port_ds_np *pdsnp;
-	struct time_status_np *tsn;
-	struct grandmaster_settings_np *gsn;
-	struct subscribe_events_np *sen;
-	struct port_properties_np *ppn;
-	struct mgmt_clock_description *cd;
-	int extra_len = 0, len;
-	uint8_t *buf;
+	dds->numberPorts = ntohs(dds->numberPorts);
+	dds->clockQuality.offsetScaledLogVariance =
+		ntohs(dds->clockQuality.offsetScaledLogVariance);
+}
+
+static void default_ds_h2n(struct defaultDS *dds)
+{
+	dds->numberPorts = htons(dds->numberPorts);
+	dds->clockQuality.offsetScaledLogVariance =
+		htons(dds->clockQuality.offsetScaledLogVariance);
+}
+
+static void current_ds_n2h(struct currentDS *cds)
+{
+	cds->stepsRemoved = ntohs(cds->stepsRemoved);
+	cds->offsetFromMaster = net2host64(cds->offsetFromMaster);
+	cds->meanPathDelay = net2host64(cds->meanPathDelay);
+}
+
+static void current_ds_h2n(struct currentDS *cds)
+{
+	cds->stepsRemoved = htons(cds->stepsRemoved);
+	cds->offsetFromMaster = host2net64(cds->offsetFromMaster);
+	cds->meanPathDelay = host2net64(cds->meanPathDelay);
+}
+
+static void parent_ds_n2h(struct parentDS *pds)
+{
+	pds->parentPortIdentity.portNumber =
+		ntohs(pds->parentPortIdentity.portNumber);
+	pds->observedParentOffsetScaledLogVariance =
+		ntohs(pds->observedParentOffsetScaledLogVariance);
+	pds->observedParentClockPhaseChangeRate =
+		ntohl(pds->observedParentClockPhaseChangeRate);
+	pds->grandmasterClockQuality.offsetScaledLogVariance =
+		ntohs(pds->grandmasterClockQuality.offsetScaledLogVariance);
+}
+
+static void parent_ds_h2n(struct parentDS *pds)
+{
+	pds->parentPortIdentity.portNumber =
+		htons(pds->parentPortIdentity.portNumber);
+	pds->observedParentOffsetScaledLogVariance =
+		htons(pds->observedParentOffsetScaledLogVariance);
+	pds->observedParentClockPhaseChangeRate =
+		htonl(pds->observedParentClockPhaseChangeRate);
+	pds->grandmasterClockQuality.offsetScaledLogVariance =
+		htons(pds->grandmasterClockQuality.offsetScaledLogVariance);
+}
+
+static void port_ds_n2h(struct portDS *p)
+{
+	p->portIdentity.portNumber = ntohs(p->portIdentity.portNumber);
+	p->peerMeanPathDelay = net2host64(p->peerMeanPathDelay);
+}
+
+static void port_ds_h2n(struct portDS *p)
+{
+	p->portIdentity.portNumber = htons(p->portIdentity.portNumber);
+	p->peerMeanPathDelay = host2net64(p->peerMeanPathDelay);
+}
+
+static void time_status_n2h(struct time_status_np *tsn)
+{
+	tsn->master_offset = net2host64(tsn->master_offset);
+	tsn->ingress_time = net2host64(tsn->ingress_time);
+	tsn->cumulativeScaledRateOffset = ntohl(tsn->cumulativeScaledRateOffset);
+	tsn->scaledLastGmPhaseChange = ntohl(tsn->scaledLastGmPhaseChange);
+	tsn->gmTimeBaseIndicator = ntohs(tsn->gmTimeBaseIndicator);
+	scaled_ns_n2h(&tsn->lastGmPhaseChange);
+	tsn->gmPresent = ntohl(tsn->gmPresent);
+}
+
+static void time_status_h2n(struct time_status_np *tsn)
+{
+	tsn->master_offset = host2net64(tsn->master_offset);
+	tsn->ingress_time = host2net64(tsn->ingress_time);
+	tsn->cumulativeScaledRateOffset = htonl(tsn->cumulativeScaledRateOffset);
+	tsn->scaledLastGmPhaseChange = htonl(tsn->scaledLastGmPhaseChange);
+	tsn->gmTimeBaseIndicator = htons(tsn->gmTimeBaseIndicator);
+	scaled_ns_h2n(&tsn->lastGmPhaseChange);
+	tsn->gmPresent = htonl(tsn->gmPresent);
+}
+
+/*
+ * The data of the management TLVs. The post_recv hooks convert the data
+ * to host byte order and return the length of the variable part, the
+ * pre_send hooks convert it back to network byte order.
+ */
+
+static int clock_description_post_recv(struct management_tlv *m,
+				       uint16_t data_len,
+				       struct tlv_extra *extra)
+{
+	struct mgmt_clock_description *cd = &extra->cd;
+	uint8_t *buf = m->data;
+	int len = data_len;
 	uint16_t u16;
-	switch (m->id) {
-	case TLV_CLOCK_DESCRIPTION:
-		cd = &extra->cd;
-		buf = m->data;
-		len = data_len;
-
-		cd->clockType = (UInteger16 *) buf;
-		buf += sizeof(*cd->clockType);
-		len -= sizeof(*cd->clockType);
-		if (len < 0)
-			goto bad_length;
-		flip16(cd->clockType);
 
-		cd->physicalLayerProtocol = (struct PTPText *) buf;
-		buf += sizeof(struct PTPText);
-		len -= sizeof(struct PTPText);
-		if (len < 0)
-			goto bad_length;
+	cd->clockType = (UInteger16 *) buf;
+	buf += sizeof(*cd->clockType);
+	len -= sizeof(*cd->clockType);
+	if (len < 0)
+		goto bad_length;
+	flip16(cd->clockType);
 
-		buf += cd->physicalLayerProtocol->length;
-		len -= cd->physicalLayerProtocol->length;
-		if (len < 0)
-			goto bad_length;
+	cd->physicalLayerProtocol = (struct PTPText *) buf;
+	buf += sizeof(struct PTPText);
+	len -= sizeof(struct PTPText);
+	if (len < 0)
+		goto bad_length;
 
-		cd->physicalAddress = (struct PhysicalAddress *) buf;
-		buf += sizeof(struct PhysicalAddress);
-		len -= sizeof(struct PhysicalAddress);
-		if (len < 0)
-			goto bad_length;
+	buf += cd->physicalLayerProtocol->length;
+	len -= cd->physicalLayerProtocol->length;
+	if (len < 0)
+		goto bad_length;
 
-		u16 = flip16(&cd->physicalAddress->length);
-		if (u16 > TRANSPORT_ADDR_LEN)
-			goto bad_length;
-		buf += u16;
-		len -= u16;
-		if (len < 0)
-			goto bad_length;
+	cd->physicalAddress = (struct PhysicalAddress *) buf;
+	buf += sizeof(struct PhysicalAddress);
+	len -= sizeof(struct PhysicalAddress);
+	if (len < 0)
+		goto bad_length;
 
-		cd->protocolAddress = (struct PortAddress *) buf;
-		buf += sizeof(struct PortAddress);
-		len -= sizeof(struct PortAddress);
-		if (len < 0)
-			goto bad_length;
+	u16 = flip16(&cd->physicalAddress->length);
+	if (u16 > TRANSPORT_ADDR_LEN)
+		goto bad_length;
+	buf += u16;
+	len -= u16;
+	if (len < 0)
+		goto bad_length;
 
-		flip16(&cd->protocolAddress->networkProtocol);
-		u16 = flip16(&cd->protocolAddress->addressLength);
-		if (u16 > TRANSPORT_ADDR_LEN)
-			goto bad_length;
-		buf += u16;
-		len -= u16;
-		if (len < 0)
-			goto bad_length;
+	cd->protocolAddress = (struct PortAddress *) buf;
+	buf += sizeof(struct PortAddress);
+	len -= sizeof(struct PortAddress);
+	if (len < 0)
+		goto bad_length;
 
-		cd->manufacturerIdentity = buf;
-		buf += OUI_LEN + 1;
-		len -= OUI_LEN + 1;
-		if (len < 0)
-			goto bad_length;
+	flip16(&cd->protocolAddress->networkProtocol);
+	u16 = flip16(&cd->protocolAddress->addressLength);
+	if (u16 > TRANSPORT_ADDR_LEN)
+		goto bad_length;
+	buf += u16;
+	len -= u16;
+	if (len < 0)
+		goto bad_length;
 
-		cd->productDescription = (struct PTPText *) buf;
-		buf += sizeof(struct PTPText);
-		len -= sizeof(struct PTPText);
-		if (len < 0)
-			goto bad_length;
+	cd->manufacturerIdentity = buf;
+	buf += OUI_LEN + 1;
+	len -= OUI_LEN + 1;
+	if (len < 0)
+		goto bad_length;
 
-		buf += cd->productDescription->length;
-		len -= cd->productDescription->length;
-		if (len < 0)
-			goto bad_length;
+	cd->productDescription = (struct PTPText *) buf;
+	buf += sizeof(struct PTPText);
+	len -= sizeof(struct PTPText);
+	if (len < 0)
+		goto bad_length;
 
-		cd->revisionData = (struct PTPText *) buf;
-		buf += sizeof(struct PTPText);
-		len -= sizeof(struct PTPText);
-		if (len < 0)
-			goto bad_length;
+	buf += cd->productDescription->length;
+	len -= cd->productDescription->length;
+	if (len < 0)
+		goto bad_length;
 
-		buf += cd->revisionData->length;
-		len -= cd->revisionData->length;
-		if (len < 0)
-			goto bad_length;
+	cd->revisionData = (struct PTPText *) buf;
+	buf += sizeof(struct PTPText);
+	len -= sizeof(struct PTPText);
+	if (len < 0)
+		goto bad_length;
 
-		cd->userDescription = (struct PTPText *) buf;
-		buf += sizeof(struct PTPText);
-		len -= sizeof(struct PTPText);
-		if (len < 0)
-			goto bad_length;
+	buf += cd->revisionData->length;
+	len -= cd->revisionData->length;
+	if (len < 0)
+		goto bad_length;
 
-		buf += cd->userDescription->length;
-		len -= cd->userDescription->length;
-		if (len < 0)
-			goto bad_length;
+	cd->userDescription = (struct PTPText *) buf;
+	buf += sizeof(struct PTPText);
+	len -= sizeof(struct PTPText);
+	if (len < 0)
+		goto bad_length;
 
-		cd->profileIdentity = buf;
-		buf += PROFILE_ID_LEN;
-		len -= PROFILE_ID_LEN;
-		if (len < 0)
-			goto bad_length;
+	buf += cd->userDescription->length;
+	len -= cd->userDescription->length;
+	if (len < 0)
+		goto bad_length;
 
-		extra_len = buf - m->data;
-		break;
-	case TLV_USER_DESCRIPTION:
-		if (data_len < sizeof(struct PTPText))
-			goto bad_length;
-		extra->cd.userDescription = (struct PTPText *) m->data;
-		extra_len = sizeof(struct PTPText);
-		extra_len += extra->cd.userDescription->length;
-		break;
-	case TLV_DEFAULT_DATA_SET:
-		if (data_len != sizeof(struct defaultDS))
-			goto bad_length;
-		dds = (struct defaultDS *) m->data;
-		dds->numberPorts = ntohs(dds->numberPorts);
-		dds->clockQuality.offsetScaledLogVariance =
-			ntohs(dds->clockQuality.offsetScaledLogVariance);
-		break;
-	case TLV_CURRENT_DATA_SET:
-		if (data_len != sizeof(struct currentDS))
-			goto bad_length;
-		cds = (struct currentDS *) m->data;
-		cds->stepsRemoved = ntohs(cds->stepsRemoved);
-		cds->offsetFromMaster = net2host64(cds->offsetFromMaster);
-		cds->meanPathDelay = net2host64(cds->meanPathDelay);
-		break;
-	case TLV_PARENT_DATA_SET:
-		if (data_len != sizeof(struct parentDS))
-			goto bad_length;
-		pds = (struct parentDS *) m->data;
-		pds->parentPortIdentity.portNumber =
-			ntohs(pds->parentPortIdentity.portNumber);
-		pds->observedParentOffsetScaledLogVariance =
-			ntohs(pds->observedParentOffsetScaledLogVariance);
-		pds->observedParentClockPhaseChangeRate =
-			ntohl(pds->observedParentClockPhaseChangeRate);
-		pds->grandmasterClockQuality.offsetScaledLogVariance =
-			ntohs(pds->grandmasterClockQuality.offsetScaledLogVariance);
-		break;
-	case TLV_TIME_PROPERTIES_DATA_SET:
-		if (data_len != sizeof(struct timePropertiesDS))
-			goto bad_length;
-		tp = (struct timePropertiesDS *) m->data;
-		tp->currentUtcOffset = ntohs(tp->currentUtcOffset);
-		break;
-	case TLV_PORT_DATA_SET:
-		if (data_len != sizeof(struct portDS))
-			goto bad_length;
-		p = (struct portDS *) m->data;
-		p->portIdentity.portNumber = ntohs(p->portIdentity.portNumber);
-		p->peerMeanPathDelay = net2host64(p->peerMeanPathDelay);
-		break;
-	case TLV_TIME_STATUS_NP:
-		if (data_len != sizeof(struct time_status_np))
-			goto bad_length;
-		tsn = (struct time_status_np *) m->data;
-		tsn->master_offset = net2host64(tsn->master_offset);
-		tsn->ingress_time = net2host64(tsn->ingress_time);
-		tsn->cumulativeScaledRateOffset = ntohl(tsn->cumulativeScaledRateOffset);
-		tsn->scaledLastGmPhaseChange = ntohl(tsn->scaledLastGmPhaseChange);
-		tsn->gmTimeBaseIndicator = ntohs(tsn->gmTimeBaseIndicator);
-		scaled_ns_n2h(&tsn->lastGmPhaseChange);
-		tsn->gmPresent = ntohl(tsn->gmPresent);
-		break;
-	case TLV_GRANDMASTER_SETTINGS_NP:
-		if (data_len != sizeof(struct grandmaster_settings_np))
-			goto bad_length;
-		gsn = (struct grandmaster_settings_np *) m->data;
-		gsn->clockQuality.offsetScaledLogVariance =
-			ntohs(gsn->clockQuality.offsetScaledLogVariance);
-		gsn->utc_offset = ntohs(gsn->utc_offset);
-		break;
-	case TLV_PORT_DATA_SET_NP:
-		if (data_len != sizeof(struct port_ds_np))
-			goto bad_length;
-		pdsnp = (struct port_ds_np *) m->data;
-		pdsnp->neighborPropDelayThresh = ntohl(pdsnp->neighborPropDelayThresh);
-		pdsnp->asCapable = ntohl(pdsnp->asCapable);
-		break;
-	case TLV_SUBSCRIBE_EVENTS_NP:
-		if (data_len != sizeof(struct subscribe_events_np))
-			goto bad_length;
-		sen = (struct subscribe_events_np *)m->data;
-		sen->duration = ntohs(sen->duration);
-		break;
-	case TLV_PORT_PROPERTIES_NP:
-		if (data_len < sizeof(struct port_properties_np))
-			goto bad_length;
-		ppn = (struct port_properties_np *)m->data;
-		ppn->portIdentity.portNumber = ntohs(ppn->portIdentity.portNumber);
-		extra_len = sizeof(struct port_properties_np);
-		extra_len += ppn->interface.length;
-		break;
-	case TLV_SAVE_IN_NON_VOLATILE_STORAGE:
-	case TLV_RESET_NON_VOLATILE_STORAGE:
-	case TLV_INITIALIZE:
-	case TLV_FAULT_LOG_RESET:
-	case TLV_ENABLE_PORT:
-	case TLV_DISABLE_PORT:
-		if (data_len != 0)
-			goto bad_length;
-		break;
+	cd->profileIdentity = buf;
+	buf += PROFILE_ID_LEN;
+	len -= PROFILE_ID_LEN;
+	if (len < 0)
+		goto bad_length;
+
+	return buf - m->data;
+bad_length:
+	return -EBADMSG;
+}
+
+static void clock_description_pre_send(struct management_tlv *m,
+				       struct tlv_extra *extra)
+{
+	struct mgmt_clock_description *cd;
+
+	if (!extra)
+		return;
+	cd = &extra->cd;
+	flip16(cd->clockType);
+	flip16(&cd->physicalAddress->length);
+	flip16(&cd->protocolAddress->networkProtocol);
+	flip16(&cd->protocolAddress->addressLength);
+}
+
+static int user_description_post_recv(struct management_tlv *m,
+				      uint16_t data_len,
+				      struct tlv_extra *extra)
+{
+	extra->cd.userDescription = (struct PTPText *) m->data;
+	return sizeof(struct PTPText) + extra->cd.userDescription->length;
+}
+
+static int default_ds_post_recv(struct management_tlv *m, uint16_t data_len,
+				struct tlv_extra *extra)
+{
+	default_ds_n2h((struct defaultDS *) m->data);
+	return 0;
+}
+
+static void default_ds_pre_send(struct management_tlv *m,
+				struct tlv_extra *extra)
+{
+	default_ds_h2n((struct defaultDS *) m->data);
+}
+
+static int current_ds_post_recv(struct management_tlv *m, uint16_t data_len,
+				struct tlv_extra *extra)
+{
+	current_ds_n2h((struct currentDS *) m->data);
+	return 0;
+}
+
+static void current_ds_pre_send(struct management_tlv *m,
+				struct tlv_extra *extra)
+{
+	current_ds_h2n((struct currentDS *) m->data);
+}
+
+static int parent_ds_post_recv(struct management_tlv *m, uint16_t data_len,
+			       struct tlv_extra *extra)
+{
+	parent_ds_n2h((struct parentDS *) m->data);
+	return 0;
+}
+
+static void parent_ds_pre_send(struct management_tlv *m,
+			       struct tlv_extra *extra)
+{
+	parent_ds_h2n((struct parentDS *) m->data);
+}
+
+static int time_properties_post_recv(struct management_tlv *m,
+				     uint16_t data_len,
+				     struct tlv_extra *extra)
+{
+	struct timePropertiesDS *tp = (struct timePropertiesDS *) m->data;
+
+	tp->currentUtcOffset = ntohs(tp->currentUtcOffset);
+	return 0;
+}
+
+static void time_properties_pre_send(struct management_tlv *m,
+				     struct tlv_extra *extra)
+{
+	struct timePropertiesDS *tp = (struct timePropertiesDS *) m->data;
+
+	tp->currentUtcOffset = htons(tp->currentUtcOffset);
+}
+
+static int port_ds_post_recv(struct management_tlv *m, uint16_t data_len,
+			     struct tlv_extra *extra)
+{
+	port_ds_n2h((struct portDS *) m->data);
+	return 0;
+}
+
+static void port_ds_pre_send(struct management_tlv *m, struct tlv_extra *extra)
+{
+	port_ds_h2n((struct portDS *) m->data);
+}
+
+static int time_status_post_recv(struct management_tlv *m, uint16_t data_len,
+				 struct tlv_extra *extra)
+{
+	time_status_n2h((struct time_status_np *) m->data);
+	return 0;
+}
+
+static void time_status_pre_send(struct management_tlv *m,
+				 struct tlv_extra *extra)
+{
+	time_status_h2n((struct time_status_np *) m->data);
+}
+
+static int gm_settings_post_recv(struct management_tlv *m, uint16_t data_len,
+				 struct tlv_extra *extra)
+{
+	struct grandmaster_settings_np *gsn =
+		(struct grandmaster_settings_np *) m->data;
+
+	gsn->clockQuality.offsetScaledLogVariance =
+		ntohs(gsn->clockQuality.offsetScaledLogVariance);
+	gsn->utc_offset = ntohs(gsn->utc_offset);
+	return 0;
+}
+
+static void gm_settings_pre_send(struct management_tlv *m,
+				 struct tlv_extra *extra)
+{
+	struct grandmaster_settings_np *gsn =
+		(struct grandmaster_settings_np *) m->data;
+
+	gsn->clockQuality.offsetScaledLogVariance =
+		htons(gsn->clockQuality.offsetScaledLogVariance);
+	gsn->utc_offset = htons(gsn->utc_offset);
+}
+
+static int port_ds_np_post_recv(struct management_tlv *m, uint16_t data_len,
+				struct tlv_extra *extra)
+{
+	struct port_ds_np *pdsnp = (struct port_ds_np *) m->data;
+
+	pdsnp->neighborPropDelayThresh = ntohl(pdsnp->neighborPropDelayThresh);
+	pdsnp->asCapable = ntohl(pdsnp->asCapable);
+	return 0;
+}
+
+static void port_ds_np_pre_send(struct management_tlv *m,
+				struct tlv_extra *extra)
+{
+	struct port_ds_np *pdsnp = (struct port_ds_np *) m->data;
+
+	pdsnp->neighborPropDelayThresh = htonl(pdsnp->neighborPropDelayThresh);
+	pdsnp->asCapable = htonl(pdsnp->asCapable);
+}
+
+static int subscribe_events_post_recv(struct management_tlv *m,
+				      uint16_t data_len,
+				      struct tlv_extra *extra)
+{
+	struct subscribe_events_np *sen = (struct subscribe_events_np *) m->data;
+
+	sen->duration = ntohs(sen->duration);
+	return 0;
+}
+
+static void subscribe_events_pre_send(struct management_tlv *m,
+				      struct tlv_extra *extra)
+{
+	struct subscribe_events_np *sen = (struct subscribe_events_np *) m->data;
+
+	sen->duration = htons(sen->duration);
+}
+
+static int port_properties_post_recv(struct management_tlv *m,
+				     uint16_t data_len,
+				     struct tlv_extra *extra)
+{
+	struct port_properties_np *ppn = (struct port_properties_np *) m->data;
+
+	ppn->portIdentity.portNumber = ntohs(ppn->portIdentity.portNumber);
+	return sizeof(struct port_properties_np) + ppn->interface.length;
+}
+
+static void port_properties_pre_send(struct management_tlv *m,
+				     struct tlv_extra *extra)
+{
+	struct port_properties_np *ppn = (struct port_properties_np *) m->data;
+
+	ppn->portIdentity.portNumber = htons(ppn->portIdentity.portNumber);
+}
+
+static int msg_pool_stats_post_recv(struct management_tlv *m,
+				    uint16_t data_len,
+				    struct tlv_extra *extra)
+{
+	struct msg_pool_stats_np *mps = (struct msg_pool_stats_np *) m->data;
+
+	mps->total = ntohl(mps->total);
+	mps->free = ntohl(mps->free);
+	mps->limit = ntohl(mps->limit);
+	mps->high_water = ntohl(mps->high_water);
+	mps->hits = net2host64(mps->hits);
+	mps->misses = net2host64(mps->misses);
+	mps->failures = net2host64(mps->failures);
+	return 0;
+}
+
+static void msg_pool_stats_pre_send(struct management_tlv *m,
+				    struct tlv_extra *extra)
+{
+	struct msg_pool_stats_np *mps = (struct msg_pool_stats_np *) m->data;
+
+	mps->total = htonl(mps->total);
+	mps->free = htonl(mps->free);
+	mps->limit = htonl(mps->limit);
+	mps->high_water = htonl(mps->high_water);
+	mps->hits = host2net64(mps->hits);
+	mps->misses = host2net64(mps->misses);
+	mps->failures = host2net64(mps->failures);
+}
+
+static int clock_stats_post_recv(struct management_tlv *m, uint16_t data_len,
+				 struct tlv_extra *extra)
+{
+	struct clock_stats_np *csn = (struct clock_stats_np *) m->data;
+
+	csn->offset_samples = ntohl(csn->offset_samples);
+	csn->delay_samples = ntohl(csn->delay_samples);
+	csn->offset_rms = net2host64(csn->offset_rms);
+	csn->offset_max = net2host64(csn->offset_max);
+	csn->offset_p50 = net2host64(csn->offset_p50);
+	csn->offset_p99 = net2host64(csn->offset_p99);
+	csn->offset_p999 = net2host64(csn->offset_p999);
+	csn->delay_mean = net2host64(csn->delay_mean);
+	csn->delay_p50 = net2host64(csn->delay_p50);
+	csn->delay_p99 = net2host64(csn->delay_p99);
+	csn->delay_p999 = net2host64(csn->delay_p999);
+	return 0;
+}
+
+static void clock_stats_pre_send(struct management_tlv *m,
+				 struct tlv_extra *extra)
+{
+	struct clock_stats_np *csn = (struct clock_stats_np *) m->data;
+
+	csn->offset_samples = htonl(csn->offset_samples);
+	csn->delay_samples = htonl(csn->delay_samples);
+	csn->offset_rms = host2net64(csn->offset_rms);
+	csn->offset_max = host2net64(csn->offset_max);
+	csn->offset_p50 = host2net64(csn->offset_p50);
+	csn->offset_p99 = host2net64(csn->offset_p99);
+	csn->offset_p999 = host2net64(csn->offset_p999);
+	csn->delay_mean = host2net64(csn->delay_mean);
+	csn->delay_p50 = host2net64(csn->delay_p50);
+	csn->delay_p99 = host2net64(csn->delay_p99);
+	csn->delay_p999 = host2net64(csn->delay_p999);
+}
+
+static int holdover_post_recv(struct management_tlv *m, uint16_t data_len,
+			      struct tlv_extra *extra)
+{
+	struct holdover_np *hon = (struct holdover_np *) m->data;
+
+	hon->active = ntohl(hon->active);
+	hon->duration = ntohl(hon->duration);
+	hon->points = ntohl(hon->points);
+	hon->frequency = net2host64(hon->frequency);
+	hon->drift = net2host64(hon->drift);
+	hon->temp_coeff = net2host64(hon->temp_coeff);
+	hon->error = net2host64(hon->error);
+	return 0;
+}
+
+static void holdover_pre_send(struct management_tlv *m,
+			      struct tlv_extra *extra)
+{
+	struct holdover_np *hon = (struct holdover_np *) m->data;
+
+	hon->active = htonl(hon->active);
+	hon->duration = htonl(hon->duration);
+	hon->points = htonl(hon->points);
+	hon->frequency = host2net64(hon->frequency);
+	hon->drift = host2net64(hon->drift);
+	hon->temp_coeff = host2net64(hon->temp_coeff);
+	hon->error = host2net64(hon->error);
+}
+
+static int snapshot_post_recv(struct management_tlv *m, uint16_t data_len,
+			      struct tlv_extra *extra)
+{
+	struct snapshot_np *snp = (struct snapshot_np *) m->data;
+	int i;
+
+	snp->portCount = ntohs(snp->portCount);
+	if (snp->portCount > SNAPSHOT_NP_MAX_PORTS ||
+	    data_len != sizeof(struct snapshot_np) +
+			snp->portCount * sizeof(struct portDS))
+		return -EBADMSG;
+	default_ds_n2h(&snp->dds);
+	current_ds_n2h(&snp->cds);
+	parent_ds_n2h(&snp->pds);
+	snp->tds.currentUtcOffset = ntohs(snp->tds.currentUtcOffset);
+	time_status_n2h(&snp->tsn);
+	for (i = 0; i < snp->portCount; i++)
+		port_ds_n2h(&snp->ports[i]);
+	return 0;
+}
+
+static void snapshot_pre_send(struct management_tlv *m,
+			      struct tlv_extra *extra)
+{
+	struct snapshot_np *snp = (struct snapshot_np *) m->data;
+	int i;
+
+	default_ds_h2n(&snp->dds);
+	current_ds_h2n(&snp->cds);
+	parent_ds_h2n(&snp->pds);
+	snp->tds.currentUtcOffset = htons(snp->tds.currentUtcOffset);
+	time_status_h2n(&snp->tsn);
+	for (i = 0; i < snp->portCount; i++)
+		port_ds_h2n(&snp->ports[i]);
+	snp->portCount = htons(snp->portCount);
+}
+
+static int sync_sample_post_recv(struct management_tlv *m, uint16_t data_len,
+				 struct tlv_extra *extra)
+{
+	struct sync_sample_np *ssn = (struct sync_sample_np *) m->data;
+
+	ssn->master_offset = net2host64(ssn->master_offset);
+	ssn->path_delay = net2host64(ssn->path_delay);
+	ssn->ingress_time = net2host64(ssn->ingress_time);
+	ssn->frequency = net2host64(ssn->frequency);
+	ssn->sequence = ntohl(ssn->sequence);
+	return 0;
+}
+
+static void sync_sample_pre_send(struct management_tlv *m,
+				 struct tlv_extra *extra)
+{
+	struct sync_sample_np *ssn = (struct sync_sample_np *) m->data;
+
+	ssn->master_offset = host2net64(ssn->master_offset);
+	ssn->path_delay = host2net64(ssn->path_delay);
+	ssn->ingress_time = host2net64(ssn->ingress_time);
+	ssn->frequency = host2net64(ssn->frequency);
+	ssn->sequence = htonl(ssn->sequence);
+}
+
+static int mgmt_stats_post_recv(struct management_tlv *m, uint16_t data_len,
+				struct tlv_extra *extra)
+{
+	struct management_stats_np *msn =
+		(struct management_stats_np *) m->data;
+
+	msn->admitted = net2host64(msn->admitted);
+	msn->dropped = net2host64(msn->dropped);
+	msn->overflows = net2host64(msn->overflows);
+	msn->sources = ntohl(msn->sources);
+	msn->limited = ntohl(msn->limited);
+	return 0;
+}
+
+static void mgmt_stats_pre_send(struct management_tlv *m,
+				struct tlv_extra *extra)
+{
+	struct management_stats_np *msn =
+		(struct management_stats_np *) m->data;
+
+	msn->admitted = host2net64(msn->admitted);
+	msn->dropped = host2net64(msn->dropped);
+	msn->overflows = host2net64(msn->overflows);
+	msn->sources = htonl(msn->sources);
+	msn->limited = htonl(msn->limited);
+}
+
+static int cpu_stats_post_recv(struct management_tlv *m, uint16_t data_len,
+			       struct tlv_extra *extra)
+{
+	struct cpu_stats_np *csn = (struct cpu_stats_np *) m->data;
+	int i;
+
+	for (i = 0; i < CPU_STATS_STAGES; i++) {
+		csn->stage[i].ns = net2host64(csn->stage[i].ns);
+		csn->stage[i].count = net2host64(csn->stage[i].count);
+	}
+	return 0;
+}
+
+static void cpu_stats_pre_send(struct management_tlv *m,
+			       struct tlv_extra *extra)
+{
+	struct cpu_stats_np *csn = (struct cpu_stats_np *) m->data;
+	int i;
+
+	for (i = 0; i < CPU_STATS_STAGES; i++) {
+		csn->stage[i].ns = host2net64(csn->stage[i].ns);
+		csn->stage[i].count = host2net64(csn->stage[i].count);
+	}
+}
+
+static int perf_stats_post_recv(struct management_tlv *m, uint16_t data_len,
+				struct tlv_extra *extra)
+{
+	struct perf_stats_np *psn = (struct perf_stats_np *) m->data;
+
+	psn->wakeups = net2host64(psn->wakeups);
+	psn->events = net2host64(psn->events);
+	psn->pool_hits = net2host64(psn->pool_hits);
+	psn->pool_misses = net2host64(psn->pool_misses);
+	psn->pool_failures = net2host64(psn->pool_failures);
+	psn->pool_total = ntohl(psn->pool_total);
+	psn->pool_high_water = ntohl(psn->pool_high_water);
+	psn->txts_count = net2host64(psn->txts_count);
+	psn->txts_timeouts = net2host64(psn->txts_timeouts);
+	psn->txts_p99 = net2host64(psn->txts_p99);
+	psn->txts_max = net2host64(psn->txts_max);
+	psn->servo_ns = net2host64(psn->servo_ns);
+	psn->servo_count = net2host64(psn->servo_count);
+	psn->adj_issued = net2host64(psn->adj_issued);
+	psn->adj_avoided = net2host64(psn->adj_avoided);
+	return 0;
+}
+
+static void perf_stats_pre_send(struct management_tlv *m,
+				struct tlv_extra *extra)
+{
+	struct perf_stats_np *psn = (struct perf_stats_np *) m->data;
+
+	psn->wakeups = host2net64(psn->wakeups);
+	psn->events = host2net64(psn->events);
+	psn->pool_hits = host2net64(psn->pool_hits);
+	psn->pool_misses = host2net64(psn->pool_misses);
+	psn->pool_failures = host2net64(psn->pool_failures);
+	psn->pool_total = htonl(psn->pool_total);
+	psn->pool_high_water = htonl(psn->pool_high_water);
+	psn->txts_count = host2net64(psn->txts_count);
+	psn->txts_timeouts = host2net64(psn->txts_timeouts);
+	psn->txts_p99 = host2net64(psn->txts_p99);
+	psn->txts_max = host2net64(psn->txts_max);
+	psn->servo_ns = host2net64(psn->servo_ns);
+	psn->servo_count = host2net64(psn->servo_count);
+	psn->adj_issued = host2net64(psn->adj_issued);
+	psn->adj_avoided = host2net64(psn->adj_avoided);
+}
+
+static int port_stats_post_recv(struct management_tlv *m, uint16_t data_len,
+				struct tlv_extra *extra)
+{
+	struct port_stats_np *psn = (struct port_stats_np *) m->data;
+	struct port_stats *s = &psn->stats;
+	int i;
+
+	psn->portIdentity.portNumber = ntohs(psn->portIdentity.portNumber);
+	for (i = 0; i < MAX_MESSAGE_TYPES; i++) {
+		s->rx[i] = net2host64(s->rx[i]);
+		s->tx[i] = net2host64(s->tx[i]);
+		s->rx_ignored[i] = net2host64(s->rx_ignored[i]);
+		s->rx_bad[i] = net2host64(s->rx_bad[i]);
+		s->rx_no_ts[i] = net2host64(s->rx_no_ts[i]);
+		s->tx_ts_timeout[i] = net2host64(s->tx_ts_timeout[i]);
+	}
+	return 0;
+}
+
+static void port_stats_pre_send(struct management_tlv *m,
+				struct tlv_extra *extra)
+{
+	struct port_stats_np *psn = (struct port_stats_np *) m->data;
+	struct port_stats *s = &psn->stats;
+	int i;
+
+	psn->portIdentity.portNumber = htons(psn->portIdentity.portNumber);
+	for (i = 0; i < MAX_MESSAGE_TYPES; i++) {
+		s->rx[i] = host2net64(s->rx[i]);
+		s->tx[i] = host2net64(s->tx[i]);
+		s->rx_ignored[i] = host2net64(s->rx_ignored[i]);
+		s->rx_bad[i] = host2net64(s->rx_bad[i]);
+		s->rx_no_ts[i] = host2net64(s->rx_no_ts[i]);
+		s->tx_ts_timeout[i] = host2net64(s->tx_ts_timeout[i]);
+	}
+}
+
+static int txts_stats_post_recv(struct management_tlv *m, uint16_t data_len,
+				struct tlv_extra *extra)
+{
+	struct tx_timestamp_stats_np *tsn =
+		(struct tx_timestamp_stats_np *) m->data;
+	int i;
+
+	tsn->portIdentity.portNumber = ntohs(tsn->portIdentity.portNumber);
+	tsn->count = ntohl(tsn->count);
+	tsn->timeouts = ntohl(tsn->timeouts);
+	tsn->timeout = ntohl(tsn->timeout);
+	tsn->suggested_timeout = ntohl(tsn->suggested_timeout);
+	tsn->mean = net2host64(tsn->mean);
+	tsn->p50 = net2host64(tsn->p50);
+	tsn->p99 = net2host64(tsn->p99);
+	tsn->p999 = net2host64(tsn->p999);
+	tsn->max = net2host64(tsn->max);
+	for (i = 0; i < TX_TIMESTAMP_HIST_BINS; i++)
+		tsn->histogram[i] = ntohl(tsn->histogram[i]);
+	return 0;
+}
+
+static void txts_stats_pre_send(struct management_tlv *m,
+				struct tlv_extra *extra)
+{
+	struct tx_timestamp_stats_np *tsn =
+		(struct tx_timestamp_stats_np *) m->data;
+	int i;
+
+	tsn->portIdentity.portNumber = htons(tsn->portIdentity.portNumber);
+	tsn->count = htonl(tsn->count);
+	tsn->timeouts = htonl(tsn->timeouts);
+	tsn->timeout = htonl(tsn->timeout);
+	tsn->suggested_timeout = htonl(tsn->suggested_timeout);
+	tsn->mean = host2net64(tsn->mean);
+	tsn->p50 = host2net64(tsn->p50);
+	tsn->p99 = host2net64(tsn->p99);
+	tsn->p999 = host2net64(tsn->p999);
+	tsn->max = host2net64(tsn->max);
+	for (i = 0; i < TX_TIMESTAMP_HIST_BINS; i++)
+		tsn->histogram[i] = htonl(tsn->histogram[i]);
+}
+
+/* The data may be longer than the size of the descriptor. */
+#define TLV_DESC_VARIABLE	(1 << 0)
+
+/* Describes the data of a management TLV. */
+struct mgt_tlv_desc {
+	/* The management ID */
+	uint16_t id;
+	/* The length of the data, or its minimum with TLV_DESC_VARIABLE */
+	uint16_t size;
+	int flags;
+	/*
+	 * Converts the data into host byte order. Returns the length of
+	 * the data actually used, which must match the length of the TLV
+	 * but for the padding, or zero to skip this check, or -EBADMSG.
+	 * May be NULL.
+	 */
+	int (*post_recv)(struct management_tlv *m, uint16_t data_len,
+			 struct tlv_extra *extra);
+	/* Converts the data into network byte order, may be NULL. */
+	void (*pre_send)(struct management_tlv *m, struct tlv_extra *extra);
+};
+
+/* Describes an organization extension TLV. */
+struct org_tlv_desc {
+	Octet id[3];
+	Octet subtype[3];
+	/* The length of the whole TLV, or its minimum with TLV_DESC_VARIABLE */
+	uint16_t size;
+	int flags;
+	/* Converts the TLV into host byte order, returns zero or -EBADMSG. */
+	int (*post_recv)(struct organization_tlv *org);
+	/* Converts the TLV into network byte order. */
+	void (*pre_send)(struct organization_tlv *org);
+};
+
+#define MGT_TLV(i, s, f, post, pre) \
+	[(i) & 0xff] = &(const struct mgt_tlv_desc) { \
+		.id = i, .size = s, .flags = f, .post_recv = post, .pre_send = pre }
+
+#define MGT_TLV_EMPTY(i) MGT_TLV(i, 0, 0, NULL, NULL)
+
+static const struct mgt_tlv_desc *const mgt_page_00[256] = {
+	MGT_TLV(TLV_CLOCK_DESCRIPTION, 0, TLV_DESC_VARIABLE,
+		clock_description_post_recv, clock_description_pre_send),
+	MGT_TLV(TLV_USER_DESCRIPTION, sizeof(struct PTPText), TLV_DESC_VARIABLE,
+		user_description_post_recv, NULL),
+	MGT_TLV_EMPTY(TLV_SAVE_IN_NON_VOLATILE_STORAGE),
+	MGT_TLV_EMPTY(TLV_RESET_NON_VOLATILE_STORAGE),
+	MGT_TLV_EMPTY(TLV_INITIALIZE),
+	MGT_TLV_EMPTY(TLV_FAULT_LOG_RESET),
+};
+
+static const struct mgt_tlv_desc *const mgt_page_20[256] = {
+	MGT_TLV(TLV_DEFAULT_DATA_SET, sizeof(struct defaultDS), 0,
+		default_ds_post_recv, default_ds_pre_send),
+	MGT_TLV(TLV_CURRENT_DATA_SET, sizeof(struct currentDS), 0,
+		current_ds_post_recv, current_ds_pre_send),
+	MGT_TLV(TLV_PARENT_DATA_SET, sizeof(struct parentDS), 0,
+		parent_ds_post_recv, parent_ds_pre_send),
+	MGT_TLV(TLV_TIME_PROPERTIES_DATA_SET, sizeof(struct timePropertiesDS), 0,
+		time_properties_post_recv, time_properties_pre_send),
+	MGT_TLV(TLV_PORT_DATA_SET, sizeof(struct portDS), 0,
+		port_ds_post_recv, port_ds_pre_send),
+	MGT_TLV_EMPTY(TLV_ENABLE_PORT),
+	MGT_TLV_EMPTY(TLV_DISABLE_PORT),
+};
+
+static const struct mgt_tlv_desc *const mgt_page_c0[256] = {
+	MGT_TLV(TLV_TIME_STATUS_NP, sizeof(struct time_status_np), 0,
+		time_status_post_recv, time_status_pre_send),
+	MGT_TLV(TLV_GRANDMASTER_SETTINGS_NP,
+		sizeof(struct grandmaster_settings_np), 0,
+		gm_settings_post_recv, gm_settings_pre_send),
+	MGT_TLV(TLV_PORT_DATA_SET_NP, sizeof(struct port_ds_np), 0,
+		port_ds_np_post_recv, port_ds_np_pre_send),
+	MGT_TLV(TLV_SUBSCRIBE_EVENTS_NP, sizeof(struct subscribe_events_np), 0,
+		subscribe_events_post_recv, subscribe_events_pre_send),
+	MGT_TLV(TLV_PORT_PROPERTIES_NP, sizeof(struct port_properties_np),
+		TLV_DESC_VARIABLE,
+		port_properties_post_recv, port_properties_pre_send),
+	MGT_TLV(TLV_MSG_POOL_STATS_NP, sizeof(struct msg_pool_stats_np), 0,
+		msg_pool_stats_post_recv, msg_pool_stats_pre_send),
+	MGT_TLV(TLV_CLOCK_STATS_NP, sizeof(struct clock_stats_np), 0,
+		clock_stats_post_recv, clock_stats_pre_send),
+	MGT_TLV(TLV_HOLDOVER_NP, sizeof(struct holdover_np), 0,
+		holdover_post_recv, holdover_pre_send),
+	MGT_TLV(TLV_SNAPSHOT_NP, sizeof(struct snapshot_np), TLV_DESC_VARIABLE,
+		snapshot_post_recv, snapshot_pre_send),
+	MGT_TLV(TLV_SYNC_SAMPLE_NP, sizeof(struct sync_sample_np), 0,
+		sync_sample_post_recv, sync_sample_pre_send),
+	MGT_TLV(TLV_MANAGEMENT_STATS_NP, sizeof(struct management_stats_np), 0,
+		mgmt_stats_post_recv, mgmt_stats_pre_send),
+	MGT_TLV(TLV_CPU_STATS_NP, sizeof(struct cpu_stats_np), 0,
+		cpu_stats_post_recv, cpu_stats_pre_send),
+	MGT_TLV(TLV_PERF_STATS_NP, sizeof(struct perf_stats_np), 0,
+		perf_stats_post_recv, perf_stats_pre_send),
+	MGT_TLV(TLV_PORT_STATS_NP, sizeof(struct port_stats_np), 0,
+		port_stats_post_recv, port_stats_pre_send),
+	MGT_TLV(TLV_TX_TIMESTAMP_STATS_NP, sizeof(struct tx_timestamp_stats_np),
+		0, txts_stats_post_recv, txts_stats_pre_send),
+};
+
+/* The descriptors indexed by the high and the low byte of the ID */
+static const struct mgt_tlv_desc *const *mgt_table[256] = {
+	[0x00] = mgt_page_00,
+	[0x20] = mgt_page_20,
+	[0xc0] = mgt_page_c0,
+};
+
+static const struct mgt_tlv_desc *mgt_desc(uint16_t id)
+{
+	const struct mgt_tlv_desc *const *page = mgt_table[id >> 8];
+
+	return page ? page[id & 0xff] : NULL;
+}
+
+static int mgt_post_recv(struct management_tlv *m, uint16_t data_len,
+			 struct tlv_extra *extra)
+{
+	const struct mgt_tlv_desc *desc = mgt_desc(m->id);
+	int extra_len = 0;
+
+	if (!desc)
+		return 0;
+	if (desc->flags & TLV_DESC_VARIABLE ?
+	    data_len < desc->size : data_len != desc->size)
+		goto bad_length;
+	if (desc->post_recv) {
+		extra_len = desc->post_recv(m, data_len, extra);
+		if (extra_len < 0)
+			return extra_len;
 	}
 	if (extra_len) {
 		if (extra_len % 2)
@@ -281,134 +912,87 @@ bad_length:
 
 static void mgt_pre_send(struct management_tlv *m, struct tlv_extra *extra)
 {
-	struct defaultDS *dds;
-	struct currentDS *cds;
-	struct parentDS *pds;
-	struct timePropertiesDS *tp;
-	struct portDS *p;
-	struct port_ds_np *pdsnp;
-	struct time_status_np *tsn;
-	struct grandmaster_settings_np *gsn;
-	struct subscribe_events_np *sen;
-	struct port_properties_np *ppn;
-	struct mgmt_clock_description *cd;
-	switch (m->id) {
-	case TLV_CLOCK_DESCRIPTION:
-		if (extra) {
-			cd = &extra->cd;
-			flip16(cd->clockType);
-			flip16(&cd->physicalAddress->length);
-			flip16(&cd->protocolAddress->networkProtocol);
-			flip16(&cd->protocolAddress->addressLength);
-		}
-		break;
-	case TLV_DEFAULT_DATA_SET:
-		dds = (struct defaultDS *) m->data;
-		dds->numberPorts = htons(dds->numberPorts);
-		dds->clockQuality.offsetScaledLogVariance =
-			htons(dds->clockQuality.offsetScaledLogVariance);
-		break;
-	case TLV_CURRENT_DATA_SET:
-		cds = (struct currentDS *) m->data;
-		cds->stepsRemoved = htons(cds->stepsRemoved);
-		cds->offsetFromMaster = host2net64(cds->offsetFromMaster);
-		cds->meanPathDelay = host2net64(cds->meanPathDelay);
-		break;
-	case TLV_PARENT_DATA_SET:
-		pds = (struct parentDS *) m->data;
-		pds->parentPortIdentity.portNumber =
-			htons(pds->parentPortIdentity.portNumber);
-		pds->observedParentOffsetScaledLogVariance =
-			htons(pds->observedParentOffsetScaledLogVariance);
-		pds->observedParentClockPhaseChangeRate =
-			htonl(pds->observedParentClockPhaseChangeRate);
-		pds->grandmasterClockQuality.offsetScaledLogVariance =
-			htons(pds->grandmasterClockQuality.offsetScaledLogVariance);
-		break;
-	case TLV_TIME_PROPERTIES_DATA_SET:
-		tp = (struct timePropertiesDS *) m->data;
-		tp->currentUtcOffset = htons(tp->currentUtcOffset);
-		break;
-	case TLV_PORT_DATA_SET:
-		p = (struct portDS *) m->data;
-		p->portIdentity.portNumber = htons(p->portIdentity.portNumber);
-		p->peerMeanPathDelay = host2net64(p->peerMeanPathDelay);
-		break;
-	case TLV_TIME_STATUS_NP:
-		tsn = (struct time_status_np *) m->data;
-		tsn->master_offset = host2net64(tsn->master_offset);
-		tsn->ingress_time = host2net64(tsn->ingress_time);
-		tsn->cumulativeScaledRateOffset = htonl(tsn->cumulativeScaledRateOffset);
-		tsn->scaledLastGmPhaseChange = htonl(tsn->scaledLastGmPhaseChange);
-		tsn->gmTimeBaseIndicator = htons(tsn->gmTimeBaseIndicator);
-		scaled_ns_h2n(&tsn->lastGmPhaseChange);
-		tsn->gmPresent = htonl(tsn->gmPresent);
-		break;
-	case TLV_GRANDMASTER_SETTINGS_NP:
-		gsn = (struct grandmaster_settings_np *) m->data;
-		gsn->clockQuality.offsetScaledLogVariance =
-			htons(gsn->clockQuality.offsetScaledLogVariance);
-		gsn->utc_offset = htons(gsn->utc_offset);
-		break;
-	case TLV_PORT_DATA_SET_NP:
-		pdsnp = (struct port_ds_np *) m->data;
-		pdsnp->neighborPropDelayThresh = htonl(pdsnp->neighborPropDelayThresh);
-		pdsnp->asCapable = htonl(pdsnp->asCapable);
-		break;
-	case TLV_SUBSCRIBE_EVENTS_NP:
-		sen = (struct subscribe_events_np *)m->data;
-		sen->duration = htons(sen->duration);
-		break;
-	case TLV_PORT_PROPERTIES_NP:
-		ppn = (struct port_properties_np *)m->data;
-		ppn->portIdentity.portNumber = htons(ppn->portIdentity.portNumber);
-		break;
+	const struct mgt_tlv_desc *desc = mgt_desc(m->id);
+
+	if (desc && desc->pre_send)
+		desc->pre_send(m, extra);
+}
+
+/* The organization extensions, to be matched by their OUI and subtype */
+
+static int follow_up_info_post_recv(struct organization_tlv *org)
+{
+	struct follow_up_info_tlv *f = (struct follow_up_info_tlv *) org;
+
+	f->cumulativeScaledRateOffset = ntohl(f->cumulativeScaledRateOffset);
+	f->gmTimeBaseIndicator = ntohs(f->gmTimeBaseIndicator);
+	scaled_ns_n2h(&f->lastGmPhaseChange);
+	f->scaledLastGmPhaseChange = ntohl(f->scaledLastGmPhaseChange);
+	return 0;
+}
+
+static void follow_up_info_pre_send(struct organization_tlv *org)
+{
+	struct follow_up_info_tlv *f = (struct follow_up_info_tlv *) org;
+
+	f->cumulativeScaledRateOffset = htonl(f->cumulativeScaledRateOffset);
+	f->gmTimeBaseIndicator = htons(f->gmTimeBaseIndicator);
+	scaled_ns_h2n(&f->lastGmPhaseChange);
+	f->scaledLastGmPhaseChange = htonl(f->scaledLastGmPhaseChange);
+}
+
+static const struct org_tlv_desc follow_up_info_desc = {
+	.id = { IEEE_802_1_COMMITTEE },
+	.subtype = { 0, 0, 1 },
+	.size = sizeof(struct follow_up_info_tlv),
+	.post_recv = follow_up_info_post_recv,
+	.pre_send = follow_up_info_pre_send,
+};
+
+static const struct org_tlv_desc msg_interval_req_desc = {
+	.id = { IEEE_802_1_COMMITTEE },
+	.subtype = { 0, 0, 2 },
+	.size = sizeof(struct msg_interval_req_tlv),
+};
+
+static const struct org_tlv_desc *const org_table[] = {
+	&follow_up_info_desc,
+	&msg_interval_req_desc,
+};
+
+#define N_ORG_TLVS (sizeof(org_table) / sizeof(org_table[0]))
+
+static const struct org_tlv_desc *org_desc(struct organization_tlv *org)
+{
+	int i;
+
+	for (i = 0; i < N_ORG_TLVS; i++) {
+		if (!memcmp(org_table[i]->id, org->id, sizeof(org->id)) &&
+		    !memcmp(org_table[i]->subtype, org->subtype,
+			    sizeof(org->subtype)))
+			return org_table[i];
 	}
+	return NULL;
 }
 
 static int org_post_recv(struct organization_tlv *org)
 {
-	struct follow_up_info_tlv *f;
+	const struct org_tlv_desc *desc = org_desc(org);
+	size_t len = org->length + sizeof(struct TLV);
 
-	if (0 == memcmp(org->id, ieee8021_id, sizeof(ieee8021_id))) {
-		if (org->subtype[0] || org->subtype[1]) {
-			return 0;
-		}
-		switch (org->subtype[2]) {
-		case 1:
-			if (org->length + sizeof(struct TLV) != sizeof(struct follow_up_info_tlv))
-				goto bad_length;
-			f = (struct follow_up_info_tlv *) org;
-			f->cumulativeScaledRateOffset = ntohl(f->cumulativeScaledRateOffset);
-			f->gmTimeBaseIndicator = ntohs(f->gmTimeBaseIndicator);
-			scaled_ns_n2h(&f->lastGmPhaseChange);
-			f->scaledLastGmPhaseChange = ntohl(f->scaledLastGmPhaseChange);
-			break;
-		}
-	}
-	return 0;
-bad_length:
-	return -EBADMSG;
+	if (!desc)
+		return 0;
+	if (desc->flags & TLV_DESC_VARIABLE ? len < desc->size : len != desc->size)
+		return -EBADMSG;
+	return desc->post_recv ? desc->post_recv(org) : 0;
 }
 
 static void org_pre_send(struct organization_tlv *org)
 {
-	struct follow_up_info_tlv *f;
+	const struct org_tlv_desc *desc = org_desc(org);
 
-	if (0 == memcmp(org->id, ieee8021_id, sizeof(ieee8021_id))) {
-		if (org->subtype[0] || org->subtype[1]) {
-			return;
-		}
-		switch (org->subtype[2]) {
-		case 1:
-			f = (struct follow_up_info_tlv *) org;
-			f->cumulativeScaledRateOffset = htonl(f->cumulativeScaledRateOffset);
-			f->gmTimeBaseIndicator = htons(f->gmTimeBaseIndicator);
-			scaled_ns_h2n(&f->lastGmPhaseChange);
-			f->scaledLastGmPhaseChange = htonl(f->scaledLastGmPhaseChange);
-			break;
-		}
-	}
+	if (desc && desc->pre_send)
+		desc->pre_send(org);
 }
 
 int tlv_post_recv(struct TLV *tlv, struct tlv_extra *extra)
@@ -416,6 +1000,8 @@ int tlv_post_recv(struct TLV *tlv, struct tlv_extra *extra)
 	int result = 0;
 	struct management_tlv *mgt;
 	struct management_error_status *mes;
+	struct request_unicast_xmit_tlv *req;
+	struct grant_unicast_xmit_tlv *grant;
 	struct path_trace_tlv *ptt;
 	struct tlv_extra dummy_extra;
 	if (!extra)
@@ -443,9 +1029,21 @@ int tlv_post_recv(struct TLV *tlv, struct tlv_extra *extra)
 		result = org_post_recv((struct organization_tlv *) tlv);
 		break;
 	case TLV_REQUEST_UNICAST_TRANSMISSION:
+		if (TLV_LENGTH_INVALID(tlv, request_unicast_xmit_tlv))
+			goto bad_length;
+		req = (struct request_unicast_xmit_tlv *) tlv;
+		req->durationField = ntohl(req->durationField);
+		break;
 	case TLV_GRANT_UNICAST_TRANSMISSION:
+		if (TLV_LENGTH_INVALID(tlv, grant_unicast_xmit_tlv))
+			goto bad_length;
+		grant = (struct grant_unicast_xmit_tlv *) tlv;
+		grant->durationField = ntohl(grant->durationField);
+		break;
 	case TLV_CANCEL_UNICAST_TRANSMISSION:
 	case TLV_ACKNOWLEDGE_CANCEL_UNICAST_TRANSMISSION:
+		if (TLV_LENGTH_INVALID(tlv, cancel_unicast_xmit_tlv))
+			goto bad_length;
 		break;
 	case TLV_PATH_TRACE:
 		ptt = (struct path_trace_tlv *) tlv;
@@ -470,6 +1068,8 @@ void tlv_pre_send(struct TLV *tlv, struct tlv_extra *extra)
 {
 	struct management_tlv *mgt;
 	struct management_error_status *mes;
+	struct request_unicast_xmit_tlv *req;
+	struct grant_unicast_xmit_tlv *grant;
 
 	switch (tlv->type) {
 	case TLV_MANAGEMENT:
@@ -487,7 +1087,13 @@ void tlv_pre_send(struct TLV *tlv, struct tlv_extra *extra)
 		org_pre_send((struct organization_tlv *) tlv);
 		break;
 	case TLV_REQUEST_UNICAST_TRANSMISSION:
+		req = (struct request_unicast_xmit_tlv *) tlv;
+		req->durationField = htonl(req->durationField);
+		break;
 	case TLV_GRANT_UNICAST_TRANSMISSION:
+		grant = (struct grant_unicast_xmit_tlv *) tlv;
+		grant->durationField = htonl(grant->durationField);
+		break;
 	case TLV_CANCEL_UNICAST_TRANSMISSION:
 	case TLV_ACKNOWLEDGE_CANCEL_UNICAST_TRANSMISSION:
 	case TLV_PATH_TRACE:
@@ -80,6 +80,14 @@ enum management_action {
 #define TLV_TIME_STATUS_NP				0xC000
 #define TLV_GRANDMASTER_SETTINGS_NP			0xC001
 #define TLV_SUBSCRIBE_EVENTS_NP				0xC003
+#define TLV_MSG_POOL_STATS_NP				0xC005
+#define TLV_CLOCK_STATS_NP				0xC006
+#define TLV_HOLDOVER_NP					0xC007
+#define TLV_SNAPSHOT_NP					0xC008
+#define TLV_SYNC_SAMPLE_NP				0xC009
+#define TLV_MANAGEMENT_STATS_NP				0xC00A
+#define TLV_CPU_STATS_NP				0xC00D
+#define TLV_PERF_STATS_NP				0xC00E
 
 /* Port management ID values */
 #define TLV_NULL_MANAGEMENT				0x0000
@@ -101,6 +109,8 @@ enum management_action {
 #define TLV_LOG_MIN_PDELAY_REQ_INTERVAL			0x6001
 #define TLV_PORT_DATA_SET_NP				0xC002
 #define TLV_PORT_PROPERTIES_NP				0xC004
+#define TLV_PORT_STATS_NP				0xC00B
+#define TLV_TX_TIMESTAMP_STATS_NP			0xC00C
 
 /* Management error ID values */
 #define TLV_RESPONSE_TOO_BIG				0x0001
@@ -175,6 +185,55 @@ struct follow_up_info_tlv {
 	Integer32     scaledLastGmPhaseChange;
 } PACKED;
 
+/* Special values of the message interval request */
+#define MSG_INTERVAL_NO_CHANGE	-128
+#define MSG_INTERVAL_INITIAL	126
+#define MSG_INTERVAL_STOP	127
+
+struct msg_interval_req_tlv {
+	Enumeration16 type;
+	UInteger16    length;
+	Octet         id[3];
+	Octet         subtype[3];
+	Integer8      linkDelayInterval;
+	Integer8      timeSyncInterval;
+	Integer8      announceInterval;
+	Octet         flags;
+	Octet         reserved[2];
+} PACKED;
+
+/*
+ * The TLVs of unicast negotiation, see IEEE 1588-2008 section 16.1.4.
+ * The message type is in the upper nibble of message_type.
+ */
+struct request_unicast_xmit_tlv {
+	Enumeration16 type;
+	UInteger16    length;
+	Enumeration8  message_type;
+	Integer8      logInterMessagePeriod;
+	UInteger32    durationField;
+} PACKED;
+
+#define GRANT_UNICAST_RENEWAL_INVITED 0x01
+
+struct grant_unicast_xmit_tlv {
+	Enumeration16 type;
+	UInteger16    length;
+	Enumeration8  message_type;
+	Integer8      logInterMessagePeriod;
+	UInteger32    durationField;
+	Octet         reserved;
+	Octet         flags;
+} PACKED;
+
+/* Also used for the acknowledgement of the cancellation. */
+struct cancel_unicast_xmit_tlv {
+	Enumeration16 type;
+	UInteger16    length;
+	Enumeration8  message_type_flags;
+	Octet         reserved;
+} PACKED;
+
 struct time_status_np {
 	int64_t       master_offset; /*nanoseconds*/
 	int64_t       ingress_time;  /*nanoseconds*/
@@ -193,11 +252,186 @@ struct grandmaster_settings_np {
 	Enumeration8 time_source;
 } PACKED;
 
+struct msg_pool_stats_np {
+	UInteger32    total;
+	UInteger32    free;
+	UInteger32    limit;
+	UInteger32    high_water;
+	uint64_t      hits;
+	uint64_t      misses;
+	uint64_t      failures;
+} PACKED;
+
+/*
+ * The statistics of the last summary_interval. The percentiles and the
+ * maximum are of the absolute offset. All values are in nanoseconds.
+ */
+struct clock_stats_np {
+	UInteger32    offset_samples;
+	UInteger32    delay_samples;
+	Integer64     offset_rms;
+	Integer64     offset_max;
+	Integer64     offset_p50;
+	Integer64     offset_p99;
+	Integer64     offset_p999;
+	Integer64     delay_mean;
+	Integer64     delay_p50;
+	Integer64     delay_p99;
+	Integer64     delay_p999;
+} PACKED;
+
+/*
+ * The frequency, drift and temperature coefficient are in units of 2^-16
+ * ppb, ppb per hour and ppb per degree Celsius.
+ */
+struct holdover_np {
+	Integer32     active;
+	UInteger32    duration;
+	UInteger32    points;
+	Integer64     frequency;
+	Integer64     drift;
+	Integer64     temp_coeff;
+	Integer64     error;
+} PACKED;
+
+/*
+ * The last offset measured by the clock, pushed to the subscribers of
+ * NOTIFY_SYNC_SAMPLE. The times are in nanoseconds and the frequency
+ * adjustment in units of 2^-16 ppb.
+ */
+struct sync_sample_np {
+	Integer64     master_offset;
+	Integer64     path_delay;
+	Integer64     ingress_time;
+	Integer64     frequency;
+	UInteger32    sequence;
+	UInteger8     servo_state;
+	UInteger8     reserved[3];
+} PACKED;
+
+/*
+ * The counters of the management messages received from the network,
+ * which are limited per source port identity.
+ */
+struct management_stats_np {
+	uint64_t      admitted;
+	uint64_t      dropped;
+	uint64_t      overflows;
+	UInteger32    sources;
+	UInteger32    limited;
+} PACKED;
+
+#define CPU_STATS_STAGES 8
+
+/*
+ * The time spent in the processing stages of ptp4l, in the order of
+ * enum cpu_stage, when the cpu_accounting option is enabled.
+ */
+struct cpu_stats_np {
+	UInteger8     enabled;
+	UInteger8     reserved[7];
+	struct {
+		uint64_t ns;
+		uint64_t count;
+	} PACKED stage[CPU_STATS_STAGES];
+} PACKED;
+
+/*
+ * A summary of the runtime performance of ptp4l. The time stamp wait is
+ * the sum or the worst of the ports, in nanoseconds. The servo time is
+ * only accounted with the cpu_accounting option.
+ */
+struct perf_stats_np {
+	uint64_t      wakeups;
+	uint64_t      events;
+	uint64_t      pool_hits;
+	uint64_t      pool_misses;
+	uint64_t      pool_failures;
+	UInteger32    pool_total;
+	UInteger32    pool_high_water;
+	uint64_t      txts_count;
+	uint64_t      txts_timeouts;
+	Integer64     txts_p99;
+	Integer64     txts_max;
+	uint64_t      servo_ns;
+	uint64_t      servo_count;
+	uint64_t      adj_issued;
+	uint64_t      adj_avoided;
+} PACKED;
+
+#define MAX_MESSAGE_TYPES 16
+
+/*
+ * The message counters of a port, indexed by the message type. The
+ * messages counted as received include the ignored and bad ones.
+ */
+struct port_stats {
+	uint64_t      rx[MAX_MESSAGE_TYPES];
+	uint64_t      tx[MAX_MESSAGE_TYPES];
+	uint64_t      rx_ignored[MAX_MESSAGE_TYPES]; /* by port_ignore() */
+	uint64_t      rx_bad[MAX_MESSAGE_TYPES];
+	uint64_t      rx_no_ts[MAX_MESSAGE_TYPES]; /* without a time stamp */
+	uint64_t      tx_ts_timeout[MAX_MESSAGE_TYPES];
+} PACKED;
+
+/*
+ * A SET of PORT_STATS_NP resets the counters. It is answered with the
+ * values before the reset.
+ */
+struct port_stats_np {
+	struct PortIdentity portIdentity;
+	struct port_stats stats;
+} PACKED;
+
+/* Powers of two of nanoseconds, the last bin from about 67 ms up. */
+#define TX_TIMESTAMP_HIST_BINS 28
+
+/*
+ * The time the transmit time stamps of a port took to show up, since the
+ * port started or the last SET, which resets the statistics and the count
+ * of timeouts, but not the tx_ts_timeout counters of PORT_STATS_NP. The
+ * times are in nanoseconds, the timeout and the suggested timeout in
+ * milliseconds. The suggested timeout is zero while there are too few
+ * time stamps to tell. The bin
+ * i of the histogram counts the times from 2^(i-1) up to 2^i.
+ */
+struct tx_timestamp_stats_np {
+	struct PortIdentity portIdentity;
+	UInteger32    count;
+	UInteger32    timeouts;
+	UInteger32    timeout;
+	UInteger32    suggested_timeout;
+	Integer64     mean;
+	Integer64     p50;
+	Integer64     p99;
+	Integer64     p999;
+	Integer64     max;
+	UInteger32    histogram[TX_TIMESTAMP_HIST_BINS];
+} PACKED;
+
 struct port_ds_np {
 	UInteger32    neighborPropDelayThresh; /*nanoseconds*/
 	Integer32     asCapable;
 } PACKED;
 
+/* Limits a snapshot to the size of a management message over UDP/IPv6. */
+#define SNAPSHOT_NP_MAX_PORTS 48
+
+/*
+ * The data sets of the clock followed by the data sets of up to
+ * SNAPSHOT_NP_MAX_PORTS of its ports, in one response.
+ */
+struct snapshot_np {
+	struct defaultDS        dds;
+	struct currentDS        cds;
+	struct parentDS         pds;
+	struct timePropertiesDS tds;
+	struct time_status_np   tsn;
+	UInteger16              portCount; /* number of port data sets */
+	UInteger16              reserved;
+	struct portDS           ports[0];
+} PACKED;
+
 
 #define EVENT_BITMASK_CNT 64
 
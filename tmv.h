@@ -20,6 +20,7 @@
 #ifndef HAVE_TMV_H
 #define HAVE_TMV_H
 
+#include <math.h>
 #include <time.h>
 
 #include "ddt.h"
@@ -29,81 +30,152 @@
 
 /**
  * We implement the time value as a 64 bit signed integer containing
- * nanoseconds. Using this representation, we could really spare the
- * arithmetic functions such as @ref tmv_add() and the like, and just
- * use plain old math operators in the code.
+ * nanoseconds and a 16 bit fraction of a nanosecond, which is the
+ * resolution of the correction fields. A single 64 bit fixed point
+ * value would not have the range needed for absolute time stamps.
  *
- * However, we are going to be a bit pedantic here and enforce the
- * use of the these functions, so that we can easily upgrade the code
- * to a finer representation later on. In that way, we can make use of
- * the fractional nanosecond parts of the correction fields, if and
- * when people start asking for them.
+ * The code must use the functions below rather than plain math
+ * operators. The fraction is always kept in the range [0, 2^16),
+ * i.e. the nanoseconds are rounded down.
  */
-typedef int64_t tmv_t;
+#define TMV_FRAC_BITS	16
+#define TMV_FRAC_ONE	(1 << TMV_FRAC_BITS)
+
+typedef struct {
+	int64_t ns;
+	uint32_t frac;
+} tmv_t;
 
 static inline tmv_t tmv_add(tmv_t a, tmv_t b)
 {
-	return a + b;
+	tmv_t t;
+
+	t.ns = a.ns + b.ns;
+	t.frac = a.frac + b.frac;
+	if (t.frac >= TMV_FRAC_ONE) {
+		t.ns++;
+		t.frac -= TMV_FRAC_ONE;
+	}
+	return t;
 }
 
 static inline tmv_t tmv_div(tmv_t a, int divisor)
 {
-	return a / divisor;
+	int64_t q, r;
+	tmv_t t;
+
+	/* Divide with rounding down, keeping the remainder positive. */
+	q = a.ns / divisor;
+	r = a.ns % divisor;
+	if (r && (r < 0) != (divisor < 0)) {
+		q--;
+		r += divisor;
+	}
+	t.ns = q;
+	t.frac = ((r << TMV_FRAC_BITS) + a.frac) / divisor;
+	return t;
+}
+
+static inline int tmv_cmp(tmv_t a, tmv_t b)
+{
+	if (a.ns != b.ns)
+		return a.ns < b.ns ? -1 : 1;
+	if (a.frac != b.frac)
+		return a.frac < b.frac ? -1 : 1;
+	return 0;
 }
 
 static inline int tmv_eq(tmv_t a, tmv_t b)
 {
-	return a == b ? 1 : 0;
+	return a.ns == b.ns && a.frac == b.frac ? 1 : 0;
 }
 
 static inline int tmv_is_zero(tmv_t x)
 {
-	return x == ((tmv_t) 0) ? 1 : 0;
+	return !x.ns && !x.frac ? 1 : 0;
+}
+
+static inline int tmv_sign(tmv_t x)
+{
+	if (x.ns)
+		return x.ns < 0 ? -1 : 1;
+	return x.frac ? 1 : 0;
 }
 
 static inline tmv_t tmv_sub(tmv_t a, tmv_t b)
 {
-	return a - b;
+	tmv_t t;
+
+	t.ns = a.ns - b.ns;
+	if (a.frac >= b.frac) {
+		t.frac = a.frac - b.frac;
+	} else {
+		t.ns--;
+		t.frac = a.frac + TMV_FRAC_ONE - b.frac;
+	}
+	return t;
 }
 
 static inline tmv_t tmv_zero(void)
 {
-	return (tmv_t) 0;
+	tmv_t t = { 0, 0 };
+	return t;
+}
+
+static inline tmv_t nanoseconds_to_tmv(int64_t ns)
+{
+	tmv_t t = { ns, 0 };
+	return t;
 }
 
 static inline tmv_t correction_to_tmv(Integer64 c)
 {
-	return c >> 16;
+	tmv_t t;
+
+	/* The arithmetic shift rounds down, as the fraction requires. */
+	t.ns = c >> TMV_FRAC_BITS;
+	t.frac = c & (TMV_FRAC_ONE - 1);
+	return t;
 }
 
 static inline double tmv_dbl(tmv_t x)
 {
-	return (double) x;
+	return (double) x.ns + (double) x.frac / TMV_FRAC_ONE;
 }
 
 static inline tmv_t dbl_tmv(double x)
 {
-	return (tmv_t) x;
+	double ns = floor(x);
+	tmv_t t;
+
+	t.ns = (int64_t) ns;
+	t.frac = (uint32_t) ((x - ns) * TMV_FRAC_ONE);
+	if (t.frac >= TMV_FRAC_ONE)
+		t.frac = TMV_FRAC_ONE - 1;
+	return t;
 }
 
+/**
+ * Convert a time value to nanoseconds, rounding to the nearest one.
+ */
 static inline int64_t tmv_to_nanoseconds(tmv_t x)
 {
-	return x;
+	return x.ns + (x.frac >= TMV_FRAC_ONE / 2);
 }
 
 static inline TimeInterval tmv_to_TimeInterval(tmv_t x)
 {
-	return x << 16;
+	return x.ns * TMV_FRAC_ONE + x.frac;
 }
 
 static inline tmv_t timespec_to_tmv(struct timespec ts)
 {
-	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+	return nanoseconds_to_tmv(ts.tv_sec * NS_PER_SEC + ts.tv_nsec);
 }
 
 static inline tmv_t timestamp_to_tmv(struct timestamp ts)
 {
-	return ts.sec * NS_PER_SEC + ts.nsec;
+	return nanoseconds_to_tmv(ts.sec * NS_PER_SEC + ts.nsec);
 }
 
 #endif
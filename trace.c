@@ -0,0 +1,121 @@
+/**
+ * @file trace.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "print.h"
+#include "trace.h"
+
+#ifndef NO_TRACE
+
+struct trace_header *trace_ring;
+static struct trace_record *records;
+static uint64_t mask;
+static size_t map_len;
+
+void trace_put(enum trace_event event, int port, int type, int sequence_id,
+	       int64_t value)
+{
+	struct trace_record *r;
+	struct timespec ts;
+	uint64_t index;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	index = atomic_fetch_add_explicit(&trace_ring->head, 1,
+					  memory_order_relaxed);
+	r = &records[index & mask];
+
+	atomic_store_explicit(&r->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	r->time = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	r->value = value;
+	r->event = event;
+	r->port = port;
+	r->sequence_id = sequence_id;
+	r->type = type;
+
+	atomic_store_explicit(&r->seq, index + 1, memory_order_release);
+}
+
+int trace_open(const char *path, unsigned int size)
+{
+	struct trace_header *hdr;
+	uint64_t n = 1;
+	int fd;
+
+	while (n < size)
+		n <<= 1;
+	map_len = sizeof(*hdr) + n * sizeof(struct trace_record);
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		pr_err("failed to open trace file %s: %m", path);
+		return -1;
+	}
+	if (ftruncate(fd, map_len)) {
+		pr_err("failed to size trace file %s: %m", path);
+		close(fd);
+		return -1;
+	}
+	hdr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		pr_err("failed to map trace file %s: %m", path);
+		return -1;
+	}
+
+	memcpy(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic));
+	hdr->version = TRACE_VERSION;
+	hdr->record_size = sizeof(struct trace_record);
+	hdr->size = n;
+	atomic_store(&hdr->head, 0);
+
+	records = (struct trace_record *) (hdr + 1);
+	mask = n - 1;
+	trace_ring = hdr;
+	return 0;
+}
+
+void trace_close(void)
+{
+	struct trace_header *hdr = trace_ring;
+
+	if (!hdr)
+		return;
+	trace_ring = NULL;
+	munmap(hdr, map_len);
+}
+
+#else
+
+int trace_open(const char *path, unsigned int size)
+{
+	pr_err("built without tracing support");
+	return -1;
+}
+
+void trace_close(void)
+{
+}
+
+#endif
@@ -0,0 +1,133 @@
+/**
+ * @file trace.h
+ * @brief Records hot path events in a ring buffer in shared memory.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_TRACE_H
+#define HAVE_TRACE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC	"PTPTRACE"
+#define TRACE_VERSION	1
+
+/**
+ * The events that are recorded, in the order in which they occur
+ * while a message travels from the socket to the clock adjustment.
+ */
+enum trace_event {
+	TRACE_PORT_EVENT, /* port_event() entered, value is the fd index */
+	TRACE_RX,         /* message received, value is its hardware time stamp */
+	TRACE_RX_SW,      /* message received, value is its software time stamp age */
+	TRACE_RX_MSG,     /* message accepted by its port, value is its time stamp */
+	TRACE_SERVO,      /* servo sample done, value is the offset */
+	TRACE_ADJ_FREQ,   /* frequency adjusted, value is the adjustment in ppb */
+	TRACE_ADJ_STEP,   /* clock stepped, value is the step */
+	TRACE_N_EVENTS,
+};
+
+/**
+ * The file starts with this header, which is followed by the records.
+ * The head counts the records ever written, the oldest of which are
+ * overwritten once the ring is full.
+ */
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t size; /* number of records, a power of two */
+	_Atomic uint64_t head;
+	uint8_t reserved[32];
+};
+
+/**
+ * A record is being written while its seq field is zero, and is valid
+ * once seq equals its position in the stream plus one. Readers must
+ * check seq before and after copying a record.
+ */
+struct trace_record {
+	_Atomic uint64_t seq;
+	uint64_t time; /* CLOCK_MONOTONIC in nanoseconds */
+	int64_t value; /* nanoseconds, unless noted otherwise */
+	uint16_t event;
+	uint16_t port;
+	uint16_t sequence_id;
+	uint8_t type;
+	uint8_t reserved;
+};
+
+#ifndef NO_TRACE
+
+extern struct trace_header *trace_ring;
+
+void trace_put(enum trace_event event, int port, int type, int sequence_id,
+	       int64_t value);
+
+/**
+ * Append a record to the trace ring, if tracing is enabled. This may
+ * be called from any thread.
+ * @param event        The kind of event.
+ * @param port         The number of the port concerned, or zero.
+ * @param type         The type of the message concerned.
+ * @param sequence_id  The sequence ID of the message concerned.
+ * @param value        A value whose meaning depends on the event.
+ */
+static inline void trace(enum trace_event event, int port, int type,
+			 int sequence_id, int64_t value)
+{
+	if (trace_ring)
+		trace_put(event, port, type, sequence_id, value);
+}
+
+/**
+ * Tell whether tracing is enabled.
+ * @return  Non-zero if events are being recorded.
+ */
+static inline int trace_enabled(void)
+{
+	return trace_ring != NULL;
+}
+
+#else
+
+static inline void trace(enum trace_event event, int port, int type,
+			 int sequence_id, int64_t value)
+{
+}
+
+static inline int trace_enabled(void)
+{
+	return 0;
+}
+
+#endif
+
+/**
+ * Create the trace ring and start recording events.
+ * @param path  The file to map, preferably on a tmpfs such as /dev/shm.
+ * @param size  The number of records, rounded up to a power of two.
+ * @return      Zero on success, non-zero otherwise.
+ */
+int trace_open(const char *path, unsigned int size);
+
+/**
+ * Stop recording events and unmap the trace ring. The file remains.
+ */
+void trace_close(void);
+
+#endif
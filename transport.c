@@ -18,7 +18,11 @@
  */
 
 #include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "config.h"
+#include "print.h"
 #include "transport.h"
 #include "transport_private.h"
 #include "raw.h"
@@ -34,12 +38,56 @@ int transport_close(struct transport *t, struct fdarray *fda)
 int transport_open(struct transport *t, const char *name,
 		   struct fdarray *fda, enum timestamp_type tt)
 {
+	/* Enabling the time stamping restarts the keys from zero. */
+	t->txid = 0;
 	return t->open(t, name, fda, tt);
 }
 
 int transport_recv(struct transport *t, int fd, struct ptp_message *msg)
 {
-	return t->recv(t, fd, msg, sizeof(msg->data), &msg->address, &msg->hwts);
+	return t->recv(t, fd, &msg->data, sizeof(msg->data), &msg->address,
+		       &msg->hwts);
+}
+
+int transport_recv_batch(struct transport *t, int fd,
+			 struct ptp_message **msg, int *cnt, int n)
+{
+	struct sk_rxbuf rx[SK_RX_BATCH];
+	int i, num;
+
+	if (!t->recv_batch) {
+		cnt[0] = transport_recv(t, fd, msg[0]);
+		return cnt[0] <= 0 ? -1 : 1;
+	}
+	if (n > SK_RX_BATCH)
+		n = SK_RX_BATCH;
+
+	for (i = 0; i < n; i++) {
+		rx[i].buf = &msg[i]->data;
+		rx[i].buflen = sizeof(msg[i]->data);
+		rx[i].addr = &msg[i]->address;
+		rx[i].hwts = &msg[i]->hwts;
+	}
+	num = t->recv_batch(t, fd, rx, n);
+	for (i = 0; i < num; i++) {
+		cnt[i] = rx[i].cnt;
+	}
+	return num;
+}
+
+int transport_filter(struct transport *t, struct fdarray *fda, int domain,
+		     int types)
+{
+	if (t->filter) {
+		return t->filter(t, fda, domain, types);
+	}
+	return 0;
+}
+
+/* Without a way to hold messages back, a batched one leaves at once. */
+static int transport_event(struct transport *t, int event)
+{
+	return event == TRANS_BATCH && !t->flush ? TRANS_DEFER : event;
 }
 
 int transport_send(struct transport *t, struct fdarray *fda, int event,
@@ -47,7 +95,8 @@ int transport_send(struct transport *t, struct fdarray *fda, int event,
 {
 	int len = ntohs(msg->header.messageLength);
 
-	return t->send(t, fda, event, 0, msg, len, NULL, &msg->hwts);
+	event = transport_event(t, event);
+	return t->send(t, fda, event, 0, &msg->data, len, NULL, &msg->hwts);
 }
 
 int transport_peer(struct transport *t, struct fdarray *fda, int event,
@@ -55,7 +104,8 @@ int transport_peer(struct transport *t, struct fdarray *fda, int event,
 {
 	int len = ntohs(msg->header.messageLength);
 
-	return t->send(t, fda, event, 1, msg, len, NULL, &msg->hwts);
+	event = transport_event(t, event);
+	return t->send(t, fda, event, 1, &msg->data, len, NULL, &msg->hwts);
 }
 
 int transport_sendto(struct transport *t, struct fdarray *fda, int event,
@@ -63,7 +113,63 @@ int transport_sendto(struct transport *t, struct fdarray *fda, int event,
 {
 	int len = ntohs(msg->header.messageLength);
 
-	return t->send(t, fda, event, 0, msg, len, &msg->address, &msg->hwts);
+	event = transport_event(t, event);
+	return t->send(t, fda, event, 0, &msg->data, len, &msg->address,
+		       &msg->hwts);
+}
+
+int transport_send_batch(struct transport *t, struct fdarray *fda,
+			 struct ptp_message **msg, int n)
+{
+	struct sk_txbuf tx[SK_TX_BATCH];
+	int i;
+
+	if (n > SK_TX_BATCH)
+		n = SK_TX_BATCH;
+
+	if (!t->send_batch) {
+		for (i = 0; i < n; i++) {
+			if (msg[i]->header.flagField[0] & UNICAST) {
+				if (transport_sendto(t, fda, 0, msg[i]) <= 0)
+					break;
+			} else if (transport_send(t, fda, 0, msg[i]) <= 0) {
+				break;
+			}
+		}
+		return i ? i : -1;
+	}
+	for (i = 0; i < n; i++) {
+		tx[i].buf = &msg[i]->data;
+		tx[i].len = ntohs(msg[i]->header.messageLength);
+		tx[i].addr = msg[i]->header.flagField[0] & UNICAST ?
+			&msg[i]->address : NULL;
+	}
+	return t->send_batch(t, fda, tx, n);
+}
+
+int transport_txts(struct transport *t, struct fdarray *fda, void *buf,
+		   int *len, struct hw_timestamp *hwts)
+{
+	if (t->txts) {
+		return t->txts(t, fda, buf, len, hwts);
+	}
+	return sk_receive_txts(fda->fd[FD_EVENT], buf, len, hwts);
+}
+
+int transport_txts_fd(struct transport *t, struct fdarray *fda)
+{
+	if (t->txts_fd) {
+		return t->txts_fd(t, fda);
+	}
+	return fda->fd[FD_EVENT];
+}
+
+int transport_flush(struct transport *t)
+{
+	if (t->flush) {
+		return t->flush(t);
+	}
+	return 0;
 }
 
 int transport_physical_addr(struct transport *t, uint8_t *addr)
@@ -82,11 +188,65 @@ int transport_protocol_addr(struct transport *t, uint8_t *addr)
 	return 0;
 }
 
+int transport_domains(struct transport *t, uint8_t *domains, int max)
+{
+	char *buf, *tok, *end;
+	int n = 0;
+	long val;
+
+	domains[n++] = config_get_int(t->cfg, NULL, "domainNumber");
+	buf = strdup(config_get_string(t->cfg, NULL, "secondary_domains"));
+	if (!buf)
+		return n;
+	/* The clock rejects the malformed entries. */
+	for (tok = strtok(buf, ", "); tok && n < max; tok = strtok(NULL, ", ")) {
+		val = strtol(tok, &end, 10);
+		if (!*end && val >= 0 && val <= 255)
+			domains[n++] = val;
+	}
+	free(buf);
+	return n;
+}
+
 enum transport_type transport_type(struct transport *t)
 {
 	return t->type;
 }
 
+#define N_REGISTERED 4
+
+static struct {
+	enum transport_type type;
+	struct transport *(*create)(void);
+} registered[N_REGISTERED];
+
+int transport_register(enum transport_type type,
+		       struct transport *(*create)(void))
+{
+	int i;
+
+	for (i = 0; i < N_REGISTERED; i++) {
+		if (!registered[i].create || registered[i].type == type) {
+			registered[i].type = type;
+			registered[i].create = create;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static struct transport *registered_create(enum transport_type type)
+{
+	int i;
+
+	for (i = 0; i < N_REGISTERED && registered[i].create; i++) {
+		if (registered[i].type == type)
+			return registered[i].create();
+	}
+	pr_err("transport %d is not available in this program", type);
+	return NULL;
+}
+
 struct transport *transport_create(struct config *cfg,
 				   enum transport_type type)
 {
@@ -108,6 +268,16 @@ struct transport *transport_create(struct config *cfg,
 	case TRANS_CONTROLNET:
 	case TRANS_PROFINET:
 		break;
+	case TRANS_XDP:
+		t = registered_create(type);
+		/* On the wire, this is still PTP over Ethernet. */
+		type = TRANS_IEEE_802_3;
+		break;
+	case TRANS_REPLAY:
+		/* The transport finds the protocol in the capture. */
+		t = registered_create(type);
+		type = TRANS_IEEE_802_3;
+		break;
 	}
 	if (t) {
 		t->type = type;
@@ -38,16 +38,26 @@ enum transport_type {
 	TRANS_DEVICENET,
 	TRANS_CONTROLNET,
 	TRANS_PROFINET,
+	/* Not a network protocol, but Ethernet through AF_XDP. */
+	TRANS_XDP = 0x100,
+	/* Not a network protocol, but messages replayed from a capture. */
+	TRANS_REPLAY,
 };
 
 /**
  * Values for the 'event' parameter in transport_send() and
- * transport_peer().
+ * transport_peer(). With TRANS_DEFER, an event message is sent without
+ * waiting for its time stamp, which is later read by transport_txts().
+ * TRANS_BATCH is like TRANS_DEFER, except that the transport may hold
+ * the message back until transport_flush(), to send it together with
+ * the messages of the other ports.
  */
 enum transport_event {
 	TRANS_GENERAL,
 	TRANS_EVENT,
 	TRANS_ONESTEP,
+	TRANS_DEFER,
+	TRANS_BATCH,
 };
 
 struct transport;
@@ -59,6 +69,35 @@ int transport_open(struct transport *t, const char *name,
 
 int transport_recv(struct transport *t, int fd, struct ptp_message *msg);
 
+/**
+ * Receives all of the PTP messages pending on a descriptor, up to a
+ * limit. Transports without batch support receive a single message.
+ * @param t	The transport.
+ * @param fd	The descriptor to read from.
+ * @param msg	Array of messages to receive into.
+ * @param cnt	Array receiving the length of each message, or a negative
+ *		value for a message that could not be received.
+ * @param n	Number of elements in 'msg' and 'cnt'.
+ * @return	Number of messages received, which may be zero, or negative
+ *		value in case of an error.
+ */
+int transport_recv_batch(struct transport *t, int fd,
+			 struct ptp_message **msg, int *cnt, int n);
+
+/**
+ * Restricts the messages that reach the transport's sockets, so that
+ * messages of no interest are dropped by the kernel. Transports
+ * without filter support accept everything.
+ * @param t	The transport.
+ * @param fda	The array of descriptors filled in by transport_open.
+ * @param domain	The domain number of the messages to accept.
+ * @param types	Bit mask of the message types to accept, with bit N
+ *		standing for messageType N.
+ * @return	Zero on success, non-zero otherwise.
+ */
+int transport_filter(struct transport *t, struct fdarray *fda, int domain,
+		     int types);
+
 /**
  * Sends the PTP message using the given transport. The message is sent to
  * the default (usually multicast) address, any address field in the
@@ -98,6 +137,54 @@ int transport_peer(struct transport *t, struct fdarray *fda, int event,
 int transport_sendto(struct transport *t, struct fdarray *fda, int event,
 		     struct ptp_message *msg);
 
+/**
+ * Sends a number of general messages using the given transport, with a
+ * single system call if the transport supports it. Each message goes to
+ * the address in its address field if it has the unicast flag set, and
+ * to the default address otherwise.
+ * @param t	The transport.
+ * @param fda	The array of descriptors filled in by transport_open.
+ * @param msg	The messages to send.
+ * @param n	The number of messages, at most SK_TX_BATCH.
+ * @return	The number of messages sent, or negative value in case
+ *		of an error.
+ */
+int transport_send_batch(struct transport *t, struct fdarray *fda,
+			 struct ptp_message **msg, int n);
+
+/**
+ * Reads one pending transmit time stamp, without blocking. Used to
+ * collect the time stamps of messages sent with TRANS_DEFER.
+ * @param t	The transport.
+ * @param fda	The array of descriptors filled in by transport_open.
+ * @param buf	Buffer to receive the looped back packet.
+ * @param len	On entry the size of 'buf' in bytes, on return the length
+ *		of the looped back packet, which is zero when only the
+ *		time stamp and its key in 'hwts' are returned.
+ * @param hwts	Pointer to a buffer to receive the time stamp.
+ * @return	One if a time stamp was read, zero if none is pending, or
+ *		negative value in case of an error.
+ */
+int transport_txts(struct transport *t, struct fdarray *fda, void *buf,
+		   int *len, struct hw_timestamp *hwts);
+
+/**
+ * Returns the descriptor whose POLLPRI signals the time stamps to be
+ * read by transport_txts().
+ * @param t	The transport.
+ * @param fda	The array of descriptors filled in by transport_open.
+ * @return	An open descriptor.
+ */
+int transport_txts_fd(struct transport *t, struct fdarray *fda);
+
+/**
+ * Sends the messages held back with TRANS_BATCH, those of the other
+ * ports using the same kind of transport included.
+ * @param t	The transport.
+ * @return	Zero on success, or negative value in case of an error.
+ */
+int transport_flush(struct transport *t);
+
 /**
  * Returns the transport's type.
  */
@@ -132,6 +219,17 @@ int transport_protocol_addr(struct transport *t, uint8_t *addr);
 struct transport *transport_create(struct config *cfg,
 				   enum transport_type type);
 
+/**
+ * Makes a transport available to transport_create(). The transports
+ * used only by ptp4l, i.e. TRANS_XDP and TRANS_REPLAY, are registered
+ * by ptp4l, so that the other programs do not have to link them.
+ * @param type    Which transport to provide.
+ * @param create  Allocates an instance of the transport.
+ * @return        Zero on success, non-zero otherwise.
+ */
+int transport_register(enum transport_type type,
+		       struct transport *(*create)(void));
+
 /**
  * Free an instance of a transport.
  * @param t Pointer obtained by calling transport_create().
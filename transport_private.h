@@ -24,11 +24,14 @@
 
 #include "address.h"
 #include "fd.h"
+#include "sk.h"
 #include "transport.h"
 
 struct transport {
 	enum transport_type type;
 	struct config *cfg;
+	/* Mirrors the time stamp key of the kernel on the event socket. */
+	unsigned int txid;
 
 	int (*close)(struct transport *t, struct fdarray *fda);
 
@@ -38,10 +41,26 @@ struct transport {
 	int (*recv)(struct transport *t, int fd, void *buf, int buflen,
 		    struct address *addr, struct hw_timestamp *hwts);
 
+	int (*recv_batch)(struct transport *t, int fd, struct sk_rxbuf *rx,
+			  int n);
+
+	int (*filter)(struct transport *t, struct fdarray *fda, int domain,
+		      int types);
+
 	int (*send)(struct transport *t, struct fdarray *fda, int event,
 		    int peer, void *buf, int buflen, struct address *addr,
 		    struct hw_timestamp *hwts);
 
+	int (*send_batch)(struct transport *t, struct fdarray *fda,
+			  struct sk_txbuf *tx, int n);
+
+	int (*txts)(struct transport *t, struct fdarray *fda, void *buf,
+		    int *len, struct hw_timestamp *hwts);
+
+	int (*txts_fd)(struct transport *t, struct fdarray *fda);
+
+	int (*flush)(struct transport *t);
+
 	void (*release)(struct transport *t);
 
 	int (*physical_addr)(struct transport *t, uint8_t *addr);
@@ -49,4 +68,14 @@ struct transport {
 	int (*protocol_addr)(struct transport *t, uint8_t *addr);
 };
 
+/**
+ * Collect the domains served through a transport, the primary domain
+ * first, followed by the secondary domains.
+ * @param t       The transport.
+ * @param domains Array to fill with the domain numbers.
+ * @param max     The number of entries in @a domains.
+ * @return        The number of domains stored.
+ */
+int transport_domains(struct transport *t, uint8_t *domains, int max);
+
 #endif
@@ -24,11 +24,24 @@
 #include "filter.h"
 #include "print.h"
 
+/* An exchange of time stamps in the window of the min_delay mode */
+struct exchange {
+	tmv_t local_ts;
+	tmv_t offset;
+	tmv_t delay;
+};
+
 struct tsproc {
 	/* Processing options */
 	int raw_mode;
 	int weighting;
 
+	/* Window of recent exchanges, or NULL when not used */
+	struct exchange *window;
+	int window_len;
+	int window_cnt;
+	int window_index;
+
 	/* Current ratio between remote and local clock frequency */
 	double clock_rate_ratio;
 
@@ -45,10 +58,14 @@ struct tsproc {
 
 	/* Delay filter */
 	struct filter *delay_filter;
+
+	/* Offset filter, or NULL */
+	struct filter *offset_filter;
 };
 
 struct tsproc *tsproc_create(enum tsproc_mode mode,
-			     enum filter_type delay_filter, int filter_length)
+			     enum filter_type delay_filter, int filter_length,
+			     double quantile)
 {
 	struct tsproc *tsp;
 
@@ -73,13 +90,29 @@ struct tsproc *tsproc_create(enum tsproc_mode mode,
 		tsp->raw_mode = 1;
 		tsp->weighting = 1;
 		break;
+	case TSPROC_MIN_DELAY:
+		tsp->raw_mode = 0;
+		tsp->weighting = 0;
+		if (filter_length < 1) {
+			free(tsp);
+			return NULL;
+		}
+		tsp->window = calloc(filter_length, sizeof(*tsp->window));
+		if (!tsp->window) {
+			free(tsp);
+			return NULL;
+		}
+		tsp->window_len = filter_length;
+		break;
 	default:
 		free(tsp);
 		return NULL;
 	}
 
-	tsp->delay_filter = filter_create(delay_filter, filter_length);
+	tsp->delay_filter = filter_create(delay_filter, filter_length,
+					  quantile);
 	if (!tsp->delay_filter) {
+		free(tsp->window);
 		free(tsp);
 		return NULL;
 	}
@@ -89,9 +122,35 @@ struct tsproc *tsproc_create(enum tsproc_mode mode,
 	return tsp;
 }
 
+int tsproc_set_filters(struct tsproc *tsp, const char *delay_chain,
+		       const char *offset_chain)
+{
+	struct filter *f;
+
+	if (delay_chain[0]) {
+		f = filter_chain_create(delay_chain);
+		if (!f)
+			return -1;
+		filter_destroy(tsp->delay_filter);
+		tsp->delay_filter = f;
+	}
+	if (offset_chain[0]) {
+		f = filter_chain_create(offset_chain);
+		if (!f)
+			return -1;
+		if (tsp->offset_filter)
+			filter_destroy(tsp->offset_filter);
+		tsp->offset_filter = f;
+	}
+	return 0;
+}
+
 void tsproc_destroy(struct tsproc *tsp)
 {
+	if (tsp->offset_filter)
+		filter_destroy(tsp->offset_filter);
 	filter_destroy(tsp->delay_filter);
+	free(tsp->window);
 	free(tsp);
 }
 
@@ -129,11 +188,12 @@ tmv_t get_raw_delay(struct tsproc *tsp)
 	t41 = tmv_sub(tsp->t4, tsp->t1);
 	delay = tmv_div(tmv_add(t23, t41), 2);
 
-	if (delay < 0) {
-		pr_debug("negative delay %10" PRId64, delay);
+	if (tmv_sign(delay) < 0) {
+		pr_debug("negative delay %10" PRId64,
+			 tmv_to_nanoseconds(delay));
 		pr_debug("delay = (t2 - t3) * rr + (t4 - t1)");
-		pr_debug("t2 - t3 = %+10" PRId64, t23);
-		pr_debug("t4 - t1 = %+10" PRId64, t41);
+		pr_debug("t2 - t3 = %+10" PRId64, tmv_to_nanoseconds(t23));
+		pr_debug("t4 - t1 = %+10" PRId64, tmv_to_nanoseconds(t41));
 		pr_debug("rr = %.9f", tsp->clock_rate_ratio);
 	}
 
@@ -151,7 +211,8 @@ int tsproc_update_delay(struct tsproc *tsp, tmv_t *delay)
 	tsp->filtered_delay = filter_sample(tsp->delay_filter, raw_delay);
 
 	pr_debug("delay   filtered %10" PRId64 "   raw %10" PRId64,
-		 tsp->filtered_delay, raw_delay);
+		 tmv_to_nanoseconds(tsp->filtered_delay),
+		 tmv_to_nanoseconds(raw_delay));
 
 	if (delay)
 		*delay = tsp->raw_mode ? raw_delay : tsp->filtered_delay;
@@ -159,14 +220,64 @@ int tsproc_update_delay(struct tsproc *tsp, tmv_t *delay)
 	return 0;
 }
 
+/*
+ * Add the current exchange to the window and return the offset measured by
+ * the exchange with the shortest delay, i.e. the one which suffered the
+ * least from queuing. The offset of an older exchange is extrapolated to
+ * the current time with the ratio between the remote and local frequency.
+ */
+static tmv_t min_delay_offset(struct tsproc *tsp)
+{
+	struct exchange *ex, *best;
+	tmv_t age, offset;
+	int i;
+
+	ex = &tsp->window[tsp->window_index];
+	ex->local_ts = tsp->t2;
+	ex->delay = get_raw_delay(tsp);
+	ex->offset = tmv_sub(tmv_sub(tsp->t2, tsp->t1), ex->delay);
+
+	tsp->window_index = (tsp->window_index + 1) % tsp->window_len;
+	if (tsp->window_cnt < tsp->window_len)
+		tsp->window_cnt++;
+
+	best = ex;
+	for (i = 0; i < tsp->window_cnt; i++) {
+		if (tmv_cmp(tsp->window[i].delay, best->delay) < 0)
+			best = &tsp->window[i];
+	}
+
+	offset = best->offset;
+	if (best != ex && tsp->clock_rate_ratio != 1.0) {
+		age = tmv_sub(tsp->t2, best->local_ts);
+		offset = tmv_add(offset, dbl_tmv(tmv_dbl(age) *
+						 (1.0 - tsp->clock_rate_ratio)));
+	}
+
+	pr_debug("min delay %10" PRId64 "   offset %10" PRId64
+		 "   current delay %10" PRId64, tmv_to_nanoseconds(best->delay),
+		 tmv_to_nanoseconds(offset), tmv_to_nanoseconds(ex->delay));
+
+	return offset;
+}
+
 int tsproc_update_offset(struct tsproc *tsp, tmv_t *offset, double *weight)
 {
-	tmv_t delay, raw_delay = 0;
+	tmv_t delay, raw_delay = tmv_zero();
 
 	if (tmv_is_zero(tsp->t1) || tmv_is_zero(tsp->t2) ||
 	    tmv_is_zero(tsp->t3))
 		return -1;
 
+	if (tsp->window) {
+		*offset = min_delay_offset(tsp);
+		if (tsp->offset_filter)
+			*offset = filter_sample(tsp->offset_filter, *offset);
+		if (weight)
+			*weight = 1.0;
+		return 0;
+	}
+
 	if (tsp->raw_mode || tsp->weighting)
 		raw_delay = get_raw_delay(tsp);
 
@@ -174,12 +285,15 @@ int tsproc_update_offset(struct tsproc *tsp, tmv_t *offset, double *weight)
 
 	/* offset = t2 - t1 - delay */
 	*offset = tmv_sub(tmv_sub(tsp->t2, tsp->t1), delay);
+	if (tsp->offset_filter)
+		*offset = filter_sample(tsp->offset_filter, *offset);
 
 	if (!weight)
 		return 0;
 
-	if (tsp->weighting && tsp->filtered_delay > 0 && raw_delay > 0) {
-		*weight = (double)tsp->filtered_delay / raw_delay;
+	if (tsp->weighting && tmv_sign(tsp->filtered_delay) > 0 &&
+	    tmv_sign(raw_delay) > 0) {
+		*weight = tmv_dbl(tsp->filtered_delay) / tmv_dbl(raw_delay);
 		if (*weight > 1.0)
 			*weight = 1.0;
 	} else {
@@ -196,6 +310,12 @@ void tsproc_reset(struct tsproc *tsp, int full)
 	tsp->t3 = tmv_zero();
 	tsp->t4 = tmv_zero();
 
+	/* The offsets in the window are no longer valid. */
+	tsp->window_cnt = 0;
+	tsp->window_index = 0;
+	if (tsp->offset_filter)
+		filter_reset(tsp->offset_filter);
+
 	if (full) {
 		tsp->clock_rate_ratio = 1.0;
 		filter_reset(tsp->delay_filter);
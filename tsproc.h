@@ -33,17 +33,35 @@ enum tsproc_mode {
 	TSPROC_RAW,
 	TSPROC_FILTER_WEIGHT,
 	TSPROC_RAW_WEIGHT,
+	TSPROC_MIN_DELAY,
 };
 
 /**
  * Create a new instance of the time stamp processor.
  * @param mode           Time stamp processing mode.
  * @param delay_filter   Type of the filter that will be applied to delay.
- * @param filter_length  Length of the filter.
+ * @param filter_length  Length of the filter, and of the window of exchanges
+ *                       searched for the minimum delay by TSPROC_MIN_DELAY.
+ * @param quantile       Quantile selected by a moving quantile filter.
  * @return               A pointer to a new tsproc on success, NULL otherwise.
  */
 struct tsproc *tsproc_create(enum tsproc_mode mode,
-			     enum filter_type delay_filter, int filter_length);
+			     enum filter_type delay_filter, int filter_length,
+			     double quantile);
+
+/**
+ * Replace the delay filter of a time stamp processor by a chain of filters,
+ * and filter the offsets by another chain.
+ * @param tsp           Pointer obtained via @ref tsproc_create().
+ * @param delay_chain   The stages of the delay filter, as accepted by
+ *                      @ref filter_chain_create(), or an empty string to
+ *                      keep the filter given to @ref tsproc_create().
+ * @param offset_chain  The stages of the offset filter, or an empty string
+ *                      to leave the offsets unfiltered.
+ * @return              Zero on success, non-zero if a chain is not valid.
+ */
+int tsproc_set_filters(struct tsproc *tsp, const char *delay_chain,
+		       const char *offset_chain);
 
 /**
  * Destroy a time stamp processor.
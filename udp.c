@@ -22,6 +22,7 @@
 #include <net/if.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -93,8 +94,20 @@ static int udp_close(struct transport *t, struct fdarray *fda)
 	return 0;
 }
 
+static int udp_filter(struct transport *t, struct fdarray *fda, int domain,
+		     int types)
+{
+	/* The filter sees the datagram from the UDP header onwards. */
+	if (sk_set_filter(fda->fd[FD_EVENT], sizeof(struct udphdr), domain,
+			  types & SK_EVENT_TYPES) ||
+	    sk_set_filter(fda->fd[FD_GENERAL], sizeof(struct udphdr), domain,
+			  types & ~SK_EVENT_TYPES))
+		return -1;
+	return 0;
+}
+
 static int open_socket(const char *name, struct in_addr mc_addr[2], short port,
-		       int ttl)
+		       int ttl, int reuseport)
 {
 	struct sockaddr_in addr;
 	int fd, index, on = 1;
@@ -117,14 +130,20 @@ static int open_socket(const char *name, struct in_addr mc_addr[2], short port,
 		pr_err("setsockopt SO_REUSEADDR failed: %m");
 		goto no_option;
 	}
-	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr))) {
-		pr_err("bind failed: %m");
+	if (reuseport &&
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) {
+		pr_err("setsockopt SO_REUSEPORT failed: %m");
 		goto no_option;
 	}
+	/* Binding to the device first gives each interface its own group. */
 	if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, name, strlen(name))) {
 		pr_err("setsockopt SO_BINDTODEVICE failed: %m");
 		goto no_option;
 	}
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+		pr_err("bind failed: %m");
+		goto no_option;
+	}
 	if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl))) {
 		pr_err("setsockopt IP_MULTICAST_TTL failed: %m");
 		goto no_option;
@@ -149,6 +168,30 @@ no_socket:
 	return -1;
 }
 
+/*
+ * Unicast messages reach only one socket of a SO_REUSEPORT group, so
+ * have them delivered to the one serving their domain.
+ */
+static int udp_steer(struct transport *t, const char *name, int efd, int gfd)
+{
+	uint8_t domains[SK_STEER_DOMAINS];
+	char path[64];
+	int n;
+
+	n = transport_domains(t, domains, SK_STEER_DOMAINS);
+
+	snprintf(path, sizeof(path), "%s/ptp4l-udp-%s-%d",
+		 SK_BPF_PIN_DIR, name, EVENT_PORT);
+	if (sk_set_reuseport_steering(efd, path, sizeof(struct udphdr),
+				      domains, n))
+		return -1;
+
+	snprintf(path, sizeof(path), "%s/ptp4l-udp-%s-%d",
+		 SK_BPF_PIN_DIR, name, GENERAL_PORT);
+	return sk_set_reuseport_steering(gfd, path, sizeof(struct udphdr),
+					 domains, n);
+}
+
 enum { MC_PRIMARY, MC_PDELAY };
 
 static struct in_addr mcast_addr[2];
@@ -158,7 +201,7 @@ static int udp_open(struct transport *t, const char *name, struct fdarray *fda,
 {
 	struct udp *udp = container_of(t, struct udp, t);
 	uint8_t event_dscp, general_dscp;
-	int efd, gfd, ttl;
+	int busy_poll, efd, gfd, prefer_busy_poll, reuseport, ttl;
 
 	ttl = config_get_int(t->cfg, name, "udp_ttl");
 	udp->mac.len = 0;
@@ -173,20 +216,35 @@ static int udp_open(struct transport *t, const char *name, struct fdarray *fda,
 	if (!inet_aton(PTP_PDELAY_MCAST_IPADDR, &mcast_addr[MC_PDELAY]))
 		return -1;
 
-	efd = open_socket(name, mcast_addr, EVENT_PORT, ttl);
+	reuseport = config_get_int(t->cfg, name, "udp_reuseport");
+
+	efd = open_socket(name, mcast_addr, EVENT_PORT, ttl, reuseport);
 	if (efd < 0)
 		goto no_event;
 
-	gfd = open_socket(name, mcast_addr, GENERAL_PORT, ttl);
+	gfd = open_socket(name, mcast_addr, GENERAL_PORT, ttl, reuseport);
 	if (gfd < 0)
 		goto no_general;
 
+	if (reuseport && udp_steer(t, name, efd, gfd))
+		goto no_timestamping;
+
 	if (sk_timestamping_init(efd, name, ts_type, TRANS_UDP_IPV4))
 		goto no_timestamping;
 
 	if (sk_general_init(gfd))
 		goto no_timestamping;
 
+	/* Only the event socket waits for its messages to leave. */
+	if (config_get_int(t->cfg, name, "tx_launch_lead") &&
+	    (sk_set_txtime(efd, 1) || sk_set_txtime(gfd, 0)))
+		goto no_timestamping;
+
+	busy_poll = config_get_int(t->cfg, name, "busy_poll");
+	prefer_busy_poll = config_get_int(t->cfg, name, "prefer_busy_poll");
+	sk_set_busy_poll(efd, busy_poll, prefer_busy_poll);
+	sk_set_busy_poll(gfd, busy_poll, prefer_busy_poll);
+
 	event_dscp = config_get_int(t->cfg, NULL, "dscp_event");
 	general_dscp = config_get_int(t->cfg, NULL, "dscp_general");
 
@@ -215,6 +273,12 @@ static int udp_recv(struct transport *t, int fd, void *buf, int buflen,
 	return sk_receive(fd, buf, buflen, addr, hwts, 0);
 }
 
+static int udp_recv_batch(struct transport *t, int fd, struct sk_rxbuf *rx,
+			  int n)
+{
+	return sk_receive_batch(fd, rx, n);
+}
+
 static int udp_send(struct transport *t, struct fdarray *fda, int event,
 		    int peer, void *buf, int len, struct address *addr,
 		    struct hw_timestamp *hwts)
@@ -234,6 +298,7 @@ static int udp_send(struct transport *t, struct fdarray *fda, int event,
 	}
 
 	addr->sin.sin_port = htons(event ? EVENT_PORT : GENERAL_PORT);
+	addr->len = sizeof(addr->sin);
 
 	/*
 	 * Extend the payload by two, for UDP checksum correction.
@@ -243,15 +308,49 @@ static int udp_send(struct transport *t, struct fdarray *fda, int event,
 	if (event == TRANS_ONESTEP)
 		len += 2;
 
-	cnt = sendto(fd, buf, len, 0, &addr->sa, sizeof(addr->sin));
+	/* Every datagram on the event socket consumes a time stamp key. */
+	if (event)
+		hwts->id = t->txid++;
+
+	cnt = sk_send(fd, buf, len, addr, hwts->txtime);
 	if (cnt < 1) {
 		pr_err("sendto failed: %m");
+		if (event)
+			t->txid--;
 		return cnt;
 	}
+	if (event != TRANS_EVENT)
+		return cnt;
 	/*
 	 * Get the time stamp right away.
 	 */
-	return event == TRANS_EVENT ? sk_receive(fd, junk, len, NULL, hwts, MSG_ERRQUEUE) : cnt;
+	cnt = sk_receive(fd, junk, len, NULL, hwts, MSG_ERRQUEUE);
+	if (cnt > 0 && hwts->id_valid)
+		t->txid = hwts->id + 1;
+	return cnt;
+}
+
+static int udp_send_batch(struct transport *t, struct fdarray *fda,
+			  struct sk_txbuf *tx, int n)
+{
+	struct address mcast;
+	int i;
+
+	memset(&mcast, 0, sizeof(mcast));
+	mcast.sin.sin_family = AF_INET;
+	mcast.sin.sin_addr = mcast_addr[MC_PRIMARY];
+	mcast.sin.sin_port = htons(GENERAL_PORT);
+	mcast.len = sizeof(mcast.sin);
+
+	for (i = 0; i < n; i++) {
+		if (!tx[i].addr) {
+			tx[i].addr = &mcast;
+			continue;
+		}
+		tx[i].addr->sin.sin_port = htons(GENERAL_PORT);
+		tx[i].addr->len = sizeof(tx[i].addr->sin);
+	}
+	return sk_send_batch(fda->fd[FD_GENERAL], tx, n);
 }
 
 static void udp_release(struct transport *t)
@@ -292,6 +391,9 @@ struct transport *udp_transport_create(void)
 	udp->t.close = udp_close;
 	udp->t.open  = udp_open;
 	udp->t.recv  = udp_recv;
+	udp->t.recv_batch = udp_recv_batch;
+	udp->t.send_batch = udp_send_batch;
+	udp->t.filter = udp_filter;
 	udp->t.send  = udp_send;
 	udp->t.release = udp_release;
 	udp->t.physical_addr = udp_physical_addr;
@@ -22,6 +22,7 @@
 #include <net/if.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -98,8 +99,20 @@ static int udp6_close(struct transport *t, struct fdarray *fda)
 	return 0;
 }
 
+static int udp6_filter(struct transport *t, struct fdarray *fda, int domain,
+		       int types)
+{
+	/* The filter sees the datagram from the UDP header onwards. */
+	if (sk_set_filter(fda->fd[FD_EVENT], sizeof(struct udphdr), domain,
+			  types & SK_EVENT_TYPES) ||
+	    sk_set_filter(fda->fd[FD_GENERAL], sizeof(struct udphdr), domain,
+			  types & ~SK_EVENT_TYPES))
+		return -1;
+	return 0;
+}
+
 static int open_socket_ipv6(const char *name, struct in6_addr mc_addr[2], short port,
-			    int *interface_index, int hop_limit)
+			    int *interface_index, int hop_limit, int reuseport)
 {
 	struct sockaddr_in6 addr;
 	int fd, index, on = 1;
@@ -124,14 +137,20 @@ static int open_socket_ipv6(const char *name, struct in6_addr mc_addr[2], short
 		pr_err("setsockopt SO_REUSEADDR failed: %m");
 		goto no_option;
 	}
-	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr))) {
-		pr_err("bind failed: %m");
+	if (reuseport &&
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) {
+		pr_err("setsockopt SO_REUSEPORT failed: %m");
 		goto no_option;
 	}
+	/* Binding to the device first gives each interface its own group. */
 	if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, name, strlen(name))) {
 		pr_err("setsockopt SO_BINDTODEVICE failed: %m");
 		goto no_option;
 	}
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+		pr_err("bind failed: %m");
+		goto no_option;
+	}
 	if (setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hop_limit,
 		       sizeof(hop_limit))) {
 		pr_err("setsockopt IPV6_MULTICAST_HOPS failed: %m");
@@ -157,6 +176,30 @@ no_socket:
 	return -1;
 }
 
+/*
+ * Unicast messages reach only one socket of a SO_REUSEPORT group, so
+ * have them delivered to the one serving their domain.
+ */
+static int udp6_steer(struct transport *t, const char *name, int efd, int gfd)
+{
+	uint8_t domains[SK_STEER_DOMAINS];
+	char path[64];
+	int n;
+
+	n = transport_domains(t, domains, SK_STEER_DOMAINS);
+
+	snprintf(path, sizeof(path), "%s/ptp4l-udp6-%s-%d",
+		 SK_BPF_PIN_DIR, name, EVENT_PORT);
+	if (sk_set_reuseport_steering(efd, path, sizeof(struct udphdr),
+				      domains, n))
+		return -1;
+
+	snprintf(path, sizeof(path), "%s/ptp4l-udp6-%s-%d",
+		 SK_BPF_PIN_DIR, name, GENERAL_PORT);
+	return sk_set_reuseport_steering(gfd, path, sizeof(struct udphdr),
+					 domains, n);
+}
+
 enum { MC_PRIMARY, MC_PDELAY };
 
 static struct in6_addr mc6_addr[2];
@@ -166,7 +209,7 @@ static int udp6_open(struct transport *t, const char *name, struct fdarray *fda,
 {
 	struct udp6 *udp6 = container_of(t, struct udp6, t);
 	uint8_t event_dscp, general_dscp;
-	int efd, gfd, hop_limit;
+	int busy_poll, efd, gfd, hop_limit, prefer_busy_poll, reuseport;
 
 	hop_limit = config_get_int(t->cfg, name, "udp_ttl");
 	udp6->mac.len = 0;
@@ -183,20 +226,37 @@ static int udp6_open(struct transport *t, const char *name, struct fdarray *fda,
 	if (1 != inet_pton(AF_INET6, PTP_PDELAY_MCAST_IP6ADDR, &mc6_addr[MC_PDELAY]))
 		return -1;
 
-	efd = open_socket_ipv6(name, mc6_addr, EVENT_PORT, &udp6->index, hop_limit);
+	reuseport = config_get_int(t->cfg, name, "udp_reuseport");
+
+	efd = open_socket_ipv6(name, mc6_addr, EVENT_PORT, &udp6->index,
+			       hop_limit, reuseport);
 	if (efd < 0)
 		goto no_event;
 
-	gfd = open_socket_ipv6(name, mc6_addr, GENERAL_PORT, &udp6->index, hop_limit);
+	gfd = open_socket_ipv6(name, mc6_addr, GENERAL_PORT, &udp6->index,
+			       hop_limit, reuseport);
 	if (gfd < 0)
 		goto no_general;
 
+	if (reuseport && udp6_steer(t, name, efd, gfd))
+		goto no_timestamping;
+
 	if (sk_timestamping_init(efd, name, ts_type, TRANS_UDP_IPV6))
 		goto no_timestamping;
 
 	if (sk_general_init(gfd))
 		goto no_timestamping;
 
+	/* Only the event socket waits for its messages to leave. */
+	if (config_get_int(t->cfg, name, "tx_launch_lead") &&
+	    (sk_set_txtime(efd, 1) || sk_set_txtime(gfd, 0)))
+		goto no_timestamping;
+
+	busy_poll = config_get_int(t->cfg, name, "busy_poll");
+	prefer_busy_poll = config_get_int(t->cfg, name, "prefer_busy_poll");
+	sk_set_busy_poll(efd, busy_poll, prefer_busy_poll);
+	sk_set_busy_poll(gfd, busy_poll, prefer_busy_poll);
+
 	event_dscp = config_get_int(t->cfg, NULL, "dscp_event");
 	general_dscp = config_get_int(t->cfg, NULL, "dscp_general");
 
@@ -225,6 +285,12 @@ static int udp6_recv(struct transport *t, int fd, void *buf, int buflen,
 	return sk_receive(fd, buf, buflen, addr, hwts, 0);
 }
 
+static int udp6_recv_batch(struct transport *t, int fd,
+			   struct sk_rxbuf *rx, int n)
+{
+	return sk_receive_batch(fd, rx, n);
+}
+
 static int udp6_send(struct transport *t, struct fdarray *fda, int event,
 		    int peer, void *buf, int len, struct address *addr,
 		    struct hw_timestamp *hwts)
@@ -248,18 +314,58 @@ static int udp6_send(struct transport *t, struct fdarray *fda, int event,
 	}
 
 	addr->sin6.sin6_port = htons(event ? EVENT_PORT : GENERAL_PORT);
+	addr->len = sizeof(addr->sin6);
 
 	len += 2; /* Extend the payload by two, for UDP checksum corrections. */
 
-	cnt = sendto(fd, buf, len, 0, &addr->sa, sizeof(addr->sin6));
+	/* Every datagram on the event socket consumes a time stamp key. */
+	if (event)
+		hwts->id = t->txid++;
+
+	cnt = sk_send(fd, buf, len, addr, hwts->txtime);
 	if (cnt < 1) {
 		pr_err("sendto failed: %m");
+		if (event)
+			t->txid--;
 		return cnt;
 	}
+	if (event != TRANS_EVENT)
+		return cnt;
 	/*
 	 * Get the time stamp right away.
 	 */
-	return event == TRANS_EVENT ? sk_receive(fd, junk, len, NULL, hwts, MSG_ERRQUEUE) : cnt;
+	cnt = sk_receive(fd, junk, len, NULL, hwts, MSG_ERRQUEUE);
+	if (cnt > 0 && hwts->id_valid)
+		t->txid = hwts->id + 1;
+	return cnt;
+}
+
+static int udp6_send_batch(struct transport *t, struct fdarray *fda,
+			   struct sk_txbuf *tx, int n)
+{
+	struct udp6 *udp6 = container_of(t, struct udp6, t);
+	struct address mcast;
+	int i;
+
+	memset(&mcast, 0, sizeof(mcast));
+	mcast.sin6.sin6_family = AF_INET6;
+	mcast.sin6.sin6_addr = mc6_addr[MC_PRIMARY];
+	if (is_link_local(&mcast.sin6.sin6_addr))
+		mcast.sin6.sin6_scope_id = udp6->index;
+	mcast.sin6.sin6_port = htons(GENERAL_PORT);
+	mcast.len = sizeof(mcast.sin6);
+
+	for (i = 0; i < n; i++) {
+		/* Extend the payload by two, as in udp6_send(). */
+		tx[i].len += 2;
+		if (!tx[i].addr) {
+			tx[i].addr = &mcast;
+			continue;
+		}
+		tx[i].addr->sin6.sin6_port = htons(GENERAL_PORT);
+		tx[i].addr->len = sizeof(tx[i].addr->sin6);
+	}
+	return sk_send_batch(fda->fd[FD_GENERAL], tx, n);
 }
 
 static void udp6_release(struct transport *t)
@@ -301,6 +407,9 @@ struct transport *udp6_transport_create(void)
 	udp6->t.close   = udp6_close;
 	udp6->t.open    = udp6_open;
 	udp6->t.recv    = udp6_recv;
+	udp6->t.recv_batch = udp6_recv_batch;
+	udp6->t.send_batch = udp6_send_batch;
+	udp6->t.filter  = udp6_filter;
 	udp6->t.send    = udp6_send;
 	udp6->t.release = udp6_release;
 	udp6->t.physical_addr = udp6_physical_addr;
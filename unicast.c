@@ -0,0 +1,235 @@
+/**
+ * @file unicast.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "contain.h"
+#include "hash.h"
+#include "print.h"
+#include "unicast.h"
+#include "util.h"
+
+#define NS_PER_SEC 1000000000ULL
+
+struct unicast_table {
+	LIST_HEAD(clients, unicast_client) clients;
+	struct hash *index; /* by port identity */
+	struct wheel *wheel;
+	void *owner;
+	int count;
+	int max;
+};
+
+static uint64_t unicast_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static uint64_t period_ns(Integer8 log_period)
+{
+	if (log_period < -30)
+		log_period = -30;
+	if (log_period > 30)
+		log_period = 30;
+	return log_period < 0 ? NS_PER_SEC >> -log_period :
+		NS_PER_SEC << log_period;
+}
+
+static struct unicast_client *client_create(struct unicast_table *ut,
+					    struct PortIdentity *pid)
+{
+	struct unicast_client *uc;
+	int i;
+
+	if (ut->count >= ut->max)
+		return NULL;
+	uc = calloc(1, sizeof(*uc));
+	if (!uc)
+		return NULL;
+	uc->portIdentity = *pid;
+	if (hash_insert(ut->index, pid2str(pid), uc)) {
+		free(uc);
+		return NULL;
+	}
+	wheel_timer_init(&uc->expiry, ut->owner, UNICAST_TIMER_EXPIRY);
+	for (i = 0; i < UNICAST_N_TYPES; i++) {
+		wheel_timer_init(&uc->grant[i].tx, ut->owner,
+				 UNICAST_TIMER_BASE + i);
+		uc->grant[i].client = uc;
+	}
+	LIST_INSERT_HEAD(&ut->clients, uc, list);
+	ut->count++;
+	return uc;
+}
+
+static void client_destroy(struct unicast_table *ut, struct unicast_client *uc)
+{
+	int i;
+
+	for (i = 0; i < UNICAST_N_TYPES; i++)
+		wheel_clear(ut->wheel, &uc->grant[i].tx);
+	wheel_clear(ut->wheel, &uc->expiry);
+	hash_remove(ut->index, pid2str(&uc->portIdentity));
+	LIST_REMOVE(uc, list);
+	ut->count--;
+	free(uc);
+}
+
+/*
+ * Drops the expired grants, and destroys a client left without any.
+ * Otherwise sets the expiry timer for the next grant to expire.
+ */
+static void client_expire(struct unicast_table *ut, struct unicast_client *uc,
+			  uint64_t now)
+{
+	struct unicast_grant *g;
+	uint64_t next = 0;
+	int i;
+
+	for (i = 0; i < UNICAST_N_TYPES; i++) {
+		g = &uc->grant[i];
+		if (!g->expiry)
+			continue;
+		if (g->expiry <= now) {
+			g->expiry = 0;
+			wheel_clear(ut->wheel, &g->tx);
+			continue;
+		}
+		if (!next || g->expiry < next)
+			next = g->expiry;
+	}
+	if (!next) {
+		client_destroy(ut, uc);
+		return;
+	}
+	wheel_set(ut->wheel, &uc->expiry, next - now);
+}
+
+struct unicast_table *unicast_create(struct wheel *w, void *owner, int max)
+{
+	struct unicast_table *ut;
+
+	ut = calloc(1, sizeof(*ut));
+	if (!ut)
+		return NULL;
+	ut->index = hash_create();
+	if (!ut->index) {
+		free(ut);
+		return NULL;
+	}
+	LIST_INIT(&ut->clients);
+	ut->wheel = w;
+	ut->owner = owner;
+	ut->max = max;
+	return ut;
+}
+
+void unicast_destroy(struct unicast_table *ut)
+{
+	unicast_clear(ut);
+	hash_destroy(ut->index, NULL);
+	free(ut);
+}
+
+void unicast_clear(struct unicast_table *ut)
+{
+	struct unicast_client *uc;
+
+	while ((uc = LIST_FIRST(&ut->clients)))
+		client_destroy(ut, uc);
+}
+
+int unicast_count(struct unicast_table *ut)
+{
+	return ut->count;
+}
+
+int unicast_grant(struct unicast_table *ut, struct PortIdentity *pid,
+		  struct address *addr, enum unicast_type type,
+		  Integer8 log_period, UInteger32 duration)
+{
+	struct unicast_client *uc;
+	struct unicast_grant *g;
+	uint64_t now, period;
+
+	uc = hash_lookup(ut->index, pid2str(pid));
+	if (!uc) {
+		uc = client_create(ut, pid);
+		if (!uc)
+			return -1;
+	}
+	uc->address = *addr;
+	g = &uc->grant[type];
+
+	now = unicast_now();
+	if (type != UNICAST_DELAY_RESP &&
+	    (!g->expiry || g->logInterMessagePeriod != log_period)) {
+		period = period_ns(log_period);
+		/* Spread the first transmissions over the period. */
+		wheel_set(ut->wheel, &g->tx,
+			  1 + (uint64_t) (random() / (RAND_MAX + 1.0) * period));
+	}
+	g->logInterMessagePeriod = log_period;
+	g->expiry = now + duration * NS_PER_SEC;
+	client_expire(ut, uc, now);
+	return 0;
+}
+
+void unicast_cancel(struct unicast_table *ut, struct PortIdentity *pid,
+		    enum unicast_type type)
+{
+	struct unicast_client *uc;
+	uint64_t now;
+
+	uc = hash_lookup(ut->index, pid2str(pid));
+	if (!uc || !uc->grant[type].expiry)
+		return;
+	now = unicast_now();
+	uc->grant[type].expiry = now;
+	client_expire(ut, uc, now);
+}
+
+struct unicast_grant *unicast_find(struct unicast_table *ut,
+				   struct PortIdentity *pid,
+				   enum unicast_type type)
+{
+	struct unicast_client *uc;
+
+	uc = hash_lookup(ut->index, pid2str(pid));
+	return uc && uc->grant[type].expiry ? &uc->grant[type] : NULL;
+}
+
+struct unicast_grant *unicast_timer(struct unicast_table *ut,
+				    struct wheel_timer *t)
+{
+	struct unicast_grant *g;
+
+	if (t->index == UNICAST_TIMER_EXPIRY) {
+		client_expire(ut, container_of(t, struct unicast_client, expiry),
+			      unicast_now());
+		return NULL;
+	}
+	g = container_of(t, struct unicast_grant, tx);
+	wheel_set(ut->wheel, &g->tx, period_ns(g->logInterMessagePeriod));
+	return g;
+}
@@ -0,0 +1,140 @@
+/**
+ * @file unicast.h
+ * @brief Keeps the unicast transmissions granted to the slaves of a port.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_UNICAST_H
+#define HAVE_UNICAST_H
+
+#include <sys/queue.h>
+
+#include "address.h"
+#include "ddt.h"
+#include "wheel.h"
+
+/* The kinds of unicast transmissions which can be granted */
+enum unicast_type {
+	UNICAST_ANNOUNCE,
+	UNICAST_SYNC,
+	UNICAST_DELAY_RESP,
+	UNICAST_N_TYPES,
+};
+
+/*
+ * The timers of the clients use indexes from UNICAST_TIMER_BASE up, so
+ * that the owner can tell them from its own timers. A timer with the
+ * index UNICAST_TIMER_BASE + type is due for a transmission of that
+ * type, one with UNICAST_TIMER_EXPIRY for the expiry of a grant.
+ */
+#define UNICAST_TIMER_BASE	0x100
+#define UNICAST_TIMER_EXPIRY	(UNICAST_TIMER_BASE + UNICAST_N_TYPES)
+
+struct unicast_client;
+
+struct unicast_grant {
+	struct wheel_timer tx;
+	struct unicast_client *client;
+	uint64_t expiry; /* CLOCK_MONOTONIC nanoseconds, zero if not granted */
+	Integer8 logInterMessagePeriod;
+	UInteger16 sequenceId;
+};
+
+struct unicast_client {
+	LIST_ENTRY(unicast_client) list;
+	struct wheel_timer expiry;
+	struct PortIdentity portIdentity;
+	struct address address;
+	struct unicast_grant grant[UNICAST_N_TYPES];
+};
+
+struct unicast_table;
+
+/**
+ * Create a table of unicast clients.
+ * @param w        The timer wheel serving the timers of the clients.
+ * @param owner    The owner passed back with the expired timers.
+ * @param max      The maximum number of clients.
+ * @return         A pointer to a new table on success, NULL otherwise.
+ */
+struct unicast_table *unicast_create(struct wheel *w, void *owner, int max);
+
+/**
+ * Destroy a table of unicast clients, cancelling all of the grants.
+ * @param ut  A pointer obtained via unicast_create().
+ */
+void unicast_destroy(struct unicast_table *ut);
+
+/**
+ * Cancel all of the grants.
+ * @param ut  A pointer obtained via unicast_create().
+ */
+void unicast_clear(struct unicast_table *ut);
+
+/**
+ * Get the number of clients holding a grant.
+ * @param ut  A pointer obtained via unicast_create().
+ * @return    The number of clients.
+ */
+int unicast_count(struct unicast_table *ut);
+
+/**
+ * Grant or renew a unicast transmission. The first transmission of a new
+ * grant is due at a random time within the period, so that the
+ * transmissions to many clients are spread out evenly.
+ * @param ut        A pointer obtained via unicast_create().
+ * @param pid       The port identity of the client.
+ * @param addr      The address of the client.
+ * @param type      The kind of transmission.
+ * @param log_period  The logarithm of the period of the transmissions.
+ * @param duration  The duration of the grant in seconds.
+ * @return          Zero on success, non-zero if the table is full.
+ */
+int unicast_grant(struct unicast_table *ut, struct PortIdentity *pid,
+		  struct address *addr, enum unicast_type type,
+		  Integer8 log_period, UInteger32 duration);
+
+/**
+ * Cancel a unicast transmission.
+ * @param ut    A pointer obtained via unicast_create().
+ * @param pid   The port identity of the client.
+ * @param type  The kind of transmission.
+ */
+void unicast_cancel(struct unicast_table *ut, struct PortIdentity *pid,
+		    enum unicast_type type);
+
+/**
+ * Look up the grant of a client.
+ * @param ut    A pointer obtained via unicast_create().
+ * @param pid   The port identity of the client.
+ * @param type  The kind of transmission.
+ * @return      The grant, or NULL if the client does not hold one.
+ */
+struct unicast_grant *unicast_find(struct unicast_table *ut,
+				   struct PortIdentity *pid,
+				   enum unicast_type type);
+
+/**
+ * Handle an expired timer of a client. An expired grant is cancelled,
+ * and the timer of a transmission is set for the next one.
+ * @param ut  A pointer obtained via unicast_create().
+ * @param t   The timer.
+ * @return    The grant due for a transmission, or NULL.
+ */
+struct unicast_grant *unicast_timer(struct unicast_table *ut,
+				    struct wheel_timer *t);
+
+#endif
@@ -17,11 +17,16 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #include <errno.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
 
 #include "address.h"
 #include "print.h"
@@ -33,6 +38,7 @@
 #define NS_PER_DAY (24 * NS_PER_HOUR)
 
 static int running = 1;
+static int reload;
 
 const char *ps_str[] = {
 	"NONE",
@@ -368,6 +374,28 @@ int is_running(void)
 	return running;
 }
 
+static void handle_hup(int s)
+{
+	reload = 1;
+}
+
+int handle_reload_signal(void)
+{
+	if (SIG_ERR == signal(SIGHUP, handle_hup)) {
+		fprintf(stderr, "cannot handle SIGHUP\n");
+		return -1;
+	}
+	return 0;
+}
+
+int reload_requested(void)
+{
+	int r = reload;
+
+	reload = 0;
+	return r;
+}
+
 void *xmalloc(size_t size)
 {
 	void *r;
@@ -527,3 +555,101 @@ int rate_limited(int interval, time_t *last)
 
 	return 0;
 }
+
+int set_scheduling(int priority, int cpu, int lock)
+{
+	struct sched_param param;
+	cpu_set_t set;
+
+	if (cpu >= CPU_SETSIZE) {
+		pr_err("cpu %d out of range", cpu);
+		return -1;
+	}
+	if (cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set)) {
+			pr_err("failed to bind to cpu %d: %m", cpu);
+			return -1;
+		}
+	}
+	if (priority) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = priority;
+		if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+			pr_err("failed to set SCHED_FIFO priority %d: %m",
+			       priority);
+			return -1;
+		}
+	}
+	if (lock && mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		pr_err("mlockall failed: %m");
+		return -1;
+	}
+	return 0;
+}
+
+/* Parse a list of CPUs in the format of sysfs, e.g. "0-7,16-23". */
+static int parse_cpulist(const char *list, cpu_set_t *set)
+{
+	long first, last;
+	char *end;
+
+	CPU_ZERO(set);
+	while (*list && *list != '\n') {
+		first = strtol(list, &end, 10);
+		last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+		if (end == list || first < 0 || last < first ||
+		    last >= CPU_SETSIZE)
+			return -1;
+		for (; first <= last; first++)
+			CPU_SET(first, set);
+		list = *end == ',' ? end + 1 : end;
+	}
+	return CPU_COUNT(set) ? 0 : -1;
+}
+
+#define MAX_NUMA_NODES 1024
+
+int set_numa_node(int node)
+{
+	unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+	char path[64], list[1024];
+	cpu_set_t set;
+	FILE *f;
+
+	if (node < 0 || node >= MAX_NUMA_NODES) {
+		pr_err("NUMA node %d out of range", node);
+		return -1;
+	}
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+		 node);
+	f = fopen(path, "r");
+	if (!f) {
+		pr_err("failed to open %s: %m", path);
+		return -1;
+	}
+	if (!fgets(list, sizeof(list), f) || parse_cpulist(list, &set)) {
+		pr_err("failed to read the CPUs of NUMA node %d", node);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		pr_err("failed to bind to NUMA node %d: %m", node);
+		return -1;
+	}
+
+	/* The memory of the other nodes is still used when this is full. */
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(unsigned long))] =
+		1UL << (node % (8 * sizeof(unsigned long)));
+	if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, node + 2)) {
+		pr_err("failed to prefer the memory of NUMA node %d: %m",
+		       node);
+		return -1;
+	}
+	return 0;
+}
@@ -254,6 +254,22 @@ int handle_term_signals(void);
  */
 int is_running(void);
 
+/**
+ * Setup a handler for the signal asking to reload the configuration
+ * (SIGHUP).
+ *
+ * @return       0 on success, -1 on error.
+ */
+int handle_reload_signal(void);
+
+/**
+ * Check if a reload of the configuration was asked for since the last
+ * call.
+ *
+ * @return       1 if a reload signal was received, 0 otherwise.
+ */
+int reload_requested(void);
+
 /**
  * Allocate memory. This is a malloc() wrapper that terminates the process when
  * the allocation fails.
@@ -363,4 +379,25 @@ void parray_extend(void ***a, ...);
  */
 int rate_limited(int interval, time_t *last);
 
+/**
+ * Configure the scheduling of the calling thread. Threads created
+ * afterwards inherit the settings.
+ *
+ * @param priority  SCHED_FIFO priority, or zero to keep the current policy.
+ * @param cpu       The CPU to run on, or -1 to keep the current affinity.
+ * @param lock      Non-zero to lock all current and future memory pages.
+ * @return          Zero on success, non-zero otherwise.
+ */
+int set_scheduling(int priority, int cpu, int lock);
+
+/**
+ * Run the calling thread on the CPUs of a NUMA node, and prefer the
+ * memory of the node for its allocations. Threads created afterwards
+ * inherit the settings.
+ *
+ * @param node  The NUMA node.
+ * @return      Zero on success, non-zero otherwise.
+ */
+int set_numa_node(int node);
+
 #endif
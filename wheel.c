@@ -0,0 +1,319 @@
+/**
+ * @file wheel.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "missing.h"
+#include "print.h"
+#include "tmv.h"
+#include "wheel.h"
+
+/*
+ * Each level has 64 slots, and each slot of a level spans a whole
+ * rotation of the level below. With a tick of about one millisecond,
+ * four levels cover timeouts of up to four and a half hours. Longer
+ * timeouts are parked in the top level until they come into range.
+ *
+ * The slots only order the timers. Each timer keeps its exact expiry,
+ * and the timerfd is programmed for the earliest one, so timers do not
+ * suffer from the granularity of the tick.
+ */
+#define WHEEL_BITS	6
+#define WHEEL_SLOTS	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS	4
+#define WHEEL_MAX	((1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+#define TICK_SHIFT	20
+
+/* Timer states. Non-negative values give the level of a pending timer. */
+#define WT_IDLE		-2
+#define WT_EXPIRED	-1
+
+LIST_HEAD(timer_list, wheel_timer);
+
+struct wheel {
+	struct timer_list slot[WHEEL_LEVELS][WHEEL_SLOTS];
+	int count[WHEEL_LEVELS];
+	struct timer_list expired;
+	uint64_t tick; /* the level zero slot being served */
+	uint64_t next; /* earliest expiry, unless rescan is set */
+	uint64_t armed; /* value of the timerfd, zero when disarmed */
+	int pending;
+	int rescan;
+	int stale; /* the timerfd fired, and must be programmed again */
+	int fd;
+};
+
+static uint64_t wheel_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void wheel_insert(struct wheel *w, struct wheel_timer *t)
+{
+	uint64_t delta, tick = t->expiry >> TICK_SHIFT;
+	int index, level;
+
+	if (tick < w->tick)
+		tick = w->tick;
+	delta = tick - w->tick;
+	if (delta > WHEEL_MAX) {
+		delta = WHEEL_MAX;
+		tick = w->tick + delta;
+	}
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < 1ULL << (WHEEL_BITS * (level + 1)))
+			break;
+	}
+	index = (tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	LIST_INSERT_HEAD(&w->slot[level][index], t, list);
+	w->count[level]++;
+	t->state = level;
+}
+
+static void wheel_cascade(struct wheel *w)
+{
+	struct wheel_timer *t;
+	struct timer_list *head;
+	int index, level;
+
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		index = (w->tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+		head = &w->slot[level][index];
+		while ((t = LIST_FIRST(head))) {
+			LIST_REMOVE(t, list);
+			w->count[level]--;
+			wheel_insert(w, t);
+		}
+		if (index)
+			break;
+	}
+}
+
+static uint64_t wheel_earliest(struct wheel *w)
+{
+	uint64_t next = UINT64_MAX;
+	struct wheel_timer *t;
+	struct timer_list *head;
+	int i, index, level;
+
+	/*
+	 * Within a level the slots following the current one are in
+	 * order of expiry, so only the first busy slot of each level
+	 * needs to be searched.
+	 */
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		if (!w->count[level])
+			continue;
+		index = (w->tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+		for (i = level ? 1 : 0; i <= WHEEL_SLOTS; i++) {
+			head = &w->slot[level][(index + i) & WHEEL_MASK];
+			if (LIST_EMPTY(head))
+				continue;
+			LIST_FOREACH(t, head, list) {
+				if (t->expiry < next)
+					next = t->expiry;
+			}
+			break;
+		}
+	}
+	return next;
+}
+
+struct wheel *wheel_create(void)
+{
+	struct wheel *w;
+	int i, j;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+	w->fd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (w->fd < 0) {
+		pr_err("timerfd_create failed: %m");
+		free(w);
+		return NULL;
+	}
+	for (i = 0; i < WHEEL_LEVELS; i++) {
+		for (j = 0; j < WHEEL_SLOTS; j++) {
+			LIST_INIT(&w->slot[i][j]);
+		}
+	}
+	LIST_INIT(&w->expired);
+	w->tick = wheel_now() >> TICK_SHIFT;
+	w->next = UINT64_MAX;
+	return w;
+}
+
+void wheel_destroy(struct wheel *w)
+{
+	close(w->fd);
+	free(w);
+}
+
+int wheel_fd(struct wheel *w)
+{
+	return w->fd;
+}
+
+void wheel_timer_init(struct wheel_timer *t, void *owner, int index)
+{
+	t->expiry = 0;
+	t->state = WT_IDLE;
+	t->owner = owner;
+	t->index = index;
+}
+
+static void wheel_start(struct wheel *w, struct wheel_timer *t,
+			uint64_t now, uint64_t expiry)
+{
+	if (!w->pending)
+		w->tick = now >> TICK_SHIFT;
+	t->expiry = expiry;
+	wheel_insert(w, t);
+	w->pending++;
+	if (t->expiry < w->next)
+		w->next = t->expiry;
+}
+
+void wheel_set(struct wheel *w, struct wheel_timer *t, uint64_t ns)
+{
+	uint64_t now;
+
+	wheel_clear(w, t);
+	if (!ns)
+		return;
+	now = wheel_now();
+	wheel_start(w, t, now, now + ns);
+}
+
+void wheel_set_aligned(struct wheel *w, struct wheel_timer *t, uint64_t period)
+{
+	uint64_t now;
+
+	wheel_clear(w, t);
+	if (!period)
+		return;
+	now = wheel_now();
+	wheel_start(w, t, now, (now / period + 1) * period);
+}
+
+void wheel_clear(struct wheel *w, struct wheel_timer *t)
+{
+	switch (t->state) {
+	case WT_IDLE:
+		return;
+	case WT_EXPIRED:
+		LIST_REMOVE(t, list);
+		break;
+	default:
+		LIST_REMOVE(t, list);
+		w->count[t->state]--;
+		w->pending--;
+		if (t->expiry == w->next)
+			w->rescan = 1;
+		break;
+	}
+	t->state = WT_IDLE;
+}
+
+void wheel_expire(struct wheel *w)
+{
+	uint64_t step, now = wheel_now(), target = now >> TICK_SHIFT;
+	struct wheel_timer *t, *tmp;
+	struct timer_list *head;
+	int level;
+
+	w->stale = 1;
+	w->rescan = 1;
+
+	while (1) {
+		head = &w->slot[0][w->tick & WHEEL_MASK];
+		for (t = LIST_FIRST(head); t; t = tmp) {
+			tmp = LIST_NEXT(t, list);
+			if (t->expiry > now)
+				continue;
+			LIST_REMOVE(t, list);
+			w->count[0]--;
+			w->pending--;
+			LIST_INSERT_HEAD(&w->expired, t, list);
+			t->state = WT_EXPIRED;
+		}
+		if (w->tick >= target)
+			break;
+		/* Skip ahead to the next cascade of a busy level. */
+		for (level = 0; level < WHEEL_LEVELS; level++) {
+			if (w->count[level])
+				break;
+		}
+		if (!level) {
+			w->tick++;
+		} else if (level == WHEEL_LEVELS) {
+			w->tick = target;
+		} else {
+			step = 1ULL << (WHEEL_BITS * level);
+			w->tick = (w->tick | (step - 1)) + 1;
+			if (w->tick > target)
+				w->tick = target;
+		}
+		if (!(w->tick & WHEEL_MASK))
+			wheel_cascade(w);
+	}
+}
+
+struct wheel_timer *wheel_next(struct wheel *w)
+{
+	struct wheel_timer *t = LIST_FIRST(&w->expired);
+
+	if (t) {
+		LIST_REMOVE(t, list);
+		t->state = WT_IDLE;
+	}
+	return t;
+}
+
+int wheel_arm(struct wheel *w)
+{
+	struct itimerspec tmo = {
+		{0, 0}, {0, 0}
+	};
+	uint64_t next;
+
+	if (w->rescan) {
+		w->next = wheel_earliest(w);
+		w->rescan = 0;
+	}
+	next = w->pending ? w->next : 0;
+	if (!w->stale && next == w->armed)
+		return 0;
+
+	tmo.it_value.tv_sec = next / NS_PER_SEC;
+	tmo.it_value.tv_nsec = next % NS_PER_SEC;
+	if (timerfd_settime(w->fd, TFD_TIMER_ABSTIME, &tmo, NULL)) {
+		pr_err("timerfd_settime failed: %m");
+		return -1;
+	}
+	w->armed = next;
+	w->stale = 0;
+	return 0;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file wheel.h
+ * @brief Implements a hierarchical timer wheel driven by a single timerfd.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_WHEEL_H
+#define HAVE_WHEEL_H
+
+#include <stdint.h>
+#include <sys/queue.h>
+
+/**
+ * A one shot timer. The owner embeds this structure in its own data
+ * and identifies the expired timer by its owner and index fields.
+ */
+struct wheel_timer {
+	LIST_ENTRY(wheel_timer) list;
+	uint64_t expiry; /* CLOCK_MONOTONIC nanoseconds */
+	int state;
+	void *owner;
+	int index;
+};
+
+struct wheel;
+
+/**
+ * Create a new timer wheel.
+ * @return  A pointer to a new timer wheel on success, NULL otherwise.
+ */
+struct wheel *wheel_create(void);
+
+/**
+ * Destroy a timer wheel. Timers still pending are simply forgotten.
+ * @param w  A pointer obtained via wheel_create().
+ */
+void wheel_destroy(struct wheel *w);
+
+/**
+ * Obtain the descriptor that becomes readable when a timer is due.
+ * @param w  The timer wheel.
+ * @return   A timerfd descriptor.
+ */
+int wheel_fd(struct wheel *w);
+
+/**
+ * Prepare a timer for use. The timer starts out disarmed.
+ * @param t      The timer to initialize.
+ * @param owner  Opaque pointer passed back with the expired timer.
+ * @param index  Number passed back with the expired timer.
+ */
+void wheel_timer_init(struct wheel_timer *t, void *owner, int index);
+
+/**
+ * Arm a timer, replacing any previous setting. Just as with
+ * timerfd_settime(2), a zero timeout disarms the timer.
+ * @param w   The timer wheel.
+ * @param t   The timer to arm.
+ * @param ns  The timeout in nanoseconds, relative to now.
+ */
+void wheel_set(struct wheel *w, struct wheel_timer *t, uint64_t ns);
+
+/**
+ * Arm a timer to expire at the next multiple of a period on the
+ * monotonic clock, replacing any previous setting. Timers armed with
+ * the same period expire together. A zero period disarms the timer.
+ * @param w       The timer wheel.
+ * @param t       The timer to arm.
+ * @param period  The period in nanoseconds.
+ */
+void wheel_set_aligned(struct wheel *w, struct wheel_timer *t, uint64_t period);
+
+/**
+ * Disarm a timer. This also withdraws a timer that has expired but has
+ * not yet been taken with wheel_next().
+ * @param w  The timer wheel.
+ * @param t  The timer to disarm.
+ */
+void wheel_clear(struct wheel *w, struct wheel_timer *t);
+
+/**
+ * Collect the timers that are due. To be called when wheel_fd()
+ * becomes readable.
+ * @param w  The timer wheel.
+ */
+void wheel_expire(struct wheel *w);
+
+/**
+ * Take the next expired timer.
+ * @param w  The timer wheel.
+ * @return   An expired timer, now disarmed, or NULL if there are none.
+ */
+struct wheel_timer *wheel_next(struct wheel *w);
+
+/**
+ * Program the descriptor for the earliest pending timer. Changes made
+ * since the last call are coalesced into at most one system call, so
+ * this should be called once before waiting on wheel_fd().
+ * @param w  The timer wheel.
+ * @return   Zero on success, non-zero otherwise.
+ */
+int wheel_arm(struct wheel *w);
+
+#endif
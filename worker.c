@@ -0,0 +1,560 @@
+/**
+ * @file worker.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#include "print.h"
+#include "sk.h"
+#include "worker.h"
+
+#ifdef HAVE_EPOLL
+
+#define WORKER_QLEN	256 /* must be a power of two */
+#define WORKER_EVENTS	16
+
+enum worker_cmd {
+	CMD_NONE,
+	CMD_WATCH,
+	CMD_FORGET,
+	CMD_STOP,
+};
+
+struct worker_src {
+	struct worker_src *next;
+	struct port *port;
+	struct transport *trp;
+	enum timestamp_type tt;
+	int fd;
+};
+
+struct worker_item {
+	struct port *port;
+	struct ptp_message *msg;
+	int cnt;
+};
+
+struct worker {
+	pthread_t thread;
+	int epoll_fd;
+	int ctl_fd; /* wakes the worker */
+	int rx_fd;  /* wakes the clock */
+	/* received messages, produced by the worker */
+	struct worker_item rxq[WORKER_QLEN];
+	atomic_uint rx_head;
+	atomic_uint rx_tail;
+	/* empty buffers, produced by the clock */
+	struct ptp_message *freeq[WORKER_QLEN];
+	atomic_uint free_head;
+	atomic_uint free_tail;
+	atomic_int starved;
+	/* command interface, protected by 'lock' */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	enum worker_cmd cmd;
+	struct worker_src *cmd_src;
+	struct port *cmd_port;
+	int cmd_err;
+	/* private to the worker thread */
+	struct worker_src *sources;
+	struct ptp_message *batch[SK_RX_BATCH];
+	int nbatch;
+};
+
+static void worker_signal(int fd)
+{
+	uint64_t one = 1;
+
+	if (write(fd, &one, sizeof(one)) != sizeof(one))
+		pr_err("worker: eventfd write failed: %m");
+}
+
+static void worker_clear(int fd)
+{
+	uint64_t val;
+
+	if (read(fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		pr_err("worker: eventfd read failed: %m");
+}
+
+static struct ptp_message *free_pop(struct worker *w)
+{
+	struct ptp_message *msg;
+	unsigned int head, tail;
+
+	tail = atomic_load_explicit(&w->free_tail, memory_order_relaxed);
+	head = atomic_load_explicit(&w->free_head, memory_order_acquire);
+	if (head == tail)
+		return NULL;
+	msg = w->freeq[tail % WORKER_QLEN];
+	atomic_store_explicit(&w->free_tail, tail + 1, memory_order_release);
+	return msg;
+}
+
+static int rx_push(struct worker *w, struct port *p, struct ptp_message *msg,
+		   int cnt)
+{
+	struct worker_item *it;
+	unsigned int head, tail;
+
+	head = atomic_load_explicit(&w->rx_head, memory_order_relaxed);
+	tail = atomic_load_explicit(&w->rx_tail, memory_order_acquire);
+	if (head - tail == WORKER_QLEN)
+		return -1;
+	it = &w->rxq[head % WORKER_QLEN];
+	it->port = p;
+	it->msg = msg;
+	it->cnt = cnt;
+	atomic_store_explicit(&w->rx_head, head + 1, memory_order_release);
+	return 0;
+}
+
+/*
+ * The sockets are edge triggered, so keep reading until one is empty.
+ * Returns the number of messages queued for the clock.
+ */
+static int worker_drain(struct worker *w, struct worker_src *src)
+{
+	int cnt[SK_RX_BATCH], err, i, j, n, num, queued = 0;
+	struct ptp_message *msg;
+
+	while (1) {
+		while (w->nbatch < SK_RX_BATCH) {
+			msg = free_pop(w);
+			if (!msg)
+				break;
+			w->batch[w->nbatch++] = msg;
+		}
+		n = w->nbatch;
+		if (!n) {
+			atomic_store(&w->starved, 1);
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			w->batch[i]->hwts.type = src->tt;
+		}
+		num = transport_recv_batch(src->trp, src->fd, w->batch, cnt, n);
+		err = num < 0;
+		if (err) {
+			/* Let the clock fault the port. */
+			cnt[0] = -1;
+			num = 1;
+		}
+		for (i = 0; i < num; i++) {
+			if (rx_push(w, src->port, w->batch[i], cnt[i])) {
+				pl_warning(60, "worker: queue full, "
+					   "dropping messages");
+				continue;
+			}
+			w->batch[i] = NULL;
+			queued++;
+		}
+		for (i = 0, j = 0; i < n; i++) {
+			if (w->batch[i])
+				w->batch[j++] = w->batch[i];
+		}
+		w->nbatch = j;
+		if (err || num < n)
+			break;
+	}
+	return queued;
+}
+
+static void worker_free_src(struct worker *w, struct worker_src *src)
+{
+	epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, src->fd, NULL);
+	free(src);
+}
+
+/* Returns non-zero when the thread should stop. */
+static int worker_command(struct worker *w)
+{
+	struct worker_src *src, **prev;
+	struct epoll_event ev;
+	int stop = 0;
+
+	pthread_mutex_lock(&w->lock);
+	switch (w->cmd) {
+	case CMD_NONE:
+		break;
+	case CMD_WATCH:
+		while ((src = w->cmd_src)) {
+			w->cmd_src = src->next;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN | EPOLLET;
+			ev.data.ptr = src;
+			if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, src->fd, &ev)) {
+				pr_err("worker: epoll_ctl failed: %m");
+				free(src);
+				w->cmd_err = -1;
+				continue;
+			}
+			src->next = w->sources;
+			w->sources = src;
+		}
+		break;
+	case CMD_FORGET:
+		prev = &w->sources;
+		while ((src = *prev)) {
+			if (src->port != w->cmd_port) {
+				prev = &src->next;
+				continue;
+			}
+			*prev = src->next;
+			worker_free_src(w, src);
+		}
+		break;
+	case CMD_STOP:
+		stop = 1;
+		break;
+	}
+	w->cmd = CMD_NONE;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	return stop;
+}
+
+static void *worker_run(void *arg)
+{
+	struct epoll_event ev[WORKER_EVENTS];
+	struct worker *w = arg;
+	struct worker_src *src;
+	int cnt, i, queued, wake;
+
+	while (1) {
+		cnt = epoll_wait(w->epoll_fd, ev, WORKER_EVENTS, -1);
+		if (cnt < 0) {
+			if (errno != EINTR)
+				pr_err("worker: epoll_wait failed: %m");
+			continue;
+		}
+		queued = 0;
+		wake = 0;
+		for (i = 0; i < cnt; i++) {
+			src = ev[i].data.ptr;
+			if (!src) {
+				wake = 1;
+				continue;
+			}
+			queued += worker_drain(w, src);
+		}
+		if (wake) {
+			worker_clear(w->ctl_fd);
+			if (worker_command(w))
+				break;
+			/*
+			 * New sockets may already hold messages, and the
+			 * buffers may have been refilled after running dry.
+			 */
+			for (src = w->sources; src; src = src->next) {
+				queued += worker_drain(w, src);
+			}
+		}
+		if (queued || atomic_load(&w->starved))
+			worker_signal(w->rx_fd);
+	}
+	return NULL;
+}
+
+/* Called by the clock's thread. */
+static int worker_request(struct worker *w, enum worker_cmd cmd,
+			  struct worker_src *src, struct port *p)
+{
+	int err;
+
+	pthread_mutex_lock(&w->lock);
+	w->cmd = cmd;
+	w->cmd_src = src;
+	w->cmd_port = p;
+	w->cmd_err = 0;
+	worker_signal(w->ctl_fd);
+	while (w->cmd != CMD_NONE) {
+		pthread_cond_wait(&w->cond, &w->lock);
+	}
+	err = w->cmd_err;
+	pthread_mutex_unlock(&w->lock);
+	return err;
+}
+
+struct worker *worker_create(int cpu)
+{
+	struct ptp_message *msg;
+	struct epoll_event ev;
+	struct worker *w;
+	sigset_t all, old;
+	cpu_set_t set;
+	int err;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+	w->ctl_fd = -1;
+	w->rx_fd = -1;
+
+	w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (w->epoll_fd < 0) {
+		pr_err("worker: epoll_create1 failed: %m");
+		goto no_epoll;
+	}
+	w->ctl_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	w->rx_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (w->ctl_fd < 0 || w->rx_fd < 0) {
+		pr_err("worker: eventfd failed: %m");
+		goto no_eventfd;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->ctl_fd, &ev)) {
+		pr_err("worker: epoll_ctl failed: %m");
+		goto no_eventfd;
+	}
+	atomic_init(&w->rx_head, 0);
+	atomic_init(&w->rx_tail, 0);
+	atomic_init(&w->free_head, 0);
+	atomic_init(&w->free_tail, 0);
+	atomic_init(&w->starved, 0);
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+
+	worker_ack(w);
+
+	/* Signals are for the main thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	err = pthread_create(&w->thread, NULL, worker_run, w);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		pr_err("worker: pthread_create failed: %s", strerror(err));
+		goto no_thread;
+	}
+	if (cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		err = pthread_setaffinity_np(w->thread, sizeof(set), &set);
+		if (err) {
+			pr_err("worker: failed to bind to cpu %d: %s",
+			       cpu, strerror(err));
+			worker_destroy(w);
+			return NULL;
+		}
+	}
+	return w;
+
+no_thread:
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	while ((msg = free_pop(w))) {
+		msg_put(msg);
+	}
+no_eventfd:
+	if (w->ctl_fd >= 0)
+		close(w->ctl_fd);
+	if (w->rx_fd >= 0)
+		close(w->rx_fd);
+	close(w->epoll_fd);
+no_epoll:
+	free(w);
+	return NULL;
+}
+
+void worker_destroy(struct worker *w)
+{
+	struct ptp_message *msg;
+	struct worker_src *src;
+	struct port *p;
+	int cnt, i;
+
+	worker_request(w, CMD_STOP, NULL, NULL);
+	pthread_join(w->thread, NULL);
+
+	while (worker_pop(w, &p, &msg, &cnt)) {
+		msg_put(msg);
+	}
+	while ((msg = free_pop(w))) {
+		msg_put(msg);
+	}
+	for (i = 0; i < w->nbatch; i++) {
+		msg_put(w->batch[i]);
+	}
+	while ((src = w->sources)) {
+		w->sources = src->next;
+		worker_free_src(w, src);
+	}
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	close(w->ctl_fd);
+	close(w->rx_fd);
+	close(w->epoll_fd);
+	free(w);
+}
+
+int worker_fd(struct worker *w)
+{
+	return w->rx_fd;
+}
+
+int worker_watch(struct worker *w, struct port *p, struct transport *t,
+		 enum timestamp_type tt, struct fdarray *fda)
+{
+	struct worker_src *src, *list = NULL;
+	int i;
+
+	/*
+	 * The worker uses the port's own descriptors, as the transport
+	 * may keep state per descriptor. The port closes them only after
+	 * worker_forget().
+	 */
+	for (i = FD_EVENT; i <= FD_GENERAL; i++) {
+		src = calloc(1, sizeof(*src));
+		if (!src)
+			goto err;
+		src->fd = fda->fd[i];
+		src->port = p;
+		src->trp = t;
+		src->tt = tt;
+		src->next = list;
+		list = src;
+	}
+	if (worker_request(w, CMD_WATCH, list, p)) {
+		worker_forget(w, p);
+		return -1;
+	}
+	return 0;
+err:
+	while ((src = list)) {
+		list = src->next;
+		free(src);
+	}
+	return -1;
+}
+
+void worker_forget(struct worker *w, struct port *p)
+{
+	struct worker_item *it;
+	unsigned int head, tail;
+
+	worker_request(w, CMD_FORGET, NULL, p);
+
+	/* The worker is done with the port, drop what it left behind. */
+	tail = atomic_load_explicit(&w->rx_tail, memory_order_relaxed);
+	head = atomic_load_explicit(&w->rx_head, memory_order_acquire);
+	for (; tail != head; tail++) {
+		it = &w->rxq[tail % WORKER_QLEN];
+		if (it->port == p) {
+			msg_put(it->msg);
+			it->port = NULL;
+		}
+	}
+}
+
+void worker_ack(struct worker *w)
+{
+	struct ptp_message *msg;
+	unsigned int head, tail;
+
+	worker_clear(w->rx_fd);
+
+	head = atomic_load_explicit(&w->free_head, memory_order_relaxed);
+	tail = atomic_load_explicit(&w->free_tail, memory_order_acquire);
+	while (head - tail < WORKER_QLEN) {
+		msg = msg_allocate();
+		if (!msg)
+			break;
+		w->freeq[head % WORKER_QLEN] = msg;
+		head++;
+	}
+	atomic_store_explicit(&w->free_head, head, memory_order_release);
+
+	if (atomic_exchange(&w->starved, 0))
+		worker_signal(w->ctl_fd);
+}
+
+int worker_pop(struct worker *w, struct port **p, struct ptp_message **msg,
+	       int *cnt)
+{
+	struct worker_item *it;
+	unsigned int head, tail;
+
+	tail = atomic_load_explicit(&w->rx_tail, memory_order_relaxed);
+	head = atomic_load_explicit(&w->rx_head, memory_order_acquire);
+	for (; tail != head; tail++) {
+		it = &w->rxq[tail % WORKER_QLEN];
+		if (!it->port)
+			continue;
+		*p = it->port;
+		*msg = it->msg;
+		*cnt = it->cnt;
+		atomic_store_explicit(&w->rx_tail, tail + 1,
+				      memory_order_release);
+		return 1;
+	}
+	atomic_store_explicit(&w->rx_tail, tail, memory_order_release);
+	return 0;
+}
+
+#else /* !HAVE_EPOLL */
+
+struct worker *worker_create(int cpu)
+{
+	pr_err("port threads are not supported without epoll");
+	return NULL;
+}
+
+void worker_destroy(struct worker *w)
+{
+}
+
+int worker_fd(struct worker *w)
+{
+	return -1;
+}
+
+int worker_watch(struct worker *w, struct port *p, struct transport *t,
+		 enum timestamp_type tt, struct fdarray *fda)
+{
+	return -1;
+}
+
+void worker_forget(struct worker *w, struct port *p)
+{
+}
+
+void worker_ack(struct worker *w)
+{
+}
+
+int worker_pop(struct worker *w, struct port **p, struct ptp_message **msg,
+	       int *cnt)
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,101 @@
+/**
+ * @file worker.h
+ * @brief Threads that receive messages on behalf of a group of ports.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_WORKER_H
+#define HAVE_WORKER_H
+
+#include "fd.h"
+#include "msg.h"
+#include "transport.h"
+
+struct port;
+
+/**
+ * A worker thread drains the event and general sockets of its ports
+ * and queues the received messages for the clock's thread, which owns
+ * all of the protocol state. Messages travel in lock free, single
+ * producer single consumer rings, one towards the clock carrying the
+ * received messages, and one towards the worker carrying empty buffers.
+ */
+struct worker;
+
+/**
+ * Create a new worker thread.
+ * @param cpu  The CPU to run the thread on, or -1 to leave it unbound.
+ * @return     A pointer to a new worker on success, NULL otherwise.
+ */
+struct worker *worker_create(int cpu);
+
+/**
+ * Stop a worker thread and free its resources. Any port being served
+ * must have been removed with worker_forget() beforehand.
+ * @param w  A pointer obtained via worker_create().
+ */
+void worker_destroy(struct worker *w);
+
+/**
+ * Obtain the descriptor that becomes readable when the worker has
+ * queued messages.
+ * @param w  The worker.
+ * @return   An eventfd descriptor.
+ */
+int worker_fd(struct worker *w);
+
+/**
+ * Start receiving on the event and general sockets of a port.
+ * @param w    The worker.
+ * @param p    The port that owns the sockets.
+ * @param t    The port's transport.
+ * @param tt   The port's time stamping mode.
+ * @param fda  The port's descriptors, as filled in by transport_open.
+ * @return     Zero on success, non-zero otherwise.
+ */
+int worker_watch(struct worker *w, struct port *p, struct transport *t,
+		 enum timestamp_type tt, struct fdarray *fda);
+
+/**
+ * Stop receiving for a port. When this returns, the worker no longer
+ * uses the port's sockets, and every message that was queued for the
+ * port has been released.
+ * @param w  The worker.
+ * @param p  The port passed to worker_watch().
+ */
+void worker_forget(struct worker *w, struct port *p);
+
+/**
+ * Acknowledge that worker_fd() became readable, and give the worker
+ * fresh buffers in place of the ones it has consumed. To be called by
+ * the clock's thread before taking the queued messages.
+ * @param w  The worker.
+ */
+void worker_ack(struct worker *w);
+
+/**
+ * Take the next received message from a worker's queue.
+ * @param w    The worker.
+ * @param p    Set to the port that received the message.
+ * @param msg  Set to the message, whose reference passes to the caller.
+ * @param cnt  Set to the length of the message, or to a negative value
+ *             if the message could not be received.
+ * @return     One if a message was taken, zero if the queue is empty.
+ */
+int worker_pop(struct worker *w, struct port **p, struct ptp_message **msg,
+	       int *cnt);
+
+#endif
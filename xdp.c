@@ -0,0 +1,686 @@
+/**
+ * @file xdp.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_ether.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_AF_XDP
+#include <linux/bpf.h>
+#include <linux/if_xdp.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "address.h"
+#include "config.h"
+#include "contain.h"
+#include "ether.h"
+#include "print.h"
+#include "raw.h"
+#include "sk.h"
+#include "tmv.h"
+#include "transport_private.h"
+#include "util.h"
+#include "xdp.h"
+
+#ifdef HAVE_AF_XDP
+
+/*
+ * The event messages arrive on an AF_XDP socket bound to one queue of
+ * the interface. The general messages, which carry no time stamps, take
+ * the normal path through a packet socket.
+ */
+#define XDP_FRAME_SIZE	2048
+#define XDP_RING_SIZE	64
+#define XDP_FRAMES	(2 * XDP_RING_SIZE) /* first half RX, then TX */
+#define XDP_META_LEN	8
+#define XDP_TXTS_QUEUE	16
+
+#define PTP_GEN_BIT 0x08 /* indicates general message, if set in message type */
+
+struct xdp_ring {
+	uint32_t *producer;
+	uint32_t *consumer;
+	void *desc;
+	void *map;
+	size_t len;
+};
+
+struct xdp_txts {
+	unsigned int id;
+	struct timespec ts;
+};
+
+struct xdp {
+	struct transport t;
+	struct address src_addr;
+	struct address ptp_addr;
+	struct address p2p_addr;
+	int ifindex;
+	int fd;
+	int map_fd;
+	int prog_fd;
+	int link_fd;
+	unsigned char *umem;
+	struct xdp_ring rx;
+	struct xdp_ring tx;
+	struct xdp_ring fill;
+	struct xdp_ring comp;
+	uint64_t tx_free[XDP_RING_SIZE];
+	int tx_nfree;
+	/* time stamps of the messages sent with TRANS_DEFER */
+	struct xdp_txts txts[XDP_TXTS_QUEUE];
+	int txts_head;
+	int txts_count;
+};
+
+#define INSN(c, d, s, o, i) \
+	{ .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) }
+
+#define OP_MOVX  (BPF_ALU64 | BPF_MOV | BPF_X)
+#define OP_MOVK  (BPF_ALU64 | BPF_MOV | BPF_K)
+#define OP_ADDK  (BPF_ALU64 | BPF_ADD | BPF_K)
+#define OP_ANDK  (BPF_ALU64 | BPF_AND | BPF_K)
+#define OP_LDXB  (BPF_LDX | BPF_B | BPF_MEM)
+#define OP_LDXH  (BPF_LDX | BPF_H | BPF_MEM)
+#define OP_LDXW  (BPF_LDX | BPF_W | BPF_MEM)
+#define OP_STXDW (BPF_STX | BPF_DW | BPF_MEM)
+#define OP_LDDW  (BPF_LD | BPF_DW | BPF_IMM)
+#define OP_JGTX  (BPF_JMP | BPF_JGT | BPF_X)
+#define OP_JNEK  (BPF_JMP | BPF_JNE | BPF_K)
+#define OP_CALL  (BPF_JMP | BPF_CALL)
+#define OP_EXIT  (BPF_JMP | BPF_EXIT)
+
+#define N_XDP_PROG	30
+#define XDP_PROG_ETYPE	7
+#define XDP_PROG_MAP	23
+
+/*
+ * Redirects the untagged PTP event messages to the socket bound to the
+ * receiving queue, with their arrival time on CLOCK_TAI placed in front
+ * of the frame. Everything else passes on to the network stack.
+ */
+static struct bpf_insn xdp_prog[N_XDP_PROG] = {
+	INSN(OP_MOVX,  6, 1, 0, 0),                /* r6 = ctx */
+	INSN(OP_LDXW,  2, 6, 0, 0),                /* r2 = data */
+	INSN(OP_LDXW,  3, 6, 4, 0),                /* r3 = data_end */
+	INSN(OP_MOVX,  4, 2, 0, 0),
+	INSN(OP_ADDK,  4, 0, 0, ETH_HLEN + 1),
+	INSN(OP_JGTX,  4, 3, 22, 0),               /* goto pass */
+	INSN(OP_LDXH,  4, 2, OFF_ETYPE, 0),
+	INSN(OP_JNEK,  4, 0, 20, 0),               /* goto pass */
+	INSN(OP_LDXB,  4, 2, ETH_HLEN, 0),         /* messageType */
+	INSN(OP_ANDK,  4, 0, 0, PTP_GEN_BIT),
+	INSN(OP_JNEK,  4, 0, 17, 0),               /* goto pass */
+	INSN(OP_MOVX,  1, 6, 0, 0),
+	INSN(OP_MOVK,  2, 0, 0, -XDP_META_LEN),
+	INSN(OP_CALL,  0, 0, 0, BPF_FUNC_xdp_adjust_meta),
+	INSN(OP_JNEK,  0, 0, 13, 0),               /* goto pass */
+	INSN(OP_CALL,  0, 0, 0, BPF_FUNC_ktime_get_tai_ns),
+	INSN(OP_LDXW,  2, 6, 0, 0),                /* r2 = data */
+	INSN(OP_LDXW,  3, 6, 8, 0),                /* r3 = data_meta */
+	INSN(OP_MOVX,  4, 3, 0, 0),
+	INSN(OP_ADDK,  4, 0, 0, XDP_META_LEN),
+	INSN(OP_JGTX,  4, 2, 7, 0),                /* goto pass */
+	INSN(OP_STXDW, 3, 0, 0, 0),                /* *data_meta = r0 */
+	INSN(OP_LDXW,  2, 6, 16, 0),               /* r2 = rx_queue_index */
+	INSN(OP_LDDW,  1, BPF_PSEUDO_MAP_FD, 0, 0),/* r1 = map */
+	INSN(0,        0, 0, 0, 0),
+	INSN(OP_MOVK,  3, 0, 0, XDP_PASS),
+	INSN(OP_CALL,  0, 0, 0, BPF_FUNC_redirect_map),
+	INSN(OP_EXIT,  0, 0, 0, 0),
+	INSN(OP_MOVK,  0, 0, 0, XDP_PASS),         /* pass: */
+	INSN(OP_EXIT,  0, 0, 0, 0),
+};
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static void mac_to_addr(struct address *addr, void *mac)
+{
+	addr->sll.sll_family = AF_PACKET;
+	addr->sll.sll_halen = MAC_LEN;
+	memcpy(addr->sll.sll_addr, mac, MAC_LEN);
+	addr->len = sizeof(addr->sll);
+}
+
+static void addr_to_mac(void *mac, struct address *addr)
+{
+	memcpy(mac, &addr->sll.sll_addr, MAC_LEN);
+}
+
+static int xdp_ring_map(struct xdp_ring *r, int fd,
+			struct xdp_ring_offset *off, off_t pgoff, size_t size)
+{
+	unsigned char *map;
+
+	r->len = off->desc + XDP_RING_SIZE * size;
+	map = mmap(NULL, r->len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (map == MAP_FAILED) {
+		pr_err("xdp: mmap ring failed: %m");
+		return -1;
+	}
+	r->map = map;
+	r->producer = (uint32_t *) (map + off->producer);
+	r->consumer = (uint32_t *) (map + off->consumer);
+	r->desc = map + off->desc;
+	return 0;
+}
+
+static void xdp_ring_unmap(struct xdp_ring *r)
+{
+	if (r->map)
+		munmap(r->map, r->len);
+	memset(r, 0, sizeof(*r));
+}
+
+static void xdp_teardown(struct xdp *xdp)
+{
+	if (xdp->link_fd >= 0)
+		close(xdp->link_fd);
+	if (xdp->prog_fd >= 0)
+		close(xdp->prog_fd);
+	if (xdp->map_fd >= 0)
+		close(xdp->map_fd);
+	xdp_ring_unmap(&xdp->rx);
+	xdp_ring_unmap(&xdp->tx);
+	xdp_ring_unmap(&xdp->fill);
+	xdp_ring_unmap(&xdp->comp);
+	if (xdp->fd >= 0)
+		close(xdp->fd);
+	if (xdp->umem)
+		munmap(xdp->umem, XDP_FRAMES * XDP_FRAME_SIZE);
+	xdp->link_fd = xdp->prog_fd = xdp->map_fd = xdp->fd = -1;
+	xdp->umem = NULL;
+}
+
+static int xdp_socket(struct xdp *xdp, int queue)
+{
+	struct xdp_umem_reg reg;
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp;
+	socklen_t optlen;
+	uint64_t *fill;
+	int i, size = XDP_RING_SIZE;
+
+	xdp->umem = mmap(NULL, XDP_FRAMES * XDP_FRAME_SIZE,
+			 PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (xdp->umem == MAP_FAILED) {
+		xdp->umem = NULL;
+		pr_err("xdp: mmap umem failed: %m");
+		return -1;
+	}
+	xdp->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (xdp->fd < 0) {
+		pr_err("xdp: socket failed: %m");
+		return -1;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (uintptr_t) xdp->umem;
+	reg.len = XDP_FRAMES * XDP_FRAME_SIZE;
+	reg.chunk_size = XDP_FRAME_SIZE;
+	if (setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) ||
+	    setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) ||
+	    setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) ||
+	    setsockopt(xdp->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) ||
+	    setsockopt(xdp->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size))) {
+		pr_err("xdp: setting up the umem failed: %m");
+		return -1;
+	}
+
+	optlen = sizeof(off);
+	if (getsockopt(xdp->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen)) {
+		pr_err("xdp: getsockopt XDP_MMAP_OFFSETS failed: %m");
+		return -1;
+	}
+	if (xdp_ring_map(&xdp->rx, xdp->fd, &off.rx, XDP_PGOFF_RX_RING,
+			 sizeof(struct xdp_desc)) ||
+	    xdp_ring_map(&xdp->tx, xdp->fd, &off.tx, XDP_PGOFF_TX_RING,
+			 sizeof(struct xdp_desc)) ||
+	    xdp_ring_map(&xdp->fill, xdp->fd, &off.fr,
+			 XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t)) ||
+	    xdp_ring_map(&xdp->comp, xdp->fd, &off.cr,
+			 XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(uint64_t))) {
+		return -1;
+	}
+
+	fill = xdp->fill.desc;
+	for (i = 0; i < XDP_RING_SIZE; i++) {
+		fill[i] = (uint64_t) i * XDP_FRAME_SIZE;
+		xdp->tx_free[i] = (uint64_t) (XDP_RING_SIZE + i) * XDP_FRAME_SIZE;
+	}
+	xdp->tx_nfree = XDP_RING_SIZE;
+	__atomic_store_n(xdp->fill.producer, XDP_RING_SIZE, __ATOMIC_RELEASE);
+
+	/* Zero copy when the driver supports it, copy mode otherwise. */
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = xdp->ifindex;
+	sxdp.sxdp_queue_id = queue;
+	if (bind(xdp->fd, (struct sockaddr *) &sxdp, sizeof(sxdp))) {
+		pr_err("xdp: bind to queue %d failed: %m", queue);
+		return -1;
+	}
+	return 0;
+}
+
+static int xdp_attach(struct xdp *xdp, int queue)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(int);
+	attr.value_size = sizeof(int);
+	attr.max_entries = queue + 1;
+	xdp->map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (xdp->map_fd < 0) {
+		pr_err("xdp: creating the socket map failed: %m");
+		return -1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = xdp->map_fd;
+	attr.key = (uintptr_t) &queue;
+	attr.value = (uintptr_t) &xdp->fd;
+	if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr)) {
+		pr_err("xdp: adding the socket to the map failed: %m");
+		return -1;
+	}
+
+	xdp_prog[XDP_PROG_ETYPE].imm = htons(ETH_P_1588);
+	xdp_prog[XDP_PROG_MAP].imm = xdp->map_fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t) xdp_prog;
+	attr.insn_cnt = N_XDP_PROG;
+	attr.license = (uintptr_t) "GPL";
+	xdp->prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (xdp->prog_fd < 0) {
+		pr_err("xdp: loading the program failed: %m");
+		return -1;
+	}
+
+	/* The program is detached once the link is closed. */
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = xdp->prog_fd;
+	attr.link_create.target_ifindex = xdp->ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	xdp->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+	if (xdp->link_fd < 0) {
+		pr_err("xdp: attaching the program failed: %m");
+		return -1;
+	}
+	return 0;
+}
+
+static int xdp_close(struct transport *t, struct fdarray *fda)
+{
+	struct xdp *xdp = container_of(t, struct xdp, t);
+
+	xdp_teardown(xdp);
+	close(fda->fd[FD_GENERAL]);
+	return 0;
+}
+
+static int xdp_open(struct transport *t, const char *name,
+		    struct fdarray *fda, enum timestamp_type ts_type)
+{
+	struct xdp *xdp = container_of(t, struct xdp, t);
+	unsigned char ptp_dst_mac[MAC_LEN];
+	unsigned char p2p_dst_mac[MAC_LEN];
+	int gfd, queue;
+	char *str;
+
+	if (ts_type != TS_SOFTWARE) {
+		pr_err("xdp: only software time stamping is supported");
+		return -1;
+	}
+	str = config_get_string(t->cfg, name, "ptp_dst_mac");
+	if (str2mac(str, ptp_dst_mac)) {
+		pr_err("invalid ptp_dst_mac %s", str);
+		return -1;
+	}
+	str = config_get_string(t->cfg, name, "p2p_dst_mac");
+	if (str2mac(str, p2p_dst_mac)) {
+		pr_err("invalid p2p_dst_mac %s", str);
+		return -1;
+	}
+	mac_to_addr(&xdp->ptp_addr, ptp_dst_mac);
+	mac_to_addr(&xdp->p2p_addr, p2p_dst_mac);
+
+	if (sk_interface_macaddr(name, &xdp->src_addr))
+		return -1;
+
+	/* Also joins the multicast groups on behalf of the event socket. */
+	gfd = raw_open_socket(name, 0, ptp_dst_mac, p2p_dst_mac);
+	if (gfd < 0)
+		return -1;
+	if (sk_general_init(gfd))
+		goto no_xdp;
+
+	xdp->ifindex = sk_interface_index(gfd, name);
+	if (xdp->ifindex < 0)
+		goto no_xdp;
+
+	queue = config_get_int(t->cfg, name, "xdp_queue");
+	if (xdp_socket(xdp, queue) || xdp_attach(xdp, queue))
+		goto no_xdp;
+
+	xdp->txts_head = 0;
+	xdp->txts_count = 0;
+	fda->fd[FD_EVENT] = xdp->fd;
+	fda->fd[FD_GENERAL] = gfd;
+	return 0;
+
+no_xdp:
+	xdp_teardown(xdp);
+	close(gfd);
+	return -1;
+}
+
+/*
+ * The program reads CLOCK_TAI, which differs from CLOCK_REALTIME by
+ * whole seconds.
+ */
+static void xdp_tai_to_realtime(uint64_t tai, struct timespec *ts)
+{
+	struct timespec rt, ta;
+	int64_t offset;
+
+	clock_gettime(CLOCK_REALTIME, &rt);
+	clock_gettime(CLOCK_TAI, &ta);
+	offset = (ta.tv_sec - rt.tv_sec) * NS_PER_SEC + ta.tv_nsec - rt.tv_nsec;
+	offset = (offset + NS_PER_SEC / 2) / NS_PER_SEC * NS_PER_SEC;
+	tai -= offset;
+	ts->tv_sec = tai / NS_PER_SEC;
+	ts->tv_nsec = tai % NS_PER_SEC;
+}
+
+static int xdp_recv_event(struct xdp *xdp, void *buf, int buflen,
+			  struct address *addr, struct hw_timestamp *hwts)
+{
+	struct xdp_desc *desc;
+	struct eth_hdr *hdr;
+	uint32_t cons, prod;
+	uint64_t *fill, tai;
+	unsigned char *frame;
+	int cnt;
+
+	cons = *xdp->rx.consumer;
+	prod = __atomic_load_n(xdp->rx.producer, __ATOMIC_ACQUIRE);
+	if (cons == prod) {
+		errno = EAGAIN;
+		return -1;
+	}
+	desc = (struct xdp_desc *) xdp->rx.desc + (cons & (XDP_RING_SIZE - 1));
+	frame = xdp->umem + desc->addr;
+	hdr = (struct eth_hdr *) frame;
+
+	cnt = desc->len - sizeof(*hdr);
+	if (cnt > buflen)
+		cnt = buflen;
+	if (cnt > 0)
+		memcpy(buf, frame + sizeof(*hdr), cnt);
+
+	if (addr) {
+		memset(addr, 0, sizeof(*addr));
+		mac_to_addr(addr, &hdr->src);
+		addr->sll.sll_protocol = htons(ETH_P_1588);
+		addr->sll.sll_ifindex = xdp->ifindex;
+	}
+	memcpy(&tai, frame - XDP_META_LEN, sizeof(tai));
+	xdp_tai_to_realtime(tai, &hwts->ts);
+	hwts->id_valid = 0;
+
+	/* Every RX frame is either in the fill ring or being read here. */
+	fill = xdp->fill.desc;
+	prod = *xdp->fill.producer;
+	fill[prod & (XDP_RING_SIZE - 1)] =
+		desc->addr - desc->addr % XDP_FRAME_SIZE;
+	__atomic_store_n(xdp->rx.consumer, cons + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(xdp->fill.producer, prod + 1, __ATOMIC_RELEASE);
+
+	return cnt < 0 ? -1 : cnt;
+}
+
+static int xdp_recv(struct transport *t, int fd, void *buf, int buflen,
+		    struct address *addr, struct hw_timestamp *hwts)
+{
+	struct xdp *xdp = container_of(t, struct xdp, t);
+	unsigned char *ptr = buf;
+	struct eth_hdr *hdr;
+	int cnt, hlen;
+
+	if (fd == xdp->fd)
+		return xdp_recv_event(xdp, buf, buflen, addr, hwts);
+
+	hlen = sizeof(*hdr);
+	ptr    -= hlen;
+	buflen += hlen;
+	hdr = (struct eth_hdr *) ptr;
+
+	cnt = sk_receive(fd, ptr, buflen, addr, hwts, 0);
+	if (cnt < hlen)
+		return -1;
+	cnt -= hlen;
+
+	/* The general messages may still arrive with a VLAN tag. */
+	if (ETH_P_8021Q == ntohs(hdr->type)) {
+		if (cnt < VLAN_HLEN)
+			return -1;
+		cnt -= VLAN_HLEN;
+		memmove(buf, (unsigned char *) buf + VLAN_HLEN, cnt);
+	}
+	return cnt;
+}
+
+static uint64_t *xdp_tx_frame(struct xdp *xdp)
+{
+	uint64_t *comp = xdp->comp.desc;
+	uint32_t cons, prod;
+
+	cons = *xdp->comp.consumer;
+	prod = __atomic_load_n(xdp->comp.producer, __ATOMIC_ACQUIRE);
+	while (cons != prod) {
+		xdp->tx_free[xdp->tx_nfree++] =
+			comp[cons++ & (XDP_RING_SIZE - 1)];
+	}
+	__atomic_store_n(xdp->comp.consumer, cons, __ATOMIC_RELEASE);
+
+	return xdp->tx_nfree ? &xdp->tx_free[--xdp->tx_nfree] : NULL;
+}
+
+static int xdp_send_event(struct xdp *xdp, int event, int peer, void *buf,
+			  int len, struct address *addr,
+			  struct hw_timestamp *hwts)
+{
+	struct timespec before, after;
+	struct xdp_txts *txts;
+	struct xdp_desc *desc;
+	struct eth_hdr *hdr;
+	uint64_t *frame;
+	uint32_t prod;
+	int64_t ns;
+
+	if (len + sizeof(*hdr) > XDP_FRAME_SIZE)
+		return -1;
+	if (event == TRANS_DEFER && xdp->txts_count == XDP_TXTS_QUEUE) {
+		pr_err("xdp: too many pending tx timestamps");
+		return -1;
+	}
+	frame = xdp_tx_frame(xdp);
+	if (!frame) {
+		pr_err("xdp: transmit ring full");
+		return -1;
+	}
+	if (!addr)
+		addr = peer ? &xdp->p2p_addr : &xdp->ptp_addr;
+
+	hdr = (struct eth_hdr *) (xdp->umem + *frame);
+	addr_to_mac(&hdr->dst, addr);
+	addr_to_mac(&hdr->src, &xdp->src_addr);
+	hdr->type = htons(ETH_P_1588);
+	memcpy(hdr + 1, buf, len);
+
+	prod = *xdp->tx.producer;
+	desc = (struct xdp_desc *) xdp->tx.desc + (prod & (XDP_RING_SIZE - 1));
+	desc->addr = *frame;
+	desc->len = len + sizeof(*hdr);
+	desc->options = 0;
+	__atomic_store_n(xdp->tx.producer, prod + 1, __ATOMIC_RELEASE);
+
+	/*
+	 * There is no transmit time stamp from the driver. The frame
+	 * leaves somewhere within the kick, so take its middle.
+	 */
+	clock_gettime(CLOCK_REALTIME, &before);
+	if (sendto(xdp->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+	    errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+		pr_err("xdp: sendto failed: %m");
+		return -1;
+	}
+	clock_gettime(CLOCK_REALTIME, &after);
+	ns = (tmv_to_nanoseconds(timespec_to_tmv(before)) +
+	      tmv_to_nanoseconds(timespec_to_tmv(after))) / 2;
+	hwts->ts.tv_sec = ns / NS_PER_SEC;
+	hwts->ts.tv_nsec = ns % NS_PER_SEC;
+	hwts->id = xdp->t.txid++;
+	hwts->id_valid = 0;
+
+	if (event == TRANS_DEFER) {
+		txts = &xdp->txts[(xdp->txts_head + xdp->txts_count) %
+				  XDP_TXTS_QUEUE];
+		txts->id = hwts->id;
+		txts->ts = hwts->ts;
+		xdp->txts_count++;
+	}
+	return len;
+}
+
+static int xdp_send(struct transport *t, struct fdarray *fda, int event,
+		    int peer, void *buf, int len, struct address *addr,
+		    struct hw_timestamp *hwts)
+{
+	struct xdp *xdp = container_of(t, struct xdp, t);
+	unsigned char *ptr = buf;
+	struct eth_hdr *hdr;
+	ssize_t cnt;
+
+	if (event)
+		return xdp_send_event(xdp, event, peer, buf, len, addr, hwts);
+
+	ptr -= sizeof(*hdr);
+	len += sizeof(*hdr);
+
+	if (!addr)
+		addr = peer ? &xdp->p2p_addr : &xdp->ptp_addr;
+
+	hdr = (struct eth_hdr *) ptr;
+	addr_to_mac(&hdr->dst, addr);
+	addr_to_mac(&hdr->src, &xdp->src_addr);
+	hdr->type = htons(ETH_P_1588);
+
+	cnt = send(fda->fd[FD_GENERAL], ptr, len, 0);
+	if (cnt < 1) {
+		pr_err("send failed: %d %m", errno);
+	}
+	return cnt;
+}
+
+static int xdp_txts(struct transport *t, struct fdarray *fda, void *buf,
+		    int *len, struct hw_timestamp *hwts)
+{
+	struct xdp *xdp = container_of(t, struct xdp, t);
+	struct xdp_txts *txts;
+
+	if (!xdp->txts_count)
+		return 0;
+	txts = &xdp->txts[xdp->txts_head];
+	xdp->txts_head = (xdp->txts_head + 1) % XDP_TXTS_QUEUE;
+	xdp->txts_count--;
+
+	hwts->ts = txts->ts;
+	hwts->id = txts->id;
+	hwts->id_valid = 1;
+	*len = 0;
+	return 1;
+}
+
+static void xdp_release(struct transport *t)
+{
+	struct xdp *xdp = container_of(t, struct xdp, t);
+	free(xdp);
+}
+
+static int xdp_physical_addr(struct transport *t, uint8_t *addr)
+{
+	struct xdp *xdp = container_of(t, struct xdp, t);
+	addr_to_mac(addr, &xdp->src_addr);
+	return MAC_LEN;
+}
+
+static int xdp_protocol_addr(struct transport *t, uint8_t *addr)
+{
+	struct xdp *xdp = container_of(t, struct xdp, t);
+	addr_to_mac(addr, &xdp->src_addr);
+	return MAC_LEN;
+}
+
+struct transport *xdp_transport_create(void)
+{
+	struct xdp *xdp;
+	xdp = calloc(1, sizeof(*xdp));
+	if (!xdp)
+		return NULL;
+	xdp->t.close   = xdp_close;
+	xdp->t.open    = xdp_open;
+	xdp->t.recv    = xdp_recv;
+	xdp->t.send    = xdp_send;
+	xdp->t.txts    = xdp_txts;
+	xdp->t.release = xdp_release;
+	xdp->t.physical_addr = xdp_physical_addr;
+	xdp->t.protocol_addr = xdp_protocol_addr;
+	xdp->fd = -1;
+	xdp->map_fd = -1;
+	xdp->prog_fd = -1;
+	xdp->link_fd = -1;
+	return &xdp->t;
+}
+
+#else /* !HAVE_AF_XDP */
+
+struct transport *xdp_transport_create(void)
+{
+	pr_err("the XDP transport is not supported by this build");
+	return NULL;
+}
+
+#endif